@@ -91,9 +91,12 @@ static inline pmd_t *pmd_alloc_one(struct mm_struct *mm, unsigned long addr)
 	struct page *page;
 	gfp_t gfp = GFP_KERNEL_ACCOUNT | __GFP_ZERO;
 
-	if (mm == &init_mm)
+	if (mm == &init_mm) {
 		gfp &= ~__GFP_ACCOUNT;
-	page = alloc_pages(gfp, 0);
+		page = alloc_pages(gfp, 0);
+	} else {
+		page = alloc_pgtable_page(gfp);
+	}
 	if (!page)
 		return NULL;
 	if (!pgtable_pmd_page_ctor(page)) {
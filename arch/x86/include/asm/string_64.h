@@ -87,6 +87,12 @@ __must_check unsigned long __memcpy_mcsafe(void *dst, const void *src,
 		size_t cnt);
 DECLARE_STATIC_KEY_FALSE(mcsafe_key);
 
+/* vectorized __memcpy_mcsafe(), see mm/copy_mcsafe.c */
+#define MCSAFE_VEC_MIN	1024
+__must_check unsigned long memcpy_mcsafe_vec(void *dst, const void *src,
+		size_t cnt);
+DECLARE_STATIC_KEY_FALSE(mcsafe_vec_key);
+
 /**
  * memcpy_mcsafe - copy memory with indication if a machine check happened
  *
@@ -106,9 +112,12 @@ static __always_inline __must_check unsigned long
 memcpy_mcsafe(void *dst, const void *src, size_t cnt)
 {
 #ifdef CONFIG_X86_MCE
-	if (static_branch_unlikely(&mcsafe_key))
+	if (static_branch_unlikely(&mcsafe_key)) {
+		if (static_branch_unlikely(&mcsafe_vec_key) &&
+		    cnt >= MCSAFE_VEC_MIN)
+			return memcpy_mcsafe_vec(dst, src, cnt);
 		return __memcpy_mcsafe(dst, src, cnt);
-	else
+	} else
 #endif
 		memcpy(dst, src, cnt);
 	return 0;
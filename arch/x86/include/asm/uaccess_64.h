@@ -46,11 +46,17 @@ copy_user_generic(void *to, const void *from, unsigned len)
 	return ret;
 }
 
+__must_check unsigned long copy_to_user_mcsafe_vec(void *to, const void *from,
+		size_t cnt);
+
 static __always_inline __must_check unsigned long
 copy_to_user_mcsafe(void *to, const void *from, unsigned len)
 {
 	unsigned long ret;
 
+	if (static_branch_unlikely(&mcsafe_vec_key) && len >= MCSAFE_VEC_MIN)
+		return copy_to_user_mcsafe_vec(to, from, len);
+
 	__uaccess_begin();
 	/*
 	 * Note, __memcpy_mcsafe() is explicitly used since it can
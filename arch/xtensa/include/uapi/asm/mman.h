@@ -105,6 +105,8 @@
 
 #define MADV_COLD	20		/* deactivate these pages */
 #define MADV_PAGEOUT	21		/* reclaim these pages */
+#define MADV_PROMOTE	22		/* move these pages to the fast tier */
+#define MADV_DEMOTE	23		/* move these pages to the slow tier */
 
 /* compatibility flags */
 #define MAP_FILE	0
@@ -20,6 +20,7 @@
 #include <linux/pm_runtime.h>
 #include <linux/swap.h>
 #include <linux/slab.h>
+#include <linux/memory_tier.h>
 
 static struct bus_type node_subsys = {
 	.name = "node",
@@ -197,6 +198,9 @@ void node_set_perf_attrs(unsigned int nid, struct node_hmem_attrs *hmem_attrs,
 		return;
 
 	c->hmem_attrs = *hmem_attrs;
+	/* access class 0 is the best performing initiator */
+	if (access == 0)
+		memory_tier_set_perf(nid, hmem_attrs);
 	for (i = 0; access_attrs[i] != NULL; i++) {
 		if (sysfs_add_file_to_group(&c->dev.kobj, access_attrs[i],
 					    "initiators")) {
@@ -11,6 +11,9 @@
 #include <linux/fs.h>
 #include <linux/mm.h>
 #include <linux/mman.h>
+#include <linux/memory_hotplug.h>
+#include <linux/memory_tier.h>
+#include <linux/node.h>
 #include "dax-private.h"
 #include "bus.h"
 
@@ -20,17 +23,55 @@
  * 
  * While migrating a page we need to know whether the destination
  * node is PMEM node or DRAM node along with if it's a local node or
- * a remote one. For that we maintain two arrays: 
- * IS_PMEM_NODE and CLOSEST_CPU_NODE_FOR_PMEM both of size MAX_NUMNODES
- * 
- * IS_PMEM_NODE[x] stores if NUMA node x is a memory only NUMA node backed by PMEM
- * CLOSEST_CPU_NODE_FOR_PMEM[x] stores a closest CPU node for PMEM NUMA node x
- * 
- * So, if a new PMEM region is hotplugged as node x we need to update CLOSEST_CPU_NODE_FOR_PMEM[x].
- * So, CLOSEST_CPU_NODE_FOR_PMEM_INITIALIZED maintains a bit if such an update is needed.
+ * a remote one. Nodes onlined here are registered in the slow memory
+ * tier (mm/memory_tier.c), the PMEM topology then finds their closest
+ * CPU node.
+ *
+ * The memory is onlined into ZONE_MOVABLE so that its pages can always be
+ * migrated out again, unless online_movable=0, which leaves the onlining
+ * to memhp_auto_online and the administrator. When the firmware reported
+ * no performance attributes for the node, the ones given as parameters
+ * are registered with the tier instead.
  */
-extern char IS_PMEM_NODE[MAX_NUMNODES];
-extern int CLOSEST_CPU_NODE_FOR_PMEM_INITIALIZED;
+
+static bool online_movable = true;
+module_param(online_movable, bool, 0644);
+MODULE_PARM_DESC(online_movable, "Online the memory into ZONE_MOVABLE");
+
+static unsigned int read_bandwidth;
+module_param(read_bandwidth, uint, 0644);
+MODULE_PARM_DESC(read_bandwidth, "Read bandwidth (MB/s) without firmware attributes");
+
+static unsigned int write_bandwidth;
+module_param(write_bandwidth, uint, 0644);
+MODULE_PARM_DESC(write_bandwidth, "Write bandwidth (MB/s) without firmware attributes");
+
+static unsigned int read_latency;
+module_param(read_latency, uint, 0644);
+MODULE_PARM_DESC(read_latency, "Read latency (ns) without firmware attributes");
+
+static unsigned int write_latency;
+module_param(write_latency, uint, 0644);
+MODULE_PARM_DESC(write_latency, "Write latency (ns) without firmware attributes");
+
+static void dev_dax_kmem_set_perf(int numa_node)
+{
+	struct node_hmem_attrs attrs = {
+		.read_bandwidth = READ_ONCE(read_bandwidth),
+		.write_bandwidth = READ_ONCE(write_bandwidth),
+		.read_latency = READ_ONCE(read_latency),
+		.write_latency = READ_ONCE(write_latency),
+	};
+	struct node_hmem_attrs fw;
+
+	if (!attrs.read_bandwidth && !attrs.write_bandwidth &&
+	    !attrs.read_latency && !attrs.write_latency)
+		return;
+	if (memory_tier_get_perf(numa_node, &fw))
+		return;
+
+	memory_tier_set_perf(numa_node, &attrs);
+}
 
 int dev_dax_kmem_probe(struct device *dev)
 {
@@ -56,10 +97,7 @@ int dev_dax_kmem_probe(struct device *dev)
 		return -EINVAL;
 	}
 	
-	if(numa_node<MAX_NUMNODES){
-		CLOSEST_CPU_NODE_FOR_PMEM_INITIALIZED = 0;
-		IS_PMEM_NODE[numa_node] = 1;
-	}
+	memory_tier_set(numa_node, MEMORY_TIER_SRC_DRIVER, MEMORY_TIER_SLOW);
 
 	/* Hotplug starting at the beginning of the next block: */
 	kmem_start = ALIGN(res->start, memory_block_size_bytes());
@@ -88,7 +126,13 @@ int dev_dax_kmem_probe(struct device *dev)
 	new_res->flags = IORESOURCE_SYSTEM_RAM;
 	new_res->name = dev_name(dev);
 
-	rc = add_memory(numa_node, new_res->start, resource_size(new_res));
+	if (online_movable)
+		rc = add_memory_online(numa_node, new_res->start,
+				       resource_size(new_res),
+				       MMOP_ONLINE_MOVABLE);
+	else
+		rc = add_memory(numa_node, new_res->start,
+				resource_size(new_res));
 	if (rc) {
 		release_resource(new_res);
 		kfree(new_res);
@@ -96,6 +140,8 @@ int dev_dax_kmem_probe(struct device *dev)
 	}
 	dev_dax->dax_kmem_res = new_res;
 
+	dev_dax_kmem_set_perf(numa_node);
+
 	return 0;
 }
 
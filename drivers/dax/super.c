@@ -360,6 +360,24 @@ void dax_flush(struct dax_device *dax_dev, void *addr, size_t size)
 #endif
 EXPORT_SYMBOL_GPL(dax_flush);
 
+/*
+ * Write back every CPU cache instead of flushing a range line by line, for
+ * flushes so large that this is cheaper. Returns false if the architecture
+ * cannot, the caller then falls back to dax_flush().
+ */
+bool dax_flush_all(struct dax_device *dax_dev)
+{
+	if (unlikely(!dax_write_cache_enabled(dax_dev)))
+		return true;
+#ifdef CONFIG_X86
+	wbinvd_on_all_cpus();
+	return true;
+#else
+	return false;
+#endif
+}
+EXPORT_SYMBOL_GPL(dax_flush_all);
+
 void dax_write_cache(struct dax_device *dax_dev, bool wc)
 {
 	if (wc)
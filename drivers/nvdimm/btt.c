@@ -19,6 +19,12 @@
 #include "btt.h"
 #include "nd.h"
 
+#define BTT_MAP_LOCKS_MAX	(1U << 16)
+
+static unsigned int map_locks;
+module_param(map_locks, uint, 0444);
+MODULE_PARM_DESC(map_locks, "Map locks per arena, 0 for 8 per free block");
+
 enum log_ent_request {
 	LOG_NEW_ENT = 0,
 	LOG_OLD_ENT
@@ -369,7 +375,11 @@ static int __btt_log_write(struct arena_info *arena, u32 lane,
 
 	ns_off = arena->logoff + (lane * LOG_GRP_SIZE) +
 		(group_slot * LOG_ENT_SIZE);
-	/* split the 16B write into atomic, durable halves */
+	/*
+	 * split the 16B write into atomic, durable halves, the flush of
+	 * the first half also makes a preceding NOFLUSH data write durable
+	 * before the second half commits the entry
+	 */
 	ret = arena_write_bytes(arena, ns_off, src, log_half, flags);
 	if (ret)
 		return ret;
@@ -729,14 +739,18 @@ static int btt_rtt_init(struct arena_info *arena)
 
 static int btt_maplocks_init(struct arena_info *arena)
 {
+	unsigned int nr = map_locks ? map_locks : arena->nfree * 8;
 	u32 i;
 
-	arena->map_locks = kcalloc(arena->nfree, sizeof(struct aligned_lock),
-				GFP_KERNEL);
+	/* clamp first, roundup_pow_of_two() of a huge value overflows */
+	nr = clamp_t(unsigned int, nr, 1, BTT_MAP_LOCKS_MAX);
+	arena->nr_map_locks = roundup_pow_of_two(nr);
+	arena->map_locks = kcalloc(arena->nr_map_locks,
+				sizeof(struct aligned_lock), GFP_KERNEL);
 	if (!arena->map_locks)
 		return -ENOMEM;
 
-	for (i = 0; i < arena->nfree; i++)
+	for (i = 0; i < arena->nr_map_locks; i++)
 		spin_lock_init(&arena->map_locks[i].lock);
 
 	return 0;
@@ -1090,7 +1104,8 @@ static int lba_to_arena(struct btt *btt, sector_t sector, __u32 *premap,
 static void lock_map(struct arena_info *arena, u32 premap)
 		__acquires(&arena->map_locks[idx].lock)
 {
-	u32 idx = (premap * MAP_ENT_SIZE / L1_CACHE_BYTES) % arena->nfree;
+	u32 idx = (premap * MAP_ENT_SIZE / L1_CACHE_BYTES) &
+		(arena->nr_map_locks - 1);
 
 	spin_lock(&arena->map_locks[idx].lock);
 }
@@ -1098,7 +1113,8 @@ static void lock_map(struct arena_info *arena, u32 premap)
 static void unlock_map(struct arena_info *arena, u32 premap)
 		__releases(&arena->map_locks[idx].lock)
 {
-	u32 idx = (premap * MAP_ENT_SIZE / L1_CACHE_BYTES) % arena->nfree;
+	u32 idx = (premap * MAP_ENT_SIZE / L1_CACHE_BYTES) &
+		(arena->nr_map_locks - 1);
 
 	spin_unlock(&arena->map_locks[idx].lock);
 }
@@ -1123,7 +1139,9 @@ static int btt_data_write(struct arena_info *arena, u32 lba,
 	u64 nsoff = to_namespace_offset(arena, lba);
 	void *mem = kmap_atomic(page);
 
-	ret = arena_write_bytes(arena, nsoff, mem + off, len, NVDIMM_IO_ATOMIC);
+	/* flushed by the log write that commits it, see __btt_log_write() */
+	ret = arena_write_bytes(arena, nsoff, mem + off, len,
+			NVDIMM_IO_ATOMIC | NVDIMM_IO_NOFLUSH);
 	kunmap_atomic(mem);
 
 	return ret;
@@ -1394,8 +1412,14 @@ static int btt_write_pg(struct btt *btt, struct bio_integrity_payload *bip,
 		if (ret)
 			goto out_map;
 
+		/*
+		 * The log entry is the commit point and recovery replays it
+		 * into the map, so the map entry only has to be durable
+		 * before this lane reuses the log slot, which the log flushes
+		 * of the lane's next write take care of.
+		 */
 		ret = btt_map_write(arena, premap, new_postmap, 0, 0,
-			NVDIMM_IO_ATOMIC);
+			NVDIMM_IO_ATOMIC | NVDIMM_IO_NOFLUSH);
 		if (ret)
 			goto out_map;
 
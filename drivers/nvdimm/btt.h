@@ -156,6 +156,7 @@ struct aligned_lock {
  * @freelist:		Pointer to in-memory list of free blocks
  * @rtt:		Pointer to in-memory "Read Tracking Table"
  * @map_locks:		Spinlocks protecting concurrent map writes
+ * @nr_map_locks:	Number of map_locks, a power of 2
  * @nd_btt:		Pointer to parent nd_btt structure.
  * @list:		List head for list of arenas
  * @debugfs_dir:	Debugfs dentry
@@ -188,6 +189,7 @@ struct arena_info {
 	struct free_entry *freelist;
 	u32 *rtt;
 	struct aligned_lock *map_locks;
+	u32 nr_map_locks;
 	struct nd_btt *nd_btt;
 	struct list_head list;
 	struct dentry *debugfs_dir;
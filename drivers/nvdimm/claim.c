@@ -293,6 +293,9 @@ static int nsio_rw_bytes(struct nd_namespace_common *ndns,
 	}
 
 	memcpy_flushcache(nsio->addr + offset, buf, size);
+	if (flags & NVDIMM_IO_NOFLUSH)
+		return rc;
+
 	ret = nvdimm_flush(to_nd_region(ndns->dev.parent), NULL);
 	if (ret)
 		rc = ret;
@@ -23,6 +23,8 @@ enum {
 	ND_MAX_LANES = 256,
 	INT_LBASIZE_ALIGNMENT = 64,
 	NVDIMM_IO_ATOMIC = 1,
+	/* the caller issues the nvdimm_flush() that makes the write durable */
+	NVDIMM_IO_NOFLUSH = 2,
 };
 
 struct nvdimm_drvdata {
@@ -102,7 +104,8 @@ unsigned sizeof_namespace_label(struct nvdimm_drvdata *ndd);
 
 struct nd_percpu_lane {
 	int count;
-	spinlock_t lock;
+	/* lane held while @count, else the lane this cpu last held */
+	unsigned int lane;
 };
 
 enum nd_label_flags {
@@ -155,6 +158,8 @@ struct nd_region {
 	struct badblocks bb;
 	struct nd_interleave_set *nd_set;
 	struct nd_percpu_lane __percpu *lane;
+	/* lanes not held by any cpu, when lanes are shared */
+	unsigned long *lane_free;
 	int (*flush)(struct nd_region *nd_region, struct bio *bio);
 	struct nd_mapping mapping[0];
 };
@@ -6,9 +6,15 @@
  * from host and provides a virtio based flushing
  * interface.
  */
+#include <linux/ktime.h>
+#include <linux/delay.h>
 #include "virtio_pmem.h"
 #include "nd.h"
 
+static unsigned int flush_interval_us;
+module_param(flush_interval_us, uint, 0644);
+MODULE_PARM_DESC(flush_interval_us, "Minimum time between two flush requests");
+
  /* The interrupt handler */
 void virtio_pmem_host_ack(struct virtqueue *vq)
 {
@@ -97,6 +103,63 @@ static int virtio_pmem_flush(struct nd_region *nd_region)
 	return err;
 };
 
+/*
+ * Every flush request is a VM exit and a host fsync, so flushes are
+ * coalesced: a caller waits for the first flush sent after it arrived,
+ * which covers all it wrote, and only one caller at a time sends one.
+ * The sender first waits out flush_interval_us since the previous flush,
+ * so that one request goes out per interval however many fsyncs are
+ * issued meanwhile.
+ */
+static int virtio_pmem_flush_coalesced(struct nd_region *nd_region)
+{
+	struct virtio_device *vdev = nd_region->provider_data;
+	struct virtio_pmem *vpmem = vdev->priv;
+	u64 target, seq, next, now;
+	int err;
+
+	spin_lock(&vpmem->flush_lock);
+	target = vpmem->flush_seq + 1;
+	while (vpmem->flush_done < target) {
+		if (vpmem->flush_busy) {
+			spin_unlock(&vpmem->flush_lock);
+			wait_event(vpmem->flush_wait,
+				   READ_ONCE(vpmem->flush_done) >= target ||
+				   !READ_ONCE(vpmem->flush_busy));
+			spin_lock(&vpmem->flush_lock);
+			continue;
+		}
+
+		vpmem->flush_busy = true;
+		next = vpmem->flush_last_ns +
+			(u64)READ_ONCE(flush_interval_us) * NSEC_PER_USEC;
+		spin_unlock(&vpmem->flush_lock);
+
+		now = ktime_get_ns();
+		if (now < next)
+			usleep_range(div_u64(next - now, NSEC_PER_USEC),
+				     div_u64(next - now, NSEC_PER_USEC) + 10);
+
+		/* whoever arrived until now is covered by this flush */
+		spin_lock(&vpmem->flush_lock);
+		seq = ++vpmem->flush_seq;
+		vpmem->flush_last_ns = ktime_get_ns();
+		spin_unlock(&vpmem->flush_lock);
+
+		err = virtio_pmem_flush(nd_region);
+
+		spin_lock(&vpmem->flush_lock);
+		vpmem->flush_done = seq;
+		vpmem->flush_err = err;
+		vpmem->flush_busy = false;
+		wake_up_all(&vpmem->flush_wait);
+	}
+	err = vpmem->flush_err;
+	spin_unlock(&vpmem->flush_lock);
+
+	return err;
+}
+
 /* The asynchronous flush callback function */
 int async_pmem_flush(struct nd_region *nd_region, struct bio *bio)
 {
@@ -116,7 +179,7 @@ int async_pmem_flush(struct nd_region *nd_region, struct bio *bio)
 		submit_bio(child);
 		return 0;
 	}
-	if (virtio_pmem_flush(nd_region))
+	if (virtio_pmem_flush_coalesced(nd_region))
 		return -EIO;
 
 	return 0;
@@ -25,6 +25,11 @@
 #include <linux/dax.h>
 #include <linux/nd.h>
 #include <linux/backing-dev.h>
+#include <linux/migrate.h>
+#include <linux/pmem_writers.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/workqueue.h>
 #include "pmem.h"
 #include "pfn.h"
 #include "nd.h"
@@ -181,21 +186,88 @@ static blk_status_t pmem_do_bvec(struct pmem_device *pmem, struct page *page,
 	return rc;
 }
 
-static blk_qc_t pmem_make_request(struct request_queue *q, struct bio *bio)
+struct pmem_bio_chunk {
+	struct page *page;
+	unsigned int len;
+	unsigned int off;
+	sector_t sector;
+};
+
+struct pmem_bio_mt {
+	struct pmem_device *pmem;
+	struct bio *bio;
+	struct pmem_bio_chunk *chunks;
+};
+
+static void pmem_do_bio_range(void *arg, int start, int end)
 {
-	int ret = 0;
-	blk_status_t rc = 0;
-	bool do_acct;
-	unsigned long start;
+	struct pmem_bio_mt *mt = arg;
+	struct pmem_bio_chunk *chunk;
+	blk_status_t rc;
+	int i;
+
+	for (i = start; i < end; i++) {
+		chunk = &mt->chunks[i];
+		rc = pmem_do_bvec(mt->pmem, chunk->page, chunk->len, chunk->off,
+				  bio_op(mt->bio), chunk->sector);
+		if (rc) {
+			WRITE_ONCE(mt->bio->bi_status, rc);
+			break;
+		}
+	}
+}
+
+/*
+ * One thread copies a few GB/s while an interleaved namespace takes several
+ * times that, so the segments of a large bio are split across the copy
+ * workers of the socket local to the namespace, each of them clearing the
+ * poison of its own segments. Returns false if the caller should do the
+ * bio itself.
+ */
+static bool pmem_do_bio_mt(struct pmem_device *pmem, struct bio *bio)
+{
+	unsigned int bytes = READ_ONCE(pmem->mt_copy_bytes);
+	struct pmem_bio_chunk *chunks;
 	struct bio_vec bvec;
 	struct bvec_iter iter;
-	struct pmem_device *pmem = q->queuedata;
-	struct nd_region *nd_region = to_region(pmem);
+	struct pmem_bio_mt mt;
+	int nr = 0;
 
-	if (bio->bi_opf & REQ_PREFLUSH)
-		ret = nvdimm_flush(nd_region, bio);
+	if (!bytes || bio->bi_iter.bi_size < bytes)
+		return false;
+
+	chunks = kmalloc_array(bio_segments(bio), sizeof(*chunks),
+			       GFP_NOIO | __GFP_NOWARN);
+	if (!chunks)
+		return false;
+
+	bio_for_each_segment(bvec, bio, iter) {
+		chunks[nr].page = bvec.bv_page;
+		chunks[nr].len = bvec.bv_len;
+		chunks[nr].off = bvec.bv_offset;
+		chunks[nr].sector = iter.bi_sector;
+		nr++;
+	}
+
+	mt.pmem = pmem;
+	mt.bio = bio;
+	mt.chunks = chunks;
+	copy_page_run_ranges(pmem->nid == NUMA_NO_NODE ? numa_node_id() :
+			     pmem->nid, nr, pmem_do_bio_range, &mt);
+	kfree(chunks);
+
+	return true;
+}
+
+static void pmem_do_bio(struct pmem_device *pmem, struct bio *bio)
+{
+	blk_status_t rc;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+
+	if (pmem_do_bio_mt(pmem, bio))
+		return;
 
-	do_acct = nd_iostat_start(bio, &start);
 	bio_for_each_segment(bvec, bio, iter) {
 		rc = pmem_do_bvec(pmem, bvec.bv_page, bvec.bv_len,
 				bvec.bv_offset, bio_op(bio), iter.bi_sector);
@@ -204,9 +276,288 @@ static blk_qc_t pmem_make_request(struct request_queue *q, struct bio *bio)
 			break;
 		}
 	}
+}
+
+struct pmem_bio_offload {
+	struct pmem_device *pmem;
+	struct bio *bio;
+	struct work_struct work;
+	struct completion done;
+};
+
+static void pmem_do_bio_fn(struct work_struct *work)
+{
+	struct pmem_bio_offload *req = container_of(work,
+					struct pmem_bio_offload, work);
+
+	pmem_do_bio(req->pmem, req->bio);
+	complete(&req->done);
+}
+
+/*
+ * A write submitted on another socket streams its data across the
+ * interconnect into the media, which is slower than reading it across and
+ * writing it locally. Large writes are therefore handed to an unbound
+ * worker on the node local to the namespace, so that concurrent writers
+ * each get their own, small ones are not worth the round trip. The worker
+ * comes from pmem->offload_wq, whose rescuer keeps writeback and swap-out
+ * going under memory pressure. Returns false if the caller should do the
+ * write itself.
+ */
+static bool pmem_write_offload(struct pmem_device *pmem, struct bio *bio)
+{
+	unsigned int bytes = READ_ONCE(pmem->write_offload_bytes);
+	struct pmem_bio_offload req = {
+		.pmem = pmem,
+		.bio = bio,
+	};
+
+	if (!bytes || !pmem->offload_wq || !op_is_write(bio_op(bio)) ||
+	    bio->bi_iter.bi_size < bytes)
+		return false;
+	if (pmem->nid == NUMA_NO_NODE || pmem->nid == numa_node_id())
+		return false;
+	if (cpumask_any_and(cpumask_of_node(pmem->nid),
+			    cpu_online_mask) >= nr_cpu_ids)
+		return false;
+
+	INIT_WORK_ONSTACK(&req.work, pmem_do_bio_fn);
+	init_completion(&req.done);
+	queue_work_node(pmem->nid, pmem->offload_wq, &req.work);
+	wait_for_completion(&req.done);
+	destroy_work_on_stack(&req.work);
+
+	return true;
+}
+
+struct pmem_dma_seg {
+	dma_addr_t addr;
+	unsigned int len;
+};
+
+/* A write bio handed to a DMA engine, completed from pmem->dma_wq */
+struct pmem_dma_bio {
+	struct pmem_device *pmem;
+	struct bio *bio;
+	struct dma_chan *chan;
+	struct work_struct work;
+	/* iostat start time, if accounted */
+	unsigned long start;
+	bool do_acct;
+	/* pmem_writers slots held until the bio ends */
+	int writers;
+	bool failed;
+	phys_addr_t pmem_off;
+	unsigned int size;
+	dma_addr_t dst;
+	int nr_segs;
+	struct pmem_dma_seg segs[];
+};
+
+static void pmem_dma_bio_unmap(struct pmem_dma_bio *req)
+{
+	struct device *dev = req->chan->device->dev;
+	int i;
+
+	for (i = 0; i < req->nr_segs; i++)
+		dma_unmap_page(dev, req->segs[i].addr, req->segs[i].len,
+			       DMA_TO_DEVICE);
+	dma_unmap_resource(dev, req->dst, req->size, DMA_FROM_DEVICE, 0);
+}
+
+static void pmem_dma_bio_end(struct work_struct *work)
+{
+	struct pmem_dma_bio *req = container_of(work, struct pmem_dma_bio,
+						work);
+	struct pmem_device *pmem = req->pmem;
+	struct nd_region *nd_region = to_region(pmem);
+	struct request_queue *q = pmem->disk->queue;
+	struct bio *bio = req->bio;
+	int ret;
+
+	pmem_dma_bio_unmap(req);
+
+	/*
+	 * The writes of the engine may be allocated in the CPU caches like
+	 * those of any other device, write the range back as write_pmem()
+	 * does. A failed transfer is redone by the CPU.
+	 */
+	if (unlikely(req->failed))
+		pmem_do_bio(pmem, bio);
+	else
+		arch_wb_cache_pmem(pmem->virt_addr + req->pmem_off, req->size);
+
+	if (req->do_acct)
+		nd_iostat_end(bio, req->start);
+	if (req->writers)
+		pmem_writers_put(nd_region->target_node, req->writers);
+
+	if (bio->bi_opf & REQ_FUA) {
+		ret = nvdimm_flush(nd_region, bio);
+		if (ret)
+			bio->bi_status = errno_to_blk_status(ret);
+	}
+
+	bio_endio(bio);
+	percpu_ref_put(&q->q_usage_counter);
+	kfree(req);
+}
+
+static void pmem_dma_bio_done(void *arg, const struct dmaengine_result *result)
+{
+	struct pmem_dma_bio *req = arg;
+
+	if (result && result->result != DMA_TRANS_NOERROR)
+		req->failed = true;
+
+	queue_work(req->pmem->dma_wq, &req->work);
+}
+
+/*
+ * Large writes can be copied by a DMA engine of the socket local to the
+ * namespace instead of the submitting CPU, the channels shared with page
+ * migration. One descriptor is queued per segment on a single channel, so
+ * they complete in order and the callback of the last one ends the bio.
+ * Ranges with bad blocks take the CPU path, which clears the poison.
+ *
+ * Returns true if the bio now belongs to the engine: its accounting, the
+ * @writers slots, FUA and its completion are done in pmem_dma_bio_end().
+ * Returns false with nothing written if the caller should do the bio.
+ */
+static bool pmem_do_bio_dma(struct pmem_device *pmem, struct bio *bio,
+		bool do_acct, unsigned long start, int writers)
+{
+	unsigned int bytes = READ_ONCE(pmem->dma_copy_bytes);
+	sector_t sector = bio->bi_iter.bi_sector;
+	unsigned int size = bio->bi_iter.bi_size;
+	struct dma_async_tx_descriptor *tx;
+	struct pmem_dma_bio *req;
+	struct bio_vec bvec;
+	struct bvec_iter iter;
+	struct dma_chan *chan;
+	struct device *dev;
+	dma_cookie_t cookie, last = 0;
+	dma_addr_t dst;
+	int nr, i;
+
+	if (!bytes || !pmem->dma_wq || !op_is_write(bio_op(bio)) || size < bytes)
+		return false;
+	if (bio->bi_opf & REQ_NOWAIT)
+		return false;
+	if (unlikely(is_bad_pmem(&pmem->bb, sector, size)))
+		return false;
+
+	chan = copy_dma_pick_chan(pmem->nid == NUMA_NO_NODE ? numa_node_id() :
+				  pmem->nid);
+	if (!chan)
+		return false;
+	dev = chan->device->dev;
+
+	nr = bio_segments(bio);
+	req = kmalloc(struct_size(req, segs, nr), GFP_NOIO | __GFP_NOWARN);
+	if (!req)
+		return false;
+
+	req->pmem = pmem;
+	req->bio = bio;
+	req->chan = chan;
+	INIT_WORK(&req->work, pmem_dma_bio_end);
+	req->start = start;
+	req->do_acct = do_acct;
+	req->writers = writers;
+	req->failed = false;
+	req->pmem_off = sector * 512 + pmem->data_offset;
+	req->size = size;
+	req->nr_segs = 0;
+
+	req->dst = dma_map_resource(dev, pmem->phys_addr + req->pmem_off, size,
+				    DMA_FROM_DEVICE, 0);
+	if (dma_mapping_error(dev, req->dst)) {
+		kfree(req);
+		return false;
+	}
+
+	bio_for_each_segment(bvec, bio, iter) {
+		struct pmem_dma_seg *seg = &req->segs[req->nr_segs];
+
+		flush_dcache_page(bvec.bv_page);
+		seg->addr = dma_map_page(dev, bvec.bv_page, bvec.bv_offset,
+					 bvec.bv_len, DMA_TO_DEVICE);
+		if (dma_mapping_error(dev, seg->addr))
+			goto unmap;
+		seg->len = bvec.bv_len;
+		req->nr_segs++;
+	}
+
+	/* the request is owned by the callback once the last one is queued */
+	percpu_ref_get(&pmem->disk->queue->q_usage_counter);
+	dst = req->dst;
+	for (i = 0; i < nr; i++) {
+		struct pmem_dma_seg *seg = &req->segs[i];
+		bool last = i == nr - 1;
+
+		tx = dmaengine_prep_dma_memcpy(chan, dst, seg->addr, seg->len,
+					       last ? DMA_PREP_INTERRUPT : 0);
+		if (!tx)
+			break;
+		dst += seg->len;
+		if (last) {
+			tx->callback_result = pmem_dma_bio_done;
+			tx->callback_param = req;
+		}
+		cookie = dmaengine_submit(tx);
+		if (dma_submit_error(cookie))
+			break;
+		last = cookie;
+	}
+	dma_async_issue_pending(chan);
+	if (i == nr)
+		return true;
+
+	/*
+	 * The engine took only part of the bio, let it finish and have the
+	 * caller write all of it again.
+	 */
+	percpu_ref_put(&pmem->disk->queue->q_usage_counter);
+	if (last && dma_sync_wait(chan, last) != DMA_COMPLETE)
+		dev_dbg(to_dev(pmem), "dma write did not complete\n");
+unmap:
+	pmem_dma_bio_unmap(req);
+	kfree(req);
+	return false;
+}
+
+static blk_qc_t pmem_make_request(struct request_queue *q, struct bio *bio)
+{
+	int ret = 0;
+	bool do_acct;
+	unsigned long start = 0;
+	struct pmem_device *pmem = q->queuedata;
+	struct nd_region *nd_region = to_region(pmem);
+	int writers = 0;
+
+	if (bio->bi_opf & REQ_PREFLUSH)
+		ret = nvdimm_flush(nd_region, bio);
+
+	/*
+	 * The DIMMs of the region may also back a slow tier node, whose
+	 * writer budget the write then counts against.
+	 */
+	if (op_is_write(bio_op(bio)) && bio->bi_iter.bi_size)
+		writers = pmem_writers_get(nd_region->target_node, 1,
+					   !(bio->bi_opf & REQ_NOWAIT));
+
+	do_acct = nd_iostat_start(bio, &start);
+	if (!ret && pmem_do_bio_dma(pmem, bio, do_acct, start, writers))
+		return BLK_QC_T_NONE;
+	if (!pmem_write_offload(pmem, bio))
+		pmem_do_bio(pmem, bio);
 	if (do_acct)
 		nd_iostat_end(bio, start);
 
+	if (writers)
+		pmem_writers_put(nd_region->target_node, writers);
+
 	if (bio->bi_opf & REQ_FUA)
 		ret = nvdimm_flush(nd_region, bio);
 
@@ -301,8 +652,99 @@ static const struct dax_operations pmem_dax_ops = {
 	.copy_to_iter = pmem_copy_to_iter,
 };
 
+static ssize_t write_offload_bytes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct pmem_device *pmem = dev_to_disk(dev)->queue->queuedata;
+
+	return sprintf(buf, "%u\n", READ_ONCE(pmem->write_offload_bytes));
+}
+
+static ssize_t write_offload_bytes_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct pmem_device *pmem = dev_to_disk(dev)->queue->queuedata;
+	unsigned int bytes;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &bytes);
+	if (rc)
+		return rc;
+	if (bytes && !pmem->offload_wq)
+		return -ENODEV;
+
+	WRITE_ONCE(pmem->write_offload_bytes, bytes);
+
+	return len;
+}
+static DEVICE_ATTR_RW(write_offload_bytes);
+
+static ssize_t mt_copy_bytes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct pmem_device *pmem = dev_to_disk(dev)->queue->queuedata;
+
+	return sprintf(buf, "%u\n", READ_ONCE(pmem->mt_copy_bytes));
+}
+
+static ssize_t mt_copy_bytes_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct pmem_device *pmem = dev_to_disk(dev)->queue->queuedata;
+	unsigned int bytes;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &bytes);
+	if (rc)
+		return rc;
+
+	WRITE_ONCE(pmem->mt_copy_bytes, bytes);
+
+	return len;
+}
+static DEVICE_ATTR_RW(mt_copy_bytes);
+
+static ssize_t dma_copy_bytes_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct pmem_device *pmem = dev_to_disk(dev)->queue->queuedata;
+
+	return sprintf(buf, "%u\n", READ_ONCE(pmem->dma_copy_bytes));
+}
+
+static ssize_t dma_copy_bytes_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct pmem_device *pmem = dev_to_disk(dev)->queue->queuedata;
+	unsigned int bytes;
+	int rc;
+
+	rc = kstrtouint(buf, 0, &bytes);
+	if (rc)
+		return rc;
+	if (bytes && !pmem->dma_wq)
+		return -ENODEV;
+
+	WRITE_ONCE(pmem->dma_copy_bytes, bytes);
+
+	return len;
+}
+static DEVICE_ATTR_RW(dma_copy_bytes);
+
+static struct attribute *pmem_attributes[] = {
+	&dev_attr_write_offload_bytes.attr,
+	&dev_attr_mt_copy_bytes.attr,
+	&dev_attr_dma_copy_bytes.attr,
+	NULL,
+};
+
+static const struct attribute_group pmem_attribute_group = {
+	.attrs = pmem_attributes,
+};
+
 static const struct attribute_group *pmem_attribute_groups[] = {
 	&dax_attribute_group,
+	&pmem_attribute_group,
 	NULL,
 };
 
@@ -327,6 +769,11 @@ static void pmem_pagemap_kill(struct dev_pagemap *pgmap)
 	blk_freeze_queue_start(q);
 }
 
+static void pmem_release_wq(void *wq)
+{
+	destroy_workqueue(wq);
+}
+
 static void pmem_release_disk(void *__pmem)
 {
 	struct pmem_device *pmem = __pmem;
@@ -383,6 +830,7 @@ static int pmem_attach_disk(struct device *dev,
 	dev_set_drvdata(dev, pmem);
 	pmem->phys_addr = res->start;
 	pmem->size = resource_size(res);
+	pmem->nid = nid;
 	fua = nvdimm_has_flush(nd_region);
 	if (!IS_ENABLED(CONFIG_ARCH_HAS_UACCESS_FLUSHCACHE) || fua < 0) {
 		dev_warn(dev, "unable to guarantee persistence of writes\n");
@@ -395,6 +843,23 @@ static int pmem_attach_disk(struct device *dev,
 		return -EBUSY;
 	}
 
+	/*
+	 * Torn down after the queue, whose cleanup waits for the bios the
+	 * DMA engines still write. Without it there is just no DMA path.
+	 */
+	pmem->dma_wq = alloc_workqueue("pmem_dma/%s", WQ_MEM_RECLAIM |
+				       WQ_HIGHPRI, 0, dev_name(dev));
+	if (pmem->dma_wq &&
+	    devm_add_action_or_reset(dev, pmem_release_wq, pmem->dma_wq))
+		pmem->dma_wq = NULL;
+
+	/* likewise, without it writes are never moved to the local node */
+	pmem->offload_wq = alloc_workqueue("pmem_wr/%s", WQ_UNBOUND |
+					   WQ_MEM_RECLAIM, 0, dev_name(dev));
+	if (pmem->offload_wq &&
+	    devm_add_action_or_reset(dev, pmem_release_wq, pmem->offload_wq))
+		pmem->offload_wq = NULL;
+
 	q = blk_alloc_queue_node(GFP_KERNEL, dev_to_node(dev));
 	if (!q)
 		return -ENOMEM;
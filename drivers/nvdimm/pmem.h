@@ -24,6 +24,18 @@ struct pmem_device {
 	struct dax_device	*dax_dev;
 	struct gendisk		*disk;
 	struct dev_pagemap	pgmap;
+	/* node local to the namespace, NUMA_NO_NODE if unknown */
+	int			nid;
+	/* bios writing this many bytes or more are copied on @nid, 0 for off */
+	unsigned int		write_offload_bytes;
+	/* runs the writes offloaded to @nid, NULL if unavailable */
+	struct workqueue_struct	*offload_wq;
+	/* bios of this many bytes or more are split across threads, 0 for off */
+	unsigned int		mt_copy_bytes;
+	/* bios writing this many bytes or more go to a DMA engine, 0 for off */
+	unsigned int		dma_copy_bytes;
+	/* completes the bios written by a DMA engine, NULL if unavailable */
+	struct workqueue_struct	*dma_wq;
 };
 
 long __pmem_direct_access(struct pmem_device *pmem, pgoff_t pgoff,
@@ -133,6 +133,7 @@ static void nd_region_release(struct device *dev)
 		put_device(&nvdimm->dev);
 	}
 	free_percpu(nd_region->lane);
+	bitmap_free(nd_region->lane_free);
 	memregion_free(nd_region->id);
 	if (is_nd_blk(dev))
 		kfree(to_nd_blk_region(dev));
@@ -888,10 +889,10 @@ int nd_blk_region_init(struct nd_region *nd_region)
  *
  * A lane correlates to a BLK-data-window and/or a log slot in the BTT.
  * We optimize for the common case where there are 256 lanes, one
- * per-cpu.  For larger systems we need to lock to share lanes.  For now
- * this implementation assumes the cost of maintaining an allocator for
- * free lanes is on the order of the lock hold time, so it implements a
- * static lane = cpu % num_lanes mapping.
+ * per-cpu.  For larger systems lanes are shared: a cpu takes the lane it
+ * last held if it is free, else any free lane of the region's bitmap, so
+ * that busy cpus do not queue up on one lane while others sit idle. Only
+ * when every lane is held does it spin for one to be released.
  *
  * In the case of a BTT instance on top of a BLK namespace a lane may be
  * acquired recursively.  We lock on the first instance.
@@ -899,19 +900,39 @@ int nd_blk_region_init(struct nd_region *nd_region)
  * In the case of a BTT instance on top of PMEM, we only acquire a lane
  * for the BTT metadata updates.
  */
+static unsigned int nd_region_alloc_lane(struct nd_region *nd_region,
+		unsigned int hint)
+{
+	unsigned int num_lanes = nd_region->num_lanes;
+	unsigned long *free = nd_region->lane_free;
+	unsigned int lane = hint;
+
+	for (;;) {
+		if (test_bit(lane, free) && test_and_clear_bit(lane, free))
+			return lane;
+
+		lane = find_next_bit(free, num_lanes, lane + 1);
+		if (lane >= num_lanes)
+			lane = find_first_bit(free, num_lanes);
+		if (lane >= num_lanes) {
+			cpu_relax();
+			lane = hint;
+		}
+	}
+}
+
 unsigned int nd_region_acquire_lane(struct nd_region *nd_region)
 {
 	unsigned int cpu, lane;
 
 	cpu = get_cpu();
 	if (nd_region->num_lanes < nr_cpu_ids) {
-		struct nd_percpu_lane *ndl_lock, *ndl_count;
+		struct nd_percpu_lane *ndl;
 
-		lane = cpu % nd_region->num_lanes;
-		ndl_count = per_cpu_ptr(nd_region->lane, cpu);
-		ndl_lock = per_cpu_ptr(nd_region->lane, lane);
-		if (ndl_count->count++ == 0)
-			spin_lock(&ndl_lock->lock);
+		ndl = per_cpu_ptr(nd_region->lane, cpu);
+		if (ndl->count++ == 0)
+			ndl->lane = nd_region_alloc_lane(nd_region, ndl->lane);
+		lane = ndl->lane;
 	} else
 		lane = cpu;
 
@@ -923,12 +944,14 @@ void nd_region_release_lane(struct nd_region *nd_region, unsigned int lane)
 {
 	if (nd_region->num_lanes < nr_cpu_ids) {
 		unsigned int cpu = get_cpu();
-		struct nd_percpu_lane *ndl_lock, *ndl_count;
+		struct nd_percpu_lane *ndl;
 
-		ndl_count = per_cpu_ptr(nd_region->lane, cpu);
-		ndl_lock = per_cpu_ptr(nd_region->lane, lane);
-		if (--ndl_count->count == 0)
-			spin_unlock(&ndl_lock->lock);
+		ndl = per_cpu_ptr(nd_region->lane, cpu);
+		if (--ndl->count == 0) {
+			/* the lane's updates are done before another cpu takes it */
+			smp_mb__before_atomic();
+			set_bit(lane, nd_region->lane_free);
+		}
 		put_cpu();
 	}
 	put_cpu();
@@ -998,12 +1021,17 @@ static struct nd_region *nd_region_create(struct nvdimm_bus *nvdimm_bus,
 	if (!nd_region->lane)
 		goto err_percpu;
 
+	nd_region->lane_free = bitmap_alloc(ndr_desc->num_lanes, GFP_KERNEL);
+	if (!nd_region->lane_free)
+		goto err_bitmap;
+	bitmap_fill(nd_region->lane_free, ndr_desc->num_lanes);
+
         for (i = 0; i < nr_cpu_ids; i++) {
 		struct nd_percpu_lane *ndl;
 
 		ndl = per_cpu_ptr(nd_region->lane, i);
-		spin_lock_init(&ndl->lock);
 		ndl->count = 0;
+		ndl->lane = i % ndr_desc->num_lanes;
 	}
 
 	for (i = 0; i < ndr_desc->num_mappings; i++) {
@@ -1048,6 +1076,8 @@ static struct nd_region *nd_region_create(struct nvdimm_bus *nvdimm_bus,
 
 	return nd_region;
 
+ err_bitmap:
+	free_percpu(nd_region->lane);
  err_percpu:
 	memregion_free(nd_region->id);
  err_id:
@@ -25,6 +25,8 @@ static int init_vq(struct virtio_pmem *vpmem)
 
 	spin_lock_init(&vpmem->pmem_lock);
 	INIT_LIST_HEAD(&vpmem->req_list);
+	spin_lock_init(&vpmem->flush_lock);
+	init_waitqueue_head(&vpmem->flush_wait);
 
 	return 0;
 };
@@ -45,6 +45,15 @@ struct virtio_pmem {
 	/* Synchronize virtqueue data */
 	spinlock_t pmem_lock;
 
+	/* Flush coalescing, see virtio_pmem_flush_coalesced() */
+	spinlock_t flush_lock;
+	wait_queue_head_t flush_wait;
+	bool flush_busy;
+	u64 flush_seq;		/* flushes sent */
+	u64 flush_done;		/* last flush completed */
+	int flush_err;		/* of the last flush completed */
+	u64 flush_last_ns;	/* when the last flush was sent */
+
 	/* Memory region information */
 	__u64 start;
 	__u64 size;
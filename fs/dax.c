@@ -19,12 +19,16 @@
 #include <linux/pagevec.h>
 #include <linux/sched.h>
 #include <linux/sched/signal.h>
+#include <linux/sched/mm.h>
+#include <linux/cacheinfo.h>
+#include <linux/migrate.h>
 #include <linux/uio.h>
 #include <linux/vmstat.h>
 #include <linux/pfn_t.h>
 #include <linux/sizes.h>
 #include <linux/mmu_notifier.h>
 #include <linux/iomap.h>
+#include <linux/access_scan.h>
 #include <asm/pgalloc.h>
 
 #define CREATE_TRACE_POINTS
@@ -347,11 +351,199 @@ static void dax_associate_entry(void *entry, struct address_space *mapping,
 	}
 }
 
+/*
+ * DRAM copies of hot DAX pages.
+ *
+ * A DAX mapping accesses PMEM directly, there is no page cache copy that
+ * could be promoted to DRAM. With vm.dax_dram_cache set, a read fault on
+ * a PTE entry maps a DRAM copy of the PMEM page instead, for the pages
+ * the access sampler reports hot (1) or for all of them (2). The copies
+ * are kept by PMEM pfn, mapped read-only and never dirty: a write fault
+ * unmaps and frees the copy of its page and maps PMEM as before, and a
+ * write() or a zeroing of the file frees the copies of its range once
+ * PMEM holds the new data. Pages with writable mappings, those tagged
+ * dirty, are not copied. A copy lives until then or until its entry is
+ * removed, and vm.dax_dram_cache_pages caps the DRAM they take.
+ */
+
+// Map DRAM copies of DAX pages on read faults, 1 for hot pages, 2 for all
+int sysctl_dax_dram_cache = 0;
+// Most DRAM pages holding copies of DAX pages
+unsigned long sysctl_dax_dram_cache_pages = 262144;
+
+/* pfn -> DRAM copy, taken under the i_pages lock of the copied entry */
+static DEFINE_XARRAY_FLAGS(dax_cache_pages, XA_FLAGS_LOCK_IRQ);
+static atomic_long_t dax_cache_nr;
+
+static bool dax_cache_entry(struct address_space *mapping, void *entry)
+{
+	return test_bit(AS_DAX_CACHE, &mapping->flags) &&
+		dax_is_pte_entry(entry) && dax_entry_size(entry);
+}
+
+/*
+ * Free the DRAM copy of @entry, which is being removed. A PTE still
+ * mapping the copy holds a reference until it is unmapped.
+ */
+static void dax_cache_release(struct address_space *mapping, void *entry)
+{
+	unsigned long flags;
+	struct page *page;
+
+	if (!dax_cache_entry(mapping, entry))
+		return;
+
+	xa_lock_irqsave(&dax_cache_pages, flags);
+	page = __xa_erase(&dax_cache_pages, dax_to_pfn(entry));
+	xa_unlock_irqrestore(&dax_cache_pages, flags);
+	if (page) {
+		atomic_long_dec(&dax_cache_nr);
+		put_page(page);
+	}
+}
+
+/* Unmap and free the DRAM copy of @entry, which is locked */
+static void dax_cache_unmap(struct address_space *mapping, pgoff_t index,
+		void *entry)
+{
+	struct page *page;
+
+	if (!dax_cache_entry(mapping, entry))
+		return;
+
+	page = xa_erase_irq(&dax_cache_pages, dax_to_pfn(entry));
+	if (!page)
+		return;
+	unmap_mapping_pages(mapping, index, 1, false);
+	atomic_long_dec(&dax_cache_nr);
+	put_page(page);
+}
+
+static bool dax_cache_want(struct vm_fault *vmf, struct address_space *mapping,
+		pfn_t pfn)
+{
+	int mode = READ_ONCE(sysctl_dax_dram_cache);
+
+	if (!mode || IS_ENABLED(CONFIG_FS_DAX_LIMITED) || !pfn_t_has_page(pfn))
+		return false;
+	if (!(vmf->vma->vm_flags & VM_MIXEDMAP))
+		return false;
+	/* PMEM may be mapped writable somewhere */
+	if (xa_get_mark(&mapping->i_pages, vmf->pgoff, PAGECACHE_TAG_DIRTY))
+		return false;
+	if (atomic_long_read(&dax_cache_nr) >=
+	    READ_ONCE(sysctl_dax_dram_cache_pages))
+		return false;
+
+	return mode > 1 || page_access_sampled_hot(pfn_t_to_page(pfn));
+}
+
+/*
+ * Map the DRAM copy of @pfn for a read fault, copying the page first if
+ * it has no copy. Returns 0 to map PMEM instead.
+ */
+static vm_fault_t dax_cache_insert(struct vm_fault *vmf,
+		struct address_space *mapping, pfn_t pfn)
+{
+	unsigned long vaddr = vmf->address & PAGE_MASK;
+	struct page *page;
+	unsigned long rem;
+	void *dst;
+
+	page = xa_load(&dax_cache_pages, pfn_t_to_pfn(pfn));
+	if (page)
+		return vmf_insert_page(vmf->vma, vaddr, page);
+
+	page = alloc_pages_node(numa_mem_id(), GFP_HIGHUSER | __GFP_THISNODE |
+				__GFP_NORETRY | __GFP_NOWARN, 0);
+	if (!page)
+		return 0;
+
+	dst = kmap_atomic(page);
+	rem = memcpy_mcsafe(dst, page_address(pfn_t_to_page(pfn)), PAGE_SIZE);
+	kunmap_atomic(dst);
+	if (rem)
+		goto free;
+
+	/* before the copy can be found, see dax_cache_release() */
+	set_bit(AS_DAX_CACHE, &mapping->flags);
+	if (xa_err(xa_store_irq(&dax_cache_pages, pfn_t_to_pfn(pfn), page,
+				GFP_KERNEL)))
+		goto free;
+	atomic_long_inc(&dax_cache_nr);
+
+	return vmf_insert_page(vmf->vma, vaddr, page);
+free:
+	__free_page(page);
+	return 0;
+}
+
+static void dax_cache_invalidate_entry(struct address_space *mapping,
+		pgoff_t index)
+{
+	XA_STATE(xas, &mapping->i_pages, index);
+	void *entry;
+
+	xas_lock_irq(&xas);
+	entry = get_unlocked_entry(&xas, 0);
+	if (!entry || !xa_is_value(entry) || !dax_cache_entry(mapping, entry)) {
+		put_unlocked_entry(&xas, entry);
+		xas_unlock_irq(&xas);
+		return;
+	}
+	dax_lock_entry(&xas, entry);
+	xas_unlock_irq(&xas);
+
+	dax_cache_unmap(mapping, index, entry);
+	dax_unlock_entry(&xas, entry);
+}
+
+/**
+ * dax_cache_invalidate - drop the DRAM copies of a DAX file range
+ * @mapping: the address space of the file
+ * @start: first page index of the range
+ * @end: last page index of the range
+ *
+ * Called once the PMEM of the range has been written, so that no copy
+ * made before the write outlives it.
+ */
+void dax_cache_invalidate(struct address_space *mapping, pgoff_t start,
+		pgoff_t end)
+{
+	XA_STATE(xas, &mapping->i_pages, start);
+	pgoff_t index;
+	void *entry;
+
+	if (!test_bit(AS_DAX_CACHE, &mapping->flags))
+		return;
+
+	xas_lock_irq(&xas);
+	xas_for_each(&xas, entry, end) {
+		if (!xa_is_value(entry) || !dax_cache_entry(mapping, entry))
+			continue;
+		/* a locked entry may be getting its copy made */
+		if (!dax_is_locked(entry) &&
+		    !xa_load(&dax_cache_pages, dax_to_pfn(entry)))
+			continue;
+
+		index = xas.xa_index;
+		xas_pause(&xas);
+		xas_unlock_irq(&xas);
+		dax_cache_invalidate_entry(mapping, index);
+		cond_resched();
+		xas_lock_irq(&xas);
+	}
+	xas_unlock_irq(&xas);
+}
+EXPORT_SYMBOL_GPL(dax_cache_invalidate);
+
 static void dax_disassociate_entry(void *entry, struct address_space *mapping,
 		bool trunc)
 {
 	unsigned long pfn;
 
+	dax_cache_release(mapping, entry);
+
 	if (IS_ENABLED(CONFIG_FS_DAX_LIMITED))
 		return;
 
@@ -846,11 +1038,26 @@ static void dax_entry_mkclean(struct address_space *mapping, pgoff_t index,
 	i_mmap_unlock_read(mapping);
 }
 
-static int dax_writeback_one(struct xa_state *xas, struct dax_device *dax_dev,
-		struct address_space *mapping, void *entry)
+/* A dirty entry locked for writeback, its cache lines yet to be flushed */
+struct dax_wb_entry {
+	void *entry;
+	pgoff_t xa_index;
+	void *addr;
+	size_t size;
+};
+
+/*
+ * Lock a dirty entry for writeback and write protect its mappings. Returns
+ * 1 if @wbe is to be flushed and finished by dax_writeback_finish(), 0 if
+ * there is nothing to write back. Called and returns with the i_pages lock
+ * held, dropping it in between.
+ */
+static int dax_writeback_prepare(struct xa_state *xas,
+		struct address_space *mapping, void *entry,
+		struct dax_wb_entry *wbe)
 {
 	unsigned long pfn, index, count;
-	long ret = 0;
+	int ret = 0;
 
 	/*
 	 * A page got tagged dirty in DAX mapping? Something is seriously
@@ -896,6 +1103,8 @@ static int dax_writeback_one(struct xa_state *xas, struct dax_device *dax_dev,
 	 * they will see the entry locked and wait for it to unlock.
 	 */
 	xas_clear_mark(xas, PAGECACHE_TAG_TOWRITE);
+	wbe->xa_index = xas->xa_index;
+	xas_pause(xas);
 	xas_unlock_irq(xas);
 
 	/*
@@ -907,34 +1116,109 @@ static int dax_writeback_one(struct xa_state *xas, struct dax_device *dax_dev,
 	 */
 	pfn = dax_to_pfn(entry);
 	count = 1UL << dax_entry_order(entry);
-	index = xas->xa_index & ~(count - 1);
+	index = wbe->xa_index & ~(count - 1);
 
 	dax_entry_mkclean(mapping, index, pfn);
-	dax_flush(dax_dev, page_address(pfn_to_page(pfn)), count * PAGE_SIZE);
-	/*
-	 * After we have flushed the cache, we can clear the dirty tag. There
-	 * cannot be new dirty data in the pfn after the flush has completed as
-	 * the pfn mappings are writeprotected and fault waits for mapping
-	 * entry lock.
-	 */
-	xas_reset(xas);
-	xas_lock_irq(xas);
-	xas_store(xas, entry);
-	xas_clear_mark(xas, PAGECACHE_TAG_DIRTY);
-	dax_wake_entry(xas, entry, false);
+	wbe->entry = entry;
+	wbe->addr = page_address(pfn_to_page(pfn));
+	wbe->size = count * PAGE_SIZE;
 
-	trace_dax_writeback_one(mapping->host, index, count);
-	return ret;
+	xas_lock_irq(xas);
+	return 1;
 
  put_unlocked:
 	put_unlocked_entry(xas, entry);
 	return ret;
 }
 
+/*
+ * After we have flushed the cache, we can clear the dirty tags. There
+ * cannot be new dirty data in the pfns after the flush has completed as
+ * the pfn mappings are writeprotected and fault waits for mapping entry
+ * lock. All the entries of a batch are finished under one i_pages lock.
+ */
+static void dax_writeback_finish(struct address_space *mapping,
+		struct dax_wb_entry *batch, int nr)
+{
+	XA_STATE(xas, &mapping->i_pages, 0);
+	int i;
+
+	xas_lock_irq(&xas);
+	for (i = 0; i < nr; i++) {
+		xas_set(&xas, batch[i].xa_index);
+		xas_store(&xas, batch[i].entry);
+		xas_clear_mark(&xas, PAGECACHE_TAG_DIRTY);
+		dax_wake_entry(&xas, batch[i].entry, false);
+
+		trace_dax_writeback_one(mapping->host,
+				batch[i].xa_index & ~(batch[i].size / PAGE_SIZE - 1),
+				batch[i].size / PAGE_SIZE);
+	}
+	xas_unlock_irq(&xas);
+}
+
+// Write back all the CPU caches for DAX writeback batches this large, 0 never
+unsigned long sysctl_dax_wbinvd_bytes = 0;
+
+/* dirty entries locked and flushed together */
+#define DAX_WB_BATCH		512
+/* batches this large are flushed by the copy workers of the PMEM socket */
+#define DAX_WB_MT_BYTES		(8UL << 20)
+
+struct dax_wb_flush {
+	struct dax_device *dax_dev;
+	struct dax_wb_entry *batch;
+};
+
+static void dax_writeback_flush_range(void *arg, int start, int end)
+{
+	struct dax_wb_flush *wbf = arg;
+	int i;
+
+	for (i = start; i < end; i++)
+		dax_flush(wbf->dax_dev, wbf->batch[i].addr, wbf->batch[i].size);
+}
+
+static void dax_writeback_flush(struct dax_device *dax_dev,
+		struct dax_wb_entry *batch, int nr)
+{
+	unsigned long wbinvd_bytes = READ_ONCE(sysctl_dax_wbinvd_bytes);
+	struct dax_wb_flush wbf = {
+		.dax_dev = dax_dev,
+		.batch = batch,
+	};
+	size_t bytes = 0;
+	int i, nid;
+
+	for (i = 0; i < nr; i++)
+		bytes += batch[i].size;
+
+	if (wbinvd_bytes && bytes >= wbinvd_bytes && dax_flush_all(dax_dev))
+		return;
+
+	if (bytes < DAX_WB_MT_BYTES) {
+		dax_writeback_flush_range(&wbf, 0, nr);
+		return;
+	}
+
+	nid = page_to_nid(virt_to_page(batch[0].addr));
+#ifdef CONFIG_MIGRATION
+	if (!node_state(nid, N_CPU))
+		nid = pmem_nearest_node(nid);
+#endif
+	if (nid == NUMA_NO_NODE)
+		nid = numa_node_id();
+	copy_page_run_ranges(nid, nr, dax_writeback_flush_range, &wbf);
+}
+
 /*
  * Flush the mapping to the persistent domain within the byte range of [start,
  * end]. This is required by data integrity operations to ensure file data is
  * on persistent storage prior to completion of the operation.
+ *
+ * Dirty entries are locked and write protected in batches whose cache lines
+ * are then flushed together, by several CPUs for large batches, or with a
+ * whole cache writeback above vm.dax_wbinvd_bytes.
  */
 int dax_writeback_mapping_range(struct address_space *mapping,
 		struct dax_device *dax_dev, struct writeback_control *wbc)
@@ -942,6 +1226,8 @@ int dax_writeback_mapping_range(struct address_space *mapping,
 	XA_STATE(xas, &mapping->i_pages, wbc->range_start >> PAGE_SHIFT);
 	struct inode *inode = mapping->host;
 	pgoff_t end_index = wbc->range_end >> PAGE_SHIFT;
+	struct dax_wb_entry one, *batch;
+	int nr = 0, max_nr = DAX_WB_BATCH;
 	void *entry;
 	int ret = 0;
 	unsigned int scanned = 0;
@@ -956,13 +1242,33 @@ int dax_writeback_mapping_range(struct address_space *mapping,
 
 	tag_pages_for_writeback(mapping, xas.xa_index, end_index);
 
+	batch = kmalloc_array(DAX_WB_BATCH, sizeof(*batch),
+			      GFP_NOFS | __GFP_NOWARN);
+	if (!batch) {
+		batch = &one;
+		max_nr = 1;
+	}
+
 	xas_lock_irq(&xas);
 	xas_for_each_marked(&xas, entry, end_index, PAGECACHE_TAG_TOWRITE) {
-		ret = dax_writeback_one(&xas, dax_dev, mapping, entry);
+		ret = dax_writeback_prepare(&xas, mapping, entry, &batch[nr]);
 		if (ret < 0) {
 			mapping_set_error(mapping, ret);
 			break;
 		}
+		nr += ret;
+
+		if (nr == max_nr) {
+			xas_pause(&xas);
+			xas_unlock_irq(&xas);
+			dax_writeback_flush(dax_dev, batch, nr);
+			dax_writeback_finish(mapping, batch, nr);
+			nr = 0;
+			cond_resched();
+			xas_lock_irq(&xas);
+			continue;
+		}
+
 		if (++scanned % XA_CHECK_SCHED)
 			continue;
 
@@ -972,8 +1278,16 @@ int dax_writeback_mapping_range(struct address_space *mapping,
 		xas_lock_irq(&xas);
 	}
 	xas_unlock_irq(&xas);
+
+	if (nr) {
+		dax_writeback_flush(dax_dev, batch, nr);
+		dax_writeback_finish(mapping, batch, nr);
+	}
+	if (batch != &one)
+		kfree(batch);
+
 	trace_dax_writeback_range_done(inode, xas.xa_index, end_index);
-	return ret;
+	return ret < 0 ? ret : 0;
 }
 EXPORT_SYMBOL_GPL(dax_writeback_mapping_range);
 
@@ -1175,6 +1489,33 @@ dax_iomap_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 	return done ? done : ret;
 }
 
+// Smallest DAX read that streams with RWF_STREAM or POSIX_FADV_NOREUSE
+unsigned long sysctl_dax_stream_min_bytes = 32 << 20;
+
+/*
+ * A read larger than the last level cache evicts the working set of the
+ * application to bring in data that will not fit anyway. Only those are
+ * copied with streaming loads and stores.
+ */
+static bool dax_iomap_stream(struct kiocb *iocb, struct iov_iter *iter)
+{
+	return (iocb->ki_flags & IOCB_STREAM) &&
+		iov_iter_count(iter) >= READ_ONCE(sysctl_dax_stream_min_bytes);
+}
+
+/* The streaming threshold defaults to the LLC size of the boot CPU */
+static int __init dax_stream_init(void)
+{
+	struct cpu_cacheinfo *cci = get_cpu_cacheinfo(0);
+
+	if (cci && cci->info_list && cci->num_leaves)
+		sysctl_dax_stream_min_bytes =
+			cci->info_list[cci->num_leaves - 1].size;
+
+	return 0;
+}
+late_initcall(dax_stream_init);
+
 /**
  * dax_iomap_rw - Perform I/O to a DAX file
  * @iocb:	The control block for this I/O
@@ -1192,7 +1533,8 @@ dax_iomap_rw(struct kiocb *iocb, struct iov_iter *iter,
 	struct address_space *mapping = iocb->ki_filp->f_mapping;
 	struct inode *inode = mapping->host;
 	loff_t pos = iocb->ki_pos, ret = 0, done = 0;
-	unsigned flags = 0;
+	unsigned flags = 0, stream = 0;
+	bool streaming = false;
 
 	if (iov_iter_rw(iter) == WRITE) {
 		lockdep_assert_held_write(&inode->i_rwsem);
@@ -1204,6 +1546,11 @@ dax_iomap_rw(struct kiocb *iocb, struct iov_iter *iter,
 	if (iocb->ki_flags & IOCB_NOWAIT)
 		flags |= IOMAP_NOWAIT;
 
+	if (iov_iter_rw(iter) == READ && dax_iomap_stream(iocb, iter)) {
+		stream = copy_stream_save();
+		streaming = true;
+	}
+
 	while (iov_iter_count(iter)) {
 		ret = iomap_apply(inode, pos, iov_iter_count(iter), flags, ops,
 				iter, dax_iomap_actor);
@@ -1213,6 +1560,13 @@ dax_iomap_rw(struct kiocb *iocb, struct iov_iter *iter,
 		done += ret;
 	}
 
+	if (streaming)
+		copy_stream_restore(stream);
+
+	if (iov_iter_rw(iter) == WRITE && done > 0)
+		dax_cache_invalidate(mapping, iocb->ki_pos >> PAGE_SHIFT,
+				     (iocb->ki_pos + done - 1) >> PAGE_SHIFT);
+
 	iocb->ki_pos += done;
 	return done ? done : ret;
 }
@@ -1346,6 +1700,8 @@ static vm_fault_t dax_iomap_pte_fault(struct vm_fault *vmf, pfn_t *pfnp,
 
 		entry = dax_insert_entry(&xas, mapping, vmf, entry, pfn,
 						 0, write && !sync);
+		if (write)
+			dax_cache_unmap(mapping, vmf->pgoff, entry);
 
 		/*
 		 * If we are doing synchronous page fault and inode needs fsync,
@@ -1363,10 +1719,15 @@ static vm_fault_t dax_iomap_pte_fault(struct vm_fault *vmf, pfn_t *pfnp,
 			goto finish_iomap;
 		}
 		trace_dax_insert_mapping(inode, vmf, entry);
-		if (write)
+		if (write) {
 			ret = vmf_insert_mixed_mkwrite(vma, vaddr, pfn);
-		else
-			ret = vmf_insert_mixed(vma, vaddr, pfn);
+		} else {
+			ret = 0;
+			if (dax_cache_want(vmf, mapping, pfn))
+				ret = dax_cache_insert(vmf, mapping, pfn);
+			if (!ret)
+				ret = vmf_insert_mixed(vma, vaddr, pfn);
+		}
 
 		goto finish_iomap;
 	case IOMAP_UNWRITTEN:
@@ -1551,16 +1912,26 @@ static vm_fault_t dax_iomap_pmd_fault(struct vm_fault *vmf, pfn_t *pfnp,
 	if (error)
 		goto unlock_entry;
 
-	if (iomap.offset + iomap.length < pos + PMD_SIZE)
+	/*
+	 * The extent is shorter than the PMD or, below, not PMD aligned on
+	 * the device: the filesystem allocator did not find an aligned
+	 * extent for the range when it was written.
+	 */
+	if (iomap.offset + iomap.length < pos + PMD_SIZE) {
+		count_vm_event(THP_DAX_EXTENT_FALLBACK);
 		goto finish_iomap;
+	}
 
 	sync = dax_fault_is_synchronous(iomap_flags, vma, &iomap);
 
 	switch (iomap.type) {
 	case IOMAP_MAPPED:
 		error = dax_iomap_pfn(&iomap, pos, PMD_SIZE, &pfn);
-		if (error < 0)
+		if (error < 0) {
+			if (error == -EINVAL)
+				count_vm_event(THP_DAX_EXTENT_FALLBACK);
 			goto finish_iomap;
+		}
 
 		entry = dax_insert_entry(&xas, mapping, vmf, entry, pfn,
 						DAX_PMD, write && !sync);
@@ -1619,12 +1990,70 @@ static vm_fault_t dax_iomap_pmd_fault(struct vm_fault *vmf, pfn_t *pfnp,
 	trace_dax_pmd_fault_done(inode, vmf, max_pgoff, result);
 	return result;
 }
+
+// PMDs a sequential DAX read fault maps ahead at most, 0 for none
+int sysctl_dax_fault_around_pmds = 8;
+
+/*
+ * Scanning a large DAX file through a fresh mapping takes one fault, one
+ * ->iomap_begin() and one xarray lookup per PMD. When a read fault lands
+ * right after the PMDs the last one mapped, map the following PMDs too,
+ * doubling the window of the VMA up to vm.dax_fault_around_pmds; any
+ * other fault shrinks it back to nothing. Write faults are left alone so
+ * that blocks are not allocated ahead of the writer.
+ */
+static void dax_pmd_fault_around(struct vm_fault *vmf,
+		const struct iomap_ops *ops)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	unsigned long addr = vmf->address & PMD_MASK;
+	unsigned int max_window = READ_ONCE(sysctl_dax_fault_around_pmds);
+	unsigned int window = 0, i;
+	struct vm_fault fvmf;
+	pmd_t *pmd;
+
+	if (addr == READ_ONCE(vma->dax_fault_next))
+		window = min(max(READ_ONCE(vma->dax_fault_window) * 2, 1U),
+			     max_window);
+
+	for (i = 0; i < window; i++) {
+		addr += PMD_SIZE;
+		if (addr + PMD_SIZE > vma->vm_end ||
+		    (addr & PUD_MASK) != (vmf->address & PUD_MASK))
+			break;
+
+		pmd = pmd_offset(vmf->pud, addr);
+		if (!pmd_none(*pmd))
+			break;
+
+		fvmf = (struct vm_fault) {
+			.vma = vma,
+			.address = addr,
+			.flags = vmf->flags,
+			.gfp_mask = vmf->gfp_mask,
+			.pgoff = linear_page_index(vma, addr),
+			.pud = vmf->pud,
+			.pmd = pmd,
+		};
+		if (dax_iomap_pmd_fault(&fvmf, NULL, ops) != VM_FAULT_NOPAGE)
+			break;
+	}
+
+	WRITE_ONCE(vma->dax_fault_window, window);
+	WRITE_ONCE(vma->dax_fault_next,
+		   (vmf->address & PMD_MASK) + (i + 1) * PMD_SIZE);
+}
 #else
 static vm_fault_t dax_iomap_pmd_fault(struct vm_fault *vmf, pfn_t *pfnp,
 			       const struct iomap_ops *ops)
 {
 	return VM_FAULT_FALLBACK;
 }
+
+static void dax_pmd_fault_around(struct vm_fault *vmf,
+		const struct iomap_ops *ops)
+{
+}
 #endif /* CONFIG_FS_DAX_PMD */
 
 /**
@@ -1643,11 +2072,17 @@ static vm_fault_t dax_iomap_pmd_fault(struct vm_fault *vmf, pfn_t *pfnp,
 vm_fault_t dax_iomap_fault(struct vm_fault *vmf, enum page_entry_size pe_size,
 		    pfn_t *pfnp, int *iomap_errp, const struct iomap_ops *ops)
 {
+	vm_fault_t result;
+
 	switch (pe_size) {
 	case PE_SIZE_PTE:
 		return dax_iomap_pte_fault(vmf, pfnp, iomap_errp, ops);
 	case PE_SIZE_PMD:
-		return dax_iomap_pmd_fault(vmf, pfnp, ops);
+		result = dax_iomap_pmd_fault(vmf, pfnp, ops);
+		if (result == VM_FAULT_NOPAGE &&
+		    !(vmf->flags & FAULT_FLAG_WRITE))
+			dax_pmd_fault_around(vmf, ops);
+		return result;
 	default:
 		return VM_FAULT_FALLBACK;
 	}
@@ -1685,8 +2120,10 @@ dax_insert_pfn_mkwrite(struct vm_fault *vmf, pfn_t pfn, unsigned int order)
 	xas_set_mark(&xas, PAGECACHE_TAG_DIRTY);
 	dax_lock_entry(&xas, entry);
 	xas_unlock_irq(&xas);
-	if (order == 0)
+	if (order == 0) {
+		dax_cache_unmap(mapping, vmf->pgoff, entry);
 		ret = vmf_insert_mixed_mkwrite(vmf->vma, vmf->address, pfn);
+	}
 #ifdef CONFIG_FS_DAX_PMD
 	else if (order == PMD_ORDER)
 		ret = vmf_insert_pfn_pmd(vmf, pfn, FAULT_FLAG_WRITE);
@@ -145,7 +145,9 @@ MODULE_PARM_DESC(mballoc_debug, "Debugging level for ext4's mballoc");
  * value of s_mb_order2_reqs can be tuned via
  * /sys/fs/ext4/<partition>/mb_order2_req.  If the request len is equal to
  * stripe size (sbi->s_stripe), we try to search for contiguous block in
- * stripe size. This should result in better allocation on RAID setups. If
+ * stripe size. This should result in better allocation on RAID setups.
+ * Likewise the data requests of DAX inodes that cover a PMD aligned range
+ * look for PMD aligned chunks, see ext4_mb_dax_align(). If
  * not, we search in the specific group using bitmap for best extents. The
  * tunable min_to_scan and max_to_scan control the behaviour here.
  * min_to_scan indicate how long the mballoc __must__ look for a best
@@ -1813,6 +1815,33 @@ int ext4_mb_try_best_found(struct ext4_allocation_context *ac,
 	return 0;
 }
 
+/*
+ * The chunk the data request of a DAX inode is aligned to, in blocks: a
+ * PMD when the normalized request covers a PMD aligned range, so that
+ * dax_iomap_pmd_fault() can map it with a huge page. The buddy scan finds
+ * aligned chunks already, PMDs being a power of two smaller than a group.
+ * 0 for no alignment.
+ */
+static ext4_grpblk_t ext4_mb_dax_align(struct ext4_allocation_context *ac)
+{
+#ifdef CONFIG_FS_DAX_PMD
+	struct super_block *sb = ac->ac_sb;
+	ext4_grpblk_t align = PMD_SIZE >> sb->s_blocksize_bits;
+
+	if (!(ac->ac_flags & EXT4_MB_HINT_DATA) || !IS_DAX(ac->ac_inode) ||
+	    EXT4_SB(sb)->s_cluster_ratio > 1)
+		return 0;
+	if (align > EXT4_CLUSTERS_PER_GROUP(sb) ||
+	    ac->ac_g_ex.fe_len < align ||
+	    (ac->ac_g_ex.fe_logical & (align - 1)))
+		return 0;
+
+	return align;
+#else
+	return 0;
+#endif
+}
+
 static noinline_for_stack
 int ext4_mb_find_by_goal(struct ext4_allocation_context *ac,
 				struct ext4_buddy *e4b)
@@ -1822,6 +1851,7 @@ int ext4_mb_find_by_goal(struct ext4_allocation_context *ac,
 	int err;
 	struct ext4_sb_info *sbi = EXT4_SB(ac->ac_sb);
 	struct ext4_group_info *grp = ext4_get_group_info(ac->ac_sb, group);
+	ext4_grpblk_t dax_align = ext4_mb_dax_align(ac);
 	struct ext4_free_extent ex;
 
 	if (!(ac->ac_flags & EXT4_MB_HINT_TRY_GOAL))
@@ -1854,6 +1884,17 @@ int ext4_mb_find_by_goal(struct ext4_allocation_context *ac,
 			ac->ac_b_ex = ex;
 			ext4_mb_use_best_found(ac, e4b);
 		}
+	} else if (max >= ac->ac_g_ex.fe_len && dax_align) {
+		ext4_fsblk_t start;
+
+		/* a misaligned goal is left for ext4_mb_scan_aligned() */
+		start = ext4_group_first_block_no(ac->ac_sb, e4b->bd_group) +
+			ex.fe_start;
+		if (!(start & (dax_align - 1))) {
+			ac->ac_found++;
+			ac->ac_b_ex = ex;
+			ext4_mb_use_best_found(ac, e4b);
+		}
 	} else if (max >= ac->ac_g_ex.fe_len) {
 		BUG_ON(ex.fe_len <= 0);
 		BUG_ON(ex.fe_group != ac->ac_g_ex.fe_group);
@@ -1986,14 +2027,14 @@ void ext4_mb_complex_scan_group(struct ext4_allocation_context *ac,
 
 /*
  * This is a special case for storages like raid5
- * we try to find stripe-aligned chunks for stripe-size-multiple requests
+ * we try to find stripe-aligned chunks for stripe-size-multiple requests,
+ * and for DAX inodes PMD aligned chunks
  */
 static noinline_for_stack
 void ext4_mb_scan_aligned(struct ext4_allocation_context *ac,
-				 struct ext4_buddy *e4b)
+				 struct ext4_buddy *e4b, ext4_grpblk_t stripe)
 {
 	struct super_block *sb = ac->ac_sb;
-	struct ext4_sb_info *sbi = EXT4_SB(sb);
 	void *bitmap = e4b->bd_bitmap;
 	struct ext4_free_extent ex;
 	ext4_fsblk_t first_group_block;
@@ -2001,19 +2042,19 @@ void ext4_mb_scan_aligned(struct ext4_allocation_context *ac,
 	ext4_grpblk_t i;
 	int max;
 
-	BUG_ON(sbi->s_stripe == 0);
+	BUG_ON(stripe == 0);
 
 	/* find first stripe-aligned block in group */
 	first_group_block = ext4_group_first_block_no(sb, e4b->bd_group);
 
-	a = first_group_block + sbi->s_stripe - 1;
-	do_div(a, sbi->s_stripe);
-	i = (a * sbi->s_stripe) - first_group_block;
+	a = first_group_block + stripe - 1;
+	do_div(a, stripe);
+	i = (a * stripe) - first_group_block;
 
 	while (i < EXT4_CLUSTERS_PER_GROUP(sb)) {
 		if (!mb_test_bit(i, bitmap)) {
-			max = mb_find_extent(e4b, i, sbi->s_stripe, &ex);
-			if (max >= sbi->s_stripe) {
+			max = mb_find_extent(e4b, i, stripe, &ex);
+			if (max >= stripe) {
 				ac->ac_found++;
 				ex.fe_logical = 0xDEADF00D; /* debug value */
 				ac->ac_b_ex = ex;
@@ -2021,7 +2062,7 @@ void ext4_mb_scan_aligned(struct ext4_allocation_context *ac,
 				break;
 			}
 		}
-		i += sbi->s_stripe;
+		i += stripe;
 	}
 }
 
@@ -2101,6 +2142,7 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 	ext4_group_t ngroups, group, i;
 	int cr;
 	int err = 0, first_err = 0;
+	ext4_grpblk_t dax_align;
 	struct ext4_sb_info *sbi;
 	struct super_block *sb;
 	struct ext4_buddy e4b;
@@ -2154,6 +2196,8 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 		spin_unlock(&sbi->s_md_lock);
 	}
 
+	dax_align = ext4_mb_dax_align(ac);
+
 	/* Let's just scan groups to find more-less suitable blocks */
 	cr = ac->ac_2order ? 0 : 1;
 	/*
@@ -2211,7 +2255,9 @@ ext4_mb_regular_allocator(struct ext4_allocation_context *ac)
 				ext4_mb_simple_scan_group(ac, &e4b);
 			else if (cr == 1 && sbi->s_stripe &&
 					!(ac->ac_g_ex.fe_len % sbi->s_stripe))
-				ext4_mb_scan_aligned(ac, &e4b);
+				ext4_mb_scan_aligned(ac, &e4b, sbi->s_stripe);
+			else if (cr == 1 && dax_align)
+				ext4_mb_scan_aligned(ac, &e4b, dax_align);
 			else
 				ext4_mb_complex_scan_group(ac, &e4b);
 
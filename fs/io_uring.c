@@ -76,6 +76,10 @@
 #include <linux/fadvise.h>
 #include <linux/eventpoll.h>
 #include <linux/fs_struct.h>
+#include <linux/cpuset.h>
+#include <linux/security.h>
+#include <linux/migrate.h>
+#include <linux/exchange.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/io_uring.h>
@@ -420,6 +424,16 @@ struct io_madvise {
 	u32				advice;
 };
 
+struct io_pages {
+	struct file			*file;
+	struct task_struct		*task;
+	u64				pages;
+	u64				nodes;
+	u64				status;
+	u32				nr;
+	u32				flags;
+};
+
 struct io_epoll {
 	struct file			*file;
 	int				epfd;
@@ -544,6 +558,7 @@ struct io_kiocb {
 		struct io_fadvise	fadvise;
 		struct io_madvise	madvise;
 		struct io_epoll		epoll;
+		struct io_pages		pages;
 	};
 
 	struct io_async_ctx		*io;
@@ -745,6 +760,12 @@ static const struct io_op_def io_op_defs[] = {
 		.unbound_nonreg_file	= 1,
 		.file_table		= 1,
 	},
+	[IORING_OP_MOVE_PAGES] = {
+		.needs_mm		= 1,
+	},
+	[IORING_OP_EXCHANGE_PAGES] = {
+		.needs_mm		= 1,
+	},
 };
 
 static void io_wq_submit_work(struct io_wq_work **workptr);
@@ -2747,6 +2768,81 @@ static int io_madvise(struct io_kiocb *req, struct io_kiocb **nxt,
 #endif
 }
 
+static int io_pages_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
+{
+#if defined(CONFIG_NUMA) && defined(CONFIG_MIGRATION)
+	struct io_uring_pages_args __user *uargs;
+	struct io_uring_pages_args args;
+	int ret;
+
+	if (sqe->ioprio || sqe->buf_index || sqe->off)
+		return -EINVAL;
+
+	uargs = u64_to_user_ptr(READ_ONCE(sqe->addr));
+	if (copy_from_user(&args, uargs, sizeof(args)))
+		return -EFAULT;
+
+	ret = security_task_movememory(current);
+	if (ret)
+		return ret;
+
+	req->pages.pages = args.pages;
+	req->pages.nodes = args.nodes;
+	req->pages.status = args.status;
+	req->pages.nr = READ_ONCE(sqe->len);
+	req->pages.flags = READ_ONCE(sqe->pages_flags);
+	/* the cpuset of the submitter, the worker running the op has none */
+	req->pages.task = get_task_struct(current);
+	req->flags |= REQ_F_NEED_CLEANUP;
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+/*
+ * move_pages() and exchange_pages() on the address space of the ring.
+ * Unlike the system calls, only the LRU pagevecs of the CPU running the
+ * op are drained, so that a stream of small requests does not pay for
+ * lru_add_drain_all() each time.
+ */
+static int io_pages(struct io_kiocb *req, struct io_kiocb **nxt,
+		    bool force_nonblock)
+{
+#if defined(CONFIG_NUMA) && defined(CONFIG_MIGRATION)
+	struct io_pages *ip = &req->pages;
+	nodemask_t task_nodes;
+	int ret;
+
+	if (force_nonblock)
+		return -EAGAIN;
+
+	task_nodes = cpuset_mems_allowed(ip->task);
+	put_task_struct(ip->task);
+	req->flags &= ~REQ_F_NEED_CLEANUP;
+
+	if (req->opcode == IORING_OP_MOVE_PAGES)
+		ret = move_pages_mm(current->mm, task_nodes, ip->nr,
+				    u64_to_user_ptr(ip->pages),
+				    u64_to_user_ptr(ip->nodes),
+				    u64_to_user_ptr(ip->status),
+				    ip->flags, false);
+	else
+		ret = exchange_pages_mm(current->mm, task_nodes, ip->nr,
+					u64_to_user_ptr(ip->pages),
+					u64_to_user_ptr(ip->nodes),
+					u64_to_user_ptr(ip->status),
+					ip->flags, false);
+	if (ret < 0)
+		req_set_fail_links(req);
+	io_cqring_add_event(req, ret);
+	io_put_req_find_next(req, nxt);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
 static int io_fadvise_prep(struct io_kiocb *req, const struct io_uring_sqe *sqe)
 {
 	if (sqe->ioprio || sqe->buf_index || sqe->addr)
@@ -4217,6 +4313,10 @@ static int io_req_defer_prep(struct io_kiocb *req,
 	case IORING_OP_EPOLL_CTL:
 		ret = io_epoll_ctl_prep(req, sqe);
 		break;
+	case IORING_OP_MOVE_PAGES:
+	case IORING_OP_EXCHANGE_PAGES:
+		ret = io_pages_prep(req, sqe);
+		break;
 	default:
 		printk_once(KERN_WARNING "io_uring: unhandled opcode %d\n",
 				req->opcode);
@@ -4279,6 +4379,10 @@ static void io_cleanup_req(struct io_kiocb *req)
 	case IORING_OP_STATX:
 		putname(req->open.filename);
 		break;
+	case IORING_OP_MOVE_PAGES:
+	case IORING_OP_EXCHANGE_PAGES:
+		put_task_struct(req->pages.task);
+		break;
 	}
 
 	req->flags &= ~REQ_F_NEED_CLEANUP;
@@ -4482,6 +4586,15 @@ static int io_issue_sqe(struct io_kiocb *req, const struct io_uring_sqe *sqe,
 		}
 		ret = io_epoll_ctl(req, nxt, force_nonblock);
 		break;
+	case IORING_OP_MOVE_PAGES:
+	case IORING_OP_EXCHANGE_PAGES:
+		if (sqe) {
+			ret = io_pages_prep(req, sqe);
+			if (ret)
+				break;
+		}
+		ret = io_pages(req, nxt, force_nonblock);
+		break;
 	default:
 		ret = -EINVAL;
 		break;
@@ -7239,6 +7352,7 @@ static int __init io_uring_init(void)
 	BUILD_BUG_SQE_ELEM(28, __u32,  open_flags);
 	BUILD_BUG_SQE_ELEM(28, __u32,  statx_flags);
 	BUILD_BUG_SQE_ELEM(28, __u32,  fadvise_advice);
+	BUILD_BUG_SQE_ELEM(28, __u32,  pages_flags);
 	BUILD_BUG_SQE_ELEM(32, __u64,  user_data);
 	BUILD_BUG_SQE_ELEM(40, __u16,  buf_index);
 	BUILD_BUG_SQE_ELEM(42, __u16,  personality);
@@ -999,9 +999,11 @@ iomap_zero_range_actor(struct inode *inode, loff_t pos, loff_t count,
 		offset = offset_in_page(pos);
 		bytes = min_t(loff_t, PAGE_SIZE - offset, count);
 
-		if (IS_DAX(inode))
+		if (IS_DAX(inode)) {
 			status = iomap_dax_zero(pos, offset, bytes, iomap);
-		else
+			dax_cache_invalidate(inode->i_mapping,
+					     pos >> PAGE_SHIFT, pos >> PAGE_SHIFT);
+		} else
 			status = iomap_zero(inode, pos, offset, bytes, iomap,
 					srcmap);
 		if (status < 0)
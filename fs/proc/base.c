@@ -315,6 +315,8 @@ static int proc_pid_page_migration_stats(struct seq_file *m, struct pid_namespac
 		var.nr_exchanges, \
 		var.nr_exchange_base_pages, \
 		var.nr_exchange_huge_pages, \
+		var.nr_isolated_pages, \
+		var.nr_failed_pages, \
 		SHOW_PAGE_MIGRATION_COUNTERS(var.f2s), \
 		SHOW_PAGE_MIGRATION_COUNTERS(var.s2f)
 
@@ -325,6 +327,8 @@ static int proc_pid_page_migration_stats(struct seq_file *m, struct pid_namespac
 		"ExchangePages_nr_exchanges %lu\n"
 		"ExchangePagesBase_nr_base_pages %lu\n"
 		"ExchangePagesHuge_nr_base_pages %lu\n"
+		"Isolated_nr_base_pages %lu\n"
+		"MigrationFailed_nr_base_pages %lu\n"
 		"Fast2Slow_nr_migrations %lu\n"
 		"Fast2SlowBasePageMigrations_nr_base_pages %lu\n"
 		"Fast2SlowHugePageMigrations_nr_base_pages %lu\n"
@@ -358,6 +362,8 @@ static int proc_pid_child_stats(struct seq_file *m, struct pid_namespace *ns,
 			"ExchangePages_nr_exchanges %lu\n"
 			"ExchangePagesBase_nr_base_pages %lu\n"
 			"ExchangePagesHuge_nr_base_pages %lu\n"
+			"Isolated_nr_base_pages %lu\n"
+			"MigrationFailed_nr_base_pages %lu\n"
 			"Fast2Slow_nr_migrations %lu\n"
 			"Fast2SlowBasePageMigrations_nr_base_pages %lu\n"
 			"Fast2SlowHugePageMigrations_nr_base_pages %lu\n"
@@ -3289,6 +3295,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 	REG("maps",       S_IRUGO, proc_pid_maps_operations),
 #ifdef CONFIG_NUMA
 	REG("numa_maps",  S_IRUGO, proc_pid_numa_maps_operations),
+#endif
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+	REG("heat_map",   S_IRUSR|S_IWUSR, proc_pid_heat_map_operations),
 #endif
 	REG("mem",        S_IRUSR|S_IWUSR, proc_mem_operations),
 	LNK("cwd",        proc_cwd_link),
@@ -3302,6 +3311,9 @@ static const struct pid_entry tgid_base_stuff[] = {
 	REG("smaps",      S_IRUGO, proc_pid_smaps_operations),
 	REG("smaps_rollup", S_IRUGO, proc_pid_smaps_rollup_operations),
 	REG("pagemap",    S_IRUSR, proc_pagemap_operations),
+#ifdef CONFIG_IDLE_PAGE_TRACKING
+	REG("page_idle",  S_IRUSR|S_IWUSR, proc_page_idle_operations),
+#endif
 #endif
 #ifdef CONFIG_SECURITY
 	DIR("attr",       S_IRUGO|S_IXUGO, proc_attr_dir_inode_operations, proc_attr_dir_operations),
@@ -3710,6 +3722,9 @@ static const struct pid_entry tid_base_stuff[] = {
 	REG("smaps",     S_IRUGO, proc_pid_smaps_operations),
 	REG("smaps_rollup", S_IRUGO, proc_pid_smaps_rollup_operations),
 	REG("pagemap",    S_IRUSR, proc_pagemap_operations),
+#ifdef CONFIG_IDLE_PAGE_TRACKING
+	REG("page_idle",  S_IRUSR|S_IWUSR, proc_page_idle_operations),
+#endif
 #endif
 #ifdef CONFIG_SECURITY
 	DIR("attr",      S_IRUGO|S_IXUGO, proc_attr_dir_inode_operations, proc_attr_dir_operations),
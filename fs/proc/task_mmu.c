@@ -19,6 +19,7 @@
 #include <linux/shmem_fs.h>
 #include <linux/uaccess.h>
 #include <linux/pkeys.h>
+#include <linux/access_scan.h>
 
 #include <asm/elf.h>
 #include <asm/tlb.h>
@@ -1644,6 +1645,229 @@ const struct file_operations proc_pagemap_operations = {
 	.open		= pagemap_open,
 	.release	= pagemap_release,
 };
+
+#ifdef CONFIG_IDLE_PAGE_TRACKING
+struct page_idle_walk {
+	u64 *bitmap;		/* one bit per page from @start */
+	unsigned long start;
+	bool write;
+};
+
+static bool page_idle_walk_test(struct page_idle_walk *piw,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long i = (addr - piw->start) >> PAGE_SHIFT;
+	unsigned long last = (end - piw->start) >> PAGE_SHIFT;
+
+	for (; i < last; i++)
+		if (piw->bitmap[i / 64] & (1ULL << (i % 64)))
+			return true;
+	return false;
+}
+
+static void page_idle_walk_set(struct page_idle_walk *piw,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long i = (addr - piw->start) >> PAGE_SHIFT;
+	unsigned long last = (end - piw->start) >> PAGE_SHIFT;
+
+	for (; i < last; i++)
+		piw->bitmap[i / 64] |= 1ULL << (i % 64);
+}
+
+/*
+ * Mark @page, mapped at [@addr, @end), idle, or report whether it still
+ * is. @young is whether the accessed bit of the mapping was set, which the
+ * caller cleared. As in mm/page_idle.c, a cleared accessed bit is handed
+ * over to reclaim with the young flag.
+ */
+static void page_idle_walk_page(struct page_idle_walk *piw, struct page *page,
+		bool young, unsigned long addr, unsigned long end)
+{
+	if (young) {
+		clear_page_idle(page);
+		set_page_young(page);
+	}
+
+	if (piw->write)
+		set_page_idle(page);
+	else if (page_is_idle(page))
+		page_idle_walk_set(piw, addr, end);
+}
+
+static int page_idle_pmd_range(pmd_t *pmdp, unsigned long addr,
+		unsigned long end, struct mm_walk *walk)
+{
+	struct page_idle_walk *piw = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *pte, *orig_pte;
+	struct page *page;
+	spinlock_t *ptl;
+	bool young;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	ptl = pmd_trans_huge_lock(pmdp, vma);
+	if (ptl) {
+		/* one accessed bit and one idle flag for the whole THP */
+		if (pmd_present(*pmdp) && (!piw->write ||
+		    page_idle_walk_test(piw, addr, end))) {
+			page = pmd_page(*pmdp);
+			if (PageLRU(page)) {
+				young = pmdp_clear_young_notify(vma,
+						addr & HPAGE_PMD_MASK, pmdp);
+				page_idle_walk_page(piw, page, young, addr, end);
+			}
+		}
+		spin_unlock(ptl);
+		return 0;
+	}
+
+	if (pmd_trans_unstable(pmdp))
+		return 0;
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+	orig_pte = pte = pte_offset_map_lock(walk->mm, pmdp, addr, &ptl);
+	for (; addr < end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+		if (piw->write && !page_idle_walk_test(piw, addr, addr + PAGE_SIZE))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || !PageLRU(page))
+			continue;
+		young = ptep_clear_young_notify(vma, addr, pte);
+		page_idle_walk_page(piw, page, young, addr, addr + PAGE_SIZE);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+
+	cond_resched();
+
+	return 0;
+}
+
+static const struct mm_walk_ops page_idle_walk_ops = {
+	.pmd_entry	= page_idle_pmd_range,
+};
+
+/*
+ * /proc/pid/page_idle - the idle page tracking bitmap by virtual address
+ *
+ * Bit i % 64 of the u64 at offset i / 64 * 8 is the idle bit of the page
+ * at virtual address i * PAGE_SIZE, with the same meaning as in
+ * /sys/kernel/mm/page_idle/bitmap: writing a bit marks the page idle,
+ * reading it tells whether the page is still idle, not accessed since.
+ * The page tables are walked instead of the rmap, so only the accessed
+ * bits of this address space are looked at.
+ *
+ * A PMD mapped THP has one idle bit: all the bits of its range read the
+ * same and writing any of them marks the whole THP idle, for the cost of
+ * a single accessed bit test. Unmapped pages read as not idle.
+ */
+static ssize_t page_idle_rw(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos, bool write)
+{
+	struct mm_struct *mm = file->private_data;
+	struct page_idle_walk piw = { .write = write };
+	unsigned long svpfn, start_vaddr, end_vaddr, end;
+	size_t len;
+	int ret = 0, copied = 0;
+
+	if (!mm || !mmget_not_zero(mm))
+		return 0;
+
+	ret = -EINVAL;
+	if ((*ppos % sizeof(u64)) || (count % sizeof(u64)))
+		goto out_mm;
+
+	ret = -ENOMEM;
+	piw.bitmap = (u64 *)__get_free_page(GFP_KERNEL);
+	if (!piw.bitmap)
+		goto out_mm;
+
+	svpfn = *ppos * BITS_PER_BYTE;
+	end_vaddr = mm->task_size;
+	start_vaddr = end_vaddr;
+	if (svpfn < end_vaddr >> PAGE_SHIFT)
+		start_vaddr = svpfn << PAGE_SHIFT;
+
+	ret = 0;
+	while (count && start_vaddr < end_vaddr) {
+		/* one page of bitmap per mmap_sem hold */
+		len = min_t(size_t, count, PAGE_SIZE);
+		end = start_vaddr + ((len * BITS_PER_BYTE) << PAGE_SHIFT);
+		if (end < start_vaddr || end > end_vaddr)
+			end = end_vaddr;
+		len = DIV_ROUND_UP((end - start_vaddr) >> PAGE_SHIFT, 64) *
+			sizeof(u64);
+
+		if (write) {
+			if (copy_from_user(piw.bitmap, buf, len)) {
+				ret = -EFAULT;
+				break;
+			}
+		} else {
+			memset(piw.bitmap, 0, len);
+		}
+
+		piw.start = start_vaddr;
+		ret = down_read_killable(&mm->mmap_sem);
+		if (ret)
+			break;
+		walk_page_range(mm, start_vaddr, end, &page_idle_walk_ops, &piw);
+		up_read(&mm->mmap_sem);
+
+		if (!write && copy_to_user(buf, piw.bitmap, len)) {
+			ret = -EFAULT;
+			break;
+		}
+		start_vaddr = end;
+		copied += len;
+		buf += len;
+		count -= len;
+	}
+	*ppos += copied;
+	if (copied)
+		ret = copied;
+
+	free_page((unsigned long)piw.bitmap);
+out_mm:
+	mmput(mm);
+	return ret;
+}
+
+static ssize_t page_idle_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	return page_idle_rw(file, buf, count, ppos, false);
+}
+
+static ssize_t page_idle_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	return page_idle_rw(file, (char __user *)buf, count, ppos, true);
+}
+
+/* marking pages idle changes what reclaim and tiering do with them */
+static int page_idle_open(struct inode *inode, struct file *file)
+{
+	struct mm_struct *mm;
+
+	mm = proc_mem_open(inode, file->f_mode & FMODE_WRITE ?
+			   PTRACE_MODE_ATTACH : PTRACE_MODE_READ);
+	if (IS_ERR(mm))
+		return PTR_ERR(mm);
+	file->private_data = mm;
+	return 0;
+}
+
+const struct file_operations proc_page_idle_operations = {
+	.llseek		= mem_lseek,
+	.read		= page_idle_read,
+	.write		= page_idle_write,
+	.open		= page_idle_open,
+	.release	= pagemap_release,
+};
+#endif /* CONFIG_IDLE_PAGE_TRACKING */
 #endif /* CONFIG_PROC_PAGE_MONITOR */
 
 #ifdef CONFIG_NUMA
@@ -1912,3 +2136,318 @@ const struct file_operations proc_pid_numa_maps_operations = {
 };
 
 #endif /* CONFIG_NUMA */
+
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+/*
+ * /proc/pid/heat_map lists the access frequencies the regions of
+ * mm/access_region.c have for the address space, keyed for the same
+ * program restarted to find its memory again, one range per line:
+ *
+ *   file <major>:<minor> <inode> <offset> <length> <frequency>
+ *   anon <brk|stack|mmap> <offset> <length> <frequency>
+ *
+ * A range of a file mapping is keyed by its offset in the file, one of
+ * anonymous memory by its offset from the start of the heap, the start of
+ * the stack or the mmap base, which the randomization of the layout moves
+ * along with the mappings. The ranges the regions have no frequency for
+ * yet are left out. Writing such lines seeds the regions of the address
+ * space with them, see access_regions_import().
+ */
+
+/* a write of a heat map takes at most this much, whole lines of it */
+#define HEAT_MAP_WRITE_MAX	(16 * PAGE_SIZE)
+/* ranges imported at once */
+#define HEAT_MAP_SEEDS		(PAGE_SIZE / sizeof(struct access_region_seed))
+
+enum heat_map_anchor {
+	HEAT_MAP_BRK,
+	HEAT_MAP_STACK,
+	HEAT_MAP_MMAP,
+};
+
+static const char * const heat_map_anchors[] = {
+	[HEAT_MAP_BRK]		= "brk",
+	[HEAT_MAP_STACK]	= "stack",
+	[HEAT_MAP_MMAP]		= "mmap",
+};
+
+static unsigned long heat_map_base(struct mm_struct *mm, int anchor)
+{
+	switch (anchor) {
+	case HEAT_MAP_BRK:
+		return mm->start_brk;
+	case HEAT_MAP_STACK:
+		return mm->start_stack;
+	default:
+		return mm->mmap_base;
+	}
+}
+
+/* What the anonymous memory of @vma is keyed from */
+static int heat_map_anchor(struct vm_area_struct *vma)
+{
+	struct mm_struct *mm = vma->vm_mm;
+
+	if (vma->vm_start <= mm->brk && vma->vm_end >= mm->start_brk)
+		return HEAT_MAP_BRK;
+	if (is_stack(vma))
+		return HEAT_MAP_STACK;
+	return HEAT_MAP_MMAP;
+}
+
+static void heat_map_show_range(struct seq_file *m,
+		struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int freq)
+{
+	struct inode *inode;
+	int anchor;
+
+	if (vma->vm_file) {
+		inode = file_inode(vma->vm_file);
+		seq_printf(m, "file %02x:%02x %lu %llu",
+			   MAJOR(inode->i_sb->s_dev), MINOR(inode->i_sb->s_dev),
+			   inode->i_ino, ((unsigned long long)vma->vm_pgoff <<
+					  PAGE_SHIFT) + start - vma->vm_start);
+	} else {
+		anchor = heat_map_anchor(vma);
+		seq_printf(m, "anon %s %ld", heat_map_anchors[anchor],
+			   (long)(start - heat_map_base(vma->vm_mm, anchor)));
+	}
+	seq_printf(m, " %lu %d\n", end - start, freq);
+}
+
+static int show_heat_map(struct seq_file *m, void *v)
+{
+	struct vm_area_struct *vma = v;
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr, end;
+	int freq;
+
+	if (!mm)
+		return 0;
+
+	/* mmap_sem is held by m_start */
+	for (addr = vma->vm_start; addr < vma->vm_end; addr = end) {
+		freq = access_region_frequency(mm, addr, &end);
+		end = min(end, vma->vm_end);
+		if (freq >= 0)
+			heat_map_show_range(m, vma, addr, end, freq);
+	}
+
+	m_cache_vma(m, vma);
+	return 0;
+}
+
+static const struct seq_operations proc_pid_heat_map_op = {
+	.start	= m_start,
+	.next	= m_next,
+	.stop	= m_stop,
+	.show	= show_heat_map,
+};
+
+struct heat_map_import {
+	struct task_struct *task;
+	struct mm_struct *mm;
+	struct access_region_seed *seed;
+	int nr;
+};
+
+static void heat_map_seed(struct heat_map_import *hmi, unsigned long start,
+		unsigned long end, int freq)
+{
+	struct access_region_seed *seed = &hmi->seed[hmi->nr++];
+
+	seed->start = start & PAGE_MASK;
+	seed->end = PAGE_ALIGN(end);
+	seed->freq = freq;
+}
+
+/* The mappings of [@off, @off + @len) of file @ino of @dev */
+static void heat_map_seed_file(struct heat_map_import *hmi, dev_t dev,
+		unsigned long ino, u64 off, unsigned long len, int freq)
+{
+	struct vm_area_struct *vma;
+	struct inode *inode;
+	u64 vm_off, vm_end;
+
+	for (vma = hmi->mm->mmap; vma && hmi->nr < HEAT_MAP_SEEDS;
+	     vma = vma->vm_next) {
+		if (!vma->vm_file)
+			continue;
+		inode = file_inode(vma->vm_file);
+		if (inode->i_ino != ino || inode->i_sb->s_dev != dev)
+			continue;
+
+		vm_off = (u64)vma->vm_pgoff << PAGE_SHIFT;
+		vm_end = vm_off + vma->vm_end - vma->vm_start;
+		if (off >= vm_end || off + len <= vm_off)
+			continue;
+		heat_map_seed(hmi, vma->vm_start + max(off, vm_off) - vm_off,
+			      vma->vm_start + min(off + len, vm_end) - vm_off,
+			      freq);
+	}
+}
+
+/* The anonymous memory of [@start, @end) */
+static void heat_map_seed_anon(struct heat_map_import *hmi,
+		unsigned long start, unsigned long end, int freq)
+{
+	struct vm_area_struct *vma;
+
+	for (vma = find_vma(hmi->mm, start);
+	     vma && vma->vm_start < end && hmi->nr < HEAT_MAP_SEEDS;
+	     vma = vma->vm_next) {
+		if (vma->vm_file)
+			continue;
+		heat_map_seed(hmi, max(start, vma->vm_start),
+			      min(end, vma->vm_end), freq);
+	}
+}
+
+/*
+ * Add the ranges of the address space the line of a heat map maps to. The
+ * mappings past the room left for ranges are dropped.
+ */
+static int heat_map_parse(struct heat_map_import *hmi, char *line)
+{
+	struct mm_struct *mm = hmi->mm;
+	unsigned int major, minor;
+	unsigned long ino, len, start;
+	unsigned long long off;
+	char name[8];
+	int anchor = -1, freq;
+	long delta;
+
+	if (sscanf(line, "file %x:%x %lu %llu %lu %d", &major, &minor, &ino,
+		   &off, &len, &freq) == 6) {
+		if (off + len < off)
+			return -EINVAL;
+	} else if (sscanf(line, "anon %7s %ld %lu %d", name, &delta, &len,
+			  &freq) == 4) {
+		anchor = match_string(heat_map_anchors,
+				      ARRAY_SIZE(heat_map_anchors), name);
+		if (anchor < 0)
+			return -EINVAL;
+	} else {
+		return -EINVAL;
+	}
+	if (!len || freq < 0 || freq > 8)
+		return -EINVAL;
+
+	if (down_read_killable(&mm->mmap_sem))
+		return -EINTR;
+	if (anchor < 0) {
+		heat_map_seed_file(hmi, MKDEV(major, minor), ino, off, len,
+				   freq);
+	} else {
+		start = heat_map_base(mm, anchor) + delta;
+		if (start + len > start && start + len <= mm->task_size)
+			heat_map_seed_anon(hmi, start, start + len, freq);
+	}
+	up_read(&mm->mmap_sem);
+
+	return 0;
+}
+
+static int heat_map_flush(struct heat_map_import *hmi)
+{
+	int nr = hmi->nr;
+
+	if (!nr)
+		return 0;
+	hmi->nr = 0;
+	return access_regions_import(hmi->task, hmi->mm, hmi->seed, nr);
+}
+
+static ssize_t heat_map_write(struct file *file, const char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct seq_file *seq = file->private_data;
+	struct proc_maps_private *priv = seq->private;
+	struct heat_map_import hmi = { .mm = priv->mm };
+	char *kbuf, *line, *next;
+	int ret;
+
+	if (count > HEAT_MAP_WRITE_MAX)
+		count = HEAT_MAP_WRITE_MAX;
+	kbuf = memdup_user_nul(buf, count);
+	if (IS_ERR(kbuf))
+		return PTR_ERR(kbuf);
+
+	/* a line cut by the limit is left to the next write */
+	if (count == HEAT_MAP_WRITE_MAX) {
+		next = strrchr(kbuf, '\n');
+		if (!next) {
+			ret = -EINVAL;
+			goto out_buf;
+		}
+		*++next = '\0';
+		count = next - kbuf;
+	}
+
+	ret = -ENOMEM;
+	hmi.seed = kmalloc_array(HEAT_MAP_SEEDS, sizeof(*hmi.seed),
+				 GFP_KERNEL);
+	if (!hmi.seed)
+		goto out_buf;
+
+	ret = -ESRCH;
+	hmi.task = get_proc_task(file_inode(file));
+	if (!hmi.task)
+		goto out_seed;
+	if (!hmi.mm || !mmget_not_zero(hmi.mm))
+		goto out_task;
+
+	next = kbuf;
+	while ((line = strsep(&next, "\n"))) {
+		line = strim(line);
+		if (!*line)
+			continue;
+		if (hmi.nr == HEAT_MAP_SEEDS) {
+			ret = heat_map_flush(&hmi);
+			if (ret)
+				goto out_mm;
+		}
+		ret = heat_map_parse(&hmi, line);
+		if (ret)
+			goto out_mm;
+	}
+	ret = heat_map_flush(&hmi);
+
+out_mm:
+	mmput(hmi.mm);
+out_task:
+	put_task_struct(hmi.task);
+out_seed:
+	kfree(hmi.seed);
+out_buf:
+	kfree(kbuf);
+	return ret ? ret : count;
+}
+
+static int pid_heat_map_open(struct inode *inode, struct file *file)
+{
+	/* importing a heat map steers the placement of the task's memory */
+	if (file->f_mode & FMODE_WRITE) {
+		struct task_struct *task = get_proc_task(inode);
+		bool allowed;
+
+		if (!task)
+			return -ESRCH;
+		allowed = ptrace_may_access(task, PTRACE_MODE_ATTACH_FSCREDS);
+		put_task_struct(task);
+		if (!allowed)
+			return -EACCES;
+	}
+
+	return do_maps_open(inode, file, &proc_pid_heat_map_op);
+}
+
+const struct file_operations proc_pid_heat_map_operations = {
+	.open		= pid_heat_map_open,
+	.read		= seq_read,
+	.write		= heat_map_write,
+	.llseek		= seq_lseek,
+	.release	= proc_map_release,
+};
+#endif /* CONFIG_PAGE_ACCESS_SCAN */
@@ -116,12 +116,30 @@ xfs_iomap_end_fsb(
 		   XFS_B_TO_FSB(mp, mp->m_super->s_maxbytes));
 }
 
+/*
+ * DAX files are allocated in PMD sized and aligned chunks of the file so
+ * that dax_iomap_pmd_fault() can map them with huge pages. Where the chunk
+ * lands on the device is up to the allocator, which aligns it too when the
+ * stripe unit is a multiple of the PMD size.
+ */
+static xfs_extlen_t
+xfs_dax_alignment(
+	struct xfs_inode	*ip)
+{
+#ifdef CONFIG_FS_DAX_PMD
+	if (IS_DAX(VFS_I(ip)) && !XFS_IS_REALTIME_INODE(ip))
+		return XFS_B_TO_FSBT(ip->i_mount, PMD_SIZE);
+#endif
+	return 0;
+}
+
 static xfs_extlen_t
 xfs_eof_alignment(
 	struct xfs_inode	*ip)
 {
 	struct xfs_mount	*mp = ip->i_mount;
 	xfs_extlen_t		align = 0;
+	xfs_extlen_t		dax_align = xfs_dax_alignment(ip);
 
 	if (!XFS_IS_REALTIME_INODE(ip)) {
 		/*
@@ -141,6 +159,13 @@ xfs_eof_alignment(
 			align = 0;
 	}
 
+	/*
+	 * DAX files round up to the PMD whatever their size, a file growing
+	 * in smaller writes would otherwise never get a PMD sized extent.
+	 */
+	if (dax_align)
+		align = align ? roundup_64(align, dax_align) : dax_align;
+
 	return align;
 }
 
@@ -793,10 +818,16 @@ xfs_direct_write_iomap_begin(
 	length = min_t(loff_t, length, 1024 * PAGE_SIZE);
 	end_fsb = xfs_iomap_end_fsb(mp, offset, length);
 
-	if (offset + length > XFS_ISIZE(ip))
+	if (offset + length > XFS_ISIZE(ip)) {
 		end_fsb = xfs_iomap_eof_align_last_fsb(ip, end_fsb);
-	else if (nimaps && imap.br_startblock == HOLESTARTBLOCK)
+	} else if (nimaps && imap.br_startblock == HOLESTARTBLOCK) {
+		xfs_extlen_t	dax_align = xfs_dax_alignment(ip);
+
+		/* fill the PMD of a DAX hole, within the hole */
+		if (dax_align)
+			end_fsb = roundup_64(end_fsb, dax_align);
 		end_fsb = min(end_fsb, imap.br_startoff + imap.br_blockcount);
+	}
 	xfs_iunlock(ip, lockmode);
 
 	error = xfs_iomap_write_direct(ip, offset_fsb, end_fsb - offset_fsb,
@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_ACCESS_SCAN_H
+#define _LINUX_ACCESS_SCAN_H
+
+#include <linux/types.h>
+#include <linux/errno.h>
+
+struct mm_struct;
+struct task_struct;
+struct page;
+struct ctl_table;
+
+/* An address range of an imported heat map, see access_regions_import() */
+struct access_region_seed {
+	unsigned long start;
+	unsigned long end;
+	int freq;
+};
+
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+extern struct page_ext_operations page_access_ops;
+extern int sysctl_access_scan_pages;
+extern int sysctl_access_scan_hot_threshold;
+extern int sysctl_access_scan_guest_pages;
+extern int sysctl_access_scan_thp_subpages;
+extern int sysctl_access_scan_regions;
+
+void access_scan_mm(struct mm_struct *mm);
+int access_region_frequency(struct mm_struct *mm, unsigned long addr,
+		unsigned long *end);
+void access_regions_exit(struct mm_struct *mm);
+int access_regions_import(struct task_struct *task, struct mm_struct *mm,
+		struct access_region_seed *seed, int nr);
+int page_access_frequency(struct page *page);
+int page_subpage_access_frequency(struct page *page);
+void page_access_split(struct page *page);
+bool access_scan_thp_sampling(struct page *page);
+
+static inline bool access_scan_enabled(void)
+{
+	return READ_ONCE(sysctl_access_scan_pages) > 0 ||
+		READ_ONCE(sysctl_access_scan_guest_pages) > 0 ||
+		READ_ONCE(sysctl_access_scan_regions) > 0;
+}
+
+static inline int access_scan_hot_threshold(void)
+{
+	return READ_ONCE(sysctl_access_scan_hot_threshold);
+}
+#else
+static inline void access_scan_mm(struct mm_struct *mm)
+{
+}
+
+static inline int access_region_frequency(struct mm_struct *mm,
+		unsigned long addr, unsigned long *end)
+{
+	*end = -1UL;
+	return -1;
+}
+
+static inline void access_regions_exit(struct mm_struct *mm)
+{
+}
+
+static inline int access_regions_import(struct task_struct *task,
+		struct mm_struct *mm, struct access_region_seed *seed, int nr)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline int page_access_frequency(struct page *page)
+{
+	return -1;
+}
+
+static inline int page_subpage_access_frequency(struct page *page)
+{
+	return -1;
+}
+
+static inline void page_access_split(struct page *page)
+{
+}
+
+static inline bool access_scan_thp_sampling(struct page *page)
+{
+	return false;
+}
+
+static inline bool access_scan_enabled(void)
+{
+	return false;
+}
+
+static inline int access_scan_hot_threshold(void)
+{
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_PAGE_ACCESS_SAMPLE
+extern bool access_sample_active;
+extern unsigned long sysctl_access_sample_event;
+extern unsigned long sysctl_access_sample_ldlat;
+extern unsigned long sysctl_access_sample_period;
+extern int sysctl_access_sample_hot_weight;
+extern int sysctl_access_sample_decay_ms;
+
+bool page_access_sampled_hot(struct page *page);
+int access_sample_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp, loff_t *ppos);
+
+static inline bool access_sample_enabled(void)
+{
+	return READ_ONCE(access_sample_active);
+}
+#else
+static inline bool page_access_sampled_hot(struct page *page)
+{
+	return false;
+}
+
+static inline bool access_sample_enabled(void)
+{
+	return false;
+}
+#endif
+
+#endif /* _LINUX_ACCESS_SCAN_H */
@@ -89,12 +89,18 @@ extern int sysctl_compaction_handler(struct ctl_table *table, int write,
 			void __user *buffer, size_t *length, loff_t *ppos);
 extern int sysctl_extfrag_threshold;
 extern int sysctl_compact_unevictable_allowed;
+extern int sysctl_compact_proactive_ms;
+extern int sysctl_compact_proactive_blocks;
+extern int compact_proactive_sysctl_handler(struct ctl_table *table, int write,
+			void __user *buffer, size_t *length, loff_t *ppos);
+extern void compact_proactive_demand(int nid, unsigned long nr_pages);
 
 extern int fragmentation_index(struct zone *zone, unsigned int order);
 extern enum compact_result try_to_compact_pages(gfp_t gfp_mask,
 		unsigned int order, unsigned int alloc_flags,
 		const struct alloc_context *ac, enum compact_priority prio,
 		struct page **page);
+extern bool compact_node_order(int nid, int order);
 extern void reset_isolation_suitable(pg_data_t *pgdat);
 extern enum compact_result compaction_suitable(struct zone *zone, int order,
 		unsigned int alloc_flags, int classzone_idx);
@@ -185,6 +191,15 @@ extern void kcompactd_stop(int nid);
 extern void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx);
 
 #else
+static inline void compact_proactive_demand(int nid, unsigned long nr_pages)
+{
+}
+
+static inline bool compact_node_order(int nid, int order)
+{
+	return false;
+}
+
 static inline void reset_isolation_suitable(pg_data_t *pgdat)
 {
 }
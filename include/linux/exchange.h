@@ -24,4 +24,52 @@ int exchange_pages(struct list_head *exchange_list,
 			int reason);
 int exchange_pages_concur(struct list_head *exchange_list,
 		enum migrate_mode mode, int reason);
+int migrate_exchange_pages_concur(struct list_head *from,
+		new_page_t get_new_page, free_page_t put_new_page,
+		unsigned long private, struct list_head *exchange_list,
+		enum migrate_mode mode, int reason);
+
+/* phases of a concurrent exchange, for the migrate_pages_concur() pipeline */
+int exchange_concur_unmap(struct list_head *exchange_list,
+		struct list_head *unmapped, struct list_head *serialized,
+		enum migrate_mode mode);
+int exchange_concur_move_mapping(struct list_head *unmapped,
+		enum migrate_mode mode);
+void exchange_concur_copy(struct list_head *unmapped, enum migrate_mode mode);
+u64 exchange_concur_remap(struct list_head *unmapped, int reason,
+		enum migrate_mode mode);
+
+/* longest ring of rotate_pages() */
+#define ROTATE_PAGES_MAX	8
+int rotate_pages(struct exchange_page_info *ring, int nr,
+		enum migrate_mode mode, int reason);
+
+int exchange_pages_mm(struct mm_struct *mm, nodemask_t task_nodes,
+		unsigned long nr_pages,
+		const void __user * __user *from_pages,
+		const void __user * __user *to_pages,
+		int __user *status, int flags, bool drain_all);
+
+extern int sysctl_migrate_exchange_fallback;
+
+/* Whether exchange_fallback_queue() takes @page at all */
+static inline bool exchange_fallback_page(struct page *page)
+{
+	return !PageHuge(page) && !page_mapping(page) && !__PageMovable(page);
+}
+
+int exchange_fallback_queue(struct page *page, int nid,
+		struct list_head *exchange_list);
+int exchange_fallback_flush(struct list_head *exchange_list,
+		enum migrate_mode mode, int reason);
+#ifdef CONFIG_THP_EXCHANGE_TARGET
+struct page *exchange_thp_target(struct page *page, int nid,
+		enum migrate_mode mode);
+#else
+static inline struct page *exchange_thp_target(struct page *page, int nid,
+		enum migrate_mode mode)
+{
+	return NULL;
+}
+#endif
 #endif /* _LINUX_EXCHANGE_H */
@@ -496,6 +496,9 @@ __alloc_pages(gfp_t gfp_mask, unsigned int order, int preferred_nid)
 	return __alloc_pages_nodemask(gfp_mask, order, preferred_nid, NULL);
 }
 
+int alloc_pages_bulk_node(int nid, gfp_t gfp_mask, unsigned int order,
+			  int nr_pages, struct list_head *list);
+
 /*
  * Allocate pages, preferring the node given as nid. The node must be valid and
  * online. For more general interface, see alloc_pages_node().
@@ -261,9 +261,13 @@ static inline void copy_user_highpage(struct page *to, struct page *from,
 
 #endif
 
+/* Upper bound of limit_mt_num, the size of each per-node copy worker pool */
+#define MAX_NR_COPY_THREADS	64
+
 #ifndef __HAVE_ARCH_COPY_HIGHPAGE
 int copy_page_multithread(struct page *to, struct page *from, int nr_pages);
 int copy_page_dma(struct page *to, struct page *from, int nr_pages);
+int copy_page_hybrid(struct page *to, struct page *from, int nr_pages);
 
 static inline void copy_highpage(struct page *to, struct page *from)
 {
@@ -58,6 +58,9 @@ enum transparent_hugepage_flag {
 	TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG,
 	TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG,
 	TRANSPARENT_HUGEPAGE_USE_ZERO_PAGE_FLAG,
+	/* some node has a policy of always, or of madvise, see thp_node_vma_allowed() */
+	TRANSPARENT_HUGEPAGE_NODE_FLAG,
+	TRANSPARENT_HUGEPAGE_NODE_REQ_MADV_FLAG,
 #ifdef CONFIG_DEBUG_VM
 	TRANSPARENT_HUGEPAGE_DEBUG_COW_FLAG,
 #endif
@@ -106,7 +109,9 @@ static inline bool __transparent_hugepage_enabled(struct vm_area_struct *vma)
 	if (test_bit(MMF_DISABLE_THP, &vma->vm_mm->flags))
 		return false;
 
-	if (transparent_hugepage_flags & (1 << TRANSPARENT_HUGEPAGE_FLAG))
+	/* the node allocated from has the last word, thp_node_vma_allowed() */
+	if (transparent_hugepage_flags & ((1 << TRANSPARENT_HUGEPAGE_FLAG) |
+					  (1 << TRANSPARENT_HUGEPAGE_NODE_FLAG)))
 		return true;
 	/*
 	 * For dax vmas, try to always use hugepage mappings. If the kernel does
@@ -118,7 +123,8 @@ static inline bool __transparent_hugepage_enabled(struct vm_area_struct *vma)
 		return true;
 
 	if (transparent_hugepage_flags &
-				(1 << TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG))
+				((1 << TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG) |
+				 (1 << TRANSPARENT_HUGEPAGE_NODE_REQ_MADV_FLAG)))
 		return !!(vma->vm_flags & VM_HUGEPAGE);
 
 	return false;
@@ -126,6 +132,11 @@ static inline bool __transparent_hugepage_enabled(struct vm_area_struct *vma)
 
 bool transparent_hugepage_enabled(struct vm_area_struct *vma);
 
+/* Per-node THP policies, see /sys/kernel/mm/transparent_hugepage/nodes */
+bool thp_node_vma_allowed(int nid, struct vm_area_struct *vma);
+bool thp_node_target_allowed(int nid);
+gfp_t thp_node_defrag_gfpmask(int nid, gfp_t gfp);
+
 #define HPAGE_CACHE_INDEX_MASK (HPAGE_PMD_NR - 1)
 
 static inline bool transhuge_vma_suitable(struct vm_area_struct *vma,
@@ -304,6 +315,21 @@ static inline bool transparent_hugepage_enabled(struct vm_area_struct *vma)
 	return false;
 }
 
+static inline bool thp_node_vma_allowed(int nid, struct vm_area_struct *vma)
+{
+	return false;
+}
+
+static inline bool thp_node_target_allowed(int nid)
+{
+	return false;
+}
+
+static inline gfp_t thp_node_defrag_gfpmask(int nid, gfp_t gfp)
+{
+	return gfp;
+}
+
 static inline bool transhuge_vma_suitable(struct vm_area_struct *vma,
 		unsigned long haddr)
 {
@@ -102,6 +102,7 @@ long hugetlb_unreserve_pages(struct inode *inode, long start, long end,
 bool isolate_huge_page(struct page *page, struct list_head *list);
 void putback_active_hugepage(struct page *page);
 void move_hugetlb_state(struct page *oldpage, struct page *newpage, int reason);
+void exchange_hugetlb_state(struct page *page1, struct page *page2);
 void free_huge_page(struct page *page);
 void hugetlb_fix_reserve_counts(struct inode *inode);
 extern struct mutex *hugetlb_fault_mutex_table;
@@ -284,6 +285,11 @@ static inline void move_hugetlb_state(struct page *oldpage,
 {
 }
 
+static inline void exchange_hugetlb_state(struct page *page1,
+					struct page *page2)
+{
+}
+
 static inline unsigned long hugetlb_change_protection(
 			struct vm_area_struct *vma, unsigned long address,
 			unsigned long end, pgprot_t newprot)
@@ -15,6 +15,8 @@ extern int __khugepaged_enter(struct mm_struct *mm);
 extern void __khugepaged_exit(struct mm_struct *mm);
 extern int khugepaged_enter_vma_merge(struct vm_area_struct *vma,
 				      unsigned long vm_flags);
+extern int khugepaged_collapse_to_node(struct mm_struct *mm,
+				       unsigned long address, int nid);
 #ifdef CONFIG_SHMEM
 extern void collapse_pte_mapped_thp(struct mm_struct *mm, unsigned long addr);
 #else
@@ -27,13 +29,17 @@ static inline void collapse_pte_mapped_thp(struct mm_struct *mm,
 #define khugepaged_enabled()					       \
 	(transparent_hugepage_flags &				       \
 	 ((1<<TRANSPARENT_HUGEPAGE_FLAG) |		       \
-	  (1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG)))
+	  (1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG) |	       \
+	  (1<<TRANSPARENT_HUGEPAGE_NODE_FLAG) |		       \
+	  (1<<TRANSPARENT_HUGEPAGE_NODE_REQ_MADV_FLAG)))
 #define khugepaged_always()				\
 	(transparent_hugepage_flags &			\
-	 (1<<TRANSPARENT_HUGEPAGE_FLAG))
+	 ((1<<TRANSPARENT_HUGEPAGE_FLAG) |		\
+	  (1<<TRANSPARENT_HUGEPAGE_NODE_FLAG)))
 #define khugepaged_req_madv()					\
 	(transparent_hugepage_flags &				\
-	 (1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG))
+	 ((1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG) |		\
+	  (1<<TRANSPARENT_HUGEPAGE_NODE_REQ_MADV_FLAG)))
 #define khugepaged_defrag()					\
 	(transparent_hugepage_flags &				\
 	 (1<<TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG))
@@ -85,6 +91,11 @@ static inline void collapse_pte_mapped_thp(struct mm_struct *mm,
 					   unsigned long addr)
 {
 }
+static inline int khugepaged_collapse_to_node(struct mm_struct *mm,
+					      unsigned long address, int nid)
+{
+	return -EINVAL;
+}
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
 #endif /* _LINUX_KHUGEPAGED_H */
@@ -21,6 +21,9 @@
 #include <linux/vmstat.h>
 #include <linux/writeback.h>
 #include <linux/page-flags.h>
+#include <linux/migrate_rate.h>
+#include <linux/migrate_stat.h>
+#include <linux/memory_tier.h>
 
 struct mem_cgroup;
 struct page;
@@ -61,6 +64,26 @@ struct mem_cgroup_reclaim_cookie {
 	unsigned int generation;
 };
 
+/* Charges of a batch of migrations, see mem_cgroup_migrate_gather() */
+struct mem_cgroup_migrate_gather {
+	struct mem_cgroup *memcg;
+	int nid;
+	unsigned long pgpgin;
+	unsigned long nr_anon;
+	unsigned long nr_file;
+	unsigned long nr_huge;
+	unsigned long nr_shmem;
+	struct page *dummy_page;
+};
+
+/* Floors of a batch of demotions, see mem_cgroup_demotion_batch_protected() */
+struct mem_cgroup_demotion_batch {
+	struct mem_cgroup *memcg;
+	int nid;			/* NUMA_NO_NODE before the first page */
+	bool low;
+	unsigned long demotable;
+};
+
 #ifdef CONFIG_MEMCG
 
 #define MEM_CGROUP_ID_SHIFT	16
@@ -124,6 +147,9 @@ struct mem_cgroup_per_node {
 
 	unsigned long		lru_zone_size[MAX_NR_ZONES][NR_LRU_LISTS];
 	unsigned long		max_nr_base_pages;
+	/* floors demotions keep the node's pages above */
+	unsigned long		min_nr_base_pages;
+	unsigned long		low_nr_base_pages;
 
 	struct mem_cgroup_reclaim_iter	iter;
 
@@ -195,6 +221,27 @@ struct memcg_cgwb_frn {
 	struct wb_completion done;	/* tracks in-flight foreign writebacks */
 };
 
+/*
+ * In-kernel tiering of the cgroup's memory, see mm/memory_manage.c. The
+ * configuration is protected by @lock.
+ */
+struct mem_cgroup_tiering {
+	struct mutex lock;
+	struct delayed_work work;
+	unsigned int interval_ms;	/* 0 when off */
+	nodemask_t fast_nodes;
+	nodemask_t slow_nodes;
+	int flags;			/* MPOL_MF_* of mm_manage() */
+	unsigned long nr_pages;		/* per cycle, ULONG_MAX for all */
+	bool offline;
+	/* only touched by the work */
+	unsigned long nr_cycles;
+	struct page_migration_stats stats;
+	/* last memory.demote and memory.promote, [promote], in base pages */
+	unsigned long move_requested[2];
+	unsigned long move_done[2];
+};
+
 /*
  * The memory controller data structure. The memory controller controls both
  * page cache and RSS per cgroup. We would eventually like to provide
@@ -242,6 +289,24 @@ struct mem_cgroup {
 	int		under_oom;
 
 	int	swappiness;
+	/* Page copy policy of migrations of the cgroup's memory */
+	struct page_copy_policy copy_policy;
+	/* Node fallback order of allocations, enum tier_fallback */
+	int tier_fallback;
+	/* Migration bytes per second, 0 for no limit, see mm/migrate_rate.c */
+	u64 migrate_rate_limit;
+	struct migrate_rate_bucket migrate_rate;
+	/* get_jiffies_64() migrations are deferred until, see memory.migrate_quiesce */
+	u64 migrate_quiesce_end;
+	/* base pages of the migrations passed over while quiesced */
+	atomic_long_t migrate_deferred;
+	/* nr_node_ids * nr_node_ids pairs, see mm/migrate_stat.c */
+	struct migrate_pair_stat __percpu *migrate_pairs;
+	/* faults of the cgroup waiting on migrations, see mm/migrate_stat.c */
+	struct migrate_stall_stat __percpu *migrate_stall;
+	/* CPU time of migrations for the cgroup outside of its tasks */
+	atomic64_t migrate_cpu_ns;
+	struct mem_cgroup_tiering tiering;
 	/* OOM-Killer disable */
 	int		oom_kill_disable;
 
@@ -375,6 +440,9 @@ void mem_cgroup_uncharge(struct page *page);
 void mem_cgroup_uncharge_list(struct list_head *page_list);
 
 void mem_cgroup_migrate(struct page *oldpage, struct page *newpage);
+void mem_cgroup_migrate_gather(struct page *oldpage, struct page *newpage,
+		struct mem_cgroup_migrate_gather *mg);
+void mem_cgroup_migrate_flush(struct mem_cgroup_migrate_gather *mg);
 
 unsigned long mem_cgroup_node_nr_lru_pages(struct mem_cgroup *memcg,
 					   int nid, unsigned int lru_mask);
@@ -572,6 +640,34 @@ bool mem_cgroup_oom_synchronize(bool wait);
 struct mem_cgroup *mem_cgroup_get_oom_group(struct task_struct *victim,
 					    struct mem_cgroup *oom_domain);
 void mem_cgroup_print_oom_group(struct mem_cgroup *memcg);
+void mem_cgroup_copy_policy(struct mm_struct *mm,
+			    struct page_copy_policy *policy);
+void __mem_cgroup_copy_policy(struct mem_cgroup *memcg,
+			      struct page_copy_policy *policy);
+enum tier_fallback mem_cgroup_tier_fallback(void);
+u64 mem_cgroup_migrate_rate_charge(struct page *page, u64 bytes);
+bool mem_cgroup_migrate_quiesced(struct page *page);
+bool mem_cgroup_mm_migrate_quiesced(struct mm_struct *mm);
+void mem_cgroup_count_migrate_pair(struct page *page, int pair, int size,
+				   int nr_pages);
+void mem_cgroup_count_migrate_stall(struct mm_struct *mm, int size,
+				    int bucket, u64 nsec);
+void mem_cgroup_count_migrate_cputime(struct task_struct *task, u64 nsec);
+int mem_cgroup_budget_node(struct mem_cgroup *memcg, int nid,
+			   unsigned long nr_pages);
+int mem_cgroup_spill_node(struct mem_cgroup *memcg, int nid,
+			  unsigned long nr_pages);
+unsigned long mem_cgroup_node_demotable(struct mem_cgroup *memcg, int nid,
+					bool low);
+bool mem_cgroup_demotion_protected(struct page *page, bool low);
+bool mem_cgroup_demotion_batch_protected(struct mem_cgroup_demotion_batch *db,
+					 struct page *page);
+
+void mem_cgroup_tiering_init(struct mem_cgroup *memcg);
+void mem_cgroup_tiering_kick(struct mem_cgroup *memcg);
+void mem_cgroup_tiering_stop(struct mem_cgroup *memcg);
+unsigned long mem_cgroup_tier_move(struct mem_cgroup *memcg,
+				   unsigned long nr_pages, bool promote);
 
 #ifdef CONFIG_MEMCG_SWAP
 extern int do_swap_account;
@@ -941,6 +1037,16 @@ static inline void mem_cgroup_migrate(struct page *old, struct page *new)
 {
 }
 
+static inline void mem_cgroup_migrate_gather(struct page *old,
+		struct page *new, struct mem_cgroup_migrate_gather *mg)
+{
+}
+
+static inline void mem_cgroup_migrate_flush(
+		struct mem_cgroup_migrate_gather *mg)
+{
+}
+
 static inline struct lruvec *mem_cgroup_lruvec(struct mem_cgroup *memcg,
 					       struct pglist_data *pgdat)
 {
@@ -1096,6 +1202,77 @@ static inline void mem_cgroup_print_oom_group(struct mem_cgroup *memcg)
 {
 }
 
+static inline void mem_cgroup_copy_policy(struct mm_struct *mm,
+					  struct page_copy_policy *policy)
+{
+}
+
+static inline enum tier_fallback mem_cgroup_tier_fallback(void)
+{
+	return TIER_FALLBACK_DEFAULT;
+}
+
+static inline u64 mem_cgroup_migrate_rate_charge(struct page *page,
+						 u64 bytes)
+{
+	return 0;
+}
+
+static inline bool mem_cgroup_migrate_quiesced(struct page *page)
+{
+	return false;
+}
+
+static inline bool mem_cgroup_mm_migrate_quiesced(struct mm_struct *mm)
+{
+	return false;
+}
+
+static inline void mem_cgroup_count_migrate_pair(struct page *page, int pair,
+						 int size, int nr_pages)
+{
+}
+
+static inline void mem_cgroup_count_migrate_stall(struct mm_struct *mm,
+						  int size, int bucket,
+						  u64 nsec)
+{
+}
+
+static inline void mem_cgroup_count_migrate_cputime(struct task_struct *task,
+						    u64 nsec)
+{
+}
+
+static inline int mem_cgroup_budget_node(struct mem_cgroup *memcg, int nid,
+					 unsigned long nr_pages)
+{
+	return nid;
+}
+
+static inline int mem_cgroup_spill_node(struct mem_cgroup *memcg, int nid,
+					unsigned long nr_pages)
+{
+	return nid;
+}
+
+static inline unsigned long mem_cgroup_node_demotable(struct mem_cgroup *memcg,
+						      int nid, bool low)
+{
+	return ULONG_MAX;
+}
+
+static inline bool mem_cgroup_demotion_protected(struct page *page, bool low)
+{
+	return false;
+}
+
+static inline bool mem_cgroup_demotion_batch_protected(
+		struct mem_cgroup_demotion_batch *db, struct page *page)
+{
+	return false;
+}
+
 static inline unsigned long memcg_page_state(struct mem_cgroup *memcg, int idx)
 {
 	return 0;
@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_MEMORY_TIER_H
+#define _LINUX_MEMORY_TIER_H
+
+#include <linux/numa.h>
+#include <linux/compiler.h>
+#include <linux/jump_label.h>
+
+struct node_hmem_attrs;
+
+/* Memory tiers of NUMA nodes, see mm/memory_tier.c */
+enum memory_tier {
+	MEMORY_TIER_FAST,	/* DRAM */
+	MEMORY_TIER_SLOW,	/* PMEM and other slow memory */
+	NR_MEMORY_TIERS,
+};
+
+/* Where a tier assignment comes from, later sources override earlier ones */
+enum memory_tier_source {
+	MEMORY_TIER_SRC_FIRMWARE,	/* HMAT performance attributes */
+	MEMORY_TIER_SRC_EMULATED,	/* memory_tier_emu=, an emulated slow node */
+	MEMORY_TIER_SRC_DRIVER,		/* the driver onlining the memory */
+	MEMORY_TIER_SRC_ADMIN,		/* /sys/kernel/mm/memory_tier/nodes */
+	NR_MEMORY_TIER_SOURCES,
+};
+
+/* Effective tier of each node as a flag, nonzero for MEMORY_TIER_SLOW */
+extern char IS_PMEM_NODE[MAX_NUMNODES];
+/* Number of nodes in MEMORY_TIER_SLOW */
+extern int nr_slow_tier_nodes;
+
+void memory_tier_set(int nid, enum memory_tier_source src, int tier);
+void memory_tier_set_perf(int nid, const struct node_hmem_attrs *attrs);
+bool memory_tier_get_perf(int nid, struct node_hmem_attrs *attrs);
+unsigned int memory_tier_bandwidth(int nid);
+
+/* enabled once a node emulates slow memory, see memory_tier_emu_charge() */
+DECLARE_STATIC_KEY_FALSE(memory_tier_emu_used);
+
+u64 __memory_tier_emu_charge(int nid, u64 bytes, u64 now);
+
+/*
+ * Nanoseconds a copy of @bytes to or from @nid should take longer for the
+ * node to behave like the slow memory it emulates, 0 if it emulates none.
+ */
+static inline u64 memory_tier_emu_charge(int nid, u64 bytes, u64 now)
+{
+	if (!static_branch_unlikely(&memory_tier_emu_used))
+		return 0;
+
+	return __memory_tier_emu_charge(nid, bytes, now);
+}
+
+static inline bool node_is_slow_tier(int nid)
+{
+	return nid >= 0 && nid < MAX_NUMNODES && READ_ONCE(IS_PMEM_NODE[nid]);
+}
+
+/* Whether the memory of the system is split in tiers at all */
+static inline bool memory_tiers_present(void)
+{
+	return READ_ONCE(nr_slow_tier_nodes) > 0;
+}
+
+int node_demotion_target(int nid);
+int node_promotion_target(int nid);
+
+/*
+ * Order in which allocations fall back to other nodes, set by the task
+ * mempolicy or the memcg, see tier_fallback_zonelist()
+ */
+enum tier_fallback {
+	TIER_FALLBACK_DEFAULT,	/* whatever the next level asks for */
+	TIER_FALLBACK_DISTANCE,	/* by node distance */
+	TIER_FALLBACK_FAST,	/* fast tier nodes by distance, then slow ones */
+	TIER_FALLBACK_SLOW,	/* slow tier nodes by distance, then fast ones */
+	NR_TIER_FALLBACKS,
+};
+
+extern const char * const tier_fallback_names[NR_TIER_FALLBACKS];
+/* enabled once anyone asks for a tier fallback */
+DECLARE_STATIC_KEY_FALSE(tier_fallback_used);
+
+void tier_fallback_enable(void);
+enum tier_fallback current_tier_fallback(void);
+
+#endif /* _LINUX_MEMORY_TIER_H */
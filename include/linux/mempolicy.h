@@ -149,6 +149,10 @@ extern void mpol_rebind_mm(struct mm_struct *mm, nodemask_t *new);
 extern int huge_node(struct vm_area_struct *vma,
 				unsigned long addr, gfp_t gfp_flags,
 				struct mempolicy **mpol, nodemask_t **nodemask);
+extern int thp_node(struct vm_area_struct *vma, unsigned long addr,
+				gfp_t gfp);
+extern bool mpol_node_allowed(struct vm_area_struct *vma, unsigned long addr,
+				int nid);
 extern bool init_nodemask_of_mempolicy(nodemask_t *mask);
 extern bool mempolicy_nodemask_intersects(struct task_struct *tsk,
 				const nodemask_t *mask);
@@ -277,6 +281,18 @@ static inline int huge_node(struct vm_area_struct *vma,
 	return 0;
 }
 
+static inline int thp_node(struct vm_area_struct *vma, unsigned long addr,
+				gfp_t gfp)
+{
+	return 0;
+}
+
+static inline bool mpol_node_allowed(struct vm_area_struct *vma,
+				unsigned long addr, int nid)
+{
+	return true;
+}
+
 static inline bool init_nodemask_of_mempolicy(nodemask_t *m)
 {
 	return false;
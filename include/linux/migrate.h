@@ -7,8 +7,14 @@
 #include <linux/migrate_mode.h>
 #include <linux/hugetlb.h>
 
+struct mem_cgroup;
+struct dma_chan;
+
 typedef struct page *new_page_t(struct page *page, unsigned long private);
 typedef void free_page_t(struct page *page, unsigned long private);
+/* Allocate @nr pages of @order onto @pages, returns how many it did */
+typedef int new_pages_bulk_t(struct list_head *pages, int order, int nr,
+		unsigned long private);
 
 /*
  * Return values from addresss_space_operations.migratepage():
@@ -25,6 +31,7 @@ enum migrate_reason {
 	MR_MEMPOLICY_MBIND,
 	MR_NUMA_MISPLACED,
 	MR_CONTIG_RANGE,
+	MR_DEMOTION,
 	MR_TYPES
 };
 
@@ -59,6 +66,41 @@ static inline struct page *new_page_nodemask(struct page *page,
 	return new_page;
 }
 
+/* Upper bound of vm.concur_pipeline_depth */
+#define CONCUR_PIPELINE_MAX_DEPTH	8
+
+/*
+ * Entries of vm.migration_batch_size_auto: the base page batch of each
+ * kind, followed by its THP batch
+ */
+enum {
+	MIGRATION_BATCH_MIGRATE = 0,
+	MIGRATION_BATCH_EXCHANGE = 2,
+	NR_MIGRATION_BATCH_KINDS = 4,
+};
+
+/* Copy engines of migrate_pages_batch() */
+enum migrate_copy_engine {
+	MIGRATE_COPY_CPU,	/* the calling thread */
+	MIGRATE_COPY_MT,	/* the copy threads, like MPOL_MF_MOVE_MT */
+	MIGRATE_COPY_DMA,	/* the DMA channels, like MPOL_MF_MOVE_DMA */
+	MIGRATE_COPY_HYBRID,	/* both the copy threads and the DMA channels */
+	MIGRATE_COPY_DRIVER,	/* the callbacks of struct migrate_copy_ops */
+};
+
+/*
+ * Copy callbacks of a driver for migrate_pages_batch(). ->submit() starts
+ * the copy of the @nr pages of @src to @dst and returns a cookie for
+ * ->wait(), or an ERR_PTR(). ->wait() returns 0 once the copy is done, or
+ * an error code for the batch to be copied by the CPU.
+ */
+struct migrate_copy_ops {
+	void *(*submit)(struct page **dst, struct page **src, int nr,
+			void *priv);
+	int (*wait)(void *cookie, void *priv);
+	void *priv;
+};
+
 #ifdef CONFIG_MIGRATION
 
 extern void putback_movable_pages(struct list_head *l);
@@ -69,11 +111,23 @@ extern int migrate_pages(struct list_head *l, new_page_t new, free_page_t free,
 		unsigned long private, enum migrate_mode mode, int reason);
 extern int migrate_pages_concur(struct list_head *l, new_page_t new, free_page_t free,
 		unsigned long private, enum migrate_mode mode, int reason);
+extern int migrate_pages_flags(struct mm_struct *mm, struct list_head *l,
+		new_page_t new, free_page_t free, unsigned long private,
+		int flags, int reason);
+extern int migrate_pages_batch(struct list_head *l, new_page_t new,
+		free_page_t free, unsigned long private,
+		enum migrate_copy_engine engine,
+		const struct migrate_copy_ops *ops, int reason);
+extern int migrate_range_batch(struct mm_struct *mm, unsigned long start,
+		unsigned long end, int nid, enum migrate_copy_engine engine,
+		const struct migrate_copy_ops *ops);
 extern int isolate_movable_page(struct page *page, isolate_mode_t mode);
 extern void putback_movable_page(struct page *page);
 
 extern int migrate_prep(void);
 extern int migrate_prep_local(void);
+extern int migrate_prep_memcg(struct mem_cgroup *memcg);
+extern int migrate_prep_mm(struct mm_struct *mm);
 extern void migrate_page_states(struct page *newpage, struct page *page);
 extern void migrate_page_copy(struct page *newpage, struct page *page,
 				  enum migrate_mode mode);
@@ -92,11 +146,28 @@ static inline int migrate_pages_concur(struct list_head *l, new_page_t new,
 		free_page_t free, unsigned long private, enum migrate_mode mode,
 		int reason)
 	{ return -ENOSYS; }
+static inline int migrate_pages_flags(struct mm_struct *mm,
+		struct list_head *l, new_page_t new, free_page_t free,
+		unsigned long private, int flags, int reason)
+	{ return -ENOSYS; }
+static inline int migrate_pages_batch(struct list_head *l, new_page_t new,
+		free_page_t free, unsigned long private,
+		enum migrate_copy_engine engine,
+		const struct migrate_copy_ops *ops, int reason)
+	{ return -ENOSYS; }
+static inline int migrate_range_batch(struct mm_struct *mm,
+		unsigned long start, unsigned long end, int nid,
+		enum migrate_copy_engine engine,
+		const struct migrate_copy_ops *ops)
+	{ return -ENOSYS; }
 static inline int isolate_movable_page(struct page *page, isolate_mode_t mode)
 	{ return -EBUSY; }
 
 static inline int migrate_prep(void) { return -ENOSYS; }
 static inline int migrate_prep_local(void) { return -ENOSYS; }
+static inline int migrate_prep_memcg(struct mem_cgroup *memcg)
+	{ return -ENOSYS; }
+static inline int migrate_prep_mm(struct mm_struct *mm) { return -ENOSYS; }
 
 static inline void migrate_page_states(struct page *newpage, struct page *page)
 {
@@ -114,6 +185,38 @@ static inline int migrate_huge_page_move_mapping(struct address_space *mapping,
 
 #endif /* CONFIG_MIGRATION */
 
+/*
+ * Slow tier shadows of promoted pages, see mm/migrate_shadow.c. An anon
+ * page with a shadow has it in its private field, tagged.
+ */
+#define MIGRATE_SHADOW_TAG	1UL
+
+#ifdef CONFIG_MIGRATION
+extern void __migrate_shadow_drop(struct page *page);
+
+static inline bool page_has_migrate_shadow(struct page *page)
+{
+	return PageAnon(page) && !PageCompound(page) && !PageSwapCache(page) &&
+		(page_private(page) & MIGRATE_SHADOW_TAG);
+}
+
+/* Free the shadow of @page before its private field is reused */
+static inline void migrate_shadow_drop(struct page *page)
+{
+	if (unlikely(page_has_migrate_shadow(page)))
+		__migrate_shadow_drop(page);
+}
+#else
+static inline void migrate_shadow_drop(struct page *page) {}
+#endif
+
+#if defined(CONFIG_NUMA) && defined(CONFIG_MIGRATION)
+extern int move_pages_mm(struct mm_struct *mm, nodemask_t task_nodes,
+		unsigned long nr_pages, const void __user * __user *pages,
+		const int __user *nodes, int __user *status, int flags,
+		bool drain_all);
+#endif
+
 #ifdef CONFIG_COMPACTION
 extern int PageMovable(struct page *page);
 extern void __SetPageMovable(struct page *page, struct address_space *mapping);
@@ -163,6 +266,12 @@ static inline int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 #endif /* CONFIG_NUMA_BALANCING && CONFIG_TRANSPARENT_HUGEPAGE*/
 
 
+/* Run a copy on the socket of a node, see mm/copy_page.c */
+void copy_page_run_ranges(int nid, int nr,
+		void (*fn)(void *arg, int start, int end), void *arg);
+unsigned int copy_page_pick_cpus(int nid, int *cpu_id_list, unsigned int nr);
+struct dma_chan *copy_dma_pick_chan(int nid);
+
 #ifdef CONFIG_MIGRATION
 
 /*
@@ -210,7 +319,12 @@ int migrate_vma_setup(struct migrate_vma *args);
 void migrate_vma_pages(struct migrate_vma *migrate);
 void migrate_vma_finalize(struct migrate_vma *migrate);
 
+/* PMEM topology, see mm/pmem_topology.c */
 int get_nearest_cpu_node(int node);
+int pmem_nearest_node(int nid);
+int pmem_helper_node(int src, int dst);
+const struct cpumask *pmem_nearest_cpus(int nid);
+void pmem_topology_update(void);
 
 #endif /* CONFIG_MIGRATION */
 
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_MIGRATE_HISTORY_H
+#define _LINUX_MIGRATE_HISTORY_H
+
+#include <linux/types.h>
+
+struct page;
+
+#ifdef CONFIG_PAGE_MIGRATE_HISTORY
+extern struct page_ext_operations page_migrate_history_ops;
+extern int sysctl_migrate_hysteresis_ms;
+
+void page_migrate_history_record(struct page *newpage, struct page *page);
+bool page_migrate_suppress(struct page *page);
+void page_migrate_history_set_demotion(struct page *page, void *shadow);
+void *page_migrate_history_take_demotion(struct page *page);
+#else
+static inline void page_migrate_history_record(struct page *newpage,
+		struct page *page)
+{
+}
+
+static inline bool page_migrate_suppress(struct page *page)
+{
+	return false;
+}
+
+static inline void page_migrate_history_set_demotion(struct page *page,
+		void *shadow)
+{
+}
+
+static inline void *page_migrate_history_take_demotion(struct page *page)
+{
+	return NULL;
+}
+#endif
+
+#endif /* _LINUX_MIGRATE_HISTORY_H */
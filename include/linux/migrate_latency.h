@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_MIGRATE_LATENCY_H
+#define _LINUX_MIGRATE_LATENCY_H
+
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include <linux/numa.h>
+#include <linux/migrate_mode.h>
+
+struct ctl_table;
+
+/*
+ * Latency histograms of page migration, see mm/migrate_latency.c. The
+ * engines are also those of the migration tracepoints.
+ */
+enum migrate_latency_engine {
+	MIGRATE_ENGINE_SINGLE,
+	MIGRATE_ENGINE_MT,
+	MIGRATE_ENGINE_DMA,
+	MIGRATE_ENGINE_HYBRID,
+	MIGRATE_ENGINE_CONCUR,
+	MIGRATE_ENGINE_EXCHANGE,
+	NR_MIGRATE_ENGINES,
+};
+
+enum migrate_latency_phase {
+	MIGRATE_PHASE_LOCK,
+	MIGRATE_PHASE_UNMAP,
+	MIGRATE_PHASE_COPY,		/* page data and mapping */
+	MIGRATE_PHASE_REMAP,
+	MIGRATE_PHASE_PAGE,		/* a whole page or exchanged pair */
+	MIGRATE_PHASE_BATCH,		/* a whole concurrent batch */
+	NR_MIGRATE_PHASES,
+};
+
+DECLARE_STATIC_KEY_FALSE(migrate_latency_key);
+extern int sysctl_migrate_latency_hist;
+
+void __migrate_latency_record(enum migrate_latency_engine engine,
+		enum migrate_latency_phase phase, int src_nid, int dst_nid,
+		u64 ns);
+int migrate_latency_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp, loff_t *ppos);
+
+static inline enum migrate_latency_engine
+migrate_latency_engine(enum migrate_mode mode)
+{
+	if (mode & MIGRATE_CONCUR)
+		return MIGRATE_ENGINE_CONCUR;
+	if (mode & MIGRATE_HYBRID)
+		return MIGRATE_ENGINE_HYBRID;
+	if (mode & MIGRATE_DMA)
+		return MIGRATE_ENGINE_DMA;
+	if (mode & MIGRATE_MT)
+		return MIGRATE_ENGINE_MT;
+	return MIGRATE_ENGINE_SINGLE;
+}
+
+/* A clock for migrate_latency_phase(), 0 while the histograms are off */
+static inline u64 migrate_latency_start(void)
+{
+	return static_branch_unlikely(&migrate_latency_key) ? ktime_get_ns() : 0;
+}
+
+/* Record the time since *@clock as @phase and restart the clock */
+static inline void migrate_latency_phase(enum migrate_latency_engine engine,
+		enum migrate_latency_phase phase, u64 *clock)
+{
+	u64 now;
+
+	if (!static_branch_unlikely(&migrate_latency_key) || !*clock)
+		return;
+
+	now = ktime_get_ns();
+	__migrate_latency_record(engine, phase, NUMA_NO_NODE, NUMA_NO_NODE,
+			now - *clock);
+	*clock = now;
+}
+
+/* Record the time since @start as @phase of a move from @src to @dst */
+static inline void migrate_latency_done(enum migrate_latency_engine engine,
+		enum migrate_latency_phase phase, int src_nid, int dst_nid,
+		u64 start)
+{
+	if (!static_branch_unlikely(&migrate_latency_key) || !start)
+		return;
+
+	__migrate_latency_record(engine, phase, src_nid, dst_nid,
+			ktime_get_ns() - start);
+}
+
+#endif /* _LINUX_MIGRATE_LATENCY_H */
@@ -13,6 +13,12 @@
  *	(mm/hmm.c) for users of this mode.
  * MIGRATE_SINGLETHREAD uses a single thread to move pages, it is the default
  *	behavior
+ * MIGRATE_HYBRID splits the page copy between the DMA engines and the
+ *	multi-threaded copy workers, it is set along with MIGRATE_MT and
+ *	MIGRATE_DMA when both are requested
+ * MIGRATE_SWAP_MAPPINGS makes exchange_pages() swap the addresses mapping the
+ *	two anonymous pages of a pair instead of their data, see
+ *	unmap_and_swap_mappings()
  */
 enum migrate_mode {
 	MIGRATE_ASYNC,
@@ -25,6 +31,8 @@ enum migrate_mode {
 	MIGRATE_MT				= 1<<4,
 	MIGRATE_DMA				= 1<<5,
 	MIGRATE_CONCUR			= 1<<6,
+	MIGRATE_HYBRID			= 1<<7,
+	MIGRATE_SWAP_MAPPINGS		= 1<<8,
 };
 
 #endif		/* MIGRATE_MODE_H_INCLUDED */
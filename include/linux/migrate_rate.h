@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_MIGRATE_RATE_H
+#define _LINUX_MIGRATE_RATE_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+
+/*
+ * Token bucket limiting the migration traffic of a node pair or a memcg,
+ * see mm/migrate_rate.c. The limit lives with the owner of the bucket.
+ */
+struct migrate_rate_bucket {
+	spinlock_t lock;
+	s64 tokens;		/* bytes, negative while in debt */
+	u64 last_ns;		/* last refill */
+	unsigned long nr_throttled;
+};
+
+void migrate_rate_bucket_init(struct migrate_rate_bucket *bucket);
+u64 migrate_rate_bucket_charge(struct migrate_rate_bucket *bucket,
+		u64 limit, u64 bytes);
+u64 migrate_rate_limit(int src_nid, int dst_nid);
+
+#endif /* _LINUX_MIGRATE_RATE_H */
@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_MIGRATE_RECORD_H
+#define _LINUX_MIGRATE_RECORD_H
+
+#include <linux/jump_label.h>
+#include <linux/ktime.h>
+#include <uapi/linux/migrate_record.h>
+
+struct page;
+struct list_head;
+struct ctl_table;
+
+/* Migration trace of mm_manage(), see mm/migrate_record.c */
+#ifdef CONFIG_MIGRATE_RECORD
+DECLARE_STATIC_KEY_FALSE(migrate_record_key);
+extern int sysctl_migrate_record;
+
+u32 migrate_record_next_batch(void);
+void __migrate_record_page(enum migrate_record_type type, struct page *page,
+		int dst_nid, u32 batch);
+void __migrate_record_list(enum migrate_record_type type,
+		struct list_head *pages, int dst_nid, u32 batch);
+void __migrate_record_batch(u32 batch, int src_nid, int dst_nid,
+		unsigned int nr_pages, unsigned int nr_failed, u64 start);
+int migrate_record_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp, loff_t *ppos);
+
+static inline bool migrate_record_enabled(void)
+{
+	return static_branch_unlikely(&migrate_record_key);
+}
+#else
+static inline bool migrate_record_enabled(void)
+{
+	return false;
+}
+
+static inline u32 migrate_record_next_batch(void)
+{
+	return 0;
+}
+
+static inline void __migrate_record_page(enum migrate_record_type type,
+		struct page *page, int dst_nid, u32 batch)
+{
+}
+
+static inline void __migrate_record_list(enum migrate_record_type type,
+		struct list_head *pages, int dst_nid, u32 batch)
+{
+}
+
+static inline void __migrate_record_batch(u32 batch, int src_nid,
+		int dst_nid, unsigned int nr_pages, unsigned int nr_failed,
+		u64 start)
+{
+}
+#endif
+
+/*
+ * Record the pages on @pages as @type candidates or moves to @dst_nid.
+ * Returns the id of their batch, 0 while recording is off.
+ */
+static inline u32 migrate_record_list(enum migrate_record_type type,
+		struct list_head *pages, int dst_nid)
+{
+	u32 batch;
+
+	if (!migrate_record_enabled())
+		return 0;
+
+	batch = migrate_record_next_batch();
+	__migrate_record_list(type, pages, dst_nid, batch);
+	return batch;
+}
+
+/* A clock for migrate_record_batch(), 0 while recording is off */
+static inline u64 migrate_record_start(void)
+{
+	return migrate_record_enabled() ? ktime_get_ns() : 0;
+}
+
+/* Record the end of @batch, which started at @start */
+static inline void migrate_record_batch(u32 batch, int src_nid, int dst_nid,
+		unsigned int nr_pages, unsigned int nr_failed, u64 start)
+{
+	if (!migrate_record_enabled() || !batch || !start)
+		return;
+
+	__migrate_record_batch(batch, src_nid, dst_nid, nr_pages, nr_failed,
+			start);
+}
+
+#endif /* _LINUX_MIGRATE_RECORD_H */
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_MIGRATE_STAT_H
+#define _LINUX_MIGRATE_STAT_H
+
+#include <linux/types.h>
+#include <linux/sched.h>
+#include <linux/migrate_latency.h>
+
+struct page;
+struct mm_struct;
+struct seq_file;
+
+/*
+ * CPU time a migration for @task spent outside of @task, in the copy
+ * workers and in the migration thread itself, see mm/migrate_stat.c
+ */
+struct migrate_cputime {
+	struct task_struct *task;
+	u64 exec_ns;
+	u64 worker_ns;
+};
+
+/* Called by the copy engines for the time their workers ran */
+static inline void migrate_worker_time_add(u64 nsec)
+{
+	current->page_migration_stats.worker_ns += nsec;
+}
+
+/* Pages migrated or exchanged per node pair, see mm/migrate_stat.c */
+enum migrate_stat_size {
+	MIGRATE_STAT_BASE,
+	MIGRATE_STAT_HUGE,	/* THP and hugetlb pages */
+	NR_MIGRATE_STAT_SIZES,
+};
+
+struct migrate_pair_stat {
+	unsigned long nr[NR_MIGRATE_STAT_SIZES];
+	unsigned long nr_base_pages;
+};
+
+/*
+ * Time faults waited on pages under migration or exchange, by the size of
+ * the page, and how many waits took under 2^i microseconds, the last
+ * bucket taking the longer ones.
+ */
+#define MIGRATE_STALL_BUCKETS	20
+
+struct migrate_stall_stat {
+	u64 nsec[NR_MIGRATE_STAT_SIZES];
+	unsigned long nr[NR_MIGRATE_STAT_SIZES];
+	unsigned long hist[MIGRATE_STALL_BUCKETS];
+};
+
+#ifdef CONFIG_MIGRATION
+void count_migrate_stall(struct mm_struct *mm, bool huge, u64 nsec);
+void migrate_stall_stat_add(struct migrate_stall_stat *sum,
+		struct migrate_stall_stat __percpu *stat);
+void migrate_stall_stat_show(struct seq_file *m, const char *prefix,
+		const struct migrate_stall_stat *stat);
+void count_migrate_pair(struct page *page, int src_nid, int dst_nid,
+		enum migrate_latency_engine engine);
+void migrate_pair_stat_add(struct migrate_pair_stat *sum,
+		struct migrate_pair_stat __percpu *stat);
+void count_pmem_write(int writer_nid, int dst_nid, u64 bytes);
+void migrate_stat_show_vmstat(struct seq_file *m);
+void migrate_cputime_begin(struct migrate_cputime *mc,
+		struct task_struct *task);
+void migrate_cputime_end(struct migrate_cputime *mc);
+#else
+static inline void count_migrate_pair(struct page *page, int src_nid,
+		int dst_nid, enum migrate_latency_engine engine)
+{
+}
+
+static inline void count_pmem_write(int writer_nid, int dst_nid, u64 bytes)
+{
+}
+
+static inline void migrate_cputime_begin(struct migrate_cputime *mc,
+		struct task_struct *task)
+{
+}
+
+static inline void migrate_cputime_end(struct migrate_cputime *mc)
+{
+}
+#endif
+
+#endif /* _LINUX_MIGRATE_STAT_H */
@@ -1954,6 +1954,30 @@ static inline void pgtable_pte_page_dtor(struct page *page)
 	dec_zone_page_state(page, NR_PAGETABLE);
 }
 
+/* pgtable_tier.c */
+#ifdef CONFIG_NUMA
+extern int sysctl_pgtable_fast_tier;
+int pgtable_tier_node(void);
+#else
+static inline int pgtable_tier_node(void)
+{
+	return NUMA_NO_NODE;
+}
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+void pgtable_tier_update(struct mm_struct *mm);
+#endif
+
+/* A user page table page, on the node pgtable_tier_node() asks for */
+static inline struct page *alloc_pgtable_page(gfp_t gfp)
+{
+	int nid = pgtable_tier_node();
+
+	if (nid == NUMA_NO_NODE)
+		return alloc_page(gfp);
+	return __alloc_pages_node(nid, gfp, 0);
+}
+
 #define pte_offset_map_lock(mm, pmd, address, ptlp)	\
 ({							\
 	spinlock_t *__ptl = pte_lockptr(mm, pmd);	\
@@ -2206,6 +2230,8 @@ extern void setup_per_cpu_pageset(void);
 extern int min_free_kbytes;
 extern int watermark_boost_factor;
 extern int watermark_scale_factor;
+extern int demote_watermark_scale_factor;
+extern int promote_headroom_factor;
 
 /* nommu.c */
 extern atomic_long_t mmap_pages_allocated;
@@ -2778,6 +2804,7 @@ static inline void print_vma_addr(char *prefix, unsigned long rip)
 #endif
 
 void *sparse_buffer_alloc(unsigned long size);
+extern int sysctl_vmemmap_fast_tier;
 struct page * __populate_section_memmap(unsigned long pfn,
 		unsigned long nr_pages, int nid, struct vmem_altmap *altmap);
 pgd_t *vmemmap_pgd_populate(unsigned long addr, int node);
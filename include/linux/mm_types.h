@@ -11,6 +11,7 @@
 #include <linux/rwsem.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
+#include <linux/nodemask.h>
 #include <linux/uprobes.h>
 #include <linux/page-flags-layout.h>
 #include <linux/workqueue.h>
@@ -23,6 +24,7 @@
 #define AT_VECTOR_SIZE (2*(AT_VECTOR_SIZE_ARCH + AT_VECTOR_SIZE_BASE + 1))
 
 
+struct access_regions;
 struct address_space;
 struct mem_cgroup;
 
@@ -351,6 +353,19 @@ struct vm_area_struct {
 #ifdef CONFIG_SWAP
 	atomic_long_t swap_readahead_info;
 #endif
+#ifdef CONFIG_FS_DAX_PMD
+	/* DAX PMD fault-around: where a sequential fault lands next */
+	unsigned long dax_fault_next;
+	unsigned int dax_fault_window;	/* PMDs mapped ahead last time */
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	/* Promotion prefetch: the range pulled in last, see mm/migrate.c */
+	unsigned long promote_prefetch_start;
+	unsigned long promote_prefetch_end;
+	unsigned int promote_prefetch_window;	/* base pages of the next */
+	unsigned int promote_prefetch_nr;	/* base pages pulled in last */
+	int promote_prefetch_nid;		/* and the node they went to */
+#endif
 #ifndef CONFIG_MMU
 	struct vm_region *vm_region;	/* NOMMU mapping region */
 #endif
@@ -513,6 +528,20 @@ struct mm_struct {
 
 		/* numa_scan_seq prevents two threads setting pte_numa */
 		int numa_scan_seq;
+
+		/* Home node the page tables follow, see mm/pgtable_tier.c */
+		int pgtable_nid;
+		unsigned long pgtable_next_move;
+#endif
+		/* Nodes under mm_manage(), see mm/memory_manage.c */
+		nodemask_t mm_manage_nodes;
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+		/* Accessed bit scanning, see mm/access_scan.c */
+		unsigned long access_scan_next;
+		unsigned long access_scan_last;
+		u8 access_scan_pass;
+		/* Region monitoring, see mm/access_region.c */
+		struct access_regions __rcu *access_regions;
 #endif
 		/*
 		 * An operation with batched TLB flushing is going on. Anything
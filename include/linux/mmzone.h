@@ -224,6 +224,7 @@ enum node_stat_item {
 	WORKINGSET_ACTIVATE,
 	WORKINGSET_RESTORE,
 	WORKINGSET_NODERECLAIM,
+	WORKINGSET_DEMOTE_REFAULT,
 	NR_ANON_MAPPED,	/* Mapped anonymous pages */
 	NR_FILE_MAPPED,	/* pagecache pages mapped into pagetables.
 			   only modified from process context */
@@ -308,6 +309,8 @@ struct lruvec {
 	atomic_long_t			inactive_age;
 	/* Refaults at the time of last reclaim cycle */
 	unsigned long			refaults;
+	/* Demotion refaults at the time of last reclaim cycle */
+	unsigned long			demote_refaults;
 	/* Various lruvec state flags (enum lruvec_flags) */
 	unsigned long			flags;
 #ifdef CONFIG_MEMCG
@@ -329,6 +332,7 @@ enum zone_watermarks {
 	WMARK_MIN,
 	WMARK_LOW,
 	WMARK_HIGH,
+	WMARK_DEMOTE,
 	NR_WMARK
 };
 
@@ -336,6 +340,8 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->_watermark[WMARK_LOW] + z->watermark_boost)
 #define high_wmark_pages(z) (z->_watermark[WMARK_HIGH] + z->watermark_boost)
 #define wmark_pages(z, i) (z->_watermark[i] + z->watermark_boost)
+/* 0 without vm.demote_watermark_scale_factor */
+#define demote_wmark_pages(z) (z->_watermark[WMARK_DEMOTE])
 
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
@@ -435,6 +441,8 @@ struct zone {
 	/* zone watermarks, access with *_wmark_pages(zone) macros */
 	unsigned long _watermark[NR_WMARK];
 	unsigned long watermark_boost;
+	/* part of the watermarks only migration targets may use */
+	unsigned long promote_headroom;
 
 	unsigned long nr_reserved_highatomic;
 
@@ -553,6 +561,14 @@ struct zone {
 	unsigned long		compact_init_migrate_pfn;
 	unsigned long		compact_init_free_pfn;
 #endif
+#ifdef CONFIG_COMPACTION
+	/* pfn where the evacuation of a pageblock looks next */
+	unsigned long		compact_evacuate_pfn;
+	/* adaptive concurrent compaction cycles, 0 until the first one */
+	unsigned int		compact_batch_pages;
+	unsigned int		compact_block_yield;	/* pages per pageblock */
+	unsigned long		compact_migrate_rate;	/* pages per second */
+#endif
 
 #ifdef CONFIG_COMPACTION
 	/*
@@ -593,6 +609,9 @@ enum zone_flags {
 	ZONE_BOOSTED_WATERMARK,		/* zone recently boosted watermarks.
 					 * Cleared when kswapd is woken.
 					 */
+	ZONE_DEMOTE_WATERMARK,		/* zone below its demotion watermark.
+					 * Cleared when kswapd demoted.
+					 */
 };
 
 static inline unsigned long zone_managed_pages(struct zone *zone)
@@ -654,6 +673,9 @@ enum {
 	 * restrict the allocations to a single node for __GFP_THISNODE.
 	 */
 	ZONELIST_NOFALLBACK,	/* zonelist without fallback (__GFP_THISNODE) */
+	/* the fallback zonelist with one memory tier ahead of the other */
+	ZONELIST_FAST_FIRST,
+	ZONELIST_SLOW_FIRST,
 #endif
 	MAX_ZONELISTS
 };
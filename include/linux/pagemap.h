@@ -29,6 +29,11 @@ enum mapping_flags {
 	AS_EXITING	= 4, 	/* final truncate in progress */
 	/* writeback related tags are not used */
 	AS_NO_WRITEBACK_TAGS = 5,
+	AS_DAX_CACHE	= 6,	/* DAX pages have DRAM copies, see fs/dax.c */
+	/* page cache on the slow tier, see mm/page_cache_tier.c */
+	AS_SLOW_TIER	= 7,
+	AS_SLOW_TIER_READAHEAD = 8,
+	AS_TIER_MANAGE	= 9,	/* under mm_manage() with MPOL_MF_SHARED */
 };
 
 /**
@@ -209,16 +214,24 @@ static inline int page_cache_add_speculative(struct page *page, int count)
 
 #ifdef CONFIG_NUMA
 extern struct page *__page_cache_alloc(gfp_t gfp);
+extern struct page *__page_cache_alloc_tier(struct address_space *x,
+		gfp_t gfp, bool readahead);
 #else
 static inline struct page *__page_cache_alloc(gfp_t gfp)
 {
 	return alloc_pages(gfp, 0);
 }
+
+static inline struct page *__page_cache_alloc_tier(struct address_space *x,
+		gfp_t gfp, bool readahead)
+{
+	return __page_cache_alloc(gfp);
+}
 #endif
 
 static inline struct page *page_cache_alloc(struct address_space *x)
 {
-	return __page_cache_alloc(mapping_gfp_mask(x));
+	return __page_cache_alloc_tier(x, mapping_gfp_mask(x), false);
 }
 
 static inline gfp_t readahead_gfp_mask(struct address_space *x)
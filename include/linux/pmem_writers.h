@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _LINUX_PMEM_WRITERS_H
+#define _LINUX_PMEM_WRITERS_H
+
+#include <linux/types.h>
+#include <linux/memory_tier.h>
+
+/*
+ * Budget of concurrent writers of each slow tier node shared by the copy
+ * engines, see mm/pmem_writers.c.
+ */
+int pmem_writers_get(int nid, int nr, bool wait);
+void pmem_writers_put(int nid, int nr);
+
+/* The node an exchange between @nid1 and @nid2 is limited by */
+static inline int pmem_writers_exchange_node(int nid1, int nid2)
+{
+	return node_is_slow_tier(nid2) ? nid2 : nid1;
+}
+
+#endif /* _LINUX_PMEM_WRITERS_H */
@@ -234,6 +234,8 @@ unsigned long page_address_in_vma(struct page *, struct vm_area_struct *);
  * returns the number of cleaned PTEs.
  */
 int page_mkclean(struct page *);
+int page_wrprotect(struct page *);
+bool page_mapped_writable(struct page *);
 
 /*
  * called in munlock()/munmap() path to check for other vmas holding
@@ -296,6 +298,16 @@ static inline int page_mkclean(struct page *page)
 	return 0;
 }
 
+static inline int page_wrprotect(struct page *page)
+{
+	return 0;
+}
+
+static inline bool page_mapped_writable(struct page *page)
+{
+	return false;
+}
+
 
 #endif	/* CONFIG_MMU */
 
@@ -43,6 +43,7 @@ struct fs_struct;
 struct futex_pi_state;
 struct io_context;
 struct mempolicy;
+struct migrate_copy_ops;
 struct nameidata;
 struct nsproxy;
 struct perf_event_context;
@@ -92,12 +93,30 @@ struct page_migration_counters {
 	unsigned long nr_huge_pages;
 };
 
+/*
+ * Page copy policy of the migration a task runs. Each field is -1 to use
+ * the sysctl default, or a value set by the syscall flags or by the memcg
+ * of the migrated process, see page_copy_policy_enter().
+ */
+struct page_copy_policy {
+	s8 nt;			/* non-temporal copies and exchanges */
+	s8 rpdaa;		/* copy on the socket of the PMEM side */
+	s16 nr_threads;		/* copy threads */
+};
+
+#define PAGE_COPY_POLICY_INIT	{ .nt = -1, .rpdaa = -1, .nr_threads = -1 }
+#define PAGE_COPY_POLICY_DEFAULT \
+	((struct page_copy_policy)PAGE_COPY_POLICY_INIT)
+
 struct page_migration_stats {
 	unsigned long base_page_under_migration_jiffies;
 	unsigned long huge_page_under_migration_jiffies;
 	unsigned long nr_exchanges;
 	unsigned long nr_exchange_base_pages;
 	unsigned long nr_exchange_huge_pages;
+	unsigned long nr_isolated_pages;	/* base pages, by mm_manage() */
+	unsigned long nr_failed_pages;		/* isolated but not moved */
+	u64 worker_ns;		/* CPU time of copy workers run for the task */
 	struct page_migration_counters f2s; /* fast to slow */
 	struct page_migration_counters s2f; /* slow to fast */
 };
@@ -813,6 +832,10 @@ struct task_struct {
 #ifdef CONFIG_MEMCG
 	unsigned			in_user_fault:1;
 #endif
+	/* allocating a migration target, may use the promotion headroom */
+	unsigned			memalloc_headroom:1;
+	/* machine check safe copies stream, see copy_stream_save() */
+	unsigned			copy_stream:1;
 #ifdef CONFIG_COMPAT_BRK
 	unsigned			brk_randomized:1;
 #endif
@@ -916,6 +939,9 @@ struct task_struct {
 #endif
 
 	struct page_migration_stats page_migration_stats;
+	struct page_copy_policy page_copy_policy;
+	/* copy callbacks of migrate_pages_batch() */
+	const struct migrate_copy_ops *migrate_copy_ops;
 
 	/* Process credentials: */
 
@@ -1120,6 +1146,8 @@ struct task_struct {
 	/* Protected by alloc_lock: */
 	struct mempolicy		*mempolicy;
 	short				il_prev;
+	/* allocations left on il_prev under MPOL_F_WEIGHTED */
+	u8				il_weight;
 	short				pref_node_fork;
 #endif
 #ifdef CONFIG_NUMA_BALANCING
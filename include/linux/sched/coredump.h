@@ -73,7 +73,9 @@ static inline int get_dumpable(struct mm_struct *mm)
 #define MMF_OOM_VICTIM		25	/* mm is the oom victim */
 #define MMF_OOM_REAP_QUEUED	26	/* mm was queued for oom_reaper */
 #define MMF_DISABLE_THP_MASK	(1 << MMF_DISABLE_THP)
-#define MMF_MM_MANAGE		26
+#define MMF_KVM_GUEST		27	/* backs the memory of a KVM guest */
+#define MMF_MM_MANAGE		28	/* nodes of the mm are under mm_manage() */
+#define MMF_ACCESS_SCAN		29	/* accessed bit scan in progress */
 
 #define MMF_INIT_MASK		(MMF_DUMPABLE_MASK | MMF_DUMP_FILTER_MASK |\
 				 MMF_DISABLE_THP_MASK)
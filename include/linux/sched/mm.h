@@ -307,6 +307,42 @@ static inline void memalloc_nocma_restore(unsigned int flags)
 }
 #endif
 
+/*
+ * Allocations between memalloc_headroom_save() and the matching restore
+ * allocate migration targets and may dip into the headroom a fast tier
+ * zone keeps free for promotions, see vm.promote_headroom_factor.
+ */
+static inline unsigned int memalloc_headroom_save(void)
+{
+	unsigned int headroom = current->memalloc_headroom;
+
+	current->memalloc_headroom = 1;
+	return headroom;
+}
+
+static inline void memalloc_headroom_restore(unsigned int headroom)
+{
+	current->memalloc_headroom = headroom;
+}
+
+/*
+ * Large machine check safe copies between copy_stream_save() and the
+ * matching restore use streaming loads, and streaming stores where the
+ * alignment allows, to keep data read once out of the CPU caches.
+ */
+static inline unsigned int copy_stream_save(void)
+{
+	unsigned int stream = current->copy_stream;
+
+	current->copy_stream = 1;
+	return stream;
+}
+
+static inline void copy_stream_restore(unsigned int stream)
+{
+	current->copy_stream = stream;
+}
+
 #ifdef CONFIG_MEMCG
 /**
  * memalloc_use_memcg - Starts the remote memcg charging scope.
@@ -22,6 +22,9 @@ extern void set_numabalancing_state(bool enabled);
 extern void task_numa_free(struct task_struct *p, bool final);
 extern bool should_numa_migrate_memory(struct task_struct *p, struct page *page,
 					int src_nid, int dst_cpu);
+extern bool numa_scan_skip_node(struct mm_struct *mm, int nid);
+extern void numa_scan_mark_page(struct page *page);
+extern bool numa_replicate_vma(struct vm_area_struct *vma);
 #else
 static inline void task_numa_fault(int last_node, int node, int pages,
 				   int flags)
@@ -42,6 +45,17 @@ static inline bool should_numa_migrate_memory(struct task_struct *p,
 {
 	return true;
 }
+static inline bool numa_scan_skip_node(struct mm_struct *mm, int nid)
+{
+	return false;
+}
+static inline void numa_scan_mark_page(struct page *page)
+{
+}
+static inline bool numa_replicate_vma(struct vm_area_struct *vma)
+{
+	return false;
+}
 #endif
 
 #endif /* _LINUX_SCHED_NUMA_BALANCING_H */
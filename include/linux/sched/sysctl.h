@@ -37,6 +37,10 @@ extern unsigned int sysctl_numa_balancing_scan_delay;
 extern unsigned int sysctl_numa_balancing_scan_period_min;
 extern unsigned int sysctl_numa_balancing_scan_period_max;
 extern unsigned int sysctl_numa_balancing_scan_size;
+extern unsigned int sysctl_numa_balancing_fast_scan_ratio;
+extern unsigned int sysctl_numa_balancing_hot_threshold;
+extern unsigned int sysctl_numa_balancing_pmem_home;
+extern unsigned int sysctl_numa_balancing_replicate;
 
 #ifdef CONFIG_SCHED_DEBUG
 extern __read_mostly unsigned int sysctl_sched_migration_cost;
@@ -104,7 +108,18 @@ extern int sched_energy_aware_handler(struct ctl_table *table, int write,
 extern int sysctl_dma_page_migration(struct ctl_table *table, int write,
 				 void __user *buffer, size_t *lenp,
 				 loff_t *ppos);
+extern int sysctl_page_copy_engine_handler(struct ctl_table *table, int write,
+				 void __user *buffer, size_t *lenp,
+				 loff_t *ppos);
+extern int sysctl_page_copy_engine;
 extern int sysctl_enable_page_migration_optimization_avoid_remote_pmem_write;
 extern int sysctl_enable_nt_exchange;
+extern int sysctl_exchange_split_socket;
 extern int sysctl_enable_nt_page_copy;
+extern int sysctl_clear_huge_page_nt;
+extern int sysctl_cow_huge_page_mt_pages;
+extern int sysctl_nt_page_copy_policy[2][2];
+extern int sysctl_mt_copy_inline_pages;
+extern int sysctl_mt_copy_interleave_ways;
+extern unsigned int mt_copy_inline_pages_auto;
 #endif /* _LINUX_SCHED_SYSCTL_H */
@@ -126,6 +126,8 @@ struct kmem_cache {
 	 * Defragmentation by allocating from a remote node.
 	 */
 	unsigned int remote_node_defrag_ratio;
+	/* new slabs on the slow tier, see slab_tier_node() */
+	bool slow_tier;
 #endif
 
 #ifdef CONFIG_SLAB_FREELIST_RANDOM
@@ -49,10 +49,23 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		NUMA_HINT_FAULTS,
 		NUMA_HINT_FAULTS_LOCAL,
 		NUMA_PAGE_MIGRATE,
+		NUMA_PAGE_REPLICATE,
+		NUMA_PROMOTE_PREFETCH,
+		NUMA_PROMOTE_PREFETCH_HIT,
+		PGTABLE_MIGRATE,
 #endif
 #ifdef CONFIG_MIGRATION
-		PGMIGRATE_SUCCESS, PGMIGRATE_FAIL,
+		PGMIGRATE_SUCCESS, PGMIGRATE_FAIL, PGMIGRATE_THROTTLE,
+		PGDEMOTE, PGMIGRATE_SKIP_RANK, PGMIGRATE_PINGPONG,
+		PGMIGRATE_ZERO_PAGE, PGMIGRATE_SAME_FILLED,
+		PGMIGRATE_SHADOW_KEEP, PGMIGRATE_SHADOW_HIT,
+		PGMIGRATE_SPLIT_PROMOTE, PGMIGRATE_PROMOTE_COLLAPSE,
+		PGMIGRATE_PAGE_CACHE_PROMOTE, PGMIGRATE_CONCUR_WAITED,
 #endif
+		PGCOPY_MT_INLINE, PGCOPY_MT_DISPATCHED, PGEXCHANGE_SPLIT,
+		PGEXCHANGE_SWAP_MAPPINGS,
+		PGMIGRATE_EARLY_PINNED, PGMIGRATE_EARLY_WRITEBACK,
+		PGMIGRATE_QUIESCED, PGALLOC_COLD_SITE,
 #ifdef CONFIG_COMPACTION
 		COMPACTMIGRATE_SCANNED, COMPACTFREE_SCANNED,
 		COMPACTISOLATED,
@@ -77,10 +90,12 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		THP_COLLAPSE_ALLOC_FAILED,
 		THP_FILE_ALLOC,
 		THP_FILE_MAPPED,
+		THP_DAX_EXTENT_FALLBACK,
 		THP_SPLIT_PAGE,
 		THP_SPLIT_PAGE_FAILED,
 		THP_DEFERRED_SPLIT_PAGE,
 		THP_SPLIT_PMD,
+		THP_REMAP_PMD,
 #ifdef CONFIG_HAVE_ARCH_TRANSPARENT_HUGEPAGE_PUD
 		THP_SPLIT_PUD,
 #endif
@@ -109,6 +124,7 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 #ifdef CONFIG_SWAP
 		SWAP_RA,
 		SWAP_RA_HIT,
+		SWPIN_SLOW_TIER,
 #endif
 		NR_VM_EVENT_ITEMS
 };
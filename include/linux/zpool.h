@@ -63,6 +63,8 @@ void zpool_unmap_handle(struct zpool *pool, unsigned long handle);
 
 u64 zpool_get_total_size(struct zpool *pool);
 
+int zpool_set_node(struct zpool *pool, int nid);
+
 
 /**
  * struct zpool_driver - driver implementation for zpool
@@ -76,6 +78,7 @@ u64 zpool_get_total_size(struct zpool *pool);
  * @map:	map a handle.
  * @unmap:	unmap a handle.
  * @total_size:	get total size of a pool.
+ * @set_node:	set the memory node of the pages of a pool.
  *
  * This is created by a zpool implementation and registered
  * with zpool.
@@ -105,6 +108,8 @@ struct zpool_driver {
 	void (*unmap)(void *pool, unsigned long handle);
 
 	u64 (*total_size)(void *pool);
+
+	void (*set_node)(void *pool, int nid);
 };
 
 void zpool_register_driver(struct zpool_driver *driver);
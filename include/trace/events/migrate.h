@@ -6,6 +6,7 @@
 #define _TRACE_MIGRATE_H
 
 #include <linux/tracepoint.h>
+#include <linux/migrate_latency.h>
 
 #define MIGRATE_MODE						\
 	EM( MIGRATE_ASYNC,	"MIGRATE_ASYNC")		\
@@ -20,7 +21,16 @@
 	EM( MR_SYSCALL,		"syscall_or_cpuset")		\
 	EM( MR_MEMPOLICY_MBIND,	"mempolicy_mbind")		\
 	EM( MR_NUMA_MISPLACED,	"numa_misplaced")		\
-	EMe(MR_CONTIG_RANGE,	"contig_range")
+	EM( MR_CONTIG_RANGE,	"contig_range")			\
+	EMe(MR_DEMOTION,	"demotion")
+
+#define MIGRATE_ENGINE						\
+	EM( MIGRATE_ENGINE_SINGLE,	"single")		\
+	EM( MIGRATE_ENGINE_MT,		"mt")			\
+	EM( MIGRATE_ENGINE_DMA,		"dma")			\
+	EM( MIGRATE_ENGINE_HYBRID,	"hybrid")		\
+	EM( MIGRATE_ENGINE_CONCUR,	"concur")		\
+	EMe(MIGRATE_ENGINE_EXCHANGE,	"exchange")
 
 /*
  * First define the enums in the above macros to be exported to userspace
@@ -33,6 +43,7 @@
 
 MIGRATE_MODE
 MIGRATE_REASON
+MIGRATE_ENGINE
 
 /*
  * Now redefine the EM() and EMe() macros to map the enums to the strings
@@ -70,6 +81,157 @@ TRACE_EVENT(mm_migrate_pages,
 		__print_symbolic(__entry->mode, MIGRATE_MODE),
 		__print_symbolic(__entry->reason, MIGRATE_REASON))
 );
+
+/*
+ * A batch of pages migrated or exchanged together, from the node of its
+ * first page to the node of the first target. The duration covers the
+ * unmap, the copy and the remap of the whole batch.
+ */
+TRACE_EVENT(mm_migrate_batch_start,
+
+	TP_PROTO(enum migrate_latency_engine engine, int src_nid, int dst_nid,
+		 int nr_pages, enum migrate_mode mode),
+
+	TP_ARGS(engine, src_nid, dst_nid, nr_pages, mode),
+
+	TP_STRUCT__entry(
+		__field(	enum migrate_latency_engine,	engine)
+		__field(	int,			src_nid)
+		__field(	int,			dst_nid)
+		__field(	int,			nr_pages)
+		__field(	enum migrate_mode,	mode)
+	),
+
+	TP_fast_assign(
+		__entry->engine		= engine;
+		__entry->src_nid	= src_nid;
+		__entry->dst_nid	= dst_nid;
+		__entry->nr_pages	= nr_pages;
+		__entry->mode		= mode;
+	),
+
+	TP_printk("engine=%s src_nid=%d dst_nid=%d nr_pages=%d mode=%s",
+		__print_symbolic(__entry->engine, MIGRATE_ENGINE),
+		__entry->src_nid,
+		__entry->dst_nid,
+		__entry->nr_pages,
+		__print_symbolic(__entry->mode & MIGRATE_MODE_MASK,
+				 MIGRATE_MODE))
+);
+
+TRACE_EVENT(mm_migrate_batch_end,
+
+	TP_PROTO(enum migrate_latency_engine engine, int src_nid, int dst_nid,
+		 int nr_pages, int nr_failed, u64 duration_ns),
+
+	TP_ARGS(engine, src_nid, dst_nid, nr_pages, nr_failed, duration_ns),
+
+	TP_STRUCT__entry(
+		__field(	enum migrate_latency_engine,	engine)
+		__field(	int,			src_nid)
+		__field(	int,			dst_nid)
+		__field(	int,			nr_pages)
+		__field(	int,			nr_failed)
+		__field(	u64,			duration_ns)
+	),
+
+	TP_fast_assign(
+		__entry->engine		= engine;
+		__entry->src_nid	= src_nid;
+		__entry->dst_nid	= dst_nid;
+		__entry->nr_pages	= nr_pages;
+		__entry->nr_failed	= nr_failed;
+		__entry->duration_ns	= duration_ns;
+	),
+
+	TP_printk("engine=%s src_nid=%d dst_nid=%d nr_pages=%d nr_failed=%d duration_ns=%llu",
+		__print_symbolic(__entry->engine, MIGRATE_ENGINE),
+		__entry->src_nid,
+		__entry->dst_nid,
+		__entry->nr_pages,
+		__entry->nr_failed,
+		__entry->duration_ns)
+);
+
+/*
+ * A copy or exchange handed to a copy engine. helper_nid is the node whose
+ * CPUs run the copy workers, or the node of the DMA channels. order is
+ * that of the first page of a list.
+ */
+TRACE_EVENT(mm_migrate_copy_dispatch,
+
+	TP_PROTO(enum migrate_latency_engine engine, int src_nid, int dst_nid,
+		 int helper_nid, int nr_items, u64 bytes, int order, bool nt),
+
+	TP_ARGS(engine, src_nid, dst_nid, helper_nid, nr_items, bytes, order,
+		nt),
+
+	TP_STRUCT__entry(
+		__field(	enum migrate_latency_engine,	engine)
+		__field(	int,			src_nid)
+		__field(	int,			dst_nid)
+		__field(	int,			helper_nid)
+		__field(	int,			nr_items)
+		__field(	u64,			bytes)
+		__field(	int,			order)
+		__field(	bool,			nt)
+	),
+
+	TP_fast_assign(
+		__entry->engine		= engine;
+		__entry->src_nid	= src_nid;
+		__entry->dst_nid	= dst_nid;
+		__entry->helper_nid	= helper_nid;
+		__entry->nr_items	= nr_items;
+		__entry->bytes		= bytes;
+		__entry->order		= order;
+		__entry->nt		= nt;
+	),
+
+	TP_printk("engine=%s src_nid=%d dst_nid=%d helper_nid=%d nr_items=%d bytes=%llu order=%d nt=%d",
+		__print_symbolic(__entry->engine, MIGRATE_ENGINE),
+		__entry->src_nid,
+		__entry->dst_nid,
+		__entry->helper_nid,
+		__entry->nr_items,
+		__entry->bytes,
+		__entry->order,
+		__entry->nt)
+);
+
+TRACE_EVENT(mm_migrate_copy_done,
+
+	TP_PROTO(enum migrate_latency_engine engine, int src_nid, int dst_nid,
+		 u64 bytes, u64 duration_ns, int ret),
+
+	TP_ARGS(engine, src_nid, dst_nid, bytes, duration_ns, ret),
+
+	TP_STRUCT__entry(
+		__field(	enum migrate_latency_engine,	engine)
+		__field(	int,			src_nid)
+		__field(	int,			dst_nid)
+		__field(	u64,			bytes)
+		__field(	u64,			duration_ns)
+		__field(	int,			ret)
+	),
+
+	TP_fast_assign(
+		__entry->engine		= engine;
+		__entry->src_nid	= src_nid;
+		__entry->dst_nid	= dst_nid;
+		__entry->bytes		= bytes;
+		__entry->duration_ns	= duration_ns;
+		__entry->ret		= ret;
+	),
+
+	TP_printk("engine=%s src_nid=%d dst_nid=%d bytes=%llu duration_ns=%llu ret=%d",
+		__print_symbolic(__entry->engine, MIGRATE_ENGINE),
+		__entry->src_nid,
+		__entry->dst_nid,
+		__entry->bytes,
+		__entry->duration_ns,
+		__entry->ret)
+);
 #endif /* _TRACE_MIGRATE_H */
 
 /* This part must be outside protection */
@@ -19,4 +19,9 @@
 #define POSIX_FADV_NOREUSE	5 /* Data will be accessed once.  */
 #endif
 
+/* Linux specific: page cache placement of the file on a tiered memory system */
+#define POSIX_FADV_SLOW_TIER	8 /* Keep the page cache on the slow tier.  */
+#define POSIX_FADV_SLOW_TIER_READAHEAD	9 /* ... the readahead pages only.  */
+#define POSIX_FADV_ANY_TIER	10 /* Back to the default placement.  */
+
 #endif	/* FADVISE_H_INCLUDED */
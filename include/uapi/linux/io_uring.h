@@ -37,6 +37,7 @@ struct io_uring_sqe {
 		__u32		open_flags;
 		__u32		statx_flags;
 		__u32		fadvise_advice;
+		__u32		pages_flags;
 	};
 	__u64	user_data;	/* data to be passed back at completion time */
 	union {
@@ -113,11 +114,26 @@ enum {
 	IORING_OP_RECV,
 	IORING_OP_OPENAT2,
 	IORING_OP_EPOLL_CTL,
+	IORING_OP_MOVE_PAGES,
+	IORING_OP_EXCHANGE_PAGES,
 
 	/* this goes last, obviously */
 	IORING_OP_LAST,
 };
 
+/*
+ * IORING_OP_MOVE_PAGES and IORING_OP_EXCHANGE_PAGES: sqe->addr points to
+ * the arrays of the move_pages() or exchange_pages() call, sqe->len is its
+ * nr_pages and sqe->pages_flags its MPOL_MF_* flags. The status of each
+ * entry is written to the status array, the cqe res is what the system
+ * call would return.
+ */
+struct io_uring_pages_args {
+	__u64	pages;		/* move_pages() pages, exchange_pages() from_pages */
+	__u64	nodes;		/* move_pages() nodes, exchange_pages() to_pages */
+	__u64	status;
+};
+
 /*
  * sqe->fsync_flags
  */
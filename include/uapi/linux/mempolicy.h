@@ -7,6 +7,8 @@
 #define _UAPI_LINUX_MEMPOLICY_H
 
 #include <linux/errno.h>
+#include <linux/types.h>
+#include <linux/ioctl.h>
 
 
 /*
@@ -22,6 +24,7 @@ enum {
 	MPOL_BIND,
 	MPOL_INTERLEAVE,
 	MPOL_LOCAL,
+	MPOL_PREFERRED_TIER,	/* the fast or slow tier of the current socket */
 	MPOL_MAX,	/* always last member of enum */
 };
 
@@ -29,12 +32,30 @@ enum {
 #define MPOL_F_STATIC_NODES	(1 << 15)
 #define MPOL_F_RELATIVE_NODES	(1 << 14)
 #define MPOL_F_MEMCG		(1 << 13)
+/*
+ * set_mempolicy: fall back to the fast tier nodes first, or the slow ones.
+ * MPOL_PREFERRED_TIER: prefer the fast tier node of the socket the task
+ * runs on, the default, or its slow tier node.
+ */
+#define MPOL_F_TIER_FAST	(1 << 12)
+#define MPOL_F_TIER_SLOW	(1 << 11)
+/*
+ * Copy mode of the mbind() and migrate_pages() migrations under the policy
+ * that do not pass MPOL_MF_MOVE_MT, MPOL_MF_MOVE_CONCUR or MPOL_MF_MOVE_DMA
+ */
+#define MPOL_F_MOVE_MT		(1 << 10)
+#define MPOL_F_MOVE_CONCUR	(1 << 9)
+#define MPOL_F_MOVE_DMA		(1 << 8)
+/* MPOL_INTERLEAVE: interleave in proportion to the weights of the nodes */
+#define MPOL_F_WEIGHTED		(1 << 7)
 
 /*
  * MPOL_MODE_FLAGS is the union of all possible optional mode flags passed to
  * either set_mempolicy() or mbind().
  */
-#define MPOL_MODE_FLAGS	(MPOL_F_STATIC_NODES | MPOL_F_RELATIVE_NODES | MPOL_F_MEMCG)
+#define MPOL_MODE_FLAGS	(MPOL_F_STATIC_NODES | MPOL_F_RELATIVE_NODES | MPOL_F_MEMCG | \
+			 MPOL_F_TIER_FAST | MPOL_F_TIER_SLOW | MPOL_F_MOVE_MT | \
+			 MPOL_F_MOVE_CONCUR | MPOL_F_MOVE_DMA | MPOL_F_WEIGHTED)
 
 /* Flags for get_mempolicy */
 #define MPOL_F_NODE	(1<<0)	/* return next IL mode instead of node mask */
@@ -55,6 +76,61 @@ enum {
 #define MPOL_MF_EXCHANGE	(1<<8)	/* Exchange pages */
 #define MPOL_MF_SHRINK_LISTS	(1<<9)	/* Exchange pages */
 
+/* Page copy policy of move_pages, exchange_pages and mm_manage */
+#define MPOL_MF_COPY_NT		(1<<10)	/* Use non-temporal page copies */
+#define MPOL_MF_COPY_NO_NT	(1<<11)	/* Do not use non-temporal page copies */
+#define MPOL_MF_COPY_RPDAA	(1<<12)	/* Copy on the socket of the PMEM side */
+#define MPOL_MF_COPY_NO_RPDAA	(1<<13)	/* Copy on the initiating socket */
+#define MPOL_MF_COPY_THREADS_SHIFT	16	/* Number of copy threads, 0 default */
+#define MPOL_MF_COPY_THREADS_MASK	(0x3f << MPOL_MF_COPY_THREADS_SHIFT)
+#define MPOL_MF_COPY_THREADS(n)	((n) << MPOL_MF_COPY_THREADS_SHIFT)
+
+#define MPOL_MF_ASYNC		(1<<14)	/* Queue mm_manage to kmigrated */
+#define MPOL_MF_MOVE_GROUPED	(1<<15)	/* move_pages: one batch per node */
+#define MPOL_MF_ROTATE		(1<<22)	/* mm_manage: rotate pages across three tiers */
+#define MPOL_MF_SHARED		(1<<23)	/* mm_manage: tier the shmem the mm maps */
+#define MPOL_MF_SWAP_MAPPINGS	(1<<24)	/* exchange_pages: swap the contents of
+					   the addresses, not the nodes */
+
+/*
+ * ioctls of the file descriptor returned by mm_manage() with MPOL_MF_ASYNC.
+ * MM_MANAGE_IOC_PROGRESS reads how far the request got, in base pages,
+ * also while it runs. MM_MANAGE_IOC_SET_EVENTFD makes the request signal
+ * an eventfd when it is done, at once if it is done already.
+ */
+struct mm_manage_progress {
+	__u64 nr_isolated;
+	__u64 nr_migrated;
+	__u64 nr_exchanged;
+	__u64 nr_failed;	/* isolated but failed to migrate */
+};
+
+#define MM_MANAGE_IOC_MAGIC		0xB8
+#define MM_MANAGE_IOC_PROGRESS		_IOR(MM_MANAGE_IOC_MAGIC, 0, \
+					     struct mm_manage_progress)
+#define MM_MANAGE_IOC_SET_EVENTFD	_IOW(MM_MANAGE_IOC_MAGIC, 1, __s32)
+
+/*
+ * page_residency() fills one __u32 per page of the range, or per PMD_SIZE
+ * block with PAGE_RESIDENCY_PMD: the node of the page in the low 16 bits,
+ * PAGE_RESIDENCY_NONE when nothing is mapped, and the bits below. A block
+ * reports the node of its first page, with PAGE_RESIDENCY_MIXED if pages
+ * of it are on other nodes, and the accessed and dirty bits of any page.
+ */
+#define PAGE_RESIDENCY_PMD	(1<<0)	/* one entry per PMD_SIZE block */
+#define PAGE_RESIDENCY_BITS	(1<<1)	/* report the accessed and dirty bits */
+
+#define PAGE_RESIDENCY_NODE_MASK	0xffff
+#define PAGE_RESIDENCY_NONE		0xffff	/* nothing mapped */
+#define PAGE_RESIDENCY_ACCESSED		(1<<16)	/* young in the page table */
+#define PAGE_RESIDENCY_DIRTY		(1<<17)	/* dirty in the page table */
+#define PAGE_RESIDENCY_HUGE		(1<<18)	/* mapped by a huge page */
+#define PAGE_RESIDENCY_MIXED		(1<<19)	/* block spans several nodes */
+
+#define MPOL_MF_COPY_POLICY	(MPOL_MF_COPY_NT | MPOL_MF_COPY_NO_NT |	\
+				 MPOL_MF_COPY_RPDAA | MPOL_MF_COPY_NO_RPDAA | \
+				 MPOL_MF_COPY_THREADS_MASK)
+
 #define MPOL_MF_VALID	(MPOL_MF_STRICT   | 	\
 			 MPOL_MF_MOVE     | 	\
 			 MPOL_MF_MOVE_ALL)
@@ -68,6 +144,7 @@ enum {
 #define MPOL_F_LOCAL   (1 << 1)	/* preferred local allocation */
 #define MPOL_F_MOF	(1 << 3) /* this policy wants migrate on fault */
 #define MPOL_F_MORON	(1 << 4) /* Migrate On protnone Reference On Node */
+#define MPOL_F_PREFERRED_TIER (1 << 5) /* MPOL_PREFERRED_TIER, with MPOL_F_LOCAL */
 
 
 #endif /* _UAPI_LINUX_MEMPOLICY_H */
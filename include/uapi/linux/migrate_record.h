@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+#ifndef _UAPI_LINUX_MIGRATE_RECORD_H
+#define _UAPI_LINUX_MIGRATE_RECORD_H
+
+#include <linux/types.h>
+
+/*
+ * Migration trace of mm_manage(), read from the per-CPU relay files in
+ * /sys/kernel/debug/migrate_record/ while vm.migrate_record is set and
+ * replayed by the replay engine of /sys/kernel/debug/migrate_benchmark.
+ */
+enum migrate_record_type {
+	MIGRATE_RECORD_ISOLATE,		/* candidate isolated on src_nid for dst_nid */
+	MIGRATE_RECORD_MIGRATE,		/* page of a batch moving to dst_nid */
+	MIGRATE_RECORD_EXCHANGE,	/* page swapped with one on dst_nid */
+	MIGRATE_RECORD_BATCH,		/* end of a migration or exchange batch */
+};
+
+/* flags */
+#define MIGRATE_RECORD_ACTIVE	0x1	/* on the active LRU list */
+#define MIGRATE_RECORD_ANON	0x2
+
+struct migrate_record {
+	__u64 time_ns;		/* CLOCK_MONOTONIC */
+	__u64 pfn;		/* BATCH: 0 */
+	__u32 batch;		/* shared by a batch and its pages */
+	__u32 nr_pages;		/* base pages, of the whole batch for BATCH */
+	__u32 nr_failed;	/* BATCH: base pages left unmoved */
+	__u32 duration_ns;	/* BATCH: saturated at U32_MAX */
+	__u16 src_nid;
+	__u16 dst_nid;
+	__u8 type;		/* enum migrate_record_type */
+	__u8 order;
+	__u16 flags;
+};
+
+#endif /* _UAPI_LINUX_MIGRATE_RECORD_H */
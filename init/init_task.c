@@ -102,6 +102,7 @@ struct task_struct init_task
 	RCU_POINTER_INITIALIZER(real_cred, &init_cred),
 	RCU_POINTER_INITIALIZER(cred, &init_cred),
 	.comm		= INIT_TASK_COMM,
+	.page_copy_policy = PAGE_COPY_POLICY_INIT,
 	.thread		= INIT_THREAD,
 	.fs		= &init_fs,
 	.files		= &init_files,
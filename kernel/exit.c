@@ -169,6 +169,8 @@ static void __exit_signal(struct task_struct *tsk)
 			dst.nr_exchanges += src.nr_exchanges;\
 			dst.nr_exchange_base_pages += src.nr_exchange_base_pages;\
 			dst.nr_exchange_huge_pages += src.nr_exchange_huge_pages;\
+			dst.nr_isolated_pages += src.nr_isolated_pages;\
+			dst.nr_failed_pages += src.nr_failed_pages;\
 			ADD_PAGE_MIGRATION_COUNTERS(dst.f2s, src.f2s);\
 			ADD_PAGE_MIGRATION_COUNTERS(dst.s2f, src.s2f);\
 		} while (0);
@@ -94,6 +94,7 @@
 #include <linux/thread_info.h>
 #include <linux/stackleak.h>
 #include <linux/kasan.h>
+#include <linux/access_scan.h>
 
 #include <asm/pgtable.h>
 #include <asm/pgalloc.h>
@@ -348,7 +349,8 @@ struct vm_area_struct *vm_area_alloc(struct mm_struct *mm)
 {
 	struct vm_area_struct *vma;
 
-	vma = kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
+	vma = kmem_cache_alloc_node(vm_area_cachep, GFP_KERNEL,
+				    pgtable_tier_node());
 	if (vma)
 		vma_init(vma, mm);
 	return vma;
@@ -356,7 +358,8 @@ struct vm_area_struct *vm_area_alloc(struct mm_struct *mm)
 
 struct vm_area_struct *vm_area_dup(struct vm_area_struct *orig)
 {
-	struct vm_area_struct *new = kmem_cache_alloc(vm_area_cachep, GFP_KERNEL);
+	struct vm_area_struct *new = kmem_cache_alloc_node(vm_area_cachep,
+					GFP_KERNEL, pgtable_tier_node());
 
 	if (new) {
 		*new = *orig;
@@ -1029,6 +1032,13 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p,
 	init_tlb_flush_pending(mm);
 #if defined(CONFIG_TRANSPARENT_HUGEPAGE) && !USE_SPLIT_PMD_PTLOCKS
 	mm->pmd_huge_pte = NULL;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	mm->pgtable_nid = NUMA_NO_NODE;
+#endif
+	nodes_clear(mm->mm_manage_nodes);
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+	RCU_INIT_POINTER(mm->access_regions, NULL);
 #endif
 	mm_init_uprobes_state(mm);
 
@@ -1080,6 +1090,7 @@ static inline void __mmput(struct mm_struct *mm)
 	ksm_exit(mm);
 	khugepaged_exit(mm); /* must run before exit_mmap */
 	exit_mmap(mm);
+	access_regions_exit(mm);
 	mm_put_huge_zero_page(mm);
 	set_mm_exe_file(mm, NULL);
 	if (!list_empty(&mm->mmlist)) {
@@ -1980,6 +1991,7 @@ static __latent_entropy struct task_struct *copy_process(
 	p->move_pages_breakdown = (struct move_pages_breakdown){0};
 #endif
 	p->page_migration_stats = (struct page_migration_stats){0};
+	p->page_copy_policy = PAGE_COPY_POLICY_DEFAULT;
 
 	p->utime = p->stime = p->gtime = 0;
 #ifdef CONFIG_ARCH_HAS_SCALED_CPUTIME
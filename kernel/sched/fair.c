@@ -1064,6 +1064,86 @@ unsigned int sysctl_numa_balancing_scan_size = 256;
 /* Scan @scan_size MB every @scan_period after an initial @scan_delay in ms */
 unsigned int sysctl_numa_balancing_scan_delay = 1000;
 
+/*
+ * On a tiered system the hinting faults that matter are the ones on slow
+ * tier pages, which may be promoted. The pages of fast tier nodes are only
+ * made hinting faults on one pass over the address space out of
+ * @fast_scan_ratio, and since the pages left alone do not use up the scan
+ * size, the same scan budget covers more of the slow tier memory.
+ */
+unsigned int sysctl_numa_balancing_fast_scan_ratio = 4;
+
+/*
+ * The two-fault cpupid filter of should_numa_migrate_memory() looks for
+ * DRAM to DRAM locality and lets lukewarm slow tier pages be promoted.
+ * When the scanner makes a hinting fault on a slow tier page it stores
+ * the time in the last cpupid of the page instead, and the page is only
+ * promoted if the fault comes within the hot threshold of the scan. The
+ * threshold of each slow tier node starts at @hot_threshold and is
+ * adjusted every @scan_period_max so that the pages passing it stay around
+ * the migration rate limit towards their target node. Without a rate
+ * limit the threshold stays fixed, and 0 turns the filter off.
+ */
+unsigned int sysctl_numa_balancing_hot_threshold = 1000;
+
+/*
+ * A task never runs on a CPU-less PMEM node, but it runs as close as it
+ * gets to the pages of one on the CPU node nearest to it, its home socket
+ * in mm/pmem_topology.c. With @pmem_home set, the faults on a CPU-less
+ * node count towards its home socket when picking the preferred node of a
+ * task and the node to move it to, see numa_pmem_home_faults().
+ */
+unsigned int sysctl_numa_balancing_pmem_home = 1;
+
+/*
+ * The hot read-only pages of a binary or of its interpreter live on one
+ * node and every other socket pays remote latency for them, they are
+ * shared and not migrated. With @replicate set such a mapping is scanned
+ * too, and a hinting fault from a remote fast tier node gives the task a
+ * local private copy of the page instead, see numa_replicate_page().
+ */
+unsigned int sysctl_numa_balancing_replicate;
+
+/*
+ * Whether the pages of @vma may be replicated: a private file mapping
+ * whose file nobody may write while it is mapped, so that a copy stays
+ * what the file holds.
+ */
+bool numa_replicate_vma(struct vm_area_struct *vma)
+{
+	return READ_ONCE(sysctl_numa_balancing_replicate) && vma->vm_file &&
+		(vma->vm_flags & VM_DENYWRITE) &&
+		!(vma->vm_flags & (VM_SHARED | VM_LOCKED));
+}
+
+/* scan times are kept in ms, in buckets if the cpupid field is narrow */
+#define PAGE_ACCESS_TIME_MIN_BITS	12
+#if LAST_CPUPID_SHIFT < PAGE_ACCESS_TIME_MIN_BITS
+#define PAGE_ACCESS_TIME_BUCKETS	(PAGE_ACCESS_TIME_MIN_BITS - LAST_CPUPID_SHIFT)
+#else
+#define PAGE_ACCESS_TIME_BUCKETS	0
+#endif
+#define PAGE_ACCESS_TIME_MASK		(LAST_CPUPID_MASK << PAGE_ACCESS_TIME_BUCKETS)
+
+/* threshold steps between 0 and twice the sysctl */
+#define NUMA_PROMOTE_ADJUST_STEPS	16
+
+struct numa_promote_threshold {
+	unsigned int threshold;		/* ms, 0 until the first adjustment */
+	unsigned int start;		/* ms, start of the adjustment period */
+	atomic_long_t nr_passed;	/* base pages passing in this period */
+};
+
+static struct numa_promote_threshold numa_promote_thresholds[MAX_NUMNODES];
+
+static unsigned int xchg_page_access_time(struct page *page, unsigned int time)
+{
+	unsigned int last_time;
+
+	last_time = page_cpupid_xchg_last(page, time >> PAGE_ACCESS_TIME_BUCKETS);
+	return last_time << PAGE_ACCESS_TIME_BUCKETS;
+}
+
 struct numa_group {
 	refcount_t refcount;
 
@@ -1282,6 +1362,29 @@ static inline unsigned long group_faults_shared(struct numa_group *ng)
 	return faults;
 }
 
+/*
+ * Faults of @p, or of its group, on the CPU-less nodes whose home socket
+ * is @nid, 0 if @nid has no CPUs itself.
+ */
+static unsigned long numa_pmem_home_faults(struct task_struct *p, int nid,
+					   bool task)
+{
+	unsigned long faults = 0;
+	int n;
+
+	if (!READ_ONCE(sysctl_numa_balancing_pmem_home) ||
+	    !node_state(nid, N_CPU))
+		return 0;
+
+	for_each_node_state(n, N_MEMORY) {
+		if (node_state(n, N_CPU) || pmem_nearest_node(n) != nid)
+			continue;
+		faults += task ? task_faults(p, n) : group_faults(p, n);
+	}
+
+	return faults;
+}
+
 /*
  * A node triggering more than 1/3 as many NUMA faults as the maximum is
  * considered part of a numa group's pseudo-interleaving set. Migrations
@@ -1380,6 +1483,7 @@ static inline unsigned long task_weight(struct task_struct *p, int nid,
 
 	faults = task_faults(p, nid);
 	faults += score_nearby_nodes(p, nid, dist, true);
+	faults += numa_pmem_home_faults(p, nid, true);
 
 	return 1000 * faults / total_faults;
 }
@@ -1400,17 +1504,89 @@ static inline unsigned long group_weight(struct task_struct *p, int nid,
 
 	faults = group_faults(p, nid);
 	faults += score_nearby_nodes(p, nid, dist, false);
+	faults += numa_pmem_home_faults(p, nid, false);
 
 	return 1000 * faults / total_faults;
 }
 
+/* Time in ms between the scan of @page and its hinting fault */
+static unsigned int numa_hint_fault_latency(struct page *page)
+{
+	unsigned int now = jiffies_to_msecs(jiffies);
+
+	return (now - xchg_page_access_time(page, now)) & PAGE_ACCESS_TIME_MASK;
+}
+
+/*
+ * Hot threshold of the promotions from @src_nid to @dst_nid. Once per
+ * adjustment period the threshold moves one step down if more pages than
+ * the rate limit allows passed it, one step up if fewer did.
+ */
+static unsigned int numa_promote_threshold(int src_nid, int dst_nid,
+		unsigned int ref_th)
+{
+	struct numa_promote_threshold *pt = &numa_promote_thresholds[src_nid];
+	unsigned int period = READ_ONCE(sysctl_numa_balancing_scan_period_max);
+	unsigned int unit = max(ref_th * 2 / NUMA_PROMOTE_ADJUST_STEPS, 1U);
+	unsigned int now = jiffies_to_msecs(jiffies);
+	unsigned int start = READ_ONCE(pt->start);
+	unsigned int th = READ_ONCE(pt->threshold) ? : ref_th;
+	unsigned long nr_passed, ref_passed;
+	u64 limit;
+
+	if (now - start <= period || cmpxchg(&pt->start, start, now) != start)
+		return th;
+
+	nr_passed = atomic_long_xchg(&pt->nr_passed, 0);
+	limit = migrate_rate_limit(src_nid, dst_nid);
+	if (!limit) {
+		WRITE_ONCE(pt->threshold, 0);
+		return ref_th;
+	}
+
+	/* base pages the rate limit lets through in one period */
+	ref_passed = div_u64(limit * period, MSEC_PER_SEC) >> PAGE_SHIFT;
+	if (nr_passed > ref_passed * 11 / 10)
+		th = th > 2 * unit ? th - unit : unit;
+	else if (nr_passed < ref_passed * 9 / 10)
+		th = min(th + unit, ref_th * 2);
+	WRITE_ONCE(pt->threshold, th);
+
+	return th;
+}
+
+/* Should the hinting fault on slow tier @page promote it to @dst_nid? */
+static bool should_numa_promote_memory(struct page *page, int src_nid,
+		int dst_nid, unsigned int ref_th)
+{
+	unsigned int th = numa_promote_threshold(src_nid, dst_nid, ref_th);
+
+	if (numa_hint_fault_latency(page) >= th)
+		return false;
+
+	atomic_long_add(hpage_nr_pages(page),
+			&numa_promote_thresholds[src_nid].nr_passed);
+	return true;
+}
+
 bool should_numa_migrate_memory(struct task_struct *p, struct page * page,
 				int src_nid, int dst_cpu)
 {
 	struct numa_group *ng = deref_curr_numa_group(p);
 	int dst_nid = cpu_to_node(dst_cpu);
+	unsigned int hot_th = READ_ONCE(sysctl_numa_balancing_hot_threshold);
 	int last_cpupid, this_cpupid;
 
+	if (node_is_slow_tier(src_nid) && !node_is_slow_tier(dst_nid)) {
+		/* demoted too early, it goes straight back */
+		if (workingset_demotion_refault(page))
+			return true;
+		/* the last cpupid of a scanned slow tier page is its scan time */
+		if (hot_th)
+			return should_numa_promote_memory(page, src_nid,
+					dst_nid, hot_th);
+	}
+
 	this_cpupid = cpu_pid_to_cpupid(dst_cpu, current->pid);
 	last_cpupid = page_cpupid_xchg_last(page, this_cpupid);
 
@@ -2219,6 +2395,26 @@ static void task_numa_placement(struct task_struct *p)
 		}
 	}
 
+	/*
+	 * Now that the faults of every node are up to date, pick the CPU
+	 * node with the most faults counting those of the CPU-less nodes
+	 * it is the home socket of.
+	 */
+	if (READ_ONCE(sysctl_numa_balancing_pmem_home)) {
+		max_faults = 0;
+		max_nid = NUMA_NO_NODE;
+		for_each_node_state(nid, N_CPU) {
+			unsigned long faults;
+
+			faults = ng ? group_faults(p, nid) : task_faults(p, nid);
+			faults += numa_pmem_home_faults(p, nid, !ng);
+			if (faults > max_faults) {
+				max_faults = faults;
+				max_nid = nid;
+			}
+		}
+	}
+
 	if (ng) {
 		numa_group_count_active_nodes(ng);
 		spin_unlock_irq(group_lock);
@@ -2467,6 +2663,28 @@ void task_numa_fault(int last_cpupid, int mem_node, int pages, int flags)
 	p->numa_faults_locality[local] += pages;
 }
 
+/*
+ * Whether the NUMA scanner of @mm leaves the pages of @nid alone on its
+ * current pass, see sysctl_numa_balancing_fast_scan_ratio.
+ */
+bool numa_scan_skip_node(struct mm_struct *mm, int nid)
+{
+	unsigned int ratio = READ_ONCE(sysctl_numa_balancing_fast_scan_ratio);
+
+	if (ratio <= 1 || !memory_tiers_present() || node_is_slow_tier(nid))
+		return false;
+
+	return READ_ONCE(mm->numa_scan_seq) % ratio;
+}
+
+/* Called by the NUMA scanner on each page it makes a hinting fault */
+void numa_scan_mark_page(struct page *page)
+{
+	if (READ_ONCE(sysctl_numa_balancing_hot_threshold) &&
+	    node_is_slow_tier(page_to_nid(page)))
+		xchg_page_access_time(page, jiffies_to_msecs(jiffies));
+}
+
 static void reset_ptenuma_scan(struct task_struct *p)
 {
 	/*
@@ -2537,6 +2755,10 @@ static void task_numa_work(struct callback_head *work)
 	 */
 	p->node_stamp += 2 * TICK_NSEC;
 
+	/* no hinting faults nor TLB flushes while migrations are quiesced */
+	if (mem_cgroup_mm_migrate_quiesced(mm))
+		return;
+
 	start = mm->numa_scan_offset;
 	pages = sysctl_numa_balancing_scan_size;
 	pages <<= 20 - PAGE_SHIFT; /* MB in pages */
@@ -2566,7 +2788,8 @@ static void task_numa_work(struct callback_head *work)
 		 * as migrating the pages will be of marginal benefit.
 		 */
 		if (!vma->vm_mm ||
-		    (vma->vm_file && (vma->vm_flags & (VM_READ|VM_WRITE)) == (VM_READ)))
+		    (vma->vm_file && (vma->vm_flags & (VM_READ|VM_WRITE)) == (VM_READ) &&
+		     !numa_replicate_vma(vma)))
 			continue;
 
 		/*
@@ -2615,6 +2838,8 @@ static void task_numa_work(struct callback_head *work)
 		reset_ptenuma_scan(p);
 	up_read(&mm->mmap_sem);
 
+	pgtable_tier_update(mm);
+
 	/*
 	 * Make sure tasks use at least 32x as much time to run other code
 	 * than they used here, to limit NUMA PTE scanning overhead to 3% max.
@@ -50,7 +50,9 @@
 #include <linux/kprobes.h>
 #include <linux/kthread.h>
 #include <linux/membarrier.h>
+#include <linux/memory_tier.h>
 #include <linux/migrate.h>
+#include <linux/migrate_rate.h>
 #include <linux/mmu_context.h>
 #include <linux/nmi.h>
 #include <linux/proc_fs.h>
@@ -68,6 +68,10 @@
 #include <linux/bpf.h>
 #include <linux/mount.h>
 #include <linux/userfaultfd_k.h>
+#include <linux/migrate.h>
+#include <linux/access_scan.h>
+#include <linux/migrate_latency.h>
+#include <linux/migrate_record.h>
 
 #include "../lib/kstrtox.h"
 
@@ -105,10 +109,97 @@
 
 extern int accel_page_copy;
 extern unsigned int limit_mt_num;
+static unsigned int max_limit_mt_num = MAX_NR_COPY_THREADS;
+static int three = 3;
 extern int use_all_dma_chans;
 extern int limit_dma_chans;
+extern int dma_batch_page_copy;
+extern unsigned int hybrid_dma_share;
 extern int sysctl_enable_thp_migration;
+extern int concur_copy_batch_size;
+extern int concur_pipeline_depth;
+extern int sysctl_migrate_target_cache_pages;
+extern unsigned long sysctl_migrate_rate_limit;
+extern int sysctl_migrate_bandwidth_headroom;
+extern int sysctl_pmem_writer_limit;
+extern int sysctl_migrate_exchange_fallback;
+extern int sysctl_migrate_prep_interval_ms;
+extern int sysctl_thp_migration_compact;
+#ifdef CONFIG_FS_DAX
+extern unsigned long sysctl_dax_stream_min_bytes;
+extern unsigned long sysctl_dax_wbinvd_bytes;
+extern int sysctl_dax_dram_cache;
+extern unsigned long sysctl_dax_dram_cache_pages;
+#endif
+#ifdef CONFIG_FS_DAX_PMD
+extern int sysctl_dax_fault_around_pmds;
+#endif
+#if defined(CONFIG_HUGETLB_PAGE) && defined(CONFIG_ARCH_HAS_GIGANTIC_PAGE) && \
+	defined(CONFIG_CONTIG_ALLOC)
+extern int sysctl_hugetlb_slow_tier_movable;
+#endif
+extern int sysctl_migrate_thp_precopy;
+extern int sysctl_migrate_notify_batch;
+extern int sysctl_migrate_same_filled;
+extern int sysctl_migrate_shadow;
+extern int sysctl_longterm_pin_fast_tier;
+extern int sysctl_fork_copy_parallel_mb;
+#if defined(CONFIG_SLUB) && defined(CONFIG_NUMA)
+extern int sysctl_slab_reclaimable_slow_tier;
+#endif
+#ifdef CONFIG_NUMA
+extern int sysctl_page_cache_readahead_slow_tier;
+extern int sysctl_page_cache_promote;
+extern int sysctl_cold_site_ratio;
+#endif
+#ifdef CONFIG_MEMORY_HOTREMOVE
+extern int sysctl_memory_offline_migrate;
+#endif
+#ifdef CONFIG_CONTIG_ALLOC
+extern int sysctl_contig_range_migrate;
+#endif
+extern int sysctl_kmigrated_nice;
+extern int sysctl_kmigrated_rate_pages;
+static int kmigrated_min_nice = MIN_NICE;
+static int kmigrated_max_nice = MAX_NICE;
+static int max_concur_pipeline_depth = CONCUR_PIPELINE_MAX_DEPTH;
+extern int sysctl_copy_engine_auto;
+extern int concur_offload_min_pages;
 extern int migration_batch_size;
+extern int sysctl_migration_batch_target_us;
+extern int sysctl_migration_min_benefit;
+extern int sysctl_thp_split_promote_ratio;
+extern int sysctl_thp_promote_collapse_ratio;
+extern int migration_batch_size_auto[NR_MIGRATION_BATCH_KINDS];
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+extern int sysctl_access_scan_pages;
+extern int sysctl_access_scan_interval_ms;
+extern int sysctl_access_scan_hot_threshold;
+extern int sysctl_access_scan_guest_pages;
+extern int sysctl_access_scan_guest_interval_ms;
+extern int sysctl_access_scan_thp_subpages;
+extern int sysctl_access_scan_regions;
+static int access_scan_max_threshold = 8;
+static int access_scan_max_regions = 65536;
+#endif
+#ifdef CONFIG_PAGE_ACCESS_SAMPLE
+extern unsigned long sysctl_access_sample_event;
+extern unsigned long sysctl_access_sample_ldlat;
+extern unsigned long sysctl_access_sample_period;
+extern int sysctl_access_sample_hot_weight;
+extern int sysctl_access_sample_decay_ms;
+#endif
+#ifdef CONFIG_PAGE_MIGRATE_HISTORY
+extern int sysctl_migrate_hysteresis_ms;
+#endif
+extern int sysctl_reclaim_demote;
+#ifdef CONFIG_NUMA_BALANCING
+extern int sysctl_numa_promote_batch_pages;
+extern int sysctl_numa_promote_flags;
+extern int sysctl_numa_promote_delay_ms;
+extern int sysctl_numa_promote_prefetch_pages;
+extern int sysctl_numa_promote_prefetch_adaptive;
+#endif
 
 /* External variables not in a header file. */
 extern int suid_dumpable;
@@ -323,6 +414,13 @@ static int min_extfrag_threshold;
 static int max_extfrag_threshold = 1000;
 extern int use_concur_to_compact;
 extern int num_block_to_scan;
+static int max_block_to_scan = 63;
+extern int sysctl_compact_evacuate;
+#endif
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+extern int sysctl_khugepaged_mt_copy;
+extern int sysctl_khugepaged_tier_aware;
 #endif
 
 static struct ctl_table kern_table[] = {
@@ -333,12 +431,48 @@ static struct ctl_table kern_table[] = {
 		.mode = 0644,
 		.proc_handler = proc_dointvec,
 	},
+	{
+		.procname = "nt_page_copy_policy",
+		.data = &sysctl_nt_page_copy_policy,
+		.maxlen = sizeof(sysctl_nt_page_copy_policy),
+		.mode = 0644,
+		.proc_handler = proc_dointvec_minmax,
+		.extra1 = SYSCTL_ZERO,
+		.extra2 = &three,
+	},
+#ifdef CONFIG_FS_DAX
+	{
+		.procname = "dax_stream_min_bytes",
+		.data = &sysctl_dax_stream_min_bytes,
+		.maxlen = sizeof(unsigned long),
+		.mode = 0644,
+		.proc_handler = proc_doulongvec_minmax,
+	},
+#endif
 	{
 		.procname = "enable_nt_exchange_page",
 		.data = &sysctl_enable_nt_exchange,
 		.maxlen = sizeof(int),
 		.mode = 0644,
-		.proc_handler = proc_dointvec,
+		.proc_handler = proc_dointvec_minmax,
+		.extra1 = SYSCTL_ZERO,
+		.extra2 = &two,
+	},
+	{
+		.procname = "exchange_split_socket",
+		.data = &sysctl_exchange_split_socket,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = proc_dointvec_minmax,
+		.extra1 = SYSCTL_ZERO,
+		.extra2 = SYSCTL_ONE,
+	},
+	{
+		.procname = "page_copy_engine",
+		.data = &sysctl_page_copy_engine,
+		.maxlen = sizeof(int),
+		.mode = 0644,
+		.proc_handler = sysctl_page_copy_engine_handler,
 	},
 	{
 		.procname = "enable_page_migration_optimization_avoid_remote_pmem_write",
@@ -448,6 +582,40 @@ static struct ctl_table kern_table[] = {
 		.proc_handler	= proc_dointvec_minmax,
 		.extra1		= SYSCTL_ONE,
 	},
+	{
+		.procname	= "numa_balancing_fast_scan_ratio",
+		.data		= &sysctl_numa_balancing_fast_scan_ratio,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ONE,
+	},
+	{
+		.procname	= "numa_balancing_hot_threshold_ms",
+		.data		= &sysctl_numa_balancing_hot_threshold,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	},
+	{
+		.procname	= "numa_balancing_pmem_home",
+		.data		= &sysctl_numa_balancing_pmem_home,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+	{
+		.procname	= "numa_balancing_replicate",
+		.data		= &sysctl_numa_balancing_replicate,
+		.maxlen		= sizeof(unsigned int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
 	{
 		.procname	= "numa_balancing",
 		.data		= NULL, /* filled in by handler */
@@ -1451,6 +1619,39 @@ static struct ctl_table vm_table[] = {
 		.mode           = 0644,
 		.proc_handler   = &hugetlb_mempolicy_sysctl_handler,
 	},
+#if defined(CONFIG_ARCH_HAS_GIGANTIC_PAGE) && defined(CONFIG_CONTIG_ALLOC)
+	{
+		.procname	= "hugetlb_slow_tier_movable",
+		.data		= &sysctl_hugetlb_slow_tier_movable,
+		.maxlen		= sizeof(sysctl_hugetlb_slow_tier_movable),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	},
+#endif
+#ifdef CONFIG_MEMORY_HOTREMOVE
+	{
+		.procname	= "memory_offline_migrate",
+		.data		= &sysctl_memory_offline_migrate,
+		.maxlen		= sizeof(sysctl_memory_offline_migrate),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &two,
+	},
+#endif
+#ifdef CONFIG_CONTIG_ALLOC
+	{
+		.procname	= "contig_range_migrate",
+		.data		= &sysctl_contig_range_migrate,
+		.maxlen		= sizeof(sysctl_contig_range_migrate),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &two,
+	},
+#endif
 	{
 		.procname		= "numa_stat",
 		.data			= &sysctl_vm_numa_stat,
@@ -1475,8 +1676,33 @@ static struct ctl_table vm_table[] = {
 		.data		= &limit_mt_num,
 		.maxlen		= sizeof(limit_mt_num),
 		.mode		= 0644,
-		.proc_handler	= proc_dointvec,
+		.proc_handler	= proc_douintvec_minmax,
 		.extra1		= SYSCTL_ZERO,
+		.extra2		= &max_limit_mt_num,
+	},
+	{
+		.procname	= "mt_copy_inline_pages",
+		.data		= &sysctl_mt_copy_inline_pages,
+		.maxlen		= sizeof(sysctl_mt_copy_inline_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &neg_one,
+		.extra2		= SYSCTL_INT_MAX,
+	},
+	{
+		.procname	= "mt_copy_interleave_ways",
+		.data		= &sysctl_mt_copy_interleave_ways,
+		.maxlen		= sizeof(sysctl_mt_copy_interleave_ways),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	},
+	{
+		.procname	= "mt_copy_inline_pages_auto",
+		.data		= &mt_copy_inline_pages_auto,
+		.maxlen		= sizeof(mt_copy_inline_pages_auto),
+		.mode		= 0444,
+		.proc_handler	= proc_douintvec,
 	},
 	 {
 		.procname	= "use_all_dma_chans",
@@ -1492,8 +1718,24 @@ static struct ctl_table vm_table[] = {
 		.data		= &limit_dma_chans,
 		.maxlen		= sizeof(limit_dma_chans),
 		.mode		= 0644,
-		.proc_handler	= proc_dointvec,
+		.proc_handler	= sysctl_dma_page_migration,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "hybrid_dma_share",
+		.data		= &hybrid_dma_share,
+		.maxlen		= sizeof(hybrid_dma_share),
+		.mode		= 0444,
+		.proc_handler	= proc_douintvec,
+	 },
+	 {
+		.procname	= "dma_batch_page_copy",
+		.data		= &dma_batch_page_copy,
+		.maxlen		= sizeof(dma_batch_page_copy),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
 		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
 	 },
 	 {
 		.procname	= "use_concur_to_compact",
@@ -1509,7 +1751,16 @@ static struct ctl_table vm_table[] = {
 		.data		= &num_block_to_scan,
 		.maxlen		= sizeof(num_block_to_scan),
 		.mode		= 0644,
-		.proc_handler	= proc_dointvec,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &max_block_to_scan,
+	 },
+	 {
+		.procname	= "compact_evacuate",
+		.data		= &sysctl_compact_evacuate,
+		.maxlen		= sizeof(sysctl_compact_evacuate),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
 		.extra1		= SYSCTL_ZERO,
 		.extra2		= SYSCTL_ONE,
 	 },
@@ -1522,6 +1773,43 @@ static struct ctl_table vm_table[] = {
 		.extra1		= SYSCTL_ZERO,
 		.extra2		= SYSCTL_ONE,
 	 },
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	 {
+		.procname	= "khugepaged_mt_copy",
+		.data		= &sysctl_khugepaged_mt_copy,
+		.maxlen		= sizeof(sysctl_khugepaged_mt_copy),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "khugepaged_tier_aware",
+		.data		= &sysctl_khugepaged_tier_aware,
+		.maxlen		= sizeof(sysctl_khugepaged_tier_aware),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+#endif
+	 {
+		.procname	= "cow_huge_page_mt_pages",
+		.data		= &sysctl_cow_huge_page_mt_pages,
+		.maxlen		= sizeof(sysctl_cow_huge_page_mt_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "clear_huge_page_nt",
+		.data		= &sysctl_clear_huge_page_nt,
+		.maxlen		= sizeof(sysctl_clear_huge_page_nt),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &two,
+	 },
 	 {
 		.procname	= "migration_batch_size",
 		.data		= &migration_batch_size,
@@ -1529,6 +1817,485 @@ static struct ctl_table vm_table[] = {
 		.mode		= 0644,
 		.proc_handler	= proc_dointvec,
 	 },
+	 {
+		.procname	= "migration_batch_target_us",
+		.data		= &sysctl_migration_batch_target_us,
+		.maxlen		= sizeof(sysctl_migration_batch_target_us),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "migration_min_benefit",
+		.data		= &sysctl_migration_min_benefit,
+		.maxlen		= sizeof(sysctl_migration_min_benefit),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "thp_split_promote_ratio",
+		.data		= &sysctl_thp_split_promote_ratio,
+		.maxlen		= sizeof(sysctl_thp_split_promote_ratio),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &one_hundred,
+	 },
+	 {
+		.procname	= "thp_promote_collapse_ratio",
+		.data		= &sysctl_thp_promote_collapse_ratio,
+		.maxlen		= sizeof(sysctl_thp_promote_collapse_ratio),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &one_hundred,
+	 },
+	 {
+		.procname	= "migration_batch_size_auto",
+		.data		= &migration_batch_size_auto,
+		.maxlen		= sizeof(migration_batch_size_auto),
+		.mode		= 0444,
+		.proc_handler	= proc_dointvec,
+	 },
+	 {
+		.procname	= "concur_copy_batch_size",
+		.data		= &concur_copy_batch_size,
+		.maxlen		= sizeof(concur_copy_batch_size),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "migrate_target_cache_pages",
+		.data		= &sysctl_migrate_target_cache_pages,
+		.maxlen		= sizeof(sysctl_migrate_target_cache_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "migrate_rate_limit",
+		.data		= &sysctl_migrate_rate_limit,
+		.maxlen		= sizeof(sysctl_migrate_rate_limit),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	 },
+	 {
+		.procname	= "migrate_bandwidth_headroom",
+		.data		= &sysctl_migrate_bandwidth_headroom,
+		.maxlen		= sizeof(sysctl_migrate_bandwidth_headroom),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &one_hundred,
+	 },
+	 {
+		.procname	= "pmem_writer_limit",
+		.data		= &sysctl_pmem_writer_limit,
+		.maxlen		= sizeof(sysctl_pmem_writer_limit),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "migrate_latency_hist",
+		.data		= &sysctl_migrate_latency_hist,
+		.maxlen		= sizeof(sysctl_migrate_latency_hist),
+		.mode		= 0644,
+		.proc_handler	= migrate_latency_sysctl_handler,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+#ifdef CONFIG_MIGRATE_RECORD
+	 {
+		.procname	= "migrate_record",
+		.data		= &sysctl_migrate_record,
+		.maxlen		= sizeof(sysctl_migrate_record),
+		.mode		= 0644,
+		.proc_handler	= migrate_record_sysctl_handler,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+#endif
+	 {
+		.procname	= "migrate_thp_precopy",
+		.data		= &sysctl_migrate_thp_precopy,
+		.maxlen		= sizeof(sysctl_migrate_thp_precopy),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "migrate_notify_batch",
+		.data		= &sysctl_migrate_notify_batch,
+		.maxlen		= sizeof(sysctl_migrate_notify_batch),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "migrate_same_filled",
+		.data		= &sysctl_migrate_same_filled,
+		.maxlen		= sizeof(sysctl_migrate_same_filled),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "migrate_shadow",
+		.data		= &sysctl_migrate_shadow,
+		.maxlen		= sizeof(sysctl_migrate_shadow),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "longterm_pin_fast_tier",
+		.data		= &sysctl_longterm_pin_fast_tier,
+		.maxlen		= sizeof(sysctl_longterm_pin_fast_tier),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "fork_copy_parallel_mb",
+		.data		= &sysctl_fork_copy_parallel_mb,
+		.maxlen		= sizeof(sysctl_fork_copy_parallel_mb),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "thp_migration_compact",
+		.data		= &sysctl_thp_migration_compact,
+		.maxlen		= sizeof(sysctl_thp_migration_compact),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "migrate_prep_interval_ms",
+		.data		= &sysctl_migrate_prep_interval_ms,
+		.maxlen		= sizeof(sysctl_migrate_prep_interval_ms),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "migrate_exchange_fallback",
+		.data		= &sysctl_migrate_exchange_fallback,
+		.maxlen		= sizeof(sysctl_migrate_exchange_fallback),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "kmigrated_nice",
+		.data		= &sysctl_kmigrated_nice,
+		.maxlen		= sizeof(sysctl_kmigrated_nice),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &kmigrated_min_nice,
+		.extra2		= &kmigrated_max_nice,
+	 },
+	 {
+		.procname	= "kmigrated_rate_pages",
+		.data		= &sysctl_kmigrated_rate_pages,
+		.maxlen		= sizeof(sysctl_kmigrated_rate_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "concur_pipeline_depth",
+		.data		= &concur_pipeline_depth,
+		.maxlen		= sizeof(concur_pipeline_depth),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ONE,
+		.extra2		= &max_concur_pipeline_depth,
+	 },
+	 {
+		.procname	= "copy_engine_auto",
+		.data		= &sysctl_copy_engine_auto,
+		.maxlen		= sizeof(sysctl_copy_engine_auto),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "concur_offload_min_pages",
+		.data		= &concur_offload_min_pages,
+		.maxlen		= sizeof(concur_offload_min_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+#ifdef CONFIG_PAGE_MIGRATE_HISTORY
+	 {
+		.procname	= "migrate_hysteresis_ms",
+		.data		= &sysctl_migrate_hysteresis_ms,
+		.maxlen		= sizeof(sysctl_migrate_hysteresis_ms),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+#endif
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+	 {
+		.procname	= "access_scan_pages",
+		.data		= &sysctl_access_scan_pages,
+		.maxlen		= sizeof(sysctl_access_scan_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "access_scan_interval_ms",
+		.data		= &sysctl_access_scan_interval_ms,
+		.maxlen		= sizeof(sysctl_access_scan_interval_ms),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "access_scan_hot_threshold",
+		.data		= &sysctl_access_scan_hot_threshold,
+		.maxlen		= sizeof(sysctl_access_scan_hot_threshold),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ONE,
+		.extra2		= &access_scan_max_threshold,
+	 },
+	 {
+		.procname	= "access_scan_guest_pages",
+		.data		= &sysctl_access_scan_guest_pages,
+		.maxlen		= sizeof(sysctl_access_scan_guest_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "access_scan_guest_interval_ms",
+		.data		= &sysctl_access_scan_guest_interval_ms,
+		.maxlen		= sizeof(sysctl_access_scan_guest_interval_ms),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "access_scan_thp_subpages",
+		.data		= &sysctl_access_scan_thp_subpages,
+		.maxlen		= sizeof(sysctl_access_scan_thp_subpages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "access_scan_regions",
+		.data		= &sysctl_access_scan_regions,
+		.maxlen		= sizeof(sysctl_access_scan_regions),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &access_scan_max_regions,
+	 },
+#endif
+#ifdef CONFIG_PAGE_ACCESS_SAMPLE
+	 {
+		.procname	= "access_sample_event",
+		.data		= &sysctl_access_sample_event,
+		.maxlen		= sizeof(sysctl_access_sample_event),
+		.mode		= 0644,
+		.proc_handler	= access_sample_sysctl_handler,
+	 },
+	 {
+		.procname	= "access_sample_ldlat",
+		.data		= &sysctl_access_sample_ldlat,
+		.maxlen		= sizeof(sysctl_access_sample_ldlat),
+		.mode		= 0644,
+		.proc_handler	= access_sample_sysctl_handler,
+	 },
+	 {
+		.procname	= "access_sample_period",
+		.data		= &sysctl_access_sample_period,
+		.maxlen		= sizeof(sysctl_access_sample_period),
+		.mode		= 0644,
+		.proc_handler	= access_sample_sysctl_handler,
+	 },
+	 {
+		.procname	= "access_sample_hot_weight",
+		.data		= &sysctl_access_sample_hot_weight,
+		.maxlen		= sizeof(sysctl_access_sample_hot_weight),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "access_sample_decay_ms",
+		.data		= &sysctl_access_sample_decay_ms,
+		.maxlen		= sizeof(sysctl_access_sample_decay_ms),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ONE,
+	 },
+#endif
+	 {
+		.procname	= "reclaim_demote",
+		.data		= &sysctl_reclaim_demote,
+		.maxlen		= sizeof(sysctl_reclaim_demote),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+#ifdef CONFIG_SPARSEMEM_VMEMMAP
+	 {
+		.procname	= "vmemmap_fast_tier",
+		.data		= &sysctl_vmemmap_fast_tier,
+		.maxlen		= sizeof(sysctl_vmemmap_fast_tier),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+#endif
+#ifdef CONFIG_FS_DAX
+	 {
+		.procname	= "dax_wbinvd_bytes",
+		.data		= &sysctl_dax_wbinvd_bytes,
+		.maxlen		= sizeof(sysctl_dax_wbinvd_bytes),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	 },
+	 {
+		.procname	= "dax_dram_cache",
+		.data		= &sysctl_dax_dram_cache,
+		.maxlen		= sizeof(sysctl_dax_dram_cache),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &two,
+	 },
+	 {
+		.procname	= "dax_dram_cache_pages",
+		.data		= &sysctl_dax_dram_cache_pages,
+		.maxlen		= sizeof(sysctl_dax_dram_cache_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_doulongvec_minmax,
+	 },
+#endif
+#ifdef CONFIG_FS_DAX_PMD
+	 {
+		.procname	= "dax_fault_around_pmds",
+		.data		= &sysctl_dax_fault_around_pmds,
+		.maxlen		= sizeof(sysctl_dax_fault_around_pmds),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+#endif
+#ifdef CONFIG_NUMA
+	 {
+		.procname	= "pgtable_fast_tier",
+		.data		= &sysctl_pgtable_fast_tier,
+		.maxlen		= sizeof(sysctl_pgtable_fast_tier),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "page_cache_readahead_slow_tier",
+		.data		= &sysctl_page_cache_readahead_slow_tier,
+		.maxlen		= sizeof(sysctl_page_cache_readahead_slow_tier),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "page_cache_promote",
+		.data		= &sysctl_page_cache_promote,
+		.maxlen		= sizeof(sysctl_page_cache_promote),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+	 {
+		.procname	= "cold_site_ratio",
+		.data		= &sysctl_cold_site_ratio,
+		.maxlen		= sizeof(sysctl_cold_site_ratio),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &one_hundred,
+	 },
+#endif
+#if defined(CONFIG_SLUB) && defined(CONFIG_NUMA)
+	 {
+		.procname	= "slab_reclaimable_slow_tier",
+		.data		= &sysctl_slab_reclaimable_slow_tier,
+		.maxlen		= sizeof(sysctl_slab_reclaimable_slow_tier),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &two,
+	 },
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	 {
+		.procname	= "numa_promote_batch_pages",
+		.data		= &sysctl_numa_promote_batch_pages,
+		.maxlen		= sizeof(sysctl_numa_promote_batch_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "numa_promote_flags",
+		.data		= &sysctl_numa_promote_flags,
+		.maxlen		= sizeof(sysctl_numa_promote_flags),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec,
+	 },
+	 {
+		.procname	= "numa_promote_delay_ms",
+		.data		= &sysctl_numa_promote_delay_ms,
+		.maxlen		= sizeof(sysctl_numa_promote_delay_ms),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "numa_promote_prefetch_pages",
+		.data		= &sysctl_numa_promote_prefetch_pages,
+		.maxlen		= sizeof(sysctl_numa_promote_prefetch_pages),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	 },
+	 {
+		.procname	= "numa_promote_prefetch_adaptive",
+		.data		= &sysctl_numa_promote_prefetch_adaptive,
+		.maxlen		= sizeof(sysctl_numa_promote_prefetch_adaptive),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= SYSCTL_ONE,
+	 },
+#endif
 	 {
 		.procname	= "hugetlb_shm_group",
 		.data		= &sysctl_hugetlb_shm_group,
@@ -1586,6 +2353,22 @@ static struct ctl_table vm_table[] = {
 		.extra1		= SYSCTL_ZERO,
 		.extra2		= SYSCTL_ONE,
 	},
+	{
+		.procname	= "compact_proactive_ms",
+		.data		= &sysctl_compact_proactive_ms,
+		.maxlen		= sizeof(sysctl_compact_proactive_ms),
+		.mode		= 0644,
+		.proc_handler	= compact_proactive_sysctl_handler,
+		.extra1		= SYSCTL_ZERO,
+	},
+	{
+		.procname	= "compact_proactive_blocks",
+		.data		= &sysctl_compact_proactive_blocks,
+		.maxlen		= sizeof(sysctl_compact_proactive_blocks),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= SYSCTL_ZERO,
+	},
 
 #endif /* CONFIG_COMPACTION */
 	{
@@ -1613,6 +2396,24 @@ static struct ctl_table vm_table[] = {
 		.extra1		= SYSCTL_ONE,
 		.extra2		= &one_thousand,
 	},
+	{
+		.procname	= "demote_watermark_scale_factor",
+		.data		= &demote_watermark_scale_factor,
+		.maxlen		= sizeof(demote_watermark_scale_factor),
+		.mode		= 0644,
+		.proc_handler	= watermark_scale_factor_sysctl_handler,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &one_thousand,
+	},
+	{
+		.procname	= "promote_headroom_factor",
+		.data		= &promote_headroom_factor,
+		.maxlen		= sizeof(promote_headroom_factor),
+		.mode		= 0644,
+		.proc_handler	= watermark_scale_factor_sysctl_handler,
+		.extra1		= SYSCTL_ZERO,
+		.extra2		= &one_thousand,
+	},
 	{
 		.procname	= "percpu_pagelist_fraction",
 		.data		= &percpu_pagelist_fraction,
@@ -0,0 +1,598 @@
+/*
+ * Region based access monitoring.
+ *
+ * The page sweeps of mm/access_scan.c cost as much as the memory they
+ * cover, too much for address spaces of terabytes. With vm.access_scan_regions
+ * set, access_scan_mm() monitors an address space by regions instead: the
+ * pages of a region are assumed to be accessed alike, and each scan checks
+ * the accessed bit of a single page picked at random in every region, the
+ * bit of that page having been cleared by the previous scan. Every
+ * ACCESS_REGION_SAMPLES scans the number of samples seen accessed becomes
+ * the access frequency of the region, from 0 to 8 like the one of a page,
+ * then adjacent regions of similar frequencies are merged and, while there
+ * are less than half of vm.access_scan_regions, every region is split in
+ * two at a random page. The cost of a scan is two page table lookups per
+ * region, whatever the size of the address space.
+ *
+ * The regions follow the VMAs the page sweep would walk, a region never
+ * spans two VMAs unless there are more VMAs than regions. Every
+ * ACCESS_REGION_REBUILD aggregations they are clipped to the VMAs again,
+ * the mappings added since getting regions of their own.
+ *
+ * The frequency of a region reaches mm_manage() through the pages sampled:
+ * each page checked, and the other pages of the region its page table maps,
+ * get the frequency of the region as their page_ext sample history, read by
+ * page_access_frequency(). MADV_DEMOTE leaves the hot
+ * regions of a range where they are, and MADV_PROMOTE the regions never
+ * seen accessed, see access_region_frequency().
+ *
+ * /proc/pid/heat_map exports the frequencies of the regions keyed by file
+ * offset and by offset in the heap, the stack or the mmap area, for a
+ * restarted program to import them: access_regions_import() seeds its
+ * regions with them, so that mm_manage() places its pages by them until
+ * the first aggregation of its own samples, and moves the pages already
+ * faulted in of the hot and the idle ranges right away.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mmu_notifier.h>
+#include <linux/huge_mm.h>
+#include <linux/pagewalk.h>
+#include <linux/page_idle.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/mman.h>
+#include <linux/sched/signal.h>
+#include <linux/access_scan.h>
+
+#include "internal.h"
+
+// Regions an address space is monitored by, 0 for the page sweeps
+int sysctl_access_scan_regions = 0;
+
+/* samples per region aggregated into its access frequency */
+#define ACCESS_REGION_SAMPLES	8
+/* aggregations between two rebuilds of the regions from the VMAs */
+#define ACCESS_REGION_REBUILD	8
+/* largest difference of the frequencies of two regions merged */
+#define ACCESS_REGION_MERGE_DIFF	1
+
+struct access_region {
+	unsigned long start;
+	unsigned long end;
+	unsigned long sample;	/* page whose accessed bit was cleared */
+	u8 nr_accesses;		/* of the samples since the aggregation */
+	s8 freq;		/* -1 until the first aggregation */
+};
+
+/*
+ * The regions of an mm. Only the scan, which holds MMF_ACCESS_SCAN, changes
+ * them; the bounds and frequencies change under @lock, which the readers of
+ * access_region_frequency() take, possibly under a page table lock. The
+ * mm points to them under RCU.
+ */
+struct access_regions {
+	spinlock_t lock;
+	int nr;
+	int max;
+	int nr_samples;
+	int nr_aggregations;
+	struct access_region region[];
+};
+
+static bool access_region_vma(struct vm_area_struct *vma)
+{
+	/* the VMAs access_scan_test_walk() skips */
+	return !(vma->vm_flags & (VM_PFNMAP | VM_MIXEDMAP | VM_IO | VM_HUGETLB |
+				  VM_LOCKED));
+}
+
+static unsigned long access_region_pages(struct access_region *r)
+{
+	return (r->end - r->start) >> PAGE_SHIFT;
+}
+
+/* The first region of @ar ending after @addr, NULL if none does */
+static struct access_region *access_region_next(struct access_regions *ar,
+		unsigned long addr)
+{
+	int lo = 0, hi = ar->nr, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (ar->region[mid].end <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < ar->nr ? &ar->region[lo] : NULL;
+}
+
+/*
+ * Build regions for the VMAs of @mm, the regions of @old clipped to them,
+ * with their frequencies, and the parts of the VMAs none of @old covers.
+ * The last region takes the rest of the address space when there are more
+ * than @max.
+ */
+static struct access_regions *access_regions_build(struct mm_struct *mm,
+		struct access_regions *old, int max)
+{
+	struct access_regions *ar;
+	struct vm_area_struct *vma;
+	struct access_region *r, *prev;
+	unsigned long addr, end;
+	s8 freq;
+
+	ar = kvzalloc(struct_size(ar, region, max), GFP_KERNEL);
+	if (!ar)
+		return NULL;
+
+	spin_lock_init(&ar->lock);
+	ar->max = max;
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (!access_region_vma(vma))
+			continue;
+
+		for (addr = vma->vm_start; addr < vma->vm_end; addr = end) {
+			end = vma->vm_end;
+			freq = -1;
+			prev = old ? access_region_next(old, addr) : NULL;
+			if (prev && prev->start <= addr) {
+				end = min(prev->end, end);
+				freq = prev->freq;
+			} else if (prev && prev->start < end) {
+				end = prev->start;
+			}
+
+			if (ar->nr == max) {
+				ar->region[max - 1].end = vma->vm_end;
+				break;
+			}
+			r = &ar->region[ar->nr++];
+			r->start = addr;
+			r->end = end;
+			r->freq = freq;
+		}
+	}
+
+	return ar;
+}
+
+struct access_region_walk {
+	unsigned long start;	/* the region of the page */
+	unsigned long end;
+	s8 freq;
+	u8 pass;
+	bool young;
+};
+
+/*
+ * Give the pages of the region of @arw that the PTE table holding @pte, the
+ * one of @addr, maps the frequency of the region.
+ */
+static void access_region_stamp_ptes(struct vm_area_struct *vma, pte_t *pte,
+		unsigned long addr, struct access_region_walk *arw)
+{
+	unsigned long start = max3(arw->start, addr & PMD_MASK, vma->vm_start);
+	unsigned long end = min3(arw->end, (addr & PMD_MASK) + PMD_SIZE,
+				 vma->vm_end);
+	struct page *page;
+
+	pte -= (addr - start) >> PAGE_SHIFT;
+	for (addr = start; addr < end; addr += PAGE_SIZE, pte++) {
+		if (!pte_present(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (page && PageLRU(compound_head(page)))
+			page_access_stamp(page, arw->freq, arw->pass);
+	}
+}
+
+/*
+ * Test and clear the accessed bit of the page at the start of the range,
+ * and give it, and the pages of its region in the same page table, the
+ * frequency of its region.
+ */
+static int access_region_pmd_entry(pmd_t *pmd, unsigned long addr,
+		unsigned long end, struct mm_walk *walk)
+{
+	struct access_region_walk *arw = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	walk->action = ACTION_CONTINUE;
+
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd) && !is_huge_zero_pmd(*pmd)) {
+			page = pmd_page(*pmd);
+			arw->young = pmdp_clear_young_notify(vma,
+					addr & HPAGE_PMD_MASK, pmd);
+		}
+		goto stamp;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		return 1;
+
+	pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	if (pte_present(*pte)) {
+		page = vm_normal_page(vma, addr, *pte);
+		if (page && PageLRU(compound_head(page)))
+			arw->young = ptep_clear_young_notify(vma, addr, pte);
+		else
+			page = NULL;
+	}
+	if (page && arw->young)
+		set_page_young(page);
+	if (arw->freq >= 0)
+		access_region_stamp_ptes(vma, pte, addr, arw);
+	pte_unmap(pte);
+	spin_unlock(ptl);
+
+	/* only the first page of the range */
+	return 1;
+
+stamp:
+	if (page) {
+		if (arw->young)
+			set_page_young(page);
+		if (arw->freq >= 0)
+			page_access_stamp(page, arw->freq, arw->pass);
+	}
+	spin_unlock(ptl);
+
+	/* only the first page of the range */
+	return 1;
+}
+
+static int access_region_test_walk(unsigned long start, unsigned long end,
+		struct mm_walk *walk)
+{
+	return access_region_vma(walk->vma) ? 0 : 1;
+}
+
+static const struct mm_walk_ops access_region_ops = {
+	.pmd_entry = access_region_pmd_entry,
+	.test_walk = access_region_test_walk,
+};
+
+/*
+ * Whether the page at @addr, sampled in @r, was accessed since its bit was
+ * last cleared. Stamps the pages around it with @freq unless it is -1.
+ */
+static bool access_region_young(struct mm_struct *mm, struct access_region *r,
+		unsigned long addr, s8 freq, u8 pass)
+{
+	struct access_region_walk arw = {
+		.start = r->start,
+		.end = r->end,
+		.freq = freq,
+		.pass = pass,
+	};
+
+	walk_page_range(mm, addr, addr + PAGE_SIZE, &access_region_ops, &arw);
+
+	return arw.young;
+}
+
+/* Pick the next page sampled in @r and clear its accessed bit */
+static void access_region_prepare(struct mm_struct *mm,
+		struct access_region *r, u8 pass)
+{
+	r->sample = r->start +
+		((unsigned long)prandom_u32_max(access_region_pages(r)) <<
+		 PAGE_SHIFT);
+	access_region_young(mm, r, r->sample, -1, pass);
+}
+
+/* Merge the adjacent regions of similar frequencies, under the lock */
+static void access_regions_merge(struct access_regions *ar)
+{
+	struct access_region *prev, *r;
+	unsigned long prev_pages, pages;
+	int i, nr = 1;
+
+	for (i = 1; i < ar->nr; i++) {
+		prev = &ar->region[nr - 1];
+		r = &ar->region[i];
+
+		if (prev->end == r->start &&
+		    abs(prev->freq - r->freq) <= ACCESS_REGION_MERGE_DIFF) {
+			prev_pages = access_region_pages(prev);
+			pages = access_region_pages(r);
+			prev->freq = (prev->freq * prev_pages + r->freq * pages) /
+				(prev_pages + pages);
+			prev->end = r->end;
+			continue;
+		}
+		ar->region[nr++] = *r;
+	}
+	ar->nr = nr;
+}
+
+/*
+ * Split every region in two at a random page while there are less than
+ * half of the maximum number of regions, under the lock. The regions are
+ * moved up from the last one, so that each is read before it is written.
+ */
+static void access_regions_split(struct access_regions *ar)
+{
+	int extra = min(ar->max - ar->nr, ar->nr);
+	int i, j;
+
+	if (ar->nr * 2 > ar->max)
+		return;
+
+	for (i = ar->nr - 1, j = ar->nr + extra - 1; i >= 0; i--) {
+		struct access_region r = ar->region[i];
+		unsigned long pages = access_region_pages(&r);
+
+		if (j > i && pages > 1) {
+			unsigned long mid = r.start + ((1 +
+				(unsigned long)prandom_u32_max(pages - 1)) <<
+				PAGE_SHIFT);
+
+			ar->region[j] = r;
+			ar->region[j].start = mid;
+			ar->region[j--].sample = 0;
+			r.end = mid;
+			r.sample = 0;
+		}
+		ar->region[j--] = r;
+	}
+	/* the unsplittable regions leave slots at the start */
+	if (++j) {
+		memmove(ar->region, ar->region + j,
+			(ar->nr + extra - j) * sizeof(ar->region[0]));
+	}
+	ar->nr += extra - j;
+}
+
+static void access_regions_aggregate(struct access_regions *ar)
+{
+	int i;
+
+	spin_lock(&ar->lock);
+	for (i = 0; i < ar->nr; i++) {
+		ar->region[i].freq = ar->region[i].nr_accesses *
+			8 / ACCESS_REGION_SAMPLES;
+		ar->region[i].nr_accesses = 0;
+	}
+	access_regions_merge(ar);
+	access_regions_split(ar);
+	spin_unlock(&ar->lock);
+
+	ar->nr_samples = 0;
+	ar->nr_aggregations++;
+}
+
+/*
+ * One region scan of @mm by at most @max regions, called by access_scan_mm()
+ * with mmap_sem held for read and MMF_ACCESS_SCAN set.
+ */
+void access_regions_scan(struct mm_struct *mm, u8 pass, int max)
+{
+	struct access_regions *ar, *old;
+	struct access_region *r;
+	int i;
+
+	if (max <= 0)
+		return;
+
+	old = rcu_dereference_protected(mm->access_regions,
+			test_bit(MMF_ACCESS_SCAN, &mm->flags));
+	if (!old || old->max != max) {
+		ar = access_regions_build(mm, old, max);
+		if (!ar)
+			return;
+		rcu_assign_pointer(mm->access_regions, ar);
+		if (old) {
+			synchronize_rcu();
+			kvfree(old);
+		}
+	} else if (!old->nr_samples && old->nr_aggregations &&
+		   !(old->nr_aggregations % ACCESS_REGION_REBUILD)) {
+		ar = access_regions_build(mm, old, max);
+		if (ar) {
+			spin_lock(&old->lock);
+			memcpy(old->region, ar->region,
+			       ar->nr * sizeof(ar->region[0]));
+			old->nr = ar->nr;
+			spin_unlock(&old->lock);
+			kvfree(ar);
+		}
+		ar = old;
+		ar->nr_aggregations++;
+	} else {
+		ar = old;
+	}
+
+	for (i = 0; i < ar->nr; i++) {
+		r = &ar->region[i];
+		if (r->sample && access_region_young(mm, r, r->sample, r->freq,
+						     pass))
+			r->nr_accesses++;
+		access_region_prepare(mm, r, pass);
+		cond_resched();
+	}
+
+	if (++ar->nr_samples == ACCESS_REGION_SAMPLES)
+		access_regions_aggregate(ar);
+}
+
+/*
+ * Access frequency of the region of @mm holding @addr, 0 to 8, -1 if the
+ * regions do not know yet. *@end is set to where the answer stops holding,
+ * for the caller to look up the next addresses only past it.
+ */
+int access_region_frequency(struct mm_struct *mm, unsigned long addr,
+		unsigned long *end)
+{
+	struct access_regions *ar;
+	struct access_region *r;
+	int freq = -1;
+
+	*end = TASK_SIZE;
+
+	rcu_read_lock();
+	ar = rcu_dereference(mm->access_regions);
+	if (ar) {
+		spin_lock(&ar->lock);
+		r = access_region_next(ar, addr);
+		if (r && r->start <= addr) {
+			freq = r->freq;
+			*end = r->end;
+		} else if (r) {
+			*end = r->start;
+		}
+		spin_unlock(&ar->lock);
+	}
+	rcu_read_unlock();
+
+	return freq;
+}
+
+static int access_region_seed_cmp(const void *a, const void *b)
+{
+	const struct access_region_seed *sa = a, *sb = b;
+
+	if (sa->start == sb->start)
+		return 0;
+	return sa->start < sb->start ? -1 : 1;
+}
+
+/*
+ * Regions for the regions of @base with the frequencies of the @nr sorted
+ * ranges of @seed over theirs. A region is cut at the bounds of the ranges
+ * while there is room for the regions after it, once there is not it takes
+ * the frequency of the range at its start.
+ */
+static struct access_regions *access_regions_seeded(struct access_regions *base,
+		struct access_region_seed *seed, int nr)
+{
+	struct access_regions *ar;
+	struct access_region *b, *r;
+	unsigned long addr, end;
+	int i, s = 0;
+	s8 freq;
+
+	ar = kvzalloc(struct_size(ar, region, base->max), GFP_KERNEL);
+	if (!ar)
+		return NULL;
+
+	spin_lock_init(&ar->lock);
+	ar->max = base->max;
+
+	for (i = 0; i < base->nr; i++) {
+		b = &base->region[i];
+
+		for (addr = b->start; addr < b->end; addr = end) {
+			while (s < nr && seed[s].end <= addr)
+				s++;
+
+			end = b->end;
+			freq = b->freq;
+			if (s < nr && seed[s].start <= addr) {
+				end = min(seed[s].end, end);
+				freq = seed[s].freq;
+			} else if (s < nr && seed[s].start < end) {
+				end = seed[s].start;
+			}
+			if (ar->nr + base->nr - i >= ar->max)
+				end = b->end;
+
+			r = &ar->region[ar->nr++];
+			r->start = addr;
+			r->end = end;
+			r->freq = freq;
+		}
+	}
+
+	return ar;
+}
+
+/*
+ * Seed the regions of @mm, the address space of @task, with the @nr ranges
+ * of @seed and their frequencies, then promote the pages already faulted
+ * in of the hot ranges and demote those of the idle ones as MADV_PROMOTE
+ * and MADV_DEMOTE do. The frequencies hold until the next aggregation of
+ * the samples of the scan replaces them with the ones seen. @seed is
+ * sorted on the way.
+ */
+int access_regions_import(struct task_struct *task, struct mm_struct *mm,
+		struct access_region_seed *seed, int nr)
+{
+	int max = READ_ONCE(sysctl_access_scan_regions);
+	int hot = access_scan_hot_threshold();
+	struct access_regions *base, *ar, *old;
+	int i, behavior, err = 0;
+
+	if (max <= 0)
+		return -EOPNOTSUPP;
+
+	sort(seed, nr, sizeof(*seed), access_region_seed_cmp, NULL);
+
+	/* the regions only change under MMF_ACCESS_SCAN, wait for the scan */
+	while (test_and_set_bit_lock(MMF_ACCESS_SCAN, &mm->flags)) {
+		schedule_timeout_killable(1);
+		if (fatal_signal_pending(current))
+			return -EINTR;
+	}
+	if (down_read_killable(&mm->mmap_sem)) {
+		err = -EINTR;
+		goto out;
+	}
+
+	old = rcu_dereference_protected(mm->access_regions,
+			test_bit(MMF_ACCESS_SCAN, &mm->flags));
+	base = access_regions_build(mm, old, max);
+	ar = base ? access_regions_seeded(base, seed, nr) : NULL;
+	kvfree(base);
+	if (ar) {
+		rcu_assign_pointer(mm->access_regions, ar);
+		if (old) {
+			synchronize_rcu();
+			kvfree(old);
+		}
+	} else {
+		err = -ENOMEM;
+	}
+
+	up_read(&mm->mmap_sem);
+out:
+	clear_bit_unlock(MMF_ACCESS_SCAN, &mm->flags);
+	if (err)
+		return err;
+
+	for (i = 0; i < nr; i++) {
+		if (!seed[i].freq)
+			behavior = MADV_DEMOTE;
+		else if (seed[i].freq >= hot)
+			behavior = MADV_PROMOTE;
+		else
+			continue;
+
+		/* the pages move if there is a tier to move them to */
+		if (madvise_tier(task, mm, seed[i].start, seed[i].end,
+				 behavior, 0) == -EINTR)
+			return -EINTR;
+	}
+
+	return 0;
+}
+
+/* Free the regions of @mm, which is going away */
+void access_regions_exit(struct mm_struct *mm)
+{
+	kvfree(rcu_dereference_protected(mm->access_regions, true));
+	RCU_INIT_POINTER(mm->access_regions, NULL);
+}
@@ -0,0 +1,271 @@
+/*
+ * Hardware sampled page hotness.
+ *
+ * The accessed bit scanner costs CPU time for every page it looks at and
+ * cannot tell a load served by DRAM from one served by PMEM. Precise load
+ * sampling, PEBS on Intel, reports the physical address and the latency
+ * of a fraction of the loads that match an event, such as the loads that
+ * missed the L3 and were served by PMEM. The overflow handler of one such
+ * per-CPU perf event adds the latency of each sample to the count-min
+ * sketch of the node of the sampled page. The sketch overestimates but
+ * never underestimates the weight of a page, so a page it reports cold is
+ * cold, and it is halved every vm.access_sample_decay_ms so that pages
+ * cool down.
+ *
+ * mm_manage() takes the pages whose weight reaches
+ * vm.access_sample_hot_weight as hot when it isolates pages.
+ *
+ * Sampling starts when the raw event config is written to
+ * vm.access_sample_event, with vm.access_sample_ldlat as the load latency
+ * threshold of load latency events and one sample every
+ * vm.access_sample_period events, and stops when 0 is written.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/hash.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/perf_event.h>
+#include <linux/workqueue.h>
+#include <linux/sysctl.h>
+#include <linux/access_scan.h>
+
+#include "internal.h"
+
+// Raw config of the precise load event to sample, 0 stops sampling
+unsigned long sysctl_access_sample_event = 0;
+// Load latency threshold in cycles of load latency events
+unsigned long sysctl_access_sample_ldlat = 0;
+// Events per sample
+unsigned long sysctl_access_sample_period = 10007;
+// Sampled load latency that makes a page hot
+int sysctl_access_sample_hot_weight = 1000;
+// Period of halving the sampled weights
+int sysctl_access_sample_decay_ms = 1000;
+
+bool access_sample_active;
+
+#define ACCESS_SKETCH_DEPTH	4
+#define ACCESS_SKETCH_SHIFT	12
+#define ACCESS_SKETCH_WIDTH	(1 << ACCESS_SKETCH_SHIFT)
+/* keeps one outlier from saturating its slots until the next decay */
+#define ACCESS_SAMPLE_MAX_WEIGHT	U16_MAX
+
+struct access_sketch {
+	u64 seed[ACCESS_SKETCH_DEPTH];
+	atomic_t weight[ACCESS_SKETCH_DEPTH][ACCESS_SKETCH_WIDTH];
+};
+
+/* allocated on first use and never freed, the NMI handler reads them */
+static struct access_sketch *access_sketches[MAX_NUMNODES];
+
+static DEFINE_PER_CPU(struct perf_event *, access_sample_events);
+static DEFINE_MUTEX(access_sample_mutex);
+static int access_sample_cpuhp_state;
+
+static void access_sample_decay_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(access_sample_decay_work, access_sample_decay_fn);
+
+static atomic_t *access_sketch_slot(struct access_sketch *sketch, int row,
+		unsigned long pfn)
+{
+	return &sketch->weight[row][hash_64(pfn ^ sketch->seed[row],
+					    ACCESS_SKETCH_SHIFT)];
+}
+
+/* Runs in NMI context */
+static void access_sample_overflow(struct perf_event *event,
+		struct perf_sample_data *data, struct pt_regs *regs)
+{
+	unsigned long pfn = PHYS_PFN(data->phys_addr);
+	struct access_sketch *sketch;
+	struct page *page;
+	int row, weight;
+
+	if (!data->phys_addr || !pfn_valid(pfn))
+		return;
+
+	/* the subpages of a THP are moved together */
+	page = compound_head(pfn_to_page(pfn));
+	sketch = READ_ONCE(access_sketches[page_to_nid(page)]);
+	if (!sketch)
+		return;
+
+	weight = data->weight ?
+		min_t(u64, data->weight, ACCESS_SAMPLE_MAX_WEIGHT) : 1;
+	pfn = page_to_pfn(page);
+	for (row = 0; row < ACCESS_SKETCH_DEPTH; row++)
+		atomic_add(weight, access_sketch_slot(sketch, row, pfn));
+}
+
+/*
+ * Sampled weight of @page, -1 if sampling is off. Collisions only ever
+ * add to the weight of a page.
+ */
+static int page_access_weight(struct page *page)
+{
+	struct access_sketch *sketch;
+	unsigned long pfn;
+	int row, weight = INT_MAX;
+
+	if (!access_sample_enabled())
+		return -1;
+
+	page = compound_head(page);
+	sketch = READ_ONCE(access_sketches[page_to_nid(page)]);
+	if (!sketch)
+		return -1;
+
+	pfn = page_to_pfn(page);
+	for (row = 0; row < ACCESS_SKETCH_DEPTH; row++)
+		weight = min(weight,
+			     atomic_read(access_sketch_slot(sketch, row, pfn)));
+
+	return weight;
+}
+
+bool page_access_sampled_hot(struct page *page)
+{
+	return page_access_weight(page) >=
+		READ_ONCE(sysctl_access_sample_hot_weight);
+}
+
+/*
+ * Halve every weight. Samples added between the read and the set of a
+ * slot are lost, which only makes a page look a little colder.
+ */
+static void access_sample_decay_fn(struct work_struct *work)
+{
+	struct access_sketch *sketch;
+	int nid, row, col;
+	atomic_t *slot;
+
+	for_each_node_state(nid, N_MEMORY) {
+		sketch = access_sketches[nid];
+		if (!sketch)
+			continue;
+		for (row = 0; row < ACCESS_SKETCH_DEPTH; row++) {
+			for (col = 0; col < ACCESS_SKETCH_WIDTH; col++) {
+				slot = &sketch->weight[row][col];
+				if (atomic_read(slot))
+					atomic_set(slot, atomic_read(slot) >> 1);
+			}
+			cond_resched();
+		}
+	}
+
+	if (READ_ONCE(access_sample_active))
+		schedule_delayed_work(&access_sample_decay_work,
+			msecs_to_jiffies(max(READ_ONCE(sysctl_access_sample_decay_ms),
+					     1)));
+}
+
+static int access_sample_cpu_online(unsigned int cpu)
+{
+	struct perf_event_attr attr = {
+		.type		= PERF_TYPE_RAW,
+		.size		= sizeof(attr),
+		.config		= sysctl_access_sample_event,
+		.config1	= sysctl_access_sample_ldlat,
+		.sample_period	= max(sysctl_access_sample_period, 1UL),
+		.sample_type	= PERF_SAMPLE_PHYS_ADDR | PERF_SAMPLE_WEIGHT,
+		/* precise sampling reports the address of the load itself */
+		.precise_ip	= 2,
+		.pinned		= 1,
+		.exclude_kernel	= 1,
+		.exclude_hv	= 1,
+	};
+	struct perf_event *event;
+
+	event = perf_event_create_kernel_counter(&attr, cpu, NULL,
+			access_sample_overflow, NULL);
+	if (IS_ERR(event))
+		return PTR_ERR(event);
+
+	per_cpu(access_sample_events, cpu) = event;
+	return 0;
+}
+
+static int access_sample_cpu_offline(unsigned int cpu)
+{
+	struct perf_event *event = per_cpu(access_sample_events, cpu);
+
+	per_cpu(access_sample_events, cpu) = NULL;
+	if (event)
+		perf_event_release_kernel(event);
+
+	return 0;
+}
+
+static void access_sample_stop(void)
+{
+	if (!access_sample_cpuhp_state)
+		return;
+
+	WRITE_ONCE(access_sample_active, false);
+	cpuhp_remove_state(access_sample_cpuhp_state);
+	access_sample_cpuhp_state = 0;
+	cancel_delayed_work_sync(&access_sample_decay_work);
+}
+
+static int access_sample_start(void)
+{
+	struct access_sketch *sketch;
+	int nid, row, state;
+
+	for_each_node_state(nid, N_MEMORY) {
+		sketch = access_sketches[nid];
+		if (!sketch) {
+			sketch = kvmalloc_node(sizeof(*sketch), GFP_KERNEL, nid);
+			if (!sketch)
+				return -ENOMEM;
+		}
+		/* nothing samples while stopped */
+		memset(sketch->weight, 0, sizeof(sketch->weight));
+		for (row = 0; row < ACCESS_SKETCH_DEPTH; row++)
+			sketch->seed[row] = get_random_u64();
+		smp_store_release(&access_sketches[nid], sketch);
+	}
+
+	state = cpuhp_setup_state(CPUHP_AP_ONLINE_DYN, "mm/access_sample:online",
+			access_sample_cpu_online, access_sample_cpu_offline);
+	if (state < 0)
+		return state;
+
+	access_sample_cpuhp_state = state;
+	WRITE_ONCE(access_sample_active, true);
+	schedule_delayed_work(&access_sample_decay_work,
+		msecs_to_jiffies(max(READ_ONCE(sysctl_access_sample_decay_ms), 1)));
+
+	return 0;
+}
+
+/* Restart the sampling with the new event, latency threshold or period */
+int access_sample_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int err;
+
+	mutex_lock(&access_sample_mutex);
+	err = proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
+	if (err || !write)
+		goto out;
+
+	access_sample_stop();
+	if (!sysctl_access_sample_event)
+		goto out;
+
+	err = access_sample_start();
+	if (err) {
+		/* e.g. the CPU has no such precise event */
+		sysctl_access_sample_event = 0;
+		pr_warn_ratelimited("access sample: failed to start sampling: %d\n",
+				err);
+	}
+out:
+	mutex_unlock(&access_sample_mutex);
+	return err;
+}
@@ -0,0 +1,389 @@
+/*
+ * Page table accessed bit scanning.
+ *
+ * The active and inactive LRU lists tell hot pages from cold ones only
+ * once memory pressure ages them, which can take many reclaim cycles and
+ * never happens to pages of a node under no pressure. To place pages by
+ * how they are actually used, the address spaces mm_manage() works on are
+ * scanned: every sweep over an address space tests and clears the
+ * accessed bit of every mapped page and shifts the result into an eight
+ * sample history kept in the page's page_ext. The number of set samples
+ * is the access frequency of the page, from 0 to 8.
+ *
+ * A scan covers vm.access_scan_pages pages of an address space, picking
+ * up where the last one stopped, and an address space is scanned at most
+ * once every vm.access_scan_interval_ms. A page is hot when it was seen
+ * accessed in at least vm.access_scan_hot_threshold of its samples.
+ *
+ * The cleared accessed bits are handed over to reclaim with the page_idle
+ * young flag, as idle page tracking does.
+ *
+ * A PMD mapped THP has one accessed bit, which says nothing about which of
+ * its subpages are used. With vm.access_scan_thp_subpages set, the scan
+ * splits the PMD mapping of a THP it finds hot on a slow tier node, and the
+ * following sweeps also keep a sample history of each subpage of the PTE
+ * mapped THP, for mm_manage() to promote only the hot subpages. khugepaged
+ * maps the THP with a PMD again once it is no longer such a candidate.
+ *
+ * Clearing the accessed bit of a page also clears it in the secondary
+ * MMUs through the mmu notifiers, so for the address space of a KVM guest
+ * the samples come from the EPT/NPT accessed bits of the guest's accesses,
+ * which the host page tables never see. Guest memory looks all active on
+ * the LRU lists, so it can be sampled on its own, with
+ * vm.access_scan_guest_pages pages per scan at most once every
+ * vm.access_scan_guest_interval_ms, whether or not other address spaces
+ * are scanned.
+ *
+ * With vm.access_scan_regions set, a scan samples a page per region of the
+ * address space instead of sweeping it, see mm/access_region.c.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/mmu_notifier.h>
+#include <linux/huge_mm.h>
+#include <linux/pagewalk.h>
+#include <linux/page_ext.h>
+#include <linux/page_idle.h>
+#include <linux/sched/mm.h>
+#include <linux/memory_tier.h>
+#include <linux/access_scan.h>
+
+#include "internal.h"
+
+// Pages of an address space sampled per scan, 0 disables the scanner
+int sysctl_access_scan_pages = 0;
+// Shortest time between two scans of an address space
+int sysctl_access_scan_interval_ms = 1000;
+// Accessed samples out of the last eight that make a page hot
+int sysctl_access_scan_hot_threshold = 4;
+// Pages of a KVM guest address space sampled per scan, 0 for vm.access_scan_pages
+int sysctl_access_scan_guest_pages = 0;
+// Shortest time between two scans of a KVM guest address space
+int sysctl_access_scan_guest_interval_ms = 1000;
+// Map hot THPs of the slow tier with PTEs to sample their subpages
+int sysctl_access_scan_thp_subpages = 0;
+
+/* samples a subpage needs before its own access frequency counts */
+#define ACCESS_SCAN_SUBPAGE_MIN_SAMPLES	2
+
+struct page_access {
+	u8 history;	/* one bit per sweep, the newest in bit 0 */
+	u8 pass;	/* sweep of the newest sample, 0 for none yet */
+	/* samples of a subpage of a PTE mapped THP on its own */
+	u8 sub_history;
+	u8 sub_pass;
+	u8 sub_samples;
+};
+
+static bool need_page_access(void)
+{
+	return true;
+}
+
+struct page_ext_operations page_access_ops = {
+	.size = sizeof(struct page_access),
+	.need = need_page_access,
+};
+
+static struct page_access *get_page_access(struct page *page)
+{
+	struct page_ext *page_ext = lookup_page_ext(page);
+
+	if (unlikely(!page_ext))
+		return NULL;
+
+	return (void *)page_ext + page_access_ops.offset;
+}
+
+/*
+ * Access frequency of @page over its last eight samples, -1 if it has
+ * not been sampled yet.
+ */
+int page_access_frequency(struct page *page)
+{
+	struct page_access *access = get_page_access(compound_head(page));
+
+	if (!access || !READ_ONCE(access->pass))
+		return -1;
+
+	return hweight8(READ_ONCE(access->history));
+}
+
+/*
+ * Access frequency of @page, a subpage of a THP, over its own samples
+ * since its THP was last mapped with PTEs for them, scaled to 0 to 8 like
+ * page_access_frequency(). -1 if it does not have enough samples yet.
+ */
+int page_subpage_access_frequency(struct page *page)
+{
+	struct page_access *access = get_page_access(page);
+	int samples;
+	u8 history;
+
+	if (!access)
+		return -1;
+
+	samples = READ_ONCE(access->sub_samples);
+	if (samples < ACCESS_SCAN_SUBPAGE_MIN_SAMPLES)
+		return -1;
+
+	history = READ_ONCE(access->sub_history) & (u8)((1 << samples) - 1);
+
+	return hweight8(history) * 8 / samples;
+}
+
+/* @page was a subpage of a THP just split, it goes by its own samples now */
+void page_access_split(struct page *page)
+{
+	struct page_access *access = get_page_access(page);
+
+	if (!access || !READ_ONCE(access->sub_samples))
+		return;
+
+	WRITE_ONCE(access->history, READ_ONCE(access->sub_history));
+	WRITE_ONCE(access->pass, READ_ONCE(access->sub_pass));
+}
+
+/*
+ * Whether the subpages of THP @page are sampled on their own: a THP sampled
+ * hot on a slow tier node, with vm.access_scan_thp_subpages set.
+ */
+bool access_scan_thp_sampling(struct page *page)
+{
+	if (!READ_ONCE(sysctl_access_scan_thp_subpages) ||
+	    !node_is_slow_tier(page_to_nid(page)))
+		return false;
+
+	return page_access_frequency(page) >= access_scan_hot_threshold();
+}
+
+static void page_access_record_subpage(struct page *page, bool young,
+		u8 pass)
+{
+	struct page_access *access = get_page_access(page);
+	u8 history, samples;
+
+	if (!access)
+		return;
+
+	history = READ_ONCE(access->sub_history);
+	if (READ_ONCE(access->sub_pass) != pass) {
+		history <<= 1;
+		WRITE_ONCE(access->sub_pass, pass);
+		samples = READ_ONCE(access->sub_samples);
+		if (samples < BITS_PER_BYTE)
+			WRITE_ONCE(access->sub_samples, samples + 1);
+	}
+	if (young)
+		history |= 1;
+	WRITE_ONCE(access->sub_history, history);
+}
+
+/* Start the subpage samples of THP @page over */
+static void page_access_reset_subpages(struct page *page)
+{
+	struct page_access *access;
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		access = get_page_access(page + i);
+		if (!access)
+			continue;
+		WRITE_ONCE(access->sub_samples, 0);
+		WRITE_ONCE(access->sub_pass, 0);
+		WRITE_ONCE(access->sub_history, 0);
+	}
+}
+
+/*
+ * Record a sample of sweep @pass. The subpages of a PTE mapped THP share
+ * the sample of their head page, the first one seen in a sweep shifts the
+ * history and the others only add their accessed bit. Each also records
+ * the sample in a history of its own.
+ */
+static void page_access_record(struct page *page, bool young, u8 pass)
+{
+	struct page_access *access = get_page_access(compound_head(page));
+	u8 history;
+
+	if (!access)
+		return;
+
+	history = READ_ONCE(access->history);
+	if (READ_ONCE(access->pass) != pass) {
+		history <<= 1;
+		WRITE_ONCE(access->pass, pass);
+	}
+	if (young) {
+		history |= 1;
+		set_page_young(page);
+	}
+	WRITE_ONCE(access->history, history);
+
+	if (PageCompound(page))
+		page_access_record_subpage(page, young, pass);
+}
+
+/*
+ * Give @page the history of @freq samples set in sweep @pass, the access
+ * frequency of the region it was sampled for.
+ */
+void page_access_stamp(struct page *page, int freq, u8 pass)
+{
+	struct page_access *access = get_page_access(compound_head(page));
+
+	if (!access)
+		return;
+
+	WRITE_ONCE(access->history, (u8)((1U << freq) - 1));
+	WRITE_ONCE(access->pass, pass);
+}
+
+struct access_scan_control {
+	unsigned long nr_to_scan;
+	unsigned long nr_scanned;
+	unsigned long next;
+	u8 pass;
+};
+
+static int access_scan_pmd_entry(pmd_t *pmd, unsigned long addr,
+		unsigned long end, struct mm_walk *walk)
+{
+	struct access_scan_control *asc = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	struct page *page = NULL;
+	spinlock_t *ptl;
+	pte_t *pte, *orig_pte;
+	bool young;
+
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd) && !is_huge_zero_pmd(*pmd)) {
+			page = pmd_page(*pmd);
+			young = pmdp_clear_young_notify(vma, addr, pmd);
+			page_access_record(page, young, asc->pass);
+			if (PageAnon(page) && access_scan_thp_sampling(page))
+				get_page(page);
+			else
+				page = NULL;
+		}
+		spin_unlock(ptl);
+
+		/* the next sweeps sample its subpages */
+		if (page) {
+			page_access_reset_subpages(page);
+			split_huge_pmd(vma, pmd, addr);
+			put_page(page);
+		}
+		asc->nr_scanned += HPAGE_PMD_NR;
+		goto out;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		goto out;
+
+	orig_pte = pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr < end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || !PageLRU(compound_head(page)))
+			continue;
+		young = ptep_clear_young_notify(vma, addr, pte);
+		page_access_record(page, young, asc->pass);
+		asc->nr_scanned++;
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+
+out:
+	asc->next = end;
+	cond_resched();
+
+	/* a positive value stops the walk */
+	return asc->nr_scanned >= asc->nr_to_scan;
+}
+
+static int access_scan_test_walk(unsigned long start, unsigned long end,
+		struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+
+	/* pages that cannot be migrated are not worth sampling */
+	if (vma->vm_flags & (VM_PFNMAP | VM_MIXEDMAP | VM_IO | VM_HUGETLB |
+			     VM_LOCKED))
+		return 1;
+
+	return 0;
+}
+
+static const struct mm_walk_ops access_scan_ops = {
+	.pmd_entry = access_scan_pmd_entry,
+	.test_walk = access_scan_test_walk,
+};
+
+/*
+ * Sample up to vm.access_scan_pages pages of @mm, carrying on from the
+ * last scan of @mm, unless it was scanned less than
+ * vm.access_scan_interval_ms ago. The address space of a KVM guest goes
+ * by the vm.access_scan_guest_* settings. With vm.access_scan_regions set,
+ * sample its regions instead.
+ */
+void access_scan_mm(struct mm_struct *mm)
+{
+	struct access_scan_control asc = {
+		.nr_to_scan = READ_ONCE(sysctl_access_scan_pages),
+	};
+	unsigned long interval = msecs_to_jiffies(
+			READ_ONCE(sysctl_access_scan_interval_ms));
+	int regions = READ_ONCE(sysctl_access_scan_regions);
+
+	if (test_bit(MMF_KVM_GUEST, &mm->flags)) {
+		if (READ_ONCE(sysctl_access_scan_guest_pages))
+			asc.nr_to_scan = READ_ONCE(sysctl_access_scan_guest_pages);
+		interval = msecs_to_jiffies(
+				READ_ONCE(sysctl_access_scan_guest_interval_ms));
+	}
+
+	if (!asc.nr_to_scan && regions <= 0)
+		return;
+	if (mm->access_scan_last &&
+	    time_before(jiffies, mm->access_scan_last + interval))
+		return;
+	/* concurrent mm_manage() calls on other nodes of @mm scan it once */
+	if (test_and_set_bit_lock(MMF_ACCESS_SCAN, &mm->flags))
+		return;
+	if (!down_read_trylock(&mm->mmap_sem)) {
+		clear_bit_unlock(MMF_ACCESS_SCAN, &mm->flags);
+		return;
+	}
+
+	asc.next = mm->access_scan_next;
+	/* sweep 0 marks pages that were never sampled */
+	if (!mm->access_scan_pass)
+		mm->access_scan_pass = 1;
+	asc.pass = mm->access_scan_pass;
+
+	if (regions > 0) {
+		access_regions_scan(mm, asc.pass, regions);
+		if (!++mm->access_scan_pass)
+			mm->access_scan_pass = 1;
+		goto out;
+	}
+
+	if (asc.next < TASK_SIZE)
+		walk_page_range(mm, asc.next, TASK_SIZE, &access_scan_ops,
+				&asc);
+	if (asc.nr_scanned < asc.nr_to_scan || asc.next >= TASK_SIZE) {
+		/* end of the address space, the next scan starts a sweep */
+		asc.next = 0;
+		if (!++mm->access_scan_pass)
+			mm->access_scan_pass = 1;
+	}
+
+	mm->access_scan_next = asc.next;
+out:
+	mm->access_scan_last = jiffies;
+	up_read(&mm->mmap_sem);
+	clear_bit_unlock(MMF_ACCESS_SCAN, &mm->flags);
+}
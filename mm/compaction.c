@@ -23,6 +23,7 @@
 #include <linux/freezer.h>
 #include <linux/page_owner.h>
 #include <linux/psi.h>
+#include <linux/migrate_rate.h>
 #include "internal.h"
 
 #ifdef CONFIG_COMPACTION
@@ -38,6 +39,8 @@ static inline void count_compact_events(enum vm_event_item item, long delta)
 
 int use_concur_to_compact;
 int num_block_to_scan;
+// Evacuate one pageblock of a zone too full for the free scanner
+int sysctl_compact_evacuate;
 
 #else
 #define count_compact_event(item) do { } while (0)
@@ -749,6 +752,12 @@ isolate_freepages_range(struct compact_control *cc,
 	return pfn;
 }
 
+/* Pages the migration scanner isolates at most per cycle */
+static unsigned int compact_cluster_max(struct compact_control *cc)
+{
+	return cc->max_migratepages ?: COMPACT_CLUSTER_MAX;
+}
+
 /* Similar to reclaim, but different enough that they don't share logic */
 static bool too_many_isolated(pg_data_t *pgdat)
 {
@@ -1003,7 +1012,7 @@ isolate_migratepages_block(struct compact_control *cc, unsigned long low_pfn,
 		 * or a lock is contended. For contention, isolate quickly to
 		 * potentially remove one source of contention.
 		 */
-		if (cc->nr_migratepages == COMPACT_CLUSTER_MAX &&
+		if (cc->nr_migratepages >= compact_cluster_max(cc) &&
 		    !cc->rescan && !cc->contended) {
 			++low_pfn;
 			break;
@@ -1737,6 +1746,87 @@ static unsigned long fast_find_migrateblock(struct compact_control *cc)
 	return pfn;
 }
 
+/*
+ * Concurrent compaction with vm.num_block_to_scan at 0 sizes its cycles
+ * itself, per zone. A cycle isolates up to compact_batch_pages pages from
+ * as many pageblocks as the recent isolation yield per block says it
+ * takes. Like the adaptive batches of mm_manage(), the batch doubles as
+ * long as bigger ones migrate more pages per second and shrinks a little
+ * once they stop paying off. Bigger batches keep more pages isolated, so
+ * a cycle isolates at most 1/1024 of the pages of its zone and scans at
+ * most COMPACT_MAX_BLOCKS_TO_SCAN pageblocks.
+ */
+#define COMPACT_MAX_BLOCKS_TO_SCAN	64
+
+static bool compact_adaptive(void)
+{
+	return READ_ONCE(use_concur_to_compact) && !READ_ONCE(num_block_to_scan);
+}
+
+static unsigned int compact_batch_cap(struct zone *zone)
+{
+	return clamp_t(unsigned long, zone_managed_pages(zone) >> 10,
+		       COMPACT_CLUSTER_MAX,
+		       COMPACT_MAX_BLOCKS_TO_SCAN * COMPACT_CLUSTER_MAX);
+}
+
+/* Set up the isolation limit of the next cycle, returns its pageblocks */
+static unsigned int compact_blocks_to_scan(struct compact_control *cc)
+{
+	struct zone *zone = cc->zone;
+	unsigned int batch, yield, nr;
+
+	if (!compact_adaptive()) {
+		nr = READ_ONCE(num_block_to_scan) + 1;
+		/* a single block keeps to COMPACT_CLUSTER_MAX, as it always did */
+		cc->max_migratepages = nr > 1 ? nr * pageblock_nr_pages : 0;
+		return nr;
+	}
+
+	batch = clamp_t(unsigned int, READ_ONCE(zone->compact_batch_pages),
+			COMPACT_CLUSTER_MAX, compact_batch_cap(zone));
+	yield = READ_ONCE(zone->compact_block_yield) ?: COMPACT_CLUSTER_MAX;
+	cc->max_migratepages = batch;
+
+	return clamp_t(unsigned int, DIV_ROUND_UP(batch, yield), 1,
+		       COMPACT_MAX_BLOCKS_TO_SCAN);
+}
+
+/*
+ * Tune the next cycles of the zone from a cycle that isolated @nr pages
+ * and migrated them in @ns.
+ */
+static void compact_batch_feedback(struct compact_control *cc,
+		unsigned int nr, u64 ns)
+{
+	struct zone *zone = cc->zone;
+	unsigned int batch = cc->max_migratepages, yield;
+	u64 rate, last;
+
+	if (!compact_adaptive() || !batch || !cc->nr_blocks_scanned || !ns)
+		return;
+
+	yield = READ_ONCE(zone->compact_block_yield) ?: COMPACT_CLUSTER_MAX;
+	yield = max((yield * 3 + nr / cc->nr_blocks_scanned) / 4, 1U);
+	WRITE_ONCE(zone->compact_block_yield, yield);
+
+	/* only full batches tell how the size performs */
+	if (nr < batch)
+		return;
+
+	rate = div64_u64((u64)nr * NSEC_PER_SEC, ns);
+	last = READ_ONCE(zone->compact_migrate_rate);
+
+	if (rate * 16 >= last * 15)
+		batch *= 2;
+	else
+		batch -= batch / 4;
+
+	WRITE_ONCE(zone->compact_migrate_rate, rate);
+	WRITE_ONCE(zone->compact_batch_pages, clamp_t(unsigned int, batch,
+			COMPACT_CLUSTER_MAX, compact_batch_cap(zone)));
+}
+
 /*
  * Isolate all pages that can be migrated from the first suitable block,
  * starting at the block pointed to by the migrate scanner pfn within
@@ -1752,7 +1842,7 @@ static isolate_migrate_t isolate_migratepages(struct compact_control *cc)
 		(sysctl_compact_unevictable_allowed ? ISOLATE_UNEVICTABLE : 0) |
 		(((cc->mode & MIGRATE_MODE_MASK) != MIGRATE_SYNC) ? ISOLATE_ASYNC_MIGRATE : 0);
 	bool fast_find_block;
-	int num_scanned_block;
+	unsigned int num_scanned_block, nr_blocks = compact_blocks_to_scan(cc);
 
 	/*
 	 * Start at where we last stopped, or beginning of the zone as
@@ -1832,14 +1922,17 @@ static isolate_migrate_t isolate_migratepages(struct compact_control *cc)
 		/*
 		 * Either we isolated something and proceed with migration. Or
 		 * we failed and compact_zone should decide if we should
-		 * continue or not.
+		 * continue or not. A full batch ended the scan of the block
+		 * early, its rest is for the next cycle.
 		 */
-		if (num_scanned_block > num_block_to_scan)
+		if (num_scanned_block >= nr_blocks ||
+		    cc->nr_migratepages >= compact_cluster_max(cc))
 			break;
 	}
 
 	/* Record where migration scanner will be restarted. */
 	cc->migrate_pfn = low_pfn;
+	cc->nr_blocks_scanned = num_scanned_block;
 
 	return cc->nr_migratepages ? ISOLATE_SUCCESS : ISOLATE_NONE;
 }
@@ -1853,6 +1946,88 @@ static inline bool is_via_compact_memory(int order)
 	return order == -1;
 }
 
+/*
+ * Proactive compaction.
+ *
+ * THP promotions and demotions split when the destination node has no
+ * free pageblock, and kcompactd wakes up only once an allocation failed.
+ * With vm.compact_proactive_ms set, kcompactd also wakes up every that
+ * many milliseconds and compacts its node until it has
+ * vm.compact_proactive_blocks free pageblocks, or as many as mm_manage()
+ * recently migrated THPs to the node per period if that is more. It runs
+ * at the lowest priority, through migrate_pages_concur() with MT copies,
+ * and moves no more than vm.migrate_rate_limit bytes per second on the
+ * node.
+ */
+// Period of proactive compaction in ms, 0 for off
+int sysctl_compact_proactive_ms = 0;
+// Free pageblocks proactive compaction keeps per node, at least
+int sysctl_compact_proactive_blocks = 16;
+
+struct compact_proactive {
+	unsigned long next;		/* jiffies of the next round */
+	atomic_long_t demand;		/* base pages of THPs migrated in */
+	unsigned long expect;		/* pageblocks per period, smoothed */
+	struct migrate_rate_bucket bucket;
+};
+
+static struct compact_proactive compact_proactive_nodes[MAX_NUMNODES];
+
+/* @nr_pages base pages of THPs are being migrated to @nid */
+void compact_proactive_demand(int nid, unsigned long nr_pages)
+{
+	if (READ_ONCE(sysctl_compact_proactive_ms))
+		atomic_long_add(nr_pages, &compact_proactive_nodes[nid].demand);
+}
+
+static unsigned long pgdat_free_blocks(pg_data_t *pgdat)
+{
+	unsigned long nr = 0;
+	struct zone *zone;
+	int zoneid, order;
+
+	for (zoneid = 0; zoneid < pgdat->nr_zones; zoneid++) {
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+		for (order = pageblock_order; order < MAX_ORDER; order++)
+			nr += READ_ONCE(zone->free_area[order].nr_free) <<
+				(order - pageblock_order);
+	}
+
+	return nr;
+}
+
+static unsigned long compact_proactive_target(pg_data_t *pgdat)
+{
+	return max_t(unsigned long, READ_ONCE(sysctl_compact_proactive_blocks),
+		     compact_proactive_nodes[pgdat->node_id].expect);
+}
+
+static bool compact_proactive_done(struct compact_control *cc)
+{
+	pg_data_t *pgdat = cc->zone->zone_pgdat;
+
+	return pgdat_free_blocks(pgdat) >= compact_proactive_target(pgdat);
+}
+
+/* Charge @nr migrated pages to the budget of the node, sleep off any debt */
+static void compact_proactive_throttle(struct compact_control *cc,
+		unsigned int nr)
+{
+	struct compact_proactive *cp =
+		&compact_proactive_nodes[zone_to_nid(cc->zone)];
+	u64 wait;
+
+	wait = migrate_rate_bucket_charge(&cp->bucket,
+			READ_ONCE(sysctl_migrate_rate_limit),
+			(u64)nr << PAGE_SHIFT);
+	if (wait)
+		schedule_timeout_interruptible(max_t(unsigned long,
+				nsecs_to_jiffies(min_t(u64, wait, NSEC_PER_SEC)),
+				1));
+}
+
 static enum compact_result __compact_finished(struct compact_control *cc)
 {
 	unsigned int order;
@@ -1879,6 +2054,10 @@ static enum compact_result __compact_finished(struct compact_control *cc)
 			return COMPACT_PARTIAL_SKIPPED;
 	}
 
+	if (cc->proactive)
+		return compact_proactive_done(cc) ? COMPACT_SUCCESS :
+			COMPACT_CONTINUE;
+
 	if (is_via_compact_memory(cc->order))
 		return COMPACT_CONTINUE;
 
@@ -1993,13 +2172,14 @@ static enum compact_result __compaction_suitable(struct zone *zone, int order,
 	 * For costly orders, we require low watermark instead of min for
 	 * compaction to proceed to increase its chances.
 	 * ALLOC_CMA is used, as pages in CMA pageblocks are considered
-	 * suitable migration targets
+	 * suitable migration targets, and ALLOC_HEADROOM as the free pages
+	 * isolated are migration targets too.
 	 */
 	watermark = (order > PAGE_ALLOC_COSTLY_ORDER) ?
 				low_wmark_pages(zone) : min_wmark_pages(zone);
 	watermark += compact_gap(order);
 	if (!__zone_watermark_ok(zone, 0, watermark, classzone_idx,
-						ALLOC_CMA, wmark_target))
+				 ALLOC_CMA | ALLOC_HEADROOM, wmark_target))
 		return COMPACT_SKIPPED;
 
 	return COMPACT_CONTINUE;
@@ -2075,6 +2255,189 @@ bool compaction_zonelist_suitable(struct alloc_context *ac, int order,
 	return false;
 }
 
+/*
+ * Evacuation of a single pageblock.
+ *
+ * Compaction needs compact_gap() free pages above the watermark for its
+ * free scanner, so a nearly full zone, such as that of a PMEM node the
+ * tiering daemon keeps filled, is never compacted and runs out of THP.
+ * Building a free block only takes as many free pages as the block has
+ * pages in use though, wherever they are. With vm.compact_evacuate set,
+ * compaction that would be skipped for lack of free pages instead picks
+ * the movable pageblock with the most free pages that can be emptied
+ * into the free pages of the rest of the zone, isolates it so that none
+ * of its own free pages is handed out, and migrates its pages to new
+ * pages of the same node, concurrently with vm.use_concur_to_compact.
+ */
+
+/* pageblocks looked at per evacuation */
+#define COMPACT_EVACUATE_SCAN_BLOCKS	1024
+
+/*
+ * Free pages in the pageblock at @start_pfn, -1 if it has pages that
+ * cannot be migrated. Racy, the block is checked again once isolated.
+ */
+static long evacuate_block_free_pages(unsigned long start_pfn,
+		unsigned long end_pfn)
+{
+	unsigned long pfn = start_pfn;
+	long nr_free = 0;
+	struct page *page;
+	unsigned int order;
+
+	while (pfn < end_pfn) {
+		page = pfn_to_page(pfn);
+		if (PageBuddy(page)) {
+			order = page_order_unsafe(page);
+			if (order >= MAX_ORDER)
+				return -1;
+			nr_free += 1UL << order;
+			pfn += 1UL << order;
+		} else if (PageLRU(page) || __PageMovable(page)) {
+			page = compound_head(page);
+			pfn = max(pfn + 1, page_to_pfn(page) + compound_nr(page));
+		} else {
+			return -1;
+		}
+	}
+
+	return nr_free;
+}
+
+/* The pageblock with the most free pages that can be emptied, 0 if none */
+static unsigned long evacuate_find_block(struct zone *zone, long nr_spare)
+{
+	unsigned long start_pfn = zone->zone_start_pfn;
+	unsigned long end_pfn = zone_end_pfn(zone);
+	unsigned long pfn, best_pfn = 0;
+	long nr_free, best_free = 0;
+	struct page *page;
+	int nr_scanned = 0;
+
+	pfn = zone->compact_evacuate_pfn;
+	if (pfn < start_pfn || pfn >= end_pfn)
+		pfn = pageblock_start_pfn(start_pfn);
+
+	for (; nr_scanned < COMPACT_EVACUATE_SCAN_BLOCKS;
+			nr_scanned++, pfn += pageblock_nr_pages) {
+		if (!(nr_scanned % SWAP_CLUSTER_MAX))
+			cond_resched();
+
+		if (pfn + pageblock_nr_pages > end_pfn)
+			pfn = ALIGN(start_pfn, pageblock_nr_pages);
+		if (pfn + pageblock_nr_pages > end_pfn)
+			break;
+
+		page = pageblock_pfn_to_page(pfn, pfn + pageblock_nr_pages,
+				zone);
+		if (!page || get_pageblock_migratetype(page) != MIGRATE_MOVABLE)
+			continue;
+
+		nr_free = evacuate_block_free_pages(pfn, pfn + pageblock_nr_pages);
+		/*
+		 * An already free block or one the rest of the zone cannot
+		 * take: the free pages of the block are isolated with it, so
+		 * its used pages must fit in nr_spare - nr_free, that is the
+		 * whole block in nr_spare.
+		 */
+		if (nr_free <= best_free || nr_free == pageblock_nr_pages ||
+		    (long)pageblock_nr_pages > nr_spare)
+			continue;
+
+		best_free = nr_free;
+		best_pfn = pfn;
+	}
+	zone->compact_evacuate_pfn = pfn;
+
+	return best_pfn;
+}
+
+/*
+ * Empty a pageblock of @zone. Only kcompactd and proactive compaction,
+ * not @direct compaction, drain the per-cpu lists of every CPU for it.
+ */
+static enum compact_result compact_zone_evacuate(struct zone *zone,
+		enum migrate_mode mode, bool direct)
+{
+	struct compact_control ecc = {
+		.zone = zone,
+		.order = -1,
+		.mode = mode,
+		/* the whole block has to go, whatever earlier scans saw */
+		.ignore_skip_hint = true,
+		.no_set_skip_hint = true,
+	};
+	struct compact_control *cc = &ecc;
+	int nid = zone_to_nid(zone);
+	unsigned long start_pfn, end_pfn, pfn;
+	long nr_spare;
+	int err = 0;
+
+	/* free pages the evacuated pages may use without dipping below min */
+	nr_spare = zone_page_state_snapshot(zone, NR_FREE_PAGES) -
+		min_wmark_pages(zone);
+	if (nr_spare <= 0)
+		return COMPACT_SKIPPED;
+
+	start_pfn = evacuate_find_block(zone, nr_spare);
+	if (!start_pfn)
+		return COMPACT_SKIPPED;
+	end_pfn = start_pfn + pageblock_nr_pages;
+
+	if (start_isolate_page_range(start_pfn, end_pfn, MIGRATE_MOVABLE, 0))
+		return COMPACT_SKIPPED;
+
+	INIT_LIST_HEAD(&cc->freepages);
+	INIT_LIST_HEAD(&cc->migratepages);
+	migrate_prep_local();
+
+	for (pfn = start_pfn; pfn < end_pfn;) {
+		pfn = isolate_migratepages_range(cc, pfn, end_pfn);
+		if (!pfn) {
+			/* a fatal signal, with a part of the block isolated */
+			putback_movable_pages(&cc->migratepages);
+			cc->nr_migratepages = 0;
+			err = -EINTR;
+			break;
+		}
+		if (!cc->nr_migratepages)
+			continue;
+
+		if (use_concur_to_compact)
+			err = migrate_pages_concur(&cc->migratepages,
+					alloc_new_node_page, NULL, nid,
+					cc->mode, MR_COMPACTION);
+		else
+			err = migrate_pages(&cc->migratepages,
+					alloc_new_node_page, NULL, nid,
+					cc->mode, MR_COMPACTION);
+		cc->nr_migratepages = 0;
+		if (err) {
+			putback_movable_pages(&cc->migratepages);
+			break;
+		}
+	}
+
+	if (!err) {
+		/*
+		 * The freed pages reach the buddy lists of the isolated block.
+		 * Most went through the lists of this CPU, the migrating one,
+		 * which is all a direct compaction drains.
+		 */
+		if (direct) {
+			lru_add_drain();
+			drain_local_pages(zone);
+		} else {
+			lru_add_drain_all();
+			drain_all_pages(zone);
+		}
+		err = test_pages_isolated(start_pfn, end_pfn, 0);
+	}
+	undo_isolate_page_range(start_pfn, end_pfn, MIGRATE_MOVABLE);
+
+	return err ? COMPACT_SKIPPED : COMPACT_SUCCESS;
+}
+
 static enum compact_result
 compact_zone(struct compact_control *cc, struct capture_control *capc)
 {
@@ -2099,6 +2462,11 @@ compact_zone(struct compact_control *cc, struct capture_control *capc)
 	cc->migratetype = gfpflags_to_migratetype(cc->gfp_mask);
 	ret = compaction_suitable(cc->zone, cc->order, cc->alloc_flags,
 							cc->classzone_idx);
+	/* Too few free pages for the free scanner, but maybe for a block */
+	if (ret == COMPACT_SKIPPED && sysctl_compact_evacuate &&
+	    cc->order > 0 && cc->order <= pageblock_order)
+		return compact_zone_evacuate(cc->zone, cc->mode,
+				cc->direct_compaction);
 	/* Compaction is likely to fail */
 	if (ret == COMPACT_SUCCESS || ret == COMPACT_SKIPPED)
 		return ret;
@@ -2159,6 +2527,7 @@ compact_zone(struct compact_control *cc, struct capture_control *capc)
 	migrate_prep_local();
 
 	while ((ret = compact_finished(cc)) == COMPACT_CONTINUE) {
+		unsigned int nr_isolated;
 		int err;
 		unsigned long start_pfn = cc->migrate_pfn;
 
@@ -2201,14 +2570,21 @@ compact_zone(struct compact_control *cc, struct capture_control *capc)
 			;
 		}
 
-		if (use_concur_to_compact)
+		nr_isolated = cc->nr_migratepages;
+		if (use_concur_to_compact || cc->proactive) {
+			u64 start = ktime_get_ns();
+
 			err = migrate_pages_concur(&cc->migratepages, compaction_alloc,
 					compaction_free, (unsigned long)cc, cc->mode,
 					MR_COMPACTION);
-		else
+			compact_batch_feedback(cc, nr_isolated,
+					ktime_get_ns() - start);
+		} else
 			err = migrate_pages(&cc->migratepages, compaction_alloc,
 					compaction_free, (unsigned long)cc, cc->mode,
 					MR_COMPACTION);
+		if (cc->proactive)
+			compact_proactive_throttle(cc, nr_isolated);
 
 		trace_mm_compaction_migratepages(cc->nr_migratepages, err,
 							&cc->migratepages);
@@ -2416,6 +2792,46 @@ enum compact_result try_to_compact_pages(gfp_t gfp_mask, unsigned int order,
 	return rc;
 }
 
+/*
+ * compact_node_order - make room for a page of @order on node @nid
+ *
+ * Compacts the zones of @nid, highest first, with at most one light
+ * synchronous pass over each, until one of them can allocate @order.
+ * Page migration calls this before it splits a THP because the target
+ * node has no free huge page. Returns true if such a page should be free.
+ */
+bool compact_node_order(int nid, int order)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	enum compact_result status;
+	struct zone *zone;
+	int zoneid;
+
+	for (zoneid = pgdat->nr_zones - 1; zoneid >= 0; zoneid--) {
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		status = compaction_suitable(zone, order, 0, zoneid);
+		if (status == COMPACT_SUCCESS)
+			return true;
+		if (status != COMPACT_CONTINUE)
+			continue;
+
+		status = compact_zone_order(zone, order,
+				GFP_TRANSHUGE | __GFP_THISNODE,
+				COMPACT_PRIO_SYNC_LIGHT, 0, zoneid, NULL);
+		if (status == COMPACT_SUCCESS) {
+			compaction_defer_reset(zone, order, false);
+			return true;
+		}
+
+		if (fatal_signal_pending(current))
+			break;
+	}
+
+	return false;
+}
 
 /* Compact all zones within a node */
 static void compact_node(int nid)
@@ -2607,6 +3023,83 @@ static void kcompactd_do_work(pg_data_t *pgdat)
 		pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
 }
 
+static bool kcompactd_proactive_due(pg_data_t *pgdat)
+{
+	return READ_ONCE(sysctl_compact_proactive_ms) &&
+		time_after_eq(jiffies,
+			READ_ONCE(compact_proactive_nodes[pgdat->node_id].next));
+}
+
+static void kcompactd_proactive(pg_data_t *pgdat)
+{
+	struct compact_proactive *cp = &compact_proactive_nodes[pgdat->node_id];
+	unsigned long demand;
+	struct zone *zone;
+	int zoneid;
+	struct compact_control cc = {
+		.order = -1,
+		.search_order = -1,
+		.classzone_idx = pgdat->nr_zones - 1,
+		.mode = MIGRATE_SYNC_LIGHT | MIGRATE_MT,
+		.gfp_mask = GFP_KERNEL,
+		.proactive = true,
+	};
+
+	WRITE_ONCE(cp->next, jiffies +
+		msecs_to_jiffies(READ_ONCE(sysctl_compact_proactive_ms)));
+
+	demand = atomic_long_xchg(&cp->demand, 0) >> pageblock_order;
+	cp->expect = DIV_ROUND_UP(cp->expect * 3 + demand, 4);
+
+	if (compact_proactive_target(pgdat) <= pgdat_free_blocks(pgdat))
+		return;
+
+	set_user_nice(current, MAX_NICE);
+	/* the highest zones are where THPs come from */
+	for (zoneid = pgdat->nr_zones - 1; zoneid >= 0; zoneid--) {
+		zone = &pgdat->node_zones[zoneid];
+		if (!populated_zone(zone))
+			continue;
+
+		if (kthread_should_stop())
+			break;
+
+		cc.zone = zone;
+		compact_zone(&cc, NULL);
+
+		count_compact_events(KCOMPACTD_MIGRATE_SCANNED,
+				     cc.total_migrate_scanned);
+		count_compact_events(KCOMPACTD_FREE_SCANNED,
+				     cc.total_free_scanned);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+
+		if (compact_proactive_target(pgdat) <= pgdat_free_blocks(pgdat))
+			break;
+	}
+	set_user_nice(current, 0);
+}
+
+/* Start the first rounds right away */
+int compact_proactive_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *length, loff_t *ppos)
+{
+	pg_data_t *pgdat;
+	int err;
+
+	err = proc_dointvec_minmax(table, write, buffer, length, ppos);
+	if (err || !write || !sysctl_compact_proactive_ms)
+		return err;
+
+	for_each_online_pgdat(pgdat) {
+		WRITE_ONCE(compact_proactive_nodes[pgdat->node_id].next, jiffies);
+		wake_up_interruptible(&pgdat->kcompactd_wait);
+	}
+
+	return 0;
+}
+
 void wakeup_kcompactd(pg_data_t *pgdat, int order, int classzone_idx)
 {
 	if (!order)
@@ -2655,13 +3148,25 @@ static int kcompactd(void *p)
 	while (!kthread_should_stop()) {
 		unsigned long pflags;
 
+		long timeout = MAX_SCHEDULE_TIMEOUT;
+
+		if (READ_ONCE(sysctl_compact_proactive_ms))
+			timeout = max_t(long, READ_ONCE(compact_proactive_nodes[
+					pgdat->node_id].next) - jiffies, 1);
+
 		trace_mm_compaction_kcompactd_sleep(pgdat->node_id);
-		wait_event_freezable(pgdat->kcompactd_wait,
-				kcompactd_work_requested(pgdat));
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+				kcompactd_work_requested(pgdat) ||
+				kcompactd_proactive_due(pgdat), timeout);
+
+		if (pgdat->kcompactd_max_order > 0) {
+			psi_memstall_enter(&pflags);
+			kcompactd_do_work(pgdat);
+			psi_memstall_leave(&pflags);
+		}
 
-		psi_memstall_enter(&pflags);
-		kcompactd_do_work(pgdat);
-		psi_memstall_leave(&pflags);
+		if (kcompactd_proactive_due(pgdat))
+			kcompactd_proactive(pgdat);
 	}
 
 	return 0;
@@ -2738,6 +3243,9 @@ static int __init kcompactd_init(void)
 		return ret;
 	}
 
+	for (nid = 0; nid < MAX_NUMNODES; nid++)
+		migrate_rate_bucket_init(&compact_proactive_nodes[nid].bucket);
+
 	for_each_node_state(nid, N_MEMORY)
 		kcompactd_run(nid);
 	return 0;
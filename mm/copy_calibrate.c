@@ -0,0 +1,333 @@
+/*
+ * Page copy engine calibration.
+ *
+ * Page migration can copy pages on the calling CPU, with the
+ * multi-threaded copy workers (with or without non-temporal accesses,
+ * with the workers next to the initiator or next to the PMEM side of
+ * the copy) or with DMA engines. Which one is fastest depends on the
+ * source and destination nodes and on the page size, so after boot and
+ * whenever a memory node comes online every configuration is timed for
+ * every pair of memory nodes and the fastest one is recorded.
+ *
+ * With vm.copy_engine_auto set, copy_huge_page() and copy_page_lists_mt()
+ * follow the recorded decisions instead of the copy sysctls, unless the
+ * syscall flags or the memcg set a copy policy for the task. The table
+ * is exported in /sys/kernel/mm/copy_engine/decisions.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/huge_mm.h>
+#include <linux/memory.h>
+#include <linux/nodemask.h>
+#include <linux/seqlock.h>
+#include <linux/workqueue.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/ktime.h>
+#include <linux/slab.h>
+#include <linux/migrate.h>
+
+#include "internal.h"
+
+// Follow the calibrated copy decisions instead of the copy sysctls
+int sysctl_copy_engine_auto = 0;
+
+enum copy_size {
+	COPY_SIZE_BASE,
+	COPY_SIZE_THP,
+	NR_COPY_SIZES,
+};
+
+static const char * const copy_size_names[NR_COPY_SIZES] = {
+	[COPY_SIZE_BASE] = "base",
+	[COPY_SIZE_THP] = "thp",
+};
+
+static const char * const copy_engine_names[NR_COPY_ENGINE_KINDS] = {
+	[COPY_ENGINE_ST] = "st",
+	[COPY_ENGINE_MT] = "mt",
+	[COPY_ENGINE_DMA] = "dma",
+};
+
+/* base pages copied per timed run, close to a migrate_pages() batch */
+#define CALIBRATE_BASE_PAGES	64
+/* timed runs per configuration, the fastest one counts */
+#define CALIBRATE_RUNS		3
+
+/* nr_node_ids * nr_node_ids * NR_COPY_SIZES decisions */
+static struct copy_decision *copy_decisions;
+static DEFINE_SEQLOCK(copy_decisions_seq);
+
+static struct copy_decision *copy_decision_slot(int from_nid, int to_nid,
+		int size)
+{
+	return &copy_decisions[(from_nid * nr_node_ids + to_nid) *
+		NR_COPY_SIZES + size];
+}
+
+/*
+ * Fill @decision with the calibrated configuration of a copy from
+ * @from_nid to @to_nid. Returns false if copy_engine_auto is off, the
+ * current task has a copy policy of its own or the pair has not been
+ * calibrated, the caller then uses the copy policy and sysctls.
+ */
+bool copy_decision_lookup(int from_nid, int to_nid, bool huge,
+		struct copy_decision *decision)
+{
+	const struct page_copy_policy *policy = &current->page_copy_policy;
+	struct copy_decision *slot;
+	unsigned int seq;
+
+	if (!READ_ONCE(sysctl_copy_engine_auto) || !copy_decisions)
+		return false;
+	if (policy->nt >= 0 || policy->rpdaa >= 0 || policy->nr_threads >= 0)
+		return false;
+
+	slot = copy_decision_slot(from_nid, to_nid,
+			huge ? COPY_SIZE_THP : COPY_SIZE_BASE);
+	do {
+		seq = read_seqbegin(&copy_decisions_seq);
+		*decision = *slot;
+	} while (read_seqretry(&copy_decisions_seq, seq));
+
+	return decision->valid;
+}
+
+static int copy_calibrate_st(struct page **to, struct page **from,
+		int nr_items)
+{
+	int i, j;
+
+	for (i = 0; i < nr_items; i++)
+		for (j = 0; j < hpage_nr_pages(from[i]); j++)
+			copy_highpage(to[i] + j, from[i] + j);
+
+	return 0;
+}
+
+/* Best throughput in MB/s of one configuration, 0 if it does not work */
+static u32 copy_calibrate_run(struct page **to, struct page **from,
+		int nr_items, unsigned long bytes,
+		const struct copy_decision *cfg)
+{
+	u64 best_ns = U64_MAX;
+	int run;
+
+	for (run = 0; run < CALIBRATE_RUNS; run++) {
+		u64 start = ktime_get_ns(), ns;
+		int err;
+
+		switch (cfg->engine) {
+		case COPY_ENGINE_ST:
+			err = copy_calibrate_st(to, from, nr_items);
+			break;
+		case COPY_ENGINE_MT:
+			err = copy_page_lists_mt_config(to, from, nr_items, cfg);
+			break;
+		default:
+			err = copy_page_lists_dma_always(to, from, nr_items);
+		}
+		if (err)
+			return 0;
+
+		ns = ktime_get_ns() - start;
+		best_ns = min(best_ns, max_t(u64, ns, 1));
+		cond_resched();
+	}
+
+	return min_t(u64, div64_u64((u64)bytes * NSEC_PER_USEC, best_ns), U32_MAX);
+}
+
+/* Time every configuration of a copy from @from to @to, keep the fastest */
+static void copy_calibrate_pages(struct page **to, struct page **from,
+		int nr_items, int from_nid, int to_nid, struct copy_decision *best)
+{
+	unsigned long bytes = (unsigned long)nr_items * hpage_nr_pages(from[0]) *
+		PAGE_SIZE;
+	bool pmem = pmem_nearest_node(from_nid) != NUMA_NO_NODE ||
+		pmem_nearest_node(to_nid) != NUMA_NO_NODE;
+	struct copy_decision cfg = {};
+	int nt, rpdaa;
+
+	memset(best, 0, sizeof(*best));
+
+	cfg.engine = COPY_ENGINE_ST;
+	cfg.mbps = copy_calibrate_run(to, from, nr_items, bytes, &cfg);
+	if (cfg.mbps > best->mbps)
+		*best = cfg;
+
+	cfg.engine = COPY_ENGINE_MT;
+	for (nt = 0; nt < 2; nt++)
+		for (rpdaa = 0; rpdaa < 1 + pmem; rpdaa++) {
+			cfg.nt = nt;
+			cfg.rpdaa = rpdaa;
+			cfg.mbps = copy_calibrate_run(to, from, nr_items, bytes,
+					&cfg);
+			if (cfg.mbps > best->mbps)
+				*best = cfg;
+		}
+
+	cfg.engine = COPY_ENGINE_DMA;
+	cfg.nt = cfg.rpdaa = 0;
+	cfg.mbps = copy_calibrate_run(to, from, nr_items, bytes, &cfg);
+	if (cfg.mbps > best->mbps)
+		*best = cfg;
+
+	best->valid = best->mbps != 0;
+}
+
+static void copy_calibrate_free(struct page **pages, int nr, int order)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (pages[i])
+			__free_pages(pages[i], order);
+}
+
+static int copy_calibrate_alloc(struct page **pages, int nr, int nid,
+		int order)
+{
+	/* movable, PMEM is usually onlined movable */
+	gfp_t gfp = GFP_HIGHUSER_MOVABLE | __GFP_THISNODE | __GFP_NOWARN |
+		__GFP_NORETRY | (order ? __GFP_COMP : 0);
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		pages[i] = alloc_pages_node(nid, gfp, order);
+		if (!pages[i]) {
+			copy_calibrate_free(pages, i, order);
+			return -ENOMEM;
+		}
+		if (order)
+			prep_transhuge_page(pages[i]);
+	}
+
+	return 0;
+}
+
+static void copy_calibrate_pair(int from_nid, int to_nid, int size)
+{
+	struct page *from[CALIBRATE_BASE_PAGES] = {NULL};
+	struct page *to[CALIBRATE_BASE_PAGES] = {NULL};
+	struct copy_decision best = {};
+	int order = 0, nr = CALIBRATE_BASE_PAGES;
+	unsigned long flags;
+
+	if (size == COPY_SIZE_THP) {
+		if (!IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE))
+			return;
+		order = HPAGE_PMD_ORDER;
+		nr = 1;
+	}
+
+	if (copy_calibrate_alloc(from, nr, from_nid, order))
+		return;
+	if (copy_calibrate_alloc(to, nr, to_nid, order))
+		goto out_from;
+
+	copy_calibrate_pages(to, from, nr, from_nid, to_nid, &best);
+
+	write_seqlock_irqsave(&copy_decisions_seq, flags);
+	*copy_decision_slot(from_nid, to_nid, size) = best;
+	write_sequnlock_irqrestore(&copy_decisions_seq, flags);
+
+	copy_calibrate_free(to, nr, order);
+out_from:
+	copy_calibrate_free(from, nr, order);
+}
+
+static void copy_calibrate_fn(struct work_struct *work)
+{
+	int from_nid, to_nid, size;
+
+	for_each_node_state(from_nid, N_MEMORY)
+		for_each_node_state(to_nid, N_MEMORY)
+			for (size = 0; size < NR_COPY_SIZES; size++)
+				copy_calibrate_pair(from_nid, to_nid, size);
+
+	pr_info("page copy engine: calibrated %d memory nodes\n",
+			num_node_state(N_MEMORY));
+}
+static DECLARE_WORK(copy_calibrate_work, copy_calibrate_fn);
+
+static int copy_calibrate_memory_callback(struct notifier_block *self,
+		unsigned long action, void *arg)
+{
+	struct memory_notify *mn = arg;
+
+	if (action == MEM_ONLINE && mn->status_change_nid >= 0)
+		queue_work(system_unbound_wq, &copy_calibrate_work);
+
+	return NOTIFY_OK;
+}
+
+static ssize_t decisions_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	struct copy_decision decision;
+	int from_nid, to_nid, size;
+	unsigned int seq;
+	ssize_t len = 0;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			"src dst size engine nt rpdaa mbps\n");
+
+	for_each_node_state(from_nid, N_MEMORY)
+		for_each_node_state(to_nid, N_MEMORY)
+			for (size = 0; size < NR_COPY_SIZES; size++) {
+				struct copy_decision *slot =
+					copy_decision_slot(from_nid, to_nid, size);
+
+				do {
+					seq = read_seqbegin(&copy_decisions_seq);
+					decision = *slot;
+				} while (read_seqretry(&copy_decisions_seq, seq));
+
+				if (!decision.valid)
+					continue;
+
+				len += scnprintf(buf + len, PAGE_SIZE - len,
+						"%d %d %s %s %u %u %u\n",
+						from_nid, to_nid,
+						copy_size_names[size],
+						copy_engine_names[decision.engine],
+						decision.nt, decision.rpdaa,
+						decision.mbps);
+			}
+
+	return len;
+}
+static struct kobj_attribute decisions_attr = __ATTR_RO(decisions);
+
+static struct attribute *copy_engine_attrs[] = {
+	&decisions_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group copy_engine_attr_group = {
+	.attrs = copy_engine_attrs,
+};
+
+static int __init copy_calibrate_init(void)
+{
+	copy_decisions = kvcalloc(nr_node_ids * nr_node_ids * NR_COPY_SIZES,
+			sizeof(*copy_decisions), GFP_KERNEL);
+	if (!copy_decisions)
+		return -ENOMEM;
+
+	mm_sysfs_add_group("copy_engine", &copy_engine_attr_group);
+
+	hotplug_memory_notifier(copy_calibrate_memory_callback, 0);
+
+	/* after copy_dma_pool_init() so that DMA channels are known */
+	queue_work(system_unbound_wq, &copy_calibrate_work);
+
+	return 0;
+}
+late_initcall_sync(copy_calibrate_init);
@@ -0,0 +1,861 @@
+/*
+ * Page copy and exchange engines.
+ *
+ * The non-temporal page copy and exchange paths used by page migration
+ * are implemented several times, once per instruction set extension.
+ * The best engine the boot CPU supports is picked at boot; the
+ * kernel.page_copy_engine sysctl overrides the choice at run time.
+ *
+ * Every engine has two exchange kernels: a non-temporal one that streams
+ * both pages, and a cached one that swaps them block by block through a
+ * small bounce buffer, prefetching the next block of both pages while the
+ * current one is swapped. page_exchange() picks one of them by page size
+ * and memory tier.
+ *
+ * The clear kernel zeroes huge pages on slow tier nodes with streaming
+ * stores where the engine has them, see clear_huge_page_nt().
+ *
+ * The SIMD copy and non-temporal exchange kernels prefetch the source a
+ * number of bytes ahead of the line they load, which keeps enough reads in
+ * flight to cover the latency of a PMEM source. The distance is set per
+ * source node, and calibrated for slow tier nodes the first time a copy
+ * reads from them, see page_copy_prefetch().
+ *
+ * Engines run inside kernel_fpu_begin()/kernel_fpu_end(), the callers
+ * take care of that.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/string.h>
+#include <linux/sysctl.h>
+#include <linux/capability.h>
+#include <linux/prefetch.h>
+#include <linux/sched/sysctl.h>
+#include <linux/memory_tier.h>
+#include <linux/gfp.h>
+#include <linux/vmalloc.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <asm/cpufeature.h>
+#include <asm/cacheflush.h>
+#include <asm/fpu/api.h>
+
+#include "internal.h"
+
+#define _MM_MALLOC_H_INCLUDED
+#include <immintrin.h>
+#undef _MM_MALLOC_H_INCLUDED
+
+// Index into page_copy_engines[] of the engine used by NT copies and exchanges
+int sysctl_page_copy_engine = PAGE_COPY_ENGINE_GENERIC;
+
+
+/*
+ * Non-temporal policy of page copies, indexed by [source is PMEM]
+ * [destination is PMEM]. Demotion to PMEM only streams the stores, the
+ * source page is read through the cache. Promotion to DRAM copies through
+ * the cache, since the page is hot and about to be touched again.
+ */
+int sysctl_nt_page_copy_policy[2][2] = {
+	{ PAGE_COPY_NT_BOTH, PAGE_COPY_NT_STORE },	/* from DRAM */
+	{ PAGE_COPY_NT_NONE, PAGE_COPY_NT_BOTH },	/* from PMEM */
+};
+
+int page_copy_nt_mode(int from_nid, int to_nid)
+{
+	return READ_ONCE(sysctl_nt_page_copy_policy[node_is_slow_tier(from_nid)]
+			[node_is_slow_tier(to_nid)]);
+}
+
+/*
+ * Whether exchanging a @page_size page between @nid1 and @nid2 uses the
+ * non-temporal kernel. In auto mode (enable_nt_exchange_page=2) only
+ * exchanges of at least a PMD sized page with a PMEM node stream, smaller
+ * ones stay well within the caches and swap faster through them.
+ */
+bool page_exchange_use_nt(int nid1, int nid2, unsigned long page_size)
+{
+	int nt = READ_ONCE(current->page_copy_policy.nt);
+
+	/* the copy policy of the migration wins over the sysctl */
+	if (nt >= 0)
+		return nt;
+
+	switch (READ_ONCE(sysctl_enable_nt_exchange)) {
+	case 0:
+		return false;
+	case 1:
+		return true;
+	}
+
+	return page_size >= PMD_SIZE &&
+		(node_is_slow_tier(nid1) || node_is_slow_tier(nid2));
+}
+
+void page_exchange(char *to, char *from, unsigned long size, bool nt,
+		unsigned int prefetch)
+{
+	const struct page_copy_engine *engine = current_page_copy_engine();
+
+	if (nt)
+		engine->exchange(to, from, size, prefetch);
+	else
+		engine->exchange_cached(to, from, size);
+}
+
+/*
+ * Block size of the cached exchange kernels. The bounce buffer and the
+ * two blocks being swapped stay resident in L1.
+ */
+#define EXCHANGE_BLOCK_SIZE	1024
+
+/* Prefetch for writing the block after the one at @offset of both pages */
+static __always_inline void exchange_prefetch_next(char *to, char *from,
+		unsigned long offset, unsigned long size)
+{
+	unsigned long next = offset + EXCHANGE_BLOCK_SIZE, i;
+
+	if (next >= size)
+		return;
+
+	for (i = next; i < min(next + EXCHANGE_BLOCK_SIZE, size); i += 64) {
+		prefetchw(to + i);
+		prefetchw(from + i);
+	}
+}
+
+/*
+ * Prefetch the line @dist bytes past offset @i of @p, unless it is past
+ * @size. The kernels call it once per cache line they load.
+ */
+static __always_inline void copy_prefetch_ahead(const char *p,
+		unsigned long i, unsigned long size, unsigned int dist)
+{
+	if (dist && i + dist < size)
+		prefetch(p + i + dist);
+}
+
+/* ======================== generic ======================== */
+
+static bool generic_usable(void)
+{
+	return true;
+}
+
+/* memcpy() and string moves leave the prefetching to the hardware */
+static void generic_copy(char *to, char *from, unsigned long size,
+		int nt_mode, unsigned int prefetch)
+{
+	memcpy(to, from, size);
+}
+
+static void generic_exchange(char *to, char *from, unsigned long size,
+		unsigned int prefetch)
+{
+	u64 tmp;
+	int i;
+
+	for (i = 0; i < size; i += sizeof(tmp)) {
+		if (!(i & 63)) {
+			copy_prefetch_ahead(from, i, size, prefetch);
+			copy_prefetch_ahead(to, i, size, prefetch);
+		}
+		tmp = *((u64*)(from + i));
+		*((u64*)(from + i)) = *((u64*)(to + i));
+		*((u64*)(to + i)) = tmp;
+	}
+}
+
+static void generic_exchange_cached(char *to, char *from, unsigned long size)
+{
+	char tmp[EXCHANGE_BLOCK_SIZE] __aligned(64);
+	unsigned long i;
+
+	for (i = 0; i < size; i += EXCHANGE_BLOCK_SIZE) {
+		unsigned long n = min_t(unsigned long, EXCHANGE_BLOCK_SIZE,
+				size - i);
+
+		exchange_prefetch_next(to, from, i, size);
+		memcpy(tmp, from + i, n);
+		memcpy(from + i, to + i, n);
+		memcpy(to + i, tmp, n);
+	}
+}
+
+static void generic_clear(char *to, unsigned long size)
+{
+	memset(to, 0, size);
+}
+
+/* ======================== rep movsb ======================== */
+
+
+static bool rep_movsb_usable(void)
+{
+	return boot_cpu_has(X86_FEATURE_ERMS) || boot_cpu_has(X86_FEATURE_FSRM);
+}
+
+static __always_inline void rep_movsb(void *to, const void *from,
+		unsigned long size)
+{
+	asm volatile("rep movsb"
+		     : "+D" (to), "+S" (from), "+c" (size)
+		     : : "memory");
+}
+
+static void rep_movsb_copy(char *to, char *from, unsigned long size,
+		int nt_mode, unsigned int prefetch)
+{
+	rep_movsb(to, from, size);
+}
+
+/* String moves are cached, both exchange kernels are this one */
+static void rep_movsb_exchange_cached(char *to, char *from, unsigned long size)
+{
+	char tmp[EXCHANGE_BLOCK_SIZE] __aligned(64);
+	unsigned long i;
+
+	for (i = 0; i < size; i += EXCHANGE_BLOCK_SIZE) {
+		unsigned long n = min_t(unsigned long, EXCHANGE_BLOCK_SIZE,
+				size - i);
+
+		exchange_prefetch_next(to, from, i, size);
+		rep_movsb(tmp, from + i, n);
+		rep_movsb(from + i, to + i, n);
+		rep_movsb(to + i, tmp, n);
+	}
+}
+
+static void rep_movsb_exchange(char *to, char *from, unsigned long size,
+		unsigned int prefetch)
+{
+	rep_movsb_exchange_cached(to, from, size);
+}
+
+/* ======================== AVX2 non-temporal ======================== */
+
+static bool avx2_nt_usable(void)
+{
+#ifdef CONFIG_AS_AVX2
+	return boot_cpu_has(X86_FEATURE_AVX) && boot_cpu_has(X86_FEATURE_AVX2);
+#else
+	return false;
+#endif
+}
+
+__attribute__((optimize("-O3")))
+__attribute__((target("avx2")))
+static void avx2_nt_copy(char *to, char *from, unsigned long size,
+		int nt_mode, unsigned int prefetch)
+{
+#ifdef CONFIG_AS_AVX2
+	__m256i* s = (__m256i*)from;
+	__m256i* d = (__m256i*)to;
+	unsigned long i;
+
+	/* two 32 byte moves per line */
+	switch (nt_mode) {
+	case PAGE_COPY_NT_LOAD:
+		for(i=0; i<size; i+=64) {
+			copy_prefetch_ahead(from, i, size, prefetch);
+			_mm256_store_si256(d++, _mm256_stream_load_si256(s++));
+			_mm256_store_si256(d++, _mm256_stream_load_si256(s++));
+		}
+		break;
+	case PAGE_COPY_NT_STORE:
+		for(i=0; i<size; i+=64) {
+			copy_prefetch_ahead(from, i, size, prefetch);
+			_mm256_stream_si256(d++, _mm256_load_si256(s++));
+			_mm256_stream_si256(d++, _mm256_load_si256(s++));
+		}
+		break;
+	default:
+		for(i=0; i<size; i+=64) {
+			copy_prefetch_ahead(from, i, size, prefetch);
+			_mm256_stream_si256(d++, _mm256_stream_load_si256(s++));
+			_mm256_stream_si256(d++, _mm256_stream_load_si256(s++));
+		}
+	}
+#else
+	memcpy(to, from, size);
+#endif
+}
+
+__attribute__((optimize("-O3")))
+__attribute__((target("avx2")))
+static void avx2_nt_exchange(char *to, char *from, unsigned long size,
+		unsigned int prefetch)
+{
+#ifdef CONFIG_AS_AVX2
+	__m256i* s = (__m256i*)from;
+	__m256i* d = (__m256i*)to;
+	__m256i temp;
+	unsigned long i;
+
+	for(i=0; i<size; i+=32){
+		if (!(i & 63)) {
+			copy_prefetch_ahead(from, i, size, prefetch);
+			copy_prefetch_ahead(to, i, size, prefetch);
+		}
+		temp = _mm256_stream_load_si256(s);
+		_mm256_stream_si256(s, _mm256_stream_load_si256(d));
+		_mm256_stream_si256(d, temp);
+		s++, d++;
+	}
+#else
+	generic_exchange(to, from, size, prefetch);
+#endif
+}
+
+__attribute__((optimize("-O3")))
+__attribute__((target("avx2")))
+static void avx2_exchange_cached(char *to, char *from, unsigned long size)
+{
+#ifdef CONFIG_AS_AVX2
+	__m256i tmp[EXCHANGE_BLOCK_SIZE / 32];
+	unsigned long i, j;
+
+	for (i = 0; i < size; i += EXCHANGE_BLOCK_SIZE) {
+		__m256i* s = (__m256i*)(from + i);
+		__m256i* d = (__m256i*)(to + i);
+
+		exchange_prefetch_next(to, from, i, size);
+		for (j = 0; j < ARRAY_SIZE(tmp); j++)
+			tmp[j] = _mm256_load_si256(s + j);
+		for (j = 0; j < ARRAY_SIZE(tmp); j++)
+			_mm256_store_si256(s + j, _mm256_load_si256(d + j));
+		for (j = 0; j < ARRAY_SIZE(tmp); j++)
+			_mm256_store_si256(d + j, tmp[j]);
+	}
+#else
+	generic_exchange_cached(to, from, size);
+#endif
+}
+
+__attribute__((optimize("-O3")))
+__attribute__((target("avx2")))
+static void avx2_nt_clear(char *to, unsigned long size)
+{
+#ifdef CONFIG_AS_AVX2
+	__m256i* d = (__m256i*)to;
+	__m256i zero = _mm256_setzero_si256();
+	unsigned long i;
+
+	for(i=0; i<size; i+=32)
+		_mm256_stream_si256(d++, zero);
+#else
+	generic_clear(to, size);
+#endif
+}
+
+/* ======================== AVX-512 non-temporal ======================== */
+
+static bool avx512_nt_usable(void)
+{
+#ifdef CONFIG_AS_AVX512
+	return boot_cpu_has(X86_FEATURE_AVX2) &&
+		boot_cpu_has(X86_FEATURE_AVX512F) &&
+		boot_cpu_has(X86_FEATURE_AVX512VL) &&
+		/* the routines are built with target("avx512vl,bmi2") */
+		boot_cpu_has(X86_FEATURE_BMI2);
+#else
+	return false;
+#endif
+}
+
+__attribute__((optimize("-O3")))
+__attribute__((target("avx512vl,bmi2")))
+static void avx512_nt_copy(char *to, char *from, unsigned long size,
+		int nt_mode, unsigned int prefetch)
+{
+#ifdef CONFIG_AS_AVX512
+	__m512i_u* s = (__m512i_u*)from;
+	__m512i_u* d = (__m512i_u*)to;
+	unsigned long i;
+
+	switch (nt_mode) {
+	case PAGE_COPY_NT_LOAD:
+		for(i=0; i<size; i+=64) {
+			copy_prefetch_ahead(from, i, size, prefetch);
+			_mm512_store_si512(d++, _mm512_stream_load_si512(s++));
+		}
+		break;
+	case PAGE_COPY_NT_STORE:
+		for(i=0; i<size; i+=64) {
+			copy_prefetch_ahead(from, i, size, prefetch);
+			_mm512_stream_si512(d++, _mm512_load_si512(s++));
+		}
+		break;
+	default:
+		for(i=0; i<size; i+=64) {
+			copy_prefetch_ahead(from, i, size, prefetch);
+			_mm512_stream_si512(d++, _mm512_stream_load_si512(s++));
+		}
+	}
+#else
+	memcpy(to, from, size);
+#endif
+}
+
+__attribute__((optimize("-O3")))
+__attribute__((target("avx512vl,bmi2")))
+static void avx512_nt_exchange(char *to, char *from, unsigned long size,
+		unsigned int prefetch)
+{
+#ifdef CONFIG_AS_AVX512
+	// use non-temporal load/stores
+	__m512i_u* s = (__m512i_u*)from;
+	__m512i_u* d = (__m512i_u*)to;
+	__m512i_u temp;
+	unsigned long i;
+
+	for(i=0; i<size; i+=64){
+		copy_prefetch_ahead(from, i, size, prefetch);
+		copy_prefetch_ahead(to, i, size, prefetch);
+		temp =  _mm512_stream_load_si512(s);
+		_mm512_stream_si512(s, _mm512_stream_load_si512(d));
+		_mm512_stream_si512(d, temp);
+		s++, d++;
+	}
+#else
+	generic_exchange(to, from, size, prefetch);
+#endif
+}
+
+__attribute__((optimize("-O3")))
+__attribute__((target("avx512vl,bmi2")))
+static void avx512_exchange_cached(char *to, char *from, unsigned long size)
+{
+#ifdef CONFIG_AS_AVX512
+	__m512i tmp[EXCHANGE_BLOCK_SIZE / 64];
+	unsigned long i, j;
+
+	for (i = 0; i < size; i += EXCHANGE_BLOCK_SIZE) {
+		__m512i* s = (__m512i*)(from + i);
+		__m512i* d = (__m512i*)(to + i);
+
+		exchange_prefetch_next(to, from, i, size);
+		for (j = 0; j < ARRAY_SIZE(tmp); j++)
+			tmp[j] = _mm512_load_si512(s + j);
+		for (j = 0; j < ARRAY_SIZE(tmp); j++)
+			_mm512_store_si512(s + j, _mm512_load_si512(d + j));
+		for (j = 0; j < ARRAY_SIZE(tmp); j++)
+			_mm512_store_si512(d + j, tmp[j]);
+	}
+#else
+	generic_exchange_cached(to, from, size);
+#endif
+}
+
+__attribute__((optimize("-O3")))
+__attribute__((target("avx512vl,bmi2")))
+static void avx512_nt_clear(char *to, unsigned long size)
+{
+#ifdef CONFIG_AS_AVX512
+	__m512i_u* d = (__m512i_u*)to;
+	__m512i zero = _mm512_setzero_si512();
+	unsigned long i;
+
+	for(i=0; i<size; i+=64)
+		_mm512_stream_si512(d++, zero);
+#else
+	generic_clear(to, size);
+#endif
+}
+
+/* ======================== movdir64b ======================== */
+
+static bool movdir64b_usable(void)
+{
+	return boot_cpu_has(X86_FEATURE_MOVDIR64B);
+}
+
+/* 64-byte direct store of *@from to @to, @to must be 64-byte aligned */
+static __always_inline void movdir64b(void *to, const void *from)
+{
+	/* movdir64b (%rdx), %rax */
+	asm volatile(".byte 0x66, 0x0f, 0x38, 0xf8, 0x02"
+		     : "+m" (*(char (*)[64])to)
+		     : "m" (*(const char (*)[64])from), "a" (to), "d" (from));
+}
+
+/* The stores are always direct and the loads always cached */
+static void movdir64b_copy(char *to, char *from, unsigned long size,
+		int nt_mode, unsigned int prefetch)
+{
+	unsigned long i;
+
+	for (i = 0; i < size; i += 64) {
+		copy_prefetch_ahead(from, i, size, prefetch);
+		movdir64b(to + i, from + i);
+	}
+}
+
+static void movdir64b_exchange(char *to, char *from, unsigned long size,
+		unsigned int prefetch)
+{
+	char tmp_to[64] __aligned(64);
+	char tmp_from[64] __aligned(64);
+	unsigned long i;
+
+	/*
+	 * Direct stores are weakly ordered against the loads of the other
+	 * page, so read both lines before writing either of them.
+	 */
+	for (i = 0; i < size; i += 64) {
+		copy_prefetch_ahead(from, i, size, prefetch);
+		copy_prefetch_ahead(to, i, size, prefetch);
+		memcpy(tmp_to, to + i, 64);
+		memcpy(tmp_from, from + i, 64);
+		movdir64b(from + i, tmp_to);
+		movdir64b(to + i, tmp_from);
+	}
+}
+
+static void movdir64b_clear(char *to, unsigned long size)
+{
+	static const char zero[64] __aligned(64);
+	unsigned long i;
+
+	for (i = 0; i < size; i += 64)
+		movdir64b(to + i, zero);
+}
+
+const struct page_copy_engine page_copy_engines[NR_PAGE_COPY_ENGINES] = {
+	[PAGE_COPY_ENGINE_GENERIC] = {
+		.name = "generic",
+		.usable = generic_usable,
+		.copy = generic_copy,
+		.exchange = generic_exchange,
+		.exchange_cached = generic_exchange_cached,
+		.clear = generic_clear,
+	},
+	[PAGE_COPY_ENGINE_REP_MOVSB] = {
+		.name = "rep_movsb",
+		.usable = rep_movsb_usable,
+		.copy = rep_movsb_copy,
+		.exchange = rep_movsb_exchange,
+		.exchange_cached = rep_movsb_exchange_cached,
+		.clear = generic_clear,
+	},
+	[PAGE_COPY_ENGINE_AVX2_NT] = {
+		.name = "avx2_nt",
+		.usable = avx2_nt_usable,
+		.copy = avx2_nt_copy,
+		.exchange = avx2_nt_exchange,
+		.exchange_cached = avx2_exchange_cached,
+		.clear = avx2_nt_clear,
+	},
+	[PAGE_COPY_ENGINE_AVX512_NT] = {
+		.name = "avx512_nt",
+		.usable = avx512_nt_usable,
+		.copy = avx512_nt_copy,
+		.exchange = avx512_nt_exchange,
+		.exchange_cached = avx512_exchange_cached,
+		.clear = avx512_nt_clear,
+	},
+	[PAGE_COPY_ENGINE_MOVDIR64B] = {
+		.name = "movdir64b",
+		.usable = movdir64b_usable,
+		.copy = movdir64b_copy,
+		.exchange = movdir64b_exchange,
+		.exchange_cached = generic_exchange_cached,
+		.clear = movdir64b_clear,
+	},
+};
+
+/* Boot time preference, best first */
+static const int page_copy_engine_order[] __initconst = {
+	PAGE_COPY_ENGINE_AVX512_NT,
+	PAGE_COPY_ENGINE_AVX2_NT,
+	PAGE_COPY_ENGINE_MOVDIR64B,
+	PAGE_COPY_ENGINE_REP_MOVSB,
+	PAGE_COPY_ENGINE_GENERIC,
+};
+
+static int __init page_copy_engine_select(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(page_copy_engine_order); ++i) {
+		int engine = page_copy_engine_order[i];
+
+		if (page_copy_engines[engine].usable()) {
+			WRITE_ONCE(sysctl_page_copy_engine, engine);
+			break;
+		}
+	}
+
+	pr_info("page copy engine: using %s\n",
+			page_copy_engines[sysctl_page_copy_engine].name);
+	return 0;
+}
+core_initcall(page_copy_engine_select);
+
+int sysctl_page_copy_engine_handler(struct ctl_table *table, int write,
+				 void __user *buffer, size_t *lenp,
+				 loff_t *ppos)
+{
+	struct ctl_table t = *table;
+	int engine = READ_ONCE(sysctl_page_copy_engine);
+	int err;
+
+	if (write && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	t.data = &engine;
+	err = proc_dointvec(&t, write, buffer, lenp, ppos);
+	if (err < 0 || !write)
+		return err;
+
+	if (engine < 0 || engine >= NR_PAGE_COPY_ENGINES ||
+	    !page_copy_engines[engine].usable())
+		return -EINVAL;
+
+	WRITE_ONCE(sysctl_page_copy_engine, engine);
+	pr_info("page copy engine: switched to %s\n",
+			page_copy_engines[engine].name);
+
+	return 0;
+}
+
+/* ======================== prefetch distance ======================== */
+
+/* distance of the slow tier nodes until they are calibrated */
+#define COPY_PREFETCH_DEFAULT	1024
+/* pages of the source buffer the calibration copies */
+#define COPY_PREFETCH_CAL_ORDER	5
+/* wait before calibrating a node again when its buffer was not allocated */
+#define COPY_PREFETCH_RETRY	(60 * HZ)
+
+enum {
+	COPY_PREFETCH_UNSET,
+	COPY_PREFETCH_CALIBRATING,
+	COPY_PREFETCH_CALIBRATED,
+	COPY_PREFETCH_MANUAL,
+};
+
+static const char * const copy_prefetch_state_names[] = {
+	[COPY_PREFETCH_UNSET] = "unset",
+	[COPY_PREFETCH_CALIBRATING] = "calibrating",
+	[COPY_PREFETCH_CALIBRATED] = "calibrated",
+	[COPY_PREFETCH_MANUAL] = "manual",
+};
+
+static const unsigned int copy_prefetch_candidates[] = {
+	0, 256, 512, 1024, 2048, 4096,
+};
+
+struct copy_prefetch_node {
+	unsigned int bytes;
+	int state;
+	unsigned long failed;	/* jiffies of the last failed calibration */
+	struct work_struct work;
+};
+
+static struct copy_prefetch_node copy_prefetch_nodes[MAX_NUMNODES];
+
+/* Time a copy of @size bytes of @from, flushed from the caches first */
+static u64 copy_prefetch_time(char *to, char *from, unsigned long size,
+		unsigned int prefetch)
+{
+	const struct page_copy_engine *engine = current_page_copy_engine();
+	unsigned long offset, len;
+	ktime_t start;
+
+	clflush_cache_range(from, size);
+
+	start = ktime_get();
+	for (offset = 0; offset < size; offset += len) {
+		len = min(size - offset, PAGE_COPY_FPU_SECTION);
+		kernel_fpu_begin();
+		engine->copy(to + offset, from + offset, len,
+			     PAGE_COPY_NT_BOTH, prefetch);
+		kernel_fpu_end();
+	}
+
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/*
+ * Pick the prefetch distance of a slow tier node: copy a buffer of the node
+ * with each of the candidate distances and keep the fastest. The buffer is
+ * copied to the local node, which is what promotions do. It is movable
+ * memory, the only kind a ZONE_MOVABLE-only slow node has. A node whose
+ * buffer cannot be allocated is left unset, to be tried again later.
+ */
+static void copy_prefetch_calibrate_fn(struct work_struct *work)
+{
+	struct copy_prefetch_node *node = container_of(work,
+			struct copy_prefetch_node, work);
+	int nid = node - copy_prefetch_nodes;
+	unsigned long size = PAGE_SIZE << COPY_PREFETCH_CAL_ORDER;
+	struct page *pages[1 << COPY_PREFETCH_CAL_ORDER];
+	unsigned int best = COPY_PREFETCH_DEFAULT;
+	struct page *src, *dst;
+	u64 ns, best_ns = U64_MAX;
+	char *from = NULL;
+	int i;
+
+	src = alloc_pages_node(nid, GFP_HIGHUSER_MOVABLE | __GFP_THISNODE |
+			       __GFP_NOWARN, COPY_PREFETCH_CAL_ORDER);
+	dst = alloc_pages(GFP_KERNEL | __GFP_NOWARN, COPY_PREFETCH_CAL_ORDER);
+	if (src) {
+		for (i = 0; i < ARRAY_SIZE(pages); i++)
+			pages[i] = src + i;
+		from = vmap(pages, ARRAY_SIZE(pages), VM_MAP, PAGE_KERNEL);
+	}
+	if (!from || !dst) {
+		WRITE_ONCE(node->failed, jiffies ? jiffies : 1);
+		cmpxchg(&node->state, COPY_PREFETCH_CALIBRATING,
+			COPY_PREFETCH_UNSET);
+		goto out;
+	}
+
+	memset(from, 0, size);
+	/* a first run to fault in the TLB entries and warm up the engine */
+	copy_prefetch_time(page_address(dst), from, size, 0);
+
+	for (i = 0; i < ARRAY_SIZE(copy_prefetch_candidates); i++) {
+		ns = copy_prefetch_time(page_address(dst), from, size,
+				copy_prefetch_candidates[i]);
+		if (ns < best_ns) {
+			best_ns = ns;
+			best = copy_prefetch_candidates[i];
+		}
+		cond_resched();
+	}
+
+	/* a manual setting made meanwhile wins */
+	if (cmpxchg(&node->state, COPY_PREFETCH_CALIBRATING,
+		    COPY_PREFETCH_CALIBRATED) == COPY_PREFETCH_CALIBRATING) {
+		WRITE_ONCE(node->bytes, best);
+		pr_info("page copy engine: node %d prefetch distance %u\n",
+			nid, best);
+	}
+out:
+	if (from)
+		vunmap(from);
+	if (src)
+		__free_pages(src, COPY_PREFETCH_CAL_ORDER);
+	if (dst)
+		__free_pages(dst, COPY_PREFETCH_CAL_ORDER);
+}
+
+static unsigned int copy_prefetch_default(int nid)
+{
+	return node_is_slow_tier(nid) ? COPY_PREFETCH_DEFAULT : 0;
+}
+
+/*
+ * Prefetch distance in bytes of copies reading from @nid, 0 for none. An
+ * uncalibrated slow tier node gets its calibration queued, and the default
+ * distance until it is done.
+ */
+unsigned int page_copy_prefetch(int nid)
+{
+	struct copy_prefetch_node *node;
+	unsigned long failed;
+
+	if (nid < 0 || nid >= MAX_NUMNODES)
+		return 0;
+
+	node = &copy_prefetch_nodes[nid];
+	switch (READ_ONCE(node->state)) {
+	case COPY_PREFETCH_CALIBRATED:
+	case COPY_PREFETCH_MANUAL:
+		return READ_ONCE(node->bytes);
+	case COPY_PREFETCH_UNSET:
+		if (!node_is_slow_tier(nid))
+			return 0;
+		failed = READ_ONCE(node->failed);
+		if (failed && time_before(jiffies, failed + COPY_PREFETCH_RETRY))
+			return copy_prefetch_default(nid);
+		if (cmpxchg(&node->state, COPY_PREFETCH_UNSET,
+			    COPY_PREFETCH_CALIBRATING) == COPY_PREFETCH_UNSET)
+			queue_work(system_unbound_wq, &node->work);
+		/* fall through */
+	default:
+		return copy_prefetch_default(nid);
+	}
+}
+
+/*
+ * /sys/kernel/mm/copy_prefetch/nodes: one "node bytes state" line per
+ * memory node. Writing "node bytes" sets the prefetch distance of a node,
+ * "node -1" calibrates it again.
+ */
+static ssize_t nodes_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct copy_prefetch_node *node;
+	ssize_t len = 0;
+	int nid, state;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len, "node bytes state\n");
+
+	for_each_node_state(nid, N_MEMORY) {
+		node = &copy_prefetch_nodes[nid];
+		state = READ_ONCE(node->state);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %u %s\n", nid,
+				state >= COPY_PREFETCH_CALIBRATED ?
+				READ_ONCE(node->bytes) : copy_prefetch_default(nid),
+				copy_prefetch_state_names[state]);
+	}
+
+	return len;
+}
+
+static ssize_t nodes_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	struct copy_prefetch_node *node;
+	int nid, bytes;
+
+	if (sscanf(buf, "%d %d", &nid, &bytes) != 2)
+		return -EINVAL;
+	if (nid < 0 || nid >= MAX_NUMNODES || !node_state(nid, N_MEMORY) ||
+	    bytes < -1 || bytes > (64 << 10))
+		return -EINVAL;
+
+	node = &copy_prefetch_nodes[nid];
+	if (bytes >= 0) {
+		WRITE_ONCE(node->bytes, bytes);
+		WRITE_ONCE(node->state, COPY_PREFETCH_MANUAL);
+		return count;
+	}
+
+	if (xchg(&node->state, COPY_PREFETCH_CALIBRATING) !=
+	    COPY_PREFETCH_CALIBRATING)
+		queue_work(system_unbound_wq, &node->work);
+
+	return count;
+}
+static struct kobj_attribute nodes_attr = __ATTR_RW(nodes);
+
+static struct attribute *copy_prefetch_attrs[] = {
+	&nodes_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group copy_prefetch_attr_group = {
+	.attrs = copy_prefetch_attrs,
+};
+
+static int __init copy_prefetch_init(void)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++)
+		INIT_WORK(&copy_prefetch_nodes[nid].work,
+			  copy_prefetch_calibrate_fn);
+
+	mm_sysfs_add_group("copy_prefetch", &copy_prefetch_attr_group);
+
+	return 0;
+}
+subsys_initcall(copy_prefetch_init);
@@ -0,0 +1,226 @@
+/*
+ * Vectorized machine check safe copies.
+ *
+ * __memcpy_mcsafe() copies PMEM a quadword at a time so that a machine
+ * check on poisoned media lands on an instruction with an exception table
+ * entry, which caps DAX and pmem reads at a fraction of what the media
+ * delivers. The copies here move a cache line per step, the poison
+ * granularity, with AVX-512 or AVX2 loads and stores that each have their
+ * own fixup. They stop at the first poisoned line and return the bytes not
+ * copied, like __memcpy_mcsafe(). The unaligned head and the tail, and the
+ * rest of a copy to a user page that faulted, go through __memcpy_mcsafe().
+ *
+ * The vector copies are picked at boot when the CPU has AVX2, for copies
+ * of at least MCSAFE_VEC_MIN bytes in a context that may use the FPU.
+ * Within a copy_stream_save() section they load with movntdqa, and store
+ * with movntdq when the source and the destination are equally aligned,
+ * for DAX reads of data read once.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/export.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/jump_label.h>
+#include <linux/sched.h>
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#include <asm/asm.h>
+#include <asm/traps.h>
+
+#include "internal.h"
+
+DEFINE_STATIC_KEY_FALSE(mcsafe_vec_key);
+EXPORT_SYMBOL_GPL(mcsafe_vec_key);
+
+/* bytes copied per kernel_fpu_begin() section, bounding the preempt off time */
+#define MCSAFE_VEC_CHUNK	(16 * PAGE_SIZE)
+
+/*
+ * Copy one cache line. The copy returns 0, or the trap number of the fault
+ * that stopped it: the fixup of ex_handler_fault() leaves it in %eax.
+ */
+#define MCSAFE_LINE_AVX512(load, store)					\
+	asm volatile("1: " load " (%[src]), %%zmm0\n"			\
+		     "2: " store " %%zmm0, (%[dst])\n"			\
+		     "3:\n"						\
+		     _ASM_EXTABLE_FAULT(1b, 3b)				\
+		     _ASM_EXTABLE_FAULT(2b, 3b)				\
+		     : "+a" (trap)					\
+		     : [src] "r" (src), [dst] "r" (dst)			\
+		     : "memory")
+
+#define MCSAFE_LINE_AVX2(load, store)					\
+	asm volatile("1: " load "   (%[src]), %%ymm0\n"			\
+		     "2: " load " 32(%[src]), %%ymm1\n"			\
+		     "3: " store " %%ymm0,   (%[dst])\n"			\
+		     "4: " store " %%ymm1, 32(%[dst])\n"			\
+		     "5:\n"						\
+		     _ASM_EXTABLE_FAULT(1b, 5b)				\
+		     _ASM_EXTABLE_FAULT(2b, 5b)				\
+		     _ASM_EXTABLE_FAULT(3b, 5b)				\
+		     _ASM_EXTABLE_FAULT(4b, 5b)				\
+		     : "+a" (trap)					\
+		     : [src] "r" (src), [dst] "r" (dst)			\
+		     : "memory")
+
+#ifdef CONFIG_AS_AVX512
+static __always_inline int mcsafe_line_avx512(void *dst, const void *src,
+		int nt_mode)
+{
+	int trap = 0;
+
+	switch (nt_mode) {
+	case PAGE_COPY_NT_NONE:
+		MCSAFE_LINE_AVX512("vmovdqu64", "vmovdqu64");
+		break;
+	case PAGE_COPY_NT_LOAD:
+		MCSAFE_LINE_AVX512("vmovntdqa", "vmovdqu64");
+		break;
+	default:
+		MCSAFE_LINE_AVX512("vmovntdqa", "vmovntdq");
+		break;
+	}
+
+	return trap;
+}
+#endif
+
+static __always_inline int mcsafe_line_avx2(void *dst, const void *src,
+		int nt_mode)
+{
+	int trap = 0;
+
+	switch (nt_mode) {
+	case PAGE_COPY_NT_NONE:
+		MCSAFE_LINE_AVX2("vmovdqu", "vmovdqu");
+		break;
+	case PAGE_COPY_NT_LOAD:
+		MCSAFE_LINE_AVX2("vmovntdqa", "vmovdqu");
+		break;
+	default:
+		MCSAFE_LINE_AVX2("vmovntdqa", "vmovntdq");
+		break;
+	}
+
+	return trap;
+}
+
+/*
+ * Copy the @len / SMP_CACHE_BYTES lines at @src, which is line aligned.
+ * Returns the bytes copied, setting *@trap if a fault stopped the copy.
+ */
+static __always_inline size_t mcsafe_copy_lines(void *dst, const void *src,
+		size_t len, int nt_mode, int *trap)
+{
+	size_t done;
+	int t;
+
+	for (done = 0; done + SMP_CACHE_BYTES <= len; done += SMP_CACHE_BYTES) {
+#ifdef CONFIG_AS_AVX512
+		if (static_cpu_has(X86_FEATURE_AVX512F))
+			t = mcsafe_line_avx512(dst + done, src + done, nt_mode);
+		else
+#endif
+			t = mcsafe_line_avx2(dst + done, src + done, nt_mode);
+		if (unlikely(t)) {
+			*trap = t;
+			break;
+		}
+	}
+
+	return done;
+}
+
+static unsigned long mcsafe_copy_scalar(void *dst, const void *src,
+		size_t cnt, bool user)
+{
+	unsigned long rem;
+
+	if (!user)
+		return __memcpy_mcsafe(dst, src, cnt);
+
+	__uaccess_begin();
+	rem = __memcpy_mcsafe(dst, src, cnt);
+	__uaccess_end();
+
+	return rem;
+}
+
+static unsigned long mcsafe_copy_vec(void *dst, const void *src, size_t cnt,
+		bool user)
+{
+	size_t head, done, chunk;
+	unsigned long rem;
+	int nt_mode = PAGE_COPY_NT_NONE;
+	int trap = 0;
+
+	if (!irq_fpu_usable())
+		return mcsafe_copy_scalar(dst, src, cnt, user);
+
+	head = min_t(size_t, cnt, PTR_ALIGN(src, SMP_CACHE_BYTES) - src);
+	if (head) {
+		rem = mcsafe_copy_scalar(dst, src, head, user);
+		if (rem)
+			return rem + cnt - head;
+	}
+
+	if (in_task() && current->copy_stream)
+		nt_mode = ((unsigned long)dst ^ (unsigned long)src) &
+			(SMP_CACHE_BYTES - 1) ? PAGE_COPY_NT_LOAD :
+			PAGE_COPY_NT_BOTH;
+
+	done = head;
+	while (!trap && cnt - done >= SMP_CACHE_BYTES) {
+		chunk = min_t(size_t, cnt - done, MCSAFE_VEC_CHUNK);
+
+		kernel_fpu_begin();
+		if (user) {
+			pagefault_disable();
+			__uaccess_begin();
+		}
+		done += mcsafe_copy_lines(dst + done, src + done, chunk,
+					  nt_mode, &trap);
+		if (nt_mode & PAGE_COPY_NT_STORE)
+			wmb();
+		if (user) {
+			__uaccess_end();
+			pagefault_enable();
+		}
+		kernel_fpu_end();
+	}
+
+	/* poison, the line at @done and everything after it is not copied */
+	if (trap == X86_TRAP_MC)
+		return cnt - done;
+
+	/* the tail, or the rest after the user destination faulted */
+	return mcsafe_copy_scalar(dst + done, src + done, cnt - done, user);
+}
+
+unsigned long memcpy_mcsafe_vec(void *dst, const void *src, size_t cnt)
+{
+	return mcsafe_copy_vec(dst, src, cnt, false);
+}
+EXPORT_SYMBOL_GPL(memcpy_mcsafe_vec);
+
+unsigned long copy_to_user_mcsafe_vec(void *to, const void *from, size_t cnt)
+{
+	return mcsafe_copy_vec(to, from, cnt, true);
+}
+EXPORT_SYMBOL_GPL(copy_to_user_mcsafe_vec);
+
+static int __init mcsafe_vec_select(void)
+{
+#ifdef CONFIG_AS_AVX2
+	if (boot_cpu_has(X86_FEATURE_AVX) && boot_cpu_has(X86_FEATURE_AVX2)) {
+		static_branch_enable(&mcsafe_vec_key);
+		pr_info("mcsafe: %s copies\n",
+			IS_ENABLED(CONFIG_AS_AVX512) &&
+			boot_cpu_has(X86_FEATURE_AVX512F) ? "AVX-512" : "AVX2");
+	}
+#endif
+	return 0;
+}
+core_initcall(mcsafe_vec_select);
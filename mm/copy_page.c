@@ -11,311 +11,1696 @@
 #include <linux/workqueue.h>
 #include <linux/slab.h>
 #include <linux/freezer.h>
+#include <linux/ktime.h>
+#include <linux/vmstat.h>
+#include <linux/llist.h>
+#include <linux/mempolicy.h>
+#include <linux/memcontrol.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/memory_tier.h>
+#include <linux/cpuset.h>
+#include <linux/sched/isolation.h>
 
 #include <linux/migrate.h>
+#include <linux/migrate_stat.h>
+#include <linux/pmem_writers.h>
+#include <linux/sort.h>
 
+#include <trace/events/migrate.h>
 
-#define _MM_MALLOC_H_INCLUDED 
-#include <immintrin.h>
-#undef _MM_MALLOC_H_INCLUDED 
+#include "internal.h"
 
+/*
+ * limit_mt_num is the default number of copy threads. The actual number
+ * of copy threads will be limited by the cpumask weight of the target
+ * node.
+ */
 unsigned int limit_mt_num = 4;
 
 /* ======================== multi-threaded copy page ======================== */
 
+/*
+ * @nr pieces of @chunk_size bytes, @stride bytes apart. A chunk is one
+ * contiguous piece unless the copy is interleaved, see
+ * copy_page_add_chunks().
+ */
 struct copy_item {
 	char *to;
 	char *from;
 	unsigned long chunk_size;
+	int nt_mode;
+	/* prefetch distance for the source node, see page_copy_prefetch() */
+	unsigned int prefetch;
+	unsigned int nr;
+	unsigned int stride;
+	/* interleave way the destination pieces sit on */
+	unsigned int way;
 };
 
+struct copy_page_pool;
+
+/*
+ * A copy worker and its chunk queue. The queue is the range
+ * [@next, @end) of the pool chunk array; chunks are claimed by bumping
+ * @next, both by the owner and by workers that ran out of their own
+ * chunks and steal from it.
+ */
 struct copy_page_info {
 	struct work_struct copy_page_work;
-	unsigned long num_items;
-	struct copy_item item_list[0];
+	struct copy_page_pool *pool;
+	int index;
+	atomic_t next;
+	unsigned int end;
+};
+
+/*
+ * Per-node pool of copy workers. The work descriptors and the chunk array
+ * are allocated once and reused by every multi-threaded copy whose workers
+ * run on that node, so a copy only fills in the chunks, queues the works
+ * and sleeps on @done until the last worker finishes.
+ *
+ * The pool always holds MAX_NR_COPY_THREADS descriptors; limit_mt_num only
+ * decides how many of them a copy uses, so it can change at any time.
+ */
+struct copy_page_pool {
+	struct mutex lock;
+	/* copies holding or waiting for @lock, and the most there ever were */
+	atomic_t nr_queued;
+	int max_queued;
+	unsigned long nr_copies;
+	u64 lock_wait_ns;
+	atomic_t nr_pending;
+	struct completion done;
+	int nr_works;
+	/* each worker holds a pmem_writers slot of @writer_nid */
+	int writer_nid;
+	/* node of the CPUs the workers run on */
+	int cpu_nid;
+	u64 start_ns;
+	u64 first_start_ns;
+	u64 end_ns;
+	/* CPU time of the workers, charged to the task that waits for them */
+	atomic64_t worker_ns;
+	unsigned long nr_base_pages;
+	unsigned int nr_chunks;
+	unsigned int max_chunks;
+	/* some chunks are interleaved, sort them by way before starting */
+	bool interleaved;
+	struct copy_item *chunks;
+	struct copy_page_info work_items[MAX_NR_COPY_THREADS];
 };
 
-// Controls the usage of non-temporal load-stores in page copy
+/*
+ * Pages are cut into chunks of this size, which is the unit of work the
+ * copy workers claim and steal. A base page is a single chunk.
+ */
+#define COPY_PAGE_CHUNK_SIZE	(64UL << 10)
+
+/* chunk slots preallocated per pool, enough for 16 THPs; grown on demand */
+#define COPY_PAGE_POOL_CHUNKS	(16 * (HPAGE_PMD_SIZE / COPY_PAGE_CHUNK_SIZE))
+
+static struct workqueue_struct *copy_page_wq;
+static struct copy_page_pool *copy_page_pools[MAX_NUMNODES];
+
+/*
+ * What the copy workers of each CPU did: how long they ran, how much they
+ * copied and how long they sat in the workqueue between being queued and
+ * running, see the copy_page/workers debugfs file.
+ */
+struct copy_worker_stat {
+	unsigned long nr_runs;
+	u64 busy_ns;
+	u64 bytes;
+	u64 wait_ns;
+	u64 max_wait_ns;
+};
+
+static DEFINE_PER_CPU(struct copy_worker_stat, copy_worker_stats);
+
+// Controls the usage of non-temporal load-stores in page copy, which side
+// of the copy streams is chosen per direction by nt_page_copy_policy
 int sysctl_enable_nt_page_copy=0;
 
-__attribute__((optimize("-O3")))
-__attribute__((target("avx512vl,bmi2")))
+/* NT mode of a copy from @from to @to, PAGE_COPY_NT_NONE unless @nt */
+static int copy_page_chunk_nt_mode(struct page *from, struct page *to, bool nt)
+{
+	if (!nt)
+		return PAGE_COPY_NT_NONE;
+
+	return page_copy_nt_mode(page_to_nid(from), page_to_nid(to));
+}
+
+/*
+ * The SIMD copy runs in PAGE_COPY_FPU_SECTION sections, each in its own
+ * FPU section, so a chunk never keeps preemption off for long. A plain
+ * memcpy() needs no FPU section at all.
+ */
 static void copy_page_routine(char *vto, char *vfrom,
-	unsigned long chunk_size)
-{
-#ifdef CONFIG_AS_AVX512
-	if(sysctl_enable_nt_page_copy==1){
-		__m512i_u* s = (__m512i_u*)vfrom;
-		__m512i_u* d = (__m512i_u*)vto;
-		unsigned long i;
-		for(i=0; i<chunk_size; i+=64)
-			_mm512_stream_si512(d++, _mm512_stream_load_si512(s++));
-	}else{
+	unsigned long chunk_size, int nt_mode, unsigned int prefetch)
+{
+	unsigned long offset, len;
+
+	if (nt_mode == PAGE_COPY_NT_NONE) {
 		memcpy(vto, vfrom, chunk_size);
+		cond_resched();
+		return;
+	}
+
+	for (offset = 0; offset < chunk_size; offset += len) {
+		len = min(chunk_size - offset, PAGE_COPY_FPU_SECTION);
+		kernel_fpu_begin();
+		current_page_copy_engine()->copy(vto + offset, vfrom + offset,
+				len, nt_mode, prefetch);
+		kernel_fpu_end();
+		cond_resched();
 	}
-#else
-	memcpy(vto, vfrom, chunk_size);
-#endif
+}
+
+static struct copy_item *copy_page_claim_chunk(struct copy_page_pool *pool,
+		struct copy_page_info *queue)
+{
+	unsigned int idx;
+
+	if (atomic_read(&queue->next) >= queue->end)
+		return NULL;
+
+	idx = atomic_inc_return(&queue->next) - 1;
+	if (idx >= queue->end)
+		return NULL;
+
+	return &pool->chunks[idx];
 }
 
 static void copy_page_work_queue_thread(struct work_struct *work)
 {
-	struct copy_page_info *my_work = (struct copy_page_info *)work;
+	struct copy_page_info *my_work = container_of(work,
+			struct copy_page_info, copy_page_work);
+	struct copy_page_pool *pool = my_work->pool;
+	struct copy_item *chunk;
+	u64 start = ktime_get_ns(), wait = start - pool->start_ns;
+	u64 bytes = 0, max_wait, old;
 	int i;
-	kernel_fpu_begin();
-	for (i = 0; i < my_work->num_items; ++i)
-		copy_page_routine(my_work->item_list[i].to,
-						  my_work->item_list[i].from,
-						  my_work->item_list[i].chunk_size);
-	kernel_fpu_end();
+
+	if (!READ_ONCE(pool->first_start_ns))
+		cmpxchg64(&pool->first_start_ns, 0, start);
+
+	/* drain our own queue first, then steal from the other workers */
+	for (i = 0; i < pool->nr_works; ++i) {
+		struct copy_page_info *queue =
+			&pool->work_items[(my_work->index + i) % pool->nr_works];
+
+		while ((chunk = copy_page_claim_chunk(pool, queue))) {
+			unsigned int j;
+
+			for (j = 0; j < chunk->nr; ++j)
+				copy_page_routine(chunk->to + j * chunk->stride,
+						chunk->from + j * chunk->stride,
+						chunk->chunk_size, chunk->nt_mode,
+						chunk->prefetch);
+			bytes += chunk->chunk_size * chunk->nr;
+		}
+	}
+	pmem_writers_put(pool->writer_nid, 1);
+
+	atomic64_add(ktime_get_ns() - start, &pool->worker_ns);
+
+	/*
+	 * The workers are bound to their CPU, but another one of the same
+	 * CPU may preempt this one between the load and store of a plain
+	 * increment.
+	 */
+	this_cpu_inc(copy_worker_stats.nr_runs);
+	this_cpu_add(copy_worker_stats.busy_ns, ktime_get_ns() - start);
+	this_cpu_add(copy_worker_stats.bytes, bytes);
+	this_cpu_add(copy_worker_stats.wait_ns, wait);
+	max_wait = this_cpu_read(copy_worker_stats.max_wait_ns);
+	while (wait > max_wait) {
+		old = this_cpu_cmpxchg(copy_worker_stats.max_wait_ns,
+				       max_wait, wait);
+		if (old == max_wait)
+			break;
+		max_wait = old;
+	}
+
+	if (atomic_dec_and_test(&pool->nr_pending)) {
+		pool->end_ns = ktime_get_ns();
+		complete(&pool->done);
+	}
 }
 
-// controls the usage of RPDAA optimization in page migration
-extern int sysctl_enable_page_migration_optimization_avoid_remote_pmem_write;
+static void copy_page_pool_free(struct copy_page_pool *pool)
+{
+	kvfree(pool->chunks);
+	kfree(pool);
+}
 
-int copy_page_multithread(struct page *to, struct page *from, int nr_pages)
+static struct copy_page_pool *copy_page_pool_alloc(int nid)
 {
-	unsigned int total_mt_num = limit_mt_num;
-	int to_node, from_node, node_selected_for_migration_processing;
+	struct copy_page_pool *pool;
 	int i;
-	struct copy_page_info *work_items[32] = {0};
-	char *vto, *vfrom;
-	unsigned long chunk_size;
-	const struct cpumask *per_node_cpumask;
-	int cpu_id_list[32] = {0};
+
+	pool = kzalloc_node(sizeof(*pool), GFP_KERNEL, nid);
+	if (!pool)
+		return NULL;
+
+	mutex_init(&pool->lock);
+	init_completion(&pool->done);
+
+	pool->chunks = kvmalloc_node(COPY_PAGE_POOL_CHUNKS *
+			sizeof(struct copy_item), GFP_KERNEL, nid);
+	if (!pool->chunks) {
+		kfree(pool);
+		return NULL;
+	}
+	pool->max_chunks = COPY_PAGE_POOL_CHUNKS;
+
+	for (i = 0; i < MAX_NR_COPY_THREADS; ++i) {
+		struct copy_page_info *work_item = &pool->work_items[i];
+
+		INIT_WORK(&work_item->copy_page_work, copy_page_work_queue_thread);
+		work_item->pool = pool;
+		work_item->index = i;
+	}
+
+	return pool;
+}
+
+/*
+ * Get the copy worker pool of @nid with its lock held. Pools of nodes that
+ * were not online at boot are created on first use and never freed.
+ */
+static struct copy_page_pool *copy_page_pool_get(int nid)
+{
+	struct copy_page_pool *pool = READ_ONCE(copy_page_pools[nid]);
+	int nr_queued;
+	u64 start;
+
+	if (unlikely(!pool)) {
+		struct copy_page_pool *new_pool = copy_page_pool_alloc(nid);
+
+		if (!new_pool)
+			return NULL;
+
+		pool = cmpxchg(&copy_page_pools[nid], NULL, new_pool);
+		if (pool)
+			copy_page_pool_free(new_pool);
+		else
+			pool = new_pool;
+	}
+
+	nr_queued = atomic_inc_return(&pool->nr_queued);
+	start = ktime_get_ns();
+	mutex_lock(&pool->lock);
+	pool->lock_wait_ns += ktime_get_ns() - start;
+	pool->nr_copies++;
+	pool->max_queued = max(pool->max_queued, nr_queued);
+
+	return pool;
+}
+
+static void copy_page_pool_put(struct copy_page_pool *pool)
+{
+	mutex_unlock(&pool->lock);
+	atomic_dec(&pool->nr_queued);
+}
+
+static unsigned long copy_page_nr_base_pages(struct page **from, int nr_items)
+{
+	unsigned long nr_pages = 0;
+	int i;
+
+	for (i = 0; i < nr_items; ++i)
+		nr_pages += hpage_nr_pages(from[i]);
+
+	return nr_pages;
+}
+
+/*
+ * PMEM interleaves the DIMMs of a region every 4KB, and Optane DIMMs
+ * write in 256B XPLines internally. Contiguous chunks written at the same
+ * time by several workers land on the same DIMMs as often as not, while
+ * the other DIMMs of the set sit idle. With vm.mt_copy_interleave_ways
+ * set to the number of DIMMs interleaved, the copies to a slow tier node
+ * are instead cut in chunks of the 4KB granules of a single DIMM, and
+ * the workers are handed the chunks of one DIMM after the other: each
+ * worker streams to its own DIMMs and every DIMM is written in parallel.
+ * The granules are whole XPLines, so no store leaves one half written.
+ */
+int sysctl_mt_copy_interleave_ways = 0;
+
+#define COPY_PAGE_INTERLEAVE_GRANULE	4096UL
+/* granules per interleaved chunk, as many bytes as a contiguous chunk */
+#define COPY_PAGE_INTERLEAVE_PIECES	\
+	(COPY_PAGE_CHUNK_SIZE / COPY_PAGE_INTERLEAVE_GRANULE)
+
+/* Ways a copy to @to is interleaved over, 0 for none */
+static unsigned int copy_page_interleave_ways(struct page *to)
+{
+	unsigned int ways = READ_ONCE(sysctl_mt_copy_interleave_ways);
+
+	if (ways < 2 || !node_is_slow_tier(page_to_nid(to)))
+		return 0;
+
+	return ways;
+}
+
+/* Chunks copy_page_add_chunks() cuts a @len bytes copy to @to in */
+static unsigned int copy_page_item_chunks(struct page *to, unsigned long len)
+{
+	unsigned int ways = copy_page_interleave_ways(to);
+	unsigned long granules;
+
+	if (!ways || len < ways * COPY_PAGE_INTERLEAVE_GRANULE)
+		return DIV_ROUND_UP(len, COPY_PAGE_CHUNK_SIZE);
+
+	granules = DIV_ROUND_UP(len, COPY_PAGE_INTERLEAVE_GRANULE);
+
+	return ways * DIV_ROUND_UP(DIV_ROUND_UP(granules, ways),
+			COPY_PAGE_INTERLEAVE_PIECES);
+}
+
+static unsigned int copy_page_nr_chunks(struct page **to, struct page **from,
+		int nr_items)
+{
+	unsigned int nr_chunks = 0;
+	int i;
+
+	for (i = 0; i < nr_items; ++i)
+		nr_chunks += copy_page_item_chunks(to[i],
+				PAGE_SIZE * hpage_nr_pages(from[i]));
+
+	return nr_chunks;
+}
+
+/* Make sure the chunk array of @pool can hold @nr_chunks chunks */
+static int copy_page_pool_reserve(struct copy_page_pool *pool,
+		unsigned int nr_chunks)
+{
+	struct copy_item *chunks;
+
+	if (pool->max_chunks >= nr_chunks)
+		return 0;
+
+	chunks = kvmalloc_array(nr_chunks, sizeof(struct copy_item), GFP_KERNEL);
+	if (!chunks)
+		return -ENOMEM;
+
+	kvfree(pool->chunks);
+	pool->chunks = chunks;
+	pool->max_chunks = nr_chunks;
+
+	return 0;
+}
+
+/*
+ * Append the @len bytes copy of @to, mapped at @vto, to the pool chunk
+ * array. An interleaved copy is cut in runs of the granules of each way,
+ * the way of a granule following from its physical address; a copy
+ * smaller than a stripe is a single chunk of the way it starts on.
+ */
+static void copy_page_add_chunks(struct copy_page_pool *pool, struct page *to,
+		char *vto, char *vfrom, unsigned long len, int nt_mode,
+		unsigned int prefetch)
+{
+	unsigned int ways = copy_page_interleave_ways(to);
+	unsigned long first = page_to_phys(to) / COPY_PAGE_INTERLEAVE_GRANULE;
+	unsigned long stride = ways * COPY_PAGE_INTERLEAVE_GRANULE;
+	unsigned long offset, granules;
+	unsigned int way;
+
+	if (!ways || len < stride) {
+		for (offset = 0; offset < len; offset += COPY_PAGE_CHUNK_SIZE) {
+			struct copy_item *chunk = &pool->chunks[pool->nr_chunks++];
+
+			chunk->to = vto + offset;
+			chunk->from = vfrom + offset;
+			chunk->chunk_size = min_t(unsigned long,
+					COPY_PAGE_CHUNK_SIZE, len - offset);
+			chunk->nt_mode = nt_mode;
+			chunk->prefetch = prefetch;
+			chunk->nr = 1;
+			chunk->stride = 0;
+			chunk->way = ways ? (first + offset /
+				COPY_PAGE_INTERLEAVE_GRANULE) % ways : 0;
+		}
+		pool->interleaved |= ways != 0;
+		return;
+	}
+
+	/* a page is a whole number of granules */
+	granules = len / COPY_PAGE_INTERLEAVE_GRANULE;
+	for (way = 0; way < ways; ++way) {
+		/* first granule of the copy on @way */
+		unsigned long g = (way + ways - first % ways) % ways;
+
+		for (; g < granules; g += ways * COPY_PAGE_INTERLEAVE_PIECES) {
+			struct copy_item *chunk = &pool->chunks[pool->nr_chunks++];
+
+			offset = g * COPY_PAGE_INTERLEAVE_GRANULE;
+			chunk->to = vto + offset;
+			chunk->from = vfrom + offset;
+			chunk->chunk_size = COPY_PAGE_INTERLEAVE_GRANULE;
+			chunk->nt_mode = nt_mode;
+			chunk->prefetch = prefetch;
+			chunk->nr = min_t(unsigned long,
+					COPY_PAGE_INTERLEAVE_PIECES,
+					DIV_ROUND_UP(granules - g, ways));
+			chunk->stride = stride;
+			chunk->way = way;
+		}
+	}
+	pool->interleaved = true;
+}
+
+static int copy_item_cmp(const void *a, const void *b)
+{
+	const struct copy_item *x = a, *y = b;
+
+	if (x->way != y->way)
+		return x->way < y->way ? -1 : 1;
+	if (x->to != y->to)
+		return x->to < y->to ? -1 : 1;
+	return 0;
+}
+
+/* ======================== inline fast path ======================== */
+
+/*
+ * Copies of at most this many base pages run on the calling CPU instead
+ * of being handed to the copy workers: waking remote workers and waiting
+ * for them costs more than copying a few pages. -1 picks the cutoff from
+ * the measured dispatch latency, see mt_copy_inline_pages_auto.
+ */
+int sysctl_mt_copy_inline_pages = -1;
+
+#define COPY_PAGE_INLINE_DEFAULT_PAGES	4
+#define COPY_PAGE_INLINE_MAX_PAGES	64
+
+/* cutoff in use when sysctl_mt_copy_inline_pages is -1 */
+unsigned int mt_copy_inline_pages_auto = COPY_PAGE_INLINE_DEFAULT_PAGES;
+
+/* moving averages, in ns, of a worker round trip and of an inline page copy */
+static u64 copy_dispatch_ns_avg;
+static u64 copy_inline_page_ns_avg;
+
+static u64 copy_page_ewma(u64 avg, u64 sample)
+{
+	if (!avg)
+		return sample;
+	return avg - (avg >> 3) + (sample >> 3);
+}
+
+static void copy_page_update_inline_cutoff(unsigned int nr_works)
+{
+	u64 dispatch_ns = READ_ONCE(copy_dispatch_ns_avg);
+	u64 page_ns = READ_ONCE(copy_inline_page_ns_avg);
+	u64 cutoff;
+
+	if (!dispatch_ns || !page_ns || nr_works < 2)
+		return;
+
+	/*
+	 * n pages take n * page_ns inline and about
+	 * dispatch_ns + n * page_ns / nr_works on the workers.
+	 */
+	cutoff = div64_u64(dispatch_ns * nr_works, page_ns * (nr_works - 1));
+	WRITE_ONCE(mt_copy_inline_pages_auto,
+			min_t(u64, cutoff, COPY_PAGE_INLINE_MAX_PAGES));
+}
+
+static void copy_page_account_dispatch(u64 dispatch_ns, unsigned int nr_works)
+{
+	WRITE_ONCE(copy_dispatch_ns_avg,
+			copy_page_ewma(copy_dispatch_ns_avg, dispatch_ns));
+	copy_page_update_inline_cutoff(nr_works);
+}
+
+static bool copy_page_use_inline(int processing_node,
+		unsigned long nr_base_pages)
+{
+	int cutoff = READ_ONCE(sysctl_mt_copy_inline_pages);
+
+	/*
+	 * With RPDAA the workers may run on the socket next to the PMEM
+	 * node, keep using them rather than writing PMEM remotely from here.
+	 */
+	if (processing_node != numa_node_id())
+		return false;
+
+	if (cutoff < 0)
+		cutoff = READ_ONCE(mt_copy_inline_pages_auto);
+
+	return nr_base_pages <= cutoff;
+}
+
+/* Copy the @nr_pages base pages from @from to @to on this CPU */
+static void copy_page_inline_range(struct page *to, struct page *from,
+		unsigned long nr_pages, bool nt)
+{
+	char *vto = kmap(to);
+	char *vfrom = kmap(from);
+
+	copy_page_routine(vto, vfrom, PAGE_SIZE * nr_pages,
+			copy_page_chunk_nt_mode(from, to, nt),
+			page_copy_prefetch(page_to_nid(from)));
+
+	kunmap(from);
+	kunmap(to);
+	count_pmem_write(numa_node_id(), page_to_nid(to), PAGE_SIZE * nr_pages);
+}
+
+static void copy_page_inline_account(u64 start, unsigned long nr_base_pages,
+		unsigned int nr_works)
+{
+	/* an empty list copied nothing to average over */
+	if (!nr_base_pages)
+		return;
+
+	WRITE_ONCE(copy_inline_page_ns_avg,
+			copy_page_ewma(copy_inline_page_ns_avg,
+				div64_u64(ktime_get_ns() - start, nr_base_pages)));
+	copy_page_update_inline_cutoff(nr_works);
+	count_vm_events(PGCOPY_MT_INLINE, nr_base_pages);
+}
+
+static void copy_page_inline(struct page **to, struct page **from,
+		int nr_items, unsigned int nr_works, bool nt)
+{
+	unsigned long nr_base_pages = 0;
+	u64 start = ktime_get_ns();
+	int i;
+
+	for (i = 0; i < nr_items; ++i) {
+		unsigned long nr_pages = hpage_nr_pages(from[i]);
+
+		copy_page_inline_range(to[i], from[i], nr_pages, nt);
+		nr_base_pages += nr_pages;
+	}
+
+	copy_page_inline_account(start, nr_base_pages, nr_works);
+}
+
+/*
+ * Hand the chunks out as nr_works contiguous queues and queue the workers
+ * on the CPUs in @cpu_id_list. Workers that finish their own queue early
+ * steal from the others, so a slow or preempted worker does not hold up
+ * the whole copy.
+ *
+ * There are no more workers than the writer slots of @dst_nid the copy
+ * gets, waiting for one if @wait.
+ */
+static void copy_page_pool_start(struct copy_page_pool *pool,
+		const int *cpu_id_list, int nr_works, int dst_nid, bool wait)
+{
+	int i;
+
+	/*
+	 * At least one worker even without a chunk, it is the one that
+	 * completes @pool->done.
+	 */
+	nr_works = max(min_t(int, nr_works, pool->nr_chunks), 1);
+	nr_works = pmem_writers_get(dst_nid, nr_works, wait);
+	pool->nr_works = nr_works;
+	pool->writer_nid = dst_nid;
+
+	/* the contiguous queues then cover the ways one after the other */
+	if (pool->interleaved)
+		sort(pool->chunks, pool->nr_chunks, sizeof(struct copy_item),
+				copy_item_cmp, NULL);
+
+	for (i = 0; i < nr_works; ++i) {
+		struct copy_page_info *work_item = &pool->work_items[i];
+
+		atomic_set(&work_item->next, pool->nr_chunks * i / nr_works);
+		work_item->end = pool->nr_chunks * (i + 1) / nr_works;
+	}
+
+	reinit_completion(&pool->done);
+	atomic_set(&pool->nr_pending, nr_works);
+	atomic64_set(&pool->worker_ns, 0);
+	pool->first_start_ns = 0;
+	pool->start_ns = ktime_get_ns();
+
+	for (i = 0; i < nr_works; ++i)
+		queue_work_on(cpu_id_list[i], copy_page_wq,
+				&pool->work_items[i].copy_page_work);
+}
+
+static bool copy_page_pool_done(struct copy_page_pool *pool)
+{
+	return completion_done(&pool->done);
+}
+
+/* Wait for the workers queued by copy_page_pool_start() */
+static void copy_page_pool_finish(struct copy_page_pool *pool)
+{
+	wait_for_completion(&pool->done);
+	pool->nr_chunks = 0;
+	pool->interleaved = false;
+	migrate_worker_time_add(atomic64_read(&pool->worker_ns));
+
+	copy_page_account_dispatch(pool->first_start_ns - pool->start_ns +
+			ktime_get_ns() - pool->end_ns, pool->nr_works);
+}
+
+static void copy_page_pool_run(struct copy_page_pool *pool,
+		const int *cpu_id_list, int nr_works, int dst_nid)
+{
+	copy_page_pool_start(pool, cpu_id_list, nr_works, dst_nid, true);
+	copy_page_pool_finish(pool);
+}
+
+static int __init copy_page_pool_init(void)
+{
+	int nid;
+
+	copy_page_wq = alloc_workqueue("copy_page",
+			WQ_HIGHPRI | WQ_MEM_RECLAIM, 0);
+	if (!copy_page_wq)
+		return -ENOMEM;
+
+	for_each_node_state(nid, N_CPU)
+		copy_page_pools[nid] = copy_page_pool_alloc(nid);
+
+	return 0;
+}
+core_initcall(copy_page_pool_init);
+
+/*
+ * Set the copy policy of the migration the current task is about to run
+ * on @mm: the memcg of @mm overrides the sysctl defaults and the
+ * MPOL_MF_COPY_* bits of @flags override the memcg. The previous policy
+ * is saved in @saved for page_copy_policy_exit(). Returns -EINVAL if
+ * @flags asks for a policy and its opposite.
+ */
+int page_copy_policy_enter(struct mm_struct *mm, int flags,
+		struct page_copy_policy *saved)
+{
+	struct page_copy_policy policy = PAGE_COPY_POLICY_DEFAULT;
+	int nr_threads;
+
+	if ((flags & MPOL_MF_COPY_NT) && (flags & MPOL_MF_COPY_NO_NT))
+		return -EINVAL;
+	if ((flags & MPOL_MF_COPY_RPDAA) && (flags & MPOL_MF_COPY_NO_RPDAA))
+		return -EINVAL;
+	nr_threads = (flags & MPOL_MF_COPY_THREADS_MASK) >>
+		MPOL_MF_COPY_THREADS_SHIFT;
+	if (nr_threads > MAX_NR_COPY_THREADS)
+		return -EINVAL;
+
+	if (mm)
+		mem_cgroup_copy_policy(mm, &policy);
+
+	if (flags & (MPOL_MF_COPY_NT | MPOL_MF_COPY_NO_NT))
+		policy.nt = !!(flags & MPOL_MF_COPY_NT);
+	if (flags & (MPOL_MF_COPY_RPDAA | MPOL_MF_COPY_NO_RPDAA))
+		policy.rpdaa = !!(flags & MPOL_MF_COPY_RPDAA);
+	if (nr_threads)
+		policy.nr_threads = nr_threads;
+
+	*saved = current->page_copy_policy;
+	current->page_copy_policy = policy;
+
+	return 0;
+}
+
+void page_copy_policy_exit(const struct page_copy_policy *saved)
+{
+	current->page_copy_policy = *saved;
+}
+
+/*
+ * The CPU node that moves data from @from_node to @to_node fastest
+ * according to the PMEM topology bandwidths. Without them, the socket
+ * local to the PMEM side of the copy so that PMEM is never written
+ * remotely, or the node initiating the migration if neither side is PMEM.
+ */
+int copy_page_rpdaa_node(int from_node, int to_node)
+{
+	int nid;
+
+	nid = pmem_helper_node(from_node, to_node);
+	if (nid != NUMA_NO_NODE)
+		return nid;
+
+	// destination node is PMEM node
+	nid = pmem_nearest_node(to_node);
+	// destination node is not a PMEM node but the source node is
+	if (nid == NUMA_NO_NODE)
+		nid = pmem_nearest_node(from_node);
+
+	return nid == NUMA_NO_NODE ? numa_node_id() : nid;
+}
+
+/*
+ * Pick the node whose CPUs run the copy workers. By default it is the node
+ * initiating the migration; with RPDAA enabled it is the socket local to
+ * the PMEM side of the copy.
+ */
+static int copy_page_processing_node(int from_node, int to_node)
+{
+	if (page_copy_use_rpdaa())
+		return copy_page_rpdaa_node(from_node, to_node);
+
+	return numa_node_id();
+}
+
+/*
+ * Configuration of a multi-threaded copy from @from to @to: the node of
+ * its workers and whether it uses non-temporal accesses. Taken from @cfg
+ * when given, else from the calibrated decisions in copy_engine_auto mode,
+ * else from the sysctls.
+ */
+static void copy_page_mt_config(struct page *from, struct page *to,
+		const struct copy_decision *cfg, int *node, bool *nt)
+{
+	struct copy_decision decision;
+	int from_nid = page_to_nid(from), to_nid = page_to_nid(to);
+
+	if (!cfg && copy_decision_lookup(from_nid, to_nid,
+				PageTransCompound(from), &decision) &&
+	    decision.engine == COPY_ENGINE_MT)
+		cfg = &decision;
+
+	if (!cfg) {
+		*node = copy_page_processing_node(from_nid, to_nid);
+		*nt = page_copy_use_nt();
+		return;
+	}
+
+	*node = cfg->rpdaa ? copy_page_rpdaa_node(from_nid, to_nid) :
+		numa_node_id();
+	*nt = cfg->nt;
+}
+
+/* ======================== socket-local copies ======================== */
+
+/*
+ * With RPDAA, copies that are not multi-threaded are still run on the
+ * socket local to the PMEM side. Each node has one worker that drains a
+ * lock-less queue of requests; callers only kick it when it is not
+ * already running, and it keeps polling the queue for a little while
+ * after it drained it, so that a stream of single page copies costs one
+ * cross-socket wakeup rather than one per page.
+ */
+struct copy_local_req {
+	struct llist_node node;
+	void (*fn)(void *arg);
+	void *arg;
+	struct page_copy_policy policy;
+	u64 worker_ns;
+	struct completion done;
+};
+
+struct copy_local_queue {
+	struct llist_head reqs;
+	struct work_struct work;
+	/* the worker is running and will see new requests */
+	int polling;
+};
+
+/* how long the worker keeps polling for requests once the queue is empty */
+#define COPY_LOCAL_LINGER_NS	(20 * NSEC_PER_USEC)
+
+static struct copy_local_queue copy_local_queues[MAX_NUMNODES];
+
+static void copy_local_run(struct llist_node *reqs)
+{
+	struct copy_local_req *req, *tmp;
+
+	reqs = llist_reverse_order(reqs);
+	llist_for_each_entry_safe(req, tmp, reqs, node) {
+		u64 start = ktime_get_ns();
+
+		current->page_copy_policy = req->policy;
+		req->fn(req->arg);
+		req->worker_ns = ktime_get_ns() - start;
+		complete(&req->done);
+	}
+	current->page_copy_policy = PAGE_COPY_POLICY_DEFAULT;
+}
+
+static void copy_local_work_fn(struct work_struct *work)
+{
+	struct copy_local_queue *q =
+		container_of(work, struct copy_local_queue, work);
+	struct llist_node *reqs;
+	u64 idle_since;
+
+again:
+	WRITE_ONCE(q->polling, 1);
+	idle_since = ktime_get_ns();
+	do {
+		reqs = llist_del_all(&q->reqs);
+		if (reqs) {
+			copy_local_run(reqs);
+			idle_since = ktime_get_ns();
+		} else
+			cpu_relax();
+	} while (ktime_get_ns() - idle_since < COPY_LOCAL_LINGER_NS);
+
+	WRITE_ONCE(q->polling, 0);
+	/* pairs with the barrier of llist_add() in copy_run_on_node() */
+	smp_mb();
+	if (!llist_empty(&q->reqs))
+		goto again;
+}
+
+/*
+ * Run @fn(@arg) on the copy worker of @nid and wait for it to return, for
+ * the copies to or from memory local to @nid issued on another socket.
+ * Returns @nid, or -EAGAIN if the caller should run it itself: this CPU is
+ * already on @nid or @nid has no online CPU. May sleep.
+ */
+static int copy_run_on_node(int nid, void (*fn)(void *arg), void *arg)
+{
+	struct copy_local_queue *q;
+	struct copy_local_req req;
 	int cpu;
-	int err = 0;
 
-	// by default schedult page migration workers on a initiating node
-	per_node_cpumask = cpumask_of_node(node_selected_for_migration_processing = numa_node_id());
-
-	from_node = page_to_nid(from);
-	to_node = page_to_nid(to);
-
-	if(sysctl_enable_page_migration_optimization_avoid_remote_pmem_write){
-		if(get_nearest_cpu_node(to_node)!=-1){
-			// destination node is PMEM node
-			node_selected_for_migration_processing = cpu_to_node(get_nearest_cpu_node(to_node));
-			per_node_cpumask = cpumask_of_node(node_selected_for_migration_processing);
-		}else if(get_nearest_cpu_node(from_node)!=-1){
-			// destination node is not a PMEM node but the source node is
-			node_selected_for_migration_processing = cpu_to_node(get_nearest_cpu_node(from_node));
-			per_node_cpumask = cpumask_of_node(node_selected_for_migration_processing);
+	if (nid < 0 || nid >= MAX_NUMNODES || nid == numa_node_id())
+		return -EAGAIN;
+
+	cpu = cpumask_any_and(cpumask_of_node(nid), cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		return -EAGAIN;
+
+	q = &copy_local_queues[nid];
+	req.fn = fn;
+	req.arg = arg;
+	req.policy = current->page_copy_policy;
+	init_completion(&req.done);
+
+	if (llist_add(&req.node, &q->reqs) && !READ_ONCE(q->polling))
+		queue_work_on(cpu, copy_page_wq, &q->work);
+
+	wait_for_completion(&req.done);
+	migrate_worker_time_add(req.worker_ns);
+
+	return nid;
+}
+
+struct copy_local_pages {
+	struct page *to;
+	struct page *from;
+	int nr_pages;
+	void (*fn)(struct page *to, struct page *from, int nr_pages);
+};
+
+static void copy_local_pages_fn(void *arg)
+{
+	struct copy_local_pages *args = arg;
+
+	args->fn(args->to, args->from, args->nr_pages);
+}
+
+/*
+ * Run @fn(@to, @from, @nr_pages) on the socket local to the PMEM side of
+ * the copy when RPDAA is enabled. Returns the node it ran on, or -EAGAIN
+ * if the caller should run it itself: RPDAA is off, neither side is PMEM
+ * or this CPU is already on the right socket.
+ */
+int copy_page_socket_local(struct page *to, struct page *from, int nr_pages,
+		void (*fn)(struct page *to, struct page *from, int nr_pages))
+{
+	struct copy_local_pages args = {
+		.to = to,
+		.from = from,
+		.nr_pages = nr_pages,
+		.fn = fn,
+	};
+
+	if (!page_copy_use_rpdaa())
+		return -EAGAIN;
+
+	return copy_run_on_node(copy_page_rpdaa_node(page_to_nid(from),
+					page_to_nid(to)),
+				copy_local_pages_fn, &args);
+}
+
+/* Copy @nr_pages base pages of a possibly gigantic page */
+void copy_highpages(struct page *to, struct page *from, int nr_pages)
+{
+	struct page *to_base = to;
+	struct page *from_base = from;
+	int i;
+
+	for (i = 0; i < nr_pages; ) {
+		cond_resched();
+		copy_highpage(to, from);
+
+		i++;
+		to = mem_map_next(to, to_base, i);
+		from = mem_map_next(from, from_base, i);
+	}
+}
+
+static int __init copy_local_init(void)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		init_llist_head(&copy_local_queues[nid].reqs);
+		INIT_WORK(&copy_local_queues[nid].work, copy_local_work_fn);
+	}
+
+	return 0;
+}
+core_initcall(copy_local_init);
+
+/* CPU the next copy on a node starts looking for workers from */
+static unsigned int copy_page_cpu_rotor[MAX_NUMNODES];
+
+static bool copy_page_cpu_usable(int cpu, const struct cpumask *allowed)
+{
+	if (!cpu_online(cpu))
+		return false;
+	/* isolcpus= and nohz_full= CPUs are kept free of kernel work */
+	if (!housekeeping_cpu(cpu, HK_FLAG_DOMAIN) ||
+	    !housekeeping_cpu(cpu, HK_FLAG_TICK))
+		return false;
+
+	return !allowed || cpumask_test_cpu(cpu, allowed);
+}
+
+/*
+ * Fill @cpu_id_list with up to @nr worker CPUs of node @nid, out of those
+ * in the cpuset of the task asking for the copy. Idle CPUs are taken
+ * first, then busy ones, both starting after the CPUs the last copy on
+ * the node took, so that the copies rotate over the node instead of all
+ * landing on its first CPUs. Returns the number of CPUs picked.
+ */
+unsigned int copy_page_pick_cpus(int nid, int *cpu_id_list, unsigned int nr)
+{
+	const struct cpumask *per_node_cpumask = cpumask_of_node(nid);
+	cpumask_var_t allowed;
+	bool has_allowed;
+	unsigned int start, n = 0;
+	int cpu, pass;
+
+	has_allowed = alloc_cpumask_var(&allowed, GFP_NOWAIT | __GFP_NOWARN);
+	if (has_allowed)
+		cpuset_cpus_allowed(current, allowed);
+
+	start = READ_ONCE(copy_page_cpu_rotor[nid]);
+	if (start >= nr_cpu_ids)
+		start = 0;
+
+	for (pass = 0; pass < 2 && n < nr; pass++) {
+		for_each_cpu_wrap(cpu, per_node_cpumask, start) {
+			if (n >= nr)
+				break;
+			/* the idle CPUs in the first pass, the others after */
+			if (idle_cpu(cpu) != !pass)
+				continue;
+			if (!copy_page_cpu_usable(cpu,
+					has_allowed ? allowed : NULL))
+				continue;
+			cpu_id_list[n++] = cpu;
 		}
 	}
 
+	if (n)
+		WRITE_ONCE(copy_page_cpu_rotor[nid], cpu_id_list[n - 1] + 1);
+	if (has_allowed)
+		free_cpumask_var(allowed);
+
+	return n;
+}
+EXPORT_SYMBOL_GPL(copy_page_pick_cpus);
+
+/*
+ * The copy workers also run the rmap walks of concurrent migrations, which
+ * cost more than the copy itself for pages with many mappers.
+ */
+struct copy_page_range_work {
+	struct work_struct work;
+	void (*fn)(void *arg, int start, int end);
+	void *arg;
+	int start;
+	int end;
+	atomic_t *nr_pending;
+	atomic64_t *worker_ns;
+	struct completion *done;
+};
+
+static void copy_page_range_work_fn(struct work_struct *work)
+{
+	struct copy_page_range_work *w =
+		container_of(work, struct copy_page_range_work, work);
+	u64 start = ktime_get_ns();
+
+	w->fn(w->arg, w->start, w->end);
+	atomic64_add(ktime_get_ns() - start, w->worker_ns);
+	if (atomic_dec_and_test(w->nr_pending))
+		complete(w->done);
+}
+
+/*
+ * Split [0, @nr) into one contiguous range per copy thread of node @nid
+ * and run @fn(@arg, start, end) on each, the calling CPU taking the first
+ * range. Falls back to running @fn(@arg, 0, @nr) here if there is a single
+ * thread or the work descriptors cannot be allocated.
+ */
+void copy_page_run_ranges(int nid, int nr,
+		void (*fn)(void *arg, int start, int end), void *arg)
+{
+	const struct cpumask *per_node_cpumask = cpumask_of_node(nid);
+	int cpu_id_list[MAX_NR_COPY_THREADS] = {0};
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct copy_page_range_work *works;
+	atomic64_t worker_ns = ATOMIC64_INIT(0);
+	unsigned int nr_works;
+	atomic_t nr_pending;
+	int i;
+
+	nr_works = min3(page_copy_nr_threads(),
+			cpumask_weight(per_node_cpumask), (unsigned int)nr);
+	nr_works = min_t(unsigned int, nr_works, MAX_NR_COPY_THREADS);
+	if (nr_works <= 1 || !copy_page_wq)
+		goto inline_run;
+
+	nr_works = copy_page_pick_cpus(nid, cpu_id_list, nr_works);
+	if (nr_works <= 1)
+		goto inline_run;
+
+	works = kcalloc(nr_works, sizeof(*works), GFP_NOWAIT | __GFP_NOWARN);
+	if (!works)
+		goto inline_run;
+
+	atomic_set(&nr_pending, nr_works - 1);
+
+	for (i = 1; i < nr_works; i++) {
+		struct copy_page_range_work *w = &works[i];
+
+		INIT_WORK(&w->work, copy_page_range_work_fn);
+		w->fn = fn;
+		w->arg = arg;
+		w->start = nr * i / nr_works;
+		w->end = nr * (i + 1) / nr_works;
+		w->nr_pending = &nr_pending;
+		w->worker_ns = &worker_ns;
+		w->done = &done;
+		queue_work_on(cpu_id_list[i], copy_page_wq, &w->work);
+	}
+
+	fn(arg, 0, nr / nr_works);
+	wait_for_completion(&done);
+	migrate_worker_time_add(atomic64_read(&worker_ns));
+	kfree(works);
+	return;
+
+inline_run:
+	fn(arg, 0, nr);
+}
+EXPORT_SYMBOL_GPL(copy_page_run_ranges);
+
+/* ======================== huge page COW ======================== */
+
+// Smallest huge page, in base pages, COW copied by the copy workers, 0 never
+int sysctl_cow_huge_page_mt_pages = 0;
+
+/*
+ * Copy the huge page @src to @dst for a COW fault at @addr_hint with the
+ * multi-threaded copy engine, whose workers run on the socket local to the
+ * PMEM side with RPDAA. The subpage at @addr_hint is copied again through
+ * the cache at the end, as copy_user_huge_page() copies it last, since it
+ * is about to be touched. Returns false if the copy is left to the caller.
+ */
+bool copy_user_huge_page_mt(struct page *dst, struct page *src,
+		unsigned long addr_hint, struct vm_area_struct *vma,
+		unsigned int pages_per_huge_page)
+{
+	int min_pages = READ_ONCE(sysctl_cow_huge_page_mt_pages);
+	int target;
+
+	if (!min_pages || pages_per_huge_page < min_pages ||
+	    hpage_nr_pages(src) != pages_per_huge_page)
+		return false;
+
+	if (copy_page_lists_mt(&dst, &src, 1))
+		return false;
+
+	target = (addr_hint >> PAGE_SHIFT) & (pages_per_huge_page - 1);
+	copy_user_highpage(dst + target, src + target, addr_hint & PAGE_MASK,
+			vma);
+
+	return true;
+}
+
+/* ======================== huge page clearing ======================== */
+
+/*
+ * How huge pages faulted in on a slow tier node are zeroed: 0 with cached
+ * stores by the faulting CPU, 1 with streaming stores by the faulting CPU,
+ * 2 with streaming stores by the copy workers, on the socket local to the
+ * node with RPDAA
+ */
+int sysctl_clear_huge_page_nt = 0;
+
+struct clear_huge_page_args {
+	struct page *page;
+	int target;		/* left for the caller to clear through the cache */
+};
+
+static void clear_huge_page_range(void *arg, int start, int end)
+{
+	struct clear_huge_page_args *args = arg;
+	const struct page_copy_engine *engine = current_page_copy_engine();
+	char *vto;
+	int i;
+
+	for (i = start; i < end; i++) {
+		if (i == args->target)
+			continue;
+
+		cond_resched();
+		vto = kmap_atomic(args->page + i);
+		kernel_fpu_begin();
+		engine->clear(vto, PAGE_SIZE);
+		kernel_fpu_end();
+		kunmap_atomic(vto);
+	}
+
+	/* streaming stores are weakly ordered */
+	wmb();
+}
+
+/* Zero @nr_pages pages from @page with streaming stores on this CPU */
+void clear_pages_nt(struct page *page, unsigned int nr_pages)
+{
+	struct clear_huge_page_args args = {
+		.page = page,
+		.target = -1,
+	};
+
+	clear_huge_page_range(&args, 0, nr_pages);
+}
+
+/*
+ * Zero the huge page @page on a slow tier node with streaming stores, the
+ * subpage at @addr_hint last and through the cache as clear_huge_page()
+ * does, since it is about to be touched. Returns false if
+ * vm.clear_huge_page_nt leaves @page to clear_huge_page().
+ */
+bool clear_huge_page_nt(struct page *page, unsigned long addr_hint,
+		unsigned int pages_per_huge_page)
+{
+	int mode = READ_ONCE(sysctl_clear_huge_page_nt);
+	struct clear_huge_page_args args;
+	int nid = page_to_nid(page);
+	int cpu_nid = numa_node_id();
+
+	if (!mode || !node_is_slow_tier(nid))
+		return false;
+
+	args.page = page;
+	args.target = (addr_hint >> PAGE_SHIFT) & (pages_per_huge_page - 1);
+
+	if (mode == 1) {
+		clear_huge_page_range(&args, 0, pages_per_huge_page);
+	} else {
+		if (page_copy_use_rpdaa())
+			cpu_nid = copy_page_rpdaa_node(nid, nid);
+		copy_page_run_ranges(cpu_nid, pages_per_huge_page,
+				clear_huge_page_range, &args);
+	}
+	count_pmem_write(cpu_nid, nid,
+			(u64)(pages_per_huge_page - 1) << PAGE_SHIFT);
+
+	clear_user_highpage(page + args.target, addr_hint & PAGE_MASK);
+
+	return true;
+}
+
+int copy_page_multithread(struct page *to, struct page *from, int nr_pages)
+{
+	unsigned int total_mt_num = page_copy_nr_threads();
+	int node_selected_for_migration_processing;
+	struct copy_page_pool *pool;
+	char *vto, *vfrom;
+	const struct cpumask *per_node_cpumask;
+	int cpu_id_list[MAX_NR_COPY_THREADS] = {0};
+	u64 start = 0;
+	bool nt;
+	int err = 0;
+
+	copy_page_mt_config(from, to, NULL,
+			&node_selected_for_migration_processing, &nt);
+	per_node_cpumask = cpumask_of_node(node_selected_for_migration_processing);
+
+	/* a gigantic page is worth every CPU of the node */
+	if (nr_pages > MAX_ORDER_NR_PAGES)
+		total_mt_num = MAX_NR_COPY_THREADS;
+
 	total_mt_num = min_t(unsigned int, total_mt_num,
 						 cpumask_weight(per_node_cpumask));
-	if (total_mt_num > 1)
-		total_mt_num = (total_mt_num / 2) * 2;
 
-	if (total_mt_num > 32 || total_mt_num < 1)
+	if (total_mt_num > MAX_NR_COPY_THREADS || total_mt_num < 1)
 		return -ENODEV;
 
-	for (cpu = 0; cpu < total_mt_num; ++cpu) {
-		work_items[cpu] = kzalloc(sizeof(struct copy_page_info)
-						+ sizeof(struct copy_item), GFP_KERNEL);
-		if (!work_items[cpu]) {
-			err = -ENOMEM;
-			goto free_work_items;
-		}
+	total_mt_num = copy_page_pick_cpus(node_selected_for_migration_processing,
+			cpu_id_list, total_mt_num);
+	if (!total_mt_num)
+		return -ENODEV;
+
+	trace_mm_migrate_copy_dispatch(MIGRATE_ENGINE_MT, page_to_nid(from),
+			page_to_nid(to), node_selected_for_migration_processing,
+			1, PAGE_SIZE * nr_pages, ilog2(nr_pages), nt);
+	if (trace_mm_migrate_copy_done_enabled())
+		start = ktime_get_ns();
+
+	/* @to and @from may be a range of subpages, see copy_page_hybrid() */
+	if (copy_page_use_inline(node_selected_for_migration_processing,
+				nr_pages)) {
+		u64 inline_start = ktime_get_ns();
+
+		copy_page_inline_range(to, from, nr_pages, nt);
+		copy_page_inline_account(inline_start, nr_pages, total_mt_num);
+		goto out;
+	}
+
+	pool = copy_page_pool_get(node_selected_for_migration_processing);
+	if (!pool) {
+		err = -ENOMEM;
+		goto out;
 	}
 
-	i = 0;
-	for_each_cpu(cpu, per_node_cpumask) {
-		if (i >= total_mt_num)
-			break;
-		cpu_id_list[i] = cpu;
-		++i;
-	}
+	err = copy_page_pool_reserve(pool,
+			copy_page_item_chunks(to, PAGE_SIZE * nr_pages));
+	if (err)
+		goto put_pool;
 
 	vfrom = kmap(from);
 	vto = kmap(to);
-	chunk_size = PAGE_SIZE*nr_pages / total_mt_num;
-
-	for (i = 0; i < total_mt_num; ++i) {
-		INIT_WORK((struct work_struct *)work_items[i],
-				  copy_page_work_queue_thread);
-
-		work_items[i]->num_items = 1;
-		work_items[i]->item_list[0].to = vto + i * chunk_size;
-		work_items[i]->item_list[0].from = vfrom + i * chunk_size;
-		work_items[i]->item_list[0].chunk_size = chunk_size;
 
-		queue_work_on(cpu_id_list[i],
-					  system_highpri_wq,
-					  (struct work_struct *)work_items[i]);
-	}
-
-	/* Wait until it finishes  */
-	for (i = 0; i < total_mt_num; ++i)
-		flush_work((struct work_struct *)work_items[i]);
+	copy_page_add_chunks(pool, to, vto, vfrom, PAGE_SIZE * nr_pages,
+			copy_page_chunk_nt_mode(from, to, nt),
+			page_copy_prefetch(page_to_nid(from)));
+	copy_page_pool_run(pool, cpu_id_list, total_mt_num, page_to_nid(to));
+	count_vm_events(PGCOPY_MT_DISPATCHED, nr_pages);
+	count_pmem_write(node_selected_for_migration_processing,
+			page_to_nid(to), PAGE_SIZE * nr_pages);
 
 	kunmap(to);
 	kunmap(from);
 
-free_work_items:
-	for (cpu = 0; cpu < total_mt_num; ++cpu)
-		if (work_items[cpu])
-			kfree(work_items[cpu]);
+put_pool:
+	copy_page_pool_put(pool);
+out:
+	if (start)
+		trace_mm_migrate_copy_done(MIGRATE_ENGINE_MT, page_to_nid(from),
+				page_to_nid(to), PAGE_SIZE * nr_pages,
+				ktime_get_ns() - start, err);
 
 	return err;
 }
 
-int copy_page_lists_mt(struct page **to, struct page **from, int nr_items)
+/*
+ * Start a multi-threaded copy of the page lists, configured by @cfg or by
+ * copy_page_mt_config() if NULL. Returns the pool whose workers run the
+ * copy, to be passed to copy_page_lists_mt_finish(), or NULL if the copy
+ * was small enough to be done inline and is complete. @wait is false for
+ * the asynchronous copies, which must not sleep on writer slots.
+ */
+static struct copy_page_pool *copy_page_lists_mt_start(struct page **to,
+		struct page **from, int nr_items, const struct copy_decision *cfg,
+		bool wait)
 {
 	int err = 0;
-	unsigned int total_mt_num = limit_mt_num;
-	int to_node, from_node, node_selected_for_migration_processing;
+	unsigned int total_mt_num = page_copy_nr_threads();
+	int node_selected_for_migration_processing;
+	unsigned long nr_base_pages = 0;
 	int i;
-	struct copy_page_info *work_items[32] = {0};
+	struct copy_page_pool *pool;
 	const struct cpumask *per_node_cpumask;
-	int cpu_id_list[32] = {0};
-	int cpu;
-	int max_items_per_thread;
-	int item_idx;
-
-	from_node = page_to_nid(*from);
-	to_node = page_to_nid(*to);
-
-	per_node_cpumask = cpumask_of_node(node_selected_for_migration_processing=numa_node_id());
-
-	if(sysctl_enable_page_migration_optimization_avoid_remote_pmem_write){
-		if(get_nearest_cpu_node(to_node)!=-1){
-			// destination node is PMEM node
-			node_selected_for_migration_processing = cpu_to_node(get_nearest_cpu_node(to_node));
-			per_node_cpumask = cpumask_of_node(node_selected_for_migration_processing);
-		} else if(get_nearest_cpu_node(from_node)!=-1) {
-			// destination node is not a PMEM node but the source node is
-			node_selected_for_migration_processing = cpu_to_node(get_nearest_cpu_node(from_node));
-			per_node_cpumask = cpumask_of_node(node_selected_for_migration_processing);
-		}
-	}
+	int cpu_id_list[MAX_NR_COPY_THREADS] = {0};
+	bool nt;
+
+	copy_page_mt_config(*from, *to, cfg,
+			&node_selected_for_migration_processing, &nt);
+	per_node_cpumask = cpumask_of_node(node_selected_for_migration_processing);
 
 	total_mt_num = min_t(unsigned int, total_mt_num,
 						 cpumask_weight(per_node_cpumask));
 
+	if (total_mt_num > MAX_NR_COPY_THREADS || total_mt_num < 1)
+		return ERR_PTR(-ENODEV);
 
-	if (total_mt_num > 32 || total_mt_num < 1)
-		return -ENODEV;
+	total_mt_num = copy_page_pick_cpus(node_selected_for_migration_processing,
+			cpu_id_list, total_mt_num);
+	if (!total_mt_num)
+		return ERR_PTR(-ENODEV);
 
-	/* Each threads get part of each page, if nr_items < totla_mt_num */
-	if (nr_items < total_mt_num)
-		max_items_per_thread = nr_items;
-	else
-		max_items_per_thread = (nr_items / total_mt_num) +
-				((nr_items % total_mt_num)?1:0);
+	for (i = 0; i < nr_items; ++i) {
+		BUG_ON(hpage_nr_pages(to[i]) != hpage_nr_pages(from[i]));
+		nr_base_pages += hpage_nr_pages(from[i]);
+	}
 
+	trace_mm_migrate_copy_dispatch(MIGRATE_ENGINE_MT, page_to_nid(*from),
+			page_to_nid(*to), node_selected_for_migration_processing,
+			nr_items, nr_base_pages << PAGE_SHIFT,
+			compound_order(*from), nt);
 
-	for (cpu = 0; cpu < total_mt_num; ++cpu) {
-		work_items[cpu] = kzalloc(sizeof(struct copy_page_info) +
-					sizeof(struct copy_item)*max_items_per_thread, GFP_KERNEL);
-		if (!work_items[cpu]) {
-			err = -ENOMEM;
-			goto free_work_items;
-		}
+	if (copy_page_use_inline(node_selected_for_migration_processing,
+				nr_base_pages)) {
+		copy_page_inline(to, from, nr_items, total_mt_num, nt);
+		return NULL;
 	}
 
-	i = 0;
-	for_each_cpu(cpu, per_node_cpumask) {
-		if (i >= total_mt_num)
-			break;
-		cpu_id_list[i] = cpu;
-		++i;
+	pool = copy_page_pool_get(node_selected_for_migration_processing);
+	if (!pool)
+		return ERR_PTR(-ENOMEM);
+
+	err = copy_page_pool_reserve(pool,
+			copy_page_nr_chunks(to, from, nr_items));
+	if (err) {
+		copy_page_pool_put(pool);
+		return ERR_PTR(err);
 	}
 
-	if (nr_items < total_mt_num) {
-		for (cpu = 0; cpu < total_mt_num; ++cpu) {
-			INIT_WORK((struct work_struct *)work_items[cpu],
-					  copy_page_work_queue_thread);
-			work_items[cpu]->num_items = max_items_per_thread;
-		}
+	/*
+	 * Mixed batches of THPs and base pages end up as a single queue of
+	 * similar sized chunks, so the workers stay busy until the very end.
+	 */
+	for (i = 0; i < nr_items; ++i) {
+		copy_page_add_chunks(pool, to[i], kmap(to[i]), kmap(from[i]),
+				PAGE_SIZE * hpage_nr_pages(from[i]),
+				copy_page_chunk_nt_mode(from[i], to[i], nt),
+				page_copy_prefetch(page_to_nid(from[i])));
+	}
 
-		for (item_idx = 0; item_idx < nr_items; ++item_idx) {
-			unsigned long chunk_size = PAGE_SIZE * hpage_nr_pages(from[item_idx]) / total_mt_num;
-			char *vfrom = kmap(from[item_idx]);
-			char *vto = kmap(to[item_idx]);
-			VM_BUG_ON(PAGE_SIZE * hpage_nr_pages(from[item_idx]) % total_mt_num);
-			BUG_ON(hpage_nr_pages(to[item_idx]) !=
-				   hpage_nr_pages(from[item_idx]));
-
-			for (cpu = 0; cpu < total_mt_num; ++cpu) {
-				work_items[cpu]->item_list[item_idx].to = vto + chunk_size * cpu;
-				work_items[cpu]->item_list[item_idx].from = vfrom + chunk_size * cpu;
-				work_items[cpu]->item_list[item_idx].chunk_size =
-					chunk_size;
-			}
-		}
+	pool->nr_base_pages = nr_base_pages;
+	pool->cpu_nid = node_selected_for_migration_processing;
+	copy_page_pool_start(pool, cpu_id_list, total_mt_num, page_to_nid(*to),
+			wait);
 
-		for (cpu = 0; cpu < total_mt_num; ++cpu)
-			queue_work_on(cpu_id_list[cpu],
-						  system_highpri_wq,
-						  (struct work_struct *)work_items[cpu]);
-	} else {
-		item_idx = 0;
-		for (cpu = 0; cpu < total_mt_num; ++cpu) {
-			int num_xfer_per_thread = nr_items / total_mt_num;
-			int per_cpu_item_idx;
-
-			if (cpu < (nr_items % total_mt_num))
-				num_xfer_per_thread += 1;
-
-			INIT_WORK((struct work_struct *)work_items[cpu],
-					  copy_page_work_queue_thread);
-
-			work_items[cpu]->num_items = num_xfer_per_thread;
-			for (per_cpu_item_idx = 0; per_cpu_item_idx < work_items[cpu]->num_items;
-				 ++per_cpu_item_idx, ++item_idx) {
-				work_items[cpu]->item_list[per_cpu_item_idx].to = kmap(to[item_idx]);
-				work_items[cpu]->item_list[per_cpu_item_idx].from =
-					kmap(from[item_idx]);
-				work_items[cpu]->item_list[per_cpu_item_idx].chunk_size =
-					PAGE_SIZE * hpage_nr_pages(from[item_idx]);
-
-				BUG_ON(hpage_nr_pages(to[item_idx]) !=
-					   hpage_nr_pages(from[item_idx]));
-			}
+	return pool;
+}
 
-			queue_work_on(cpu_id_list[cpu],
-						  system_highpri_wq,
-						  (struct work_struct *)work_items[cpu]);
-		}
-		if (item_idx != nr_items)
-			pr_err("%s: only %d out of %d pages are transferred\n", __func__,
-				item_idx - 1, nr_items);
-	}
+/* Returns how long, in ns, the workers took from being queued to done */
+static u64 copy_page_lists_mt_finish(struct page **to, struct page **from,
+		int nr_items, struct copy_page_pool *pool)
+{
+	u64 busy_ns;
+	int i;
 
 	/* Wait until it finishes  */
-	for (i = 0; i < total_mt_num; ++i)
-		flush_work((struct work_struct *)work_items[i]);
+	copy_page_pool_finish(pool);
+	count_vm_events(PGCOPY_MT_DISPATCHED, pool->nr_base_pages);
+	count_pmem_write(pool->cpu_nid, pool->writer_nid,
+			(u64)pool->nr_base_pages << PAGE_SHIFT);
+	busy_ns = pool->end_ns - pool->start_ns;
 
 	for (i = 0; i < nr_items; ++i) {
 			kunmap(to[i]);
 			kunmap(from[i]);
 	}
 
-free_work_items:
-	for (cpu = 0; cpu < total_mt_num; ++cpu)
-		if (work_items[cpu])
-			kfree(work_items[cpu]);
+	copy_page_pool_put(pool);
 
-	return err;
+	return busy_ns;
+}
+
+/* Multi-threaded list copy with an explicit configuration, for calibration */
+int copy_page_lists_mt_config(struct page **to, struct page **from,
+		int nr_items, const struct copy_decision *cfg)
+{
+	struct copy_page_pool *pool;
+
+	pool = copy_page_lists_mt_start(to, from, nr_items, cfg, true);
+	if (IS_ERR_OR_NULL(pool))
+		return PTR_ERR_OR_ZERO(pool);
+
+	copy_page_lists_mt_finish(to, from, nr_items, pool);
+
+	return 0;
+}
+
+int copy_page_lists_mt(struct page **to, struct page **from, int nr_items)
+{
+	return copy_page_lists_mt_config(to, from, nr_items, NULL);
 }
+
 /* ======================== DMA copy page ======================== */
 #include <linux/dmaengine.h>
 #include <linux/dma-mapping.h>
+#include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
 
 #define NUM_AVAIL_DMA_CHAN 16
 
 
 int use_all_dma_chans = 0;
 int limit_dma_chans = NUM_AVAIL_DMA_CHAN;
+// Copy page lists with one scatter-gather mapped descriptor chain per channel
+int dma_batch_page_copy = 1;
+
+
+/*
+ * DMA_MEMCPY channels used for page migration, grouped by the node the
+ * DMA engine sits on. The channels are grabbed at boot, and the pool is
+ * rescanned whenever use_all_dma_chans is written or a copy finds no
+ * channel at all, so engines that show up later (ioatdma loaded as a
+ * module, hotplugged devices) get picked up.
+ *
+ * Copies hold copy_dma_sem for read while they use the channels.
+ */
+/* PMD sized, the largest page exchanged on the DMA channels */
+#define COPY_DMA_BOUNCE_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+
+/* Bounce buffer of a channel for DMA page exchange */
+struct copy_dma_bounce {
+	struct mutex lock;
+	struct page *page;	/* allocated on first use */
+};
+
+/*
+ * Utilization of a channel: it is busy while at least one copy has
+ * transfers queued on it, see the copy_page/dma_chans debugfs file.
+ */
+struct copy_dma_chan_stat {
+	spinlock_t lock;
+	int nr_active;
+	int max_active;
+	u64 active_since;
+	u64 busy_ns;
+	u64 bytes;
+	unsigned long nr_xfers;
+};
+
+struct copy_dma_chans {
+	int nr_chans;
+	atomic_t next;
+	struct dma_chan *chans[NUM_AVAIL_DMA_CHAN];
+	struct copy_dma_bounce bounce[NUM_AVAIL_DMA_CHAN];
+	struct copy_dma_chan_stat stat[NUM_AVAIL_DMA_CHAN];
+};
+
+static struct copy_dma_chans copy_dma_pool[MAX_NUMNODES];
+static DECLARE_RWSEM(copy_dma_sem);
+static bool copy_dma_engine_ref;
+static int copy_dma_nr_chans;
+static unsigned long copy_dma_last_scan;
+
+static int copy_dma_chan_node(struct dma_chan *chan)
+{
+	int nid = dev_to_node(chan->device->dev);
+
+	return nid == NUMA_NO_NODE ? first_online_node : nid;
+}
 
+/*
+ * Only take channels whose node still has room in the pool, as many per
+ * node as vm.limit_dma_chans lets a copy use, so the others stay free for
+ * the rest of the system.
+ */
+static bool copy_dma_filter(struct dma_chan *chan, void *param)
+{
+	int limit = clamp(READ_ONCE(limit_dma_chans), 1, NUM_AVAIL_DMA_CHAN);
+
+	return copy_dma_pool[copy_dma_chan_node(chan)].nr_chans < limit;
+}
+
+/* Add every DMA_MEMCPY channel not taken yet to the pool */
+static void copy_dma_pool_scan(void)
+{
+	dma_cap_mask_t copy_mask;
+	struct dma_chan *chan;
+
+	down_write(&copy_dma_sem);
+
+	dma_cap_zero(copy_mask);
+	dma_cap_set(DMA_MEMCPY, copy_mask);
+
+	if (!copy_dma_engine_ref) {
+		dmaengine_get();
+		copy_dma_engine_ref = true;
+	}
+
+	while ((chan = dma_request_channel(copy_mask, copy_dma_filter, NULL))) {
+		struct copy_dma_chans *pool = &copy_dma_pool[copy_dma_chan_node(chan)];
+
+		pool->chans[pool->nr_chans++] = chan;
+		copy_dma_nr_chans++;
+	}
+
+	copy_dma_last_scan = jiffies;
+
+	up_write(&copy_dma_sem);
+
+	pr_debug("page migration: %d DMA channels\n", copy_dma_nr_chans);
+}
+
+/* A copy queued @nr_xfers transfers of @bytes in total on channel @i */
+static void copy_dma_chan_queued(struct copy_dma_chans *chans, int i,
+		u64 bytes, unsigned long nr_xfers)
+{
+	struct copy_dma_chan_stat *stat = &chans->stat[i];
+
+	spin_lock(&stat->lock);
+	if (!stat->nr_active++)
+		stat->active_since = ktime_get_ns();
+	stat->max_active = max(stat->max_active, stat->nr_active);
+	stat->bytes += bytes;
+	stat->nr_xfers += nr_xfers;
+	spin_unlock(&stat->lock);
+}
+
+/* The transfers a copy queued on channel @i completed at @now */
+static void copy_dma_chan_completed(struct copy_dma_chans *chans, int i,
+		u64 now)
+{
+	struct copy_dma_chan_stat *stat = &chans->stat[i];
+
+	spin_lock(&stat->lock);
+	if (!--stat->nr_active && now > stat->active_since)
+		stat->busy_ns += now - stat->active_since;
+	spin_unlock(&stat->lock);
+}
+
+static int __init copy_dma_pool_init(void)
+{
+	int nid, i;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++)
+		for (i = 0; i < NUM_AVAIL_DMA_CHAN; i++) {
+			mutex_init(&copy_dma_pool[nid].bounce[i].lock);
+			spin_lock_init(&copy_dma_pool[nid].stat[i].lock);
+		}
+
+	copy_dma_pool_scan();
+	return 0;
+}
+late_initcall_sync(copy_dma_pool_init);
+
+/* Node of the CPU socket next to @nid, @nid itself when it has CPUs */
+static int copy_dma_socket(int nid)
+{
+	int cpu_node = pmem_nearest_node(nid);
+
+	return cpu_node != NUMA_NO_NODE ? cpu_node : nid;
+}
+
+/*
+ * Pick the channels for a copy from @from_nid to @to_nid: those of the
+ * destination socket, or with RPDAA those of the PMEM side of the copy,
+ * then those of the other socket, then the nearest node that has any.
+ * Returns NULL if there are no channels at all. Called with copy_dma_sem
+ * held for read.
+ */
+static struct copy_dma_chans *copy_dma_pick_chans(int from_nid, int to_nid)
+{
+	int first = copy_dma_socket(to_nid);
+	int second = copy_dma_socket(from_nid);
+	int best = NUMA_NO_NODE;
+	int nid;
+
+	if (page_copy_use_rpdaa() &&
+	    pmem_nearest_node(to_nid) == NUMA_NO_NODE &&
+	    pmem_nearest_node(from_nid) != NUMA_NO_NODE)
+		swap(first, second);
+
+	if (copy_dma_pool[first].nr_chans)
+		return &copy_dma_pool[first];
+	if (copy_dma_pool[second].nr_chans)
+		return &copy_dma_pool[second];
+
+	for_each_node(nid) {
+		if (!copy_dma_pool[nid].nr_chans)
+			continue;
+		if (best == NUMA_NO_NODE ||
+		    node_distance(first, nid) < node_distance(first, best))
+			best = nid;
+	}
+
+	return best == NUMA_NO_NODE ? NULL : &copy_dma_pool[best];
+}
+
+/*
+ * Take copy_dma_sem for read and return the channels for the copy, or
+ * NULL with the semaphore released when there is no channel. An empty
+ * pool is rescanned at most once a second.
+ */
+static struct copy_dma_chans *copy_dma_get_chans(int from_nid, int to_nid)
+{
+	struct copy_dma_chans *chans;
+
+	if (!READ_ONCE(copy_dma_nr_chans) &&
+	    time_after(jiffies, READ_ONCE(copy_dma_last_scan) + HZ))
+		copy_dma_pool_scan();
+
+	down_read(&copy_dma_sem);
+	chans = copy_dma_pick_chans(from_nid, to_nid);
+	if (!chans)
+		up_read(&copy_dma_sem);
+
+	return chans;
+}
+
+static void copy_dma_put_chans(struct copy_dma_chans *chans)
+{
+	up_read(&copy_dma_sem);
+}
+
+/* Number of channels of @chans a copy spreads over, a power of 2 */
+static int copy_dma_nr_usable(struct copy_dma_chans *chans)
+{
+	int total_available_chans = chans->nr_chans;
+
+	if (limit_dma_chans < total_available_chans)
+		total_available_chans = limit_dma_chans;
+	if (total_available_chans < 1)
+		total_available_chans = 1;
+
+	/* round down to closest 2^x value  */
+	return 1<<ilog2(total_available_chans);
+}
+
+/*
+ * A channel of the pool for a copy to @nid outside of page migration,
+ * taken round robin among those of the socket of @nid, or of the nearest
+ * node that has any. Channels never leave the pool, the one returned
+ * stays usable until shutdown. Returns NULL if there is no channel.
+ */
+struct dma_chan *copy_dma_pick_chan(int nid)
+{
+	struct copy_dma_chans *chans;
+	struct dma_chan *chan;
 
-struct dma_chan *copy_chan[NUM_AVAIL_DMA_CHAN] = {0};
-struct dma_device *copy_dev[NUM_AVAIL_DMA_CHAN] = {0};
+	chans = copy_dma_get_chans(nid, nid);
+	if (!chans)
+		return NULL;
 
+	chan = chans->chans[(unsigned int)atomic_inc_return(&chans->next) %
+			    chans->nr_chans];
+	copy_dma_put_chans(chans);
 
+	return chan;
+}
+EXPORT_SYMBOL_GPL(copy_dma_pick_chan);
 
 #ifdef CONFIG_PROC_SYSCTL
 int proc_dointvec_minmax(struct ctl_table *table, int write,
@@ -325,8 +1710,6 @@ int sysctl_dma_page_migration(struct ctl_table *table, int write,
 				 loff_t *ppos)
 {
 	int err = 0;
-	int use_all_dma_chans_prior_val = use_all_dma_chans;
-	dma_cap_mask_t copy_mask;
 
 	if (write && !capable(CAP_SYS_ADMIN))
 		return -EPERM;
@@ -335,95 +1718,45 @@ int sysctl_dma_page_migration(struct ctl_table *table, int write,
 
 	if (err < 0)
 		return err;
-	if (write) {
-		/* Grab all DMA channels  */
-		if (use_all_dma_chans_prior_val == 0 && use_all_dma_chans == 1) {
-			int i;
-
-			dma_cap_zero(copy_mask);
-			dma_cap_set(DMA_MEMCPY, copy_mask);
-
-			dmaengine_get();
-			for (i = 0; i < NUM_AVAIL_DMA_CHAN; ++i) {
-				if (!copy_chan[i]) {
-					copy_chan[i] = dma_request_channel(copy_mask, NULL, NULL);
-				}
-				if (!copy_chan[i]) {
-					pr_err("%s: cannot grab channel: %d\n", __func__, i);
-					continue;
-				}
-
-				copy_dev[i] = copy_chan[i]->device;
-
-				if (!copy_dev[i]) {
-					pr_err("%s: no device: %d\n", __func__, i);
-					continue;
-				}
-			}
-
-		}
-		/* Release all DMA channels  */
-		else if (use_all_dma_chans_prior_val == 1 && use_all_dma_chans == 0) {
-			int i;
-
-			for (i = 0; i < NUM_AVAIL_DMA_CHAN; ++i) {
-				if (copy_chan[i]) {
-					dma_release_channel(copy_chan[i]);
-					copy_chan[i] = NULL;
-					copy_dev[i] = NULL;
-				}
-			}
+	/* Pick up DMA channels that appeared since the last scan */
+	if (write)
+		copy_dma_pool_scan();
 
-			dmaengine_put();
-		}
-
-		if (err)
-			use_all_dma_chans = use_all_dma_chans_prior_val;
-	}
 	return err;
 }
 
 #endif
 
-static int copy_page_dma_once(struct page *to, struct page *from, int nr_pages)
+/* A copy queued on a single channel of @chans, see copy_page_dma_submit() */
+struct copy_page_dma_once {
+	struct dmaengine_unmap_data *unmap;
+	dma_cookie_t cookie;
+	int chan;
+};
+
+/* Queue the copy of @nr_pages base pages from @from on one channel */
+static int copy_page_dma_submit(struct page *to, struct page *from,
+		int nr_pages, struct copy_dma_chans *chans,
+		struct copy_page_dma_once *once)
 {
-	static struct dma_chan *copy_chan = NULL;
+	struct dma_chan *copy_chan;
 	struct dma_device *device = NULL;
 	struct dma_async_tx_descriptor *tx = NULL;
 	dma_cookie_t cookie;
 	enum dma_ctrl_flags flags = 0;
 	struct dmaengine_unmap_data *unmap = NULL;
-	dma_cap_mask_t mask;
 	int ret_val = 0;
+	int i;
 
-
-	dma_cap_zero(mask);
-	dma_cap_set(DMA_MEMCPY, mask);
-
-	dmaengine_get();
-
-	copy_chan = dma_request_channel(mask, NULL, NULL);
-
-	if (!copy_chan) {
-		pr_err("%s: cannot get a channel\n", __func__);
-		ret_val = -1;
-		goto no_chan;
-	}
-
+	i = (unsigned int)atomic_inc_return(&chans->next) % chans->nr_chans;
+	copy_chan = chans->chans[i];
 	device = copy_chan->device;
 
-	if (!device) {
-		pr_err("%s: cannot get a device\n", __func__);
-		ret_val = -2;
-		goto release;
-	}
-
 	unmap = dmaengine_get_unmap_data(device->dev, 2, GFP_NOWAIT);
 
 	if (!unmap) {
 		pr_err("%s: cannot get unmap data\n", __func__);
-		ret_val = -3;
-		goto release;
+		return -3;
 	}
 
 	unmap->to_cnt = 1;
@@ -452,54 +1785,72 @@ static int copy_page_dma_once(struct page *to, struct page *from, int nr_pages)
 		ret_val = -5;
 		goto unmap_dma;
 	}
+	copy_dma_chan_queued(chans, i, unmap->len, 1);
 
-	if (dma_sync_wait(copy_chan, cookie) != DMA_COMPLETE) {
-		pr_err("%s: dma does not complete properly\n", __func__);
-		ret_val = -6;
-	}
+	once->unmap = unmap;
+	once->cookie = cookie;
+	once->chan = i;
+
+	return 0;
 
 unmap_dma:
 	dmaengine_unmap_put(unmap);
-release:
-	if (copy_chan) {
-		dma_release_channel(copy_chan);
+
+	return ret_val;
+}
+
+/* Wait for the copy copy_page_dma_submit() queued */
+static int copy_page_dma_wait(struct copy_dma_chans *chans,
+		struct copy_page_dma_once *once)
+{
+	int ret_val = 0;
+
+	if (dma_sync_wait(chans->chans[once->chan], once->cookie) !=
+	    DMA_COMPLETE) {
+		pr_err("%s: dma does not complete properly\n", __func__);
+		ret_val = -6;
 	}
-no_chan:
-	dmaengine_put();
+	copy_dma_chan_completed(chans, once->chan, ktime_get_ns());
+	dmaengine_unmap_put(once->unmap);
 
 	return ret_val;
 }
 
-static int copy_page_dma_always(struct page *to, struct page *from, int nr_pages)
+/* Copy the page with a single channel of @chans */
+static int copy_page_dma_once(struct page *to, struct page *from, int nr_pages,
+		struct copy_dma_chans *chans)
+{
+	struct copy_page_dma_once once;
+	int ret_val;
+
+	ret_val = copy_page_dma_submit(to, from, nr_pages, chans, &once);
+	if (ret_val)
+		return ret_val;
+
+	return copy_page_dma_wait(chans, &once);
+}
+
+/* Split the page over all the usable channels of @chans */
+static int copy_page_dma_always(struct page *to, struct page *from, int nr_pages,
+		struct copy_dma_chans *chans)
 {
 	struct dma_async_tx_descriptor *tx[NUM_AVAIL_DMA_CHAN] = {0};
 	dma_cookie_t cookie[NUM_AVAIL_DMA_CHAN];
 	enum dma_ctrl_flags flags[NUM_AVAIL_DMA_CHAN] = {0};
 	struct dmaengine_unmap_data *unmap[NUM_AVAIL_DMA_CHAN] = {0};
+	struct dma_chan **copy_chan = chans->chans;
 	int ret_val = 0;
-	int total_available_chans = NUM_AVAIL_DMA_CHAN;
+	int total_available_chans = copy_dma_nr_usable(chans);
+	int nr_queued = 0;
 	int i;
 	size_t page_offset;
-
-	for (i = 0; i < NUM_AVAIL_DMA_CHAN; ++i) {
-		if (!copy_chan[i]) {
-			total_available_chans = i;
-		}
-	}
-	if (total_available_chans != NUM_AVAIL_DMA_CHAN) {
-		pr_err("%d channels are missing", NUM_AVAIL_DMA_CHAN - total_available_chans);
-	}
-
-	total_available_chans = min_t(int, total_available_chans, limit_dma_chans);
-
-	/* round down to closest 2^x value  */
-	total_available_chans = 1<<ilog2(total_available_chans);
+	u64 now;
 
 	if ((nr_pages != 1) && (nr_pages % total_available_chans != 0))
 		return -5;
 
 	for (i = 0; i < total_available_chans; ++i) {
-		unmap[i] = dmaengine_get_unmap_data(copy_dev[i]->dev, 2, GFP_NOWAIT);
+		unmap[i] = dmaengine_get_unmap_data(copy_chan[i]->device->dev, 2, GFP_NOWAIT);
 		if (!unmap[i]) {
 			pr_err("%s: no unmap data at chan %d\n", __func__, i);
 			ret_val = -3;
@@ -508,15 +1859,17 @@ static int copy_page_dma_always(struct page *to, struct page *from, int nr_pages
 	}
 
 	for (i = 0; i < total_available_chans; ++i) {
+		struct device *dev = copy_chan[i]->device->dev;
+
 		if (nr_pages == 1) {
 			page_offset = PAGE_SIZE / total_available_chans;
 
 			unmap[i]->to_cnt = 1;
-			unmap[i]->addr[0] = dma_map_page(copy_dev[i]->dev, from, page_offset*i,
+			unmap[i]->addr[0] = dma_map_page(dev, from, page_offset*i,
 							  page_offset,
 							  DMA_TO_DEVICE);
 			unmap[i]->from_cnt = 1;
-			unmap[i]->addr[1] = dma_map_page(copy_dev[i]->dev, to, page_offset*i,
+			unmap[i]->addr[1] = dma_map_page(dev, to, page_offset*i,
 							  page_offset,
 							  DMA_FROM_DEVICE);
 			unmap[i]->len = page_offset;
@@ -524,13 +1877,13 @@ static int copy_page_dma_always(struct page *to, struct page *from, int nr_pages
 			page_offset = nr_pages / total_available_chans;
 
 			unmap[i]->to_cnt = 1;
-			unmap[i]->addr[0] = dma_map_page(copy_dev[i]->dev,
+			unmap[i]->addr[0] = dma_map_page(dev,
 								from + page_offset*i,
 								0,
 								PAGE_SIZE*page_offset,
 								DMA_TO_DEVICE);
 			unmap[i]->from_cnt = 1;
-			unmap[i]->addr[1] = dma_map_page(copy_dev[i]->dev,
+			unmap[i]->addr[1] = dma_map_page(dev,
 								to + page_offset*i,
 								0,
 								PAGE_SIZE*page_offset,
@@ -540,7 +1893,7 @@ static int copy_page_dma_always(struct page *to, struct page *from, int nr_pages
 	}
 
 	for (i = 0; i < total_available_chans; ++i) {
-		tx[i] = copy_dev[i]->device_prep_dma_memcpy(copy_chan[i],
+		tx[i] = copy_chan[i]->device->device_prep_dma_memcpy(copy_chan[i],
 							unmap[i]->addr[1],
 							unmap[i]->addr[0],
 							unmap[i]->len,
@@ -561,36 +1914,349 @@ static int copy_page_dma_always(struct page *to, struct page *from, int nr_pages
 			goto unmap_dma;
 		}
 
-		dma_async_issue_pending(copy_chan[i]);
+		dma_async_issue_pending(copy_chan[i]);
+		copy_dma_chan_queued(chans, i, unmap[i]->len, 1);
+		nr_queued++;
+	}
+
+	for (i = 0; i < total_available_chans; ++i) {
+		if (dma_sync_wait(copy_chan[i], cookie[i]) != DMA_COMPLETE) {
+			ret_val = -6;
+			pr_err("%s: dma does not complete at chan %d\n", __func__, i);
+		}
+	}
+
+unmap_dma:
+	now = ktime_get_ns();
+	for (i = 0; i < nr_queued; ++i)
+		copy_dma_chan_completed(chans, i, now);
+
+	for (i = 0; i < total_available_chans; ++i) {
+		if (unmap[i])
+			dmaengine_unmap_put(unmap[i]);
+	}
+
+	return ret_val;
+}
+
+int copy_page_dma(struct page *to, struct page *from, int nr_pages)
+{
+	struct copy_dma_chans *chans;
+	u64 start = 0;
+	int nr_writers;
+	int ret_val;
+
+	BUG_ON(hpage_nr_pages(from) != nr_pages);
+	BUG_ON(hpage_nr_pages(to) != nr_pages);
+
+	chans = copy_dma_get_chans(page_to_nid(from), page_to_nid(to));
+	if (!chans)
+		return -ENODEV;
+
+	trace_mm_migrate_copy_dispatch(MIGRATE_ENGINE_DMA, page_to_nid(from),
+			page_to_nid(to), chans - copy_dma_pool, 1,
+			PAGE_SIZE * nr_pages, ilog2(nr_pages), false);
+	if (trace_mm_migrate_copy_done_enabled())
+		start = ktime_get_ns();
+
+	nr_writers = use_all_dma_chans ? copy_dma_nr_usable(chans) : 1;
+	nr_writers = pmem_writers_get(page_to_nid(to), nr_writers, true);
+
+	/* short of writer slots for every channel, a single one does it */
+	if (!use_all_dma_chans || nr_writers < copy_dma_nr_usable(chans))
+		ret_val = copy_page_dma_once(to, from, nr_pages, chans);
+	else
+		ret_val = copy_page_dma_always(to, from, nr_pages, chans);
+	pmem_writers_put(page_to_nid(to), nr_writers);
+
+	if (!ret_val)
+		count_pmem_write(chans - copy_dma_pool, page_to_nid(to),
+				PAGE_SIZE * nr_pages);
+	copy_dma_put_chans(chans);
+
+	if (start)
+		trace_mm_migrate_copy_done(MIGRATE_ENGINE_DMA, page_to_nid(from),
+				page_to_nid(to), PAGE_SIZE * nr_pages,
+				ktime_get_ns() - start, ret_val);
+
+	return ret_val;
+}
+
+/* The part of a batched list copy queued on one channel */
+struct copy_page_dma_sg_chan {
+	int first_page;
+	int nr_pages;
+	struct sg_table src;
+	struct sg_table dst;
+	int src_nents;
+	int dst_nents;
+	/* the chain was cut short, the pages are copied by the CPU */
+	bool failed;
+};
+
+/*
+ * A list copy in flight on the DMA channels, see copy_page_lists_dma_start().
+ */
+struct copy_page_dma_batch {
+	struct copy_dma_chans *chans;
+	int nr_chans;
+	/* pmem_writers slots of @writer_nid held until the batch is waited for */
+	int writer_nid;
+	int nr_writers;
+	/* channels [0, nr_queued) have transfers accounted as queued */
+	int nr_queued;
+	struct dma_async_tx_descriptor **tx;
+	dma_cookie_t *cookie;
+	/* cookie of the last transfer queued on each channel */
+	dma_cookie_t last_cookie[NUM_AVAIL_DMA_CHAN];
+	struct dmaengine_unmap_data *unmap[NUM_AVAIL_DMA_CHAN];
+	/* when the last transfer completed */
+	u64 end_ns;
+	/* batched mode, see copy_page_lists_dma_sg_start() */
+	bool batched;
+	struct page **to;
+	struct page **from;
+	atomic_t pending;
+	struct completion done;
+	struct copy_page_dma_sg_chan sg[NUM_AVAIL_DMA_CHAN];
+};
+
+/* Account the channels of @batch idle again, at @batch->end_ns if set */
+static void copy_page_dma_batch_completed(struct copy_page_dma_batch *batch)
+{
+	u64 now = batch->end_ns ?: ktime_get_ns();
+	int i;
+
+	for (i = 0; i < batch->nr_queued; ++i)
+		copy_dma_chan_completed(batch->chans, i, now);
+}
+
+static void copy_page_dma_batch_free(struct copy_page_dma_batch *batch)
+{
+	int i;
+
+	copy_page_dma_batch_completed(batch);
+
+	for (i = 0; i < batch->nr_chans; ++i) {
+		if (batch->unmap[i])
+			dmaengine_unmap_put(batch->unmap[i]);
+	}
+
+	kfree(batch->cookie);
+	kfree(batch->tx);
+	copy_dma_put_chans(batch->chans);
+	pmem_writers_put(batch->writer_nid, batch->nr_writers);
+}
+
+static void copy_page_dma_sg_callback(void *param)
+{
+	struct copy_page_dma_batch *batch = param;
+
+	if (atomic_dec_and_test(&batch->pending)) {
+		batch->end_ns = ktime_get_ns();
+		complete(&batch->done);
+	}
+}
+
+/*
+ * Queue the pages of @sgc on @chan as one descriptor chain. Both page
+ * lists are mapped with dma_map_sg(), which may merge neighbouring pages,
+ * so the descriptors follow the mapped segments of both lists rather than
+ * the pages. Only the last descriptor raises an interrupt, its callback
+ * accounts the channel in @batch->pending.
+ */
+static void copy_page_dma_sg_chan_start(struct copy_page_dma_batch *batch,
+		struct dma_chan *chan, struct copy_page_dma_sg_chan *sgc)
+{
+	struct device *dev = chan->device->dev;
+	struct page **to = batch->to + sgc->first_page;
+	struct page **from = batch->from + sgc->first_page;
+	struct scatterlist *s, *d;
+	size_t s_off = 0, d_off = 0;
+	unsigned long nr_xfers = 0;
+	u64 bytes = 0;
+	int si = 0, di = 0;
+	bool last = false;
+	int i;
+
+	if (sg_alloc_table(&sgc->src, sgc->nr_pages, GFP_KERNEL))
+		goto fail;
+	if (sg_alloc_table(&sgc->dst, sgc->nr_pages, GFP_KERNEL))
+		goto fail;
+
+	for_each_sg(sgc->src.sgl, s, sgc->nr_pages, i)
+		sg_set_page(s, from[i], PAGE_SIZE * hpage_nr_pages(from[i]), 0);
+	for_each_sg(sgc->dst.sgl, d, sgc->nr_pages, i)
+		sg_set_page(d, to[i], PAGE_SIZE * hpage_nr_pages(to[i]), 0);
+
+	sgc->src_nents = dma_map_sg(dev, sgc->src.sgl, sgc->nr_pages,
+			DMA_TO_DEVICE);
+	if (!sgc->src_nents)
+		goto fail;
+	sgc->dst_nents = dma_map_sg(dev, sgc->dst.sgl, sgc->nr_pages,
+			DMA_FROM_DEVICE);
+	if (!sgc->dst_nents)
+		goto fail;
+
+	s = sgc->src.sgl;
+	d = sgc->dst.sgl;
+	while (si < sgc->src_nents && di < sgc->dst_nents) {
+		size_t len = min_t(size_t, sg_dma_len(s) - s_off,
+				sg_dma_len(d) - d_off);
+		struct dma_async_tx_descriptor *tx;
+		dma_cookie_t cookie;
+
+		last = si == sgc->src_nents - 1 && s_off + len == sg_dma_len(s);
+
+		if (last)
+			atomic_inc(&batch->pending);
+
+		tx = chan->device->device_prep_dma_memcpy(chan,
+				sg_dma_address(d) + d_off,
+				sg_dma_address(s) + s_off, len,
+				DMA_CTRL_ACK | (last ? DMA_PREP_INTERRUPT : 0));
+		if (!tx)
+			goto fail_last;
+
+		if (last) {
+			tx->callback = copy_page_dma_sg_callback;
+			tx->callback_param = batch;
+		}
+
+		cookie = tx->tx_submit(tx);
+		if (dma_submit_error(cookie))
+			goto fail_last;
+		batch->last_cookie[sgc - batch->sg] = cookie;
+		nr_xfers++;
+		bytes += len;
+
+		s_off += len;
+		d_off += len;
+		if (s_off == sg_dma_len(s)) {
+			s = sg_next(s);
+			s_off = 0;
+			si++;
+		}
+		if (d_off == sg_dma_len(d)) {
+			d = sg_next(d);
+			d_off = 0;
+			di++;
+		}
+	}
+
+	dma_async_issue_pending(chan);
+	copy_dma_chan_queued(batch->chans, sgc - batch->sg, bytes, nr_xfers);
+	return;
+
+fail_last:
+	if (last)
+		atomic_dec(&batch->pending);
+fail:
+	pr_err("%s: cannot queue %d pages on chan %d, copying them with the CPU\n",
+			__func__, sgc->nr_pages, (int)(sgc - batch->sg));
+	sgc->failed = true;
+	dma_async_issue_pending(chan);
+	copy_dma_chan_queued(batch->chans, sgc - batch->sg, bytes, nr_xfers);
+}
+
+/*
+ * Batched list copy: the pages are split in contiguous runs, one per
+ * channel, and each run is queued as a single descriptor chain that
+ * raises one interrupt when it is done. A channel that fails to queue
+ * its run falls back to the CPU for those pages only.
+ */
+static int copy_page_lists_dma_sg_start(struct page **to, struct page **from,
+		int nr_items, struct copy_page_dma_batch *batch)
+{
+	int nr_chans = batch->nr_writers;
+	int i;
+
+	batch->batched = true;
+	batch->nr_chans = nr_chans;
+	/* bias, dropped once every channel has been queued */
+	atomic_set(&batch->pending, 1);
+	init_completion(&batch->done);
+
+	for (i = 0; i < nr_chans; ++i) {
+		struct copy_page_dma_sg_chan *sgc = &batch->sg[i];
+
+		sgc->first_page = nr_items * i / nr_chans;
+		sgc->nr_pages = nr_items * (i + 1) / nr_chans - sgc->first_page;
+
+		copy_page_dma_sg_chan_start(batch, batch->chans->chans[i], sgc);
+		batch->nr_queued++;
 	}
 
-	for (i = 0; i < total_available_chans; ++i) {
-		if (dma_sync_wait(copy_chan[i], cookie[i]) != DMA_COMPLETE) {
-			ret_val = -6;
-			pr_err("%s: dma does not complete at chan %d\n", __func__, i);
-		}
+	if (atomic_dec_and_test(&batch->pending)) {
+		batch->end_ns = ktime_get_ns();
+		complete(&batch->done);
 	}
 
-unmap_dma:
+	return 0;
+}
 
-	for (i = 0; i < total_available_chans; ++i) {
-		if (unmap[i])
-			dmaengine_unmap_put(unmap[i]);
+static bool copy_page_lists_dma_sg_done(struct copy_page_dma_batch *batch)
+{
+	int i;
+
+	if (!completion_done(&batch->done))
+		return false;
+
+	/* chains cut short have no callback, poll their last descriptor */
+	for (i = 0; i < batch->nr_chans; ++i) {
+		if (batch->sg[i].failed && batch->last_cookie[i] &&
+		    dma_async_is_tx_complete(batch->chans->chans[i],
+				batch->last_cookie[i], NULL, NULL) != DMA_COMPLETE)
+			return false;
 	}
 
-	return ret_val;
+	return true;
 }
 
-int copy_page_dma(struct page *to, struct page *from, int nr_pages)
+static int copy_page_lists_dma_sg_finish(struct copy_page_dma_batch *batch)
 {
-	BUG_ON(hpage_nr_pages(from) != nr_pages);
-	BUG_ON(hpage_nr_pages(to) != nr_pages);
+	int i, j;
+
+	wait_for_completion(&batch->done);
+
+	for (i = 0; i < batch->nr_chans; ++i) {
+		struct copy_page_dma_sg_chan *sgc = &batch->sg[i];
+		struct device *dev = batch->chans->chans[i]->device->dev;
+		u64 bytes = (u64)copy_page_nr_base_pages(batch->to +
+				sgc->first_page, sgc->nr_pages) << PAGE_SHIFT;
 
-	if (!use_all_dma_chans) {
-		return copy_page_dma_once(to, from, nr_pages);
+		if (sgc->failed && batch->last_cookie[i]) {
+			dma_sync_wait(batch->chans->chans[i], batch->last_cookie[i]);
+			batch->end_ns = ktime_get_ns();
+		}
+
+		if (sgc->src_nents)
+			dma_unmap_sg(dev, sgc->src.sgl, sgc->nr_pages, DMA_TO_DEVICE);
+		if (sgc->dst_nents)
+			dma_unmap_sg(dev, sgc->dst.sgl, sgc->nr_pages, DMA_FROM_DEVICE);
+		sg_free_table(&sgc->src);
+		sg_free_table(&sgc->dst);
+
+		if (!sgc->failed) {
+			count_pmem_write(batch->chans - copy_dma_pool,
+					batch->writer_nid, bytes);
+			continue;
+		}
+		count_pmem_write(numa_node_id(), batch->writer_nid, bytes);
+
+		for (j = sgc->first_page; j < sgc->first_page + sgc->nr_pages; ++j) {
+			int k;
+
+			for (k = 0; k < hpage_nr_pages(batch->from[j]); ++k)
+				copy_highpage(batch->to[j] + k, batch->from[j] + k);
+		}
 	}
 
-	return copy_page_dma_always(to, from, nr_pages);
+	copy_page_dma_batch_completed(batch);
+	copy_dma_put_chans(batch->chans);
+	pmem_writers_put(batch->writer_nid, batch->nr_writers);
+
+	return 0;
 }
 
 /*
@@ -598,44 +2264,58 @@ int copy_page_dma(struct page *to, struct page *from, int nr_pages)
  *
  * Just put each page into individual DMA channel.
  *
- * */
-int copy_page_lists_dma_always(struct page **to, struct page **from, int nr_items)
+ * Map the pages, queue one transfer per page spread over the channels and
+ * kick the channels. On success the transfers are in flight and @batch
+ * must be passed to copy_page_lists_dma_finish(). There are no more
+ * channels than the writer slots the copy gets, waiting for one if @wait.
+ */
+static int copy_page_lists_dma_start(struct page **to, struct page **from,
+		int nr_items, struct copy_page_dma_batch *batch, bool wait)
 {
-	struct dma_async_tx_descriptor **tx = NULL;
-	dma_cookie_t *cookie = NULL;
 	enum dma_ctrl_flags flags[NUM_AVAIL_DMA_CHAN] = {0};
-	struct dmaengine_unmap_data *unmap[NUM_AVAIL_DMA_CHAN] = {0};
+	struct dmaengine_unmap_data **unmap = batch->unmap;
+	struct dma_chan **copy_chan;
 	int ret_val = 0;
-	int total_available_chans = NUM_AVAIL_DMA_CHAN;
+	int total_available_chans;
 	int i;
 	int page_idx;
 
-	for (i = 0; i < NUM_AVAIL_DMA_CHAN; ++i) {
-		if (!copy_chan[i]) {
-			total_available_chans = i;
-		}
-	}
-	if (total_available_chans != NUM_AVAIL_DMA_CHAN) {
-		pr_err("%d channels are missing\n", NUM_AVAIL_DMA_CHAN - total_available_chans);
-	}
-	if (limit_dma_chans < total_available_chans)
-		total_available_chans = limit_dma_chans;
+	memset(batch, 0, sizeof(*batch));
 
-	/* round down to closest 2^x value  */
-	total_available_chans = 1<<ilog2(total_available_chans);
+	batch->chans = copy_dma_get_chans(page_to_nid(*from), page_to_nid(*to));
+	if (!batch->chans)
+		return -ENODEV;
+	copy_chan = batch->chans->chans;
+	batch->to = to;
+	batch->from = from;
+
+	trace_mm_migrate_copy_dispatch(MIGRATE_ENGINE_DMA, page_to_nid(*from),
+			page_to_nid(*to), batch->chans - copy_dma_pool, nr_items,
+			(u64)copy_page_nr_base_pages(from, nr_items) << PAGE_SHIFT,
+			compound_order(*from), false);
 
+	total_available_chans = copy_dma_nr_usable(batch->chans);
 	total_available_chans = min_t(int, total_available_chans, nr_items);
+	batch->writer_nid = page_to_nid(*to);
+	batch->nr_writers = pmem_writers_get(batch->writer_nid,
+			total_available_chans, wait);
 
+	if (READ_ONCE(dma_batch_page_copy))
+		return copy_page_lists_dma_sg_start(to, from, nr_items, batch);
 
-	tx = kzalloc(sizeof(struct dma_async_tx_descriptor*)*nr_items, GFP_KERNEL);
-	if (!tx) {
+	total_available_chans = batch->nr_writers;
+	batch->nr_chans = total_available_chans;
+
+
+	batch->tx = kzalloc(sizeof(struct dma_async_tx_descriptor*)*nr_items, GFP_KERNEL);
+	if (!batch->tx) {
 		ret_val = -ENOMEM;
 		goto out;
 	}
-	cookie = kzalloc(sizeof(dma_cookie_t)*nr_items, GFP_KERNEL);
-	if (!cookie) {
+	batch->cookie = kzalloc(sizeof(dma_cookie_t)*nr_items, GFP_KERNEL);
+	if (!batch->cookie) {
 		ret_val = -ENOMEM;
-		goto out_free_tx;
+		goto out;
 	}
 
 	for (i = 0; i < total_available_chans; ++i) {
@@ -647,20 +2327,21 @@ int copy_page_lists_dma_always(struct page **to, struct page **from, int nr_item
 		if (num_xfer_per_dev > 128) {
 			ret_val = -ENOMEM;
 			pr_err("%s: too many pages to be transferred\n", __func__);
-			goto out_free_both;
+			goto out;
 		}
 
-		unmap[i] = dmaengine_get_unmap_data(copy_dev[i]->dev,
+		unmap[i] = dmaengine_get_unmap_data(copy_chan[i]->device->dev,
 						2 * num_xfer_per_dev, GFP_NOWAIT);
 		if (!unmap[i]) {
 			pr_err("%s: no unmap data at chan %d\n", __func__, i);
 			ret_val = -ENODEV;
-			goto unmap_dma;
+			goto out;
 		}
 	}
 
 	page_idx = 0;
 	for (i = 0; i < total_available_chans; ++i) {
+		struct device *dev = copy_chan[i]->device->dev;
 		int num_xfer_per_dev = nr_items / total_available_chans;
 		int xfer_idx;
 
@@ -678,13 +2359,13 @@ int copy_page_lists_dma_always(struct page **to, struct page **from, int nr_item
 			BUG_ON(unmap[i]->len != page_len);
 
 			unmap[i]->addr[xfer_idx] =
-				 dma_map_page(copy_dev[i]->dev, from[page_idx],
+				 dma_map_page(dev, from[page_idx],
 							  0,
 							  page_len,
 							  DMA_TO_DEVICE);
 
 			unmap[i]->addr[xfer_idx+num_xfer_per_dev] =
-				 dma_map_page(copy_dev[i]->dev, to[page_idx],
+				 dma_map_page(dev, to[page_idx],
 							  0,
 							  page_len,
 							  DMA_FROM_DEVICE);
@@ -701,60 +2382,740 @@ int copy_page_lists_dma_always(struct page **to, struct page **from, int nr_item
 
 		for (xfer_idx = 0; xfer_idx < num_xfer_per_dev; ++xfer_idx, ++page_idx) {
 
-			tx[page_idx] = copy_dev[i]->device_prep_dma_memcpy(copy_chan[i],
+			batch->tx[page_idx] = copy_chan[i]->device->device_prep_dma_memcpy(copy_chan[i],
 								unmap[i]->addr[xfer_idx + num_xfer_per_dev],
 								unmap[i]->addr[xfer_idx],
 								unmap[i]->len,
 								flags[i]);
-			if (!tx[page_idx]) {
+			if (!batch->tx[page_idx]) {
 				pr_err("%s: no tx descriptor at chan %d xfer %d\n",
 					   __func__, i, xfer_idx);
 				ret_val = -ENODEV;
-				goto unmap_dma;
+				goto out;
 			}
 
-			cookie[page_idx] = tx[page_idx]->tx_submit(tx[page_idx]);
+			batch->cookie[page_idx] = batch->tx[page_idx]->tx_submit(batch->tx[page_idx]);
 
-			if (dma_submit_error(cookie[page_idx])) {
+			if (dma_submit_error(batch->cookie[page_idx])) {
 				pr_err("%s: submission error at chan %d xfer %d\n",
 					   __func__, i, xfer_idx);
 				ret_val = -ENODEV;
-				goto unmap_dma;
+				goto out;
 			}
+			batch->last_cookie[i] = batch->cookie[page_idx];
 		}
 
 		dma_async_issue_pending(copy_chan[i]);
+		copy_dma_chan_queued(batch->chans, i,
+				(u64)num_xfer_per_dev * unmap[i]->len,
+				num_xfer_per_dev);
+		batch->nr_queued++;
+	}
+
+	return 0;
+
+out:
+	copy_page_dma_batch_free(batch);
+
+	return ret_val;
+}
+
+/* Has every transfer of @batch completed? */
+static bool copy_page_lists_dma_done(struct copy_page_dma_batch *batch)
+{
+	int i;
+
+	if (batch->batched)
+		return copy_page_lists_dma_sg_done(batch);
+
+	for (i = 0; i < batch->nr_chans; ++i) {
+		if (dma_async_is_tx_complete(batch->chans->chans[i],
+					batch->last_cookie[i],
+					NULL, NULL) != DMA_COMPLETE)
+			return false;
 	}
 
+	return true;
+}
+
+/* Wait for the transfers of @batch, unmap the pages and release @batch */
+static int copy_page_lists_dma_finish(struct copy_page_dma_batch *batch,
+		int nr_items)
+{
+	struct dma_chan **copy_chan = batch->chans->chans;
+	int ret_val = 0;
+	int i;
+	int page_idx;
+
+	if (batch->batched)
+		return copy_page_lists_dma_sg_finish(batch);
+
 	page_idx = 0;
-	for (i = 0; i < total_available_chans; ++i) {
-		int num_xfer_per_dev = nr_items / total_available_chans;
+	for (i = 0; i < batch->nr_chans; ++i) {
+		int num_xfer_per_dev = nr_items / batch->nr_chans;
 		int xfer_idx;
 
-		if (i < (nr_items % total_available_chans))
+		if (i < (nr_items % batch->nr_chans))
 			num_xfer_per_dev += 1;
 
 		for (xfer_idx = 0; xfer_idx < num_xfer_per_dev; ++xfer_idx, ++page_idx) {
 
-			if (dma_sync_wait(copy_chan[i], cookie[page_idx]) != DMA_COMPLETE) {
+			if (dma_sync_wait(copy_chan[i], batch->cookie[page_idx]) != DMA_COMPLETE) {
 				ret_val = -6;
 				pr_err("%s: dma does not complete at chan %d, xfer %d\n",
 					   __func__, i, xfer_idx);
+				continue;
 			}
+			count_pmem_write(batch->chans - copy_dma_pool,
+					batch->writer_nid, PAGE_SIZE *
+					hpage_nr_pages(batch->to[page_idx]));
 		}
 	}
+	batch->end_ns = ktime_get_ns();
 
-unmap_dma:
-	for (i = 0; i < total_available_chans; ++i) {
-		if (unmap[i])
-			dmaengine_unmap_put(unmap[i]);
+	copy_page_dma_batch_free(batch);
+
+	return ret_val;
+}
+
+int copy_page_lists_dma_always(struct page **to, struct page **from, int nr_items)
+{
+	struct copy_page_dma_batch *batch;
+	int ret_val;
+
+	batch = kmalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
+		return -ENOMEM;
+
+	ret_val = copy_page_lists_dma_start(to, from, nr_items, batch, true);
+	if (!ret_val)
+		ret_val = copy_page_lists_dma_finish(batch, nr_items);
+
+	kfree(batch);
+
+	return ret_val;
+}
+
+/* ======================== DMA exchange page ======================== */
+
+/* A pair of pages of a DMA exchange */
+struct exchange_dma_pair {
+	dma_addr_t to_addr;
+	dma_addr_t from_addr;
+	/* descriptors of the swap queued, 3 when it is complete */
+	u8 stage;
+};
+
+/* The part of a DMA exchange queued on one channel */
+struct exchange_dma_chan {
+	int first_pair;
+	int nr_pairs;
+	struct copy_dma_chans *chans;
+	int chan;		/* index in @chans */
+	struct copy_dma_bounce *bounce;
+	dma_addr_t bounce_addr;
+	dma_cookie_t last_cookie;
+	/* accounted as queued on the channel */
+	bool queued;
+};
+
+/* Queue one fenced memcpy on @chan, returns its cookie or a submit error */
+static dma_cookie_t exchange_dma_queue(struct dma_chan *chan, dma_addr_t dst,
+		dma_addr_t src, size_t len)
+{
+	struct dma_async_tx_descriptor *tx;
+
+	tx = chan->device->device_prep_dma_memcpy(chan, dst, src, len,
+			DMA_CTRL_ACK | DMA_PREP_FENCE);
+	if (!tx)
+		return -ENOMEM;
+
+	return tx->tx_submit(tx);
+}
+
+/*
+ * Queue the swaps of the run @ec on @chan through the bounce buffer of the
+ * channel: from to the bounce buffer, to to from, then the bounce buffer to
+ * to, each descriptor fenced on the one before so that the next swap does
+ * not overwrite the bounce buffer early. The bounce buffer lock is held
+ * until exchange_dma_chan_finish(). Queuing stops at the first descriptor
+ * the channel refuses, the pairs left behind are exchanged by the caller.
+ */
+static void exchange_dma_chan_start(struct dma_chan *chan,
+		struct exchange_dma_chan *ec, struct exchange_dma_pair *pairs,
+		struct page **to, struct page **from)
+{
+	struct device *dev = chan->device->dev;
+	struct copy_dma_bounce *bounce = ec->bounce;
+	unsigned long nr_xfers = 0;
+	dma_cookie_t cookie;
+	u64 bytes = 0;
+	int i;
+
+	mutex_lock(&bounce->lock);
+	if (!bounce->page) {
+		bounce->page = alloc_pages_node(copy_dma_chan_node(chan),
+				GFP_KERNEL | __GFP_NOWARN, COPY_DMA_BOUNCE_ORDER);
+		if (!bounce->page)
+			return;
 	}
 
-out_free_both:
-	kfree(cookie);
-out_free_tx:
-	kfree(tx);
-out:
+	ec->bounce_addr = dma_map_page(dev, bounce->page, 0,
+			PAGE_SIZE << COPY_DMA_BOUNCE_ORDER, DMA_BIDIRECTIONAL);
+	if (dma_mapping_error(dev, ec->bounce_addr)) {
+		ec->bounce_addr = 0;
+		return;
+	}
+
+	for (i = ec->first_pair; i < ec->first_pair + ec->nr_pairs; i++) {
+		struct exchange_dma_pair *pair = &pairs[i];
+		int nr_pages = hpage_nr_pages(from[i]);
+		size_t len = PAGE_SIZE * nr_pages;
+
+		if (nr_pages != hpage_nr_pages(to[i]) ||
+		    nr_pages > (1 << COPY_DMA_BOUNCE_ORDER))
+			continue;
+
+		pair->from_addr = dma_map_page(dev, from[i], 0, len,
+				DMA_BIDIRECTIONAL);
+		if (dma_mapping_error(dev, pair->from_addr)) {
+			pair->from_addr = 0;
+			continue;
+		}
+		pair->to_addr = dma_map_page(dev, to[i], 0, len,
+				DMA_BIDIRECTIONAL);
+		if (dma_mapping_error(dev, pair->to_addr)) {
+			pair->to_addr = 0;
+			continue;
+		}
+
+		cookie = exchange_dma_queue(chan, ec->bounce_addr,
+				pair->from_addr, len);
+		if (dma_submit_error(cookie))
+			break;
+		ec->last_cookie = cookie;
+		pair->stage++;
+
+		cookie = exchange_dma_queue(chan, pair->from_addr,
+				pair->to_addr, len);
+		if (dma_submit_error(cookie))
+			break;
+		ec->last_cookie = cookie;
+		pair->stage++;
+
+		cookie = exchange_dma_queue(chan, pair->to_addr,
+				ec->bounce_addr, len);
+		if (dma_submit_error(cookie))
+			break;
+		ec->last_cookie = cookie;
+		pair->stage++;
+		nr_xfers += 3;
+		bytes += 3 * len;
+	}
+
+	if (i < ec->first_pair + ec->nr_pairs)
+		pr_err("%s: cannot queue pair %d, exchanging the rest with the CPU\n",
+				__func__, i);
+
+	dma_async_issue_pending(chan);
+	copy_dma_chan_queued(ec->chans, ec->chan, bytes, nr_xfers);
+	ec->queued = true;
+}
+
+/*
+ * Wait for the run @ec, unmap its pages and mark the pairs exchanged in
+ * @done. A swap cut short after its second descriptor has the data of
+ * from in the bounce buffer only, the CPU copies it to to.
+ */
+static void exchange_dma_chan_finish(struct dma_chan *chan,
+		struct exchange_dma_chan *ec, struct exchange_dma_pair *pairs,
+		struct page **to, struct page **from, unsigned long *done)
+{
+	struct device *dev = chan->device->dev;
+	struct copy_dma_bounce *bounce = ec->bounce;
+	bool exchanged = false;
+	int i, k;
+
+	if (ec->last_cookie &&
+	    dma_sync_wait(chan, ec->last_cookie) != DMA_COMPLETE)
+		pr_err("%s: dma does not complete properly\n", __func__);
+	if (ec->queued)
+		copy_dma_chan_completed(ec->chans, ec->chan, ktime_get_ns());
+
+	for (i = ec->first_pair; i < ec->first_pair + ec->nr_pairs; i++) {
+		struct exchange_dma_pair *pair = &pairs[i];
+		size_t len = PAGE_SIZE * hpage_nr_pages(from[i]);
+
+		if (pair->from_addr)
+			dma_unmap_page(dev, pair->from_addr, len,
+					DMA_BIDIRECTIONAL);
+		if (pair->to_addr)
+			dma_unmap_page(dev, pair->to_addr, len,
+					DMA_BIDIRECTIONAL);
+	}
+	if (ec->bounce_addr)
+		dma_unmap_page(dev, ec->bounce_addr,
+				PAGE_SIZE << COPY_DMA_BOUNCE_ORDER,
+				DMA_BIDIRECTIONAL);
+
+	for (i = ec->first_pair; i < ec->first_pair + ec->nr_pairs; i++) {
+		struct exchange_dma_pair *pair = &pairs[i];
+
+		if (pair->stage == 2)
+			for (k = 0; k < hpage_nr_pages(from[i]); k++)
+				copy_highpage(to[i] + k, bounce->page + k);
+		/* a single descriptor only made a copy of from */
+		if (pair->stage >= 2) {
+			set_bit(i, done);
+			exchanged = true;
+		}
+	}
+
+	/* a channel that cannot exchange anything does not keep the buffer */
+	if (!exchanged && bounce->page) {
+		__free_pages(bounce->page, COPY_DMA_BOUNCE_ORDER);
+		bounce->page = NULL;
+	}
+	mutex_unlock(&bounce->lock);
+}
+
+/*
+ * Exchange the data of each pair of @to and @from on the DMA channels,
+ * the pairs split in contiguous runs, one per channel. Returns 0 when
+ * every pair is exchanged, -EBUSY when some are left for the CPU, -ENODEV
+ * or -ENOMEM when none is. The pairs exchanged are set in @done, which
+ * holds @nr_items bits.
+ */
+int exchange_page_lists_dma(struct page **to, struct page **from,
+		int nr_items, unsigned long *done)
+{
+	struct exchange_dma_chan ecs[NUM_AVAIL_DMA_CHAN] = {};
+	struct exchange_dma_pair *pairs;
+	struct copy_dma_chans *chans;
+	int nr_chans, writer_nid, i;
+
+	pairs = kvcalloc(nr_items, sizeof(*pairs), GFP_KERNEL);
+	if (!pairs)
+		return -ENOMEM;
+
+	chans = copy_dma_get_chans(page_to_nid(*from), page_to_nid(*to));
+	if (!chans) {
+		kvfree(pairs);
+		return -ENODEV;
+	}
+
+	nr_chans = min_t(int, copy_dma_nr_usable(chans), nr_items);
+	writer_nid = pmem_writers_exchange_node(page_to_nid(*to),
+			page_to_nid(*from));
+	nr_chans = pmem_writers_get(writer_nid, nr_chans, true);
+
+	trace_mm_migrate_copy_dispatch(MIGRATE_ENGINE_EXCHANGE,
+			page_to_nid(*from), page_to_nid(*to), chans - copy_dma_pool,
+			nr_items,
+			(u64)copy_page_nr_base_pages(from, nr_items) << PAGE_SHIFT,
+			compound_order(*from), false);
+
+	for (i = 0; i < nr_chans; i++) {
+		struct exchange_dma_chan *ec = &ecs[i];
+
+		ec->first_pair = nr_items * i / nr_chans;
+		ec->nr_pairs = nr_items * (i + 1) / nr_chans - ec->first_pair;
+		ec->chans = chans;
+		ec->chan = i;
+		ec->bounce = &chans->bounce[i];
+		exchange_dma_chan_start(chans->chans[i], ec, pairs, to, from);
+	}
+
+	for (i = 0; i < nr_chans; i++)
+		exchange_dma_chan_finish(chans->chans[i], &ecs[i], pairs, to,
+				from, done);
+
+	for (i = 0; i < nr_items; i++) {
+		if (!test_bit(i, done))
+			continue;
+		count_pmem_write(chans - copy_dma_pool, page_to_nid(to[i]),
+				PAGE_SIZE * hpage_nr_pages(to[i]));
+		count_pmem_write(chans - copy_dma_pool, page_to_nid(from[i]),
+				PAGE_SIZE * hpage_nr_pages(from[i]));
+	}
+
+	pmem_writers_put(writer_nid, nr_chans);
+	copy_dma_put_chans(chans);
+	kvfree(pairs);
+
+	if (bitmap_empty(done, nr_items))
+		return -ENODEV;
+
+	return bitmap_full(done, nr_items) ? 0 : -EBUSY;
+}
+
+/* ======================== hybrid CPU + DMA copy ======================== */
+
+#define HYBRID_SHARE_SCALE	1024
+/* keep both engines busy enough to keep measuring them */
+#define HYBRID_SHARE_MIN	(HYBRID_SHARE_SCALE / 32)
+
+/*
+ * MIGRATE_HYBRID copies the head of a page list on the DMA channels and
+ * the tail on the copy workers at the same time. The DMA part is
+ * hybrid_dma_share / HYBRID_SHARE_SCALE of the bytes, rebalanced after
+ * every hybrid copy from the bandwidth each engine reached.
+ */
+unsigned int hybrid_dma_share = HYBRID_SHARE_SCALE / 2;
+
+/* moving averages, in bytes per us, of each engine on hybrid copies */
+static u64 hybrid_dma_bw;
+static u64 hybrid_mt_bw;
+
+/* Number of leading items of @from that go to the DMA channels */
+static int copy_page_hybrid_split(struct page **from, int nr_items)
+{
+	unsigned long total = 0, dma_pages = 0, target;
+	int i;
+
+	for (i = 0; i < nr_items; ++i)
+		total += hpage_nr_pages(from[i]);
+
+	target = total * READ_ONCE(hybrid_dma_share) / HYBRID_SHARE_SCALE;
+
+	for (i = 0; i < nr_items && dma_pages < target; ++i)
+		dma_pages += hpage_nr_pages(from[i]);
+
+	return i;
+}
+
+static void copy_page_hybrid_account(u64 *bw, unsigned long nr_pages,
+		u64 busy_ns)
+{
+	u64 dma_bw, mt_bw;
+	unsigned int share;
+
+	if (!busy_ns)
+		return;
+
+	WRITE_ONCE(*bw, copy_page_ewma(*bw,
+			div64_u64((u64)nr_pages * PAGE_SIZE * NSEC_PER_USEC, busy_ns)));
+
+	dma_bw = READ_ONCE(hybrid_dma_bw);
+	mt_bw = READ_ONCE(hybrid_mt_bw);
+	if (!dma_bw || !mt_bw)
+		return;
+
+	share = div64_u64(dma_bw * HYBRID_SHARE_SCALE, dma_bw + mt_bw);
+	WRITE_ONCE(hybrid_dma_share, clamp_t(unsigned int, share,
+			HYBRID_SHARE_MIN, HYBRID_SHARE_SCALE - HYBRID_SHARE_MIN));
+}
+
+/* ======================== asynchronous page list copy ======================== */
+
+/*
+ * An in-flight page list copy on the CPU copy workers (MIGRATE_MT), on
+ * the DMA channels (MIGRATE_DMA) or split between both (MIGRATE_HYBRID).
+ */
+struct copy_page_handle {
+	struct page **to;
+	struct page **from;
+	int nr_items;
+	enum migrate_mode mode;
+	/* MIGRATE_MT: the copy workers, NULL if the copy was done inline */
+	struct copy_page_pool *pool;
+	/* MIGRATE_DMA */
+	struct copy_page_dma_batch dma;
+	/* MIGRATE_HYBRID: the first nr_dma_items go to DMA, the rest to MT */
+	int nr_dma_items;
+	u64 start_ns;
+};
+
+static int copy_page_lists_hybrid_start(struct copy_page_handle *handle)
+{
+	struct page **to = handle->to, **from = handle->from;
+	int nr_dma = copy_page_hybrid_split(from, handle->nr_items);
+
+	/* no usable channel, the workers take the whole list */
+	if (nr_dma && copy_page_lists_dma_start(to, from, nr_dma, &handle->dma,
+				false))
+		nr_dma = 0;
+	handle->nr_dma_items = nr_dma;
+
+	if (nr_dma == handle->nr_items)
+		return 0;
+
+	handle->pool = copy_page_lists_mt_start(to + nr_dma, from + nr_dma,
+			handle->nr_items - nr_dma, NULL, false);
+	if (IS_ERR(handle->pool)) {
+		if (nr_dma)
+			copy_page_lists_dma_finish(&handle->dma, nr_dma);
+		return PTR_ERR(handle->pool);
+	}
+
+	return 0;
+}
+
+static int copy_page_lists_hybrid_finish(struct copy_page_handle *handle)
+{
+	int nr_dma = handle->nr_dma_items;
+	int nr_mt = handle->nr_items - nr_dma;
+	int ret_val = 0;
+
+	if (nr_dma) {
+		ret_val = copy_page_lists_dma_finish(&handle->dma, nr_dma);
+		if (!ret_val)
+			copy_page_hybrid_account(&hybrid_dma_bw,
+					copy_page_nr_base_pages(handle->from, nr_dma),
+					handle->dma.end_ns - handle->start_ns);
+	}
+
+	if (handle->pool)
+		copy_page_hybrid_account(&hybrid_mt_bw,
+				copy_page_nr_base_pages(handle->from + nr_dma, nr_mt),
+				copy_page_lists_mt_finish(handle->to + nr_dma,
+					handle->from + nr_dma, nr_mt, handle->pool));
+
+	return ret_val;
+}
+
+/*
+ * Start copying @from[i] to @to[i] for the @nr_items page pairs with the
+ * engine selected by @mode and return without waiting for the copy.
+ *
+ * The page arrays must not be freed, and the pages not touched, until
+ * copy_page_lists_wait() returns. Only one MIGRATE_MT copy per processing
+ * node runs at a time, a second submit on the same node sleeps until the
+ * first one has been waited for.
+ */
+struct copy_page_handle *copy_page_lists_submit(struct page **to,
+		struct page **from, int nr_items, enum migrate_mode mode)
+{
+	struct copy_page_handle *handle;
+	int err = 0;
+
+	if (!(mode & (MIGRATE_MT | MIGRATE_DMA | MIGRATE_HYBRID)))
+		return ERR_PTR(-EINVAL);
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle)
+		return ERR_PTR(-ENOMEM);
+
+	handle->to = to;
+	handle->from = from;
+	handle->nr_items = nr_items;
+	handle->mode = mode;
+	handle->start_ns = ktime_get_ns();
+
+	if (mode & MIGRATE_HYBRID) {
+		err = copy_page_lists_hybrid_start(handle);
+	} else if (mode & MIGRATE_DMA) {
+		err = copy_page_lists_dma_start(to, from, nr_items, &handle->dma,
+				false);
+	} else {
+		handle->pool = copy_page_lists_mt_start(to, from, nr_items, NULL,
+				false);
+		if (IS_ERR(handle->pool))
+			err = PTR_ERR(handle->pool);
+	}
+
+	if (err) {
+		kfree(handle);
+		return ERR_PTR(err);
+	}
+
+	return handle;
+}
+
+/* Has the copy behind @handle completed? Does not release @handle. */
+bool copy_page_lists_poll(struct copy_page_handle *handle)
+{
+	if (handle->mode & MIGRATE_HYBRID)
+		return (!handle->nr_dma_items ||
+			copy_page_lists_dma_done(&handle->dma)) &&
+			(IS_ERR_OR_NULL(handle->pool) ||
+			 copy_page_pool_done(handle->pool));
+
+	if (handle->mode & MIGRATE_DMA)
+		return copy_page_lists_dma_done(&handle->dma);
+
+	return !handle->pool || copy_page_pool_done(handle->pool);
+}
+
+/* Wait for the copy behind @handle to complete and release @handle */
+int copy_page_lists_wait(struct copy_page_handle *handle)
+{
+	int ret_val = 0;
+
+	if (handle->mode & MIGRATE_HYBRID)
+		ret_val = copy_page_lists_hybrid_finish(handle);
+	else if (handle->mode & MIGRATE_DMA)
+		ret_val = copy_page_lists_dma_finish(&handle->dma,
+				handle->nr_items);
+	else if (handle->pool)
+		copy_page_lists_mt_finish(handle->to, handle->from,
+				handle->nr_items, handle->pool);
+
+	if (trace_mm_migrate_copy_done_enabled())
+		trace_mm_migrate_copy_done(migrate_latency_engine(handle->mode),
+				page_to_nid(*handle->from), page_to_nid(*handle->to),
+				(u64)copy_page_nr_base_pages(handle->from,
+					handle->nr_items) << PAGE_SHIFT,
+				ktime_get_ns() - handle->start_ns, ret_val);
+
+	kfree(handle);
+
+	return ret_val;
+}
+
+/*
+ * MIGRATE_HYBRID copy of a single huge page: the DMA channels copy the
+ * head of its bytes while the copy workers copy the rest, split like a
+ * page list by hybrid_dma_share.
+ */
+int copy_page_hybrid(struct page *to, struct page *from, int nr_pages)
+{
+	int nr_dma = (unsigned long)nr_pages * READ_ONCE(hybrid_dma_share) /
+		HYBRID_SHARE_SCALE;
+	int to_nid = page_to_nid(to);
+	struct copy_dma_chans *chans = NULL;
+	struct copy_page_dma_once once;
+	int nr_writers = 0;
+	int ret_val = 0, dma_ret;
+	u64 start, end;
+
+	if (nr_dma)
+		chans = copy_dma_get_chans(page_to_nid(from), to_nid);
+	if (chans) {
+		nr_writers = pmem_writers_get(to_nid, 1, true);
+		start = ktime_get_ns();
+		if (copy_page_dma_submit(to, from, nr_dma, chans, &once))
+			nr_dma = 0;
+	} else {
+		nr_dma = 0;
+		start = ktime_get_ns();
+	}
+
+	/* no usable channel, the workers take the whole page */
+	if (nr_dma < nr_pages) {
+		ret_val = copy_page_multithread(to + nr_dma, from + nr_dma,
+				nr_pages - nr_dma);
+		if (!ret_val)
+			copy_page_hybrid_account(&hybrid_mt_bw, nr_pages - nr_dma,
+					ktime_get_ns() - start);
+	}
+
+	if (nr_dma) {
+		dma_ret = copy_page_dma_wait(chans, &once);
+		end = ktime_get_ns();
+		if (!dma_ret) {
+			count_pmem_write(chans - copy_dma_pool, to_nid,
+					PAGE_SIZE * nr_dma);
+			copy_page_hybrid_account(&hybrid_dma_bw, nr_dma,
+					end - start);
+		}
+		if (!ret_val)
+			ret_val = dma_ret;
+	}
+
+	if (chans) {
+		pmem_writers_put(to_nid, nr_writers);
+		copy_dma_put_chans(chans);
+	}
 
 	return ret_val;
 }
+
+/* ======================== copy engine statistics ======================== */
+
+/* cpu node runs busy_ns bytes wait_ns max_wait_ns */
+static int copy_page_workers_show(struct seq_file *m, void *v)
+{
+	struct copy_worker_stat *stat;
+	int cpu;
+
+	seq_puts(m, "cpu node runs busy_ns bytes wait_ns max_wait_ns\n");
+	for_each_possible_cpu(cpu) {
+		stat = per_cpu_ptr(&copy_worker_stats, cpu);
+		if (!READ_ONCE(stat->nr_runs))
+			continue;
+		seq_printf(m, "%d %d %lu %llu %llu %llu %llu\n", cpu,
+				cpu_to_node(cpu), READ_ONCE(stat->nr_runs),
+				READ_ONCE(stat->busy_ns), READ_ONCE(stat->bytes),
+				READ_ONCE(stat->wait_ns),
+				READ_ONCE(stat->max_wait_ns));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(copy_page_workers);
+
+/* node copies queued max_queued lock_wait_ns */
+static int copy_page_pools_show(struct seq_file *m, void *v)
+{
+	struct copy_page_pool *pool;
+	int nid;
+
+	seq_puts(m, "node copies queued max_queued lock_wait_ns\n");
+	for_each_node(nid) {
+		pool = READ_ONCE(copy_page_pools[nid]);
+		if (!pool)
+			continue;
+		seq_printf(m, "%d %lu %d %d %llu\n", nid,
+				READ_ONCE(pool->nr_copies),
+				atomic_read(&pool->nr_queued),
+				READ_ONCE(pool->max_queued),
+				READ_ONCE(pool->lock_wait_ns));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(copy_page_pools);
+
+/* node chan active max_active busy_ns bytes xfers */
+static int copy_page_dma_chans_show(struct seq_file *m, void *v)
+{
+	struct copy_dma_chan_stat *stat;
+	struct copy_dma_chans *chans;
+	u64 busy_ns;
+	int nid, i;
+
+	seq_puts(m, "node chan active max_active busy_ns bytes xfers\n");
+	down_read(&copy_dma_sem);
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		chans = &copy_dma_pool[nid];
+		for (i = 0; i < chans->nr_chans; i++) {
+			stat = &chans->stat[i];
+			spin_lock(&stat->lock);
+			busy_ns = stat->busy_ns;
+			/* the current busy period too */
+			if (stat->nr_active)
+				busy_ns += ktime_get_ns() - stat->active_since;
+			seq_printf(m, "%d %s %d %d %llu %llu %lu\n", nid,
+					dma_chan_name(chans->chans[i]),
+					stat->nr_active, stat->max_active,
+					busy_ns, stat->bytes, stat->nr_xfers);
+			spin_unlock(&stat->lock);
+		}
+	}
+	up_read(&copy_dma_sem);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(copy_page_dma_chans);
+
+/*
+ * copy_page/workers: what the multi-threaded copy workers of each CPU ran,
+ * copied and waited in the workqueue; copy_page/pools: how many copies
+ * each node's worker pool ran and how many queued behind each other for
+ * it; copy_page/dma_chans: how long each DMA channel was busy and what it
+ * transferred. Times are in nanoseconds.
+ */
+static int __init copy_page_stat_init(void)
+{
+	struct dentry *dir = debugfs_create_dir("copy_page", NULL);
+
+	debugfs_create_file("workers", 0444, dir, NULL,
+			&copy_page_workers_fops);
+	debugfs_create_file("pools", 0444, dir, NULL, &copy_page_pools_fops);
+	debugfs_create_file("dma_chans", 0444, dir, NULL,
+			&copy_page_dma_chans_fops);
+
+	return 0;
+}
+late_initcall(copy_page_stat_init);
@@ -1,6 +1,9 @@
 /*
  * Exchange two in-use pages. Page flags and page->mapping are exchanged
- * as well. Only anonymous pages are supported.
+ * as well. Anonymous pages, shmem pages and page cache pages of
+ * filesystems using buffer_migrate_page() or no migratepage at all are
+ * supported, and so are hugetlb pages of the same size. Swap cache pages
+ * are not.
  *
  * Copyright (C) 2016 NVIDIA, Zi Yan <ziy@nvidia.com>
  *
@@ -10,6 +13,7 @@
 #include <linux/syscalls.h>
 #include <linux/migrate.h>
 #include <linux/exchange.h>
+#include <linux/prefetch.h>
 #include <linux/security.h>
 #include <linux/cpuset.h>
 #include <linux/hugetlb.h>
@@ -23,7 +27,11 @@
 #include <linux/fs.h> /* buffer_migrate_page  */
 #include <linux/backing-dev.h>
 #include <linux/sched/mm.h>
+#include <linux/migrate_history.h>
+#include <linux/migrate_latency.h>
+#include <linux/migrate_stat.h>
 
+#include <trace/events/migrate.h>
 
 #include "internal.h"
 
@@ -76,30 +84,35 @@ static void pr_dump_page(struct page *page, const char *msg)
 		);
 }
 
-static void exchange_page(char *to, char *from)
+static void exchange_page(char *to, char *from, bool nt,
+		unsigned int prefetch)
 {
-	u64 tmp;
-	int i;
-
-	for (i = 0; i < PAGE_SIZE; i += sizeof(tmp)) {
-		tmp = *((u64*)(from + i));
-		*((u64*)(from + i)) = *((u64*)(to + i));
-		*((u64*)(to + i)) = tmp;
-	}
+	kernel_fpu_begin();
+	page_exchange(to, from, PAGE_SIZE, nt, prefetch);
+	kernel_fpu_end();
 }
 
-static inline void exchange_highpage(struct page *to, struct page *from)
+/*
+ * Exchange one base page of a @page_size page, the exchange kernel is
+ * picked for the whole page.
+ */
+static inline void __exchange_highpage(struct page *to, struct page *from,
+		unsigned long page_size)
 {
 	char *vfrom, *vto;
+	bool nt = page_exchange_use_nt(page_to_nid(to), page_to_nid(from),
+			page_size);
 
 	vfrom = kmap_atomic(from);
 	vto = kmap_atomic(to);
-	exchange_page(vto, vfrom);
+	exchange_page(vto, vfrom, nt,
+		      page_exchange_prefetch(page_to_nid(to), page_to_nid(from)));
 	kunmap_atomic(vto);
 	kunmap_atomic(vfrom);
 }
 
-static void __exchange_gigantic_page(struct page *dst, struct page *src,
+/* Exchange @nr_pages base pages of a possibly gigantic page */
+static void exchange_highpages(struct page *dst, struct page *src,
 				int nr_pages)
 {
 	int i;
@@ -108,7 +121,7 @@ static void __exchange_gigantic_page(struct page *dst, struct page *src,
 
 	for (i = 0; i < nr_pages; ) {
 		cond_resched();
-		exchange_highpage(dst, src);
+		__exchange_highpage(dst, src, PAGE_SIZE * nr_pages);
 
 		i++;
 		dst = mem_map_next(dst, dst_base, i);
@@ -116,29 +129,51 @@ static void __exchange_gigantic_page(struct page *dst, struct page *src,
 	}
 }
 
+/* With RPDAA the exchange runs on the socket local to the PMEM page */
+static void exchange_highpages_rpdaa(struct page *dst, struct page *src,
+				int nr_pages)
+{
+	int nid = copy_page_socket_local(dst, src, nr_pages,
+			exchange_highpages);
+
+	if (nid < 0) {
+		exchange_highpages(dst, src, nr_pages);
+		nid = numa_node_id();
+	}
+	count_pmem_write(nid, page_to_nid(dst), PAGE_SIZE * nr_pages);
+	count_pmem_write(nid, page_to_nid(src), PAGE_SIZE * nr_pages);
+}
+
+static inline void exchange_highpage(struct page *to, struct page *from)
+{
+	exchange_highpages_rpdaa(to, from, 1);
+}
+
+/*
+ * Huge pages are exchanged by the exchange workers whatever the migration
+ * mode asked for: a single CPU cannot get near the bandwidth of the nodes
+ * on a 2MB or larger swap. The workers run on the RPDAA node and use NT
+ * stores as page_exchange_use_nt() decides.
+ */
 static void exchange_huge_page(struct page *dst, struct page *src)
 {
-	int i;
 	int nr_pages;
 
 	if (PageHuge(src)) {
 		/* hugetlbfs page */
 		struct hstate *h = page_hstate(src);
 		nr_pages = pages_per_huge_page(h);
-
-		if (unlikely(nr_pages > MAX_ORDER_NR_PAGES)) {
-			__exchange_gigantic_page(dst, src, nr_pages);
-			return;
-		}
 	} else {
 		/* thp page */
 		BUG_ON(!PageTransHuge(src));
 		nr_pages = hpage_nr_pages(src);
 	}
 
-	for (i = 0; i < nr_pages; i++) {
-		exchange_highpage(dst + i, src + i);
-	}
+	if (page_copy_nr_threads() > 1 &&
+	    !exchange_page_mthread(dst, src, nr_pages))
+		return;
+
+	exchange_highpages_rpdaa(dst, src, nr_pages);
 }
 
 /*
@@ -266,6 +301,8 @@ static void exchange_page_flags(struct page *to_page, struct page *from_page)
 	 */
 	page_cpupid_xchg_last(to_page, from_cpupid);
 	page_cpupid_xchg_last(from_page, to_cpupid);
+	page_migrate_history_record(to_page, from_page);
+	page_migrate_history_record(from_page, to_page);
 
 	ksm_exchange_page(to_page, from_page);
 	/*
@@ -290,6 +327,65 @@ static void exchange_page_flags(struct page *to_page, struct page *from_page)
 
 }
 
+/* Lock the page cache of both pages, in a stable order */
+static void exchange_lock_mappings(struct address_space *a,
+		struct address_space *b)
+{
+	if (a == b) {
+		xa_lock_irq(&a->i_pages);
+		return;
+	}
+	if (a > b)
+		swap(a, b);
+	xa_lock_irq(&a->i_pages);
+	spin_lock_nested(&b->i_pages.xa_lock, SINGLE_DEPTH_NESTING);
+}
+
+/* Leaves interrupts disabled for the node statistics updates */
+static void exchange_unlock_mappings(struct address_space *a,
+		struct address_space *b)
+{
+	if (a != b)
+		xa_unlock(&b->i_pages);
+	xa_unlock(&a->i_pages);
+}
+
+/*
+ * Page cache references of @page: one per subpage for a THP, one for a
+ * hugetlb page, which takes a single slot of its hugetlbfs mapping.
+ */
+static int exchange_cache_refs(struct page *page)
+{
+	return PageHuge(page) ? 1 : hpage_nr_pages(page);
+}
+
+/* Store @page in all the page cache slots @xas covers for it */
+static void exchange_xas_store(struct xa_state *xas, struct page *page)
+{
+	int i;
+
+	xas_store(xas, page);
+	for (i = 1; i < exchange_cache_refs(page); i++) {
+		xas_next(xas);
+		xas_store(xas, page);
+	}
+}
+
+/* Undo buffer_migrate_lock_buffers() */
+static void exchange_unlock_buffers(struct buffer_head *head)
+{
+	struct buffer_head *bh = head;
+
+	if (!head)
+		return;
+
+	do {
+		unlock_buffer(bh);
+		put_bh(bh);
+		bh = bh->b_this_page;
+	} while (bh != head);
+}
+
 /*
  * Replace the page in the mapping.
  *
@@ -359,7 +455,8 @@ static int exchange_page_move_mapping(struct address_space *to_mapping,
 
 		xas_lock_irq(&to_xas);
 
-		to_expected_count += 1 + page_has_private(to_page);
+		to_expected_count += exchange_cache_refs(to_page) +
+			page_has_private(to_page);
 		if (page_count(to_page) != to_expected_count ||
 			xas_load(&to_xas) != to_page) {
 			xas_unlock_irq(&to_xas);
@@ -395,7 +492,7 @@ static int exchange_page_move_mapping(struct address_space *to_mapping,
 		to_page->index = from_page_index;
 		to_page->mapping = from_mapping_value;
 
-		page_ref_add(from_page, hpage_nr_pages(to_page)); /* add cache reference  */
+		page_ref_add(from_page, exchange_cache_refs(to_page)); /* add cache reference  */
 		if (to_swapbacked)
 			__SetPageSwapBacked(from_page);
 		else
@@ -408,10 +505,11 @@ static int exchange_page_move_mapping(struct address_space *to_mapping,
 
 		dirty = PageDirty(to_page);
 
-		xas_store(&to_xas, from_page);
+		exchange_xas_store(&to_xas, from_page);
 
 		/* drop cache reference */
-		page_ref_unfreeze(to_page, to_expected_count - hpage_nr_pages(to_page));
+		page_ref_unfreeze(to_page, to_expected_count -
+				exchange_cache_refs(to_page));
 
 		xas_unlock_irq(&to_xas);
 
@@ -423,9 +521,10 @@ static int exchange_page_move_mapping(struct address_space *to_mapping,
 		 *
 		 * Note that anonymous pages are accounted for
 		 * via NR_FILE_PAGES and NR_ANON_MAPPED if they
-		 * are mapped to swap space.
+		 * are mapped to swap space. hugetlbfs pages are not
+		 * counted in NR_FILE_PAGES.
 		 */
-		if (to_zone != from_zone) {
+		if (to_zone != from_zone && !PageHuge(to_page)) {
 			__dec_node_state(to_zone->zone_pgdat, NR_FILE_PAGES);
 			__inc_node_state(from_zone->zone_pgdat, NR_FILE_PAGES);
 			if (PageSwapBacked(to_page) && !PageSwapCache(to_page)) {
@@ -441,21 +540,219 @@ static int exchange_page_move_mapping(struct address_space *to_mapping,
 		}
 		local_irq_enable();
 
+	} else if (from_mapping && to_mapping) { /* both are file-backed */
+		XA_STATE(to_xas, &to_mapping->i_pages, page_index(to_page));
+		XA_STATE(from_xas, &from_mapping->i_pages, page_index(from_page));
+		int nr_pages = hpage_nr_pages(from_page);
+		int nr_refs = exchange_cache_refs(from_page);
+		struct zone *from_zone, *to_zone;
+		int to_dirty, from_dirty, delta;
+
+		from_zone = page_zone(from_page);
+		to_zone = page_zone(to_page);
+
+		exchange_lock_mappings(to_mapping, from_mapping);
+
+		to_expected_count += nr_refs + page_has_private(to_page);
+		from_expected_count += nr_refs + page_has_private(from_page);
+		if (page_count(to_page) != to_expected_count ||
+			page_count(from_page) != from_expected_count ||
+			xas_load(&to_xas) != to_page ||
+			xas_load(&from_xas) != from_page) {
+			exchange_unlock_mappings(to_mapping, from_mapping);
+			local_irq_enable();
+			return -EAGAIN;
+		}
+
+		if (!page_ref_freeze(to_page, to_expected_count))
+			goto out_unlock_mappings;
+		if (!page_ref_freeze(from_page, from_expected_count)) {
+			page_ref_unfreeze(to_page, to_expected_count);
+			goto out_unlock_mappings;
+		}
+
+		if ((mode & MIGRATE_MODE_MASK) == MIGRATE_ASYNC) {
+			if (to_head && !buffer_migrate_lock_buffers(to_head, mode))
+				goto out_unfreeze;
+			if (from_head &&
+			    !buffer_migrate_lock_buffers(from_head, mode)) {
+				exchange_unlock_buffers(to_head);
+				goto out_unfreeze;
+			}
+		}
+
+		/*
+		 * Now we know that no one else is looking at the pages:
+		 * no turning back from here.
+		 */
+		from_page->index = to_page_index;
+		from_page->mapping = to_mapping_value;
+		to_page->index = from_page_index;
+		to_page->mapping = from_mapping_value;
+
+		/* shmem pages are swap backed */
+		__ClearPageSwapBacked(from_page);
+		__ClearPageSwapBacked(to_page);
+		if (to_swapbacked)
+			__SetPageSwapBacked(from_page);
+		if (from_swapbacked)
+			__SetPageSwapBacked(to_page);
+
+		to_dirty = PageDirty(to_page) &&
+			mapping_cap_account_dirty(to_mapping);
+		from_dirty = PageDirty(from_page) &&
+			mapping_cap_account_dirty(from_mapping);
+
+		/* each page takes the cache references of the other's slots */
+		exchange_xas_store(&to_xas, from_page);
+		exchange_xas_store(&from_xas, to_page);
+
+		page_ref_unfreeze(to_page, to_expected_count);
+		page_ref_unfreeze(from_page, from_expected_count);
+
+		exchange_unlock_mappings(to_mapping, from_mapping);
+
+		/*
+		 * Both pages stay in the page cache, only the shmem and dirty
+		 * pages change node along with the data.
+		 */
+		if (to_zone != from_zone) {
+			delta = (to_swapbacked - from_swapbacked) * nr_pages;
+			if (delta) {
+				__mod_node_page_state(from_zone->zone_pgdat,
+						NR_SHMEM, delta);
+				__mod_node_page_state(to_zone->zone_pgdat,
+						NR_SHMEM, -delta);
+			}
+			delta = (to_dirty - from_dirty) * nr_pages;
+			if (delta) {
+				__mod_node_page_state(from_zone->zone_pgdat,
+						NR_FILE_DIRTY, delta);
+				__mod_zone_page_state(from_zone,
+						NR_ZONE_WRITE_PENDING, delta);
+				__mod_node_page_state(to_zone->zone_pgdat,
+						NR_FILE_DIRTY, -delta);
+				__mod_zone_page_state(to_zone,
+						NR_ZONE_WRITE_PENDING, -delta);
+			}
+		}
+		local_irq_enable();
 	} else {
-		/* from is file-backed to is anonymous: fold this to the case above */
-		/* both are file-backed  */
+		/* exchange_from_to_pages() folds file-backed <-> anonymous */
 		BUG();
 	}
 
 	return MIGRATEPAGE_SUCCESS;
+
+out_unfreeze:
+	page_ref_unfreeze(from_page, from_expected_count);
+	page_ref_unfreeze(to_page, to_expected_count);
+out_unlock_mappings:
+	exchange_unlock_mappings(to_mapping, from_mapping);
+	local_irq_enable();
+	pr_debug("cannot freeze page count or lock buffer head\n");
+	return -EAGAIN;
+}
+
+/*
+ * Check that the mapping of @page can be exchanged and return in @head the
+ * buffers that have to follow its data, if any.
+ */
+static int exchange_prepare_mapping(struct address_space *mapping,
+		struct page *page, enum migrate_mode mode,
+		struct buffer_head **head)
+{
+	*head = NULL;
+
+	if (!mapping)
+		return MIGRATEPAGE_SUCCESS;
+
+	/* the swap entry in page_private() would have to be exchanged too */
+	if (PageSwapCache(page))
+		return -EBUSY;
+
+	/* hugetlbfs: exchange_hugetlb_state() swaps the subpools */
+	if (PageHuge(page))
+		return MIGRATEPAGE_SUCCESS;
+
+	if (mapping->a_ops->migratepage == buffer_migrate_page) {
+		if (page_has_buffers(page))
+			*head = page_buffers(page);
+		return MIGRATEPAGE_SUCCESS;
+	}
+
+	/* shmem: no private data to move */
+	if (mapping->a_ops->migratepage == migrate_page)
+		return page_has_private(page) ? -EBUSY : MIGRATEPAGE_SUCCESS;
+
+	if (!mapping->a_ops->migratepage) {
+		/* fallback_migrate_page  */
+		if (PageDirty(page)) {
+			if ((mode & MIGRATE_MODE_MASK) != MIGRATE_SYNC)
+				return -EBUSY;
+			return writeout(mapping, page);
+		}
+		if (page_has_private(page) &&
+			!try_to_release_page(page, GFP_KERNEL))
+			return -EAGAIN;
+		return MIGRATEPAGE_SUCCESS;
+	}
+
+	/* a migratepage of its own means private state we cannot exchange */
+	return -EBUSY;
+}
+
+/*
+ * Hand the buffers of each page over to the other page, which holds their
+ * data after the exchange. The buffers are locked.
+ */
+static void exchange_page_buffers(struct page *to_page, struct page *from_page,
+		struct buffer_head *to_head, struct buffer_head *from_head)
+{
+	unsigned long to_private = page_private(to_page);
+	unsigned long from_private = page_private(from_page);
+	struct buffer_head *bh;
+
+	/* transfer private page counts */
+	if (to_head) {
+		ClearPagePrivate(to_page);
+		get_page(from_page);
+		put_page(to_page);
+	}
+	if (from_head) {
+		ClearPagePrivate(from_page);
+		get_page(to_page);
+		put_page(from_page);
+	}
+
+	set_page_private(from_page, to_head ? to_private : 0);
+	set_page_private(to_page, from_head ? from_private : 0);
+
+	if (to_head) {
+		bh = to_head;
+		do {
+			set_bh_page(bh, from_page, bh_offset(bh));
+			bh = bh->b_this_page;
+		} while (bh != to_head);
+		SetPagePrivate(from_page);
+	}
+
+	if (from_head) {
+		bh = from_head;
+		do {
+			set_bh_page(bh, to_page, bh_offset(bh));
+			bh = bh->b_this_page;
+		} while (bh != from_head);
+		SetPagePrivate(to_page);
+	}
 }
 
 static int exchange_from_to_pages(struct page *to_page, struct page *from_page,
 				enum migrate_mode mode)
 {
-	int rc = -EBUSY;
+	int rc;
 	struct address_space *to_page_mapping, *from_page_mapping;
-	struct buffer_head *to_head = NULL, *to_bh = NULL;
+	struct buffer_head *to_head, *from_head;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
@@ -467,80 +764,50 @@ static int exchange_from_to_pages(struct page *to_page, struct page *from_page,
 	to_page_mapping = page_mapping(to_page);
 	from_page_mapping = page_mapping(from_page);
 
-	/* from_page has to be anonymous page  */
-	BUG_ON(from_page_mapping);
-	BUG_ON(PageWriteback(from_page));
+	/*
+	 * The exchange is symmetric: fold file-backed <-> anonymous into
+	 * anonymous <-> file-backed.
+	 */
+	if (from_page_mapping && !to_page_mapping) {
+		swap(from_page, to_page);
+		swap(from_page_mapping, to_page_mapping);
+	}
+
 	/* writeback has to finish */
+	BUG_ON(PageWriteback(from_page));
 	BUG_ON(PageWriteback(to_page));
 
-	pr_dump_page(from_page, "exchange anonymous page: from ");
-
-	/* to_page is anonymous  */
-	if (!to_page_mapping) {
-		pr_dump_page(to_page, "exchange anonymous page: to ");
-exchange_mappings:
-		/* actual page mapping exchange */
-		rc = exchange_page_move_mapping(to_page_mapping, from_page_mapping,
-							to_page, from_page, NULL, NULL, mode, 0, 0);
-	} else {
-		if (to_page_mapping->a_ops->migratepage == buffer_migrate_page) {
-
-			pr_dump_page(to_page, "exchange has migratepage: to ");
-
-			if (!page_has_buffers(to_page))
-				goto exchange_mappings;
-
-			to_head = page_buffers(to_page);
-
-			rc = exchange_page_move_mapping(to_page_mapping,
-					from_page_mapping, to_page, from_page,
-					to_head, NULL, mode, 0, 0);
-
-			if (rc != MIGRATEPAGE_SUCCESS)
-				return rc;
-
-			/*
-			 * In the async case, migrate_page_move_mapping locked the buffers
-			 * with an IRQ-safe spinlock held. In the sync case, the buffers
-			 * need to be locked now
-			 */
-			if ((mode & MIGRATE_MODE_MASK) != MIGRATE_ASYNC)
-				BUG_ON(!buffer_migrate_lock_buffers(to_head, mode));
-
-			ClearPagePrivate(to_page);
-			set_page_private(from_page, page_private(to_page));
-			set_page_private(to_page, 0);
-			/* transfer private page count  */
-			put_page(to_page);
-			get_page(from_page);
+	pr_dump_page(from_page, "exchange page: from ");
+	pr_dump_page(to_page, "exchange page: to ");
 
-			to_bh = to_head;
-			do {
-				set_bh_page(to_bh, from_page, bh_offset(to_bh));
-				to_bh = to_bh->b_this_page;
-
-			} while (to_bh != to_head);
-
-			SetPagePrivate(from_page);
-
-			to_bh = to_head;
-		} else if (!to_page_mapping->a_ops->migratepage) {
-			/* fallback_migrate_page  */
-			pr_dump_page(to_page, "exchange no migratepage: to ");
+	rc = exchange_prepare_mapping(to_page_mapping, to_page, mode, &to_head);
+	if (rc != MIGRATEPAGE_SUCCESS)
+		return rc;
+	rc = exchange_prepare_mapping(from_page_mapping, from_page, mode,
+			&from_head);
+	if (rc != MIGRATEPAGE_SUCCESS)
+		return rc;
 
-			if (PageDirty(to_page)) {
-				if ((mode & MIGRATE_MODE_MASK) != MIGRATE_SYNC)
-					return -EBUSY;
-				return writeout(to_page_mapping, to_page);
-			}
-			if (page_has_private(to_page) &&
-				!try_to_release_page(to_page, GFP_KERNEL))
-				return -EAGAIN;
+	/* actual page mapping exchange */
+	rc = exchange_page_move_mapping(to_page_mapping, from_page_mapping,
+			to_page, from_page, to_head, from_head, mode, 0, 0);
+	if (rc != MIGRATEPAGE_SUCCESS)
+		return rc;
 
-			goto exchange_mappings;
-		}
+	/*
+	 * In the async case, exchange_page_move_mapping locked the buffers
+	 * with an IRQ-safe spinlock held. In the sync case, the buffers
+	 * need to be locked now
+	 */
+	if ((mode & MIGRATE_MODE_MASK) != MIGRATE_ASYNC) {
+		if (to_head)
+			BUG_ON(!buffer_migrate_lock_buffers(to_head, mode));
+		if (from_head)
+			BUG_ON(!buffer_migrate_lock_buffers(from_head, mode));
 	}
 
+	exchange_page_buffers(to_page, from_page, to_head, from_head);
+
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	timestamp = rdtsc();
 	current->move_pages_breakdown.change_page_mapping_cycles += timestamp -
@@ -549,33 +816,29 @@ static int exchange_from_to_pages(struct page *to_page, struct page *from_page,
 #endif
 
 	/* actual page data exchange  */
-	if (rc != MIGRATEPAGE_SUCCESS)
-		return rc;
-
 	rc = -EFAULT;
 
-	if (mode & MIGRATE_MT)
-		rc = exchange_page_mthread(to_page, from_page,
-				hpage_nr_pages(from_page));
-	if (rc) {
-		if (PageHuge(from_page) || PageTransHuge(from_page))
-			exchange_huge_page(to_page, from_page);
-		else
+	if (PageHuge(from_page) || PageTransHuge(from_page)) {
+		exchange_huge_page(to_page, from_page);
+		rc = 0;
+	} else {
+		if (mode & MIGRATE_MT)
+			rc = exchange_page_mthread(to_page, from_page, 1);
+		if (rc)
 			exchange_highpage(to_page, from_page);
 		rc = 0;
 	}
 
 	/*
-	 * 1. buffer_migrate_page:
-	 *   private flag should be transferred from to_page to from_page
-	 *
-	 * 2. anon<->anon, fallback_migrate_page:
-	 *   both have none private flags or to_page's is cleared.
-	 * */
-	VM_BUG_ON(!((page_has_private(from_page) && !page_has_private(to_page)) ||
-				(!page_has_private(from_page) && !page_has_private(to_page))));
+	 * The buffers of a buffer_migrate_page mapping follow the data, the
+	 * other pages have no private data or had it released.
+	 */
+	VM_BUG_ON_PAGE(page_has_private(from_page) != !!to_head, from_page);
+	VM_BUG_ON_PAGE(page_has_private(to_page) != !!from_head, to_page);
 
 	exchange_page_flags(to_page, from_page);
+	if (PageHuge(from_page))
+		exchange_hugetlb_state(to_page, from_page);
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	timestamp = rdtsc();
@@ -587,15 +850,8 @@ static int exchange_from_to_pages(struct page *to_page, struct page *from_page,
 	pr_dump_page(from_page, "after exchange: from ");
 	pr_dump_page(to_page, "after exchange: to ");
 
-	if (to_bh) {
-		VM_BUG_ON(to_bh != to_head);
-		do {
-			unlock_buffer(to_bh);
-			put_bh(to_bh);
-			to_bh = to_bh->b_this_page;
-
-		} while (to_bh != to_head);
-	}
+	exchange_unlock_buffers(to_head);
+	exchange_unlock_buffers(from_head);
 
 	return rc;
 }
@@ -627,7 +883,7 @@ static int unmap_and_exchange(struct page *from_page,
 
 	if (!trylock_page(to_page)) {
 		if ((mode & MIGRATE_MODE_MASK) == MIGRATE_ASYNC)
-			goto out;
+			goto out_unlock;
 		lock_page(to_page);
 	}
 
@@ -638,10 +894,7 @@ static int unmap_and_exchange(struct page *from_page,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	/* from_page is supposed to be an anonymous page */
-	VM_BUG_ON_PAGE(PageWriteback(from_page), from_page);
-
-	if (PageWriteback(to_page)) {
+	if (PageWriteback(from_page) || PageWriteback(to_page)) {
 		/*
 		 * Only in the case of a full synchronous migration is it
 		 * necessary to wait for PageWriteback. In the async case,
@@ -650,8 +903,9 @@ static int unmap_and_exchange(struct page *from_page,
 		 */
 		if ((mode & MIGRATE_MODE_MASK) != MIGRATE_SYNC) {
 			rc = -EBUSY;
-			goto out_unlock;
+			goto out_unlock_both;
 		}
+		wait_on_page_writeback(from_page);
 		wait_on_page_writeback(to_page);
 	}
 
@@ -871,6 +1125,28 @@ static int unmap_and_exchange(struct page *from_page,
 	return rc;
 }
 
+/* Charge both directions of an exchange to the migration rate limits */
+static u64 exchange_rate_charge(struct page *from_page, struct page *to_page,
+		int reason, enum migrate_mode mode)
+{
+	return max(migrate_rate_charge(from_page, page_to_nid(to_page), reason,
+				       mode),
+		   migrate_rate_charge(to_page, page_to_nid(from_page), reason,
+				       mode));
+}
+
+/*
+ * Count both directions of an exchange by node pair. Each page now holds
+ * the data of the other one, and its memcg.
+ */
+static void exchange_count_pairs(struct page *from_page, struct page *to_page)
+{
+	count_migrate_pair(from_page, page_to_nid(to_page),
+			page_to_nid(from_page), MIGRATE_ENGINE_EXCHANGE);
+	count_migrate_pair(to_page, page_to_nid(from_page),
+			page_to_nid(to_page), MIGRATE_ENGINE_EXCHANGE);
+}
+
 static bool can_be_exchanged(struct page *from, struct page *to)
 {
 	if (PageCompound(from) != PageCompound(to))
@@ -879,7 +1155,9 @@ static bool can_be_exchanged(struct page *from, struct page *to)
 	if (PageHuge(from) != PageHuge(to))
 		return false;
 
-	if (PageHuge(from) || PageHuge(to))
+	/* hugetlb pages of one hstate, exchange_hugetlb_state() swaps them */
+	if (PageHuge(from) && (page_hstate(from) != page_hstate(to) ||
+			       !hugepage_migration_supported(page_hstate(from))))
 		return false;
 
 	if (compound_order(from) != compound_order(to))
@@ -888,6 +1166,119 @@ static bool can_be_exchanged(struct page *from, struct page *to)
 	return true;
 }
 
+/* Exchange what exchange_page_move_mapping() does for anonymous pages */
+static void rotate_exchange_anon_mapping(struct page *to_page,
+		struct page *from_page)
+{
+	int to_swapbacked = PageSwapBacked(to_page);
+	int from_swapbacked = PageSwapBacked(from_page);
+
+	swap(to_page->mapping, from_page->mapping);
+	swap(to_page->index, from_page->index);
+
+	ClearPageSwapBacked(to_page);
+	ClearPageSwapBacked(from_page);
+	if (from_swapbacked)
+		SetPageSwapBacked(to_page);
+	if (to_swapbacked)
+		SetPageSwapBacked(from_page);
+}
+
+/*
+ * With MIGRATE_SWAP_MAPPINGS a pair swaps the addresses mapping its pages
+ * rather than the data of the pages: the contents seen at the two places
+ * are swapped in O(1) whatever the page size, and both pages stay where
+ * they are. Only for anonymous pages mapped once, by a pte or the pmd of
+ * a THP, and charged to the same memcg, the charge staying with the data.
+ */
+static bool can_swap_mappings(struct page *page)
+{
+	if (!PageAnon(page) || PageKsm(page) || PageSwapCache(page))
+		return false;
+	if (PageMlocked(page) || PageWriteback(page))
+		return false;
+	if (PageTransHuge(page) &&
+	    (!thp_migration_supported() || compound_mapcount(page) != 1))
+		return false;
+
+	return total_mapcount(page) == 1;
+}
+
+static int unmap_and_swap_mappings(struct page *from_page,
+		struct page *to_page, enum migrate_mode mode)
+{
+	struct anon_vma *from_anon_vma, *to_anon_vma;
+	pgoff_t from_index, to_index;
+	int rc = -EAGAIN;
+
+	if (PageHuge(from_page) || page_memcg(from_page) != page_memcg(to_page))
+		return -EINVAL;
+
+	if (!trylock_page(from_page)) {
+		if ((mode & MIGRATE_MODE_MASK) == MIGRATE_ASYNC)
+			return rc;
+		lock_page(from_page);
+	}
+	/* a task locking them in the other order cannot deadlock with us */
+	if (!trylock_page(to_page))
+		goto out_unlock;
+
+	rc = -EBUSY;
+	if (!can_swap_mappings(from_page) || !can_swap_mappings(to_page))
+		goto out_unlock_both;
+
+	from_anon_vma = page_get_anon_vma(from_page);
+	to_anon_vma = page_get_anon_vma(to_page);
+	if (!from_anon_vma || !to_anon_vma)
+		goto out_put;
+
+	from_index = from_page->index;
+	to_index = to_page->index;
+
+	try_to_unmap(from_page, TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
+	try_to_unmap(to_page, TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
+
+	/* nothing but the isolation may hold a reference from here on */
+	if (!page_mapped(from_page) && !page_mapped(to_page) &&
+	    page_count(from_page) == 1 && page_count(to_page) == 1) {
+		rotate_exchange_anon_mapping(to_page, from_page);
+		rc = MIGRATEPAGE_SUCCESS;
+	}
+
+	/*
+	 * On success the migration entries of each page are replaced by the
+	 * other page, which took over their anon_vma and index. Like in
+	 * rotate_pages(), remove_migration_ptes() wants the index the ptes
+	 * were made for in the old page.
+	 */
+	if (rc == MIGRATEPAGE_SUCCESS) {
+		swap(from_page->index, from_index);
+		remove_migration_ptes(from_page, to_page, false);
+		swap(from_page->index, from_index);
+
+		swap(to_page->index, to_index);
+		remove_migration_ptes(to_page, from_page, false);
+		swap(to_page->index, to_index);
+
+		count_vm_events(PGEXCHANGE_SWAP_MAPPINGS,
+				2 * hpage_nr_pages(from_page));
+	} else {
+		remove_migration_ptes(from_page, from_page, false);
+		remove_migration_ptes(to_page, to_page, false);
+	}
+
+out_put:
+	if (from_anon_vma)
+		put_anon_vma(from_anon_vma);
+	if (to_anon_vma)
+		put_anon_vma(to_anon_vma);
+out_unlock_both:
+	unlock_page(to_page);
+out_unlock:
+	unlock_page(from_page);
+	return rc;
+}
+
 /*
  * Exchange pages in the exchange_list
  *
@@ -912,10 +1303,25 @@ int exchange_pages(struct list_head *exchange_list,
 	list_for_each_entry_safe(one_pair, one_pair2, exchange_list, list) {
 		struct page *from_page = one_pair->from_page;
 		struct page *to_page = one_pair->to_page;
+		/* the exchange swaps which of the two pages is file cache */
+		int from_file = page_is_file_cache(from_page);
+		int to_file = page_is_file_cache(to_page);
+		u64 rate_wait = 0, start;
 		int rc;
 		int retry = 0;
 
 again:
+		if (PageHuge(from_page) || PageHuge(to_page)) {
+			/*
+			 * Not on the LRU: a hugetlb page freed from under us
+			 * goes back to its pool from the putback.
+			 */
+			if (page_count(from_page) == 1 ||
+			    page_count(to_page) == 1)
+				goto putback;
+			goto exchange;
+		}
+
 		if (page_count(from_page) == 1) {
 			/* page was freed from under us. So we are done  */
 			ClearPageActive(from_page);
@@ -951,16 +1357,25 @@ int exchange_pages(struct list_head *exchange_list,
 			continue;
 		}
 
-		/* TODO: compound page not supported */
-		if (!can_be_exchanged(from_page, to_page) ||
-			page_mapping(from_page)
-			/* allow to_page to be file-backed page  */
-			/*|| page_mapping(to_page)*/
-			) {
+exchange:
+		if (!can_be_exchanged(from_page, to_page)) {
 			++failed;
 			goto putback;
 		}
 
+		if (mode & MIGRATE_SWAP_MAPPINGS) {
+			rc = unmap_and_swap_mappings(from_page, to_page, mode);
+			if (rc == -EAGAIN && retry < 3) {
+				++retry;
+				goto again;
+			}
+			/* no data moved, nothing to count against the rates */
+			if (rc != MIGRATEPAGE_SUCCESS)
+				++failed;
+			goto putback;
+		}
+
+		start = migrate_latency_start();
 		rc = unmap_and_exchange(from_page, to_page, mode);
 
 		if (rc == -EAGAIN && retry < 3) {
@@ -968,12 +1383,29 @@ int exchange_pages(struct list_head *exchange_list,
 			goto again;
 		}
 
-		if (rc != MIGRATEPAGE_SUCCESS)
+		if (rc != MIGRATEPAGE_SUCCESS) {
 			++failed;
+		} else {
+			/* the pages have swapped their contents, not their nodes */
+			migrate_latency_done(MIGRATE_ENGINE_EXCHANGE,
+					MIGRATE_PHASE_PAGE, page_to_nid(to_page),
+					page_to_nid(from_page), start);
+			exchange_count_pairs(from_page, to_page);
+			rate_wait = exchange_rate_charge(from_page, to_page,
+					reason, mode);
+		}
 
 putback:
-		dec_node_page_state(from_page, NR_ISOLATED_ANON +
-				page_is_file_cache(from_page));
+		if (PageHuge(from_page) || PageHuge(to_page)) {
+			/* isolate_huge_page() does not count NR_ISOLATED_* */
+			putback_active_hugepage(from_page);
+			putback_active_hugepage(to_page);
+			migrate_rate_throttle(rate_wait, mode);
+			continue;
+		}
+
+		mod_node_page_state(page_pgdat(from_page), NR_ISOLATED_ANON +
+				from_file, -hpage_nr_pages(from_page));
 
 		putback_lru_page(from_page);
 
@@ -985,8 +1417,8 @@ int exchange_pages(struct list_head *exchange_list,
 #endif
 putback_to_page:
 		/*if (!__PageMovable(to_page)) {*/
-			dec_node_page_state(to_page, NR_ISOLATED_ANON +
-					page_is_file_cache(to_page));
+			mod_node_page_state(page_pgdat(to_page), NR_ISOLATED_ANON +
+					to_file, -hpage_nr_pages(to_page));
 
 			putback_lru_page(to_page);
 		/*} else {*/
@@ -999,17 +1431,396 @@ int exchange_pages(struct list_head *exchange_list,
 		current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
+		migrate_rate_throttle(rate_wait, mode);
 	}
 	return failed;
 }
 
+/*
+ * Exchange fallback of migrate_pages(): when the target node of a
+ * migration is full, the page is exchanged with a cold page of its memcg
+ * on the target node instead, a promotion without the demotion that would
+ * otherwise have to make room for it first.
+ */
 
-int exchange_two_pages(struct page *page1, struct page *page2)
-{
-	struct exchange_page_info page_info;
-	LIST_HEAD(exchange_list);
-	int err = -EFAULT;
-	int pagevec_flushed = 0;
+// Exchange pages with cold pages of full migration target nodes
+int sysctl_migrate_exchange_fallback = 0;
+
+/* inactive pages looked at for a victim of the same size */
+#define EXCHANGE_FALLBACK_SCAN	SWAP_CLUSTER_MAX
+
+/* Isolate a cold anonymous page of @page's memcg and size on @nid */
+static struct page *exchange_isolate_cold_page(struct page *page, int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	struct mem_cgroup *memcg = NULL;
+	int nr_pages = hpage_nr_pages(page);
+	struct page *victim, *found = NULL;
+	struct lruvec *lruvec;
+	int scan = 0;
+
+#ifdef CONFIG_MEMCG
+	memcg = page->mem_cgroup;
+#endif
+
+	spin_lock_irq(&pgdat->lru_lock);
+	lruvec = mem_cgroup_lruvec(memcg, pgdat);
+	list_for_each_entry_reverse(victim, &lruvec->lists[LRU_INACTIVE_ANON],
+			lru) {
+		if (++scan > EXCHANGE_FALLBACK_SCAN)
+			break;
+		if (PageReferenced(victim) || hpage_nr_pages(victim) != nr_pages)
+			continue;
+		/* swap cache is not exchanged concurrently either */
+		if (page_mapping(victim))
+			continue;
+		if (__isolate_lru_page(victim, 0))
+			continue;
+		del_page_from_lru_list(victim, lruvec, LRU_INACTIVE_ANON);
+		found = victim;
+		break;
+	}
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	if (found)
+		mod_node_page_state(pgdat, NR_ISOLATED_ANON, nr_pages);
+
+	return found;
+}
+
+/*
+ * Pair the isolated @page, whose migration to @nid failed for want of
+ * memory, with a cold page on @nid and queue the pair on @exchange_list,
+ * taking @page off its list. Only anonymous pages are exchanged. A THP
+ * without a cold THP to pair with is left to exchange_thp_target().
+ */
+int exchange_fallback_queue(struct page *page, int nid,
+		struct list_head *exchange_list)
+{
+	struct exchange_page_info *one_pair;
+	struct page *victim;
+
+	if (!exchange_fallback_page(page))
+		return -EINVAL;
+
+	one_pair = kzalloc(sizeof(*one_pair), GFP_KERNEL);
+	if (!one_pair)
+		return -ENOMEM;
+
+	victim = exchange_isolate_cold_page(page, nid);
+	if (!victim) {
+		kfree(one_pair);
+		return -ENOMEM;
+	}
+
+	list_del(&page->lru);
+	one_pair->from_page = page;
+	one_pair->to_page = victim;
+	list_add_tail(&one_pair->list, exchange_list);
+
+	return 0;
+}
+
+/*
+ * Exchange the pairs queued by exchange_fallback_queue() and free them.
+ * Returns the number of pairs that were not exchanged.
+ */
+int exchange_fallback_flush(struct list_head *exchange_list,
+		enum migrate_mode mode, int reason)
+{
+	struct exchange_page_info *one_pair, *one_pair2;
+	int rc;
+
+	if (list_empty(exchange_list))
+		return 0;
+
+	rc = exchange_pages_concur(exchange_list, mode, reason);
+
+	list_for_each_entry_safe(one_pair, one_pair2, exchange_list, list) {
+		list_del(&one_pair->list);
+		kfree(one_pair);
+	}
+
+	return rc;
+}
+
+#ifdef CONFIG_THP_EXCHANGE_TARGET
+/*
+ * Mixed-order exchange: cold memory of a full node is mostly base pages,
+ * so a THP often has no cold THP to be exchanged with. Rather than split
+ * it, an aligned block of the target node made of nothing but free pages
+ * and cold base pages of the THP's memcg is emptied by demoting those
+ * pages to the THP's node, and the block is claimed as the THP's target.
+ */
+
+/* Is @page free, or a cold anonymous base page of @memcg we may move? */
+static bool exchange_cold_block_page(struct page *page, struct zone *zone,
+		struct mem_cgroup *memcg)
+{
+	if (page_zone(page) != zone)
+		return false;
+	if (PageBuddy(page))
+		return true;
+	if (!PageLRU(page) || PageCompound(page) || !PageAnon(page) ||
+	    PageActive(page) || PageReferenced(page) ||
+	    PageUnevictable(page) || page_mapcount(page) > 1)
+		return false;
+#ifdef CONFIG_MEMCG
+	if (page->mem_cgroup != memcg)
+		return false;
+#endif
+	return true;
+}
+
+/*
+ * Isolate the in-use pages of the THP sized block of @nid around @pfn onto
+ * @pages if the whole block qualifies. Returns false, with nothing
+ * isolated, if it does not.
+ */
+static bool exchange_isolate_cold_block(unsigned long pfn, int nid,
+		struct mem_cgroup *memcg, struct list_head *pages)
+{
+	unsigned long start_pfn = round_down(pfn, HPAGE_PMD_NR);
+	struct zone *zone = page_zone(pfn_to_page(pfn));
+	struct page *page;
+	int i;
+
+	if (!zone_spans_pfn(zone, start_pfn) ||
+	    !zone_spans_pfn(zone, start_pfn + HPAGE_PMD_NR - 1))
+		return false;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (!pfn_valid_within(start_pfn + i))
+			return false;
+		if (!exchange_cold_block_page(pfn_to_page(start_pfn + i), zone,
+				memcg))
+			return false;
+	}
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page = pfn_to_page(start_pfn + i);
+		if (PageBuddy(page) || !get_page_unless_zero(page))
+			continue;
+		if (isolate_lru_page(page)) {
+			put_page(page);
+			/* alloc_contig_range() migrates what is left */
+			continue;
+		}
+		put_page(page);
+		list_add_tail(&page->lru, pages);
+		inc_node_page_state(page, NR_ISOLATED_ANON +
+				page_is_file_cache(page));
+	}
+
+	return true;
+}
+
+/*
+ * Free a THP sized block of cold base pages on the full node @nid for the
+ * THP @page and return it as a THP, NULL if there is no such block, or
+ * ERR_PTR(-EAGAIN) if the block emptied could not be claimed.
+ */
+struct page *exchange_thp_target(struct page *page, int nid,
+		enum migrate_mode mode)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	unsigned long pfns[EXCHANGE_FALLBACK_SCAN];
+	struct mem_cgroup *memcg = NULL;
+	struct page *victim, *target;
+	struct lruvec *lruvec;
+	int nr_pfns = 0, i;
+	LIST_HEAD(cold_pages);
+
+	/* alloc_contig_range() sleeps */
+	if ((mode & MIGRATE_MODE_MASK) == MIGRATE_ASYNC)
+		return NULL;
+
+#ifdef CONFIG_MEMCG
+	memcg = page->mem_cgroup;
+#endif
+
+	spin_lock_irq(&pgdat->lru_lock);
+	lruvec = mem_cgroup_lruvec(memcg, pgdat);
+	list_for_each_entry_reverse(victim, &lruvec->lists[LRU_INACTIVE_ANON],
+			lru) {
+		if (nr_pfns == EXCHANGE_FALLBACK_SCAN)
+			break;
+		if (!PageReferenced(victim) && !PageCompound(victim))
+			pfns[nr_pfns++] = page_to_pfn(victim);
+	}
+	spin_unlock_irq(&pgdat->lru_lock);
+
+	for (i = 0; i < nr_pfns; i++) {
+		if (!exchange_isolate_cold_block(pfns[i], nid, memcg,
+				&cold_pages))
+			continue;
+
+		/* the other half of the exchange: demote the cold pages */
+		if (!list_empty(&cold_pages) &&
+		    migrate_pages(&cold_pages, alloc_new_node_page, NULL,
+				page_to_nid(page), MIGRATE_SYNC, MR_CONTIG_RANGE)) {
+			putback_movable_pages(&cold_pages);
+			return NULL;
+		}
+
+		pfns[i] = round_down(pfns[i], HPAGE_PMD_NR);
+		if (alloc_contig_range(pfns[i], pfns[i] + HPAGE_PMD_NR,
+				MIGRATE_MOVABLE, GFP_HIGHUSER_MOVABLE |
+				__GFP_NOWARN))
+			return ERR_PTR(-EAGAIN);
+
+		target = pfn_to_page(pfns[i]);
+		prep_compound_page(target, HPAGE_PMD_ORDER);
+		prep_transhuge_page(target);
+		return target;
+	}
+
+	return NULL;
+}
+#endif /* CONFIG_THP_EXCHANGE_TARGET */
+
+/*
+ * N-way rotation: ring[i].from_page moves to the frame of ring[i].to_page,
+ * which is ring[i + 1].from_page, and the last page to the frame of the
+ * first, in one unmap, copy and remap cycle. The frame of the first page
+ * doubles as the temporary frame of the rotation: exchanging it in turn
+ * with each other page moves every page one frame down the ring.
+ */
+
+static bool can_be_rotated(struct exchange_page_info *ring, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = ring[i].from_page;
+
+		if (ring[i].to_page != ring[(i + 1) % nr].from_page)
+			return false;
+		if (!can_be_exchanged(ring[0].from_page, page))
+			return false;
+		/* only anonymous pages, see exchange_pages() for the others */
+		if (page_mapping(page) || __PageMovable(page))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Rotate the @nr isolated pages of @ring. Returns MIGRATEPAGE_SUCCESS,
+ * -EAGAIN if a page could not be locked or unmapped, or another error;
+ * the pages stay isolated either way.
+ */
+int rotate_pages(struct exchange_page_info *ring, int nr,
+		enum migrate_mode mode, int reason)
+{
+	struct page *first = ring[0].from_page;
+	int nr_locked = 0, i;
+	u64 rate_wait = 0;
+	int rc = -EAGAIN;
+
+	if (nr < 2 || nr > ROTATE_PAGES_MAX || !can_be_rotated(ring, nr))
+		return -EINVAL;
+
+	/* a task locking the pages in another order cannot deadlock with us */
+	for (i = 0; i < nr; i++) {
+		struct page *page = ring[i].from_page;
+
+		ring[i].from_anon_vma = NULL;
+		if (!trylock_page(page)) {
+			if (i || (mode & MIGRATE_MODE_MASK) == MIGRATE_ASYNC)
+				goto out_unlock;
+			lock_page(page);
+		}
+		nr_locked++;
+
+		if (PageWriteback(page))
+			goto out_unlock;
+
+		if (PageAnon(page) && !PageKsm(page))
+			ring[i].from_anon_vma = page_get_anon_vma(page);
+		ring[i].from_index = page->index;
+		ring[i].from_page_was_mapped = 0;
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = ring[i].from_page;
+
+		if (!page->mapping)
+			goto out_remap;
+		if (page_mapped(page)) {
+			try_to_unmap(page,
+				TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
+			ring[i].from_page_was_mapped = 1;
+		}
+	}
+
+	/* nothing but the isolation may hold a reference from here on */
+	for (i = 0; i < nr; i++)
+		if (page_mapped(ring[i].from_page) ||
+		    page_count(ring[i].from_page) != 1)
+			goto out_remap;
+
+	for (i = 0; i < nr; i++)
+		rate_wait = max(rate_wait, migrate_rate_charge(ring[i].from_page,
+					page_to_nid(ring[i].to_page), reason,
+					mode));
+
+	for (i = 1; i < nr; i++) {
+		struct page *page = ring[i].from_page;
+
+		rotate_exchange_anon_mapping(page, first);
+
+		rc = -EFAULT;
+		if (PageTransHuge(first)) {
+			exchange_huge_page(page, first);
+		} else {
+			if (mode & MIGRATE_MT)
+				rc = exchange_page_mthread(page, first, 1);
+			if (rc)
+				exchange_highpage(page, first);
+		}
+
+		exchange_page_flags(page, first);
+	}
+	rc = MIGRATEPAGE_SUCCESS;
+
+out_remap:
+	for (i = 0; i < nr; i++) {
+		struct page *old = ring[i].from_page;
+		struct page *new = rc == MIGRATEPAGE_SUCCESS ?
+			ring[i].to_page : old;
+
+		if (!ring[i].from_page_was_mapped)
+			continue;
+
+		/* remove_migration_ptes() wants the index the ptes were for */
+		if (rc == MIGRATEPAGE_SUCCESS)
+			swap(old->index, ring[i].from_index);
+		remove_migration_ptes(old, new, false);
+		if (rc == MIGRATEPAGE_SUCCESS)
+			swap(old->index, ring[i].from_index);
+	}
+
+out_unlock:
+	for (i = 0; i < nr_locked; i++) {
+		if (ring[i].from_anon_vma)
+			put_anon_vma(ring[i].from_anon_vma);
+		ring[i].from_anon_vma = NULL;
+		unlock_page(ring[i].from_page);
+	}
+
+	migrate_rate_throttle(rate_wait, mode);
+
+	return rc;
+}
+
+int exchange_two_pages(struct page *page1, struct page *page2)
+{
+	struct exchange_page_info page_info;
+	LIST_HEAD(exchange_list);
+	int err = -EFAULT;
+	int pagevec_flushed = 0;
 
 	VM_BUG_ON_PAGE(PageTail(page1), page1);
 	VM_BUG_ON_PAGE(PageTail(page2), page2);
@@ -1155,12 +1966,12 @@ static int unmap_pair_pages_concur(struct exchange_page_info *one_pair,
 			goto out_unlock_both;
 		}
 	} else if (page_mapped(from_page)) {
-		/* Establish migration ptes */
+		/*
+		 * Migration ptes are established for the whole batch by
+		 * unmap_pairs_concur()
+		 */
 		VM_BUG_ON_PAGE(PageAnon(from_page) && !PageKsm(from_page) &&
 					   !anon_vma_from_page, from_page);
-		try_to_unmap(from_page,
-			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
-
 		one_pair->from_page_was_mapped = 1;
 	}
 
@@ -1171,12 +1982,8 @@ static int unmap_pair_pages_concur(struct exchange_page_info *one_pair,
 			goto out_unlock_both;
 		}
 	} else if (page_mapped(to_page)) {
-		/* Establish migration ptes */
 		VM_BUG_ON_PAGE(PageAnon(to_page) && !PageKsm(to_page) &&
 					   !anon_vma_to_page, to_page);
-		try_to_unmap(to_page,
-			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
-
 		one_pair->to_page_was_mapped = 1;
 	}
 
@@ -1196,6 +2003,75 @@ static int unmap_pair_pages_concur(struct exchange_page_info *one_pair,
 	return rc;
 }
 
+/*
+ * Establish the migration ptes of the locked pairs of @unmapped_list inside
+ * one mmu notifier range per mm, so that the secondary MMUs of a KVM guest
+ * flush once for the batch instead of once per page. The TLB flush is done
+ * once for the whole batch by __exchange_pages_concur().
+ */
+static void unmap_pairs_concur(struct list_head *unmapped_list)
+{
+	enum ttu_flags ttu = TTU_MIGRATION | TTU_IGNORE_MLOCK |
+		TTU_IGNORE_ACCESS | TTU_BATCH_FLUSH;
+	struct exchange_page_info *one_pair;
+	struct mmu_notify_batch nb;
+
+	mmu_notify_batch_init(&nb);
+	list_for_each_entry(one_pair, unmapped_list, list) {
+		if (one_pair->from_page_was_mapped)
+			mmu_notify_batch_add(&nb, one_pair->from_page);
+		if (one_pair->to_page_was_mapped)
+			mmu_notify_batch_add(&nb, one_pair->to_page);
+	}
+	mmu_notify_batch_start(&nb);
+
+	list_for_each_entry(one_pair, unmapped_list, list) {
+		if (one_pair->from_page_was_mapped)
+			try_to_unmap(one_pair->from_page, ttu);
+		if (one_pair->to_page_was_mapped)
+			try_to_unmap(one_pair->to_page, ttu);
+	}
+
+	mmu_notify_batch_end(&nb);
+}
+
+/* pairs whose struct pages the walks over a batch prefetch ahead of them */
+#define EXCHANGE_PREFETCH_AHEAD	4
+
+/*
+ * Same as the cursor of the migration batches: runs a few pairs ahead of
+ * a walk and prefetches both struct pages of each pair it passes. Only
+ * the pair under the walk may leave the list.
+ */
+struct exchange_prefetch {
+	struct list_head *head;
+	struct list_head *ahead;
+};
+
+static void exchange_prefetch_advance(struct exchange_prefetch *ep)
+{
+	struct exchange_page_info *one_pair;
+
+	if (ep->ahead == ep->head)
+		return;
+
+	one_pair = list_entry(ep->ahead, struct exchange_page_info, list);
+	prefetchw(one_pair->from_page);
+	prefetchw(one_pair->to_page);
+	ep->ahead = ep->ahead->next;
+}
+
+static void exchange_prefetch_start(struct exchange_prefetch *ep,
+		struct list_head *head)
+{
+	int i;
+
+	ep->head = head;
+	ep->ahead = head->next;
+	for (i = 0; i < EXCHANGE_PREFETCH_AHEAD; i++)
+		exchange_prefetch_advance(ep);
+}
+
 static int exchange_page_mapping_concur(struct list_head *unmapped_list_ptr,
 					   struct list_head *exchange_list_ptr,
 						enum migrate_mode mode)
@@ -1203,12 +2079,16 @@ static int exchange_page_mapping_concur(struct list_head *unmapped_list_ptr,
 	int nr_failed = 0;
 	struct address_space *to_page_mapping, *from_page_mapping;
 	struct exchange_page_info *one_pair, *one_pair2;
+	struct exchange_prefetch ep;
 
+	exchange_prefetch_start(&ep, unmapped_list_ptr);
 	list_for_each_entry_safe(one_pair, one_pair2, unmapped_list_ptr, list) {
 		struct page *from_page = one_pair->from_page;
 		struct page *to_page = one_pair->to_page;
 		int rc = -EBUSY;
 
+		exchange_prefetch_advance(&ep);
+
 		VM_BUG_ON_PAGE(!PageLocked(from_page), from_page);
 		VM_BUG_ON_PAGE(!PageLocked(to_page), to_page);
 
@@ -1266,6 +2146,7 @@ static int exchange_page_data_concur(struct list_head *unmapped_list_ptr,
 	struct exchange_page_info *one_pair;
 	int num_pages = 0, idx = 0;
 	struct page **src_page_list = NULL, **dst_page_list = NULL;
+	unsigned long *done = NULL;
 	unsigned long size = 0;
 	int rc = -EFAULT;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
@@ -1303,12 +2184,23 @@ static int exchange_page_data_concur(struct list_head *unmapped_list_ptr,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	if (mode & MIGRATE_MT)
+	if (mode & MIGRATE_DMA) {
+		done = bitmap_zalloc(num_pages, GFP_KERNEL);
+		if (done)
+			rc = exchange_page_lists_dma(dst_page_list,
+					src_page_list, num_pages, done);
+	}
+
+	/* the copy workers only take the list when DMA exchanged none of it */
+	if (rc && (mode & MIGRATE_MT) && (!done || bitmap_empty(done, num_pages)))
 		rc = exchange_page_lists_mthread(dst_page_list, src_page_list,
 				num_pages);
 
 	if (rc) {
+		idx = 0;
 		list_for_each_entry(one_pair, unmapped_list_ptr, list) {
+			if (done && test_bit(idx++, done))
+				continue;
 			if (PageHuge(one_pair->from_page) ||
 				PageTransHuge(one_pair->from_page)) {
 				exchange_huge_page(one_pair->to_page, one_pair->from_page);
@@ -1329,6 +2221,7 @@ static int exchange_page_data_concur(struct list_head *unmapped_list_ptr,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
+	bitmap_free(done);
 	kfree(src_page_list);
 	kfree(dst_page_list);
 
@@ -1339,14 +2232,18 @@ static int exchange_page_data_concur(struct list_head *unmapped_list_ptr,
 static int remove_migration_ptes_concur(struct list_head *unmapped_list_ptr)
 {
 	struct exchange_page_info *iterator;
+	struct exchange_prefetch ep;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
 
+	exchange_prefetch_start(&ep, unmapped_list_ptr);
 	list_for_each_entry(iterator, unmapped_list_ptr, list) {
 		struct page *from_page = iterator->from_page;
 		struct page *to_page = iterator->to_page;
 
+		exchange_prefetch_advance(&ep);
+
 		swap(from_page->index, iterator->from_index);
 		if (iterator->from_page_was_mapped)
 			remove_migration_ptes(iterator->from_page, iterator->to_page, false);
@@ -1398,156 +2295,300 @@ static int remove_migration_ptes_concur(struct list_head *unmapped_list_ptr)
 	return 0;
 }
 
-int exchange_pages_concur(struct list_head *exchange_list,
-		enum migrate_mode mode, int reason)
+/*
+ * The phases of a concurrent exchange, run by __exchange_pages_concur() and,
+ * for the pairs riding along a batch of migrations, by the pipeline of
+ * migrate_exchange_pages_concur().
+ *
+ * Lock the pairs of @exchange_list and establish the migration ptes of
+ * those that can be exchanged concurrently, moving them to @unmapped. The
+ * pairs left to exchange_pages() go to @serialized, and the busy ones stay
+ * on @exchange_list. The TLB flush is left to the caller, to be done once
+ * with that of the other pages it unmapped. Returns the number of pairs
+ * that failed, not counting those left to exchange_pages().
+ */
+int exchange_concur_unmap(struct list_head *exchange_list,
+		struct list_head *unmapped, struct list_head *serialized,
+		enum migrate_mode mode)
 {
 	struct exchange_page_info *one_pair, *one_pair2;
-	int pass = 0;
-	int retry = 1;
+	struct exchange_prefetch ep;
 	int nr_failed = 0;
-	int nr_succeeded = 0;
-	int rc = 0;
-	LIST_HEAD(serialized_list);
-	LIST_HEAD(unmapped_list);
+	int rc;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
-
-	timestamp = rdtsc();
-	current->move_pages_breakdown.enter_unmap_and_move_cycles += timestamp -
-		current->move_pages_breakdown.last_timestamp;
-	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	for(pass = 0; pass < 1 && retry; pass++) {
-		retry = 0;
-
-		/* unmap and get new page for page_mapping(page) == NULL */
-		list_for_each_entry_safe(one_pair, one_pair2, exchange_list, list) {
-			struct page *from_page = one_pair->from_page;
-			struct page *to_page = one_pair->to_page;
-			cond_resched();
-
-			if (page_count(from_page) == 1) {
-				/* page was freed from under us. So we are done  */
-				ClearPageActive(from_page);
-				ClearPageUnevictable(from_page);
-
-				put_page(from_page);
-				dec_node_page_state(from_page, NR_ISOLATED_ANON +
-						page_is_file_cache(from_page));
-
-				if (page_count(to_page) == 1) {
-					ClearPageActive(to_page);
-					ClearPageUnevictable(to_page);
-					put_page(to_page);
-				} else {
-					mod_node_page_state(page_pgdat(to_page), NR_ISOLATED_ANON +
-							page_is_file_cache(to_page), -hpage_nr_pages(to_page));
-					putback_lru_page(to_page);
-				}
-				list_del(&one_pair->list);
+	/* unmap and get new page for page_mapping(page) == NULL */
+	exchange_prefetch_start(&ep, exchange_list);
+	list_for_each_entry_safe(one_pair, one_pair2, exchange_list, list) {
+		struct page *from_page = one_pair->from_page;
+		struct page *to_page = one_pair->to_page;
 
-				continue;
-			}
+		exchange_prefetch_advance(&ep);
+		cond_resched();
+
+		/* hugetlb pages are exchanged one pair at a time */
+		if (PageHuge(from_page) || PageHuge(to_page)) {
+			list_move(&one_pair->list, serialized);
+			continue;
+		}
+
+		if (page_count(from_page) == 1) {
+			/* page was freed from under us. So we are done  */
+			ClearPageActive(from_page);
+			ClearPageUnevictable(from_page);
+
+			put_page(from_page);
+			dec_node_page_state(from_page, NR_ISOLATED_ANON +
+					page_is_file_cache(from_page));
 
 			if (page_count(to_page) == 1) {
-				/* page was freed from under us. So we are done  */
 				ClearPageActive(to_page);
 				ClearPageUnevictable(to_page);
-
 				put_page(to_page);
+			} else {
+				mod_node_page_state(page_pgdat(to_page), NR_ISOLATED_ANON +
+						page_is_file_cache(to_page), -hpage_nr_pages(to_page));
+				putback_lru_page(to_page);
+			}
+			list_del(&one_pair->list);
 
-				dec_node_page_state(to_page, NR_ISOLATED_ANON +
-						page_is_file_cache(to_page));
+			continue;
+		}
 
-				mod_node_page_state(page_pgdat(from_page), NR_ISOLATED_ANON +
-						page_is_file_cache(from_page), -hpage_nr_pages(from_page));
-				putback_lru_page(from_page);
+		if (page_count(to_page) == 1) {
+			/* page was freed from under us. So we are done  */
+			ClearPageActive(to_page);
+			ClearPageUnevictable(to_page);
 
-				list_del(&one_pair->list);
-				continue;
-			}
-		/* We do not exchange huge pages and file-backed pages concurrently */
-			if (PageHuge(one_pair->from_page) || PageHuge(one_pair->to_page)) {
-				rc = -ENODEV;
-			}
-			else if ((page_mapping(one_pair->from_page) != NULL) ||
-					 (page_mapping(one_pair->from_page) != NULL)) {
-				rc = -ENODEV;
-			}
-			else
-				rc = unmap_pair_pages_concur(one_pair, 1, mode);
-
-			switch(rc) {
-			case -ENODEV:
-				list_move(&one_pair->list, &serialized_list);
-				break;
-			case -ENOMEM:
-				goto out;
-			case -EAGAIN:
-				retry++;
-				break;
-			case MIGRATEPAGE_SUCCESS:
-				list_move(&one_pair->list, &unmapped_list);
-				nr_succeeded++;
-				break;
-			default:
-				/*
-				 * Permanent failure (-EBUSY, -ENOSYS, etc.):
-				 * unlike -EAGAIN case, the failed page is
-				 * removed from migration page list and not
-				 * retried in the next outer loop.
-				 */
-				list_move(&one_pair->list, &serialized_list);
-				nr_failed++;
-				break;
-			}
+			put_page(to_page);
+
+			dec_node_page_state(to_page, NR_ISOLATED_ANON +
+					page_is_file_cache(to_page));
+
+			mod_node_page_state(page_pgdat(from_page), NR_ISOLATED_ANON +
+					page_is_file_cache(from_page), -hpage_nr_pages(from_page));
+			putback_lru_page(from_page);
+
+			list_del(&one_pair->list);
+			continue;
+		}
+	/* We do not exchange file-backed pages concurrently */
+		if ((page_mapping(one_pair->from_page) != NULL) ||
+				 (page_mapping(one_pair->to_page) != NULL)) {
+			rc = -ENODEV;
 		}
+		/*
+		 * A pinned page would fail the exchange only once both pages
+		 * are unmapped, and exchange_pages() would unmap them again.
+		 * The pair is given up on here, left on @exchange_list with
+		 * its pages back on the LRU, and counted once.
+		 */
+		else if (isolated_page_pinned(from_page) ||
+			 isolated_page_pinned(to_page)) {
+			count_vm_event(PGMIGRATE_EARLY_PINNED);
+			mod_node_page_state(page_pgdat(from_page), NR_ISOLATED_ANON +
+					page_is_file_cache(from_page), -hpage_nr_pages(from_page));
+			putback_lru_page(from_page);
+			mod_node_page_state(page_pgdat(to_page), NR_ISOLATED_ANON +
+					page_is_file_cache(to_page), -hpage_nr_pages(to_page));
+			putback_lru_page(to_page);
+			nr_failed++;
+			continue;
+		}
+		else
+			rc = unmap_pair_pages_concur(one_pair, 1, mode);
+
+		switch(rc) {
+		case -ENODEV:
+			list_move(&one_pair->list, serialized);
+			break;
+		case -EAGAIN:
+			nr_failed++;
+			break;
+		case MIGRATEPAGE_SUCCESS:
+			list_move(&one_pair->list, unmapped);
+			break;
+		default:
+			/*
+			 * Permanent failure (-EBUSY, -ENOSYS, etc.):
+			 * unlike -EAGAIN case, the failed page is
+			 * removed from migration page list and not
+			 * retried in the next outer loop. exchange_pages()
+			 * gets a go at it and counts it if it fails again.
+			 */
+			list_move(&one_pair->list, serialized);
+			break;
+		}
+	}
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
-		timestamp = rdtsc();
-		current->move_pages_breakdown.unmap_page_cycles += timestamp -
-			current->move_pages_breakdown.last_timestamp;
-		current->move_pages_breakdown.last_timestamp = timestamp;
+	timestamp = rdtsc();
+	current->move_pages_breakdown.unmap_page_cycles += timestamp -
+		current->move_pages_breakdown.last_timestamp;
+	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-		/* move page->mapping to new page, only -EAGAIN could happen  */
-		exchange_page_mapping_concur(&unmapped_list, exchange_list, mode);
+	unmap_pairs_concur(unmapped);
 
-		/* copy pages in unmapped_list */
-		exchange_page_data_concur(&unmapped_list, mode);
+	return nr_failed;
+}
+
+/*
+ * Exchange the mappings of the pairs of @unmapped. The pairs that fail
+ * are put back and taken off the list; returns how many there are.
+ */
+int exchange_concur_move_mapping(struct list_head *unmapped,
+		enum migrate_mode mode)
+{
+	/* move page->mapping to new page, only -EAGAIN could happen  */
+	return exchange_page_mapping_concur(unmapped, NULL, mode);
+}
+
+void exchange_concur_copy(struct list_head *unmapped, enum migrate_mode mode)
+{
+	exchange_page_data_concur(unmapped, mode);
+}
 
-		/* remove migration pte, if old_page is NULL?, unlock old and new
-		 * pages, put anon_vma, put old and new pages */
-		remove_migration_ptes_concur(&unmapped_list);
+/*
+ * Charge and count the exchanged pairs of @unmapped, then remove their
+ * migration ptes and put their pages back. The pairs stay on @unmapped
+ * without their pages. Returns the migrate_rate_charge() debt of the pairs.
+ */
+u64 exchange_concur_remap(struct list_head *unmapped, int reason,
+		enum migrate_mode mode)
+{
+	struct exchange_page_info *one_pair;
+	u64 rate_wait = 0;
+
+	list_for_each_entry(one_pair, unmapped, list) {
+		rate_wait = max(rate_wait, exchange_rate_charge(
+				one_pair->from_page, one_pair->to_page,
+				reason, mode));
+		exchange_count_pairs(one_pair->from_page,
+				one_pair->to_page);
 	}
 
-	nr_failed += retry;
-	rc = nr_failed;
+	/* remove migration pte, if old_page is NULL?, unlock old and new
+	 * pages, put anon_vma, put old and new pages */
+	remove_migration_ptes_concur(unmapped);
 
-	exchange_pages(&serialized_list, mode, reason);
-out:
+	return rate_wait;
+}
+
+/* Returns the number of pairs that were not exchanged */
+static int __exchange_pages_concur(struct list_head *exchange_list,
+		enum migrate_mode mode, int reason)
+{
+	struct exchange_page_info *one_pair;
+	int nr_failed = 0;
+	u64 rate_wait = 0, start = 0;
+	int from_nid = NUMA_NO_NODE, to_nid = NUMA_NO_NODE, nr_pairs = 0;
+	LIST_HEAD(serialized_list);
+	LIST_HEAD(unmapped_list);
+#ifdef CONFIG_PAGE_MIGRATION_PROFILE
+	u64 timestamp;
+
+	timestamp = rdtsc();
+	current->move_pages_breakdown.enter_unmap_and_move_cycles += timestamp -
+		current->move_pages_breakdown.last_timestamp;
+	current->move_pages_breakdown.last_timestamp = timestamp;
+#endif
+
+	if (trace_mm_migrate_batch_start_enabled() ||
+	    trace_mm_migrate_batch_end_enabled()) {
+		one_pair = list_first_entry_or_null(exchange_list,
+				struct exchange_page_info, list);
+		if (one_pair) {
+			from_nid = page_to_nid(one_pair->from_page);
+			to_nid = page_to_nid(one_pair->to_page);
+		}
+		list_for_each_entry(one_pair, exchange_list, list)
+			nr_pairs++;
+		trace_mm_migrate_batch_start(MIGRATE_ENGINE_EXCHANGE, from_nid,
+				to_nid, nr_pairs, mode);
+		start = ktime_get_ns();
+	}
+
+	nr_failed = exchange_concur_unmap(exchange_list, &unmapped_list,
+			&serialized_list, mode);
+
+	/* one shootdown for every page unmapped above */
+	try_to_unmap_flush();
+
+	nr_failed += exchange_concur_move_mapping(&unmapped_list, mode);
+	exchange_concur_copy(&unmapped_list, mode);
+	rate_wait = exchange_concur_remap(&unmapped_list, reason, mode);
+
+	migrate_rate_throttle(rate_wait, mode);
+
+	nr_failed += exchange_pages(&serialized_list, mode, reason);
+	try_to_unmap_flush();
 	list_splice(&unmapped_list, exchange_list);
 	list_splice(&serialized_list, exchange_list);
 
-	return nr_failed?-EFAULT:0;
+	if (start)
+		trace_mm_migrate_batch_end(MIGRATE_ENGINE_EXCHANGE, from_nid,
+				to_nid, nr_pairs, nr_failed,
+				ktime_get_ns() - start);
+
+	return nr_failed;
 }
 
-static int store_status(int __user *status, int start, int value, int nr)
+struct exchange_concur_args {
+	struct list_head *exchange_list;
+	enum migrate_mode mode;
+	int reason;
+};
+
+static int exchange_pages_concur_fn(void *arg)
 {
-	while (nr-- > 0) {
-		if (put_user(value, status + start))
-			return -EFAULT;
-		start++;
-	}
+	struct exchange_concur_args *args = arg;
 
-	return 0;
+	return __exchange_pages_concur(args->exchange_list, args->mode,
+			args->reason);
+}
+
+int exchange_pages_concur(struct list_head *exchange_list,
+		enum migrate_mode mode, int reason)
+{
+	struct exchange_concur_args args = {
+		.exchange_list = exchange_list,
+		.mode = mode,
+		.reason = reason,
+	};
+	struct exchange_page_info *one_pair;
+	u64 start = migrate_latency_start();
+	int from_nid, to_nid;
+	int nr_pages = 0;
+	int rc;
+
+	list_for_each_entry(one_pair, exchange_list, list)
+		nr_pages++;
+
+	one_pair = list_first_entry_or_null(exchange_list,
+			struct exchange_page_info, list);
+	if (!one_pair)
+		return 0;
+	from_nid = page_to_nid(one_pair->from_page);
+	to_nid = page_to_nid(one_pair->to_page);
+
+	/* socket nearest the PMEM side of the first pair */
+	if (!migrate_concur_offload(copy_page_rpdaa_node(from_nid, to_nid),
+				nr_pages, exchange_pages_concur_fn, &args, &rc))
+		rc = __exchange_pages_concur(exchange_list, mode, reason);
+
+	migrate_latency_done(MIGRATE_ENGINE_EXCHANGE, MIGRATE_PHASE_BATCH,
+			from_nid, to_nid, start);
+	return rc;
 }
 
 static int do_exchange_page_list(struct mm_struct *mm,
 		struct list_head *from_pagelist, struct list_head *to_pagelist,
-		bool migrate_mt, bool migrate_concur)
+		int flags)
 {
+	enum migrate_mode mode = MIGRATE_SYNC;
 	int err;
 	struct exchange_page_info *one_pair;
 	LIST_HEAD(exchange_page_list);
@@ -1576,14 +2617,21 @@ static int do_exchange_page_list(struct mm_struct *mm,
 		list_add_tail(&one_pair->list, &exchange_page_list);
 	}
 
-	if (migrate_concur)
-		err = exchange_pages_concur(&exchange_page_list,
-			MIGRATE_SYNC | (migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD),
-			MR_SYSCALL);
-	else
-		err = exchange_pages(&exchange_page_list,
-			MIGRATE_SYNC | (migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD),
+	if (flags & MPOL_MF_MOVE_MT)
+		mode |= MIGRATE_MT;
+
+	/* there is no copy to batch, the pairs go one at a time */
+	if (flags & MPOL_MF_SWAP_MAPPINGS) {
+		mode |= MIGRATE_SWAP_MAPPINGS;
+		err = exchange_pages(&exchange_page_list, mode, MR_SYSCALL);
+	} else if (flags & MPOL_MF_MOVE_CONCUR) {
+		/* only the concurrent path exchanges a list at once */
+		if (flags & MPOL_MF_MOVE_DMA)
+			mode |= MIGRATE_DMA;
+		err = exchange_pages_concur(&exchange_page_list, mode,
 			MR_SYSCALL);
+	} else
+		err = exchange_pages(&exchange_page_list, mode, MR_SYSCALL);
 
 	while (!list_empty(&exchange_page_list)) {
 		struct exchange_page_info *one_pair =
@@ -1603,157 +2651,204 @@ static int do_exchange_page_list(struct mm_struct *mm,
 	return err;
 }
 
-static int add_page_for_exchange(struct mm_struct *mm,
-		unsigned long from_addr, unsigned long to_addr,
-		struct list_head *from_pagelist, struct list_head *to_pagelist,
-		bool migrate_all)
+/*
+ * Isolate a hugetlb page for exchange_isolate_side(), which puts it on the
+ * exchange lists like the LRU pages.
+ */
+static int exchange_isolate_huge_page(struct page *page)
 {
-	struct vm_area_struct *from_vma, *to_vma;
-	struct page *from_page, *to_page;
-	LIST_HEAD(err_page_list);
-	unsigned int follflags;
-	int err;
+	LIST_HEAD(isolated);
+
+	if (!PageHead(page))
+		return -EACCES;
+	if (!isolate_huge_page(page, &isolated))
+		return -EBUSY;
+	list_del_init(&page->lru);
+
+	return 0;
+}
+
+/* Address pairs of exchange_pages() looked up and isolated at once */
+#define EXCHANGE_LOOKUP_BATCH	64
+
+enum {
+	EXCHANGE_FROM,
+	EXCHANGE_TO,
+	NR_EXCHANGE_SIDES,
+};
+
+struct exchange_lookup_batch {
+	unsigned long addr[NR_EXCHANGE_SIDES][EXCHANGE_LOOKUP_BATCH];
+	/* the pages looked up and then isolated, NULL once a side failed */
+	struct page *page[NR_EXCHANGE_SIDES][EXCHANGE_LOOKUP_BATCH];
+	int status[EXCHANGE_LOOKUP_BATCH];
+	/* the LRU pages of a side handed to isolate_lru_pages_bulk() */
+	struct page *lru_pages[EXCHANGE_LOOKUP_BATCH];
+	int lru_index[EXCHANGE_LOOKUP_BATCH];
+	int lru_status[EXCHANGE_LOOKUP_BATCH];
+};
 
-	err = -EFAULT;
-	from_vma = find_vma(mm, from_addr);
-	if (!from_vma || from_addr < from_vma->vm_start ||
-		!vma_migratable(from_vma))
-		goto set_from_status;
+/*
+ * The page mapped at @addr with a reference held, or an ERR_PTR(). *@vmap
+ * is the VMA of the previous address of the batch, which saves the
+ * find_vma() of the addresses that follow in the same VMA.
+ */
+static struct page *exchange_lookup_page(struct mm_struct *mm,
+		struct vm_area_struct **vmap, unsigned long addr,
+		bool migrate_all)
+{
+	struct vm_area_struct *vma = *vmap;
+	struct page *page;
+
+	if (!vma || addr < vma->vm_start || addr >= vma->vm_end) {
+		vma = find_vma(mm, addr);
+		if (!vma || addr < vma->vm_start || !vma_migratable(vma))
+			return ERR_PTR(-EFAULT);
+		*vmap = vma;
+	}
 
 	/* FOLL_DUMP to ignore special (like zero) pages */
-	follflags = FOLL_GET | FOLL_DUMP;
-	from_page = follow_page(from_vma, from_addr, follflags);
+	page = follow_page(vma, addr, FOLL_GET | FOLL_DUMP);
+	if (IS_ERR(page))
+		return page;
+	if (!page)
+		return ERR_PTR(-ENOENT);
+
+	if ((page_mapcount(page) > 1 && !migrate_all) ||
+	    (!PageHuge(page) && PageTail(page))) {
+		put_page(page);
+		return ERR_PTR(-EACCES);
+	}
 
-	err = PTR_ERR(from_page);
-	if (IS_ERR(from_page))
-		goto set_from_status;
+	return page;
+}
 
-	err = -ENOENT;
-	if (!from_page)
-		goto set_from_status;
+/*
+ * Isolate the pages of @side of the pairs of @b not failed yet, the LRU
+ * pages with one lru_lock hold per run of pages of a node, and drop the
+ * references of the lookup.
+ */
+static void exchange_isolate_side(struct exchange_lookup_batch *b, int side,
+		int nr)
+{
+	struct page *page;
+	int i, n = 0;
 
-	err = -EACCES;
-	if (page_mapcount(from_page) > 1 && !migrate_all)
-		goto put_and_set_from_page;
+	for (i = 0; i < nr; i++) {
+		page = b->page[side][i];
+		if (!page)
+			continue;
 
-	if (PageHuge(from_page)) {
-		if (PageHead(from_page))
-			if (isolate_huge_page(from_page, &err_page_list)) {
-				err = 0;
-			}
-		goto put_and_set_from_page;
-	} else if (PageTransCompound(from_page)) {
-		if (PageTail(from_page)) {
-			err = -EACCES;
-			goto put_and_set_from_page;
+		if (PageHuge(page)) {
+			b->status[i] = exchange_isolate_huge_page(page);
+			put_page(page);
+			if (b->status[i])
+				b->page[side][i] = NULL;
+			continue;
 		}
-	}
 
-	err = isolate_lru_page(from_page);
-	if (!err)
-		mod_node_page_state(page_pgdat(from_page), NR_ISOLATED_ANON +
-					page_is_file_cache(from_page), hpage_nr_pages(from_page));
-put_and_set_from_page:
-	/*
-	 * Either remove the duplicate refcount from
-	 * isolate_lru_page() or drop the page ref if it was
-	 * not isolated.
-	 *
-	 * Since FOLL_GET calls get_page(), and isolate_lru_page()
-	 * also calls get_page()
-	 */
-	put_page(from_page);
-set_from_status:
-	if (err)
-		goto out;
+		b->lru_pages[n] = page;
+		b->lru_index[n++] = i;
+	}
 
-	/* to pages  */
-	err = -EFAULT;
-	to_vma = find_vma(mm, to_addr);
-	if (!to_vma ||
-		to_addr < to_vma->vm_start ||
-		!vma_migratable(to_vma))
-		goto set_to_status;
+	isolate_lru_pages_bulk(b->lru_pages, n, b->lru_status);
 
-	/* FOLL_DUMP to ignore special (like zero) pages */
-	to_page = follow_page(to_vma, to_addr, follflags);
+	for (i = 0; i < n; i++) {
+		/* isolate_lru_pages_bulk() took its own reference */
+		put_page(b->lru_pages[i]);
+		if (b->lru_status[i]) {
+			b->status[b->lru_index[i]] = b->lru_status[i];
+			b->page[side][b->lru_index[i]] = NULL;
+		}
+	}
+}
 
-	err = PTR_ERR(to_page);
-	if (IS_ERR(to_page))
-		goto set_to_status;
+/*
+ * Look up and isolate the @nr address pairs of @b, the from pages of all
+ * pairs first and then the to pages of the pairs whose from page was
+ * isolated. The pairs isolated go on the exchange lists, the status of
+ * each pair is left in @b->status.
+ */
+static void exchange_lookup_pairs(struct mm_struct *mm,
+		struct exchange_lookup_batch *b, int nr,
+		struct list_head *from_pagelist, struct list_head *to_pagelist,
+		bool migrate_all)
+{
+	struct vm_area_struct *vma;
+	struct page *from_page, *to_page, *page;
+	LIST_HEAD(err_page_list);
+	int side, i;
 
-	err = -ENOENT;
-	if (!to_page)
-		goto set_to_status;
+	for (i = 0; i < nr; i++)
+		b->status[i] = 0;
 
-	err = -EACCES;
-	if (page_mapcount(to_page) > 1 &&
-			!migrate_all)
-		goto put_and_set_to_page;
+	for (side = EXCHANGE_FROM; side < NR_EXCHANGE_SIDES; side++) {
+		vma = NULL;
+		for (i = 0; i < nr; i++) {
+			b->page[side][i] = NULL;
+			if (b->status[i])
+				continue;
 
-	if (PageHuge(to_page)) {
-		if (PageHead(to_page))
-			if (isolate_huge_page(to_page, &err_page_list)) {
-				err = 0;
-			}
-		goto put_and_set_to_page;
-	} else if (PageTransCompound(to_page)) {
-		if (PageTail(to_page)) {
-			err = -EACCES;
-			goto put_and_set_to_page;
+			page = exchange_lookup_page(mm, &vma, b->addr[side][i],
+					migrate_all);
+			if (IS_ERR(page))
+				b->status[i] = PTR_ERR(page);
+			else
+				b->page[side][i] = page;
 		}
+
+		exchange_isolate_side(b, side, nr);
 	}
 
-	err = isolate_lru_page(to_page);
-	if (!err)
-		mod_node_page_state(page_pgdat(to_page), NR_ISOLATED_ANON +
-					page_is_file_cache(to_page), hpage_nr_pages(to_page));
-put_and_set_to_page:
-	/*
-	 * Either remove the duplicate refcount from
-	 * isolate_lru_page() or drop the page ref if it was
-	 * not isolated.
-	 *
-	 * Since FOLL_GET calls get_page(), and isolate_lru_page()
-	 * also calls get_page()
-	 */
-	put_page(to_page);
-set_to_status:
-	if (!err) {
-		if ((PageHuge(from_page) != PageHuge(to_page)) ||
-			(PageTransHuge(from_page) != PageTransHuge(to_page))) {
+	for (i = 0; i < nr; i++) {
+		from_page = b->page[EXCHANGE_FROM][i];
+		to_page = b->page[EXCHANGE_TO][i];
+
+		if (b->status[i]) {
+			if (from_page)
+				list_add(&from_page->lru, &err_page_list);
+		} else if ((PageHuge(from_page) != PageHuge(to_page)) ||
+			   (PageTransHuge(from_page) != PageTransHuge(to_page))) {
 			list_add(&from_page->lru, &err_page_list);
 			list_add(&to_page->lru, &err_page_list);
 		} else {
 			list_add_tail(&from_page->lru, from_pagelist);
 			list_add_tail(&to_page->lru, to_pagelist);
 		}
-	} else
-		list_add(&from_page->lru, &err_page_list);
-out:
+	}
+
 	if (!list_empty(&err_page_list))
 		putback_movable_pages(&err_page_list);
-	return err;
 }
+
 /*
- * Migrate an array of page address onto an array of nodes and fill
- * the corresponding array of status.
+ * Exchange the pages of an array of address pairs and fill the
+ * corresponding array of status. The pairs are read, looked up and
+ * isolated EXCHANGE_LOOKUP_BATCH at a time and exchanged all at once.
  */
 static int do_pages_exchange(struct mm_struct *mm, nodemask_t task_nodes,
 			 unsigned long nr_pages,
 			 const void __user * __user *from_pages,
 			 const void __user * __user *to_pages,
-			 int __user *status, int flags)
+			 int __user *status, int flags, bool drain_all)
 {
+	struct exchange_lookup_batch *b;
 	LIST_HEAD(from_pagelist);
 	LIST_HEAD(to_pagelist);
-	int start, i;
-	int err = 0, err1;
+	unsigned long start;
+	int err = 0, err1, nr;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
 
-	migrate_prep();
+	b = kmalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+
+	if (drain_all)
+		migrate_prep_mm(mm);
+	else
+		migrate_prep_local();
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	timestamp = rdtsc();
@@ -1763,69 +2858,32 @@ static int do_pages_exchange(struct mm_struct *mm, nodemask_t task_nodes,
 #endif
 
 	down_read(&mm->mmap_sem);
-	for (i = start = 0; i < nr_pages; i++) {
-		const void __user *from_p, *to_p;
-		unsigned long from_addr, to_addr;
+	for (start = 0; start < nr_pages; start += nr) {
+		nr = min_t(unsigned long, nr_pages - start,
+			   EXCHANGE_LOOKUP_BATCH);
 
 		err = -EFAULT;
-		if (get_user(from_p, from_pages + i))
-			goto out_flush;
-		if (get_user(to_p, to_pages + i))
-			goto out_flush;
-
-		from_addr = (unsigned long)from_p;
-		to_addr = (unsigned long)to_p;
-
-		err = -EACCES;
+		if (copy_from_user(b->addr[EXCHANGE_FROM], from_pages + start,
+				   nr * sizeof(*from_pages)) ||
+		    copy_from_user(b->addr[EXCHANGE_TO], to_pages + start,
+				   nr * sizeof(*to_pages)))
+			break;
 
-#ifdef CONFIG_PAGE_MIGRATION_PROFILE
-		timestamp = rdtsc();
-		current->move_pages_breakdown.form_page_node_info_cycles += timestamp -
-					current->move_pages_breakdown.last_timestamp;
-		current->move_pages_breakdown.last_timestamp = timestamp;
-#endif
 		/*
-		 * Errors in the page lookup or isolation are not fatal and we simply
-		 * report them via status
+		 * Errors in the page lookup or isolation are not fatal and we
+		 * simply report them via status
 		 */
-		err = add_page_for_exchange(mm, from_addr, to_addr,
-				&from_pagelist, &to_pagelist,
+		exchange_lookup_pairs(mm, b, nr, &from_pagelist, &to_pagelist,
 				flags & MPOL_MF_MOVE_ALL);
 
-		if (!err)
-			continue;
-
-		err = store_status(status, i, err, 1);
-		if (err)
-			goto out_flush;
-
-#ifdef CONFIG_PAGE_MIGRATION_PROFILE
-		timestamp = rdtsc();
-		current->move_pages_breakdown.form_page_node_info_cycles += timestamp -
-					current->move_pages_breakdown.last_timestamp;
-		current->move_pages_breakdown.last_timestamp = timestamp;
-#endif
-
-		err = do_exchange_page_list(mm, &from_pagelist, &to_pagelist,
-				flags & MPOL_MF_MOVE_MT,
-				flags & MPOL_MF_MOVE_CONCUR);
-		if (err)
-			goto out;
-		if (i > start) {
-			err = store_status(status, start, 0, i - start);
-			if (err)
-				goto out;
+		err = 0;
+		if (copy_to_user(status + start, b->status,
+				 nr * sizeof(*status))) {
+			err = -EFAULT;
+			break;
 		}
-		start = i;
-
-#ifdef CONFIG_PAGE_MIGRATION_PROFILE
-		timestamp = rdtsc();
-		current->move_pages_breakdown.store_page_status_cycles += timestamp -
-					current->move_pages_breakdown.last_timestamp;
-		current->move_pages_breakdown.last_timestamp = timestamp;
-#endif
+		cond_resched();
 	}
-out_flush:
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	timestamp = rdtsc();
@@ -1836,10 +2894,7 @@ static int do_pages_exchange(struct mm_struct *mm, nodemask_t task_nodes,
 
 	/* Make sure we do not overwrite the existing error */
 	err1 = do_exchange_page_list(mm, &from_pagelist, &to_pagelist,
-				flags & MPOL_MF_MOVE_MT,
-				flags & MPOL_MF_MOVE_CONCUR);
-	if (!err1)
-		err1 = store_status(status, start, 0, i - start);
+				flags);
 	if (!err)
 		err = err1;
 
@@ -1849,8 +2904,57 @@ static int do_pages_exchange(struct mm_struct *mm, nodemask_t task_nodes,
 				current->move_pages_breakdown.last_timestamp;
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
-out:
 	up_read(&mm->mmap_sem);
+	kfree(b);
+
+	return err;
+}
+
+static int exchange_pages_check_flags(int flags)
+{
+	if (flags & ~(MPOL_MF_MOVE|
+				  MPOL_MF_MOVE_ALL|
+				  MPOL_MF_MOVE_DMA|
+				  MPOL_MF_MOVE_MT|
+				  MPOL_MF_MOVE_CONCUR|
+				  MPOL_MF_SWAP_MAPPINGS|
+				  MPOL_MF_COPY_POLICY))
+		return -EINVAL;
+
+	if ((flags & MPOL_MF_MOVE_ALL) && !capable(CAP_SYS_NICE))
+		return -EPERM;
+
+	return 0;
+}
+
+/*
+ * The body of exchange_pages() once the rights on @mm are checked, shared
+ * with the io_uring exchange_pages op, see move_pages_mm() for @drain_all.
+ */
+int exchange_pages_mm(struct mm_struct *mm, nodemask_t task_nodes,
+		unsigned long nr_pages,
+		const void __user * __user *from_pages,
+		const void __user * __user *to_pages,
+		int __user *status, int flags, bool drain_all)
+{
+	struct page_copy_policy copy_policy;
+	struct migrate_cputime cputime;
+	int err;
+
+	err = exchange_pages_check_flags(flags);
+	if (err)
+		return err;
+
+	err = page_copy_policy_enter(mm, flags, &copy_policy);
+	if (err)
+		return err;
+	migrate_cputime_begin(&cputime, current);
+
+	err = do_pages_exchange(mm, task_nodes, nr_pages, from_pages,
+				to_pages, status, flags, drain_all);
+	migrate_cputime_end(&cputime);
+	page_copy_policy_exit(&copy_policy);
+
 	return err;
 }
 
@@ -1871,15 +2975,9 @@ SYSCALL_DEFINE6(exchange_pages, pid_t, pid, unsigned long, nr_pages,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	/* Check flags */
-	if (flags & ~(MPOL_MF_MOVE|
-				  MPOL_MF_MOVE_ALL|
-				  MPOL_MF_MOVE_MT|
-				  MPOL_MF_MOVE_CONCUR))
-		return -EINVAL;
-
-	if ((flags & MPOL_MF_MOVE_ALL) && !capable(CAP_SYS_NICE))
-		return -EPERM;
+	err = exchange_pages_check_flags(flags);
+	if (err)
+		return err;
 
 	/* Find the mm_struct */
 	rcu_read_lock();
@@ -1924,9 +3022,8 @@ SYSCALL_DEFINE6(exchange_pages, pid_t, pid, unsigned long, nr_pages,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	err = do_pages_exchange(mm, task_nodes, nr_pages, from_pages,
-				    to_pages, status, flags);
-
+	err = exchange_pages_mm(mm, task_nodes, nr_pages, from_pages,
+				to_pages, status, flags, true);
 	mmput(mm);
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
@@ -10,279 +10,472 @@
 #include <linux/workqueue.h>
 #include <linux/slab.h>
 #include <linux/freezer.h>
+#include <linux/gfp.h>
+#include <linux/nodemask.h>
 
 #include <linux/migrate.h>
+#include <linux/migrate_stat.h>
+#include <linux/pmem_writers.h>
 
-#define _MM_MALLOC_H_INCLUDED 
-#include <immintrin.h>
-#undef _MM_MALLOC_H_INCLUDED 
+#include <trace/events/migrate.h>
 
-/*
- * nr_copythreads can be the highest number of threads for given node
- * on any architecture. The actual number of copy threads will be
- * limited by the cpumask weight of the target node.
- */
-extern unsigned int limit_mt_num;
+#include "internal.h"
 
 struct copy_page_info {
 	struct work_struct copy_page_work;
 	char *to;
 	char *from;
 	unsigned long chunk_size;
+	bool nt;
+	/* NT mode of the one way copies of a split exchange */
+	int nt_mode;
+	unsigned int prefetch;
+	atomic_t *nr_pending;
+	atomic64_t *worker_ns;
+	struct completion *done;
 };
 
-// Controls if non-temporal load/stores are used in page data exchange
+// Controls if non-temporal load/stores are used in page data exchange:
+// 0 never, 1 always, 2 for huge pages exchanged with a PMEM node
 int sysctl_enable_nt_exchange = 0;
+// Exchange pages between two sockets with each socket writing only its own
+// node, through local bounce buffers
+int sysctl_exchange_split_socket = 0;
 
-__attribute__((optimize("-O3")))
-__attribute__((target("avx512vl,bmi2")))
-static void exchange_page_routine(char *to, char *from, unsigned long chunk_size)
+static void exchange_page_routine(char *to, char *from, unsigned long chunk_size,
+		bool nt, unsigned int prefetch)
 {
-#ifdef CONFIG_AS_AVX512
-	if(sysctl_enable_nt_exchange==1){
-		// use non-temporal load/stores
-		__m512i_u* s = (__m512i_u*)from;
-		__m512i_u* d = (__m512i_u*)to;
-		__m512i_u temp;
-		unsigned long i;
-
-		for(i=0; i<chunk_size; i+=64){
-			temp =  _mm512_stream_load_si512(s);
-			_mm512_stream_si512(s, _mm512_stream_load_si512(d));
-			_mm512_stream_si512(d, temp);
-			s++, d++;
-		} 
-	} else {
-		u64 tmp;
-		int i;
+	page_exchange(to, from, chunk_size, nt, prefetch);
+}
 
-		for (i = 0; i < chunk_size; i += sizeof(tmp)) {
-			tmp = *((u64*)(from + i));
-			*((u64*)(from + i)) = *((u64*)(to + i));
-			*((u64*)(to + i)) = tmp;
+static void exchange_page_work_queue_thread(struct work_struct *work)
+{
+	struct copy_page_info *my_work = container_of(work,
+			struct copy_page_info, copy_page_work);
+	unsigned long offset, len;
+	u64 start = ktime_get_ns();
+
+	/* a work is up to a whole THP, give the CPU back every section */
+	for (offset = 0; offset < my_work->chunk_size; offset += len) {
+		len = min(my_work->chunk_size - offset, PAGE_COPY_FPU_SECTION);
+		kernel_fpu_begin();
+		exchange_page_routine(my_work->to + offset,
+				my_work->from + offset, len, my_work->nt,
+				my_work->prefetch);
+		kernel_fpu_end();
+		cond_resched();
+	}
+	atomic64_add(ktime_get_ns() - start, my_work->worker_ns);
+
+	if (atomic_dec_and_test(my_work->nr_pending))
+		complete(my_work->done);
+}
+
+/* A one way copy of a split exchange, see exchange_page_lists_split() */
+static void exchange_split_work_queue_thread(struct work_struct *work)
+{
+	struct copy_page_info *my_work = container_of(work,
+			struct copy_page_info, copy_page_work);
+	unsigned long offset, len;
+	u64 start = ktime_get_ns();
+
+	if (my_work->nt_mode == PAGE_COPY_NT_NONE) {
+		memcpy(my_work->to, my_work->from, my_work->chunk_size);
+	} else {
+		for (offset = 0; offset < my_work->chunk_size; offset += len) {
+			len = min(my_work->chunk_size - offset,
+				  PAGE_COPY_FPU_SECTION);
+			kernel_fpu_begin();
+			current_page_copy_engine()->copy(my_work->to + offset,
+					my_work->from + offset, len,
+					my_work->nt_mode, my_work->prefetch);
+			kernel_fpu_end();
+			cond_resched();
 		}
 	}
-#else
-	u64 tmp;
+	atomic64_add(ktime_get_ns() - start, my_work->worker_ns);
+
+	if (atomic_dec_and_test(my_work->nr_pending))
+		complete(my_work->done);
+}
+
+/*
+ * Cut the exchange of the @nr_pages base pages at @vto and @vfrom into @nr
+ * works of whole base pages, @nr at most @nr_pages. When the pages do not
+ * split evenly some works get one page more than the others.
+ */
+static void exchange_page_slice(struct copy_page_info *work_items, int nr,
+		char *vto, char *vfrom, int nr_pages, bool nt,
+		unsigned int prefetch)
+{
+	unsigned long start, end;
 	int i;
 
-	for (i = 0; i < chunk_size; i += sizeof(tmp)) {
-		tmp = *((u64*)(from + i));
-		*((u64*)(from + i)) = *((u64*)(to + i));
-		*((u64*)(to + i)) = tmp;
+	for (i = 0; i < nr; i++) {
+		start = (unsigned long)nr_pages * i / nr;
+		end = (unsigned long)nr_pages * (i + 1) / nr;
+		work_items[i].to = vto + start * PAGE_SIZE;
+		work_items[i].from = vfrom + start * PAGE_SIZE;
+		work_items[i].chunk_size = (end - start) * PAGE_SIZE;
+		work_items[i].nt = nt;
+		work_items[i].prefetch = prefetch;
 	}
-#endif
 }
 
-static void exchange_page_work_queue_thread(struct work_struct *work)
+/*
+ * Queue the @nr works of @work_items round robin on the @nr_cpus CPUs of
+ * @cpu_id_list and wait for them. The last work to finish wakes us up, so
+ * the wait does not grow with the number of threads and does not wait for
+ * the unrelated works of system_highpri_wq, as flush_workqueue() did.
+ */
+static void exchange_page_run(struct copy_page_info *work_items, int nr,
+		const int *cpu_id_list, int nr_cpus, work_func_t fn)
 {
-	struct copy_page_info *my_work = (struct copy_page_info*)work;
-	kernel_fpu_begin();
-	exchange_page_routine(my_work->to,
-							  my_work->from,
-							  my_work->chunk_size);
-	kernel_fpu_end();
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic64_t worker_ns = ATOMIC64_INIT(0);
+	atomic_t nr_pending;
+	int i;
+
+	if (!nr)
+		return;
+
+	atomic_set(&nr_pending, nr);
+	for (i = 0; i < nr; i++) {
+		INIT_WORK(&work_items[i].copy_page_work, fn);
+		work_items[i].nr_pending = &nr_pending;
+		work_items[i].worker_ns = &worker_ns;
+		work_items[i].done = &done;
+		queue_work_on(cpu_id_list[i % nr_cpus], system_highpri_wq,
+				&work_items[i].copy_page_work);
+	}
+
+	wait_for_completion(&done);
+	migrate_worker_time_add(atomic64_read(&worker_ns));
 }
 
-// controls the usage of RPDAA optimization in page migration
-extern int sysctl_enable_page_migration_optimization_avoid_remote_pmem_write;
+/* Node whose CPUs exchange pages between @from_node and @to_node */
+static int exchange_page_helper_node(int from_node, int to_node)
+{
+	// by default schedult page migration workers on the initiator node,
+	// with RPDAA on the socket of the PMEM side, the destination first
+	return page_copy_use_rpdaa() ?
+		copy_page_rpdaa_node(from_node, to_node) : numa_node_id();
+}
+
+/* ======================== split socket exchange ======================== */
+
+/* bounce buffer of each socket, the bytes of the pairs swapped per round */
+#define EXCHANGE_SPLIT_ORDER	9
+#define EXCHANGE_SPLIT_ROUND	(PAGE_SIZE << EXCHANGE_SPLIT_ORDER)
+/* largest one way copy of a work */
+#define EXCHANGE_SPLIT_CHUNK	(256UL << 10)
+
+/* Node of the CPUs of the socket of @nid, NUMA_NO_NODE if none */
+static int exchange_split_cpu_node(int nid)
+{
+	if (node_state(nid, N_CPU))
+		return nid;
+
+	return pmem_nearest_node(nid);
+}
+
+/* Size of the pages of pair @i, the pairs all have @nr_base pages if set */
+static unsigned long exchange_split_pair_size(struct page **from, int i,
+		int nr_base)
+{
+	return PAGE_SIZE * (nr_base ? nr_base : hpage_nr_pages(from[i]));
+}
+
+static void exchange_split_add(struct copy_page_info *work, int *cpu_of,
+		int cpu, char *to, char *from, unsigned long len, int nt_mode,
+		unsigned int prefetch)
+{
+	work->to = to;
+	work->from = from;
+	work->chunk_size = len;
+	work->nt_mode = nt_mode;
+	work->prefetch = prefetch;
+	*cpu_of = cpu;
+}
+
+/*
+ * Exchange the @nr_pages pairs of pages @to and @from, on the nodes of two
+ * different sockets, so that neither socket ever writes the memory of the
+ * other. Side 0 is the socket of @to, side 1 the one of @from. Each round,
+ * the workers of each side copy a piece of the remote page of every pair
+ * into a bounce buffer on their node, and once all of them are done, copy
+ * the bounce buffer over the local page, both writes socket local.
+ *
+ * Returns 0 when the pages are exchanged, an error for the caller to fall
+ * back to the regular exchange: -EINVAL if the pages are on one socket.
+ */
+static int exchange_page_lists_split(struct page **to, struct page **from,
+		int nr_pages, int nr_base)
+{
+	int nid[2] = { page_to_nid(*to), page_to_nid(*from) };
+	struct page **pages[2] = { to, from };
+	int cpu_node[2], nr_cpus[2], writers[2] = { 0, 0 };
+	int cpus[2][MAX_NR_COPY_THREADS];
+	struct page *bounce[2] = { NULL, NULL };
+	struct copy_page_info *reads, *writes;
+	int *read_cpu, *write_cpu;
+	unsigned long off = 0, bytes = 0;
+	int nr_works, i = 0, s, err = -ENOMEM;
+	int nt_mode[2] = { PAGE_COPY_NT_NONE, PAGE_COPY_NT_NONE };
+
+	cpu_node[0] = exchange_split_cpu_node(nid[0]);
+	cpu_node[1] = exchange_split_cpu_node(nid[1]);
+	if (cpu_node[0] == NUMA_NO_NODE || cpu_node[1] == NUMA_NO_NODE ||
+	    cpu_node[0] == cpu_node[1])
+		return -EINVAL;
+
+	for (s = 0; s < 2; s++) {
+		nr_cpus[s] = copy_page_pick_cpus(cpu_node[s], cpus[s],
+				max(page_copy_nr_threads() / 2, 1U));
+		if (!nr_cpus[s])
+			return -ENODEV;
+	}
+
+	/* a round has a piece of every pair it reaches, and of each chunk */
+	nr_works = min_t(unsigned long, EXCHANGE_SPLIT_ROUND / PAGE_SIZE,
+			 nr_pages + EXCHANGE_SPLIT_ROUND / EXCHANGE_SPLIT_CHUNK);
+	reads = kvzalloc(sizeof(*reads) * 4 * nr_works, GFP_KERNEL);
+	read_cpu = kvmalloc_array(4 * nr_works, sizeof(int), GFP_KERNEL);
+	if (!reads || !read_cpu)
+		goto free;
+	writes = reads + 2 * nr_works;
+	write_cpu = read_cpu + 2 * nr_works;
+
+	for (s = 0; s < 2; s++) {
+		bounce[s] = alloc_pages_node(cpu_node[s], GFP_KERNEL |
+				__GFP_THISNODE | __GFP_NORETRY | __GFP_NOWARN,
+				EXCHANGE_SPLIT_ORDER);
+		if (!bounce[s])
+			goto free;
+	}
+
+	if (page_exchange_use_nt(nid[0], nid[1],
+			exchange_split_pair_size(from, 0, nr_base))) {
+		nt_mode[0] = PAGE_COPY_NT_LOAD;
+		nt_mode[1] = PAGE_COPY_NT_STORE;
+	}
+
+	/* the writers of a slow tier node only write in the second half */
+	for (s = 0; s < 2; s++) {
+		if (!node_is_slow_tier(nid[s]))
+			continue;
+		writers[s] = pmem_writers_get(nid[s], nr_cpus[s], true);
+		nr_cpus[s] = writers[s];
+	}
+
+	trace_mm_migrate_copy_dispatch(MIGRATE_ENGINE_EXCHANGE, nid[1], nid[0],
+			cpu_node[0], nr_pages,
+			exchange_split_pair_size(from, 0, nr_base) * nr_pages,
+			compound_order(*from), nt_mode[0] != PAGE_COPY_NT_NONE);
+
+	while (i < nr_pages) {
+		unsigned long round = 0;
+		int nr_reads = 0, nr_writes = 0;
+
+		/* cut the next EXCHANGE_SPLIT_ROUND bytes of the pairs */
+		while (i < nr_pages && round < EXCHANGE_SPLIT_ROUND) {
+			unsigned long size = exchange_split_pair_size(from, i,
+					nr_base);
+			unsigned long len = min3(size - off,
+					EXCHANGE_SPLIT_ROUND - round,
+					EXCHANGE_SPLIT_CHUNK);
+
+			for (s = 0; s < 2; s++) {
+				char *local = page_address(pages[s][i]) + off;
+				char *remote = page_address(pages[!s][i]) + off;
+				char *buf = page_address(bounce[s]) + round;
+				int cpu = cpus[s][nr_reads / 2 % nr_cpus[s]];
+
+				exchange_split_add(&reads[nr_reads],
+						&read_cpu[nr_reads], cpu, buf,
+						remote, len, nt_mode[0],
+						page_copy_prefetch(nid[!s]));
+				exchange_split_add(&writes[nr_writes],
+						&write_cpu[nr_writes], cpu, local,
+						buf, len, nt_mode[1], 0);
+				nr_reads++;
+				nr_writes++;
+			}
+
+			round += len;
+			off += len;
+			if (off == size) {
+				off = 0;
+				i++;
+			}
+		}
+
+		exchange_page_run(reads, nr_reads, read_cpu, nr_reads,
+				exchange_split_work_queue_thread);
+		exchange_page_run(writes, nr_writes, write_cpu, nr_writes,
+				exchange_split_work_queue_thread);
+		bytes += round;
+	}
+
+	for (s = 0; s < 2; s++) {
+		if (writers[s])
+			pmem_writers_put(nid[s], writers[s]);
+		count_pmem_write(cpu_node[s], nid[s], bytes);
+	}
+	count_vm_events(PGEXCHANGE_SPLIT, bytes >> PAGE_SHIFT);
+	err = 0;
+free:
+	for (s = 0; s < 2; s++)
+		if (bounce[s])
+			__free_pages(bounce[s], EXCHANGE_SPLIT_ORDER);
+	kvfree(read_cpu);
+	kvfree(reads);
+
+	return err;
+}
 
 int exchange_page_mthread(struct page *to, struct page *from, int nr_pages)
 {
-	int total_mt_num = limit_mt_num;
+	int total_mt_num = page_copy_nr_threads();
 	int to_node, from_node;
-	int i;
 	struct copy_page_info *work_items;
 	char *vto, *vfrom;
-	unsigned long chunk_size;
-	const struct cpumask *per_node_cpumask;
-	int cpu_id_list[32] = {0};
-	int cpu;
+	int cpu_id_list[MAX_NR_COPY_THREADS] = {0};
+	int nr_works, helper_node, writer_node;
+	bool nt;
+
+	if (READ_ONCE(sysctl_exchange_split_socket) &&
+	    !exchange_page_lists_split(&to, &from, 1, nr_pages))
+		return 0;
 
 	from_node = page_to_nid(from);
 	to_node = page_to_nid(to);
+	helper_node = exchange_page_helper_node(from_node, to_node);
+	writer_node = pmem_writers_exchange_node(to_node, from_node);
 
-	// by default schedult page migration workers on the initiator node
-	per_node_cpumask = cpumask_of_node(numa_node_id());
-
-	if(sysctl_enable_page_migration_optimization_avoid_remote_pmem_write){
-		if(get_nearest_cpu_node(to_node)!=-1){
-			// schedule page migration on destination node of page migration since it's a PMEM node
-			per_node_cpumask = cpumask_of_node(cpu_to_node(get_nearest_cpu_node(to_node)));
-		} else if(get_nearest_cpu_node(from_node)!=-1) {
-			// schedule page migration on source node of page migration since it's a PMEM node but 
-			// destination node is not a PMEM node
-			per_node_cpumask = cpumask_of_node(cpu_to_node(get_nearest_cpu_node(from_node)));
-		}
-	}
-
-	total_mt_num = min_t(unsigned int, total_mt_num,
-						 cpumask_weight(per_node_cpumask));
-
-	if (total_mt_num > 1)
-		total_mt_num = (total_mt_num / 2) * 2;
-
-	if (total_mt_num > 32 || total_mt_num < 1)
+	total_mt_num = copy_page_pick_cpus(helper_node, cpu_id_list,
+			total_mt_num);
+	if (total_mt_num < 1)
 		return -ENODEV;
 
-	work_items = kvzalloc(sizeof(struct copy_page_info)*total_mt_num,
+	nr_works = min(total_mt_num, nr_pages);
+	work_items = kvzalloc(sizeof(struct copy_page_info) * nr_works,
 						 GFP_KERNEL);
 	if (!work_items)
 		return -ENOMEM;
 
-	i = 0;
-	for_each_cpu(cpu, per_node_cpumask) {
-		if (i >= total_mt_num)
-			break;
-		cpu_id_list[i] = cpu;
-		++i;
-	}
+	/* one writer per CPU, the works queued on the same CPU run in turn */
+	total_mt_num = pmem_writers_get(writer_node, total_mt_num, true);
 
 	/* XXX: assume no highmem  */
 	vfrom = kmap(from);
 	vto = kmap(to);
-	chunk_size = PAGE_SIZE*nr_pages / total_mt_num;
+	nt = page_exchange_use_nt(to_node, from_node, PAGE_SIZE * nr_pages);
 
-	for (i = 0; i < total_mt_num; ++i) {
-		INIT_WORK((struct work_struct *)&work_items[i],
-				exchange_page_work_queue_thread);
-
-		work_items[i].to = vto + i * chunk_size;
-		work_items[i].from = vfrom + i * chunk_size;
-		work_items[i].chunk_size = chunk_size;
-
-		queue_work_on(cpu_id_list[i],
-					  system_highpri_wq,
-					  (struct work_struct *)&work_items[i]);
-	}
+	trace_mm_migrate_copy_dispatch(MIGRATE_ENGINE_EXCHANGE, from_node,
+			to_node, helper_node, 1, PAGE_SIZE * nr_pages,
+			ilog2(nr_pages), nt);
 
-	/* Wait until it finishes  */
-	flush_workqueue(system_highpri_wq);
+	exchange_page_slice(work_items, nr_works, vto, vfrom, nr_pages, nt,
+			page_exchange_prefetch(to_node, from_node));
+	exchange_page_run(work_items, nr_works, cpu_id_list, total_mt_num,
+			exchange_page_work_queue_thread);
+	pmem_writers_put(writer_node, total_mt_num);
 
 	kunmap(to);
 	kunmap(from);
 
 	kvfree(work_items);
 
+	/* an exchange writes both pages */
+	count_pmem_write(helper_node, to_node, PAGE_SIZE * nr_pages);
+	count_pmem_write(helper_node, from_node, PAGE_SIZE * nr_pages);
+
 	return 0;
 }
 
-int exchange_page_lists_mthread(struct page **to, struct page **from, int nr_pages) 
+/*
+ * Exchange @nr_pages pairs of pages. With fewer pages than threads the
+ * threads are shared out between the pages and each page is cut in as
+ * many works as it gets threads, else each pair is one work.
+ */
+int exchange_page_lists_mthread(struct page **to, struct page **from, int nr_pages)
 {
-	int err = 0;
-	int total_mt_num = limit_mt_num;
+	int total_mt_num = page_copy_nr_threads();
 	int to_node, from_node;
 	int i;
 	struct copy_page_info *work_items;
-	const struct cpumask *per_node_cpumask;
-	int cpu_id_list[32] = {0};
-	int cpu;
-	int item_idx;
+	int cpu_id_list[MAX_NR_COPY_THREADS] = {0};
+	int helper_node, writer_node;
+	int nr_works = 0;
+
+	if (READ_ONCE(sysctl_exchange_split_socket) &&
+	    !exchange_page_lists_split(to, from, nr_pages, 0))
+		return 0;
 
 	from_node = page_to_nid(*from);
 	to_node = page_to_nid(*to);
+	helper_node = exchange_page_helper_node(from_node, to_node);
+	writer_node = pmem_writers_exchange_node(to_node, from_node);
 
-	per_node_cpumask = cpumask_of_node(numa_node_id());
-
-	if(sysctl_enable_page_migration_optimization_avoid_remote_pmem_write){
-		if(get_nearest_cpu_node(to_node)!=-1){
-			per_node_cpumask = cpumask_of_node(cpu_to_node(get_nearest_cpu_node(to_node)));
-		} else if(get_nearest_cpu_node(from_node)!=-1) {
-			per_node_cpumask = cpumask_of_node(cpu_to_node(get_nearest_cpu_node(from_node)));
-		}
-	}
-
-	total_mt_num = min_t(unsigned int, total_mt_num,
-						 cpumask_weight(per_node_cpumask));
-
-	if (total_mt_num > 32 || total_mt_num < 1)
+	total_mt_num = copy_page_pick_cpus(helper_node, cpu_id_list,
+			total_mt_num);
+	if (total_mt_num < 1)
 		return -ENODEV;
 
-	if (nr_pages < total_mt_num) {
-		int residual_nr_pages = nr_pages - rounddown_pow_of_two(nr_pages);
-
-		if (residual_nr_pages) {
-			for (i = 0; i < residual_nr_pages; ++i) {
-				BUG_ON(hpage_nr_pages(to[i]) != hpage_nr_pages(from[i]));
-				err = exchange_page_mthread(to[i], from[i], hpage_nr_pages(to[i]));
-				VM_BUG_ON(err);
-			}
-			nr_pages = rounddown_pow_of_two(nr_pages);
-			to = &to[residual_nr_pages];
-			from = &from[residual_nr_pages];
-		}
-
-		work_items = kvzalloc(sizeof(struct copy_page_info)*total_mt_num,
-							 GFP_KERNEL);
-	} else
-		work_items = kvzalloc(sizeof(struct copy_page_info)*nr_pages,
-							 GFP_KERNEL);
+	work_items = kvzalloc(sizeof(struct copy_page_info) *
+			max(nr_pages, total_mt_num), GFP_KERNEL);
 	if (!work_items)
 		return -ENOMEM;
 
-	i = 0;
-	for_each_cpu(cpu, per_node_cpumask) {
-		if (i >= total_mt_num)
-			break;
-		cpu_id_list[i] = cpu;
-		++i;
-	}
-
-	if (nr_pages < total_mt_num) {
-		for (cpu = 0; cpu < total_mt_num; ++cpu)
-			INIT_WORK((struct work_struct *)&work_items[cpu],
-					  exchange_page_work_queue_thread);
-		cpu = 0;
-		for (item_idx = 0; item_idx < nr_pages; ++item_idx) {
-			unsigned long chunk_size = nr_pages * PAGE_SIZE * hpage_nr_pages(from[item_idx]) / total_mt_num;
-			char *vfrom = kmap(from[item_idx]);
-			char *vto = kmap(to[item_idx]);
-			VM_BUG_ON(PAGE_SIZE * hpage_nr_pages(from[item_idx]) % total_mt_num);
-			VM_BUG_ON(total_mt_num % nr_pages);
-			BUG_ON(hpage_nr_pages(to[item_idx]) !=
-				   hpage_nr_pages(from[item_idx]));
-
-			for (i = 0; i < (total_mt_num/nr_pages); ++cpu, ++i) {
-				work_items[cpu].to = vto + chunk_size * i;
-				work_items[cpu].from = vfrom + chunk_size * i;
-				work_items[cpu].chunk_size = chunk_size;
-			}
-		}
-		if (cpu != total_mt_num)
-			pr_err("%s: only %d out of %d pages are transferred\n", __func__,
-				cpu - 1, total_mt_num);
-
-		for (cpu = 0; cpu < total_mt_num; ++cpu)
-			queue_work_on(cpu_id_list[cpu],
-						  system_highpri_wq,
-						  (struct work_struct *)&work_items[cpu]);
-	} else {
-		for (i = 0; i < nr_pages; ++i) {
-			int thread_idx = i % total_mt_num;
-
-			INIT_WORK((struct work_struct *)&work_items[i], exchange_page_work_queue_thread);
+	total_mt_num = pmem_writers_get(writer_node, total_mt_num, true);
 
-			/* XXX: assume no highmem  */
-			work_items[i].to = kmap(to[i]);
-			work_items[i].from = kmap(from[i]);
-			work_items[i].chunk_size = PAGE_SIZE * hpage_nr_pages(from[i]);
+	if (trace_mm_migrate_copy_dispatch_enabled()) {
+		unsigned long nr_base_pages = 0;
 
-			BUG_ON(hpage_nr_pages(to[i]) != hpage_nr_pages(from[i]));
+		for (i = 0; i < nr_pages; ++i)
+			nr_base_pages += hpage_nr_pages(from[i]);
+		trace_mm_migrate_copy_dispatch(MIGRATE_ENGINE_EXCHANGE,
+				from_node, to_node, helper_node, nr_pages,
+				(u64)nr_base_pages << PAGE_SHIFT,
+				compound_order(*from),
+				page_exchange_use_nt(to_node, from_node,
+					PAGE_SIZE * hpage_nr_pages(*from)));
+	}
 
-			queue_work_on(cpu_id_list[thread_idx], system_highpri_wq, (struct work_struct *)&work_items[i]);
-		}
+	for (i = 0; i < nr_pages; ++i) {
+		int nr_base = hpage_nr_pages(from[i]);
+		int nr = 1;
+
+		BUG_ON(hpage_nr_pages(to[i]) != nr_base);
+
+		if (nr_pages < total_mt_num)
+			nr = min(total_mt_num * (i + 1) / nr_pages -
+				 total_mt_num * i / nr_pages, nr_base);
+
+		/* XXX: assume no highmem  */
+		exchange_page_slice(&work_items[nr_works], nr, kmap(to[i]),
+				kmap(from[i]), nr_base,
+				page_exchange_use_nt(to_node, from_node,
+					PAGE_SIZE * nr_base),
+				page_exchange_prefetch(to_node, from_node));
+		nr_works += nr;
 	}
 
-	/* Wait until it finishes  */
-	flush_workqueue(system_highpri_wq);
+	exchange_page_run(work_items, nr_works, cpu_id_list, total_mt_num,
+			exchange_page_work_queue_thread);
+	pmem_writers_put(writer_node, total_mt_num);
 
 	for (i = 0; i < nr_pages; ++i) {
 			kunmap(to[i]);
 			kunmap(from[i]);
+			count_pmem_write(helper_node, page_to_nid(to[i]),
+					PAGE_SIZE * hpage_nr_pages(to[i]));
+			count_pmem_write(helper_node, page_to_nid(from[i]),
+					PAGE_SIZE * hpage_nr_pages(from[i]));
 	}
 
 	kvfree(work_items);
 
-	return err;
+	return 0;
 }
-
@@ -27,6 +27,16 @@
  * deactivate the pages and clear PG_Referenced.
  */
 
+/*
+ * The tier placement applies to the inode, for every user of the file, see
+ * mm/page_cache_tier.c. Only those who may write the file, or may renice
+ * others, get to move its page cache.
+ */
+static bool fadvise_tier_allowed(struct file *file)
+{
+	return (file->f_mode & FMODE_WRITE) || capable(CAP_SYS_NICE);
+}
+
 int generic_fadvise(struct file *file, loff_t offset, loff_t len, int advice)
 {
 	struct inode *inode;
@@ -50,11 +60,25 @@ int generic_fadvise(struct file *file, loff_t offset, loff_t len, int advice)
 	if (IS_DAX(inode) || (bdi == &noop_backing_dev_info)) {
 		switch (advice) {
 		case POSIX_FADV_NORMAL:
+			spin_lock(&file->f_lock);
+			file->f_mode &= ~FMODE_NOREUSE;
+			spin_unlock(&file->f_lock);
+			break;
+		case POSIX_FADV_NOREUSE:
+			/* large DAX reads stream, see dax_iomap_rw() */
+			if (IS_DAX(inode)) {
+				spin_lock(&file->f_lock);
+				file->f_mode |= FMODE_NOREUSE;
+				spin_unlock(&file->f_lock);
+			}
+			break;
 		case POSIX_FADV_RANDOM:
 		case POSIX_FADV_SEQUENTIAL:
 		case POSIX_FADV_WILLNEED:
-		case POSIX_FADV_NOREUSE:
 		case POSIX_FADV_DONTNEED:
+		case POSIX_FADV_SLOW_TIER:
+		case POSIX_FADV_SLOW_TIER_READAHEAD:
+		case POSIX_FADV_ANY_TIER:
 			/* no bad return value, but ignore advice */
 			break;
 		default:
@@ -110,6 +134,24 @@ int generic_fadvise(struct file *file, loff_t offset, loff_t len, int advice)
 		break;
 	case POSIX_FADV_NOREUSE:
 		break;
+	case POSIX_FADV_SLOW_TIER:
+		if (!fadvise_tier_allowed(file))
+			return -EPERM;
+		clear_bit(AS_SLOW_TIER_READAHEAD, &mapping->flags);
+		set_bit(AS_SLOW_TIER, &mapping->flags);
+		break;
+	case POSIX_FADV_SLOW_TIER_READAHEAD:
+		if (!fadvise_tier_allowed(file))
+			return -EPERM;
+		clear_bit(AS_SLOW_TIER, &mapping->flags);
+		set_bit(AS_SLOW_TIER_READAHEAD, &mapping->flags);
+		break;
+	case POSIX_FADV_ANY_TIER:
+		if (!fadvise_tier_allowed(file))
+			return -EPERM;
+		clear_bit(AS_SLOW_TIER, &mapping->flags);
+		clear_bit(AS_SLOW_TIER_READAHEAD, &mapping->flags);
+		break;
 	case POSIX_FADV_DONTNEED:
 		if (!inode_write_congested(mapping->host))
 			__filemap_fdatawrite_range(mapping, offset, endbyte,
@@ -959,6 +959,27 @@ struct page *__page_cache_alloc(gfp_t gfp)
 	return alloc_pages(gfp, 0);
 }
 EXPORT_SYMBOL(__page_cache_alloc);
+
+/*
+ * A page cache page for @x, on the slow tier node page_cache_tier_node()
+ * picks if it has one free, else where __page_cache_alloc() puts it.
+ */
+struct page *__page_cache_alloc_tier(struct address_space *x, gfp_t gfp,
+		bool readahead)
+{
+	int nid = page_cache_tier_node(x, readahead);
+	struct page *page;
+
+	if (nid != NUMA_NO_NODE) {
+		page = __alloc_pages_node(nid, (gfp | __GFP_THISNODE |
+				__GFP_NOWARN) & ~__GFP_DIRECT_RECLAIM, 0);
+		if (page)
+			return page;
+	}
+
+	return __page_cache_alloc(gfp);
+}
+EXPORT_SYMBOL(__page_cache_alloc_tier);
 #endif
 
 /*
@@ -1646,7 +1667,7 @@ struct page *pagecache_get_page(struct address_space *mapping, pgoff_t offset,
 		if (fgp_flags & FGP_NOFS)
 			gfp_mask &= ~__GFP_FS;
 
-		page = __page_cache_alloc(gfp_mask);
+		page = __page_cache_alloc_tier(mapping, gfp_mask, false);
 		if (!page)
 			return NULL;
 
@@ -2742,7 +2763,7 @@ static struct page *do_read_cache_page(struct address_space *mapping,
 repeat:
 	page = find_get_page(mapping, index);
 	if (!page) {
-		page = __page_cache_alloc(gfp);
+		page = __page_cache_alloc_tier(mapping, gfp, false);
 		if (!page)
 			return ERR_PTR(-ENOMEM);
 		err = add_to_page_cache_lru(page, mapping, index, gfp);
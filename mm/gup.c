@@ -17,6 +17,7 @@
 #include <linux/migrate.h>
 #include <linux/mm_inline.h>
 #include <linux/sched/mm.h>
+#include <linux/memory_tier.h>
 
 #include <asm/mmu_context.h>
 #include <asm/pgtable.h>
@@ -29,6 +30,9 @@ struct follow_page_context {
 	unsigned int page_mask;
 };
 
+// Migrate the slow tier pages of FOLL_LONGTERM pins to the fast tier first
+int sysctl_longterm_pin_fast_tier = 0;
+
 /*
  * Return the compound head page with ref appropriately incremented,
  * or NULL if that failed.
@@ -1316,7 +1320,7 @@ static long __get_user_pages_locked(struct task_struct *tsk,
 }
 #endif /* !CONFIG_MMU */
 
-#if defined(CONFIG_FS_DAX) || defined (CONFIG_CMA)
+#if defined(CONFIG_FS_DAX) || defined (CONFIG_CMA) || defined(CONFIG_MIGRATION)
 static bool check_dax_vmas(struct vm_area_struct **vmas, long nr_pages)
 {
 	long i;
@@ -1489,6 +1493,123 @@ static long check_and_migrate_cma_pages(struct task_struct *tsk,
 }
 #endif /* CONFIG_CMA */
 
+#ifdef CONFIG_MIGRATION
+/*
+ * Target page on the nearest fast tier node for a slow tier page about to
+ * be pinned. Like new_non_cma_page(), it is not movable: the page stays
+ * pinned for a long time.
+ */
+static struct page *new_fast_tier_page(struct page *page, unsigned long private)
+{
+	int nid = node_promotion_target(page_to_nid(page));
+	gfp_t gfp_mask = GFP_USER | __GFP_THISNODE | __GFP_NOWARN;
+
+	if (nid == NUMA_NO_NODE)
+		return NULL;
+
+#ifdef CONFIG_HUGETLB_PAGE
+	if (PageHuge(page))
+		return alloc_huge_page_node(page_hstate(compound_head(page)),
+					    nid);
+#endif
+	if (PageTransHuge(page)) {
+		struct page *thp;
+
+		thp = __alloc_pages_node(nid, (GFP_TRANSHUGE & ~__GFP_MOVABLE) |
+					 __GFP_THISNODE | __GFP_NOWARN,
+					 HPAGE_PMD_ORDER);
+		if (!thp)
+			return NULL;
+		prep_transhuge_page(thp);
+		return thp;
+	}
+
+	if (PageHighMem(page))
+		gfp_mask |= __GFP_HIGHMEM;
+
+	return __alloc_pages_node(nid, gfp_mask, 0);
+}
+
+/*
+ * With vm.longterm_pin_fast_tier set, move the pages of a FOLL_LONGTERM
+ * pin that are on a slow tier node to the nearest fast tier node before
+ * they are pinned, which tiering cannot move them out of. The pages are
+ * migrated in batches with the copy threads, and pinned where they are
+ * if that fails.
+ */
+static long check_and_migrate_slow_tier_pages(struct task_struct *tsk,
+					      struct mm_struct *mm,
+					      unsigned long start,
+					      unsigned long nr_pages,
+					      struct page **pages,
+					      struct vm_area_struct **vmas,
+					      unsigned int gup_flags)
+{
+	unsigned long i, step;
+	bool drain_allow = true;
+	LIST_HEAD(slow_page_list);
+
+	if (!READ_ONCE(sysctl_longterm_pin_fast_tier) ||
+	    !memory_tiers_present())
+		return nr_pages;
+
+	for (i = 0; i < nr_pages; i += step) {
+		struct page *head = compound_head(pages[i]);
+
+		/* gup may start from a tail page */
+		step = compound_nr(head) - (pages[i] - head);
+
+		if (!node_is_slow_tier(page_to_nid(head)) ||
+		    node_promotion_target(page_to_nid(head)) == NUMA_NO_NODE)
+			continue;
+
+		if (PageHuge(head)) {
+			isolate_huge_page(head, &slow_page_list);
+			continue;
+		}
+
+		if (!PageLRU(head) && drain_allow) {
+			lru_add_drain_all();
+			drain_allow = false;
+		}
+
+		if (!isolate_lru_page(head)) {
+			list_add_tail(&head->lru, &slow_page_list);
+			mod_node_page_state(page_pgdat(head), NR_ISOLATED_ANON +
+					    page_is_file_cache(head),
+					    hpage_nr_pages(head));
+		}
+	}
+
+	if (list_empty(&slow_page_list))
+		return nr_pages;
+
+	/* drop the above get_user_pages reference */
+	for (i = 0; i < nr_pages; i++)
+		put_page(pages[i]);
+
+	migrate_pages_batch(&slow_page_list, new_fast_tier_page, NULL, 0,
+			    MIGRATE_COPY_MT, NULL, MR_SYSCALL);
+	if (!list_empty(&slow_page_list))
+		putback_movable_pages(&slow_page_list);
+
+	/* the pages not migrated are pinned on the slow tier */
+	return __get_user_pages_locked(tsk, mm, start, nr_pages, pages, vmas,
+				       NULL, gup_flags);
+}
+#else
+static long check_and_migrate_slow_tier_pages(struct task_struct *tsk,
+					      struct mm_struct *mm,
+					      unsigned long start,
+					      unsigned long nr_pages,
+					      struct page **pages,
+					      struct vm_area_struct **vmas,
+					      unsigned int gup_flags)
+{
+	return nr_pages;
+}
+#endif /* CONFIG_MIGRATION */
+
 /*
  * __gup_longterm_locked() is a wrapper for __get_user_pages_locked which
  * allows us to process the FOLL_LONGTERM flag.
@@ -1536,6 +1657,9 @@ static long __gup_longterm_locked(struct task_struct *tsk,
 
 		rc = check_and_migrate_cma_pages(tsk, mm, start, rc, pages,
 						 vmas_tmp, gup_flags);
+		if (rc > 0)
+			rc = check_and_migrate_slow_tier_pages(tsk, mm, start,
+					rc, pages, vmas_tmp, gup_flags);
 	}
 
 out:
@@ -1543,7 +1667,7 @@ static long __gup_longterm_locked(struct task_struct *tsk,
 		kfree(vmas_tmp);
 	return rc;
 }
-#else /* !CONFIG_FS_DAX && !CONFIG_CMA */
+#else /* !CONFIG_FS_DAX && !CONFIG_CMA && !CONFIG_MIGRATION */
 static __always_inline long __gup_longterm_locked(struct task_struct *tsk,
 						  struct mm_struct *mm,
 						  unsigned long start,
@@ -1555,7 +1679,7 @@ static __always_inline long __gup_longterm_locked(struct task_struct *tsk,
 	return __get_user_pages_locked(tsk, mm, start, nr_pages, pages, vmas,
 				       NULL, flags);
 }
-#endif /* CONFIG_FS_DAX || CONFIG_CMA */
+#endif /* CONFIG_FS_DAX || CONFIG_CMA || CONFIG_MIGRATION */
 
 /*
  * get_user_pages_remote() - pin user pages in memory
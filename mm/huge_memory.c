@@ -33,6 +33,8 @@
 #include <linux/oom.h>
 #include <linux/numa.h>
 #include <linux/page_owner.h>
+#include <linux/migrate_stat.h>
+#include <linux/memory_tier.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -58,6 +60,112 @@ unsigned long transparent_hugepage_flags __read_mostly =
 	(1<<TRANSPARENT_HUGEPAGE_DEFRAG_KHUGEPAGED_FLAG)|
 	(1<<TRANSPARENT_HUGEPAGE_USE_ZERO_PAGE_FLAG);
 
+/*
+ * Per-node policies overriding the enabled and defrag settings for the
+ * THPs allocated on a node, by faults, khugepaged and migration, e.g.
+ * THPs with direct compaction on DRAM nodes and THPs without defrag
+ * stalls on PMEM nodes. THP_NODE_DEFAULT follows the global setting.
+ */
+enum {
+	THP_NODE_DEFAULT,
+	THP_NODE_ALWAYS,
+	THP_NODE_MADVISE,
+	THP_NODE_NEVER,
+};
+
+enum {
+	THP_DEFRAG_DEFAULT,
+	THP_DEFRAG_ALWAYS,
+	THP_DEFRAG_DEFER,
+	THP_DEFRAG_DEFER_MADVISE,
+	THP_DEFRAG_MADVISE,
+	THP_DEFRAG_NEVER,
+};
+
+static u8 thp_node_enabled[MAX_NUMNODES];
+static u8 thp_node_defrag[MAX_NUMNODES];
+
+/*
+ * Whether a fault or khugepaged may allocate a THP for @vma on @nid, the
+ * vma being one __transparent_hugepage_enabled() lets through.
+ */
+bool thp_node_vma_allowed(int nid, struct vm_area_struct *vma)
+{
+	int enabled = nid == NUMA_NO_NODE ? THP_NODE_DEFAULT :
+		READ_ONCE(thp_node_enabled[nid]);
+
+	switch (enabled) {
+	case THP_NODE_ALWAYS:
+		return true;
+	case THP_NODE_MADVISE:
+		return vma->vm_flags & VM_HUGEPAGE;
+	case THP_NODE_NEVER:
+		return false;
+	}
+
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags) ||
+	    vma_is_dax(vma))
+		return true;
+	if (test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+		     &transparent_hugepage_flags))
+		return vma->vm_flags & VM_HUGEPAGE;
+
+	return false;
+}
+
+/*
+ * Whether a THP may be migrated to @nid as a THP rather than split. The
+ * page is huge already, only a policy of never on the node refuses it.
+ */
+bool thp_node_target_allowed(int nid)
+{
+	return nid == NUMA_NO_NODE ||
+		READ_ONCE(thp_node_enabled[nid]) != THP_NODE_NEVER;
+}
+
+/*
+ * The gfp mask of a THP allocated on @nid by khugepaged or for migration,
+ * @gfp unless the node has a defrag policy of its own. There is no vma to
+ * have been madvised, a policy of madvise keeps @gfp.
+ */
+gfp_t thp_node_defrag_gfpmask(int nid, gfp_t gfp)
+{
+	if (nid == NUMA_NO_NODE)
+		return gfp;
+
+	switch (READ_ONCE(thp_node_defrag[nid])) {
+	case THP_DEFRAG_ALWAYS:
+		return GFP_TRANSHUGE;
+	case THP_DEFRAG_DEFER:
+	case THP_DEFRAG_DEFER_MADVISE:
+		return GFP_TRANSHUGE_LIGHT | __GFP_KSWAPD_RECLAIM;
+	case THP_DEFRAG_NEVER:
+		return GFP_TRANSHUGE_LIGHT;
+	}
+
+	return gfp;
+}
+
+/* The defrag setting in force for the faults allocating on @nid */
+static int thp_node_defrag_policy(int nid)
+{
+	int defrag = nid == NUMA_NO_NODE ? THP_DEFRAG_DEFAULT :
+		READ_ONCE(thp_node_defrag[nid]);
+
+	if (defrag != THP_DEFRAG_DEFAULT)
+		return defrag;
+
+	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_DIRECT_FLAG, &transparent_hugepage_flags))
+		return THP_DEFRAG_ALWAYS;
+	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_KSWAPD_FLAG, &transparent_hugepage_flags))
+		return THP_DEFRAG_DEFER;
+	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_KSWAPD_OR_MADV_FLAG, &transparent_hugepage_flags))
+		return THP_DEFRAG_DEFER_MADVISE;
+	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG, &transparent_hugepage_flags))
+		return THP_DEFRAG_MADVISE;
+	return THP_DEFRAG_NEVER;
+}
+
 static struct shrinker deferred_split_shrinker;
 
 static atomic_t huge_zero_refcount;
@@ -304,6 +412,25 @@ static ssize_t hpage_pmd_size_show(struct kobject *kobj,
 static struct kobj_attribute hpage_pmd_size_attr =
 	__ATTR_RO(hpage_pmd_size);
 
+#ifdef CONFIG_MIGRATION
+/* THPs split by migration, one "reason count" line per migrate_reason */
+static ssize_t migration_splits_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	int reason;
+
+	for (reason = 0; reason < MR_TYPES; reason++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %ld\n",
+				migrate_reason_names[reason],
+				atomic_long_read(&thp_migration_splits[reason]));
+
+	return len;
+}
+static struct kobj_attribute migration_splits_attr =
+	__ATTR_RO(migration_splits);
+#endif
+
 #ifdef CONFIG_DEBUG_VM
 static ssize_t debug_cow_show(struct kobject *kobj,
 				struct kobj_attribute *attr, char *buf)
@@ -322,11 +449,88 @@ static struct kobj_attribute debug_cow_attr =
 	__ATTR(debug_cow, 0644, debug_cow_show, debug_cow_store);
 #endif /* CONFIG_DEBUG_VM */
 
+static const char * const thp_node_enabled_names[] = {
+	[THP_NODE_DEFAULT]	= "default",
+	[THP_NODE_ALWAYS]	= "always",
+	[THP_NODE_MADVISE]	= "madvise",
+	[THP_NODE_NEVER]	= "never",
+};
+
+static const char * const thp_node_defrag_names[] = {
+	[THP_DEFRAG_DEFAULT]		= "default",
+	[THP_DEFRAG_ALWAYS]		= "always",
+	[THP_DEFRAG_DEFER]		= "defer",
+	[THP_DEFRAG_DEFER_MADVISE]	= "defer+madvise",
+	[THP_DEFRAG_MADVISE]		= "madvise",
+	[THP_DEFRAG_NEVER]		= "never",
+};
+
+static DEFINE_MUTEX(thp_node_mutex);
+
+/* One "node enabled defrag" line per online node */
+static ssize_t nodes_show(struct kobject *kobj,
+			  struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len;
+	int nid;
+
+	len = scnprintf(buf, PAGE_SIZE, "node enabled defrag\n");
+	for_each_online_node(nid)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %s %s\n", nid,
+				 thp_node_enabled_names[READ_ONCE(thp_node_enabled[nid])],
+				 thp_node_defrag_names[READ_ONCE(thp_node_defrag[nid])]);
+
+	return len;
+}
+
+/* "node enabled defrag", "default" hands the node back to the global setting */
+static ssize_t nodes_store(struct kobject *kobj,
+			   struct kobj_attribute *attr,
+			   const char *buf, size_t count)
+{
+	char enabled[16], defrag[16];
+	int nid, e, d, err;
+	bool always = false, madv = false;
+
+	if (sscanf(buf, "%d %15s %15s", &nid, enabled, defrag) != 3)
+		return -EINVAL;
+	if (nid < 0 || nid >= MAX_NUMNODES || !node_online(nid))
+		return -EINVAL;
+	e = match_string(thp_node_enabled_names,
+			 ARRAY_SIZE(thp_node_enabled_names), enabled);
+	d = match_string(thp_node_defrag_names,
+			 ARRAY_SIZE(thp_node_defrag_names), defrag);
+	if (e < 0 || d < 0)
+		return -EINVAL;
+
+	mutex_lock(&thp_node_mutex);
+	WRITE_ONCE(thp_node_enabled[nid], e);
+	WRITE_ONCE(thp_node_defrag[nid], d);
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		always |= thp_node_enabled[nid] == THP_NODE_ALWAYS;
+		madv |= thp_node_enabled[nid] == THP_NODE_MADVISE;
+	}
+	assign_bit(TRANSPARENT_HUGEPAGE_NODE_FLAG,
+		   &transparent_hugepage_flags, always);
+	assign_bit(TRANSPARENT_HUGEPAGE_NODE_REQ_MADV_FLAG,
+		   &transparent_hugepage_flags, madv);
+	err = start_stop_khugepaged();
+	mutex_unlock(&thp_node_mutex);
+
+	return err ? err : count;
+}
+static struct kobj_attribute nodes_attr =
+	__ATTR(nodes, 0644, nodes_show, nodes_store);
+
 static struct attribute *hugepage_attr[] = {
 	&enabled_attr.attr,
 	&defrag_attr.attr,
 	&use_zero_page_attr.attr,
 	&hpage_pmd_size_attr.attr,
+	&nodes_attr.attr,
+#ifdef CONFIG_MIGRATION
+	&migration_splits_attr.attr,
+#endif
 #if defined(CONFIG_SHMEM) && defined(CONFIG_TRANSPARENT_HUGE_PAGECACHE)
 	&shmem_enabled_attr.attr,
 #endif
@@ -585,7 +789,7 @@ unsigned long thp_get_unmapped_area(struct file *filp, unsigned long addr,
 EXPORT_SYMBOL_GPL(thp_get_unmapped_area);
 
 static vm_fault_t __do_huge_pmd_anonymous_page(struct vm_fault *vmf,
-			struct page *page, gfp_t gfp)
+			struct page *page, gfp_t gfp, bool zeroed)
 {
 	struct vm_area_struct *vma = vmf->vma;
 	struct mem_cgroup *memcg;
@@ -607,7 +811,9 @@ static vm_fault_t __do_huge_pmd_anonymous_page(struct vm_fault *vmf,
 		goto release;
 	}
 
-	clear_huge_page(page, vmf->address, HPAGE_PMD_NR);
+	/* pages of the pre-zeroed pools were cleared when they were added */
+	if (!zeroed)
+		clear_huge_page(page, vmf->address, HPAGE_PMD_NR);
 	/*
 	 * The memory barrier inside __SetPageUptodate makes sure that
 	 * clear_huge_page writes become visible before the set_pmd_at()
@@ -672,29 +878,31 @@ static vm_fault_t __do_huge_pmd_anonymous_page(struct vm_fault *vmf,
  * madvise: directly stall for MADV_HUGEPAGE, otherwise fail if not immediately
  *	    available
  * never: never stall for any thp allocation
+ *
+ * The policy is the one of @nid, the node the fault allocates from.
  */
-static inline gfp_t alloc_hugepage_direct_gfpmask(struct vm_area_struct *vma)
+static inline gfp_t alloc_hugepage_direct_gfpmask(struct vm_area_struct *vma,
+						   int nid)
 {
 	const bool vma_madvised = !!(vma->vm_flags & VM_HUGEPAGE);
 
-	/* Always do synchronous compaction */
-	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_DIRECT_FLAG, &transparent_hugepage_flags))
+	switch (thp_node_defrag_policy(nid)) {
+	case THP_DEFRAG_ALWAYS:
+		/* Always do synchronous compaction */
 		return GFP_TRANSHUGE | (vma_madvised ? 0 : __GFP_NORETRY);
-
-	/* Kick kcompactd and fail quickly */
-	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_KSWAPD_FLAG, &transparent_hugepage_flags))
+	case THP_DEFRAG_DEFER:
+		/* Kick kcompactd and fail quickly */
 		return GFP_TRANSHUGE_LIGHT | __GFP_KSWAPD_RECLAIM;
-
-	/* Synchronous compaction if madvised, otherwise kick kcompactd */
-	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_KSWAPD_OR_MADV_FLAG, &transparent_hugepage_flags))
+	case THP_DEFRAG_DEFER_MADVISE:
+		/* Synchronous compaction if madvised, otherwise kick kcompactd */
 		return GFP_TRANSHUGE_LIGHT |
 			(vma_madvised ? __GFP_DIRECT_RECLAIM :
 					__GFP_KSWAPD_RECLAIM);
-
-	/* Only do synchronous compaction if madvised */
-	if (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG, &transparent_hugepage_flags))
+	case THP_DEFRAG_MADVISE:
+		/* Only do synchronous compaction if madvised */
 		return GFP_TRANSHUGE_LIGHT |
 		       (vma_madvised ? __GFP_DIRECT_RECLAIM : 0);
+	}
 
 	return GFP_TRANSHUGE_LIGHT;
 }
@@ -722,6 +930,7 @@ vm_fault_t do_huge_pmd_anonymous_page(struct vm_fault *vmf)
 	gfp_t gfp;
 	struct page *page;
 	unsigned long haddr = vmf->address & HPAGE_PMD_MASK;
+	int nid;
 
 	if (!transhuge_vma_suitable(vma, haddr))
 		return VM_FAULT_FALLBACK;
@@ -729,6 +938,11 @@ vm_fault_t do_huge_pmd_anonymous_page(struct vm_fault *vmf)
 		return VM_FAULT_OOM;
 	if (unlikely(khugepaged_enter(vma, vma->vm_flags)))
 		return VM_FAULT_OOM;
+	nid = thp_node(vma, haddr, GFP_TRANSHUGE_LIGHT);
+	if (!thp_node_vma_allowed(nid, vma)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
 	if (!(vmf->flags & FAULT_FLAG_WRITE) &&
 			!mm_forbids_zeropage(vma->vm_mm) &&
 			transparent_hugepage_use_zero_page()) {
@@ -768,14 +982,18 @@ vm_fault_t do_huge_pmd_anonymous_page(struct vm_fault *vmf)
 			pte_free(vma->vm_mm, pgtable);
 		return ret;
 	}
-	gfp = alloc_hugepage_direct_gfpmask(vma);
+	gfp = alloc_hugepage_direct_gfpmask(vma, nid);
+	page = prezero_pool_get(nid);
+	if (page)
+		return __do_huge_pmd_anonymous_page(vmf, page, gfp, true);
+
 	page = alloc_hugepage_vma(gfp, vma, haddr, HPAGE_PMD_ORDER);
 	if (unlikely(!page)) {
 		count_vm_event(THP_FAULT_FALLBACK);
 		return VM_FAULT_FALLBACK;
 	}
 	prep_transhuge_page(page);
-	return __do_huge_pmd_anonymous_page(vmf, page, gfp);
+	return __do_huge_pmd_anonymous_page(vmf, page, gfp, false);
 }
 
 static void insert_pfn_pmd(struct vm_area_struct *vma, unsigned long addr,
@@ -1333,6 +1551,7 @@ vm_fault_t do_huge_pmd_wp_page(struct vm_fault *vmf, pmd_t orig_pmd)
 	struct mmu_notifier_range range;
 	gfp_t huge_gfp;			/* for allocation and charge */
 	vm_fault_t ret = 0;
+	int nid;
 
 	vmf->ptl = pmd_lockptr(vma->vm_mm, vmf->pmd);
 	VM_BUG_ON_VMA(!vma->anon_vma, vma);
@@ -1374,9 +1593,11 @@ vm_fault_t do_huge_pmd_wp_page(struct vm_fault *vmf, pmd_t orig_pmd)
 	get_page(page);
 	spin_unlock(vmf->ptl);
 alloc:
+	nid = thp_node(vma, haddr, GFP_TRANSHUGE_LIGHT);
 	if (__transparent_hugepage_enabled(vma) &&
+	    thp_node_vma_allowed(nid, vma) &&
 	    !transparent_hugepage_debug_cow()) {
-		huge_gfp = alloc_hugepage_direct_gfpmask(vma);
+		huge_gfp = alloc_hugepage_direct_gfpmask(vma, nid);
 		new_page = alloc_hugepage_vma(huge_gfp, vma, haddr, HPAGE_PMD_ORDER);
 	} else
 		new_page = NULL;
@@ -1567,18 +1788,24 @@ vm_fault_t do_huge_pmd_numa_page(struct vm_fault *vmf, pmd_t pmd)
 	 * check_same as the page may no longer be mapped.
 	 */
 	if (unlikely(pmd_trans_migrating(*vmf->pmd))) {
+		u64 start;
+
 		page = pmd_page(*vmf->pmd);
 		if (!get_page_unless_zero(page))
 			goto out_unlock;
 		spin_unlock(vmf->ptl);
+		start = ktime_get_ns();
 		put_and_wait_on_page_locked(page);
+		count_migrate_stall(vma->vm_mm, true, ktime_get_ns() - start);
 		goto out;
 	}
 
 	page = pmd_page(pmd);
 	BUG_ON(is_huge_zero_page(page));
 	page_nid = page_to_nid(page);
-	last_cpupid = page_cpupid_last(page);
+	/* a slow tier page keeps its scan time there, see numa_scan_mark_page() */
+	if (!node_is_slow_tier(page_nid))
+		last_cpupid = page_cpupid_last(page);
 	count_vm_numa_event(NUMA_HINT_FAULTS);
 	if (page_nid == this_nid) {
 		count_vm_numa_event(NUMA_HINT_FAULTS_LOCAL);
@@ -1982,6 +2209,13 @@ int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
 	if (prot_numa && pmd_protnone(*pmd))
 		goto unlock;
 
+	if (prot_numa && numa_scan_skip_node(vma->vm_mm,
+					     page_to_nid(pmd_page(*pmd))))
+		goto unlock;
+
+	if (prot_numa)
+		numa_scan_mark_page(pmd_page(*pmd));
+
 	/*
 	 * In case prot_numa, we are under down_read(mmap_sem). It's critical
 	 * to not clear pmd intermittently to avoid race with MADV_DONTNEED
@@ -39,6 +39,7 @@
 #include <linux/node.h>
 #include <linux/userfaultfd_k.h>
 #include <linux/page_owner.h>
+#include <linux/memory_tier.h>
 #include "internal.h"
 
 int hugetlb_max_hstate __read_mostly;
@@ -1024,10 +1025,30 @@ static void free_gigantic_page(struct page *page, unsigned int order)
 }
 
 #ifdef CONFIG_CONTIG_ALLOC
+// Allocate gigantic pages of slow tier nodes from their ZONE_MOVABLE
+int sysctl_hugetlb_slow_tier_movable = 0;
+
 static struct page *alloc_gigantic_page(struct hstate *h, gfp_t gfp_mask,
 		int nid, nodemask_t *nodemask)
 {
 	unsigned long nr_pages = 1UL << huge_page_order(h);
+	struct page *page;
+
+	/*
+	 * dax kmem onlines PMEM into ZONE_MOVABLE, where gigantic pages
+	 * are not allocated as they cannot be migrated. Take them from
+	 * there anyway on slow tier nodes when asked to, so the copy engines
+	 * get 1GB mappings of PMEM. Such a node can no longer be offlined
+	 * while they are allocated, hence off by default.
+	 */
+	if (READ_ONCE(sysctl_hugetlb_slow_tier_movable) &&
+	    node_is_slow_tier(nid) && !(gfp_mask & __GFP_MOVABLE)) {
+		page = alloc_contig_pages(nr_pages,
+				gfp_mask | __GFP_MOVABLE | __GFP_THISNODE,
+				nid, NULL);
+		if (page)
+			return page;
+	}
 
 	return alloc_contig_pages(nr_pages, gfp_mask, nid, nodemask);
 }
@@ -5073,3 +5094,32 @@ void move_hugetlb_state(struct page *oldpage, struct page *newpage, int reason)
 		spin_unlock(&hugetlb_lock);
 	}
 }
+
+/*
+ * Swap the hugetlb state of two in-use huge pages of the same hstate whose
+ * contents have been exchanged: each page takes over the subpool and the
+ * hugetlb cgroup charge of the other. Both pages stay in use on their
+ * nodes, so the per-node counts of the hstate do not change.
+ */
+void exchange_hugetlb_state(struct page *page1, struct page *page2)
+{
+	struct hugetlb_cgroup *h_cg1, *h_cg2;
+	unsigned long private;
+
+	VM_BUG_ON_PAGE(page_hstate(page1) != page_hstate(page2), page1);
+
+	/* page_private is the subpool pointer of hugetlb pages */
+	private = page_private(page1);
+	set_page_private(page1, page_private(page2));
+	set_page_private(page2, private);
+
+	if (hugetlb_cgroup_disabled())
+		return;
+
+	spin_lock(&hugetlb_lock);
+	h_cg1 = hugetlb_cgroup_from_page(page1);
+	h_cg2 = hugetlb_cgroup_from_page(page2);
+	set_hugetlb_cgroup(page1, h_cg2);
+	set_hugetlb_cgroup(page2, h_cg1);
+	spin_unlock(&hugetlb_lock);
+}
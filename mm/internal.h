@@ -11,6 +11,10 @@
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/tracepoint-defs.h>
+#include <linux/sched.h>
+#include <linux/sched/sysctl.h>
+#include <linux/migrate.h>
+#include <linux/mmu_notifier.h>
 
 /*
  * The set of flags that only affect watermark checking and reclaim
@@ -86,6 +90,7 @@ extern unsigned long highest_memmap_pfn;
  * in mm/vmscan.c:
  */
 extern int isolate_lru_page(struct page *page);
+extern void isolate_lru_pages_bulk(struct page **pages, int nr, int *status);
 extern void putback_lru_page(struct page *page);
 
 /*
@@ -185,6 +190,8 @@ struct compact_control {
 	struct list_head migratepages;	/* List of pages being migrated */
 	unsigned int nr_freepages;	/* Number of isolated free pages */
 	unsigned int nr_migratepages;	/* Number of pages to migrate */
+	unsigned int max_migratepages;	/* per cycle, 0 for COMPACT_CLUSTER_MAX */
+	unsigned int nr_blocks_scanned;	/* pageblocks of the last cycle */
 	unsigned long free_pfn;		/* isolate_freepages search base */
 	unsigned long migrate_pfn;	/* isolate_migratepages search base */
 	unsigned long fast_start_pfn;	/* a pfn to start linear scan from */
@@ -206,6 +213,7 @@ struct compact_control {
 	bool whole_zone;		/* Whole zone should/has been scanned */
 	bool contended;			/* Signal lock or sched contention */
 	bool rescan;			/* Rescanning the same pageblock */
+	bool proactive;			/* Proactive kcompactd, see kcompactd_proactive() */
 };
 
 /*
@@ -422,6 +430,10 @@ static inline struct page *mem_map_next(struct page *iter,
 	return iter + 1;
 }
 
+struct attribute_group;
+/* Create /sys/kernel/mm/@name holding @grp, see mm/mm_init.c */
+int mm_sysfs_add_group(const char *name, const struct attribute_group *grp);
+
 /* Memory initialisation debug and verification */
 enum mminit_level {
 	MMINIT_WARNING,
@@ -533,6 +545,7 @@ unsigned long reclaim_clean_pages_from_list(struct zone *zone,
 #define ALLOC_NOFRAGMENT	  0x0
 #endif
 #define ALLOC_KSWAPD		0x200 /* allow waking of kswapd */
+#define ALLOC_HEADROOM		0x400 /* may use the promotion headroom */
 
 enum ttu_flags;
 struct tlbflush_unmap_batch;
@@ -560,6 +573,45 @@ static inline void flush_tlb_batched_pending(struct mm_struct *mm)
 }
 #endif /* CONFIG_ARCH_WANT_BATCHED_UNMAP_TLB_FLUSH */
 
+#ifdef CONFIG_MMU_NOTIFIER
+/* mmu notifier ranges opened around the unmapping of a batch of pages */
+#define MMU_NOTIFY_BATCH_RANGES	8
+
+struct mmu_notify_batch {
+	int nr;
+	struct mmu_notifier_range ranges[MMU_NOTIFY_BATCH_RANGES];
+};
+
+static inline void mmu_notify_batch_init(struct mmu_notify_batch *nb)
+{
+	nb->nr = 0;
+}
+
+void mmu_notify_batch_add(struct mmu_notify_batch *nb, struct page *page);
+void mmu_notify_batch_start(struct mmu_notify_batch *nb);
+void mmu_notify_batch_end(struct mmu_notify_batch *nb);
+#else
+struct mmu_notify_batch {
+};
+
+static inline void mmu_notify_batch_init(struct mmu_notify_batch *nb)
+{
+}
+
+static inline void mmu_notify_batch_add(struct mmu_notify_batch *nb,
+		struct page *page)
+{
+}
+
+static inline void mmu_notify_batch_start(struct mmu_notify_batch *nb)
+{
+}
+
+static inline void mmu_notify_batch_end(struct mmu_notify_batch *nb)
+{
+}
+#endif /* CONFIG_MMU_NOTIFIER */
+
 extern const struct trace_print_flags pageflag_names[];
 extern const struct trace_print_flags vmaflag_names[];
 extern const struct trace_print_flags gfpflag_names[];
@@ -577,18 +629,293 @@ static inline bool is_migrate_highatomic_page(struct page *page)
 void setup_zone_pageset(struct zone *zone);
 extern struct page *alloc_new_node_page(struct page *page, unsigned long node);
 
+/* Bulk allocated migration target pages, see mm/migrate_target.c */
+#ifdef CONFIG_MIGRATION
+extern int sysctl_migrate_target_cache_pages;
+extern new_pages_bulk_t migrate_target_alloc_bulk;
+extern struct page *migrate_target_cache_get(int nid, int order);
+extern void migrate_target_cache_fill(int nid, int nr_base, int nr_thp);
+extern void migrate_target_cache_trim(int nid);
+#else
+static inline struct page *migrate_target_cache_get(int nid, int order)
+{
+	return NULL;
+}
+#endif
+
+/* Pre-zeroed THP pools, see mm/prezero_pool.c */
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+extern struct page *prezero_pool_get(int nid);
+#else
+static inline struct page *prezero_pool_get(int nid)
+{
+	return NULL;
+}
+#endif
+
+#ifdef CONFIG_MIGRATION
+/* THPs split because they could not be migrated whole, per migrate_reason */
+extern atomic_long_t thp_migration_splits[MR_TYPES];
+
+static inline void count_thp_migration_split(int reason)
+{
+	atomic_long_inc(&thp_migration_splits[reason]);
+}
+#endif
+
+#ifdef CONFIG_MIGRATION
+/* Slow tier shadows of promoted pages, see mm/migrate_shadow.c */
+extern bool migrate_shadow_candidate(struct page *newpage, struct page *page,
+		enum migrate_reason reason);
+extern void migrate_shadow_keep(struct page *newpage, struct page *page);
+extern struct page *migrate_shadow_take(struct page *page, int nid);
+extern bool migrate_shadow_hit(struct page *newpage, struct page *page);
+#endif
+
+/* Reclaimable slab caches on the slow tier, see mm/slub.c */
+#if defined(CONFIG_SLUB) && defined(CONFIG_NUMA)
+extern bool slab_tier_shrink_first(int nid);
+#else
+static inline bool slab_tier_shrink_first(int nid)
+{
+	return false;
+}
+#endif
+
+/* Page cache on the slow tier, see mm/page_cache_tier.c */
+#ifdef CONFIG_NUMA
+extern int page_cache_tier_node(struct address_space *mapping, bool readahead);
+#endif
+#if defined(CONFIG_NUMA) && defined(CONFIG_MIGRATION)
+extern void page_cache_tier_accessed(struct page *page);
+#else
+static inline void page_cache_tier_accessed(struct page *page)
+{
+}
+#endif
+
+/* Initial tier placement by the history of a region, see mm/tier_site.c */
+#ifdef CONFIG_NUMA
+extern int sysctl_cold_site_ratio;
+extern int tier_site_fault_node(struct vm_area_struct *vma);
+extern void tier_site_demoted(struct page *page);
+extern void tier_site_promoted(struct page *page);
+#else
+static inline int tier_site_fault_node(struct vm_area_struct *vma)
+{
+	return NUMA_NO_NODE;
+}
+
+static inline void tier_site_demoted(struct page *page)
+{
+}
+
+static inline void tier_site_promoted(struct page *page)
+{
+}
+#endif
+
+/* Region based access monitoring, see mm/access_region.c */
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+extern void access_regions_scan(struct mm_struct *mm, u8 pass, int max);
+extern void page_access_stamp(struct page *page, int freq, u8 pass);
+/* MADV_PROMOTE and MADV_DEMOTE of the pages of @mm, see mm/madvise.c */
+extern int madvise_tier(struct task_struct *task, struct mm_struct *mm,
+		unsigned long start, unsigned long end, int behavior, int flags);
+#endif
+
+/* Split promotion of partially hot THPs, see mm/memory_manage.c */
+extern int sysctl_thp_split_promote_ratio;
+
+/* Migration bandwidth limits, see mm/migrate_rate.c */
+extern unsigned long sysctl_migrate_rate_limit;
+extern u64 migrate_rate_charge(struct page *page, int dst_nid,
+		enum migrate_reason reason, enum migrate_mode mode);
+extern void migrate_rate_throttle(u64 wait, enum migrate_mode mode);
+/* Closed loop migration bandwidth limits, see mm/migrate_bandwidth.c */
+extern int sysctl_migrate_bandwidth_headroom;
+extern u64 migrate_bandwidth_charge(int src_nid, int dst_nid, u64 bytes);
+
+/*
+ * Whether an isolated page holds references beyond the isolation, one per
+ * mapping, the page cache's and that of its buffers: pinned by GUP or held
+ * by someone for a while, so moving its mapping would fail once it is
+ * unmapped. A cheap check, without the page lock, for the batch paths to
+ * leave such pages alone before unmapping them. KSM and non-LRU movable
+ * pages have references of their own and are never reported.
+ */
+static inline bool isolated_page_pinned(struct page *page)
+{
+	int expected = 1 + total_mapcount(page);
+
+	if (unlikely(__PageMovable(page)) || PageKsm(page))
+		return false;
+	if (page_mapping(page))
+		expected += hpage_nr_pages(page);
+	if (page_has_private(page))
+		expected++;
+
+	return page_count(page) > expected;
+}
+
 extern int copy_page_lists_dma_always(struct page **to,
 			struct page **from, int nr_pages);
 extern int copy_page_lists_mt(struct page **to,
 			struct page **from, int nr_pages);
+
+/*
+ * Copy configuration picked by boot time calibration for a (source node,
+ * destination node, page size) triple, see mm/copy_calibrate.c.
+ */
+enum copy_engine_kind {
+	COPY_ENGINE_ST,		/* copy_highpage() on the calling CPU */
+	COPY_ENGINE_MT,		/* copy_page_lists_mt() */
+	COPY_ENGINE_DMA,	/* copy_page_lists_dma_always() */
+	NR_COPY_ENGINE_KINDS,
+};
+
+struct copy_decision {
+	u8 engine;		/* enum copy_engine_kind */
+	u8 nt;			/* MT only: non-temporal accesses */
+	u8 rpdaa;		/* MT only: workers local to the PMEM side */
+	u8 valid;
+	u32 mbps;		/* measured throughput */
+};
+
+extern int sysctl_copy_engine_auto;
+extern bool copy_decision_lookup(int from_nid, int to_nid, bool huge,
+			struct copy_decision *decision);
+extern int copy_page_lists_mt_config(struct page **to, struct page **from,
+			int nr_pages, const struct copy_decision *cfg);
+
+extern int copy_page_rpdaa_node(int from_node, int to_node);
+extern bool migrate_concur_offload(int nid, int nr_pages,
+			int (*fn)(void *arg), void *arg, int *rc);
+struct kthread_worker;
+extern struct kthread_worker *kmigrated_worker(int nid);
+extern int copy_page_socket_local(struct page *to, struct page *from,
+			int nr_pages,
+			void (*fn)(struct page *to, struct page *from, int nr_pages));
+extern void copy_highpages(struct page *to, struct page *from, int nr_pages);
+extern bool clear_huge_page_nt(struct page *page, unsigned long addr_hint,
+			unsigned int pages_per_huge_page);
+extern void clear_pages_nt(struct page *page, unsigned int nr_pages);
+extern bool copy_user_huge_page_mt(struct page *dst, struct page *src,
+			unsigned long addr_hint, struct vm_area_struct *vma,
+			unsigned int pages_per_huge_page);
+
+/*
+ * Copy policy of the migration run by the current task: what the syscall
+ * flags or the memcg asked for, else the sysctl defaults.
+ */
+extern unsigned int limit_mt_num;
+extern int page_copy_policy_enter(struct mm_struct *mm, int flags,
+			struct page_copy_policy *saved);
+extern void page_copy_policy_exit(const struct page_copy_policy *saved);
+
+static inline bool page_copy_use_nt(void)
+{
+	int nt = READ_ONCE(current->page_copy_policy.nt);
+
+	return nt >= 0 ? nt : READ_ONCE(sysctl_enable_nt_page_copy) == 1;
+}
+
+static inline bool page_copy_use_rpdaa(void)
+{
+	int rpdaa = READ_ONCE(current->page_copy_policy.rpdaa);
+
+	return rpdaa >= 0 ? rpdaa :
+		READ_ONCE(sysctl_enable_page_migration_optimization_avoid_remote_pmem_write);
+}
+
+static inline unsigned int page_copy_nr_threads(void)
+{
+	int nr = READ_ONCE(current->page_copy_policy.nr_threads);
+
+	return nr > 0 ? min(nr, MAX_NR_COPY_THREADS) : READ_ONCE(limit_mt_num);
+}
+
+/* Asynchronous page list copies, see copy_page_lists_submit() */
+struct copy_page_handle;
+extern struct copy_page_handle *copy_page_lists_submit(struct page **to,
+			struct page **from, int nr_pages, enum migrate_mode mode);
+extern bool copy_page_lists_poll(struct copy_page_handle *handle);
+extern int copy_page_lists_wait(struct copy_page_handle *handle);
 extern int exchange_page_mthread(struct page *to, struct page *from,
 			int nr_pages);
 extern int exchange_page_lists_mthread(struct page **to,
 						  struct page **from,
 						  int nr_pages);
+extern int exchange_page_lists_dma(struct page **to, struct page **from,
+			int nr_pages, unsigned long *done);
 
 extern int exchange_two_pages(struct page *page1, struct page *page2);
 
+/*
+ * Page copy engines, see mm/copy_engine.c. Used by the non-temporal page
+ * copy and exchange paths, always between kernel_fpu_begin()/end().
+ */
+enum page_copy_engine_id {
+	PAGE_COPY_ENGINE_GENERIC,
+	PAGE_COPY_ENGINE_REP_MOVSB,
+	PAGE_COPY_ENGINE_AVX2_NT,
+	PAGE_COPY_ENGINE_AVX512_NT,
+	PAGE_COPY_ENGINE_MOVDIR64B,
+	NR_PAGE_COPY_ENGINES,
+};
+
+/* Which side of a copy uses non-temporal accesses, see nt_page_copy_policy */
+enum page_copy_nt_mode {
+	PAGE_COPY_NT_NONE = 0,
+	PAGE_COPY_NT_LOAD = 1,
+	PAGE_COPY_NT_STORE = 2,
+	PAGE_COPY_NT_BOTH = PAGE_COPY_NT_LOAD | PAGE_COPY_NT_STORE,
+};
+
+struct page_copy_engine {
+	const char *name;
+	bool (*usable)(void);
+	/*
+	 * @nt_mode is never PAGE_COPY_NT_NONE, engines may ignore it. The
+	 * kernels prefetch @prefetch bytes ahead of the loads, 0 for none.
+	 */
+	void (*copy)(char *to, char *from, unsigned long size, int nt_mode,
+			unsigned int prefetch);
+	/* non-temporal exchange */
+	void (*exchange)(char *to, char *from, unsigned long size,
+			unsigned int prefetch);
+	/* cache-blocked exchange through a bounce buffer */
+	void (*exchange_cached)(char *to, char *from, unsigned long size);
+	/* zeroing, with streaming stores if the engine has them */
+	void (*clear)(char *to, unsigned long size);
+};
+
+extern const struct page_copy_engine page_copy_engines[NR_PAGE_COPY_ENGINES];
+extern int sysctl_page_copy_engine;
+
+static inline const struct page_copy_engine *current_page_copy_engine(void)
+{
+	return &page_copy_engines[READ_ONCE(sysctl_page_copy_engine)];
+}
+
+extern int page_copy_nt_mode(int from_nid, int to_nid);
+extern bool page_exchange_use_nt(int nid1, int nid2, unsigned long page_size);
+extern void page_exchange(char *to, char *from, unsigned long size, bool nt,
+		unsigned int prefetch);
+extern unsigned int page_copy_prefetch(int nid);
+
+/* Prefetch distance of an exchange, the one of the slower of the nodes */
+static inline unsigned int page_exchange_prefetch(int nid1, int nid2)
+{
+	return max(page_copy_prefetch(nid1), page_copy_prefetch(nid2));
+}
+
+/*
+ * Bytes the copy and exchange workers move per kernel_fpu_begin() section,
+ * rescheduling in between, which bounds how long preemption stays off.
+ */
+#define PAGE_COPY_FPU_SECTION	(32UL << 10)
+
 bool buffer_migrate_lock_buffers(struct buffer_head *head,
 							enum migrate_mode mode);
 int writeout(struct address_space *mapping, struct page *page);
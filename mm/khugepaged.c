@@ -18,6 +18,8 @@
 #include <linux/page_idle.h>
 #include <linux/swapops.h>
 #include <linux/shmem_fs.h>
+#include <linux/access_scan.h>
+#include <linux/memory_tier.h>
 
 #include <asm/tlb.h>
 #include <asm/pgalloc.h>
@@ -49,6 +51,7 @@ enum scan_result {
 	SCAN_EXCEED_SWAP_PTE,
 	SCAN_TRUNCATED,
 	SCAN_PAGE_HAS_PRIVATE,
+	SCAN_PTE_MAPPED_THP,
 };
 
 #define CREATE_TRACE_POINTS
@@ -643,19 +646,97 @@ static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
 	return 0;
 }
 
+// Copy the subpages of a collapse with the multi-threaded copy workers
+int sysctl_khugepaged_mt_copy = 1;
+
+struct collapse_copy_args {
+	struct page **src;		/* NULL for none or zero ptes */
+	struct page *page;
+	struct vm_area_struct *vma;
+	unsigned long address;
+};
+
+static void collapse_copy_range(void *arg, int start, int end)
+{
+	struct collapse_copy_args *args = arg;
+	unsigned long address;
+	int i;
+
+	for (i = start; i < end; i++) {
+		address = args->address + i * PAGE_SIZE;
+		if (args->src[i])
+			copy_user_highpage(args->page + i, args->src[i],
+					   address, args->vma);
+		else
+			clear_user_highpage(args->page + i, address);
+	}
+}
+
+/*
+ * Fill the new huge page with the copy workers, of the socket local to the
+ * PMEM side with RPDAA, so that mmap_sem is held for write a fraction of
+ * the time a copy on this CPU takes. Returns false if the copy is left to
+ * the caller.
+ */
+static bool collapse_copy_mt(pte_t *pte, struct page *page,
+			     struct vm_area_struct *vma, unsigned long address)
+{
+	struct collapse_copy_args args;
+	int from_nid = NUMA_NO_NODE;
+	int i, nid;
+
+	if (!READ_ONCE(sysctl_khugepaged_mt_copy) ||
+	    page_copy_nr_threads() <= 1)
+		return false;
+
+	args.src = kmalloc_array(HPAGE_PMD_NR, sizeof(*args.src),
+				 GFP_KERNEL | __GFP_NOWARN);
+	if (!args.src)
+		return false;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		pte_t pteval = pte[i];
+
+		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
+			args.src[i] = NULL;
+			continue;
+		}
+		args.src[i] = pte_page(pteval);
+		if (from_nid == NUMA_NO_NODE)
+			from_nid = page_to_nid(args.src[i]);
+	}
+
+	if (from_nid == NUMA_NO_NODE)
+		from_nid = page_to_nid(page);
+	nid = page_copy_use_rpdaa() ?
+		copy_page_rpdaa_node(from_nid, page_to_nid(page)) :
+		numa_node_id();
+
+	args.page = page;
+	args.vma = vma;
+	args.address = address;
+	copy_page_run_ranges(nid, HPAGE_PMD_NR, collapse_copy_range, &args);
+	kfree(args.src);
+
+	return true;
+}
+
 static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
 				      struct vm_area_struct *vma,
 				      unsigned long address,
 				      spinlock_t *ptl)
 {
+	bool copied = collapse_copy_mt(pte, page, vma, address);
 	pte_t *_pte;
+
 	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
 				_pte++, page++, address += PAGE_SIZE) {
 		pte_t pteval = *_pte;
 		struct page *src_page;
 
 		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
-			clear_user_highpage(page, address);
+			if (!copied)
+				clear_user_highpage(page, address);
 			add_mm_counter(vma->vm_mm, MM_ANONPAGES, 1);
 			if (is_zero_pfn(pte_pfn(pteval))) {
 				/*
@@ -671,7 +752,8 @@ static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
 			}
 		} else {
 			src_page = pte_page(pteval);
-			copy_user_highpage(page, src_page, address, vma);
+			if (!copied)
+				copy_user_highpage(page, src_page, address, vma);
 			VM_BUG_ON_PAGE(page_mapcount(src_page) != 1, src_page);
 			release_pte_page(src_page);
 			/*
@@ -703,6 +785,61 @@ static void khugepaged_alloc_sleep(void)
 }
 
 static int khugepaged_node_load[MAX_NUMNODES];
+/* subpages of the scanned range the tiering hotness data knows as hot/cold */
+static int khugepaged_nr_hot;
+static int khugepaged_nr_cold;
+/* hot subpages of the scanned range on a fast tier node */
+static int khugepaged_nr_hot_fast;
+
+// Collapse hot ranges into the fast tier and cold ones into the slow tier
+int sysctl_khugepaged_tier_aware = 1;
+
+static void khugepaged_scan_reset(void)
+{
+	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	khugepaged_nr_hot = 0;
+	khugepaged_nr_cold = 0;
+	khugepaged_nr_hot_fast = 0;
+}
+
+/*
+ * Count @page of the scanned range on its node and, if the accessed bit
+ * scanner or the load sampling has seen it, as hot or cold.
+ */
+static void khugepaged_account_page(struct page *page, int node)
+{
+	int freq;
+
+	khugepaged_node_load[node]++;
+
+	if (access_sample_enabled() && page_access_sampled_hot(page)) {
+		freq = access_scan_hot_threshold();
+	} else {
+		freq = access_scan_enabled() ? page_access_frequency(page) : -1;
+		if (freq < 0)
+			return;
+	}
+
+	if (freq >= access_scan_hot_threshold()) {
+		khugepaged_nr_hot++;
+		if (!node_is_slow_tier(node))
+			khugepaged_nr_hot_fast++;
+	} else {
+		khugepaged_nr_cold++;
+	}
+}
+
+/*
+ * Whether to leave the scanned range alone rather than collapse it on
+ * @nid: a range whose hot subpages a split promotion moved to a fast tier
+ * node, see vm.thp_split_promote_ratio, is collapsed again on the slow
+ * tier once they are cold, not pulled back while they are hot.
+ */
+static bool khugepaged_keep_split(int nid)
+{
+	return READ_ONCE(sysctl_thp_split_promote_ratio) &&
+		node_is_slow_tier(nid) && khugepaged_nr_hot_fast;
+}
 
 static bool khugepaged_scan_abort(int nid)
 {
@@ -735,7 +872,37 @@ static inline gfp_t alloc_hugepage_khugepaged_gfpmask(void)
 }
 
 #ifdef CONFIG_NUMA
-static int khugepaged_find_target_node(void)
+/*
+ * The node of the tier the scanned range belongs in, if the node with most
+ * of its subpages, @nid, is not: a range mostly hot is collapsed into the
+ * nearest fast tier node and a range without a hot subpage into the
+ * nearest slow tier node, which saves migrating the huge page later.
+ * Ranges the hotness data knows nothing about stay on @nid.
+ */
+static int khugepaged_tier_node(struct mm_struct *mm, int nid)
+{
+	int known = khugepaged_nr_hot + khugepaged_nr_cold;
+	int target = NUMA_NO_NODE;
+	struct mem_cgroup *memcg;
+
+	if (!READ_ONCE(sysctl_khugepaged_tier_aware) || !known)
+		return nid;
+
+	if (node_is_slow_tier(nid)) {
+		if (khugepaged_nr_hot * 2 > known)
+			target = node_promotion_target(nid);
+	} else if (!khugepaged_nr_hot) {
+		/* unless the floor of the memcg of @mm keeps the range */
+		memcg = get_mem_cgroup_from_mm(mm);
+		if (mem_cgroup_node_demotable(memcg, nid, true) >= HPAGE_PMD_NR)
+			target = node_demotion_target(nid);
+		mem_cgroup_put(memcg);
+	}
+
+	return target == NUMA_NO_NODE ? nid : target;
+}
+
+static int khugepaged_find_target_node(struct mm_struct *mm)
 {
 	static int last_khugepaged_target_node = NUMA_NO_NODE;
 	int nid, target_node = 0, max_value = 0;
@@ -757,7 +924,7 @@ static int khugepaged_find_target_node(void)
 			}
 
 	last_khugepaged_target_node = target_node;
-	return target_node;
+	return khugepaged_tier_node(mm, target_node);
 }
 
 static bool khugepaged_prealloc_page(struct page **hpage, bool *wait)
@@ -794,7 +961,7 @@ khugepaged_alloc_page(struct page **hpage, gfp_t gfp, int node)
 	return *hpage;
 }
 #else
-static int khugepaged_find_target_node(void)
+static int khugepaged_find_target_node(struct mm_struct *mm)
 {
 	return 0;
 }
@@ -961,8 +1128,9 @@ static void collapse_huge_page(struct mm_struct *mm,
 
 	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
 
-	/* Only allocate from the target node */
-	gfp = alloc_hugepage_khugepaged_gfpmask() | __GFP_THISNODE;
+	/* Only allocate from the target node, with the node's defrag policy */
+	gfp = thp_node_defrag_gfpmask(node, alloc_hugepage_khugepaged_gfpmask()) |
+		__GFP_THISNODE;
 
 	/*
 	 * Before allocating the hugepage, release the mmap_sem read lock.
@@ -1112,6 +1280,182 @@ static void collapse_huge_page(struct mm_struct *mm,
 	goto out_up_write;
 }
 
+/*
+ * Map the THP that the PTEs at @address map whole, in order, with a PMD
+ * again, undoing the split_huge_pmd() of the accessed bit scanner, see
+ * vm.access_scan_thp_subpages. The THP is not copied: its PTE table is
+ * withdrawn under the same locks as for a collapse and deposited for the
+ * PMD. Called with the mmap_sem read locked, returns with it released.
+ */
+static void remap_pte_mapped_thp(struct mm_struct *mm, unsigned long address)
+{
+	bool write = true, young = false, soft_dirty = false;
+	struct mmu_notifier_range range;
+	spinlock_t *pmd_ptl, *pte_ptl;
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+	pmd_t *pmd, _pmd;
+	pgtable_t pgtable;
+	pte_t *pte;
+	int i, result;
+
+	up_read(&mm->mmap_sem);
+	down_write(&mm->mmap_sem);
+	result = SCAN_ANY_PROCESS;
+	if (!mmget_still_valid(mm))
+		goto out;
+	result = hugepage_vma_revalidate(mm, address, &vma);
+	if (result)
+		goto out;
+	result = SCAN_VMA_CHECK;
+	if (!vma->anon_vma || (vma->vm_flags & VM_LOCKED))
+		goto out;
+	result = SCAN_PMD_NULL;
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd)
+		goto out;
+
+	result = SCAN_PAGE_NULL;
+	pte = pte_offset_map_lock(mm, pmd, address, &pte_ptl);
+	if (pte_present(*pte)) {
+		page = vm_normal_page(vma, address, *pte);
+		if (page && PageAnon(page) && PageTransHuge(page) &&
+		    !PageKsm(page))
+			get_page(page);
+		else
+			page = NULL;
+	}
+	pte_unmap_unlock(pte, pte_ptl);
+	if (!page)
+		goto out;
+
+	/* the page lock keeps split_huge_page() and migration away */
+	result = SCAN_PAGE_LOCK;
+	if (!trylock_page(page))
+		goto out_put;
+
+	/* only mapped here, by the PTEs of this range */
+	result = SCAN_PAGE_COUNT;
+	if (PageSwapCache(page) || PageDoubleMap(page) ||
+	    compound_mapcount(page) ||
+	    total_mapcount(page) != HPAGE_PMD_NR)
+		goto out_unlock;
+
+	anon_vma_lock_write(vma->anon_vma);
+
+	mmu_notifier_range_init(&range, MMU_NOTIFY_CLEAR, 0, NULL, mm,
+				address, address + HPAGE_PMD_SIZE);
+	mmu_notifier_invalidate_range_start(&range);
+
+	pte = pte_offset_map(pmd, address);
+	pte_ptl = pte_lockptr(mm, pmd);
+
+	pmd_ptl = pmd_lock(mm, pmd);
+	_pmd = pmdp_collapse_flush(vma, address, pmd);
+	spin_unlock(pmd_ptl);
+	mmu_notifier_invalidate_range_end(&range);
+
+	spin_lock(pte_ptl);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		pte_t pteval = pte[i];
+
+		if (!pte_present(pteval) ||
+		    pte_pfn(pteval) != page_to_pfn(page) + i)
+			break;
+		write &= pte_write(pteval);
+		young |= pte_young(pteval);
+		soft_dirty |= pte_soft_dirty(pteval);
+	}
+
+	if (i < HPAGE_PMD_NR) {
+		spin_unlock(pte_ptl);
+		pte_unmap(pte);
+		spin_lock(pmd_ptl);
+		BUG_ON(!pmd_none(*pmd));
+		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
+		spin_unlock(pmd_ptl);
+		anon_vma_unlock_write(vma->anon_vma);
+		result = SCAN_FAIL;
+		goto out_unlock;
+	}
+
+	/*
+	 * The reverse of the mapcount and refcount changes of
+	 * __split_huge_pmd_locked(): the PMD holds a single reference.
+	 */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		pte_clear(mm, address + i * PAGE_SIZE, pte + i);
+		atomic_dec(&page[i]._mapcount);
+	}
+	atomic_inc(compound_mapcount_ptr(page));
+	page_ref_sub(page, HPAGE_PMD_NR - 1);
+	__inc_node_page_state(page, NR_ANON_THPS);
+	spin_unlock(pte_ptl);
+	pte_unmap(pte);
+
+	pgtable = pmd_pgtable(_pmd);
+	_pmd = pmd_mkdirty(mk_huge_pmd(page, vma->vm_page_prot));
+	if (write)
+		_pmd = maybe_pmd_mkwrite(_pmd, vma);
+	if (young)
+		_pmd = pmd_mkyoung(_pmd);
+	if (soft_dirty)
+		_pmd = pmd_mksoft_dirty(_pmd);
+
+	spin_lock(pmd_ptl);
+	BUG_ON(!pmd_none(*pmd));
+	pgtable_trans_huge_deposit(mm, pmd, pgtable);
+	set_pmd_at(mm, address, pmd, _pmd);
+	update_mmu_cache_pmd(vma, address, pmd);
+	spin_unlock(pmd_ptl);
+	anon_vma_unlock_write(vma->anon_vma);
+
+	count_vm_event(THP_REMAP_PMD);
+	result = SCAN_SUCCEED;
+out_unlock:
+	unlock_page(page);
+out_put:
+	put_page(page);
+out:
+	up_write(&mm->mmap_sem);
+	trace_mm_collapse_huge_page(mm, result == SCAN_SUCCEED, result);
+}
+
+/*
+ * Collapse the range of @mm at @address into a new THP on @nid, for a
+ * promotion that found most of its base pages hot, see
+ * vm.thp_promote_collapse_ratio. The collapse copies them once, with the
+ * copy workers, instead of a migration of each and a collapse later.
+ * Returns 0 if the range was collapsed.
+ */
+int khugepaged_collapse_to_node(struct mm_struct *mm, unsigned long address,
+		int nid)
+{
+#ifdef CONFIG_NUMA
+	struct vm_area_struct *vma;
+	struct page *hpage = NULL;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	down_read(&mm->mmap_sem);
+	if (hugepage_vma_revalidate(mm, address, &vma) || !vma->anon_vma) {
+		up_read(&mm->mmap_sem);
+		return -EINVAL;
+	}
+
+	/* every page of the range counts as referenced, it was found hot */
+	collapse_huge_page(mm, address, &hpage, nid, HPAGE_PMD_NR);
+	if (IS_ERR_OR_NULL(hpage))
+		return PTR_ERR_OR_ZERO(hpage);
+
+	put_page(hpage);
+	return -EAGAIN;
+#else
+	/* the collapses of a single node are khugepaged's */
+	return -EINVAL;
+#endif
+}
+
 static int khugepaged_scan_pmd(struct mm_struct *mm,
 			       struct vm_area_struct *vma,
 			       unsigned long address,
@@ -1134,7 +1478,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 		goto out;
 	}
 
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	khugepaged_scan_reset();
 	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
 	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
 	     _pte++, _address += PAGE_SIZE) {
@@ -1169,9 +1513,17 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			goto out_unmap;
 		}
 
-		/* TODO: teach khugepaged to collapse THP mapped with pte */
+		/*
+		 * TODO: teach khugepaged to collapse THP mapped with pte. A
+		 * THP the PTEs of the range map whole gets its PMD back,
+		 * unless the accessed bit scanner still samples its subpages.
+		 */
 		if (PageCompound(page)) {
-			result = SCAN_PAGE_COMPOUND;
+			if (_address == address && PageTransHuge(page) &&
+			    PageAnon(page) && !access_scan_thp_sampling(page))
+				result = SCAN_PTE_MAPPED_THP;
+			else
+				result = SCAN_PAGE_COMPOUND;
 			goto out_unmap;
 		}
 
@@ -1186,7 +1538,7 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 			result = SCAN_SCAN_ABORT;
 			goto out_unmap;
 		}
-		khugepaged_node_load[node]++;
+		khugepaged_account_page(page, node);
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
 			goto out_unmap;
@@ -1227,9 +1579,19 @@ static int khugepaged_scan_pmd(struct mm_struct *mm,
 out_unmap:
 	pte_unmap_unlock(pte, ptl);
 	if (ret) {
-		node = khugepaged_find_target_node();
-		/* collapse_huge_page will return with the mmap_sem released */
-		collapse_huge_page(mm, address, hpage, node, referenced);
+		node = khugepaged_find_target_node(mm);
+		if (khugepaged_keep_split(node) ||
+		    !thp_node_vma_allowed(node, vma)) {
+			result = SCAN_SCAN_ABORT;
+			ret = 0;
+		} else {
+			/* collapse_huge_page will return with the mmap_sem released */
+			collapse_huge_page(mm, address, hpage, node, referenced);
+		}
+	} else if (result == SCAN_PTE_MAPPED_THP) {
+		/* remap_pte_mapped_thp will return with the mmap_sem released */
+		remap_pte_mapped_thp(mm, address);
+		ret = 1;
 	}
 out:
 	trace_mm_khugepaged_scan_pmd(mm, page, writable, referenced,
@@ -1841,7 +2203,7 @@ static void khugepaged_scan_file(struct mm_struct *mm,
 
 	present = 0;
 	swap = 0;
-	memset(khugepaged_node_load, 0, sizeof(khugepaged_node_load));
+	khugepaged_scan_reset();
 	rcu_read_lock();
 	xas_for_each(&xas, page, start + HPAGE_PMD_NR - 1) {
 		if (xas_retry(&xas, page))
@@ -1865,7 +2227,7 @@ static void khugepaged_scan_file(struct mm_struct *mm,
 			result = SCAN_SCAN_ABORT;
 			break;
 		}
-		khugepaged_node_load[node]++;
+		khugepaged_account_page(page, node);
 
 		if (!PageLRU(page)) {
 			result = SCAN_PAGE_LRU;
@@ -1897,7 +2259,7 @@ static void khugepaged_scan_file(struct mm_struct *mm,
 		if (present < HPAGE_PMD_NR - khugepaged_max_ptes_none) {
 			result = SCAN_EXCEED_NONE_PTE;
 		} else {
-			node = khugepaged_find_target_node();
+			node = khugepaged_find_target_node(mm);
 			collapse_file(mm, file, start, hpage, node);
 		}
 	}
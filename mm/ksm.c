@@ -38,6 +38,8 @@
 #include <linux/freezer.h>
 #include <linux/oom.h>
 #include <linux/numa.h>
+#include <linux/memory_tier.h>
+#include <linux/access_scan.h>
 
 #include <asm/tlbflush.h>
 #include "internal.h"
@@ -278,6 +280,15 @@ static unsigned int zero_checksum __read_mostly;
 /* Whether to merge empty (zeroed) pages with actual zero pages */
 static bool ksm_use_zero_pages __read_mostly;
 
+/* Whether ksmd passes over the hot pages of the fast tier nodes */
+static bool ksm_tier_scan __read_mostly;
+
+/* The number of fast tier hot pages passed over by the tier scan */
+static unsigned long ksm_pages_tier_skipped;
+
+/* Pages a batch of the tier scan may pass over per page it scans */
+#define KSM_TIER_SKIP_RATIO	8
+
 #ifdef CONFIG_NUMA
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
@@ -2372,21 +2383,57 @@ static struct rmap_item *scan_get_next_rmap_item(struct page **page)
 	return NULL;
 }
 
+/*
+ * Whether the tier scan passes over @page: a page of a fast tier node that
+ * the access samples or the accessed bit scanner, or else the LRU, take for
+ * hot. Merging it would only add COW faults to DRAM that is in use, the
+ * pages worth merging are the cold ones and those demoted to a slow tier.
+ */
+static bool ksm_tier_skip(struct page *page)
+{
+	int freq;
+
+	if (PageKsm(page) || node_is_slow_tier(page_to_nid(page)))
+		return false;
+
+	if (access_sample_enabled() && page_access_sampled_hot(page))
+		return true;
+
+	freq = access_scan_enabled() ? page_access_frequency(page) : -1;
+	if (freq < 0)
+		return PageActive(page);
+
+	return freq >= access_scan_hot_threshold();
+}
+
 /**
  * ksm_do_scan  - the ksm scanner main worker function.
  * @scan_npages:  number of pages we want to scan before we return.
+ *
+ * With tier_scan set, the hot pages of the fast tier nodes are passed
+ * over, up to KSM_TIER_SKIP_RATIO of them per page scanned, and do not
+ * count in @scan_npages: the batch goes on to the next cold pages.
  */
 static void ksm_do_scan(unsigned int scan_npages)
 {
+	unsigned int skip_npages = scan_npages * KSM_TIER_SKIP_RATIO;
 	struct rmap_item *rmap_item;
 	struct page *uninitialized_var(page);
 
-	while (scan_npages-- && likely(!freezing(current))) {
+	while (scan_npages && likely(!freezing(current))) {
 		cond_resched();
 		rmap_item = scan_get_next_rmap_item(&page);
 		if (!rmap_item)
 			return;
-		cmp_and_merge_page(page, rmap_item);
+		if (ksm_tier_scan && skip_npages && ksm_tier_skip(page)) {
+			/* drop it from the trees as a changed page would be */
+			remove_rmap_item_from_tree(rmap_item);
+			ksm_pages_tier_skipped++;
+			skip_npages--;
+		} else {
+			cmp_and_merge_page(page, rmap_item);
+			scan_npages--;
+		}
 		put_page(page);
 	}
 }
@@ -3053,6 +3100,28 @@ static ssize_t use_zero_pages_store(struct kobject *kobj,
 }
 KSM_ATTR(use_zero_pages);
 
+static ssize_t tier_scan_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_tier_scan);
+}
+static ssize_t tier_scan_store(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	int err;
+	bool value;
+
+	err = kstrtobool(buf, &value);
+	if (err)
+		return -EINVAL;
+
+	ksm_tier_scan = value;
+
+	return count;
+}
+KSM_ATTR(tier_scan);
+
 static ssize_t max_page_sharing_show(struct kobject *kobj,
 				     struct kobj_attribute *attr, char *buf)
 {
@@ -3179,6 +3248,13 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_tier_skipped_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_tier_skipped);
+}
+KSM_ATTR_RO(pages_tier_skipped);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -3196,6 +3272,8 @@ static struct attribute *ksm_attrs[] = {
 	&stable_node_dups_attr.attr,
 	&stable_node_chains_prune_millisecs_attr.attr,
 	&use_zero_pages_attr.attr,
+	&tier_scan_attr.attr,
+	&pages_tier_skipped_attr.attr,
 	NULL,
 };
 
@@ -27,6 +27,14 @@
 #include <linux/swapops.h>
 #include <linux/shmem_fs.h>
 #include <linux/mmu_notifier.h>
+#include <linux/mm_inline.h>
+#include <linux/migrate.h>
+#include <linux/memory_tier.h>
+#include <linux/access_scan.h>
+#include <linux/cpuset.h>
+#include <linux/ptrace.h>
+#include <linux/security.h>
+#include <linux/sched/mm.h>
 
 #include <asm/tlb.h>
 
@@ -924,6 +932,210 @@ static int madvise_inject_error(int behavior,
 }
 #endif
 
+#ifdef CONFIG_MIGRATION
+/*
+ * MADV_PROMOTE and MADV_DEMOTE move the pages of a range to the fast or
+ * the slow tier node of the socket the task runs on. The range is walked
+ * a batch at a time, the pages of a batch isolated in one pass over the
+ * page tables and migrated together, with the multi-threaded concurrent
+ * copy unless the caller of process_madvise() asks for another one.
+ * When the address space is monitored by regions, MADV_DEMOTE leaves the
+ * pages of hot regions where they are and MADV_PROMOTE those of regions
+ * seen idle.
+ */
+
+/* base pages isolated per migration batch */
+#define MADV_TIER_BATCH		4096
+#define MADV_TIER_MOVE_FLAGS	(MPOL_MF_MOVE_MT | MPOL_MF_MOVE_CONCUR | \
+				 MPOL_MF_MOVE_DMA)
+
+struct madvise_tier_private {
+	struct list_head pages;
+	unsigned long nr_pages;
+	unsigned long next;	/* where the walk stopped on a full batch */
+	int nid;
+	bool demote;
+	/* floors of the memcgs, with the pages of the batch counted */
+	struct mem_cgroup_demotion_batch floor;
+	/* access frequency of the monitored region up to region_end */
+	unsigned long region_end;
+	int region_freq;
+};
+
+/* Whether the access frequency of the region of @addr keeps it in place */
+static bool madvise_tier_skip(struct mm_struct *mm, unsigned long addr,
+		struct madvise_tier_private *mt)
+{
+	if (addr >= mt->region_end)
+		mt->region_freq = access_region_frequency(mm, addr,
+							  &mt->region_end);
+	if (mt->region_freq < 0)
+		return false;
+
+	if (mt->demote)
+		return mt->region_freq >= access_scan_hot_threshold();
+	return !mt->region_freq;
+}
+
+static void madvise_tier_isolate(struct page *page,
+		struct madvise_tier_private *mt)
+{
+	struct page *head = compound_head(page);
+
+	/* pages on the target node and pages shared with others stay */
+	if (page_to_nid(head) == mt->nid || page_mapcount(head) != 1)
+		return;
+	/* and so do the pages the floors of their memcg protect */
+	if (mt->demote && mem_cgroup_demotion_batch_protected(&mt->floor, head))
+		return;
+	if (isolate_lru_page(head))
+		return;
+
+	list_add_tail(&head->lru, &mt->pages);
+	mod_node_page_state(page_pgdat(head),
+			NR_ISOLATED_ANON + page_is_file_cache(head),
+			hpage_nr_pages(head));
+	mt->nr_pages += hpage_nr_pages(head);
+}
+
+static int madvise_tier_pte_range(pmd_t *pmd, unsigned long addr,
+		unsigned long end, struct mm_walk *walk)
+{
+	struct madvise_tier_private *mt = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *orig_pte, *pte;
+	struct page *page;
+	spinlock_t *ptl;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd) && !is_huge_zero_pmd(*pmd) &&
+		    !madvise_tier_skip(vma->vm_mm, addr, mt))
+			madvise_tier_isolate(pmd_page(*pmd), mt);
+		spin_unlock(ptl);
+		goto out;
+	}
+#endif
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr < end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (page && !madvise_tier_skip(vma->vm_mm, addr, mt))
+			madvise_tier_isolate(page, mt);
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+out:
+#endif
+	if (mt->nr_pages < MADV_TIER_BATCH)
+		return 0;
+	/* migrate the batch before isolating more */
+	mt->next = end;
+	return 1;
+}
+
+static int madvise_tier_test_walk(unsigned long start, unsigned long end,
+		struct mm_walk *walk)
+{
+	return vma_migratable(walk->vma) ? 0 : 1;
+}
+
+static const struct mm_walk_ops madvise_tier_walk_ops = {
+	.pmd_entry	= madvise_tier_pte_range,
+	.test_walk	= madvise_tier_test_walk,
+};
+
+static void madvise_tier_migrate(struct mm_struct *mm,
+		struct madvise_tier_private *mt, int flags)
+{
+	if (list_empty(&mt->pages))
+		return;
+
+	if (migrate_pages_flags(mm, &mt->pages, alloc_new_node_page, NULL,
+				mt->nid, flags, MR_SYSCALL))
+		putback_movable_pages(&mt->pages);
+	mt->nr_pages = 0;
+	/* the next batch reads the sizes left by this one */
+	mt->floor.nid = NUMA_NO_NODE;
+}
+
+/* The fast or the slow tier node of the socket @task runs on */
+static int madvise_tier_node(struct task_struct *task, int behavior)
+{
+	int nid = cpu_to_node(task_cpu(task));
+
+	if (node_is_slow_tier(nid))
+		nid = node_promotion_target(nid);
+	if (behavior == MADV_DEMOTE && nid != NUMA_NO_NODE)
+		nid = node_demotion_target(nid);
+
+	return nid;
+}
+
+int madvise_tier(struct task_struct *task, struct mm_struct *mm,
+		unsigned long start, unsigned long end, int behavior, int flags)
+{
+	struct madvise_tier_private mt = {
+		.pages = LIST_HEAD_INIT(mt.pages),
+		.floor = { .nid = NUMA_NO_NODE, .low = true },
+	};
+	struct vm_area_struct *vma;
+	unsigned long addr, vend;
+	nodemask_t task_nodes;
+	int unmapped_error = 0;
+	int err = 0;
+
+	mt.nid = madvise_tier_node(task, behavior);
+	mt.demote = behavior == MADV_DEMOTE;
+	if (mt.nid == NUMA_NO_NODE)
+		return -ENODEV;
+	task_nodes = cpuset_mems_allowed(task);
+	if (!node_isset(mt.nid, task_nodes))
+		return -EACCES;
+	if (!(flags & MADV_TIER_MOVE_FLAGS))
+		flags |= MPOL_MF_MOVE_MT | MPOL_MF_MOVE_CONCUR;
+
+	migrate_prep();
+
+	down_read(&mm->mmap_sem);
+	for (vma = find_vma(mm, start); vma && vma->vm_start < end;
+	     vma = vma->vm_next) {
+		if (vma->vm_start > start)
+			unmapped_error = -ENOMEM;
+		addr = max(start, vma->vm_start);
+		vend = min(end, vma->vm_end);
+		start = vma->vm_end;
+
+		while (addr < vend) {
+			if (walk_page_range(mm, addr, vend,
+					    &madvise_tier_walk_ops, &mt))
+				addr = mt.next;
+			else
+				addr = vend;
+			if (mt.nr_pages >= MADV_TIER_BATCH)
+				madvise_tier_migrate(mm, &mt, flags);
+			if (fatal_signal_pending(current)) {
+				err = -EINTR;
+				goto out;
+			}
+		}
+	}
+	if (start < end)
+		unmapped_error = -ENOMEM;
+out:
+	madvise_tier_migrate(mm, &mt, flags);
+	up_read(&mm->mmap_sem);
+
+	return err ? err : unmapped_error;
+}
+#endif /* CONFIG_MIGRATION */
+
 static long
 madvise_vma(struct vm_area_struct *vma, struct vm_area_struct **prev,
 		unsigned long start, unsigned long end, int behavior)
@@ -975,6 +1187,10 @@ madvise_behavior_valid(int behavior)
 #ifdef CONFIG_MEMORY_FAILURE
 	case MADV_SOFT_OFFLINE:
 	case MADV_HWPOISON:
+#endif
+#ifdef CONFIG_MIGRATION
+	case MADV_PROMOTE:
+	case MADV_DEMOTE:
 #endif
 		return true;
 
@@ -1030,6 +1246,10 @@ madvise_behavior_valid(int behavior)
  *  MADV_DONTDUMP - the application wants to prevent pages in the given range
  *		from being included in its core dump.
  *  MADV_DODUMP - cancel MADV_DONTDUMP: no longer exclude from core dump.
+ *  MADV_PROMOTE - move the pages in the given range to the fast tier node
+ *		of the socket the task runs on.
+ *  MADV_DEMOTE - move the pages in the given range to the slow tier node
+ *		of the socket the task runs on.
  *
  * return values:
  *  zero    - success
@@ -1043,6 +1263,8 @@ madvise_behavior_valid(int behavior)
  *  -EIO    - an I/O error occurred while paging in data.
  *  -EBADF  - map exists, but area maps something that isn't a file.
  *  -EAGAIN - a kernel resource was temporarily unavailable.
+ *  -ENODEV - MADV_PROMOTE or MADV_DEMOTE without a tier to move to.
+ *  -EACCES - the tier node is not allowed by the cpuset of the task.
  */
 int do_madvise(unsigned long start, size_t len_in, int behavior)
 {
@@ -1079,6 +1301,11 @@ int do_madvise(unsigned long start, size_t len_in, int behavior)
 	if (behavior == MADV_HWPOISON || behavior == MADV_SOFT_OFFLINE)
 		return madvise_inject_error(behavior, start, start + len_in);
 #endif
+#ifdef CONFIG_MIGRATION
+	if (behavior == MADV_PROMOTE || behavior == MADV_DEMOTE)
+		return madvise_tier(current, current->mm, start, end, behavior,
+				0);
+#endif
 
 	write = madvise_need_mmap_write(behavior);
 	if (write) {
@@ -1146,3 +1373,67 @@ SYSCALL_DEFINE3(madvise, unsigned long, start, size_t, len_in, int, behavior)
 {
 	return do_madvise(start, len_in, behavior);
 }
+
+#ifdef CONFIG_MIGRATION
+/*
+ * MADV_PROMOTE and MADV_DEMOTE on the range of another process, for an
+ * agent placing the memory of the processes it manages. @flags takes the
+ * copy modes and the page copy policy of mm_manage(), MPOL_MF_MOVE_MT |
+ * MPOL_MF_MOVE_CONCUR if no copy mode is given.
+ */
+SYSCALL_DEFINE5(process_madvise, pid_t, pid, unsigned long, start,
+		size_t, len_in, int, behavior, int, flags)
+{
+	struct task_struct *task;
+	struct mm_struct *mm;
+	unsigned long end;
+	size_t len;
+	int err;
+
+	start = untagged_addr(start);
+
+	if (behavior != MADV_PROMOTE && behavior != MADV_DEMOTE)
+		return -EINVAL;
+	if (flags & ~(MADV_TIER_MOVE_FLAGS | MPOL_MF_COPY_POLICY))
+		return -EINVAL;
+	if (!PAGE_ALIGNED(start))
+		return -EINVAL;
+	len = PAGE_ALIGN(len_in);
+	if (len_in && !len)
+		return -EINVAL;
+	end = start + len;
+	if (end < start)
+		return -EINVAL;
+	if (end == start)
+		return 0;
+
+	rcu_read_lock();
+	task = pid ? find_task_by_vpid(pid) : current;
+	if (!task) {
+		rcu_read_unlock();
+		return -ESRCH;
+	}
+	get_task_struct(task);
+	rcu_read_unlock();
+
+	/* the rights of move_pages() on the target process */
+	err = -EPERM;
+	if (!ptrace_may_access(task, PTRACE_MODE_READ_REALCREDS))
+		goto out;
+	err = security_task_movememory(task);
+	if (err)
+		goto out;
+
+	err = -EINVAL;
+	mm = get_task_mm(task);
+	if (!mm)
+		goto out;
+
+	err = madvise_tier(task, mm, start, end, behavior, flags);
+	mmput(mm);
+out:
+	put_task_struct(task);
+
+	return err;
+}
+#endif /* CONFIG_MIGRATION */
@@ -59,6 +59,8 @@
 #include <linux/tracehook.h>
 #include <linux/psi.h>
 #include <linux/seq_buf.h>
+#include <linux/mempolicy.h>
+#include <linux/memory_tier.h>
 #include "internal.h"
 #include <net/sock.h>
 #include <net/ip.h>
@@ -724,20 +726,15 @@ parent_nodeinfo(struct mem_cgroup_per_node *pn, int nid)
  * function updates the all three counters that are affected by a
  * change of state at this level: per-node, per-cgroup, per-lruvec.
  */
-void __mod_lruvec_state(struct lruvec *lruvec, enum node_stat_item idx,
-			int val)
+/* Update the memcg and lruvec counters of @lruvec, not the node ones */
+static void __mod_memcg_lruvec_state(struct lruvec *lruvec,
+				     enum node_stat_item idx, int val)
 {
 	pg_data_t *pgdat = lruvec_pgdat(lruvec);
 	struct mem_cgroup_per_node *pn;
 	struct mem_cgroup *memcg;
 	long x;
 
-	/* Update node */
-	__mod_node_page_state(pgdat, idx, val);
-
-	if (mem_cgroup_disabled())
-		return;
-
 	pn = container_of(lruvec, struct mem_cgroup_per_node, lruvec);
 	memcg = pn->memcg;
 
@@ -758,6 +755,18 @@ void __mod_lruvec_state(struct lruvec *lruvec, enum node_stat_item idx,
 	__this_cpu_write(pn->lruvec_stat_cpu->count[idx], x);
 }
 
+void __mod_lruvec_state(struct lruvec *lruvec, enum node_stat_item idx,
+			int val)
+{
+	/* Update node */
+	__mod_node_page_state(lruvec_pgdat(lruvec), idx, val);
+
+	if (mem_cgroup_disabled())
+		return;
+
+	__mod_memcg_lruvec_state(lruvec, idx, val);
+}
+
 void __mod_lruvec_slab_state(void *p, enum node_stat_item idx, int val)
 {
 	struct page *page = virt_to_head_page(p);
@@ -842,6 +851,12 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 	if (compound) {
 		VM_BUG_ON_PAGE(!PageTransHuge(page), page);
 		__mod_memcg_state(memcg, MEMCG_RSS_HUGE, nr_pages);
+		/*
+		 * The node counter is kept by the rmap code, this is only
+		 * the per node count of memory.tier_stat.
+		 */
+		__mod_memcg_lruvec_state(mem_cgroup_lruvec(memcg,
+				page_pgdat(page)), NR_ANON_THPS, nr_pages);
 	}
 
 	/* pagein of a big page is an event. So, ignore page size */
@@ -1355,6 +1370,51 @@ static bool mem_cgroup_wait_acct_move(struct mem_cgroup *memcg)
 	return false;
 }
 
+#ifdef CONFIG_MIGRATION
+/*
+ * The node pair lines grow with the square of the number of nodes, so
+ * they are not part of the buffer of memory_stat_format() but written to
+ * memory.stat directly.
+ */
+static void memcg_migrate_stat_show(struct seq_file *m,
+				    struct mem_cgroup *memcg)
+{
+	struct migrate_pair_stat sum;
+	struct mem_cgroup *iter;
+	int src_nid, dst_nid, pair;
+	u64 cpu_ns = 0;
+
+	for_each_mem_cgroup_tree(iter, memcg)
+		cpu_ns += atomic64_read(&iter->migrate_cpu_ns);
+	seq_printf(m, "migrate_cpu_usec %llu\n",
+		       div_u64(cpu_ns, NSEC_PER_USEC));
+
+	for_each_node_state(src_nid, N_MEMORY) {
+		for_each_node_state(dst_nid, N_MEMORY) {
+			if (src_nid == dst_nid)
+				continue;
+
+			pair = src_nid * nr_node_ids + dst_nid;
+			memset(&sum, 0, sizeof(sum));
+			for_each_mem_cgroup_tree(iter, memcg)
+				if (iter->migrate_pairs)
+					migrate_pair_stat_add(&sum,
+						iter->migrate_pairs + pair);
+			if (!sum.nr_base_pages)
+				continue;
+
+			seq_printf(m, "pgmigrate_%d_%d_base %lu\n",
+				   src_nid, dst_nid, sum.nr[MIGRATE_STAT_BASE]);
+			seq_printf(m, "pgmigrate_%d_%d_huge %lu\n",
+				   src_nid, dst_nid, sum.nr[MIGRATE_STAT_HUGE]);
+			seq_printf(m, "pgmigrate_%d_%d_bytes %llu\n",
+				   src_nid, dst_nid,
+				   (u64)sum.nr_base_pages << PAGE_SHIFT);
+		}
+	}
+}
+#endif
+
 static char *memory_stat_format(struct mem_cgroup *memcg)
 {
 	struct seq_buf s;
@@ -1440,6 +1500,8 @@ static char *memory_stat_format(struct mem_cgroup *memcg)
 		       memcg_page_state(memcg, WORKINGSET_ACTIVATE));
 	seq_buf_printf(&s, "workingset_nodereclaim %lu\n",
 		       memcg_page_state(memcg, WORKINGSET_NODERECLAIM));
+	seq_buf_printf(&s, "workingset_demote_refault %lu\n",
+		       memcg_page_state(memcg, WORKINGSET_DEMOTE_REFAULT));
 
 	seq_buf_printf(&s, "%s %lu\n",  vm_event_name(PGREFILL),
 		       memcg_events(memcg, PGREFILL));
@@ -2944,6 +3006,8 @@ void mem_cgroup_split_huge_fixup(struct page *head)
 		head[i].mem_cgroup = head->mem_cgroup;
 
 	__mod_memcg_state(head->mem_cgroup, MEMCG_RSS_HUGE, -HPAGE_PMD_NR);
+	__mod_memcg_lruvec_state(mem_cgroup_lruvec(head->mem_cgroup,
+			page_pgdat(head)), NR_ANON_THPS, -HPAGE_PMD_NR);
 }
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
@@ -4630,217 +4694,1012 @@ static ssize_t memcg_write_event_control(struct kernfs_open_file *of,
 	return ret;
 }
 
-static struct cftype mem_cgroup_legacy_files[] = {
-	{
-		.name = "usage_in_bytes",
-		.private = MEMFILE_PRIVATE(_MEM, RES_USAGE),
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "max_usage_in_bytes",
-		.private = MEMFILE_PRIVATE(_MEM, RES_MAX_USAGE),
-		.write = mem_cgroup_reset,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "limit_in_bytes",
-		.private = MEMFILE_PRIVATE(_MEM, RES_LIMIT),
-		.write = mem_cgroup_write,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "soft_limit_in_bytes",
-		.private = MEMFILE_PRIVATE(_MEM, RES_SOFT_LIMIT),
-		.write = mem_cgroup_write,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "failcnt",
-		.private = MEMFILE_PRIVATE(_MEM, RES_FAILCNT),
-		.write = mem_cgroup_reset,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "stat",
-		.seq_show = memcg_stat_show,
-	},
-	{
-		.name = "force_empty",
-		.write = mem_cgroup_force_empty_write,
-	},
-	{
-		.name = "use_hierarchy",
-		.write_u64 = mem_cgroup_hierarchy_write,
-		.read_u64 = mem_cgroup_hierarchy_read,
-	},
-	{
-		.name = "cgroup.event_control",		/* XXX: for compat */
-		.write = memcg_write_event_control,
-		.flags = CFTYPE_NO_PREFIX | CFTYPE_WORLD_WRITABLE,
-	},
-	{
-		.name = "swappiness",
-		.read_u64 = mem_cgroup_swappiness_read,
-		.write_u64 = mem_cgroup_swappiness_write,
-	},
-	{
-		.name = "move_charge_at_immigrate",
-		.read_u64 = mem_cgroup_move_charge_read,
-		.write_u64 = mem_cgroup_move_charge_write,
-	},
-	{
-		.name = "oom_control",
-		.seq_show = mem_cgroup_oom_control_read,
-		.write_u64 = mem_cgroup_oom_control_write,
-		.private = MEMFILE_PRIVATE(_OOM_TYPE, OOM_CONTROL),
-	},
-	{
-		.name = "pressure_level",
-	},
-#ifdef CONFIG_NUMA
-	{
-		.name = "numa_stat",
-		.seq_show = memcg_numa_stat_show,
-	},
-#endif
-	{
-		.name = "kmem.limit_in_bytes",
-		.private = MEMFILE_PRIVATE(_KMEM, RES_LIMIT),
-		.write = mem_cgroup_write,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "kmem.usage_in_bytes",
-		.private = MEMFILE_PRIVATE(_KMEM, RES_USAGE),
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "kmem.failcnt",
-		.private = MEMFILE_PRIVATE(_KMEM, RES_FAILCNT),
-		.write = mem_cgroup_reset,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "kmem.max_usage_in_bytes",
-		.private = MEMFILE_PRIVATE(_KMEM, RES_MAX_USAGE),
-		.write = mem_cgroup_reset,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-#if defined(CONFIG_SLAB) || defined(CONFIG_SLUB_DEBUG)
-	{
-		.name = "kmem.slabinfo",
-		.seq_start = memcg_slab_start,
-		.seq_next = memcg_slab_next,
-		.seq_stop = memcg_slab_stop,
-		.seq_show = memcg_slab_show,
-	},
-#endif
-	{
-		.name = "kmem.tcp.limit_in_bytes",
-		.private = MEMFILE_PRIVATE(_TCP, RES_LIMIT),
-		.write = mem_cgroup_write,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "kmem.tcp.usage_in_bytes",
-		.private = MEMFILE_PRIVATE(_TCP, RES_USAGE),
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "kmem.tcp.failcnt",
-		.private = MEMFILE_PRIVATE(_TCP, RES_FAILCNT),
-		.write = mem_cgroup_reset,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{
-		.name = "kmem.tcp.max_usage_in_bytes",
-		.private = MEMFILE_PRIVATE(_TCP, RES_MAX_USAGE),
-		.write = mem_cgroup_reset,
-		.read_u64 = mem_cgroup_read_u64,
-	},
-	{ },	/* terminate */
-};
-
-/*
- * Private memory cgroup IDR
- *
- * Swap-out records and page cache shadow entries need to store memcg
- * references in constrained space, so we maintain an ID space that is
- * limited to 16 bit (MEM_CGROUP_ID_MAX), limiting the total number of
- * memory-controlled cgroups to 64k.
- *
- * However, there usually are many references to the oflline CSS after
- * the cgroup has been destroyed, such as page cache or reclaimable
- * slab objects, that don't need to hang on to the ID. We want to keep
- * those dead CSS from occupying IDs, or we might quickly exhaust the
- * relatively small ID space and prevent the creation of new cgroups
- * even when there are much fewer than 64k cgroups - possibly none.
- *
- * Maintain a private 16-bit ID space for memcg, and allow the ID to
- * be freed and recycled when it's no longer needed, which is usually
- * when the CSS is offlined.
+/**
+ * mem_cgroup_copy_policy - page copy policy of migrations of @mm's memory
+ * @mm: mm whose pages are migrated
+ * @policy: policy to fill
  *
- * The only exception to that are records of swapped out tmpfs/shmem
- * pages that need to be attributed to live ancestors on swapin. But
- * those references are manageable from userspace.
+ * Every field of @policy that is not set yet is taken from the closest
+ * cgroup, starting from the memcg of @mm, that sets it. Fields no cgroup
+ * sets are left alone, the sysctl defaults apply to them.
  */
+void mem_cgroup_copy_policy(struct mm_struct *mm,
+			    struct page_copy_policy *policy)
+{
+	struct mem_cgroup *memcg;
 
-static DEFINE_IDR(mem_cgroup_idr);
+	if (mem_cgroup_disabled())
+		return;
 
-static void mem_cgroup_id_remove(struct mem_cgroup *memcg)
+	memcg = get_mem_cgroup_from_mm(mm);
+	__mem_cgroup_copy_policy(memcg, policy);
+	css_put(&memcg->css);
+}
+
+/* Like mem_cgroup_copy_policy(), starting from @memcg */
+void __mem_cgroup_copy_policy(struct mem_cgroup *memcg,
+			      struct page_copy_policy *policy)
 {
-	if (memcg->id.id > 0) {
-		idr_remove(&mem_cgroup_idr, memcg->id.id);
-		memcg->id.id = 0;
+	struct mem_cgroup *iter;
+
+	for (iter = memcg; iter; iter = parent_mem_cgroup(iter)) {
+		struct page_copy_policy p = READ_ONCE(iter->copy_policy);
+
+		if (policy->nt < 0)
+			policy->nt = p.nt;
+		if (policy->rpdaa < 0)
+			policy->rpdaa = p.rpdaa;
+		if (policy->nr_threads < 0)
+			policy->nr_threads = p.nr_threads;
 	}
 }
 
-static void mem_cgroup_id_get_many(struct mem_cgroup *memcg, unsigned int n)
+static void memory_copy_policy_print(struct seq_file *m, const char *name,
+				     int val, bool last)
 {
-	refcount_add(n, &memcg->id.ref);
+	if (val < 0)
+		seq_printf(m, "%s=default", name);
+	else
+		seq_printf(m, "%s=%d", name, val);
+	seq_putc(m, last ? '\n' : ' ');
 }
 
-static void mem_cgroup_id_put_many(struct mem_cgroup *memcg, unsigned int n)
+static int memory_copy_policy_show(struct seq_file *m, void *v)
 {
-	if (refcount_sub_and_test(n, &memcg->id.ref)) {
-		mem_cgroup_id_remove(memcg);
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	struct page_copy_policy policy = READ_ONCE(memcg->copy_policy);
 
-		/* Memcg ID pins CSS */
-		css_put(&memcg->css);
-	}
+	memory_copy_policy_print(m, "nt", policy.nt, false);
+	memory_copy_policy_print(m, "rpdaa", policy.rpdaa, false);
+	memory_copy_policy_print(m, "threads", policy.nr_threads, true);
+
+	return 0;
 }
 
-static inline void mem_cgroup_id_put(struct mem_cgroup *memcg)
+/*
+ * Writes are "key=value" pairs separated by spaces, the keys being nt,
+ * rpdaa and threads. A value of "default" falls back to the parent
+ * cgroup, then to the sysctl.
+ */
+static ssize_t memory_copy_policy_write(struct kernfs_open_file *of,
+					char *buf, size_t nbytes, loff_t off)
 {
-	mem_cgroup_id_put_many(memcg, 1);
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	struct page_copy_policy policy = READ_ONCE(memcg->copy_policy);
+	char *tok;
+	int val;
+
+	buf = strstrip(buf);
+	while ((tok = strsep(&buf, " ")) != NULL) {
+		char *key = strsep(&tok, "=");
+
+		if (!*key)
+			continue;
+		if (!tok)
+			return -EINVAL;
+
+		if (!strcmp(tok, "default"))
+			val = -1;
+		else if (kstrtoint(tok, 0, &val) || val < 0)
+			return -EINVAL;
+
+		if (!strcmp(key, "nt") && val <= 1)
+			policy.nt = val;
+		else if (!strcmp(key, "rpdaa") && val <= 1)
+			policy.rpdaa = val;
+		else if (!strcmp(key, "threads") && val != 0 &&
+			 val <= MAX_NR_COPY_THREADS)
+			policy.nr_threads = val;
+		else
+			return -EINVAL;
+	}
+
+	WRITE_ONCE(memcg->copy_policy, policy);
+
+	return nbytes;
 }
 
 /**
- * mem_cgroup_from_id - look up a memcg from a memcg id
- * @id: the memcg id to look up
+ * mem_cgroup_tier_fallback - node fallback order of the current task
  *
- * Caller must hold rcu_read_lock().
+ * The fallback order of the closest cgroup, starting from the memcg of
+ * the current task, that sets one, TIER_FALLBACK_DEFAULT if none does.
  */
-struct mem_cgroup *mem_cgroup_from_id(unsigned short id)
+enum tier_fallback mem_cgroup_tier_fallback(void)
 {
-	WARN_ON_ONCE(!rcu_read_lock_held());
-	return idr_find(&mem_cgroup_idr, id);
+	enum tier_fallback fallback = TIER_FALLBACK_DEFAULT;
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled())
+		return fallback;
+
+	rcu_read_lock();
+	for (memcg = mem_cgroup_from_task(current);
+	     memcg && fallback == TIER_FALLBACK_DEFAULT;
+	     memcg = parent_mem_cgroup(memcg))
+		fallback = READ_ONCE(memcg->tier_fallback);
+	rcu_read_unlock();
+
+	return fallback;
 }
 
-static int alloc_mem_cgroup_per_node_info(struct mem_cgroup *memcg, int node)
+static int memory_tier_fallback_show(struct seq_file *m, void *v)
 {
-	struct mem_cgroup_per_node *pn;
-	int tmp = node;
-	/*
-	 * This routine is called against possible nodes.
-	 * But it's BUG to call kmalloc() against offline node.
-	 *
-	 * TODO: this routine can waste much memory for nodes which will
-	 *       never be onlined. It's better to use memory hotplug callback
-	 *       function.
-	 */
-	if (!node_state(node, N_NORMAL_MEMORY))
-		tmp = -1;
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	int fallback = READ_ONCE(memcg->tier_fallback);
+	int i;
+
+	for (i = 0; i < NR_TIER_FALLBACKS; i++)
+		seq_printf(m, i == fallback ? "[%s]%c" : "%s%c",
+			   tier_fallback_names[i],
+			   i == NR_TIER_FALLBACKS - 1 ? '\n' : ' ');
+
+	return 0;
+}
+
+/*
+ * Writes are one of default, distance, fast and slow. "default" falls
+ * back to the parent cgroup, then to the node distance order.
+ */
+static ssize_t memory_tier_fallback_write(struct kernfs_open_file *of,
+					  char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	int fallback;
+
+	fallback = match_string(tier_fallback_names, NR_TIER_FALLBACKS,
+				strstrip(buf));
+	if (fallback < 0)
+		return -EINVAL;
+
+	if (fallback != TIER_FALLBACK_DEFAULT)
+		tier_fallback_enable();
+	WRITE_ONCE(memcg->tier_fallback, fallback);
+
+	return nbytes;
+}
+
+#ifdef CONFIG_MIGRATION
+/**
+ * mem_cgroup_migrate_rate_charge - charge a migration to memcg rate limits
+ * @page: page being migrated
+ * @bytes: size of the migration
+ *
+ * Charges the memcg of @page and every ancestor with a migration rate
+ * limit. Returns how many nanoseconds it takes the most indebted of them
+ * to be repaid.
+ */
+u64 mem_cgroup_migrate_rate_charge(struct page *page, u64 bytes)
+{
+	struct mem_cgroup *memcg;
+	u64 limit, wait = 0;
+
+	if (mem_cgroup_disabled())
+		return 0;
+
+	rcu_read_lock();
+	for (memcg = page->mem_cgroup; memcg; memcg = parent_mem_cgroup(memcg)) {
+		limit = READ_ONCE(memcg->migrate_rate_limit);
+		if (limit)
+			wait = max(wait, migrate_rate_bucket_charge(
+					&memcg->migrate_rate, limit, bytes));
+	}
+	rcu_read_unlock();
+
+	return wait;
+}
+
+/* The quiesced cgroup among @memcg and its ancestors, NULL if none is */
+static struct mem_cgroup *memcg_migrate_quiesced(struct mem_cgroup *memcg)
+{
+	u64 now = get_jiffies_64();
+
+	for (; memcg; memcg = parent_mem_cgroup(memcg))
+		if (READ_ONCE(memcg->migrate_quiesce_end) > now)
+			return memcg;
+
+	return NULL;
+}
+
+/**
+ * mem_cgroup_migrate_quiesced - whether to defer the migration of a page
+ * @page: page to be migrated by tiering, NUMA balancing or mm_manage()
+ *
+ * Returns true while the memcg of @page or one of its ancestors has its
+ * migrations quiesced, counting the deferred migration. A page the scans
+ * come back to during the window is counted each time it is passed over.
+ */
+bool mem_cgroup_migrate_quiesced(struct page *page)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled())
+		return false;
+
+	rcu_read_lock();
+	memcg = memcg_migrate_quiesced(page->mem_cgroup);
+	if (memcg)
+		atomic_long_add(hpage_nr_pages(page), &memcg->migrate_deferred);
+	rcu_read_unlock();
+
+	if (memcg)
+		count_vm_events(PGMIGRATE_QUIESCED, hpage_nr_pages(page));
+
+	return memcg;
+}
+
+/* Whether the NUMA balancing scan of @mm is to be skipped for now */
+bool mem_cgroup_mm_migrate_quiesced(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg;
+	bool quiesced;
+
+	if (mem_cgroup_disabled())
+		return false;
+
+	memcg = get_mem_cgroup_from_mm(mm);
+	quiesced = memcg_migrate_quiesced(memcg);
+	css_put(&memcg->css);
+
+	return quiesced;
+}
+
+/**
+ * mem_cgroup_count_migrate_pair - count a migration in memory.stat
+ * @page: page migrated
+ * @pair: index of its node pair, src_nid * nr_node_ids + dst_nid
+ * @size: its enum migrate_stat_size
+ * @nr_pages: its number of base pages
+ *
+ * Only the memcg of @page counts it, memory.stat adds up the descendants.
+ */
+void mem_cgroup_count_migrate_pair(struct page *page, int pair, int size,
+				   int nr_pages)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	rcu_read_lock();
+	memcg = READ_ONCE(page->mem_cgroup);
+	if (memcg && memcg->migrate_pairs) {
+		this_cpu_inc(memcg->migrate_pairs[pair].nr[size]);
+		this_cpu_add(memcg->migrate_pairs[pair].nr_base_pages, nr_pages);
+	}
+	rcu_read_unlock();
+}
+
+/**
+ * mem_cgroup_count_migrate_stall - count a fault waiting on a migration
+ * @mm: mm of the faulting task
+ * @size: enum migrate_stat_size of the page waited on
+ * @bucket: histogram bucket of the wait
+ * @nsec: length of the wait
+ *
+ * The wait is charged to the memcg of @mm, memory.migrate_stall adds up
+ * the descendants.
+ */
+void mem_cgroup_count_migrate_stall(struct mm_struct *mm, int size,
+				    int bucket, u64 nsec)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
+	if (memcg && memcg->migrate_stall) {
+		this_cpu_add(memcg->migrate_stall->nsec[size], nsec);
+		this_cpu_inc(memcg->migrate_stall->nr[size]);
+		this_cpu_inc(memcg->migrate_stall->hist[bucket]);
+	}
+	rcu_read_unlock();
+}
+
+/**
+ * mem_cgroup_count_migrate_cputime - charge CPU time of a migration
+ * @task: task the migration was done for
+ * @nsec: CPU time the copy workers and kmigrated spent on it
+ *
+ * The time is charged to the memcg of @task, memory.stat adds up the
+ * descendants.
+ */
+void mem_cgroup_count_migrate_cputime(struct task_struct *task, u64 nsec)
+{
+	struct mem_cgroup *memcg;
+
+	if (mem_cgroup_disabled())
+		return;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(task);
+	if (memcg)
+		atomic64_add(nsec, &memcg->migrate_cpu_ns);
+	rcu_read_unlock();
+}
+
+static int memory_migrate_stall_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	struct migrate_stall_stat sum = {};
+	struct mem_cgroup *iter;
+
+	for_each_mem_cgroup_tree(iter, memcg)
+		if (iter->migrate_stall)
+			migrate_stall_stat_add(&sum, iter->migrate_stall);
+	migrate_stall_stat_show(m, "", &sum);
+
+	return 0;
+}
+#endif
+
+#ifdef CONFIG_MIGRATION
+/* Base pages of @memcg and its descendants migrated from @src to @dst */
+static unsigned long memcg_migrate_pair_pages(struct mem_cgroup *memcg,
+					      int src, int dst)
+{
+	struct migrate_pair_stat sum = {};
+	struct mem_cgroup *iter;
+
+	for_each_mem_cgroup_tree(iter, memcg)
+		if (iter->migrate_pairs)
+			migrate_pair_stat_add(&sum, iter->migrate_pairs +
+					      src * nr_node_ids + dst);
+
+	return sum.nr_base_pages;
+}
+
+/*
+ * Base pages promoted, to a fast tier node from a slow tier one, and
+ * demoted, the other way, into ([0]) and out of ([1]) @nid.
+ */
+static void memcg_tier_migrate_stat(struct mem_cgroup *memcg, int nid,
+				    unsigned long *promoted,
+				    unsigned long *demoted)
+{
+	bool slow = node_is_slow_tier(nid);
+	int other;
+
+	for_each_node_state(other, N_MEMORY) {
+		if (node_is_slow_tier(other) == slow)
+			continue;
+
+		if (slow) {
+			demoted[0] += memcg_migrate_pair_pages(memcg, other, nid);
+			promoted[1] += memcg_migrate_pair_pages(memcg, nid, other);
+		} else {
+			promoted[0] += memcg_migrate_pair_pages(memcg, other, nid);
+			demoted[1] += memcg_migrate_pair_pages(memcg, nid, other);
+		}
+	}
+}
+#else
+static void memcg_tier_migrate_stat(struct mem_cgroup *memcg, int nid,
+				    unsigned long *promoted,
+				    unsigned long *demoted)
+{
+}
+#endif
+
+/*
+ * memory.tier_stat: one line per memory node with the LRU and THP bytes of
+ * the memcg and its descendants on the node, and the base pages promoted
+ * and demoted into and out of the node since the memcg was created. The
+ * sizes come from the batched lruvec counters, not from the LRUs, so they
+ * are off by up to MEMCG_CHARGE_BATCH pages per CPU.
+ */
+static int memory_tier_stat_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	unsigned long promoted[2], demoted[2];
+	struct lruvec *lruvec;
+	int nid;
+
+	seq_puts(m, "node active_anon inactive_anon active_file inactive_file "
+		 "thp promoted_in promoted_out demoted_in demoted_out\n");
+
+	for_each_node_state(nid, N_MEMORY) {
+		lruvec = mem_cgroup_lruvec(memcg, NODE_DATA(nid));
+		memset(promoted, 0, sizeof(promoted));
+		memset(demoted, 0, sizeof(demoted));
+		memcg_tier_migrate_stat(memcg, nid, promoted, demoted);
+
+		seq_printf(m, "%d %llu %llu %llu %llu %llu %lu %lu %lu %lu\n",
+			   nid,
+			   (u64)lruvec_page_state(lruvec, NR_ACTIVE_ANON) *
+			   PAGE_SIZE,
+			   (u64)lruvec_page_state(lruvec, NR_INACTIVE_ANON) *
+			   PAGE_SIZE,
+			   (u64)lruvec_page_state(lruvec, NR_ACTIVE_FILE) *
+			   PAGE_SIZE,
+			   (u64)lruvec_page_state(lruvec, NR_INACTIVE_FILE) *
+			   PAGE_SIZE,
+			   (u64)lruvec_page_state(lruvec, NR_ANON_THPS) *
+			   PAGE_SIZE,
+			   promoted[0], promoted[1], demoted[0], demoted[1]);
+	}
+
+	return 0;
+}
+
+static int memory_migrate_rate_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	u64 limit = READ_ONCE(memcg->migrate_rate_limit);
+
+	if (limit)
+		seq_printf(m, "limit=%llu", limit);
+	else
+		seq_puts(m, "limit=max");
+	seq_printf(m, " throttled=%lu\n",
+		   READ_ONCE(memcg->migrate_rate.nr_throttled));
+
+	return 0;
+}
+
+/* Writes are a limit in bytes per second, or "max" for no limit */
+static ssize_t memory_migrate_rate_write(struct kernfs_open_file *of,
+					 char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	u64 limit;
+
+	buf = strstrip(buf);
+	if (!strcmp(buf, "max"))
+		limit = 0;
+	else if (kstrtou64(buf, 0, &limit) || !limit)
+		return -EINVAL;
+
+	WRITE_ONCE(memcg->migrate_rate_limit, limit);
+
+	return nbytes;
+}
+
+static int memory_migrate_quiesce_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	u64 end = READ_ONCE(memcg->migrate_quiesce_end);
+	u64 now = get_jiffies_64();
+
+	if (end == U64_MAX)
+		seq_puts(m, "quiesced=max");
+	else if (end > now)
+		seq_printf(m, "quiesced=%u", jiffies_to_msecs(end - now));
+	else
+		seq_puts(m, "quiesced=0");
+	seq_printf(m, " deferred=%ld\n",
+		   atomic_long_read(&memcg->migrate_deferred));
+
+	return 0;
+}
+
+/*
+ * Writes are how many milliseconds from now the migrations of the cgroup
+ * are deferred for, "max" until further notice and 0 to resume them. The
+ * deferred pages are found again by the scans that picked them and
+ * migrated as they would have been: memory.migrate_rate paces the
+ * migrations that may sleep, those of kmigrated, kswapd and mm_manage(),
+ * while the MIGRATE_ASYNC promotions of hinting faults only charge it and
+ * are not held back. The "deferred" count of the file is in migrations
+ * passed over, not in distinct pages.
+ */
+static ssize_t memory_migrate_quiesce_write(struct kernfs_open_file *of,
+					    char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned int msecs;
+	u64 end;
+
+	buf = strstrip(buf);
+	if (!strcmp(buf, "max"))
+		end = U64_MAX;
+	else if (kstrtouint(buf, 0, &msecs))
+		return -EINVAL;
+	else
+		end = msecs ? get_jiffies_64() + msecs_to_jiffies(msecs) : 0;
+
+	WRITE_ONCE(memcg->migrate_quiesce_end, end);
+
+	return nbytes;
+}
+
+static int memory_tiering_interval_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+
+	seq_printf(m, "%u\n", READ_ONCE(memcg->tiering.interval_ms));
+
+	return 0;
+}
+
+/* Writes are the period of the tiering cycles in ms, 0 to stop them */
+static ssize_t memory_tiering_interval_write(struct kernfs_open_file *of,
+					     char *buf, size_t nbytes,
+					     loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned int interval;
+
+	if (kstrtouint(strstrip(buf), 0, &interval))
+		return -EINVAL;
+
+	mutex_lock(&memcg->tiering.lock);
+	memcg->tiering.interval_ms = interval;
+	mem_cgroup_tiering_kick(memcg);
+	mutex_unlock(&memcg->tiering.lock);
+
+	return nbytes;
+}
+
+static int memory_tiering_nodes_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	nodemask_t nodes;
+
+	mutex_lock(&memcg->tiering.lock);
+	nodes = seq_cft(m)->private ? memcg->tiering.fast_nodes :
+		memcg->tiering.slow_nodes;
+	mutex_unlock(&memcg->tiering.lock);
+
+	seq_printf(m, "%*pbl\n", nodemask_pr_args(&nodes));
+
+	return 0;
+}
+
+/* Writes are a node list, the fast nodes with a private of 1 */
+static ssize_t memory_tiering_nodes_write(struct kernfs_open_file *of,
+					  char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	nodemask_t nodes;
+
+	if (nodelist_parse(strstrip(buf), nodes))
+		return -EINVAL;
+	if (!nodes_subset(nodes, node_states[N_MEMORY]))
+		return -EINVAL;
+
+	mutex_lock(&memcg->tiering.lock);
+	if (of_cft(of)->private)
+		memcg->tiering.fast_nodes = nodes;
+	else
+		memcg->tiering.slow_nodes = nodes;
+	mem_cgroup_tiering_kick(memcg);
+	mutex_unlock(&memcg->tiering.lock);
+
+	return nbytes;
+}
+
+static const struct {
+	const char *name;
+	int flag;
+} memory_tiering_modes[] = {
+	{ "mt",		MPOL_MF_MOVE_MT },
+	{ "dma",	MPOL_MF_MOVE_DMA },
+	{ "concur",	MPOL_MF_MOVE_CONCUR },
+	{ "exchange",	MPOL_MF_EXCHANGE },
+	{ "shrink",	MPOL_MF_SHRINK_LISTS },
+	{ "all",	MPOL_MF_MOVE_ALL },
+};
+
+static int memory_tiering_mode_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	unsigned long nr_pages;
+	int flags, i;
+
+	mutex_lock(&memcg->tiering.lock);
+	flags = memcg->tiering.flags;
+	nr_pages = memcg->tiering.nr_pages;
+	mutex_unlock(&memcg->tiering.lock);
+
+	for (i = 0; i < ARRAY_SIZE(memory_tiering_modes); i++)
+		if (flags & memory_tiering_modes[i].flag)
+			seq_printf(m, "%s ", memory_tiering_modes[i].name);
+	if (nr_pages == ULONG_MAX)
+		seq_puts(m, "pages=max\n");
+	else
+		seq_printf(m, "pages=%lu\n", nr_pages);
+
+	return 0;
+}
+
+/*
+ * Writes are the mm_manage() options of the tiering cycles separated by
+ * spaces, out of mt, dma, concur, exchange, shrink and all, and
+ * pages=<nr> or pages=max for the base pages moved per cycle.
+ */
+static ssize_t memory_tiering_mode_write(struct kernfs_open_file *of,
+					 char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	unsigned long nr_pages = ULONG_MAX;
+	int flags = MPOL_MF_MOVE;
+	char *tok;
+	int i;
+
+	buf = strstrip(buf);
+	while ((tok = strsep(&buf, " ")) != NULL) {
+		if (!*tok)
+			continue;
+
+		if (!strncmp(tok, "pages=", 6)) {
+			if (!strcmp(tok + 6, "max"))
+				nr_pages = ULONG_MAX;
+			else if (kstrtoul(tok + 6, 0, &nr_pages) || !nr_pages)
+				return -EINVAL;
+			continue;
+		}
+
+		for (i = 0; i < ARRAY_SIZE(memory_tiering_modes); i++)
+			if (!strcmp(tok, memory_tiering_modes[i].name))
+				break;
+		if (i == ARRAY_SIZE(memory_tiering_modes))
+			return -EINVAL;
+		flags |= memory_tiering_modes[i].flag;
+	}
+
+	mutex_lock(&memcg->tiering.lock);
+	memcg->tiering.flags = flags;
+	memcg->tiering.nr_pages = nr_pages;
+	mutex_unlock(&memcg->tiering.lock);
+
+	return nbytes;
+}
+
+static int memory_tiering_stat_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	struct page_migration_stats *stats = &memcg->tiering.stats;
+
+	seq_printf(m, "cycles %lu\n", READ_ONCE(memcg->tiering.nr_cycles));
+	seq_printf(m, "promoted_base_pages %lu\n",
+		   READ_ONCE(stats->s2f.nr_base_pages));
+	seq_printf(m, "promoted_huge_pages %lu\n",
+		   READ_ONCE(stats->s2f.nr_huge_pages));
+	seq_printf(m, "demoted_base_pages %lu\n",
+		   READ_ONCE(stats->f2s.nr_base_pages));
+	seq_printf(m, "demoted_huge_pages %lu\n",
+		   READ_ONCE(stats->f2s.nr_huge_pages));
+	seq_printf(m, "exchanges %lu\n", READ_ONCE(stats->nr_exchanges));
+
+	return 0;
+}
+
+/* Reads are the bytes the last write asked for and the bytes it moved */
+static int memory_tier_move_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_seq(m);
+	int promote = seq_cft(m)->private;
+	u64 requested, done;
+
+	mutex_lock(&memcg->tiering.lock);
+	requested = (u64)memcg->tiering.move_requested[promote] * PAGE_SIZE;
+	done = (u64)memcg->tiering.move_done[promote] * PAGE_SIZE;
+	mutex_unlock(&memcg->tiering.lock);
+
+	seq_printf(m, "requested %llu moved %llu\n", requested, done);
+
+	return 0;
+}
+
+/*
+ * Writes are a number of bytes to demote, or promote, now. The write
+ * returns once they are moved, -EAGAIN if none could be.
+ */
+static ssize_t memory_tier_move_write(struct kernfs_open_file *of,
+				      char *buf, size_t nbytes, loff_t off)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	int promote = of_cft(of)->private;
+	unsigned long nr_pages, nr_moved;
+	int err;
+
+	err = page_counter_memparse(strstrip(buf), "max", &nr_pages);
+	if (err)
+		return err;
+
+	nr_moved = mem_cgroup_tier_move(memcg, nr_pages, promote);
+
+	mutex_lock(&memcg->tiering.lock);
+	memcg->tiering.move_requested[promote] = nr_pages;
+	memcg->tiering.move_done[promote] = nr_moved;
+	mutex_unlock(&memcg->tiering.lock);
+
+	if (!nr_moved && nr_pages)
+		return -EAGAIN;
+
+	return nbytes;
+}
+
+#define MEMORY_TIERING_FILES						\
+	{								\
+		.name = "tiering.interval_ms",				\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.seq_show = memory_tiering_interval_show,		\
+		.write = memory_tiering_interval_write,			\
+	},								\
+	{								\
+		.name = "tiering.fast_nodes",				\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.private = 1,						\
+		.seq_show = memory_tiering_nodes_show,			\
+		.write = memory_tiering_nodes_write,			\
+	},								\
+	{								\
+		.name = "tiering.slow_nodes",				\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.seq_show = memory_tiering_nodes_show,			\
+		.write = memory_tiering_nodes_write,			\
+	},								\
+	{								\
+		.name = "tiering.mode",					\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.seq_show = memory_tiering_mode_show,			\
+		.write = memory_tiering_mode_write,			\
+	},								\
+	{								\
+		.name = "tiering.stat",					\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.seq_show = memory_tiering_stat_show,			\
+	},								\
+	{								\
+		.name = "demote",					\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.seq_show = memory_tier_move_show,			\
+		.write = memory_tier_move_write,			\
+	},								\
+	{								\
+		.name = "promote",					\
+		.flags = CFTYPE_NOT_ON_ROOT,				\
+		.private = 1,						\
+		.seq_show = memory_tier_move_show,			\
+		.write = memory_tier_move_write,			\
+	}
+
+static struct cftype mem_cgroup_legacy_files[] = {
+	{
+		.name = "usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_MEM, RES_USAGE),
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "max_usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_MEM, RES_MAX_USAGE),
+		.write = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_MEM, RES_LIMIT),
+		.write = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "soft_limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_MEM, RES_SOFT_LIMIT),
+		.write = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "failcnt",
+		.private = MEMFILE_PRIVATE(_MEM, RES_FAILCNT),
+		.write = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "stat",
+		.seq_show = memcg_stat_show,
+	},
+	{
+		.name = "force_empty",
+		.write = mem_cgroup_force_empty_write,
+	},
+	{
+		.name = "use_hierarchy",
+		.write_u64 = mem_cgroup_hierarchy_write,
+		.read_u64 = mem_cgroup_hierarchy_read,
+	},
+	{
+		.name = "cgroup.event_control",		/* XXX: for compat */
+		.write = memcg_write_event_control,
+		.flags = CFTYPE_NO_PREFIX | CFTYPE_WORLD_WRITABLE,
+	},
+	{
+		.name = "swappiness",
+		.read_u64 = mem_cgroup_swappiness_read,
+		.write_u64 = mem_cgroup_swappiness_write,
+	},
+	{
+		.name = "copy_policy",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_copy_policy_show,
+		.write = memory_copy_policy_write,
+	},
+	{
+		.name = "migrate_rate",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_migrate_rate_show,
+		.write = memory_migrate_rate_write,
+	},
+	{
+		.name = "migrate_quiesce",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_migrate_quiesce_show,
+		.write = memory_migrate_quiesce_write,
+	},
+	{
+		.name = "tier_fallback",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_tier_fallback_show,
+		.write = memory_tier_fallback_write,
+	},
+#ifdef CONFIG_MIGRATION
+	{
+		.name = "migrate_stall",
+		.seq_show = memory_migrate_stall_show,
+	},
+#endif
+	MEMORY_TIERING_FILES,
+	{
+		.name = "move_charge_at_immigrate",
+		.read_u64 = mem_cgroup_move_charge_read,
+		.write_u64 = mem_cgroup_move_charge_write,
+	},
+	{
+		.name = "oom_control",
+		.seq_show = mem_cgroup_oom_control_read,
+		.write_u64 = mem_cgroup_oom_control_write,
+		.private = MEMFILE_PRIVATE(_OOM_TYPE, OOM_CONTROL),
+	},
+	{
+		.name = "pressure_level",
+	},
+#ifdef CONFIG_NUMA
+	{
+		.name = "numa_stat",
+		.seq_show = memcg_numa_stat_show,
+	},
+#endif
+	{
+		.name = "kmem.limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_LIMIT),
+		.write = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "kmem.usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_USAGE),
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "kmem.failcnt",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_FAILCNT),
+		.write = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "kmem.max_usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_KMEM, RES_MAX_USAGE),
+		.write = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+#if defined(CONFIG_SLAB) || defined(CONFIG_SLUB_DEBUG)
+	{
+		.name = "kmem.slabinfo",
+		.seq_start = memcg_slab_start,
+		.seq_next = memcg_slab_next,
+		.seq_stop = memcg_slab_stop,
+		.seq_show = memcg_slab_show,
+	},
+#endif
+	{
+		.name = "kmem.tcp.limit_in_bytes",
+		.private = MEMFILE_PRIVATE(_TCP, RES_LIMIT),
+		.write = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "kmem.tcp.usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_TCP, RES_USAGE),
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "kmem.tcp.failcnt",
+		.private = MEMFILE_PRIVATE(_TCP, RES_FAILCNT),
+		.write = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{
+		.name = "kmem.tcp.max_usage_in_bytes",
+		.private = MEMFILE_PRIVATE(_TCP, RES_MAX_USAGE),
+		.write = mem_cgroup_reset,
+		.read_u64 = mem_cgroup_read_u64,
+	},
+	{ },	/* terminate */
+};
+
+/*
+ * Private memory cgroup IDR
+ *
+ * Swap-out records and page cache shadow entries need to store memcg
+ * references in constrained space, so we maintain an ID space that is
+ * limited to 16 bit (MEM_CGROUP_ID_MAX), limiting the total number of
+ * memory-controlled cgroups to 64k.
+ *
+ * However, there usually are many references to the oflline CSS after
+ * the cgroup has been destroyed, such as page cache or reclaimable
+ * slab objects, that don't need to hang on to the ID. We want to keep
+ * those dead CSS from occupying IDs, or we might quickly exhaust the
+ * relatively small ID space and prevent the creation of new cgroups
+ * even when there are much fewer than 64k cgroups - possibly none.
+ *
+ * Maintain a private 16-bit ID space for memcg, and allow the ID to
+ * be freed and recycled when it's no longer needed, which is usually
+ * when the CSS is offlined.
+ *
+ * The only exception to that are records of swapped out tmpfs/shmem
+ * pages that need to be attributed to live ancestors on swapin. But
+ * those references are manageable from userspace.
+ */
+
+static DEFINE_IDR(mem_cgroup_idr);
+
+static void mem_cgroup_id_remove(struct mem_cgroup *memcg)
+{
+	if (memcg->id.id > 0) {
+		idr_remove(&mem_cgroup_idr, memcg->id.id);
+		memcg->id.id = 0;
+	}
+}
+
+static void mem_cgroup_id_get_many(struct mem_cgroup *memcg, unsigned int n)
+{
+	refcount_add(n, &memcg->id.ref);
+}
+
+static void mem_cgroup_id_put_many(struct mem_cgroup *memcg, unsigned int n)
+{
+	if (refcount_sub_and_test(n, &memcg->id.ref)) {
+		mem_cgroup_id_remove(memcg);
+
+		/* Memcg ID pins CSS */
+		css_put(&memcg->css);
+	}
+}
+
+static inline void mem_cgroup_id_put(struct mem_cgroup *memcg)
+{
+	mem_cgroup_id_put_many(memcg, 1);
+}
+
+/**
+ * mem_cgroup_from_id - look up a memcg from a memcg id
+ * @id: the memcg id to look up
+ *
+ * Caller must hold rcu_read_lock().
+ */
+struct mem_cgroup *mem_cgroup_from_id(unsigned short id)
+{
+	WARN_ON_ONCE(!rcu_read_lock_held());
+	return idr_find(&mem_cgroup_idr, id);
+}
+
+static int alloc_mem_cgroup_per_node_info(struct mem_cgroup *memcg, int node)
+{
+	struct mem_cgroup_per_node *pn;
+	int tmp = node;
+	/*
+	 * This routine is called against possible nodes.
+	 * But it's BUG to call kmalloc() against offline node.
+	 *
+	 * TODO: this routine can waste much memory for nodes which will
+	 *       never be onlined. It's better to use memory hotplug callback
+	 *       function.
+	 */
+	if (!node_state(node, N_NORMAL_MEMORY))
+		tmp = -1;
 	pn = kzalloc_node(sizeof(*pn), GFP_KERNEL, tmp);
 	if (!pn)
 		return 1;
@@ -4886,6 +5745,8 @@ static void __mem_cgroup_free(struct mem_cgroup *memcg)
 
 	for_each_node(node)
 		free_mem_cgroup_per_node_info(memcg, node);
+	free_percpu(memcg->migrate_pairs);
+	free_percpu(memcg->migrate_stall);
 	free_percpu(memcg->vmstats_percpu);
 	free_percpu(memcg->vmstats_local);
 	kfree(memcg);
@@ -4931,6 +5792,17 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 	if (!memcg->vmstats_percpu)
 		goto fail;
 
+#ifdef CONFIG_MIGRATION
+	memcg->migrate_pairs = __alloc_percpu(sizeof(struct migrate_pair_stat) *
+					      nr_node_ids * nr_node_ids,
+					      __alignof__(struct migrate_pair_stat));
+	if (!memcg->migrate_pairs)
+		goto fail;
+	memcg->migrate_stall = alloc_percpu(struct migrate_stall_stat);
+	if (!memcg->migrate_stall)
+		goto fail;
+#endif
+
 	for_each_node(node)
 		if (alloc_mem_cgroup_per_node_info(memcg, node))
 			goto fail;
@@ -4981,6 +5853,9 @@ mem_cgroup_css_alloc(struct cgroup_subsys_state *parent_css)
 
 	memcg->high = PAGE_COUNTER_MAX;
 	memcg->soft_limit = PAGE_COUNTER_MAX;
+	memcg->copy_policy = PAGE_COPY_POLICY_DEFAULT;
+	migrate_rate_bucket_init(&memcg->migrate_rate);
+	mem_cgroup_tiering_init(memcg);
 	if (parent) {
 		memcg->swappiness = mem_cgroup_swappiness(parent);
 		memcg->oom_kill_disable = parent->oom_kill_disable;
@@ -5075,6 +5950,7 @@ static void mem_cgroup_css_offline(struct cgroup_subsys_state *css)
 	wb_memcg_offline(memcg);
 
 	drain_all_stock(memcg);
+	mem_cgroup_tiering_stop(memcg);
 
 	mem_cgroup_id_put(memcg);
 }
@@ -6066,6 +6942,9 @@ static int memory_stat_show(struct seq_file *m, void *v)
 		return -ENOMEM;
 	seq_puts(m, buf);
 	kfree(buf);
+#ifdef CONFIG_MIGRATION
+	memcg_migrate_stat_show(m, memcg);
+#endif
 	return 0;
 }
 
@@ -6153,6 +7032,42 @@ static struct cftype memory_files[] = {
 		.seq_show = memory_oom_group_show,
 		.write = memory_oom_group_write,
 	},
+	{
+		.name = "copy_policy",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_copy_policy_show,
+		.write = memory_copy_policy_write,
+	},
+	{
+		.name = "migrate_rate",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_migrate_rate_show,
+		.write = memory_migrate_rate_write,
+	},
+	{
+		.name = "migrate_quiesce",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_migrate_quiesce_show,
+		.write = memory_migrate_quiesce_write,
+	},
+	{
+		.name = "tier_fallback",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_tier_fallback_show,
+		.write = memory_tier_fallback_write,
+	},
+#ifdef CONFIG_MIGRATION
+	{
+		.name = "migrate_stall",
+		.seq_show = memory_migrate_stall_show,
+	},
+#endif
+	{
+		.name = "tier_stat",
+		.flags = CFTYPE_NOT_ON_ROOT,
+		.seq_show = memory_tier_stat_show,
+	},
+	MEMORY_TIERING_FILES,
 	{ }	/* terminate */
 };
 
@@ -6540,8 +7455,16 @@ static void uncharge_page(struct page *page, struct uncharge_gather *ug)
 		unsigned int nr_pages = 1;
 
 		if (PageTransHuge(page)) {
+			unsigned long flags;
+
 			nr_pages = compound_nr(page);
 			ug->nr_huge += nr_pages;
+			/* a batch may span nodes, count the node one now */
+			local_irq_save(flags);
+			__mod_memcg_lruvec_state(mem_cgroup_lruvec(ug->memcg,
+					page_pgdat(page)), NR_ANON_THPS,
+					-nr_pages);
+			local_irq_restore(flags);
 		}
 		if (PageAnon(page))
 			ug->nr_anon += nr_pages;
@@ -6675,6 +7598,98 @@ void mem_cgroup_migrate(struct page *oldpage, struct page *newpage)
 	local_irq_restore(flags);
 }
 
+/**
+ * mem_cgroup_migrate_gather - charge a page's replacement in a batch
+ * @oldpage: currently circulating page
+ * @newpage: replacement page
+ * @mg: charges of the batch
+ *
+ * Like mem_cgroup_migrate(), but only @newpage->mem_cgroup is set right
+ * away: the counters and statistics of the charges are gathered in @mg for
+ * as long as the new pages go to the same memcg and node, and updated at
+ * once by mem_cgroup_migrate_flush(), which the caller calls at the end of
+ * the batch, before the pages go back to the LRU.
+ */
+void mem_cgroup_migrate_gather(struct page *oldpage, struct page *newpage,
+		struct mem_cgroup_migrate_gather *mg)
+{
+	struct mem_cgroup *memcg;
+	unsigned int nr_pages;
+
+	VM_BUG_ON_PAGE(!PageLocked(oldpage), oldpage);
+	VM_BUG_ON_PAGE(!PageLocked(newpage), newpage);
+	VM_BUG_ON_PAGE(PageAnon(oldpage) != PageAnon(newpage), newpage);
+	VM_BUG_ON_PAGE(PageTransHuge(oldpage) != PageTransHuge(newpage),
+		       newpage);
+
+	if (mem_cgroup_disabled())
+		return;
+
+	if (newpage->mem_cgroup)
+		return;
+
+	memcg = oldpage->mem_cgroup;
+	if (!memcg)
+		return;
+
+	if (mg->memcg != memcg || mg->nid != page_to_nid(newpage)) {
+		mem_cgroup_migrate_flush(mg);
+		mg->memcg = memcg;
+		mg->nid = page_to_nid(newpage);
+	}
+
+	/* the charge is counted by the flush, @oldpage pins @memcg until */
+	commit_charge(newpage, memcg, false);
+
+	nr_pages = hpage_nr_pages(newpage);
+	if (PageTransHuge(newpage))
+		mg->nr_huge += nr_pages;
+	if (PageAnon(newpage)) {
+		mg->nr_anon += nr_pages;
+	} else {
+		mg->nr_file += nr_pages;
+		if (PageSwapBacked(newpage))
+			mg->nr_shmem += nr_pages;
+	}
+	mg->pgpgin++;
+	mg->dummy_page = newpage;
+}
+
+/**
+ * mem_cgroup_migrate_flush - commit the charges of a batch of migrations
+ * @mg: charges gathered by mem_cgroup_migrate_gather()
+ */
+void mem_cgroup_migrate_flush(struct mem_cgroup_migrate_gather *mg)
+{
+	unsigned long nr_pages = mg->nr_anon + mg->nr_file;
+	struct mem_cgroup *memcg = mg->memcg;
+	unsigned long flags;
+
+	if (!nr_pages)
+		goto out;
+
+	page_counter_charge(&memcg->memory, nr_pages);
+	if (do_memsw_account())
+		page_counter_charge(&memcg->memsw, nr_pages);
+	css_get_many(&memcg->css, nr_pages);
+
+	local_irq_save(flags);
+	__mod_memcg_state(memcg, MEMCG_RSS, mg->nr_anon);
+	__mod_memcg_state(memcg, MEMCG_CACHE, mg->nr_file);
+	__mod_memcg_state(memcg, NR_SHMEM, mg->nr_shmem);
+	if (mg->nr_huge) {
+		__mod_memcg_state(memcg, MEMCG_RSS_HUGE, mg->nr_huge);
+		__mod_memcg_lruvec_state(mem_cgroup_lruvec(memcg,
+				NODE_DATA(mg->nid)), NR_ANON_THPS, mg->nr_huge);
+	}
+	__count_memcg_events(memcg, PGPGIN, mg->pgpgin);
+	__this_cpu_add(memcg->vmstats_percpu->nr_page_events, nr_pages);
+	memcg_check_events(memcg, mg->dummy_page);
+	local_irq_restore(flags);
+out:
+	memset(mg, 0, sizeof(*mg));
+}
+
 DEFINE_STATIC_KEY_FALSE(memcg_sockets_enabled_key);
 EXPORT_SYMBOL(memcg_sockets_enabled_key);
 
@@ -7193,8 +8208,193 @@ static ssize_t memory_per_node_max_write(struct kernfs_open_file *of,
 	return nbytes;
 }
 
+/*
+ * min_at_node and low_at_node are the inverse of max_at_node: floors below
+ * which demotions leave the pages of a memcg on a node where they are, so
+ * that a latency critical tenant keeps its fast tier memory whatever the
+ * promotions of the others. Every demotion path honours min_at_node, all
+ * but the reclaim that found nothing else to reclaim honour low_at_node,
+ * as for memory.min and memory.low. Like max_at_node they count the pages
+ * of the memcg itself, not those of its descendants.
+ */
+static int memory_per_node_floor_show(struct seq_file *m,
+		unsigned long floor)
+{
+	if (floor == PAGE_COUNTER_MAX)
+		seq_puts(m, "max\n");
+	else
+		seq_printf(m, "%llu\n", (u64)floor * PAGE_SIZE);
+
+	return 0;
+}
+
+static int memory_per_node_min_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	int nid = seq_cft(m)->numa_node_id;
+
+	return memory_per_node_floor_show(m,
+			READ_ONCE(memcg->nodeinfo[nid]->min_nr_base_pages));
+}
+
+static int memory_per_node_low_show(struct seq_file *m, void *v)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(seq_css(m));
+	int nid = seq_cft(m)->numa_node_id;
+
+	return memory_per_node_floor_show(m,
+			READ_ONCE(memcg->nodeinfo[nid]->low_nr_base_pages));
+}
+
+static ssize_t memory_per_node_floor_write(struct kernfs_open_file *of,
+		char *buf, size_t nbytes, bool low)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_css(of_css(of));
+	struct mem_cgroup_per_node *pn = memcg->nodeinfo[of_cft(of)->numa_node_id];
+	unsigned long floor;
+	int err;
+
+	buf = strstrip(buf);
+	err = page_counter_memparse(buf, "max", &floor);
+	if (err)
+		return err;
+
+	if (low)
+		xchg(&pn->low_nr_base_pages, floor);
+	else
+		xchg(&pn->min_nr_base_pages, floor);
+
+	return nbytes;
+}
+
+static ssize_t memory_per_node_min_write(struct kernfs_open_file *of,
+				char *buf, size_t nbytes, loff_t off)
+{
+	return memory_per_node_floor_write(of, buf, nbytes, false);
+}
+
+static ssize_t memory_per_node_low_write(struct kernfs_open_file *of,
+				char *buf, size_t nbytes, loff_t off)
+{
+	return memory_per_node_floor_write(of, buf, nbytes, true);
+}
+
+/*
+ * Base pages of @memcg on @nid that can be demoted without going below its
+ * min_at_node there, nor below its low_at_node with @low. ULONG_MAX when
+ * there is no floor.
+ */
+unsigned long mem_cgroup_node_demotable(struct mem_cgroup *memcg, int nid,
+		bool low)
+{
+	struct mem_cgroup_per_node *pn;
+	unsigned long floor, size;
+
+	if (!memcg || mem_cgroup_disabled() || mem_cgroup_is_root(memcg))
+		return ULONG_MAX;
+
+	pn = memcg->nodeinfo[nid];
+	floor = READ_ONCE(pn->min_nr_base_pages);
+	if (low)
+		floor = max(floor, READ_ONCE(pn->low_nr_base_pages));
+	if (!floor)
+		return ULONG_MAX;
+
+	size = memcg_size_node(memcg, nid);
+	return size > floor ? size - floor : 0;
+}
+
+/*
+ * Whether demoting @page, isolated or locked, would take its memcg below
+ * its floor on the node of @page, see mem_cgroup_node_demotable().
+ */
+bool mem_cgroup_demotion_protected(struct page *page, bool low)
+{
+	if (mem_cgroup_disabled())
+		return false;
+
+	return mem_cgroup_node_demotable(page->mem_cgroup, page_to_nid(page),
+					 low) < hpage_nr_pages(page);
+}
+
+/*
+ * mem_cgroup_demotion_protected() for a page about to join the batch of
+ * demotions @db: what its memcg can demote on its node is read once for a
+ * run of pages of the same memcg and node, and the pages already in the
+ * batch are taken out of it, so that the whole batch stays above the
+ * floor. Called with @page isolated or locked.
+ */
+bool mem_cgroup_demotion_batch_protected(struct mem_cgroup_demotion_batch *db,
+		struct page *page)
+{
+	unsigned long nr_pages = hpage_nr_pages(page);
+
+	if (mem_cgroup_disabled())
+		return false;
+
+	if (page->mem_cgroup != db->memcg || page_to_nid(page) != db->nid) {
+		db->memcg = page->mem_cgroup;
+		db->nid = page_to_nid(page);
+		db->demotable = mem_cgroup_node_demotable(db->memcg, db->nid,
+							  db->low);
+	}
+
+	if (db->demotable < nr_pages)
+		return true;
+	if (db->demotable != ULONG_MAX)
+		db->demotable -= nr_pages;
+	return false;
+}
+
+static bool mem_cgroup_node_full(struct mem_cgroup *memcg, int nid,
+		unsigned long nr_pages)
+{
+	unsigned long max = READ_ONCE(memcg->nodeinfo[nid]->max_nr_base_pages);
+
+	if (max == PAGE_COUNTER_MAX)
+		return false;
+
+	return memcg_size_node(memcg, nid) + nr_pages > max;
+}
+
+/*
+ * The first node from @nid down the tiers on which @memcg has room for
+ * @nr_pages more base pages within its max_at_node, NUMA_NO_NODE when no
+ * tier has room.
+ */
+int mem_cgroup_budget_node(struct mem_cgroup *memcg, int nid,
+		unsigned long nr_pages)
+{
+	int target = nid;
+
+	if (mem_cgroup_is_root(memcg))
+		return nid;
+
+	while (target != NUMA_NO_NODE &&
+	       mem_cgroup_node_full(memcg, target, nr_pages))
+		target = node_demotion_target(target);
+
+	return target;
+}
+
+/*
+ * Node to allocate @nr_pages base pages of @memcg on in place of @nid:
+ * @nid while it stays within the max_at_node of @memcg, or else the next
+ * tier down that does, so that the pages do not have to be demoted by the
+ * next mm_manage() cycle. @nid when no tier has room.
+ */
+int mem_cgroup_spill_node(struct mem_cgroup *memcg, int nid,
+		unsigned long nr_pages)
+{
+	int target = mem_cgroup_budget_node(memcg, nid, nr_pages);
+
+	return target == NUMA_NO_NODE ? nid : target;
+}
+
 static struct cftype memcg_per_node_stats_files[MAX_NUMNODES];
 static struct cftype memcg_per_node_max_files[MAX_NUMNODES];
+static struct cftype memcg_per_node_min_files[MAX_NUMNODES];
+static struct cftype memcg_per_node_low_files[MAX_NUMNODES];
 
 static int __init mem_cgroup_per_node_init(void)
 {
@@ -7213,11 +8413,29 @@ static int __init mem_cgroup_per_node_init(void)
 		memcg_per_node_max_files[nid].seq_show = memory_per_node_max_show;
 		memcg_per_node_max_files[nid].write = memory_per_node_max_write;
 		memcg_per_node_max_files[nid].numa_node_id = nid;
+
+		snprintf(memcg_per_node_min_files[nid].name, MAX_CFTYPE_NAME,
+				"min_at_node:%d", nid);
+		memcg_per_node_min_files[nid].flags = CFTYPE_NOT_ON_ROOT;
+		memcg_per_node_min_files[nid].seq_show = memory_per_node_min_show;
+		memcg_per_node_min_files[nid].write = memory_per_node_min_write;
+		memcg_per_node_min_files[nid].numa_node_id = nid;
+
+		snprintf(memcg_per_node_low_files[nid].name, MAX_CFTYPE_NAME,
+				"low_at_node:%d", nid);
+		memcg_per_node_low_files[nid].flags = CFTYPE_NOT_ON_ROOT;
+		memcg_per_node_low_files[nid].seq_show = memory_per_node_low_show;
+		memcg_per_node_low_files[nid].write = memory_per_node_low_write;
+		memcg_per_node_low_files[nid].numa_node_id = nid;
 	}
 	WARN_ON(cgroup_add_dfl_cftypes(&memory_cgrp_subsys,
 				memcg_per_node_stats_files));
 	WARN_ON(cgroup_add_dfl_cftypes(&memory_cgrp_subsys,
 				memcg_per_node_max_files));
+	WARN_ON(cgroup_add_dfl_cftypes(&memory_cgrp_subsys,
+				memcg_per_node_min_files));
+	WARN_ON(cgroup_add_dfl_cftypes(&memory_cgrp_subsys,
+				memcg_per_node_low_files));
 	return 0;
 }
 subsys_initcall(mem_cgroup_per_node_init);
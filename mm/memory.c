@@ -952,11 +952,111 @@ static inline int copy_p4d_range(struct mm_struct *dst_mm, struct mm_struct *src
 	return 0;
 }
 
-int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
-		struct vm_area_struct *vma)
+static int copy_pgd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		struct vm_area_struct *vma, unsigned long addr,
+		unsigned long end)
 {
 	pgd_t *src_pgd, *dst_pgd;
 	unsigned long next;
+
+	dst_pgd = pgd_offset(dst_mm, addr);
+	src_pgd = pgd_offset(src_mm, addr);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(src_pgd))
+			continue;
+		if (unlikely(copy_p4d_range(dst_mm, src_mm, dst_pgd, src_pgd,
+					    vma, addr, next)))
+			return -ENOMEM;
+	} while (dst_pgd++, src_pgd++, addr = next, addr != end);
+
+	return 0;
+}
+
+/*
+ * Parallel page table copy at fork.
+ *
+ * Copying the page tables of a terabyte address space takes the parent
+ * seconds, more with its page tables on a slow tier node. With
+ * vm.fork_copy_parallel_mb set, the mappings of at least
+ * FORK_COPY_PARALLEL_MIN of an address space of at least that many MB are
+ * split in PMD ranges and copied by the copy workers of the node the
+ * parent runs on, see copy_page_run_ranges(). Two workers never share a
+ * page table page of the child below the PMD level, and the upper levels
+ * are populated under the page table lock as they are by concurrent
+ * faults. The parent holds mmap_sem of both mms for writing meanwhile.
+ * The workers charge the page tables they allocate to the memcg of the
+ * child, as the parent does for its own range.
+ */
+
+// Size of an address space from which fork copies page tables in parallel, in MB, 0 for never
+int sysctl_fork_copy_parallel_mb = 0;
+
+/* smallest mapping whose page tables the copy workers copy */
+#define FORK_COPY_PARALLEL_MIN	(PTRS_PER_PMD * PMD_SIZE)
+
+struct fork_copy_args {
+	struct mm_struct *dst_mm;
+	struct mm_struct *src_mm;
+	struct vm_area_struct *vma;
+	unsigned long base;	/* PMD aligned start of the first range */
+	struct task_struct *parent;
+	struct mem_cgroup *memcg;
+	int ret;
+};
+
+static void fork_copy_range(void *arg, int start, int end)
+{
+	struct fork_copy_args *args = arg;
+	struct vm_area_struct *vma = args->vma;
+	unsigned long addr = max(args->base + start * PMD_SIZE, vma->vm_start);
+	unsigned long next = min(args->base + end * PMD_SIZE, vma->vm_end);
+	bool worker = current != args->parent;
+
+	if (addr >= next)
+		return;
+
+	if (worker)
+		memalloc_use_memcg(args->memcg);
+	if (copy_pgd_range(args->dst_mm, args->src_mm, vma, addr, next))
+		WRITE_ONCE(args->ret, -ENOMEM);
+	if (worker)
+		memalloc_unuse_memcg();
+}
+
+static bool fork_copy_parallel(struct mm_struct *src_mm,
+		struct vm_area_struct *vma)
+{
+	unsigned long mb = READ_ONCE(sysctl_fork_copy_parallel_mb);
+
+	if (!mb || vma->vm_end - vma->vm_start < FORK_COPY_PARALLEL_MIN)
+		return false;
+	return src_mm->total_vm >= mb << (20 - PAGE_SHIFT);
+}
+
+static int copy_page_range_parallel(struct mm_struct *dst_mm,
+		struct mm_struct *src_mm, struct vm_area_struct *vma)
+{
+	struct fork_copy_args args = {
+		.dst_mm	= dst_mm,
+		.src_mm	= src_mm,
+		.vma	= vma,
+		.base	= vma->vm_start & PMD_MASK,
+		.parent	= current,
+		.memcg	= get_mem_cgroup_from_mm(dst_mm),
+	};
+
+	copy_page_run_ranges(numa_node_id(),
+			DIV_ROUND_UP(vma->vm_end - args.base, PMD_SIZE),
+			fork_copy_range, &args);
+	mem_cgroup_put(args.memcg);
+
+	return args.ret;
+}
+
+int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		struct vm_area_struct *vma)
+{
 	unsigned long addr = vma->vm_start;
 	unsigned long end = vma->vm_end;
 	struct mmu_notifier_range range;
@@ -1000,19 +1100,10 @@ int copy_page_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		mmu_notifier_invalidate_range_start(&range);
 	}
 
-	ret = 0;
-	dst_pgd = pgd_offset(dst_mm, addr);
-	src_pgd = pgd_offset(src_mm, addr);
-	do {
-		next = pgd_addr_end(addr, end);
-		if (pgd_none_or_clear_bad(src_pgd))
-			continue;
-		if (unlikely(copy_p4d_range(dst_mm, src_mm, dst_pgd, src_pgd,
-					    vma, addr, next))) {
-			ret = -ENOMEM;
-			break;
-		}
-	} while (dst_pgd++, src_pgd++, addr = next, addr != end);
+	if (fork_copy_parallel(src_mm, vma))
+		ret = copy_page_range_parallel(dst_mm, src_mm, vma);
+	else
+		ret = copy_pgd_range(dst_mm, src_mm, vma, addr, end);
 
 	if (is_cow)
 		mmu_notifier_invalidate_range_end(&range);
@@ -2976,9 +3067,15 @@ vm_fault_t do_swap_page(struct vm_fault *vmf)
 
 		if (si->flags & SWP_SYNCHRONOUS_IO &&
 				__swap_count(entry) == 1) {
+			int nid = swapin_fault_node(si, vmf);
+
 			/* skip swapcache */
-			page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma,
-							vmf->address);
+			if (nid == NUMA_NO_NODE)
+				page = alloc_page_vma(GFP_HIGHUSER_MOVABLE, vma,
+						      vmf->address);
+			else
+				page = alloc_pages_node(nid,
+						GFP_HIGHUSER_MOVABLE, 0);
 			if (page) {
 				__SetPageLocked(page);
 				__SetPageSwapBacked(page);
@@ -3157,6 +3254,7 @@ static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 	struct page *page;
 	vm_fault_t ret = 0;
 	pte_t entry;
+	int nid;
 
 	/* File mapping without ->vm_ops ? */
 	if (vma->vm_flags & VM_SHARED)
@@ -3202,7 +3300,18 @@ static vm_fault_t do_anonymous_page(struct vm_fault *vmf)
 	/* Allocate our own private page. */
 	if (unlikely(anon_vma_prepare(vma)))
 		goto oom;
-	page = alloc_zeroed_user_highpage_movable(vma, vmf->address);
+	page = NULL;
+	nid = tier_site_fault_node(vma);
+	if (nid != NUMA_NO_NODE) {
+		/* a cold region, see mm/tier_site.c */
+		page = alloc_pages_node(nid, (GFP_HIGHUSER_MOVABLE &
+					~__GFP_RECLAIM) | __GFP_THISNODE |
+					__GFP_NOWARN, 0);
+		if (page)
+			clear_user_highpage(page, vmf->address);
+	}
+	if (!page)
+		page = alloc_zeroed_user_highpage_movable(vma, vmf->address);
 	if (!page)
 		goto oom;
 
@@ -3847,6 +3956,99 @@ static int numa_migrate_prep(struct page *page, struct vm_area_struct *vma,
 	return mpol_misplaced(page, vma, addr);
 }
 
+/*
+ * Whether @nid has room for a replica: replicas only come from memory
+ * above the high watermark, they never make kswapd run there.
+ */
+static bool numa_replicate_room(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int z;
+
+	for (z = pgdat->nr_zones - 1; z >= 0; z--) {
+		struct zone *zone = pgdat->node_zones + z;
+
+		if (populated_zone(zone) &&
+		    zone_watermark_ok(zone, 0, high_wmark_pages(zone) + 1,
+				      ZONE_MOVABLE, 0))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Replace the mapping @pte of the shared file page @page by a private copy
+ * on @nid, see numa_replicate_vma(). The copy is an anonymous page like
+ * the one a write would have made, so a later write reuses it. Until then
+ * it is clean and lazily freed, as after MADV_FREE: reclaim drops it
+ * without swap and the next fault maps the file page again. It is only
+ * made from free memory above the high watermark and charged without
+ * reclaim. The caller keeps its reference on @page.
+ */
+static bool numa_replicate_page(struct vm_fault *vmf, struct page *page,
+				pte_t pte, int nid)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct mm_struct *mm = vma->vm_mm;
+	struct mmu_notifier_range range;
+	struct mem_cgroup *memcg;
+	struct page *new_page;
+	bool replicated = false;
+
+	if (!numa_replicate_room(nid) || unlikely(anon_vma_prepare(vma)))
+		return false;
+
+	new_page = alloc_pages_node(nid, (GFP_HIGHUSER_MOVABLE & ~__GFP_RECLAIM) |
+				    __GFP_THISNODE | __GFP_NOWARN, 0);
+	if (!new_page)
+		return false;
+	if (mem_cgroup_try_charge(new_page, mm, GFP_NOWAIT | __GFP_NOWARN,
+				  &memcg, false)) {
+		put_page(new_page);
+		return false;
+	}
+	copy_user_highpage(new_page, page, vmf->address, vma);
+	__SetPageUptodate(new_page);
+
+	mmu_notifier_range_init(&range, MMU_NOTIFY_CLEAR, 0, vma, mm,
+				vmf->address & PAGE_MASK,
+				(vmf->address & PAGE_MASK) + PAGE_SIZE);
+	mmu_notifier_invalidate_range_start(&range);
+
+	vmf->pte = pte_offset_map_lock(mm, vmf->pmd, vmf->address, &vmf->ptl);
+	if (likely(pte_same(*vmf->pte, pte))) {
+		pte_t entry = pte_mkyoung(mk_pte(new_page, vma->vm_page_prot));
+
+		dec_mm_counter_fast(mm, mm_counter_file(page));
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		flush_cache_page(vma, vmf->address, pte_pfn(pte));
+		ptep_clear_flush_notify(vma, vmf->address, vmf->pte);
+		page_add_new_anon_rmap(new_page, vma, vmf->address, false);
+		mem_cgroup_commit_charge(new_page, memcg, false, false);
+		/* on the file LRU, see mark_page_lazyfree() */
+		ClearPageSwapBacked(new_page);
+		lru_cache_add_active_or_unevictable(new_page, vma);
+		set_pte_at_notify(mm, vmf->address, vmf->pte, entry);
+		update_mmu_cache(vma, vmf->address, vmf->pte);
+		/* as in wp_page_copy(), after the flush of the old pte */
+		page_remove_rmap(page, false);
+		replicated = true;
+	}
+	pte_unmap_unlock(vmf->pte, vmf->ptl);
+	mmu_notifier_invalidate_range_only_end(&range);
+
+	if (replicated) {
+		/* the reference of the old pte */
+		put_page(page);
+		count_vm_numa_event(NUMA_PAGE_REPLICATE);
+	} else {
+		mem_cgroup_cancel_charge(new_page, memcg, false);
+		put_page(new_page);
+	}
+
+	return replicated;
+}
+
 static vm_fault_t do_numa_page(struct vm_fault *vmf)
 {
 	struct vm_area_struct *vma = vmf->vma;
@@ -3913,8 +4115,9 @@ static vm_fault_t do_numa_page(struct vm_fault *vmf)
 	if (page_mapcount(page) > 1 && (vma->vm_flags & VM_SHARED))
 		flags |= TNF_SHARED;
 
-	last_cpupid = page_cpupid_last(page);
 	page_nid = page_to_nid(page);
+	/* a slow tier page keeps its scan time there, see numa_scan_mark_page() */
+	last_cpupid = node_is_slow_tier(page_nid) ? -1 : page_cpupid_last(page);
 	target_nid = numa_migrate_prep(page, vma, vmf->address, page_nid,
 			&flags);
 	pte_unmap_unlock(vmf->pte, vmf->ptl);
@@ -3923,6 +4126,19 @@ static vm_fault_t do_numa_page(struct vm_fault *vmf)
 		goto out;
 	}
 
+	/* A shared page of a binary gets a local copy rather than moving */
+	if (page_mapcount(page) > 1 && !PageAnon(page) &&
+	    !node_is_slow_tier(target_nid) && numa_replicate_vma(vma)) {
+		migrated = numa_replicate_page(vmf, page, pte, target_nid);
+		put_page(page);
+		if (migrated) {
+			page_nid = target_nid;
+			flags |= TNF_MIGRATED;
+		} else
+			flags |= TNF_MIGRATE_FAIL;
+		goto out;
+	}
+
 	/* Migrate to the requested node */
 	migrated = migrate_misplaced_page(page, vma, target_nid);
 	if (migrated) {
@@ -4739,6 +4955,9 @@ void clear_huge_page(struct page *page,
 		return;
 	}
 
+	if (clear_huge_page_nt(page, addr_hint, pages_per_huge_page))
+		return;
+
 	process_huge_page(addr_hint, pages_per_huge_page, clear_subpage, page);
 }
 
@@ -4793,6 +5012,10 @@ void copy_user_huge_page(struct page *dst, struct page *src,
 		return;
 	}
 
+	if (copy_user_huge_page_mt(dst, src, addr_hint, vma,
+				   pages_per_huge_page))
+		return;
+
 	process_huge_page(addr_hint, pages_per_huge_page, copy_subpage, &arg);
 }
 
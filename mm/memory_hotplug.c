@@ -36,6 +36,8 @@
 #include <linux/memblock.h>
 #include <linux/compaction.h>
 #include <linux/rmap.h>
+#include <linux/memory_tier.h>
+#include <linux/mempolicy.h>
 
 #include <asm/tlbflush.h>
 
@@ -671,6 +673,91 @@ static void __meminit resize_pgdat_range(struct pglist_data *pgdat, unsigned lon
 	pgdat->node_spanned_pages = max(start_pfn + nr_pages, old_end_pfn) - pgdat->node_start_pfn;
 
 }
+
+/* fewest pages of memmap a worker initializes */
+#define MEMMAP_INIT_MIN_PAGES	PAGES_PER_SECTION
+
+struct memmap_init_work {
+	struct work_struct work;
+	unsigned long start_pfn;
+	unsigned long nr_pages;
+	int nid;
+	unsigned long zone_idx;
+};
+
+static void memmap_init_work_fn(struct work_struct *work)
+{
+	struct memmap_init_work *w = container_of(work,
+			struct memmap_init_work, work);
+
+	memmap_init_zone(w->nr_pages, w->nid, w->zone_idx, w->start_pfn,
+			MEMMAP_HOTPLUG, NULL);
+}
+
+/* The node whose CPUs initialize the memmap of @nid */
+static int memmap_init_cpu_node(int nid)
+{
+	if (node_state(nid, N_CPU))
+		return nid;
+#ifdef CONFIG_MIGRATION
+	return pmem_nearest_node(nid);
+#else
+	return NUMA_NO_NODE;
+#endif
+}
+
+/*
+ * Initialize the memmap of a hot-added range. Onlining holds
+ * mem_hotplug_lock, so the memory blocks of a large PMEM range are onlined
+ * one after the other and writing their struct pages is most of the time
+ * it takes. Split it over workers on the CPUs of the node, or of the
+ * nearest socket for a CPU-less node, each initializing whole pageblocks.
+ */
+static void memmap_init_hotplug(unsigned long nr_pages, int nid,
+		unsigned long zone_idx, unsigned long start_pfn,
+		struct vmem_altmap *altmap)
+{
+	unsigned long end_pfn = start_pfn + nr_pages;
+	unsigned long pfn, chunk;
+	struct memmap_init_work *works;
+	int cpu_nid = memmap_init_cpu_node(nid);
+	int nr_workers, i;
+
+	nr_workers = cpu_nid != NUMA_NO_NODE ?
+		cpumask_weight(cpumask_of_node(cpu_nid)) : num_online_cpus();
+	nr_workers = min_t(unsigned long, nr_workers,
+			   nr_pages / MEMMAP_INIT_MIN_PAGES);
+	if (zone_idx == ZONE_DEVICE || nr_workers < 2)
+		goto serial;
+
+	works = kmalloc_array(nr_workers, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		goto serial;
+
+	/* the workers see it covers their ranges and leave it alone */
+	if (highest_memmap_pfn < end_pfn - 1)
+		highest_memmap_pfn = end_pfn - 1;
+
+	chunk = round_up(DIV_ROUND_UP(nr_pages, nr_workers), pageblock_nr_pages);
+	for (i = 0, pfn = start_pfn; pfn < end_pfn; i++, pfn += chunk) {
+		works[i].start_pfn = pfn;
+		works[i].nr_pages = min(chunk, end_pfn - pfn);
+		works[i].nid = nid;
+		works[i].zone_idx = zone_idx;
+		INIT_WORK(&works[i].work, memmap_init_work_fn);
+		queue_work_node(cpu_nid, system_unbound_wq, &works[i].work);
+	}
+	while (i--)
+		flush_work(&works[i].work);
+
+	kfree(works);
+	return;
+
+serial:
+	memmap_init_zone(nr_pages, nid, zone_idx, start_pfn, MEMMAP_HOTPLUG,
+			altmap);
+}
+
 /*
  * Associate the pfn range with the given zone, initializing the memmaps
  * and resizing the pgdat/zone data to span the added pages. After this
@@ -701,8 +788,7 @@ void __ref move_pfn_range_to_zone(struct zone *zone, unsigned long start_pfn,
 	 * expects the zone spans the pfn range. All the pages in the range
 	 * are reserved so nobody should be touching them so we should be safe
 	 */
-	memmap_init_zone(nr_pages, nid, zone_idx(zone), start_pfn,
-			MEMMAP_HOTPLUG, altmap);
+	memmap_init_hotplug(nr_pages, nid, zone_idx(zone), start_pfn, altmap);
 
 	set_zone_contiguous(zone);
 }
@@ -988,16 +1074,20 @@ static int check_hotplug_memory_range(u64 start, u64 size)
 
 static int online_memory_block(struct memory_block *mem, void *arg)
 {
+	int *online_type = arg;
+
+	/* mem->online_type is protected by device_hotplug_lock */
+	if (mem->state == MEM_OFFLINE)
+		mem->online_type = *online_type;
 	return device_online(&mem->dev);
 }
 
 /*
- * NOTE: The caller must call lock_device_hotplug() to serialize hotplug
- * and online/offline operations (triggered e.g. by sysfs).
- *
- * we are OK calling __meminit stuff here - we have CONFIG_MEMORY_HOTPLUG
+ * Add the memory of @res to @nid and online it as @online_type, leave it
+ * offline for MMOP_OFFLINE.
  */
-int __ref add_memory_resource(int nid, struct resource *res)
+static int __ref __add_memory_resource(int nid, struct resource *res,
+		int online_type)
 {
 	struct mhp_restrictions restrictions = {};
 	u64 start, size;
@@ -1060,8 +1150,9 @@ int __ref add_memory_resource(int nid, struct resource *res)
 	mem_hotplug_done();
 
 	/* online pages if requested */
-	if (memhp_auto_online)
-		walk_memory_blocks(start, size, NULL, online_memory_block);
+	if (online_type != MMOP_OFFLINE)
+		walk_memory_blocks(start, size, &online_type,
+				   online_memory_block);
 
 	return ret;
 error:
@@ -1073,6 +1164,18 @@ int __ref add_memory_resource(int nid, struct resource *res)
 	return ret;
 }
 
+/*
+ * NOTE: The caller must call lock_device_hotplug() to serialize hotplug
+ * and online/offline operations (triggered e.g. by sysfs).
+ *
+ * we are OK calling __meminit stuff here - we have CONFIG_MEMORY_HOTPLUG
+ */
+int add_memory_resource(int nid, struct resource *res)
+{
+	return __add_memory_resource(nid, res, memhp_auto_online ?
+				     MMOP_ONLINE_KEEP : MMOP_OFFLINE);
+}
+
 /* requires device_hotplug_lock, see add_memory_resource() */
 int __ref __add_memory(int nid, u64 start, u64 size)
 {
@@ -1101,6 +1204,33 @@ int add_memory(int nid, u64 start, u64 size)
 }
 EXPORT_SYMBOL_GPL(add_memory);
 
+/*
+ * add_memory() onlining the memory as @online_type whatever
+ * memhp_auto_online says, for drivers that know which zone their memory
+ * belongs in.
+ */
+int add_memory_online(int nid, u64 start, u64 size, int online_type)
+{
+	struct resource *res;
+	int rc;
+
+	lock_device_hotplug();
+	res = register_memory_resource(start, size);
+	if (IS_ERR(res)) {
+		rc = PTR_ERR(res);
+		goto out;
+	}
+
+	rc = __add_memory_resource(nid, res, online_type);
+	if (rc < 0)
+		release_memory_resource(res);
+out:
+	unlock_device_hotplug();
+
+	return rc;
+}
+EXPORT_SYMBOL_GPL(add_memory_online);
+
 #ifdef CONFIG_MEMORY_HOTREMOVE
 /*
  * A free page on the buddy free lists (not the per-cpu lists) has PageBuddy
@@ -1266,10 +1396,85 @@ static struct page *new_node_page(struct page *page, unsigned long private)
 	return new_page_nodemask(page, nid, &nmask);
 }
 
+// Copy mode of memory offlining: 0 serial, 1 concurrent multi-threaded, 2 concurrent MT+DMA
+int sysctl_memory_offline_migrate = 1;
+
+/* base pages isolated per offlining migration batch */
+#define OFFLINE_MIGRATE_BATCH	(256UL << (20 - PAGE_SHIFT))
+/* how often the progress of a long offlining is reported */
+#define OFFLINE_REPORT_INTERVAL	(10 * HZ)
+
+/* Progress of the migrations of one __offline_pages() */
+struct offline_progress {
+	unsigned long start_pfn;
+	unsigned long end_pfn;
+	int nid;
+	unsigned long nr_isolated;	/* base pages */
+	unsigned long nr_failed;	/* pages */
+	u64 start_ns;
+	unsigned long next_report;
+};
+
+static void offline_progress_report(struct offline_progress *op)
+{
+	u64 ms = div_u64(ktime_get_ns() - op->start_ns, NSEC_PER_MSEC);
+
+	pr_info("Offlining [mem %#010llx-%#010llx]: %lu MB migrated, %lu pages failed, %llu MB/s\n",
+		(unsigned long long) op->start_pfn << PAGE_SHIFT,
+		((unsigned long long) op->end_pfn << PAGE_SHIFT) - 1,
+		op->nr_isolated >> (20 - PAGE_SHIFT), op->nr_failed,
+		ms ? div_u64((u64)(op->nr_isolated >> (20 - PAGE_SHIFT)) *
+			     MSEC_PER_SEC, ms) : 0);
+}
+
+/*
+ * Migrate a batch of pages off the range being offlined, with the
+ * concurrent multi-threaded copy unless vm.memory_offline_migrate is 0.
+ * Pages leaving a slow tier node are copied on the socket of the node.
+ */
+static int offline_migrate_batch(struct list_head *source,
+		unsigned long nr_pages, struct offline_progress *op)
+{
+	int mode = READ_ONCE(sysctl_memory_offline_migrate);
+	struct page *page;
+	int flags = 0;
+	int ret;
+
+	if (mode)
+		flags |= MPOL_MF_MOVE_MT | MPOL_MF_MOVE_CONCUR;
+	if (mode > 1)
+		flags |= MPOL_MF_MOVE_DMA;
+	if (node_is_slow_tier(op->nid))
+		flags |= MPOL_MF_COPY_RPDAA;
+
+	/* Allocate a new page from the nearest neighbor node */
+	ret = migrate_pages_flags(NULL, source, new_node_page, NULL, 0, flags,
+				  MR_MEMORY_HOTPLUG);
+	if (ret) {
+		list_for_each_entry(page, source, lru) {
+			pr_warn("migrating pfn %lx failed ret:%d ",
+			       page_to_pfn(page), ret);
+			dump_page(page, "migration failure");
+		}
+		putback_movable_pages(source);
+	}
+
+	op->nr_isolated += nr_pages;
+	if (ret > 0)
+		op->nr_failed += ret;
+	if (time_after_eq(jiffies, op->next_report)) {
+		offline_progress_report(op);
+		op->next_report = jiffies + OFFLINE_REPORT_INTERVAL;
+	}
+
+	return ret;
+}
+
 static int
-do_migrate_range(unsigned long start_pfn, unsigned long end_pfn)
+do_migrate_range(unsigned long start_pfn, unsigned long end_pfn,
+		struct offline_progress *op)
 {
-	unsigned long pfn;
+	unsigned long pfn, nr_pages = 0;
 	struct page *page;
 	int ret = 0;
 	LIST_HEAD(source);
@@ -1282,7 +1487,8 @@ do_migrate_range(unsigned long start_pfn, unsigned long end_pfn)
 		if (PageHuge(page)) {
 			struct page *head = compound_head(page);
 			pfn = page_to_pfn(head) + compound_nr(head) - 1;
-			isolate_huge_page(head, &source);
+			if (isolate_huge_page(head, &source))
+				nr_pages += compound_nr(head);
 			continue;
 		} else if (PageTransHuge(page))
 			pfn = page_to_pfn(compound_head(page))
@@ -1318,26 +1524,22 @@ do_migrate_range(unsigned long start_pfn, unsigned long end_pfn)
 			if (!__PageMovable(page))
 				inc_node_page_state(page, NR_ISOLATED_ANON +
 						    page_is_file_cache(page));
+			nr_pages += hpage_nr_pages(page);
 
 		} else {
 			pr_warn("failed to isolate pfn %lx\n", pfn);
 			dump_page(page, "isolation failed");
 		}
 		put_page(page);
-	}
-	if (!list_empty(&source)) {
-		/* Allocate a new page from the nearest neighbor node */
-		ret = migrate_pages(&source, new_node_page, NULL, 0,
-					MIGRATE_SYNC, MR_MEMORY_HOTPLUG);
-		if (ret) {
-			list_for_each_entry(page, &source, lru) {
-				pr_warn("migrating pfn %lx failed ret:%d ",
-				       page_to_pfn(page), ret);
-				dump_page(page, "migration failure");
-			}
-			putback_movable_pages(&source);
+
+		if (nr_pages >= OFFLINE_MIGRATE_BATCH) {
+			ret = offline_migrate_batch(&source, nr_pages, op);
+			nr_pages = 0;
+			cond_resched();
 		}
 	}
+	if (!list_empty(&source))
+		ret = offline_migrate_batch(&source, nr_pages, op);
 
 	return ret;
 }
@@ -1460,6 +1662,10 @@ static int __ref __offline_pages(unsigned long start_pfn,
 	unsigned long flags;
 	struct zone *zone;
 	struct memory_notify arg;
+	struct offline_progress progress = {
+		.start_pfn = start_pfn,
+		.end_pfn = end_pfn,
+	};
 	char *reason;
 
 	mem_hotplug_begin();
@@ -1489,6 +1695,9 @@ static int __ref __offline_pages(unsigned long start_pfn,
 		goto failed_removal;
 	}
 	node = zone_to_nid(zone);
+	progress.nid = node;
+	progress.start_ns = ktime_get_ns();
+	progress.next_report = jiffies + OFFLINE_REPORT_INTERVAL;
 
 	/* set above range as isolated */
 	ret = start_isolate_page_range(start_pfn, end_pfn,
@@ -1528,7 +1737,7 @@ static int __ref __offline_pages(unsigned long start_pfn,
 				 * TODO: fatal migration failures should bail
 				 * out
 				 */
-				do_migrate_range(pfn, end_pfn);
+				do_migrate_range(pfn, end_pfn, &progress);
 			}
 		}
 
@@ -1552,6 +1761,8 @@ static int __ref __offline_pages(unsigned long start_pfn,
 	walk_system_ram_range(start_pfn, end_pfn - start_pfn,
 			      &offlined_pages, offline_isolated_pages_cb);
 	pr_info("Offlined Pages %ld\n", offlined_pages);
+	if (progress.nr_isolated)
+		offline_progress_report(&progress);
 	/*
 	 * Onlining will reset pagetype flags and makes migrate type
 	 * MOVABLE, so just need to decrease the number of isolated
@@ -1,5 +1,5 @@
 /*
- * A syscall used to move pages between two nodes.
+ * A syscall used to move pages between memory nodes.
  */
 
 #include <linux/sched/mm.h>
@@ -13,17 +13,143 @@
 #include <linux/rmap.h>
 #include <linux/security.h>
 #include <linux/syscalls.h>
+#include <linux/kthread.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/slab.h>
+#include <linux/prefetch.h>
+#include <linux/access_scan.h>
+#include <linux/migrate_history.h>
+#include <linux/migrate_record.h>
+#include <linux/migrate_stat.h>
+#include <linux/compaction.h>
+#include <linux/memory_tier.h>
+#include <linux/khugepaged.h>
+#include <linux/list_sort.h>
+#include <linux/pagevec.h>
+#include <linux/shmem_fs.h>
 
 #include "internal.h"
 
 int migration_batch_size = 16;
 
+/*
+ * Adaptive batch sizes: with vm.migration_batch_target_us set, the
+ * concurrent migrations and exchanges of mm_manage() size their batches
+ * themselves, separately for base pages and THPs, instead of using
+ * vm.migration_batch_size. The pages of a concurrent batch stay unmapped
+ * from the unmap of the first to the remap of the last, so a batch that
+ * takes longer than the target shrinks the next ones in proportion. A
+ * batch within the target grows the next ones as long as bigger batches
+ * keep moving more pages per second, and shrinks them a little once they
+ * stop paying off. The current sizes are in vm.migration_batch_size_auto.
+ */
+// Target time in us the pages of a concurrent batch stay unmapped, 0 for vm.migration_batch_size
+int sysctl_migration_batch_target_us = 0;
+// Batch sizes of the migrations and exchanges of base pages and THPs
+int migration_batch_size_auto[NR_MIGRATION_BATCH_KINDS] = {
+	[0 ... NR_MIGRATION_BATCH_KINDS - 1] = 16,
+};
+/* pages per second of the last full batch of each kind */
+static u64 migration_batch_rate[NR_MIGRATION_BATCH_KINDS];
+
+#define MIGRATION_BATCH_MAX		1024
+#define MIGRATION_BATCH_MAX_THP		64
+
+static int migration_batch_kind(bool exchange, bool huge)
+{
+	return (exchange ? MIGRATION_BATCH_EXCHANGE : MIGRATION_BATCH_MIGRATE) +
+		huge;
+}
+
+/* Batch size of the next concurrent migration or exchange */
+static int migration_batch(bool exchange, bool huge)
+{
+	if (!READ_ONCE(sysctl_migration_batch_target_us))
+		return READ_ONCE(migration_batch_size);
+
+	return READ_ONCE(migration_batch_size_auto[
+			migration_batch_kind(exchange, huge)]);
+}
+
+/*
+ * Tune the batch size from a batch of @nr pages out of @batch_size that
+ * took @ns. Only full batches tell how the size performs.
+ */
+static void migration_batch_feedback(bool exchange, bool huge, int nr,
+		int batch_size, u64 ns)
+{
+	u64 target = (u64)READ_ONCE(sysctl_migration_batch_target_us) *
+		NSEC_PER_USEC;
+	int kind = migration_batch_kind(exchange, huge);
+	int size = READ_ONCE(migration_batch_size_auto[kind]);
+	u64 rate, last;
+
+	if (!target || !ns || batch_size <= 0 || nr < batch_size)
+		return;
+
+	rate = div64_u64((u64)nr * NSEC_PER_SEC, ns);
+	last = READ_ONCE(migration_batch_rate[kind]);
+
+	if (ns > target)
+		size = div64_u64((u64)size * target, ns);
+	else if (rate * 16 >= last * 15)
+		size *= 2;
+	else
+		size -= size / 4;
+
+	WRITE_ONCE(migration_batch_rate[kind], rate);
+	WRITE_ONCE(migration_batch_size_auto[kind], clamp(size, 1,
+			huge ? MIGRATION_BATCH_MAX_THP : MIGRATION_BATCH_MAX));
+}
+
 enum isolate_action {
 	ISOLATE_COLD_PAGES = 1,
 	ISOLATE_HOT_PAGES,
 	ISOLATE_HOT_AND_COLD_PAGES,
 };
 
+/*
+ * Is @page on @lru wanted by @action? With the accessed bit scanner the
+ * access frequency of the page decides, pages not sampled yet and every
+ * page without the scanner go by their LRU list.
+ */
+static bool isolate_action_wants(struct page *page, enum lru_list lru,
+		enum isolate_action action)
+{
+	int freq;
+
+	if (action == ISOLATE_HOT_AND_COLD_PAGES)
+		return true;
+
+	/* a page sampled hot is hot, the samples miss most pages */
+	if (access_sample_enabled() && page_access_sampled_hot(page))
+		return action == ISOLATE_HOT_PAGES;
+
+	freq = access_scan_enabled() ? page_access_frequency(page) : -1;
+	if (freq < 0)
+		return is_active_lru(lru) == (action == ISOLATE_HOT_PAGES);
+
+	return (freq >= access_scan_hot_threshold()) ==
+		(action == ISOLATE_HOT_PAGES);
+}
+
+/*
+ * mm_manage() isolates at most this many pages per lru_lock hold, so that
+ * isolating from a large memcg does not stall reclaim and page faults on
+ * the node.
+ */
+#define ISOLATE_CHUNK_PAGES	SWAP_CLUSTER_MAX
+
+/* Prefetch the page scanned after @page, the LRU is scanned backwards */
+static inline void prefetchw_prev_lru_page(struct page *page,
+		struct list_head *src)
+{
+	if (page->lru.prev != src)
+		prefetchw(&lru_to_page(&page->lru)->flags);
+}
+
 static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		struct lruvec *lruvec,
 		struct list_head *dst_base_page,
@@ -31,7 +157,8 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		unsigned long *nr_scanned,
 		unsigned long *nr_taken_base_page,
 		unsigned long *nr_taken_huge_page,
-		isolate_mode_t mode, enum lru_list lru)
+		isolate_mode_t mode, enum lru_list lru,
+		enum isolate_action action)
 {
 	struct list_head *src = &lruvec->lists[lru];
 	unsigned long nr_taken = 0;
@@ -47,7 +174,7 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		struct page *page;
 
 		page = lru_to_page(src);
-		/*prefetchw_prev_lru_page(page, src, flags);*/
+		prefetchw_prev_lru_page(page, src);
 
 		VM_BUG_ON_PAGE(!PageLRU(page), page);
 
@@ -58,6 +185,11 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		 * pages, triggering a premature OOM.
 		 */
 		scan++;
+		if (!isolate_action_wants(page, lru, action)) {
+			list_move(&page->lru, &busy_list);
+			continue;
+		}
+
 		switch (__isolate_lru_page(page, mode)) {
 		case 0:
 			nr_pages = hpage_nr_pages(page);
@@ -112,29 +244,52 @@ static unsigned long isolate_pages_from_lru_list(pg_data_t *pgdat,
 		nr_pages = memcg_size_node(memcg, pgdat->node_id);
 
 	for_each_evictable_lru(lru) {
-		unsigned long nr_scanned, nr_taken;
+		unsigned long nr_scanned, nr_taken, nr_lru_scanned = 0;
+		unsigned long nr_lru_pages;
 		int file = is_file_lru(lru);
 
-		if (action == ISOLATE_COLD_PAGES && is_active_lru(lru))
-			continue;
-		if (action == ISOLATE_HOT_PAGES && !is_active_lru(lru))
-			continue;
+		/* the scanner and the samples find hot pages on either list */
+		if (!access_scan_enabled() && !access_sample_enabled()) {
+			if (action == ISOLATE_COLD_PAGES && is_active_lru(lru))
+				continue;
+			if (action == ISOLATE_HOT_PAGES && !is_active_lru(lru))
+				continue;
+		}
+
+		/*
+		 * Skipped pages go back to the head of the list between
+		 * chunks, so scan the list at most once.
+		 */
+		nr_lru_pages = min(nr_pages,
+				lruvec_lru_size(lruvec, lru, MAX_NR_ZONES));
+
+		while (nr_lru_scanned < nr_lru_pages && nr_all_taken < nr_pages) {
+			spin_lock_irq(&pgdat->lru_lock);
+
+			nr_taken = isolate_lru_pages(min3(nr_pages - nr_all_taken,
+						nr_lru_pages - nr_lru_scanned,
+						(unsigned long)ISOLATE_CHUNK_PAGES),
+					lruvec, base_page_list, huge_page_list,
+					&nr_scanned, nr_taken_base_page,
+					nr_taken_huge_page, 0, lru, action);
 
-		spin_lock_irq(&pgdat->lru_lock);
+			__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file,
+					nr_taken);
 
-		nr_taken = isolate_lru_pages(nr_pages, lruvec, base_page_list,
-					huge_page_list, &nr_scanned,
-					nr_taken_base_page,
-					nr_taken_huge_page,
-					0, lru);
+			spin_unlock_irq(&pgdat->lru_lock);
 
-		__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, nr_taken);
+			nr_all_taken += nr_taken;
+			nr_lru_scanned += nr_scanned;
 
-		spin_unlock_irq(&pgdat->lru_lock);
+			if (fatal_signal_pending(current))
+				return nr_all_taken;
+			if (!nr_scanned)
+				break;
 
-		nr_all_taken += nr_taken;
+			cond_resched();
+		}
 
-		if (nr_all_taken > nr_pages)
+		if (nr_all_taken >= nr_pages)
 			break;
 	}
 
@@ -149,12 +304,16 @@ static int migrate_to_node(struct list_head *page_list, int nid,
 	int num = 0;
 	int from_nid = -1;
 	int err;
+	u64 start;
 
 	if (list_empty(page_list))
 		return num;
 
 	while (!list_empty(page_list)) {
 		LIST_HEAD(batch_page_list);
+		unsigned int nr_batch = 0, nr_failed = 0;
+		u64 record_start;
+		u32 batch;
 		int i;
 
 		/* it should move all pages to batch_page_list if !migrate_concur */
@@ -163,14 +322,28 @@ static int migrate_to_node(struct list_head *page_list, int nid,
 			if (!item)
 				break;
 			list_move(&item->lru, &batch_page_list);
+			nr_batch += hpage_nr_pages(item);
 		}
 
 		from_nid = page_to_nid(list_first_entry(&batch_page_list, struct page, lru));
-
-		if (migrate_concur)
+		batch = migrate_record_list(MIGRATE_RECORD_MIGRATE,
+				&batch_page_list, nid);
+		record_start = migrate_record_start();
+		/* THPs split without a free pageblock to go to */
+		if (PageTransHuge(list_first_entry(&batch_page_list,
+						struct page, lru)))
+			compact_proactive_demand(nid, nr_batch);
+
+		if (migrate_concur) {
+			bool huge = PageTransHuge(list_first_entry(&batch_page_list,
+						struct page, lru));
+
+			start = ktime_get_ns();
 			err = migrate_pages_concur(&batch_page_list, alloc_new_node_page,
 				NULL, nid, mode, MR_SYSCALL);
-		else
+			migration_batch_feedback(false, huge, i, batch_size,
+					ktime_get_ns() - start);
+		} else
 			err = migrate_pages(&batch_page_list, alloc_new_node_page,
 				NULL, nid, mode, MR_SYSCALL);
 
@@ -178,10 +351,13 @@ static int migrate_to_node(struct list_head *page_list, int nid,
 			struct page *page;
 
 			list_for_each_entry(page, &batch_page_list, lru)
-				num += hpage_nr_pages(page);
+				nr_failed += hpage_nr_pages(page);
+			num += nr_failed;
 
 			putback_movable_pages(&batch_page_list);
 		}
+		migrate_record_batch(batch, from_nid, nid, nr_batch, nr_failed,
+				record_start);
 	}
 	pr_debug("%d pages failed to migrate from %d to %d\n",
 		num, from_nid, nid);
@@ -256,6 +432,380 @@ static int putback_overflow_pages(unsigned long max_nr_base_pages,
 			huge_page_list, nr_huge_pages);
 }
 
+/*
+ * Candidate ranking: the hot pages isolated for promotion are ordered by
+ * their expected benefit per unit of copy cost, so that the trimming to
+ * the room of the target node and the batches drop the least useful ones.
+ * The benefit of a page is its access level, from the accessed bit
+ * scanner, the access samples or else its LRU list, times the latency gap
+ * between the two nodes. Copying a THP costs less per byte than copying
+ * base pages, one unmap and TLB flush for all of it, and less again when
+ * multi-threaded copy spreads it over several CPUs. With
+ * vm.migration_min_benefit set, pages whose benefit does not reach that
+ * many times their copy cost stay where they are, they would not be hot
+ * long enough to pay back their migration.
+ */
+// Minimum benefit per unit of copy cost of a promotion, 0 promotes every candidate
+int sysctl_migration_min_benefit = 0;
+
+#define MIGRATION_ACCESS_LEVELS		8
+/* copy cost per base page of a base page, a THP and a THP with MT copy */
+#define MIGRATION_COPY_COST_BASE	4
+#define MIGRATION_COPY_COST_THP		2
+#define MIGRATION_COPY_COST_THP_MT	1
+#define MIGRATION_RANKS	(MIGRATION_ACCESS_LEVELS * \
+			 MIGRATION_COPY_COST_BASE / MIGRATION_COPY_COST_THP_MT + 1)
+
+static int migration_access_level(struct page *page)
+{
+	int freq = page_access_frequency(page);
+
+	if (freq >= 0)
+		return freq;
+	if (page_access_sampled_hot(page))
+		return MIGRATION_ACCESS_LEVELS;
+	return PageActive(page) ? MIGRATION_ACCESS_LEVELS / 2 : 0;
+}
+
+/*
+ * Move @page of an isolated list to @putback_list, taking it off
+ * @nr_base_pages or @nr_huge_pages as isolate_lru_pages() counted it.
+ * Returns its number of base pages.
+ */
+static int move_to_putback_list(struct page *page,
+		struct list_head *putback_list, unsigned long *nr_base_pages,
+		unsigned long *nr_huge_pages)
+{
+	int nr_pages = hpage_nr_pages(page);
+
+	list_move_tail(&page->lru, putback_list);
+	if (nr_pages == HPAGE_PMD_NR)
+		*nr_huge_pages -= nr_pages;
+	else
+		*nr_base_pages -= nr_pages;
+
+	return nr_pages;
+}
+
+/*
+ * Put back the pages of @page_list that moved to their node too recently
+ * to move again, see mm/migrate_history.c. Returns how many base pages
+ * it put back.
+ */
+static unsigned long putback_pingpong_pages(struct list_head *page_list,
+		unsigned long *nr_base_pages, unsigned long *nr_huge_pages)
+{
+	unsigned long nr_putback = 0;
+	struct page *page, *next;
+	LIST_HEAD(putback_list);
+
+	list_for_each_entry_safe(page, next, page_list, lru)
+		if (page_migrate_suppress(page) ||
+		    mem_cgroup_migrate_quiesced(page))
+			nr_putback += move_to_putback_list(page, &putback_list,
+					nr_base_pages, nr_huge_pages);
+
+	putback_movable_pages(&putback_list);
+
+	return nr_putback;
+}
+
+/*
+ * Split promotion: a THP on a slow tier node whose subpages were sampled
+ * on their own, see vm.access_scan_thp_subpages, and of which less than
+ * vm.thp_split_promote_ratio percent are hot, is split so that only its
+ * hot subpages are promoted. The cold ones stay behind as base pages, for
+ * khugepaged to collapse again on the slow tier once the rest cools down.
+ */
+// Percentage of hot subpages under which a promoted THP is split, 0 never splits
+int sysctl_thp_split_promote_ratio = 0;
+
+/* Hot subpages of THP @page, -1 if they do not all have samples */
+static int thp_hot_subpages(struct page *page)
+{
+	int threshold = access_scan_hot_threshold();
+	int i, freq, nr_hot = 0;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		freq = page_subpage_access_frequency(page + i);
+		if (freq < 0)
+			return -1;
+		if (freq >= threshold)
+			nr_hot++;
+	}
+
+	return nr_hot;
+}
+
+/*
+ * Split the THPs of @page_list, isolated for a promotion, that have few hot
+ * subpages. Their hot subpages move to @base_page_list and the cold ones
+ * are put back, @nr_base_pages and @nr_huge_pages follow. Returns how many
+ * base pages it put back.
+ */
+static unsigned long split_promote_thps(struct list_head *page_list,
+		struct list_head *base_page_list, unsigned long *nr_base_pages,
+		unsigned long *nr_huge_pages)
+{
+	int ratio = READ_ONCE(sysctl_thp_split_promote_ratio);
+	int threshold = access_scan_hot_threshold();
+	struct page *page, *next, *subpage, *tmp;
+	unsigned long nr_putback = 0;
+	LIST_HEAD(putback_list);
+	LIST_HEAD(subpages);
+	int nr_hot;
+
+	if (!ratio || !access_scan_enabled())
+		return 0;
+
+	list_for_each_entry_safe(page, next, page_list, lru) {
+		if (!PageTransHuge(page) || !PageAnon(page) ||
+		    !node_is_slow_tier(page_to_nid(page)))
+			continue;
+
+		nr_hot = thp_hot_subpages(page);
+		if (nr_hot < 0 || nr_hot * 100 >= ratio * HPAGE_PMD_NR)
+			continue;
+
+		if (!trylock_page(page))
+			continue;
+		/* the page is isolated, its tails go to @subpages */
+		if (split_huge_page_to_list(page, &subpages)) {
+			unlock_page(page);
+			continue;
+		}
+		unlock_page(page);
+		list_move(&page->lru, &subpages);
+		*nr_huge_pages -= HPAGE_PMD_NR;
+
+		list_for_each_entry_safe(subpage, tmp, &subpages, lru) {
+			page_access_split(subpage);
+			if (page_access_frequency(subpage) >= threshold) {
+				list_move_tail(&subpage->lru, base_page_list);
+				(*nr_base_pages)++;
+			} else {
+				list_move_tail(&subpage->lru, &putback_list);
+				nr_putback++;
+			}
+		}
+		count_vm_event(PGMIGRATE_SPLIT_PROMOTE);
+	}
+
+	putback_movable_pages(&putback_list);
+
+	return nr_putback;
+}
+
+/*
+ * Promotion time collapse: base pages of an aligned 2MB range of an address
+ * space isolated together for a promotion, at least
+ * vm.thp_promote_collapse_ratio percent of the range, are collapsed into a
+ * new THP on the target node instead of being migrated one by one and
+ * copied again by a khugepaged collapse later. The collapse copies the
+ * range once, with the copy workers.
+ */
+// Percentage of a 2MB range promoted together that is collapsed into a THP, 0 never collapses
+int sysctl_thp_promote_collapse_ratio = 0;
+
+/* ranges collapsed per promotion at most */
+#define PROMOTE_COLLAPSE_BATCH	16
+
+struct promote_collapse_range {
+	struct mm_struct *mm;
+	unsigned long address;
+};
+
+/* the 2MB range of the address space of anon @page, as far as its index goes */
+static int promote_collapse_cmp(void *priv, struct list_head *a,
+		struct list_head *b)
+{
+	struct page *pa = list_entry(a, struct page, lru);
+	struct page *pb = list_entry(b, struct page, lru);
+	unsigned long ka = (unsigned long)page_anon_vma(pa);
+	unsigned long kb = (unsigned long)page_anon_vma(pb);
+
+	if (ka != kb)
+		return ka < kb ? -1 : 1;
+	if (pa->index != pb->index)
+		return pa->index < pb->index ? -1 : 1;
+	return 0;
+}
+
+static bool promote_collapse_same_range(struct page *a, struct page *b)
+{
+	return page_anon_vma(a) == page_anon_vma(b) &&
+		a->index >> HPAGE_PMD_ORDER == b->index >> HPAGE_PMD_ORDER;
+}
+
+static bool promote_collapse_rmap_one(struct page *page,
+		struct vm_area_struct *vma, unsigned long address, void *arg)
+{
+	struct promote_collapse_range *range = arg;
+
+	if (!mmget_not_zero(vma->vm_mm))
+		return true;
+
+	range->mm = vma->vm_mm;
+	range->address = address;
+
+	return false;
+}
+
+/*
+ * The address space and the 2MB range @page is mapped at, if the range
+ * lines up with its index; takes a reference on the mm.
+ */
+static bool promote_collapse_find_range(struct page *page,
+		struct promote_collapse_range *range)
+{
+	struct rmap_walk_control rwc = {
+		.rmap_one = promote_collapse_rmap_one,
+		.arg = range,
+		.anon_lock = page_lock_anon_vma_read,
+	};
+
+	range->mm = NULL;
+	rmap_walk(page, &rwc);
+	if (!range->mm)
+		return false;
+
+	if (((range->address >> PAGE_SHIFT) ^ page->index) &
+	    (HPAGE_PMD_NR - 1)) {
+		mmput(range->mm);
+		return false;
+	}
+	range->address &= HPAGE_PMD_MASK;
+
+	return true;
+}
+
+/*
+ * Collapse the mostly promoted 2MB ranges of @page_list, base pages
+ * isolated for a promotion to @to_nid, into THPs on @to_nid. Their pages
+ * are put back for the collapse and taken off @nr_base_pages. Returns how
+ * many base pages it put back, adding those collapsed to @nr_collapsed.
+ */
+static unsigned long promote_collapse_ranges(struct list_head *page_list,
+		int to_nid, unsigned long *nr_base_pages,
+		unsigned long *nr_collapsed)
+{
+	int ratio = READ_ONCE(sysctl_thp_promote_collapse_ratio);
+	struct promote_collapse_range ranges[PROMOTE_COLLAPSE_BATCH];
+	unsigned long nr_run, nr_putback = 0;
+	int i, nr_ranges = 0, nr_min;
+	struct page *page, *next;
+	LIST_HEAD(putback_list);
+	LIST_HEAD(pages);
+	LIST_HEAD(run);
+
+	if (!ratio || list_empty(page_list))
+		return 0;
+
+	nr_min = max(DIV_ROUND_UP(ratio * HPAGE_PMD_NR, 100), 1);
+	list_sort(NULL, page_list, promote_collapse_cmp);
+	list_splice_init(page_list, &pages);
+
+	while (!list_empty(&pages)) {
+		page = list_first_entry(&pages, struct page, lru);
+		list_move_tail(&page->lru, &run);
+		nr_run = 1;
+		while (!list_empty(&pages)) {
+			next = list_first_entry(&pages, struct page, lru);
+			if (!promote_collapse_same_range(page, next))
+				break;
+			list_move_tail(&next->lru, &run);
+			nr_run++;
+		}
+
+		if (nr_run >= nr_min && PageAnon(page) && !PageKsm(page) &&
+		    nr_ranges < PROMOTE_COLLAPSE_BATCH &&
+		    promote_collapse_find_range(page, &ranges[nr_ranges])) {
+			nr_ranges++;
+			nr_putback += nr_run;
+			list_splice_tail_init(&run, &putback_list);
+		} else {
+			list_splice_tail_init(&run, page_list);
+		}
+	}
+
+	if (!nr_ranges)
+		return 0;
+
+	*nr_base_pages -= nr_putback;
+	putback_movable_pages(&putback_list);
+	/* the collapse takes them off the LRU again */
+	lru_add_drain();
+
+	for (i = 0; i < nr_ranges; i++) {
+		if (!khugepaged_collapse_to_node(ranges[i].mm,
+				ranges[i].address, to_nid)) {
+			*nr_collapsed += HPAGE_PMD_NR;
+			count_vm_event(PGMIGRATE_PROMOTE_COLLAPSE);
+		}
+		mmput(ranges[i].mm);
+	}
+
+	return nr_putback;
+}
+
+static int migration_copy_cost(struct page *page, bool migrate_mt)
+{
+	if (!PageTransHuge(page))
+		return MIGRATION_COPY_COST_BASE;
+
+	return migrate_mt ? MIGRATION_COPY_COST_THP_MT :
+		MIGRATION_COPY_COST_THP;
+}
+
+/*
+ * Order @page_list by benefit per copy cost, highest first and in LRU
+ * order among equals, for a promotion over a latency gap of @gap in node
+ * distance units. Puts back the pages not worth it and takes them off
+ * @nr_base_pages and @nr_huge_pages, the isolation counts of the list.
+ * Returns how many base pages it put back.
+ */
+static unsigned long rank_migration_candidates(struct list_head *page_list,
+		int gap, bool migrate_mt, unsigned long *nr_base_pages,
+		unsigned long *nr_huge_pages)
+{
+	struct list_head ranks[MIGRATION_RANKS];
+	int min_benefit = READ_ONCE(sysctl_migration_min_benefit);
+	unsigned long nr_putback = 0;
+	struct page *page, *next;
+	LIST_HEAD(putback_list);
+	int i;
+
+	if (list_empty(page_list))
+		return 0;
+
+	for (i = 0; i < MIGRATION_RANKS; i++)
+		INIT_LIST_HEAD(&ranks[i]);
+
+	list_for_each_entry_safe(page, next, page_list, lru) {
+		int level = migration_access_level(page);
+		int cost = migration_copy_cost(page, migrate_mt);
+
+		if (min_benefit && gap > 0 &&
+		    level * gap < min_benefit * cost) {
+			nr_putback += move_to_putback_list(page, &putback_list,
+					nr_base_pages, nr_huge_pages);
+			continue;
+		}
+
+		list_move_tail(&page->lru,
+			&ranks[level * MIGRATION_COPY_COST_BASE / cost]);
+	}
+
+	for (i = MIGRATION_RANKS - 1; i >= 0; i--)
+		list_splice_tail(&ranks[i], page_list);
+
+	if (nr_putback)
+		count_vm_events(PGMIGRATE_SKIP_RANK, nr_putback);
+	putback_movable_pages(&putback_list);
+
+	return nr_putback;
+}
+
 static int add_pages_to_exchange_list(struct list_head *from_pagelist,
 	struct list_head *to_pagelist, struct exchange_page_info *info_list,
 	struct list_head *exchange_list, unsigned long info_list_size)
@@ -283,6 +833,7 @@ static int add_pages_to_exchange_list(struct list_head *from_pagelist,
 				list_move(&from_page->lru, &odd_from_list);
 				continue;
 			}
+			count_thp_migration_split(MR_SYSCALL);
 		}
 
 		if (!thp_migration_supported() && PageTransHuge(to_page)) {
@@ -293,6 +844,7 @@ static int add_pages_to_exchange_list(struct list_head *from_pagelist,
 				list_move(&to_page->lru, &odd_to_list);
 				continue;
 			}
+			count_thp_migration_split(MR_SYSCALL);
 		}
 
 		if (hpage_nr_pages(from_page) != hpage_nr_pages(to_page)) {
@@ -339,6 +891,36 @@ static int add_pages_to_exchange_list(struct list_head *from_pagelist,
 	return info_list_index;
 }
 
+/* Record the pairs of @exchange_list as one batch, returns its id */
+static u32 migrate_record_exchange_list(struct list_head *exchange_list)
+{
+	struct exchange_page_info *info;
+	u32 batch;
+
+	if (!migrate_record_enabled())
+		return 0;
+
+	batch = migrate_record_next_batch();
+	list_for_each_entry(info, exchange_list, list)
+		__migrate_record_page(MIGRATE_RECORD_EXCHANGE, info->from_page,
+				page_to_nid(info->to_page), batch);
+	return batch;
+}
+
+/*
+ * Whether the batch of @nr_added pairs just taken is the last exchange of
+ * exchange_pages_between_nodes(), with the pages left on the to list to
+ * migrate along. THPs split into base pages are not.
+ */
+static bool exchange_last_batch(struct list_head *from_page_list,
+		unsigned long nr_added, int batch_size, bool huge_page)
+{
+	if (huge_page && !thp_migration_supported())
+		return false;
+
+	return list_empty(from_page_list) || nr_added < batch_size;
+}
+
 static unsigned long exchange_pages_between_nodes(unsigned long nr_from_pages,
 	unsigned long nr_to_pages, struct list_head *from_page_list,
 	struct list_head *to_page_list, int batch_size,
@@ -368,6 +950,10 @@ static unsigned long exchange_pages_between_nodes(unsigned long nr_from_pages,
 
 	while (!list_empty(from_page_list) && !list_empty(to_page_list)) {
 		unsigned long nr_added_pages;
+		unsigned int nr_batch;
+		int from_nid, to_nid;
+		u64 record_start;
+		u32 batch;
 		INIT_LIST_HEAD(&exchange_list);
 
 		nr_added_pages = add_pages_to_exchange_list(from_page_list, to_page_list,
@@ -385,11 +971,51 @@ static unsigned long exchange_pages_between_nodes(unsigned long nr_from_pages,
 
 		VM_BUG_ON(added_size > info_list_size);
 
-		if (migrate_concur)
+		from_nid = page_to_nid(info_list[0].from_page);
+		to_nid = page_to_nid(info_list[0].to_page);
+		nr_batch = nr_added_pages * hpage_nr_pages(info_list[0].from_page);
+		batch = migrate_record_exchange_list(&exchange_list);
+		record_start = migrate_record_start();
+
+		if (migrate_concur && exchange_last_batch(from_page_list,
+					nr_added_pages, batch_size, huge_page)) {
+			int nr_migrate = migration_batch(false, huge_page);
+			LIST_HEAD(migrate_list);
+			struct page *page, *next;
+			int n = 0;
+
+			/*
+			 * The pages of the to node left without a pair, which
+			 * the caller migrates to the from node next, go with
+			 * the last batch: one unmap, TLB shootdown, copy and
+			 * remap for both.
+			 */
+			list_for_each_entry_safe(page, next, to_page_list, lru) {
+				if (nr_migrate > 0 && n++ == nr_migrate)
+					break;
+				list_move_tail(&page->lru, &migrate_list);
+			}
+			migrate_exchange_pages_concur(&migrate_list,
+					alloc_new_node_page, NULL, from_nid,
+					&exchange_list, mode, MR_SYSCALL);
+			/* what did not move is left to the caller */
+			list_splice(&migrate_list, to_page_list);
+		} else if (migrate_concur) {
+			u64 start = ktime_get_ns();
+
 			exchange_pages_concur(&exchange_list, mode, MR_SYSCALL);
-		else
+			/* THPs split into base pages do not tell about either */
+			if (!huge_page || thp_migration_supported())
+				migration_batch_feedback(true, huge_page,
+						nr_added_pages, batch_size,
+						ktime_get_ns() - start);
+		} else
 			exchange_pages(&exchange_list, mode, MR_SYSCALL);
 
+		/* failed exchanges leave no trace behind */
+		migrate_record_batch(batch, from_nid, to_nid, nr_batch, 0,
+				record_start);
+
 		memset(info_list, 0, sizeof(struct exchange_page_info)*batch_size);
 	}
 
@@ -398,9 +1024,163 @@ static unsigned long exchange_pages_between_nodes(unsigned long nr_from_pages,
 	return info_list_size;
 }
 
-static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
+/*
+ * MPOL_MF_ROTATE: balance three tiers in one pass. The hot pages of the
+ * slow node move to the fast node, cold pages of the fast node to the
+ * middle node and cold pages of the middle node to the slow node, each
+ * triple in a single rotate_pages() instead of an exchange and a
+ * migration.
+ */
+enum {
+	MM_MANAGE_ROTATE_SLOW,
+	MM_MANAGE_ROTATE_FAST,
+	MM_MANAGE_ROTATE_MIDDLE,
+	MM_MANAGE_ROTATE_TIERS,
+};
+
+/*
+ * Rotate the first pages of the per tier @lists until one runs out.
+ * Returns the number of base pages the rotations moved to the fast node.
+ * All pages are left on their lists.
+ */
+static unsigned long mm_manage_rotate_lists(struct list_head *lists,
+		enum migrate_mode mode)
+{
+	struct exchange_page_info ring[MM_MANAGE_ROTATE_TIERS];
+	struct list_head done[MM_MANAGE_ROTATE_TIERS];
+	unsigned long nr_rotated = 0;
+	int i, rc, retry;
+
+	for (i = 0; i < MM_MANAGE_ROTATE_TIERS; i++)
+		INIT_LIST_HEAD(&done[i]);
+
+	for (;;) {
+		bool skipped = false;
+
+		for (i = 0; i < MM_MANAGE_ROTATE_TIERS; i++)
+			if (list_empty(&lists[i]))
+				goto out;
+
+		memset(ring, 0, sizeof(ring));
+		for (i = 0; i < MM_MANAGE_ROTATE_TIERS; i++) {
+			struct page *page = list_first_entry(&lists[i],
+					struct page, lru);
+
+			/* rotate_pages() takes anonymous pages only */
+			if (page_mapping(page)) {
+				list_move_tail(&page->lru, &done[i]);
+				skipped = true;
+				continue;
+			}
+			ring[i].from_page = page;
+		}
+		if (skipped)
+			continue;
+
+		for (i = 0; i < MM_MANAGE_ROTATE_TIERS; i++) {
+			ring[i].to_page =
+				ring[(i + 1) % MM_MANAGE_ROTATE_TIERS].from_page;
+			list_move_tail(&ring[i].from_page->lru, &done[i]);
+		}
+
+		retry = 0;
+		do {
+			rc = rotate_pages(ring, MM_MANAGE_ROTATE_TIERS, mode,
+					MR_SYSCALL);
+		} while (rc == -EAGAIN && ++retry < 3);
+
+		if (rc == MIGRATEPAGE_SUCCESS)
+			nr_rotated += hpage_nr_pages(ring[0].from_page);
+		cond_resched();
+	}
+
+out:
+	for (i = 0; i < MM_MANAGE_ROTATE_TIERS; i++)
+		list_splice(&done[i], &lists[i]);
+
+	return nr_rotated;
+}
+
+static int do_mm_manage_rotate(struct task_struct *p, struct mm_struct *mm,
 		const nodemask_t *from, const nodemask_t *to,
-		unsigned long nr_pages, int flags)
+		unsigned long *budget, int flags)
+{
+	unsigned long nr_pages = *budget;
+	bool migrate_mt = flags & MPOL_MF_MOVE_MT;
+	struct mem_cgroup *memcg = mem_cgroup_from_task(p);
+	enum migrate_mode mode = MIGRATE_SYNC |
+		(migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD);
+	struct list_head base_lists[MM_MANAGE_ROTATE_TIERS];
+	struct list_head huge_lists[MM_MANAGE_ROTATE_TIERS];
+	unsigned long nr_base, nr_huge, nr_rotated;
+	int nids[MM_MANAGE_ROTATE_TIERS];
+	int cpu_nid = cpu_to_node(task_cpu(p));
+	int i;
+
+	/* the slow node, then the fast and the middle ones in any order */
+	if (nodes_weight(*from) != 1 || nodes_weight(*to) != 2)
+		return -EINVAL;
+
+	nids[MM_MANAGE_ROTATE_SLOW] = first_node(*from);
+	nids[MM_MANAGE_ROTATE_FAST] = first_node(*to);
+	nids[MM_MANAGE_ROTATE_MIDDLE] = next_node(first_node(*to), *to);
+	if (node_isset(nids[MM_MANAGE_ROTATE_SLOW], *to))
+		return -EINVAL;
+
+	/* the fast node is the one nearest to the task */
+	if (node_distance(cpu_nid, nids[MM_MANAGE_ROTATE_MIDDLE]) <
+	    node_distance(cpu_nid, nids[MM_MANAGE_ROTATE_FAST]))
+		swap(nids[MM_MANAGE_ROTATE_FAST],
+		     nids[MM_MANAGE_ROTATE_MIDDLE]);
+
+	VM_BUG_ON(!memcg);
+	if (memcg == root_mem_cgroup)
+		return 0;
+
+	for (i = 0; i < MM_MANAGE_ROTATE_TIERS; i++) {
+		INIT_LIST_HEAD(&base_lists[i]);
+		INIT_LIST_HEAD(&huge_lists[i]);
+	}
+
+	migrate_prep_memcg(memcg);
+
+	for (i = 0; i < MM_MANAGE_ROTATE_TIERS; i++) {
+		nr_base = nr_huge = 0;
+		/* as many cold pages as there are hot ones to make room for */
+		nr_pages = isolate_pages_from_lru_list(NODE_DATA(nids[i]), memcg,
+				nr_pages, &base_lists[i], &huge_lists[i],
+				&nr_base, &nr_huge,
+				i == MM_MANAGE_ROTATE_SLOW ?
+				ISOLATE_HOT_PAGES : ISOLATE_COLD_PAGES);
+		p->page_migration_stats.nr_isolated_pages += nr_pages;
+		if (!nr_pages)
+			break;
+	}
+
+	nr_rotated = mm_manage_rotate_lists(huge_lists, mode);
+	nr_rotated += mm_manage_rotate_lists(base_lists, mode);
+	pr_debug("%lu pages rotated from node %d to node %d\n", nr_rotated,
+			nids[MM_MANAGE_ROTATE_SLOW], nids[MM_MANAGE_ROTATE_FAST]);
+	if (*budget != ULONG_MAX)
+		*budget -= min(*budget, nr_rotated);
+
+	for (i = 0; i < MM_MANAGE_ROTATE_TIERS; i++) {
+		putback_movable_pages(&base_lists[i]);
+		putback_movable_pages(&huge_lists[i]);
+	}
+
+	return 0;
+}
+
+/*
+ * Move up to @nr_pages hot pages of @from_nid to @to_nid, making room on
+ * @to_nid by moving its cold pages back when it is over its budget. The
+ * number of base pages moved to @to_nid is added to @nr_moved.
+ */
+static int do_mm_manage_pair(struct page_migration_stats *stats,
+		struct mem_cgroup *memcg,
+		int from_nid, int to_nid, unsigned long nr_pages, int flags,
+		unsigned long *nr_moved)
 {
 	bool migrate_mt = flags & MPOL_MF_MOVE_MT;
 	bool migrate_concur = flags & MPOL_MF_MOVE_CONCUR;
@@ -408,7 +1188,6 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 	bool move_hot_and_cold_pages = flags & MPOL_MF_MOVE_ALL;
 	bool migrate_exchange_pages = flags & MPOL_MF_EXCHANGE;
 	/*bool migrate_pages_out = false;*/
-	struct mem_cgroup *memcg = mem_cgroup_from_task(p);
 	int err = 0;
 	unsigned long nr_isolated_from_pages;
 	unsigned long nr_isolated_from_base_pages = 0, nr_isolated_from_huge_pages = 0;
@@ -419,29 +1198,20 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 				  nr_isolated_to_huge_pages = ULONG_MAX;
 	unsigned long max_nr_pages_to_node, nr_pages_to_node, nr_active_pages_from_node;
 	unsigned long nr_pages_from_node;
+	unsigned long nr_to_move;
+	unsigned long nr_collapsed = 0;
 	long nr_free_pages_to_node;
-	int from_nid, to_nid;
+	int gap;
 	enum migrate_mode mode = MIGRATE_SYNC |
 		(migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD) |
 		(migrate_dma ? MIGRATE_DMA : MIGRATE_SINGLETHREAD) |
+		(migrate_mt && migrate_dma ? MIGRATE_HYBRID : MIGRATE_SINGLETHREAD) |
 		(migrate_concur ? MIGRATE_CONCUR : MIGRATE_SINGLETHREAD);
 	enum isolate_action from_action =
 		move_hot_and_cold_pages?ISOLATE_HOT_AND_COLD_PAGES:ISOLATE_HOT_PAGES;
 	LIST_HEAD(from_base_page_list);
 	LIST_HEAD(from_huge_page_list);
 
-	VM_BUG_ON(!memcg);
-	/* Let's handle simplest situation first */
-	VM_BUG_ON(!(nodes_weight(*from) == 1 && nodes_weight(*to) == 1));
-
-	if (memcg == root_mem_cgroup)
-		return 0;
-
-	from_nid = first_node(*from);
-	to_nid = first_node(*to);
-
-	lru_add_drain_all();
-
 	max_nr_pages_to_node = memcg_max_size_node(memcg, to_nid);
 	nr_pages_to_node = memcg_size_node(memcg, to_nid);
 	nr_active_pages_from_node = active_inactive_size_memcg_node(memcg,
@@ -456,6 +1226,10 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 	nr_pages = min_t(unsigned long, max_nr_pages_to_node, nr_pages);
 	/* do not migrate in more pages than from node has */
 	nr_pages = min_t(unsigned long, nr_pages_from_node, nr_pages);
+	/* nor demote the from node below the floors of the memcg there */
+	if (!node_is_slow_tier(from_nid) && node_is_slow_tier(to_nid))
+		nr_pages = min(nr_pages,
+			       mem_cgroup_node_demotable(memcg, from_nid, true));
 
 	pr_debug("nr_active_pages_from_node: %lu, nr_free_pages_to_node: %ld\n", nr_active_pages_from_node, nr_free_pages_to_node);
 	/* if to node has enough space, migrate all possible pages in from node */
@@ -472,6 +1246,35 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 			from_action);
 
 	pr_debug("%ld pages isolated at from node: %d\n", nr_isolated_from_pages, from_nid);
+	stats->nr_isolated_pages += nr_isolated_from_pages;
+
+	nr_isolated_from_pages -= putback_pingpong_pages(&from_base_page_list,
+			&nr_isolated_from_base_pages, &nr_isolated_from_huge_pages);
+	nr_isolated_from_pages -= putback_pingpong_pages(&from_huge_page_list,
+			&nr_isolated_from_base_pages, &nr_isolated_from_huge_pages);
+
+	if (node_is_slow_tier(from_nid) && !node_is_slow_tier(to_nid)) {
+		nr_isolated_from_pages -= split_promote_thps(
+				&from_huge_page_list, &from_base_page_list,
+				&nr_isolated_from_base_pages,
+				&nr_isolated_from_huge_pages);
+		nr_isolated_from_pages -= promote_collapse_ranges(
+				&from_base_page_list, to_nid,
+				&nr_isolated_from_base_pages, &nr_collapsed);
+	}
+
+	/* as seen from the CPUs next to the to node */
+	gap = node_distance(to_nid, from_nid) - node_distance(to_nid, to_nid);
+	nr_isolated_from_pages -= rank_migration_candidates(
+			&from_base_page_list, gap, migrate_mt,
+			&nr_isolated_from_base_pages,
+			&nr_isolated_from_huge_pages);
+	nr_isolated_from_pages -= rank_migration_candidates(
+			&from_huge_page_list, gap, migrate_mt,
+			&nr_isolated_from_base_pages,
+			&nr_isolated_from_huge_pages);
+	migrate_record_list(MIGRATE_RECORD_ISOLATE, &from_base_page_list, to_nid);
+	migrate_record_list(MIGRATE_RECORD_ISOLATE, &from_huge_page_list, to_nid);
 
 	if (max_nr_pages_to_node != ULONG_MAX &&
 		(nr_free_pages_to_node < 0 ||
@@ -489,6 +1292,17 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 				&nr_isolated_to_base_pages, &nr_isolated_to_huge_pages,
 				move_hot_and_cold_pages?ISOLATE_HOT_AND_COLD_PAGES:ISOLATE_COLD_PAGES);
 		pr_debug("%lu pages isolated at to node: %d\n", nr_isolated_to_pages, to_nid);
+		stats->nr_isolated_pages += nr_isolated_to_pages;
+		nr_isolated_to_pages -= putback_pingpong_pages(&to_base_page_list,
+				&nr_isolated_to_base_pages,
+				&nr_isolated_to_huge_pages);
+		nr_isolated_to_pages -= putback_pingpong_pages(&to_huge_page_list,
+				&nr_isolated_to_base_pages,
+				&nr_isolated_to_huge_pages);
+		migrate_record_list(MIGRATE_RECORD_ISOLATE, &to_base_page_list,
+				from_nid);
+		migrate_record_list(MIGRATE_RECORD_ISOLATE, &to_huge_page_list,
+				from_nid);
 
 		if (migrate_exchange_pages) {
 			unsigned long nr_exchange_pages;
@@ -500,46 +1314,48 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 			if (!thp_migration_supported()) {
 				nr_exchange_pages =  exchange_pages_between_nodes(nr_isolated_from_base_pages,
 					nr_isolated_to_base_pages, &from_base_page_list,
-					&to_base_page_list, migration_batch_size, false, mode);
+					&to_base_page_list, migration_batch(true, false), false, mode);
 
 				nr_isolated_to_base_pages -= nr_exchange_pages;
 
-				p->page_migration_stats.nr_exchange_base_pages += nr_exchange_pages;
+				stats->nr_exchange_base_pages += nr_exchange_pages;
 			}
 
 			/* THP page exchange */
 			nr_exchange_pages =  exchange_pages_between_nodes(nr_isolated_from_huge_pages,
 				nr_isolated_to_huge_pages, &from_huge_page_list,
-				&to_huge_page_list, migration_batch_size, true, mode);
+				&to_huge_page_list, migration_batch(true, true), true, mode);
 
 			if (!thp_migration_supported()) {
 			/* split THP above, so we do not need to multiply the counter */
 				nr_isolated_to_huge_pages -= nr_exchange_pages;
-				p->page_migration_stats.nr_exchange_huge_pages += nr_exchange_pages;
+				stats->nr_exchange_huge_pages += nr_exchange_pages;
 			} else {
 				nr_isolated_to_huge_pages -= nr_exchange_pages * HPAGE_PMD_NR;
-				p->page_migration_stats.nr_exchange_huge_pages += nr_exchange_pages * HPAGE_PMD_NR;
+				stats->nr_exchange_huge_pages += nr_exchange_pages * HPAGE_PMD_NR;
 			}
 
-			p->page_migration_stats.nr_exchanges += 1;
+			stats->nr_exchanges += 1;
 
 			goto migrate_out;
 		} else {
 migrate_out:
+			nr_to_move = nr_isolated_to_base_pages +
+				nr_isolated_to_huge_pages;
 			if (migrate_mt || migrate_concur) {
 				nr_isolated_to_base_pages -=
-					migrate_to_node(&to_base_page_list, from_nid, mode & ~MIGRATE_MT,
-						migration_batch_size);
+					migrate_to_node(&to_base_page_list, from_nid, mode & ~(MIGRATE_MT | MIGRATE_HYBRID),
+						migration_batch(false, false));
 				nr_isolated_to_huge_pages -=
 					migrate_to_node(&to_huge_page_list, from_nid, mode,
-						migration_batch_size);
+						migration_batch(false, true));
 			} else {
 				nr_isolated_to_base_pages -=
 					migrate_to_node(&to_base_page_list, from_nid, mode,
-						migration_batch_size);
+						migration_batch(false, false));
 				nr_isolated_to_huge_pages -=
 					migrate_to_node(&to_huge_page_list, from_nid, mode,
-						migration_batch_size);
+						migration_batch(false, true));
 #if 0
 				/* migrate base pages and THPs together if no opt is used */
 				if (!list_empty(&to_huge_page_list)) {
@@ -549,9 +1365,12 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 					migrate_to_node(&to_base_page_list, from_nid, mode);
 #endif
 			}
-			p->page_migration_stats.f2s.nr_migrations += 1;
-			p->page_migration_stats.f2s.nr_base_pages += nr_isolated_to_base_pages;
-			p->page_migration_stats.f2s.nr_huge_pages += nr_isolated_to_huge_pages;
+			stats->f2s.nr_migrations += 1;
+			stats->f2s.nr_base_pages += nr_isolated_to_base_pages;
+			stats->f2s.nr_huge_pages += nr_isolated_to_huge_pages;
+			stats->nr_failed_pages += nr_to_move -
+				nr_isolated_to_base_pages -
+				nr_isolated_to_huge_pages;
 		}
 	}
 
@@ -582,20 +1401,21 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 		list_empty(&from_huge_page_list)))
 		pr_info("%ld free pages at to node: %d\n", nr_free_pages_to_node, to_nid);
 
+	nr_to_move = nr_isolated_from_base_pages + nr_isolated_from_huge_pages;
 	if (migrate_mt || migrate_concur) {
 		nr_isolated_from_base_pages -=
-			migrate_to_node(&from_base_page_list, to_nid, mode & ~MIGRATE_MT,
-				migration_batch_size);
+			migrate_to_node(&from_base_page_list, to_nid, mode & ~(MIGRATE_MT | MIGRATE_HYBRID),
+				migration_batch(false, false));
 		nr_isolated_from_huge_pages -=
 			migrate_to_node(&from_huge_page_list, to_nid, mode,
-				migration_batch_size);
+				migration_batch(false, true));
 	} else {
 		nr_isolated_from_base_pages -=
 			migrate_to_node(&from_base_page_list, to_nid, mode,
-				migration_batch_size);
+				migration_batch(false, false));
 		nr_isolated_from_huge_pages -=
 			migrate_to_node(&from_huge_page_list, to_nid, mode,
-				migration_batch_size);
+				migration_batch(false, true));
 #if 0
 		/* migrate base pages and THPs together if no opt is used */
 		if (!list_empty(&from_huge_page_list)) {
@@ -606,13 +1426,366 @@ static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
 #endif
 	}
 
-	p->page_migration_stats.s2f.nr_migrations += 1;
-	p->page_migration_stats.s2f.nr_base_pages += nr_isolated_from_base_pages;
-	p->page_migration_stats.s2f.nr_huge_pages += nr_isolated_from_huge_pages;
+	stats->s2f.nr_migrations += 1;
+	stats->s2f.nr_base_pages += nr_isolated_from_base_pages;
+	stats->s2f.nr_huge_pages += nr_isolated_from_huge_pages;
+	stats->nr_failed_pages += nr_to_move - nr_isolated_from_base_pages -
+		nr_isolated_from_huge_pages;
+
+	*nr_moved += nr_isolated_from_base_pages + nr_isolated_from_huge_pages +
+		nr_collapsed;
+
+	return err;
+}
+
+/* Node of @nodes with the most active pages of @memcg */
+static int mm_manage_hottest_node(struct mem_cgroup *memcg,
+		const nodemask_t *nodes)
+{
+	unsigned long nr_active, max_active = 0;
+	int nid, hottest = first_node(*nodes);
+
+	for_each_node_mask(nid, *nodes) {
+		nr_active = active_inactive_size_memcg_node(memcg, nid, true);
+		if (nr_active > max_active) {
+			max_active = nr_active;
+			hottest = nid;
+		}
+	}
+
+	return hottest;
+}
+
+/* Node of @nodes nearest to @cpu_nid */
+static int mm_manage_nearest_node(int cpu_nid, const nodemask_t *nodes)
+{
+	int nid, nearest = first_node(*nodes);
+
+	for_each_node_mask(nid, *nodes)
+		if (node_distance(cpu_nid, nid) <
+		    node_distance(cpu_nid, nearest))
+			nearest = nid;
+
+	return nearest;
+}
+
+/* Base pages @memcg may still place on @nid, ULONG_MAX without a budget */
+static unsigned long mm_manage_room(struct mem_cgroup *memcg, int nid)
+{
+	unsigned long max = memcg_max_size_node(memcg, nid);
+	unsigned long size = memcg_size_node(memcg, nid);
+
+	/* memory.max_at_node:N of "max" */
+	if (max == PAGE_COUNTER_MAX)
+		return ULONG_MAX;
+
+	return max > size ? max - size : 0;
+}
+
+/*
+ * Place the hot pages of @memcg on the @from nodes on the @to nodes in one
+ * pass. The from nodes are taken hottest first, by their number of active
+ * pages, and their hot pages fill the to nodes nearest to @cpu_nid first,
+ * or to the from node without one, each up to its max_at_node budget.
+ * When every to node is full, the nearest one makes room by moving its
+ * cold pages back to the from node. The number of base pages moved to the
+ * to nodes, at most @nr_pages, is taken off @nr_pages unless that is
+ * ULONG_MAX.
+ */
+static int mm_manage_memcg(struct mem_cgroup *memcg, int cpu_nid,
+		struct page_migration_stats *stats,
+		const nodemask_t *from, const nodemask_t *to,
+		unsigned long *budget, int flags)
+{
+	unsigned long nr_pages = *budget;
+	nodemask_t from_left, to_nodes;
+	int err = 0;
+
+	VM_BUG_ON(!memcg);
+
+	nodes_and(from_left, *from, node_states[N_MEMORY]);
+	nodes_and(to_nodes, *to, node_states[N_MEMORY]);
+	if (nodes_empty(from_left) || nodes_empty(to_nodes))
+		return -EINVAL;
+
+	if (memcg == root_mem_cgroup)
+		return 0;
+
+	migrate_prep_memcg(memcg);
+
+	while (!nodes_empty(from_left) && nr_pages) {
+		int from_nid = mm_manage_hottest_node(memcg, &from_left);
+		int nearest = NUMA_NO_NODE;
+		nodemask_t to_left = to_nodes;
+		bool placed = false;
+
+		node_clear(from_nid, from_left);
+		node_clear(from_nid, to_left);
+
+		while (!nodes_empty(to_left) && nr_pages) {
+			int to_nid = mm_manage_nearest_node(
+					cpu_nid != NUMA_NO_NODE ? cpu_nid : from_nid,
+					&to_left);
+			unsigned long room = mm_manage_room(memcg, to_nid);
+			unsigned long nr_moved = 0;
+
+			node_clear(to_nid, to_left);
+			if (nearest == NUMA_NO_NODE)
+				nearest = to_nid;
+			if (!room)
+				continue;
 
+			err = do_mm_manage_pair(stats, memcg, from_nid, to_nid,
+					min(nr_pages, room), flags, &nr_moved);
+			if (err)
+				goto out;
+
+			placed = true;
+			if (nr_pages != ULONG_MAX)
+				nr_pages -= min(nr_pages, nr_moved);
+		}
+
+		if (!placed && nearest != NUMA_NO_NODE) {
+			unsigned long nr_moved = 0;
+
+			err = do_mm_manage_pair(stats, memcg, from_nid, nearest,
+					nr_pages, flags, &nr_moved);
+			if (err)
+				goto out;
+			if (nr_pages != ULONG_MAX)
+				nr_pages -= min(nr_pages, nr_moved);
+		}
+	}
+
+out:
+	*budget = nr_pages;
 	return err;
 }
 
+static int do_mm_manage(struct task_struct *p, struct mm_struct *mm,
+		const nodemask_t *from, const nodemask_t *to,
+		unsigned long *nr_pages, int flags)
+{
+	access_scan_mm(mm);
+
+	return mm_manage_memcg(mem_cgroup_from_task(p),
+			cpu_to_node(task_cpu(p)), &p->page_migration_stats,
+			from, to, nr_pages, flags);
+}
+
+/*
+ * MPOL_MF_SHARED: tier the shmem, tmpfs, SysV shm and shared anonymous
+ * memory the mm maps. A shared page is charged to the memcg of whoever
+ * touched it first, so the memcg LRUs of the processes sharing a segment
+ * each see only a part of it. Here a segment is tiered as a whole, by the
+ * hotness of its own pages and whichever process asks: the hot pages of
+ * the inode on the from nodes move to the to node nearest to the task, and
+ * when that node is short of free memory, the cold pages of the inode on
+ * it move back to the from node nearest to it first. The AS_TIER_MANAGE
+ * bit keeps one mm_manage() at a time on an inode.
+ *
+ * The pages are migrated in the batches of migrate_to_node(), exchanges
+ * do not take page cache pages.
+ */
+#define MM_MANAGE_SHARED_MAX	64
+
+/* Free pages of @nid above the high watermarks */
+static unsigned long mm_manage_node_room(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	unsigned long room = 0, free, high;
+	int z;
+
+	for (z = 0; z < pgdat->nr_zones; z++) {
+		struct zone *zone = pgdat->node_zones + z;
+
+		if (!populated_zone(zone))
+			continue;
+		free = zone_page_state(zone, NR_FREE_PAGES);
+		high = high_wmark_pages(zone);
+		if (free > high)
+			room += free - high;
+	}
+
+	return room;
+}
+
+/*
+ * Gather up to @max distinct shmem inodes mapped shared by @mm into
+ * @inodes, with a reference on each.
+ */
+static int mm_manage_shared_inodes(struct mm_struct *mm,
+		struct inode **inodes, int max)
+{
+	struct vm_area_struct *vma;
+	struct address_space *mapping;
+	int nr = 0, i;
+
+	if (down_read_killable(&mm->mmap_sem))
+		return -EINTR;
+
+	for (vma = mm->mmap; vma && nr < max; vma = vma->vm_next) {
+		if (!(vma->vm_flags & VM_SHARED) || !vma->vm_file)
+			continue;
+		mapping = vma->vm_file->f_mapping;
+		if (!shmem_mapping(mapping))
+			continue;
+
+		for (i = 0; i < nr; i++)
+			if (inodes[i] == mapping->host)
+				break;
+		if (i == nr && igrab(mapping->host))
+			inodes[nr++] = mapping->host;
+	}
+
+	up_read(&mm->mmap_sem);
+
+	return nr;
+}
+
+/*
+ * Isolate up to @nr_pages base pages of @mapping on @nodes wanted by
+ * @action onto @list. Returns the number of base pages isolated.
+ */
+static unsigned long mm_manage_isolate_mapping(struct address_space *mapping,
+		const nodemask_t *nodes, enum isolate_action action,
+		unsigned long nr_pages, struct list_head *list)
+{
+	unsigned long nr_taken = 0;
+	struct pagevec pvec;
+	pgoff_t index = 0;
+	struct page *page;
+	int i;
+
+	pagevec_init(&pvec);
+	while (nr_taken < nr_pages && pagevec_lookup(&pvec, mapping, &index)) {
+		for (i = 0; i < pagevec_count(&pvec) && nr_taken < nr_pages; i++) {
+			/* the tail pages of an isolated THP are no longer on the LRU */
+			page = compound_head(pvec.pages[i]);
+			if (!node_isset(page_to_nid(page), *nodes) ||
+			    !PageLRU(page) || PageUnevictable(page))
+				continue;
+			if (!isolate_action_wants(page, page_lru(page), action))
+				continue;
+			if (isolate_lru_page(page))
+				continue;
+
+			mod_node_page_state(page_pgdat(page),
+					NR_ISOLATED_ANON + page_is_file_cache(page),
+					hpage_nr_pages(page));
+			list_add_tail(&page->lru, list);
+			nr_taken += hpage_nr_pages(page);
+		}
+		pagevec_release(&pvec);
+
+		if (fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+
+	return nr_taken;
+}
+
+/*
+ * Tier the pages of @mapping, moving up to @nr_pages of them to the to
+ * node. Returns the number of base pages moved there.
+ */
+static unsigned long mm_manage_shared_mapping(struct address_space *mapping,
+		int cpu_nid, struct page_migration_stats *stats,
+		const nodemask_t *from, const nodemask_t *to,
+		unsigned long nr_pages, int flags)
+{
+	bool migrate_mt = flags & MPOL_MF_MOVE_MT;
+	bool migrate_concur = flags & MPOL_MF_MOVE_CONCUR;
+	bool migrate_dma = flags & MPOL_MF_MOVE_DMA;
+	enum migrate_mode mode = MIGRATE_SYNC |
+		(migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD) |
+		(migrate_dma ? MIGRATE_DMA : MIGRATE_SINGLETHREAD) |
+		(migrate_mt && migrate_dma ? MIGRATE_HYBRID : MIGRATE_SINGLETHREAD) |
+		(migrate_concur ? MIGRATE_CONCUR : MIGRATE_SINGLETHREAD);
+	int to_nid = mm_manage_nearest_node(cpu_nid, to);
+	int back_nid = mm_manage_nearest_node(to_nid, from);
+	nodemask_t to_mask = nodemask_of_node(to_nid);
+	unsigned long nr_hot, nr_cold = 0, room, nr_failed;
+	LIST_HEAD(hot_list);
+	LIST_HEAD(cold_list);
+
+	nr_hot = mm_manage_isolate_mapping(mapping, from,
+			flags & MPOL_MF_MOVE_ALL ? ISOLATE_HOT_AND_COLD_PAGES :
+			ISOLATE_HOT_PAGES, nr_pages, &hot_list);
+	if (!nr_hot)
+		return 0;
+
+	room = mm_manage_node_room(to_nid);
+	if (nr_hot > room)
+		nr_cold = mm_manage_isolate_mapping(mapping, &to_mask,
+				ISOLATE_COLD_PAGES, nr_hot - room, &cold_list);
+	stats->nr_isolated_pages += nr_hot + nr_cold;
+
+	if (nr_cold) {
+		nr_failed = migrate_to_node(&cold_list, back_nid, mode,
+				migration_batch(false, false));
+		stats->f2s.nr_migrations += 1;
+		stats->f2s.nr_base_pages += nr_cold - nr_failed;
+		stats->nr_failed_pages += nr_failed;
+	}
+
+	nr_failed = migrate_to_node(&hot_list, to_nid, mode,
+			migration_batch(false, false));
+	stats->s2f.nr_migrations += 1;
+	stats->s2f.nr_base_pages += nr_hot - nr_failed;
+	stats->nr_failed_pages += nr_failed;
+
+	return nr_hot - nr_failed;
+}
+
+static int do_mm_manage_shared(struct task_struct *p, struct mm_struct *mm,
+		const nodemask_t *from, const nodemask_t *to,
+		unsigned long *nr_pages, int flags)
+{
+	struct page_migration_stats *stats = &p->page_migration_stats;
+	int cpu_nid = cpu_to_node(task_cpu(p));
+	struct address_space *mapping;
+	nodemask_t from_nodes, to_nodes;
+	unsigned long nr_moved;
+	struct inode **inodes;
+	int nr, i;
+
+	nodes_and(from_nodes, *from, node_states[N_MEMORY]);
+	nodes_and(to_nodes, *to, node_states[N_MEMORY]);
+	nodes_andnot(from_nodes, from_nodes, to_nodes);
+	if (nodes_empty(from_nodes) || nodes_empty(to_nodes))
+		return -EINVAL;
+
+	inodes = kmalloc_array(MM_MANAGE_SHARED_MAX, sizeof(*inodes),
+			GFP_KERNEL);
+	if (!inodes)
+		return -ENOMEM;
+
+	nr = mm_manage_shared_inodes(mm, inodes, MM_MANAGE_SHARED_MAX);
+	/* samples the accessed bits of the shared pages too */
+	access_scan_mm(mm);
+	migrate_prep();
+
+	for (i = 0; i < nr; i++) {
+		mapping = inodes[i]->i_mapping;
+		if (*nr_pages && !fatal_signal_pending(current) &&
+		    !test_and_set_bit_lock(AS_TIER_MANAGE, &mapping->flags)) {
+			nr_moved = mm_manage_shared_mapping(mapping, cpu_nid,
+					stats, &from_nodes, &to_nodes,
+					*nr_pages, flags);
+			clear_bit_unlock(AS_TIER_MANAGE, &mapping->flags);
+			if (*nr_pages != ULONG_MAX)
+				*nr_pages -= min(*nr_pages, nr_moved);
+		}
+		iput(inodes[i]);
+	}
+
+	kfree(inodes);
+
+	return nr < 0 ? nr : 0;
+}
+
 static unsigned long shrink_active_list(pg_data_t *pgdat, struct lruvec *lruvec,
 	enum lru_list lru, unsigned long nr_to_scan, bool fast_node)
 {
@@ -631,7 +1804,8 @@ static unsigned long shrink_active_list(pg_data_t *pgdat, struct lruvec *lruvec,
 	spin_lock_irq(&pgdat->lru_lock);
 
 	nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &l_hold, &l_hold,
-				     &nr_scanned, &nr_taken, &nr_taken, 0, lru);
+				     &nr_scanned, &nr_taken, &nr_taken, 0, lru,
+				     ISOLATE_HOT_AND_COLD_PAGES);
 
 	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, nr_taken);
 
@@ -754,7 +1928,8 @@ static unsigned long shrink_inactive_list(pg_data_t *pgdat, struct lruvec *lruve
 	spin_lock_irq(&pgdat->lru_lock);
 
 	nr_taken = isolate_lru_pages(nr_to_scan, lruvec, &page_list, &page_list,
-			&nr_scanned, &nr_taken, &nr_taken, 0, lru);
+			&nr_scanned, &nr_taken, &nr_taken, 0, lru,
+			ISOLATE_HOT_AND_COLD_PAGES);
 
 	__mod_node_page_state(pgdat, NR_ISOLATED_ANON + file, nr_taken);
 
@@ -805,30 +1980,639 @@ static unsigned long shrink_lists_node_memcg(pg_data_t *pgdat,
 	return 0;
 }
 
-static int shrink_lists(struct task_struct *p, struct mm_struct *mm,
+/*
+ * The aging of each (node, memcg) pair is independent of the others, so
+ * shrink_lists_memcg() runs one per node on a worker of the node, in
+ * parallel, and waits for all of them before migration starts.
+ */
+struct shrink_lists_work {
+	struct work_struct work;
+	pg_data_t *pgdat;
+	struct mem_cgroup *memcg;
+	unsigned long nr_to_scan;
+	bool fast_node;
+};
+
+static void shrink_lists_work_fn(struct work_struct *work)
+{
+	struct shrink_lists_work *sw =
+		container_of(work, struct shrink_lists_work, work);
+
+	shrink_lists_node_memcg(sw->pgdat, sw->memcg, sw->nr_to_scan,
+			sw->fast_node);
+}
+
+static int shrink_lists_memcg(struct mem_cgroup *memcg,
 		const nodemask_t *from, const nodemask_t *to, unsigned long nr_to_scan)
 {
-	struct mem_cgroup *memcg = mem_cgroup_from_task(p);
-	int from_nid, to_nid;
+	struct shrink_lists_work *works;
+	nodemask_t nodes;
+	int nid, i, nr_nodes;
 	int err = 0;
 
 	VM_BUG_ON(!memcg);
-	/* Let's handle simplest situation first */
-	VM_BUG_ON(!(nodes_weight(*from) == 1 && nodes_weight(*to) == 1));
 
 	if (memcg == root_mem_cgroup)
 		return 0;
 
-	from_nid = first_node(*from);
-	to_nid = first_node(*to);
+	nodes_or(nodes, *from, *to);
+	nodes_and(nodes, nodes, node_states[N_MEMORY]);
+	nr_nodes = nodes_weight(nodes);
+
+	works = nr_nodes > 1 ?
+		kmalloc_array(nr_nodes, sizeof(*works), GFP_KERNEL) : NULL;
+	if (!works) {
+		for_each_node_mask(nid, nodes)
+			shrink_lists_node_memcg(NODE_DATA(nid), memcg,
+					nr_to_scan, !node_isset(nid, *from));
+		return err;
+	}
 
-	shrink_lists_node_memcg(NODE_DATA(from_nid), memcg, nr_to_scan, false);
+	i = 0;
+	for_each_node_mask(nid, nodes) {
+		struct shrink_lists_work *sw = &works[i++];
+
+		INIT_WORK(&sw->work, shrink_lists_work_fn);
+		sw->pgdat = NODE_DATA(nid);
+		sw->memcg = memcg;
+		sw->nr_to_scan = nr_to_scan;
+		/* a node in both masks is aged as a from node */
+		sw->fast_node = !node_isset(nid, *from);
+		queue_work_node(nid, system_unbound_wq, &sw->work);
+	}
 
-	shrink_lists_node_memcg(NODE_DATA(to_nid), memcg, nr_to_scan, true);
+	for (i = 0; i < nr_nodes; i++)
+		flush_work(&works[i].work);
+	kfree(works);
 
 	return err;
 }
 
+static int shrink_lists(struct task_struct *p, struct mm_struct *mm,
+		const nodemask_t *from, const nodemask_t *to, unsigned long nr_to_scan)
+{
+	return shrink_lists_memcg(mem_cgroup_from_task(p), from, to,
+			nr_to_scan);
+}
+
+#ifdef CONFIG_MEMCG
+/*
+ * In-kernel tiering: a memcg with memory.tiering.interval_ms set runs an
+ * mm_manage() cycle on its own memory every interval from a workqueue,
+ * moving its hot pages from memory.tiering.slow_nodes to
+ * memory.tiering.fast_nodes with the options of memory.tiering.mode and
+ * the copy policy of memory.copy_policy. A cycle does what a launcher
+ * calling mm_manage() in a loop would, without a system call or a
+ * privileged process per workload.
+ */
+static struct workqueue_struct *mem_cgroup_tiering_wq;
+
+static int mem_cgroup_tiering_scan_task(struct task_struct *task, void *arg)
+{
+	struct mm_struct *mm = get_task_mm(task);
+
+	/* threads share the mm, the scan interval keeps it to one scan */
+	if (mm) {
+		access_scan_mm(mm);
+		mmput(mm);
+	}
+
+	return 0;
+}
+
+static void mem_cgroup_tiering_work_fn(struct work_struct *work)
+{
+	struct mem_cgroup_tiering *tiering = container_of(to_delayed_work(work),
+			struct mem_cgroup_tiering, work);
+	struct mem_cgroup *memcg = container_of(tiering, struct mem_cgroup,
+			tiering);
+	struct page_copy_policy copy_policy;
+	nodemask_t fast_nodes, slow_nodes;
+	unsigned long nr_pages;
+	int flags;
+
+	mutex_lock(&tiering->lock);
+	fast_nodes = tiering->fast_nodes;
+	slow_nodes = tiering->slow_nodes;
+	flags = tiering->flags;
+	nr_pages = tiering->nr_pages;
+	mutex_unlock(&tiering->lock);
+
+	if (nodes_empty(fast_nodes) || nodes_empty(slow_nodes))
+		goto requeue;
+
+	if (page_copy_policy_enter(NULL, flags, &copy_policy))
+		goto requeue;
+	__mem_cgroup_copy_policy(memcg, &current->page_copy_policy);
+
+	if (access_scan_enabled())
+		mem_cgroup_scan_tasks(memcg, mem_cgroup_tiering_scan_task,
+				NULL);
+	if (flags & MPOL_MF_SHRINK_LISTS)
+		shrink_lists_memcg(memcg, &slow_nodes, &fast_nodes, nr_pages);
+	mm_manage_memcg(memcg, NUMA_NO_NODE, &tiering->stats, &slow_nodes,
+			&fast_nodes, &nr_pages, flags);
+
+	page_copy_policy_exit(&copy_policy);
+	tiering->nr_cycles++;
+
+requeue:
+	mutex_lock(&tiering->lock);
+	if (tiering->interval_ms && !tiering->offline)
+		queue_delayed_work(mem_cgroup_tiering_wq, &tiering->work,
+				msecs_to_jiffies(tiering->interval_ms));
+	mutex_unlock(&tiering->lock);
+}
+
+void mem_cgroup_tiering_init(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup_tiering *tiering = &memcg->tiering;
+
+	mutex_init(&tiering->lock);
+	INIT_DELAYED_WORK(&tiering->work, mem_cgroup_tiering_work_fn);
+	tiering->flags = MPOL_MF_MOVE;
+	tiering->nr_pages = ULONG_MAX;
+}
+
+/*
+ * Start, reschedule or stop the cycles of @memcg after a change of its
+ * configuration. Called with the tiering lock held.
+ */
+void mem_cgroup_tiering_kick(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup_tiering *tiering = &memcg->tiering;
+
+	lockdep_assert_held(&tiering->lock);
+
+	if (!mem_cgroup_tiering_wq || tiering->offline)
+		return;
+
+	if (tiering->interval_ms)
+		mod_delayed_work(mem_cgroup_tiering_wq, &tiering->work,
+				msecs_to_jiffies(tiering->interval_ms));
+	else
+		cancel_delayed_work(&tiering->work);
+}
+
+/* Stop the cycles of @memcg for good, it is going offline */
+void mem_cgroup_tiering_stop(struct mem_cgroup *memcg)
+{
+	struct mem_cgroup_tiering *tiering = &memcg->tiering;
+
+	mutex_lock(&tiering->lock);
+	tiering->offline = true;
+	mutex_unlock(&tiering->lock);
+
+	cancel_delayed_work_sync(&tiering->work);
+}
+
+/*
+ * memory.demote and memory.promote: move up to @nr_pages base pages of
+ * @memcg and its descendants across the tiers once. A demotion takes the
+ * coldest pages on the fast tier nodes to their demotion target, a
+ * promotion the hottest pages on the slow tier nodes to their promotion
+ * target, both with the concurrent multi-threaded copy under the copy
+ * policy of @memcg. Returns the number of base pages moved.
+ */
+unsigned long mem_cgroup_tier_move(struct mem_cgroup *memcg,
+		unsigned long nr_pages, bool promote)
+{
+	enum migrate_mode mode = MIGRATE_SYNC | MIGRATE_MT | MIGRATE_CONCUR;
+	enum isolate_action action = promote ? ISOLATE_HOT_PAGES :
+		ISOLATE_COLD_PAGES;
+	struct page_copy_policy copy_policy;
+	unsigned long nr_moved = 0;
+	struct mem_cgroup *iter;
+	int nid;
+
+	if (!memory_tiers_present() ||
+	    page_copy_policy_enter(NULL, 0, &copy_policy))
+		return 0;
+	__mem_cgroup_copy_policy(memcg, &current->page_copy_policy);
+
+	for (iter = mem_cgroup_iter(memcg, NULL, NULL); iter;
+	     iter = mem_cgroup_iter(memcg, iter, NULL)) {
+		migrate_prep_memcg(iter);
+
+		for_each_node_state(nid, N_MEMORY) {
+			unsigned long nr_base = 0, nr_huge = 0;
+			unsigned long nr_taken, nr_failed;
+			LIST_HEAD(base_page_list);
+			LIST_HEAD(huge_page_list);
+			int target;
+
+			if (nr_moved >= nr_pages || fatal_signal_pending(current))
+				break;
+			if (node_is_slow_tier(nid) != promote)
+				continue;
+			target = promote ? node_promotion_target(nid) :
+				node_demotion_target(nid);
+			if (target == NUMA_NO_NODE)
+				continue;
+
+			nr_taken = nr_pages - nr_moved;
+			if (!promote)
+				nr_taken = min(nr_taken,
+					mem_cgroup_node_demotable(iter, nid, true));
+			if (!nr_taken)
+				continue;
+
+			nr_taken = isolate_pages_from_lru_list(NODE_DATA(nid),
+					iter, nr_taken,
+					&base_page_list, &huge_page_list,
+					&nr_base, &nr_huge, action);
+			if (!nr_taken)
+				continue;
+
+			nr_failed = migrate_to_node(&base_page_list, target,
+					mode, migration_batch(false, false));
+			nr_failed += migrate_to_node(&huge_page_list, target,
+					mode, migration_batch(false, true));
+			nr_moved += nr_taken - min(nr_taken, nr_failed);
+		}
+
+		if (nr_moved >= nr_pages || fatal_signal_pending(current)) {
+			mem_cgroup_iter_break(memcg, iter);
+			break;
+		}
+	}
+
+	page_copy_policy_exit(&copy_policy);
+
+	return nr_moved;
+}
+
+static int __init mem_cgroup_tiering_wq_init(void)
+{
+	mem_cgroup_tiering_wq = alloc_workqueue("memcg_tiering",
+			WQ_UNBOUND | WQ_FREEZABLE, 0);
+
+	return mem_cgroup_tiering_wq ? 0 : -ENOMEM;
+}
+subsys_initcall(mem_cgroup_tiering_wq_init);
+#endif /* CONFIG_MEMCG */
+
+/*
+ * kmigrated: with MPOL_MF_ASYNC, mm_manage() queues the request to the
+ * kmigrated thread of its first target node and returns at once with a
+ * file descriptor. The descriptor polls readable once the request is done,
+ * and reading it then returns the result of the request as an s64. Its
+ * MM_MANAGE_IOC_PROGRESS ioctl reports the pages the request isolated,
+ * migrated, exchanged and failed to migrate so far, and
+ * MM_MANAGE_IOC_SET_EVENTFD gives it an eventfd to signal on completion.
+ * The threads run at the nice level vm.kmigrated_nice and pace the
+ * requests to vm.kmigrated_rate_pages base pages per second, 0 for no
+ * limit.
+ */
+int sysctl_kmigrated_nice = 0;
+int sysctl_kmigrated_rate_pages = 0;
+
+static struct kthread_worker *kmigrated_workers[MAX_NUMNODES];
+static DEFINE_MUTEX(kmigrated_mutex);
+
+struct kmigrate_request {
+	struct kthread_work work;
+	struct kref ref;
+	struct task_struct *task;
+	struct mm_struct *mm;
+	nodemask_t old;
+	nodemask_t new;
+	unsigned long nr_pages;
+	int flags;
+
+	/* the stats of @task when the request was queued */
+	struct page_migration_stats start;
+
+	spinlock_t lock;		/* protects the fields below */
+	wait_queue_head_t wait;
+	struct eventfd_ctx *eventfd;
+	struct mm_manage_progress progress;	/* once done */
+	bool done;
+	s64 result;
+};
+
+static void kmigrate_request_release(struct kref *ref)
+{
+	struct kmigrate_request *req =
+		container_of(ref, struct kmigrate_request, ref);
+
+	if (req->eventfd)
+		eventfd_ctx_put(req->eventfd);
+	kfree(req);
+}
+
+/* What the stats of the task of @req gained since it was queued */
+static void kmigrate_request_progress(struct kmigrate_request *req,
+		struct mm_manage_progress *progress)
+{
+	struct page_migration_stats *stats = &req->task->page_migration_stats;
+	struct page_migration_stats *start = &req->start;
+
+	progress->nr_isolated = READ_ONCE(stats->nr_isolated_pages) -
+		start->nr_isolated_pages;
+	progress->nr_migrated =
+		READ_ONCE(stats->f2s.nr_base_pages) - start->f2s.nr_base_pages +
+		READ_ONCE(stats->f2s.nr_huge_pages) - start->f2s.nr_huge_pages +
+		READ_ONCE(stats->s2f.nr_base_pages) - start->s2f.nr_base_pages +
+		READ_ONCE(stats->s2f.nr_huge_pages) - start->s2f.nr_huge_pages;
+	progress->nr_exchanged =
+		READ_ONCE(stats->nr_exchange_base_pages) -
+		start->nr_exchange_base_pages +
+		READ_ONCE(stats->nr_exchange_huge_pages) -
+		start->nr_exchange_huge_pages;
+	progress->nr_failed = READ_ONCE(stats->nr_failed_pages) -
+		start->nr_failed_pages;
+}
+
+struct kthread_worker *kmigrated_worker(int nid)
+{
+	struct kthread_worker *worker;
+	int cpu_nid;
+
+	worker = smp_load_acquire(&kmigrated_workers[nid]);
+	if (worker)
+		return worker;
+
+	mutex_lock(&kmigrated_mutex);
+	worker = kmigrated_workers[nid];
+	if (!worker) {
+		worker = kthread_create_worker(0, "kmigrated/%d", nid);
+		if (IS_ERR(worker)) {
+			worker = NULL;
+			goto unlock;
+		}
+		/* PMEM nodes have no CPUs, run next to them */
+		cpu_nid = node_state(nid, N_CPU) ? nid : pmem_nearest_node(nid);
+		if (cpu_nid != NUMA_NO_NODE)
+			set_cpus_allowed_ptr(worker->task, cpumask_of_node(cpu_nid));
+		smp_store_release(&kmigrated_workers[nid], worker);
+	}
+unlock:
+	mutex_unlock(&kmigrated_mutex);
+
+	return worker;
+}
+
+/*
+ * mm_manage() calls on the same mm exclude each other by the nodes they
+ * move pages between, the union of their from and to nodes, so that
+ * managers working on disjoint nodes of a large process, one per socket
+ * for instance, run in parallel. MMF_MM_MANAGE is set while any nodes of
+ * the mm are claimed.
+ */
+static DEFINE_SPINLOCK(mm_manage_nodes_lock);
+
+static bool mm_manage_claim(struct mm_struct *mm, const nodemask_t *from,
+		const nodemask_t *to)
+{
+	nodemask_t nodes;
+	bool claimed = false;
+
+	nodes_or(nodes, *from, *to);
+
+	spin_lock(&mm_manage_nodes_lock);
+	if (!nodes_intersects(mm->mm_manage_nodes, nodes)) {
+		nodes_or(mm->mm_manage_nodes, mm->mm_manage_nodes, nodes);
+		set_bit(MMF_MM_MANAGE, &mm->flags);
+		claimed = true;
+	}
+	spin_unlock(&mm_manage_nodes_lock);
+
+	return claimed;
+}
+
+static void mm_manage_release(struct mm_struct *mm, const nodemask_t *from,
+		const nodemask_t *to)
+{
+	spin_lock(&mm_manage_nodes_lock);
+	nodes_andnot(mm->mm_manage_nodes, mm->mm_manage_nodes, *from);
+	nodes_andnot(mm->mm_manage_nodes, mm->mm_manage_nodes, *to);
+	if (nodes_empty(mm->mm_manage_nodes))
+		clear_bit(MMF_MM_MANAGE, &mm->flags);
+	spin_unlock(&mm_manage_nodes_lock);
+}
+
+static void kmigrated_work_fn(struct kthread_work *work)
+{
+	struct kmigrate_request *req =
+		container_of(work, struct kmigrate_request, work);
+	unsigned long nr_pages = req->nr_pages;
+	/* what is left of the budget for the steps below */
+	unsigned long nr_left = nr_pages;
+	struct page_copy_policy copy_policy;
+	struct migrate_cputime cputime;
+	struct eventfd_ctx *eventfd;
+	int rate;
+	int err;
+
+	set_user_nice(current, READ_ONCE(sysctl_kmigrated_nice));
+
+	err = page_copy_policy_enter(req->mm, req->flags, &copy_policy);
+	if (!err) {
+		migrate_cputime_begin(&cputime, req->task);
+		if (req->flags & MPOL_MF_SHRINK_LISTS)
+			shrink_lists(req->task, req->mm, &req->old, &req->new,
+					req->nr_pages);
+		if (req->flags & MPOL_MF_ROTATE)
+			err = do_mm_manage_rotate(req->task, req->mm,
+					&req->old, &req->new, &nr_left,
+					req->flags);
+		else if (req->flags & MPOL_MF_MOVE)
+			err = do_mm_manage(req->task, req->mm, &req->old,
+					&req->new, &nr_left, req->flags);
+		if (!err && (req->flags & MPOL_MF_SHARED))
+			err = do_mm_manage_shared(req->task, req->mm,
+					&req->old, &req->new, &nr_left,
+					req->flags);
+		migrate_cputime_end(&cputime);
+		page_copy_policy_exit(&copy_policy);
+	}
+
+	mm_manage_release(req->mm, &req->old, &req->new);
+	mmput(req->mm);
+
+	spin_lock(&req->lock);
+	kmigrate_request_progress(req, &req->progress);
+	req->result = err;
+	smp_store_release(&req->done, true);
+	eventfd = req->eventfd;
+	spin_unlock(&req->lock);
+
+	/* the task is only looked at while the request is not done */
+	put_task_struct(req->task);
+
+	if (eventfd)
+		eventfd_signal(eventfd, 1);
+	wake_up_all(&req->wait);
+	kref_put(&req->ref, kmigrate_request_release);
+
+	rate = READ_ONCE(sysctl_kmigrated_rate_pages);
+	if (rate > 0)
+		schedule_timeout_interruptible(
+			DIV_ROUND_UP_ULL((u64)nr_pages * HZ, rate));
+}
+
+static ssize_t kmigrate_read(struct file *file, char __user *buf,
+		size_t count, loff_t *ppos)
+{
+	struct kmigrate_request *req = file->private_data;
+	int err;
+
+	if (count < sizeof(req->result))
+		return -EINVAL;
+
+	if (!smp_load_acquire(&req->done)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		err = wait_event_interruptible(req->wait,
+				smp_load_acquire(&req->done));
+		if (err)
+			return err;
+	}
+
+	if (copy_to_user(buf, &req->result, sizeof(req->result)))
+		return -EFAULT;
+
+	return sizeof(req->result);
+}
+
+static __poll_t kmigrate_poll(struct file *file, poll_table *wait)
+{
+	struct kmigrate_request *req = file->private_data;
+
+	poll_wait(file, &req->wait, wait);
+
+	return smp_load_acquire(&req->done) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static long kmigrate_ioctl_set_eventfd(struct kmigrate_request *req,
+		int __user *arg)
+{
+	struct eventfd_ctx *eventfd, *old;
+	bool done;
+	int fd;
+
+	if (get_user(fd, arg))
+		return -EFAULT;
+
+	eventfd = fd >= 0 ? eventfd_ctx_fdget(fd) : NULL;
+	if (IS_ERR(eventfd))
+		return PTR_ERR(eventfd);
+
+	spin_lock(&req->lock);
+	old = req->eventfd;
+	req->eventfd = eventfd;
+	done = req->done;
+	spin_unlock(&req->lock);
+
+	if (old)
+		eventfd_ctx_put(old);
+	if (done && eventfd)
+		eventfd_signal(eventfd, 1);
+
+	return 0;
+}
+
+static long kmigrate_ioctl(struct file *file, unsigned int cmd,
+		unsigned long arg)
+{
+	struct kmigrate_request *req = file->private_data;
+	struct mm_manage_progress progress;
+
+	switch (cmd) {
+	case MM_MANAGE_IOC_PROGRESS:
+		spin_lock(&req->lock);
+		if (req->done)
+			progress = req->progress;
+		else
+			kmigrate_request_progress(req, &progress);
+		spin_unlock(&req->lock);
+
+		if (copy_to_user((void __user *)arg, &progress,
+				 sizeof(progress)))
+			return -EFAULT;
+		return 0;
+
+	case MM_MANAGE_IOC_SET_EVENTFD:
+		return kmigrate_ioctl_set_eventfd(req, (int __user *)arg);
+
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int kmigrate_release(struct inode *inode, struct file *file)
+{
+	struct kmigrate_request *req = file->private_data;
+
+	kref_put(&req->ref, kmigrate_request_release);
+
+	return 0;
+}
+
+static const struct file_operations kmigrate_fops = {
+	.read		= kmigrate_read,
+	.poll		= kmigrate_poll,
+	.unlocked_ioctl	= kmigrate_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.release	= kmigrate_release,
+	.llseek		= noop_llseek,
+};
+
+/*
+ * Queue an mm_manage() request on @mm to kmigrated, which takes over the
+ * caller's reference on @mm and its claim on the nodes. Returns the file
+ * descriptor reporting its completion.
+ */
+static int kmigrated_queue(struct task_struct *task, struct mm_struct *mm,
+		const nodemask_t *old, const nodemask_t *new,
+		unsigned long nr_pages, int flags)
+{
+	struct kthread_worker *worker;
+	struct kmigrate_request *req;
+	int nid = first_node(*new);
+	int fd;
+
+	/* the request runs on the worker of the node it migrates to */
+	if (nid >= MAX_NUMNODES || !node_state(nid, N_MEMORY))
+		return -EINVAL;
+
+	worker = kmigrated_worker(nid);
+	if (!worker)
+		return -ENOMEM;
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	kthread_init_work(&req->work, kmigrated_work_fn);
+	/* one reference for the file, one for kmigrated */
+	kref_init(&req->ref);
+	kref_get(&req->ref);
+	spin_lock_init(&req->lock);
+	init_waitqueue_head(&req->wait);
+	get_task_struct(task);
+	req->task = task;
+	req->start = task->page_migration_stats;
+	req->mm = mm;
+	req->old = *old;
+	req->new = *new;
+	req->nr_pages = nr_pages;
+	req->flags = flags & ~MPOL_MF_ASYNC;
+
+	fd = anon_inode_getfd("[kmigrate]", &kmigrate_fops, req,
+			O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		put_task_struct(task);
+		kfree(req);
+		return fd;
+	}
+
+	kthread_queue_work(worker, &req->work);
+
+	return fd;
+}
+
 SYSCALL_DEFINE6(mm_manage, pid_t, pid, unsigned long, nr_pages,
 		unsigned long, maxnode,
 		const unsigned long __user *, old_nodes,
@@ -836,6 +2620,8 @@ SYSCALL_DEFINE6(mm_manage, pid_t, pid, unsigned long, nr_pages,
 		int, flags)
 {
 	const struct cred *cred = current_cred(), *tcred;
+	struct page_copy_policy copy_policy;
+	struct migrate_cputime cputime;
 	struct task_struct *task;
 	struct mm_struct *mm = NULL;
 	int err;
@@ -866,7 +2652,11 @@ SYSCALL_DEFINE6(mm_manage, pid_t, pid, unsigned long, nr_pages,
 				  MPOL_MF_MOVE_CONCUR|
 				  MPOL_MF_EXCHANGE|
 				  MPOL_MF_SHRINK_LISTS|
-				  MPOL_MF_MOVE_ALL))
+				  MPOL_MF_MOVE_ALL|
+				  MPOL_MF_ASYNC|
+				  MPOL_MF_ROTATE|
+				  MPOL_MF_SHARED|
+				  MPOL_MF_COPY_POLICY))
 		return -EINVAL;
 
 	/* Find the mm_struct */
@@ -902,34 +2692,51 @@ SYSCALL_DEFINE6(mm_manage, pid_t, pid, unsigned long, nr_pages,
 
 	task_nodes = cpuset_mems_allowed(task);
 	mm = get_task_mm(task);
-	put_task_struct(task);
 
 	if (!mm) {
 		err = -EINVAL;
-		goto out;
+		goto out_put;
 	}
-	if (test_bit(MMF_MM_MANAGE, &mm->flags)) {
+	/* one mm_manage() at a time per node of the mm, queued or not */
+	if (!mm_manage_claim(mm, old, new)) {
 		mmput(mm);
-		goto out;
-	} else {
-		set_bit(MMF_MM_MANAGE, &mm->flags);
+		err = -EBUSY;
+		goto out_put;
 	}
 
+	if (flags & MPOL_MF_ASYNC) {
+		err = kmigrated_queue(task, mm, old, new, nr_pages, flags);
+		if (err < 0)
+			goto out_clear;
+		goto out_put;
+	}
+
+	err = page_copy_policy_enter(mm, flags, &copy_policy);
+	if (err)
+		goto out_clear;
+	migrate_cputime_begin(&cputime, current);
+
 	if (flags & MPOL_MF_SHRINK_LISTS)
 		shrink_lists(task, mm, old, new, nr_pages);
 
-	if (flags & MPOL_MF_MOVE)
-		err = do_mm_manage(task, mm, old, new, nr_pages, flags);
+	/* the steps below share the one budget of nr_pages */
+	if (flags & MPOL_MF_ROTATE)
+		err = do_mm_manage_rotate(task, mm, old, new, &nr_pages, flags);
+	else if (flags & MPOL_MF_MOVE)
+		err = do_mm_manage(task, mm, old, new, &nr_pages, flags);
+	if (!err && (flags & MPOL_MF_SHARED))
+		err = do_mm_manage_shared(task, mm, old, new, &nr_pages, flags);
 
-	clear_bit(MMF_MM_MANAGE, &mm->flags);
+	migrate_cputime_end(&cputime);
+	page_copy_policy_exit(&copy_policy);
+out_clear:
+
+	mm_manage_release(mm, old, new);
 	mmput(mm);
+out_put:
+	put_task_struct(task);
 out:
 	NODEMASK_SCRATCH_FREE(scratch);
 
 	return err;
-
-out_put:
-	put_task_struct(task);
-	goto out;
-
 }
\ No newline at end of file
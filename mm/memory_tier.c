@@ -0,0 +1,504 @@
+/*
+ * Memory tier registry.
+ *
+ * Which NUMA nodes are slow memory is reported by several sources: the
+ * firmware through the HMAT performance attributes, the driver that
+ * onlines the memory (dax kmem for PMEM) and the administrator through
+ * /sys/kernel/mm/memory_tier/nodes. The registry keeps what each source
+ * said about each node and resolves it to one tier, the administrator
+ * overriding the driver overriding the firmware. RPDAA, the NT copy
+ * policies and tiering all look at the resolved tier through
+ * node_is_slow_tier().
+ *
+ * For tiering benchmarks on DRAM-only machines a node, typically a fake
+ * one from numa=fake=, can emulate slow memory: memory_tier_emu= on the
+ * command line or /sys/kernel/mm/memory_tier/emulation puts it in the
+ * slow tier and gives it a bandwidth and a latency. Migrations to and from
+ * the node are then throttled to them through migrate_rate_charge(), so
+ * that the results of the copy engines and of the tiering policies do not
+ * depend on the hardware they ran on. That includes the MIGRATE_ASYNC
+ * promotions of kmigrated and demotions of kswapd. The MIGRATE_ASYNC
+ * migrations of user tasks, from hinting faults or direct reclaim, cannot
+ * sleep and are neither throttled nor charged. Plain loads and stores to the node
+ * run at DRAM speed, there is no cheap way to slow those down.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/node.h>
+#include <linux/nodemask.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/string.h>
+#include <linux/memory_tier.h>
+#include <linux/migrate.h>
+#include <linux/mmzone.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+
+#include "internal.h"
+
+// IS_PMEM_NODE[x] stores if NUMA node x is in the slow memory tier
+char IS_PMEM_NODE[MAX_NUMNODES];
+EXPORT_SYMBOL(IS_PMEM_NODE);
+int nr_slow_tier_nodes;
+
+struct memory_tier_node {
+	/* tier reported by each source, -1 if it did not report one */
+	s8 tier[NR_MEMORY_TIER_SOURCES];
+	bool has_perf;
+	struct node_hmem_attrs perf;
+	/* emulated slow memory: MB/s and ns per page, 0 for unlimited */
+	unsigned int emu_bandwidth;
+	unsigned int emu_latency;
+	/* when the copies charged so far would be done on the emulated node */
+	atomic64_t emu_busy;
+};
+
+static struct memory_tier_node memory_tier_nodes[MAX_NUMNODES] = {
+	[0 ... MAX_NUMNODES - 1] = {
+		.tier = { [0 ... NR_MEMORY_TIER_SOURCES - 1] = -1 },
+	},
+};
+static DEFINE_MUTEX(memory_tier_mutex);
+
+static const char * const memory_tier_names[NR_MEMORY_TIERS] = {
+	[MEMORY_TIER_FAST] = "fast",
+	[MEMORY_TIER_SLOW] = "slow",
+};
+
+const char * const tier_fallback_names[NR_TIER_FALLBACKS] = {
+	[TIER_FALLBACK_DEFAULT] = "default",
+	[TIER_FALLBACK_DISTANCE] = "distance",
+	[TIER_FALLBACK_FAST] = "fast",
+	[TIER_FALLBACK_SLOW] = "slow",
+};
+
+DEFINE_STATIC_KEY_FALSE(tier_fallback_used);
+
+/* Look the tier fallback of allocations up from now on */
+void tier_fallback_enable(void)
+{
+	static_branch_enable(&tier_fallback_used);
+}
+
+static const char * const memory_tier_source_names[NR_MEMORY_TIER_SOURCES] = {
+	[MEMORY_TIER_SRC_FIRMWARE] = "firmware",
+	[MEMORY_TIER_SRC_EMULATED] = "emulated",
+	[MEMORY_TIER_SRC_DRIVER] = "driver",
+	[MEMORY_TIER_SRC_ADMIN] = "admin",
+};
+
+/* Source deciding the tier of @nid, -1 if none reported one */
+static int memory_tier_source(int nid)
+{
+	int src;
+
+	for (src = NR_MEMORY_TIER_SOURCES - 1; src >= 0; src--)
+		if (memory_tier_nodes[nid].tier[src] >= 0)
+			return src;
+
+	return -1;
+}
+
+static int memory_tier_of(int nid)
+{
+	int src = memory_tier_source(nid);
+
+	return src < 0 ? MEMORY_TIER_FAST : memory_tier_nodes[nid].tier[src];
+}
+
+/* Publish the resolved tiers, called with memory_tier_mutex held */
+static void memory_tier_resolve(void)
+{
+	bool changed = false;
+	int nid, nr_slow = 0;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		char slow = memory_tier_of(nid) == MEMORY_TIER_SLOW;
+
+		if (IS_PMEM_NODE[nid] != slow) {
+			WRITE_ONCE(IS_PMEM_NODE[nid], slow);
+			changed = true;
+		}
+		nr_slow += slow;
+	}
+	WRITE_ONCE(nr_slow_tier_nodes, nr_slow);
+
+#ifdef CONFIG_MIGRATION
+	if (changed)
+		pmem_topology_update();
+#endif
+	/* the tier-ordered zonelists follow the tiers */
+	if (changed && IS_ENABLED(CONFIG_NUMA))
+		build_all_zonelists(NULL);
+	/* and so does the promotion headroom of the fast tier */
+	if (changed && READ_ONCE(promote_headroom_factor))
+		setup_per_zone_wmarks();
+}
+
+/*
+ * Record that @src considers @nid to be in @tier, or withdraw what @src
+ * said if @tier is -1.
+ */
+void memory_tier_set(int nid, enum memory_tier_source src, int tier)
+{
+	if (nid < 0 || nid >= MAX_NUMNODES || tier < -1 ||
+	    tier >= NR_MEMORY_TIERS)
+		return;
+
+	mutex_lock(&memory_tier_mutex);
+	memory_tier_nodes[nid].tier[src] = tier;
+	memory_tier_resolve();
+	mutex_unlock(&memory_tier_mutex);
+}
+EXPORT_SYMBOL(memory_tier_set);
+
+/*
+ * Slow tier node the pages of the fast tier node @nid are demoted to, the
+ * nearest one with memory, NUMA_NO_NODE if @nid is slow or there is none.
+ */
+int node_demotion_target(int nid)
+{
+	int target = NUMA_NO_NODE;
+	int n;
+
+	if (node_is_slow_tier(nid))
+		return NUMA_NO_NODE;
+
+	for_each_node_state(n, N_MEMORY) {
+		if (!node_is_slow_tier(n))
+			continue;
+		if (target == NUMA_NO_NODE ||
+		    node_distance(nid, n) < node_distance(nid, target))
+			target = n;
+	}
+
+	return target;
+}
+
+/*
+ * Fast tier node the pages of the slow tier node @nid are promoted to, the
+ * nearest one with memory, NUMA_NO_NODE if @nid is fast or there is none.
+ */
+int node_promotion_target(int nid)
+{
+	int target = NUMA_NO_NODE;
+	int n;
+
+	if (!node_is_slow_tier(nid))
+		return NUMA_NO_NODE;
+
+	for_each_node_state(n, N_MEMORY) {
+		if (node_is_slow_tier(n))
+			continue;
+		if (target == NUMA_NO_NODE ||
+		    node_distance(nid, n) < node_distance(nid, target))
+			target = n;
+	}
+
+	return target;
+}
+
+/*
+ * Classify the nodes with firmware performance attributes: a node whose
+ * read or write bandwidth is under half of the best node's, or whose read
+ * latency is over twice the best node's, is slow memory.
+ */
+static void memory_tier_classify_firmware(void)
+{
+	unsigned int max_read = 0, max_write = 0, min_latency = UINT_MAX;
+	struct node_hmem_attrs *perf;
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		if (!memory_tier_nodes[nid].has_perf)
+			continue;
+		perf = &memory_tier_nodes[nid].perf;
+		max_read = max(max_read, perf->read_bandwidth);
+		max_write = max(max_write, perf->write_bandwidth);
+		if (perf->read_latency)
+			min_latency = min(min_latency, perf->read_latency);
+	}
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		bool slow;
+
+		if (!memory_tier_nodes[nid].has_perf)
+			continue;
+		perf = &memory_tier_nodes[nid].perf;
+		slow = (perf->read_bandwidth &&
+			perf->read_bandwidth * 2 < max_read) ||
+		       (perf->write_bandwidth &&
+			perf->write_bandwidth * 2 < max_write) ||
+		       (min_latency != UINT_MAX &&
+			perf->read_latency > min_latency * 2);
+
+		memory_tier_nodes[nid].tier[MEMORY_TIER_SRC_FIRMWARE] =
+			slow ? MEMORY_TIER_SLOW : MEMORY_TIER_FAST;
+	}
+}
+
+/* Performance attributes of @nid from its best initiator, from the HMAT */
+void memory_tier_set_perf(int nid, const struct node_hmem_attrs *attrs)
+{
+	if (nid < 0 || nid >= MAX_NUMNODES)
+		return;
+
+	mutex_lock(&memory_tier_mutex);
+	memory_tier_nodes[nid].perf = *attrs;
+	memory_tier_nodes[nid].has_perf = true;
+	memory_tier_classify_firmware();
+	memory_tier_resolve();
+	mutex_unlock(&memory_tier_mutex);
+}
+EXPORT_SYMBOL(memory_tier_set_perf);
+
+bool memory_tier_get_perf(int nid, struct node_hmem_attrs *attrs)
+{
+	bool ret;
+
+	if (nid < 0 || nid >= MAX_NUMNODES)
+		return false;
+
+	mutex_lock(&memory_tier_mutex);
+	ret = memory_tier_nodes[nid].has_perf;
+	if (ret)
+		*attrs = memory_tier_nodes[nid].perf;
+	mutex_unlock(&memory_tier_mutex);
+
+	return ret;
+}
+EXPORT_SYMBOL(memory_tier_get_perf);
+
+/*
+ * Mean of the read and write bandwidths of @nid in MB/s, 0 if unknown.
+ * Lockless, for the allocation paths.
+ */
+unsigned int memory_tier_bandwidth(int nid)
+{
+	struct memory_tier_node *mtn;
+
+	if (nid < 0 || nid >= MAX_NUMNODES)
+		return 0;
+
+	mtn = &memory_tier_nodes[nid];
+	if (READ_ONCE(mtn->emu_bandwidth))
+		return READ_ONCE(mtn->emu_bandwidth);
+	if (!READ_ONCE(mtn->has_perf))
+		return 0;
+
+	return (READ_ONCE(mtn->perf.read_bandwidth) +
+		READ_ONCE(mtn->perf.write_bandwidth)) / 2;
+}
+
+DEFINE_STATIC_KEY_FALSE(memory_tier_emu_used);
+
+/*
+ * Each emulated node has a timeline of when the copies charged to it would
+ * be done at its bandwidth and latency. A copy starts when the previous
+ * ones are done, or now if they are, and the wait is how far the end of
+ * the timeline is ahead of now. Copies that take longer than that on the
+ * real memory leave the timeline behind and are not slowed down.
+ */
+u64 __memory_tier_emu_charge(int nid, u64 bytes, u64 now)
+{
+	struct memory_tier_node *mtn;
+	unsigned int bandwidth, latency;
+	s64 busy, start, cost;
+
+	if (nid < 0 || nid >= MAX_NUMNODES)
+		return 0;
+
+	mtn = &memory_tier_nodes[nid];
+	bandwidth = READ_ONCE(mtn->emu_bandwidth);
+	latency = READ_ONCE(mtn->emu_latency);
+	if (!bandwidth && !latency)
+		return 0;
+
+	/* MB/s are bytes per microsecond */
+	cost = (u64)latency * DIV_ROUND_UP(bytes, PAGE_SIZE);
+	if (bandwidth)
+		cost += div_u64(bytes * NSEC_PER_USEC, bandwidth);
+
+	busy = atomic64_read(&mtn->emu_busy);
+	do {
+		start = max_t(s64, busy, now);
+	} while (!atomic64_try_cmpxchg(&mtn->emu_busy, &busy, start + cost));
+
+	return start + cost - now;
+}
+
+/*
+ * Make @nid emulate slow memory of @bandwidth MB/s and @latency ns per
+ * page, both 0 for unlimited, or stop emulating if @enable is false.
+ */
+static void memory_tier_emu_set(int nid, bool enable, unsigned int bandwidth,
+		unsigned int latency)
+{
+	struct memory_tier_node *mtn = &memory_tier_nodes[nid];
+
+	WRITE_ONCE(mtn->emu_bandwidth, enable ? bandwidth : 0);
+	WRITE_ONCE(mtn->emu_latency, enable ? latency : 0);
+	if (enable && (bandwidth || latency))
+		static_branch_enable(&memory_tier_emu_used);
+	memory_tier_set(nid, MEMORY_TIER_SRC_EMULATED,
+			enable ? MEMORY_TIER_SLOW : -1);
+}
+
+/* memory_tier_emu=<nodelist>[:<MB/s>[:<ns per page>]], applied at init */
+static nodemask_t memory_tier_emu_nodes __initdata;
+static unsigned int memory_tier_emu_bandwidth __initdata;
+static unsigned int memory_tier_emu_latency __initdata;
+
+static int __init memory_tier_emu_setup(char *str)
+{
+	char *nodes = strsep(&str, ":");
+	char *bandwidth = strsep(&str, ":");
+
+	if (nodelist_parse(nodes, memory_tier_emu_nodes) ||
+	    (bandwidth && kstrtouint(bandwidth, 0, &memory_tier_emu_bandwidth)) ||
+	    (str && kstrtouint(str, 0, &memory_tier_emu_latency))) {
+		pr_warn("memory tier: bad memory_tier_emu=\n");
+		nodes_clear(memory_tier_emu_nodes);
+	}
+
+	return 1;
+}
+__setup("memory_tier_emu=", memory_tier_emu_setup);
+
+/*
+ * /sys/kernel/mm/memory_tier/nodes: one "nid tier source" line per memory
+ * node, followed by the read/write bandwidths (MB/s) and latencies (ns)
+ * when the firmware reported them. Writing "nid fast|slow" overrides the
+ * tier of a node, "nid auto" drops the override.
+ */
+static ssize_t nodes_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	ssize_t len = 0;
+	int nid, src;
+
+	mutex_lock(&memory_tier_mutex);
+	for_each_node_state(nid, N_MEMORY) {
+		struct memory_tier_node *mtn = &memory_tier_nodes[nid];
+
+		src = memory_tier_source(nid);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %s %s", nid,
+				memory_tier_names[memory_tier_of(nid)],
+				src < 0 ? "default" : memory_tier_source_names[src]);
+		if (mtn->has_perf)
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					" %u %u %u %u",
+					mtn->perf.read_bandwidth,
+					mtn->perf.write_bandwidth,
+					mtn->perf.read_latency,
+					mtn->perf.write_latency);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+	mutex_unlock(&memory_tier_mutex);
+
+	return len;
+}
+
+static ssize_t nodes_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	char name[8];
+	int nid, tier;
+
+	if (sscanf(buf, "%d %7s", &nid, name) != 2)
+		return -EINVAL;
+	if (nid < 0 || nid >= MAX_NUMNODES)
+		return -EINVAL;
+
+	if (!strcmp(name, "auto"))
+		tier = -1;
+	else {
+		tier = match_string(memory_tier_names, NR_MEMORY_TIERS, name);
+		if (tier < 0)
+			return -EINVAL;
+	}
+
+	memory_tier_set(nid, MEMORY_TIER_SRC_ADMIN, tier);
+
+	return count;
+}
+static struct kobj_attribute nodes_attr = __ATTR_RW(nodes);
+
+/*
+ * /sys/kernel/mm/memory_tier/emulation: one "nid bandwidth latency" line
+ * per node emulating slow memory, in MB/s and ns per page. Writing "nid
+ * bandwidth latency" makes a node emulate slow memory, "nid off" stops it.
+ */
+static ssize_t emulation_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	int nid;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len, "node bandwidth latency\n");
+
+	mutex_lock(&memory_tier_mutex);
+	for_each_node_state(nid, N_MEMORY) {
+		struct memory_tier_node *mtn = &memory_tier_nodes[nid];
+
+		if (mtn->tier[MEMORY_TIER_SRC_EMULATED] < 0)
+			continue;
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %u %u\n", nid,
+				mtn->emu_bandwidth, mtn->emu_latency);
+	}
+	mutex_unlock(&memory_tier_mutex);
+
+	return len;
+}
+
+static ssize_t emulation_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	unsigned int bandwidth, latency;
+	char name[4];
+	int nid;
+
+	if (sscanf(buf, "%d %u %u", &nid, &bandwidth, &latency) == 3) {
+		if (nid < 0 || nid >= MAX_NUMNODES ||
+		    !node_state(nid, N_MEMORY))
+			return -EINVAL;
+		memory_tier_emu_set(nid, true, bandwidth, latency);
+	} else if (sscanf(buf, "%d %3s", &nid, name) == 2 &&
+		   !strcmp(name, "off")) {
+		if (nid < 0 || nid >= MAX_NUMNODES)
+			return -EINVAL;
+		memory_tier_emu_set(nid, false, 0, 0);
+	} else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute emulation_attr = __ATTR_RW(emulation);
+
+static struct attribute *memory_tier_attrs[] = {
+	&nodes_attr.attr,
+	&emulation_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group memory_tier_attr_group = {
+	.attrs = memory_tier_attrs,
+};
+
+static int __init memory_tier_init(void)
+{
+	int nid;
+
+	for_each_node_mask(nid, memory_tier_emu_nodes) {
+		memory_tier_emu_set(nid, true, memory_tier_emu_bandwidth,
+				memory_tier_emu_latency);
+		pr_info("memory tier: node %d emulates slow memory\n", nid);
+	}
+
+	return mm_sysfs_add_group("memory_tier", &memory_tier_attr_group);
+}
+subsys_initcall(memory_tier_init);
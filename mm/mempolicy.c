@@ -99,6 +99,9 @@
 #include <linux/mmu_notifier.h>
 #include <linux/printk.h>
 #include <linux/swapops.h>
+#include <linux/memory_tier.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
 
 #include <asm/tlbflush.h>
 #include <linux/uaccess.h>
@@ -109,6 +112,10 @@
 #define MPOL_MF_DISCONTIG_OK (MPOL_MF_INTERNAL << 0)	/* Skip checks for continuous vmas */
 #define MPOL_MF_INVERT (MPOL_MF_INTERNAL << 1)		/* Invert check for nodemask */
 
+/* Copy mode of mbind() and migrate_pages(), kept apart from the flags above */
+#define MPOL_MF_MOVE_ACCEL	(MPOL_MF_MOVE_MT | MPOL_MF_MOVE_CONCUR | \
+				 MPOL_MF_MOVE_DMA | MPOL_MF_COPY_POLICY)
+
 static struct kmem_cache *policy_cache;
 static struct kmem_cache *sn_cache;
 
@@ -146,6 +153,49 @@ struct mempolicy *get_task_policy(struct task_struct *p)
 	return &default_policy;
 }
 
+/*
+ * Fallback order of the allocations of the current task: what its task
+ * policy asks for, else what its memcg does.
+ */
+enum tier_fallback current_tier_fallback(void)
+{
+	struct mempolicy *pol = current->mempolicy;
+
+	if (pol && (pol->flags & MPOL_F_TIER_FAST))
+		return TIER_FALLBACK_FAST;
+	if (pol && (pol->flags & MPOL_F_TIER_SLOW))
+		return TIER_FALLBACK_SLOW;
+
+	return mem_cgroup_tier_fallback();
+}
+
+/*
+ * Node of the current socket an MPOL_F_LOCAL policy allocates on: the
+ * local one, or for MPOL_PREFERRED_TIER the fast or the slow tier node of
+ * the socket, so that the placement follows the task across sockets.
+ */
+static int mpol_local_node(const struct mempolicy *pol)
+{
+	int nid = numa_node_id();
+	int target;
+
+	if (!(pol->flags & MPOL_F_PREFERRED_TIER))
+		return nid;
+
+	if (node_is_slow_tier(nid)) {
+		target = node_promotion_target(nid);
+		if (target != NUMA_NO_NODE)
+			nid = target;
+	}
+	if (pol->flags & MPOL_F_TIER_SLOW) {
+		target = node_demotion_target(nid);
+		if (target != NUMA_NO_NODE)
+			nid = target;
+	}
+
+	return nid;
+}
+
 static const struct mempolicy_operations {
 	int (*create)(struct mempolicy *pol, const nodemask_t *nodes);
 	void (*rebind)(struct mempolicy *pol, const nodemask_t *nodes);
@@ -153,7 +203,50 @@ static const struct mempolicy_operations {
 
 static inline int mpol_store_user_nodemask(const struct mempolicy *pol)
 {
-	return pol->flags & MPOL_MODE_FLAGS;
+	return pol->flags & (MPOL_F_STATIC_NODES | MPOL_F_RELATIVE_NODES);
+}
+
+/*
+ * Interleave weights of MPOL_F_WEIGHTED, set in
+ * /sys/kernel/mm/weighted_interleave/nodes, 0 for the default derived from
+ * the bandwidth of the node in the memory tier registry
+ */
+static u8 iw_weights[MAX_NUMNODES];
+
+/* one default weight unit per GB/s of bandwidth */
+#define IW_BANDWIDTH_UNIT	1024
+
+static unsigned int iw_default_weight(int nid)
+{
+	unsigned int bw = memory_tier_bandwidth(nid);
+
+	return clamp_t(unsigned int, DIV_ROUND_UP(bw, IW_BANDWIDTH_UNIT),
+		       1, U8_MAX);
+}
+
+/* Allocations in a row on @nid per weighted interleave round */
+static unsigned int iw_weight(int nid)
+{
+	unsigned int weight = READ_ONCE(iw_weights[nid]);
+
+	return weight ? weight : iw_default_weight(nid);
+}
+
+/* The MPOL_MF_MOVE_* copy mode that @pol asks for by default */
+static int mpol_migrate_flags(const struct mempolicy *pol)
+{
+	int flags = 0;
+
+	if (!pol)
+		return 0;
+	if (pol->flags & MPOL_F_MOVE_MT)
+		flags |= MPOL_MF_MOVE_MT;
+	if (pol->flags & MPOL_F_MOVE_CONCUR)
+		flags |= MPOL_MF_MOVE_CONCUR;
+	if (pol->flags & MPOL_F_MOVE_DMA)
+		flags |= MPOL_MF_MOVE_DMA;
+
+	return flags;
 }
 
 static void mpol_relative_nodemask(nodemask_t *ret, const nodemask_t *orig,
@@ -248,7 +341,11 @@ static struct mempolicy *mpol_new(unsigned short mode, unsigned short flags,
 		 mode, flags, nodes ? nodes_addr(*nodes)[0] : NUMA_NO_NODE);
 
 	if (mode == MPOL_DEFAULT) {
-		if (nodes && !nodes_empty(*nodes))
+		/* there is no policy left to carry the fallback tier or copy mode */
+		if ((nodes && !nodes_empty(*nodes)) ||
+		    (flags & (MPOL_F_TIER_FAST | MPOL_F_TIER_SLOW |
+			      MPOL_F_MOVE_MT | MPOL_F_MOVE_CONCUR |
+			      MPOL_F_MOVE_DMA)))
 			return ERR_PTR(-EINVAL);
 		return NULL;
 	}
@@ -271,8 +368,19 @@ static struct mempolicy *mpol_new(unsigned short mode, unsigned short flags,
 		    (flags & MPOL_F_RELATIVE_NODES))
 			return ERR_PTR(-EINVAL);
 		mode = MPOL_PREFERRED;
+	} else if (mode == MPOL_PREFERRED_TIER) {
+		if (!nodes_empty(*nodes) ||
+		    (flags & MPOL_F_STATIC_NODES) ||
+		    (flags & MPOL_F_RELATIVE_NODES) ||
+		    ((flags & MPOL_F_TIER_FAST) && (flags & MPOL_F_TIER_SLOW)))
+			return ERR_PTR(-EINVAL);
+		mode = MPOL_PREFERRED;
+		/* NUMA balancing moves the pages after the task */
+		flags |= MPOL_F_PREFERRED_TIER | MPOL_F_MOF;
 	} else if (nodes_empty(*nodes))
 		return ERR_PTR(-EINVAL);
+	if ((flags & MPOL_F_WEIGHTED) && mode != MPOL_INTERLEAVE)
+		return ERR_PTR(-EINVAL);
 	policy = kmem_cache_alloc(policy_cache, GFP_KERNEL);
 	if (!policy)
 		return ERR_PTR(-ENOMEM);
@@ -829,8 +937,10 @@ static long do_set_mempolicy(unsigned short mode, unsigned short flags,
 	}
 	old = current->mempolicy;
 	current->mempolicy = new;
-	if (new && new->mode == MPOL_INTERLEAVE)
+	if (new && new->mode == MPOL_INTERLEAVE) {
 		current->il_prev = MAX_NUMNODES-1;
+		current->il_weight = 0;
+	}
 	task_unlock(current);
 	mpol_put(old);
 	ret = 0;
@@ -944,7 +1054,12 @@ static long do_get_mempolicy(int *policy, nodemask_t *nmask,
 			*policy = err;
 		} else if (pol == current->mempolicy &&
 				pol->mode == MPOL_INTERLEAVE) {
-			*policy = next_node_in(current->il_prev, pol->v.nodes);
+			if ((pol->flags & MPOL_F_WEIGHTED) &&
+			    current->il_weight)
+				*policy = current->il_prev;
+			else
+				*policy = next_node_in(current->il_prev,
+						       pol->v.nodes);
 		} else {
 			err = -EINVAL;
 			goto out;
@@ -952,6 +1067,8 @@ static long do_get_mempolicy(int *policy, nodemask_t *nmask,
 	} else {
 		*policy = pol == &default_policy ? MPOL_DEFAULT :
 						pol->mode;
+		if (pol->flags & MPOL_F_PREFERRED_TIER)
+			*policy = MPOL_PREFERRED_TIER;
 		/*
 		 * Internal mempolicy flags must be masked off before exposing
 		 * the policy to userspace.
@@ -1020,16 +1137,32 @@ struct page *alloc_new_node_page(struct page *page, unsigned long node)
 	else if (PageTransHuge(page)) {
 		struct page *thp;
 
+		/* NULL has migrate_pages() split the THP for a node of never */
+		if (!thp_node_target_allowed(node))
+			return NULL;
+
+		/* the concurrent path may have allocated it in bulk already */
+		thp = migrate_target_cache_get(node, HPAGE_PMD_ORDER);
+		if (!thp)
+			thp = prezero_pool_get(node);
+		if (thp)
+			return thp;
+
 		thp = alloc_pages_node(node,
-			(GFP_TRANSHUGE | __GFP_THISNODE),
+			thp_node_defrag_gfpmask(node, GFP_TRANSHUGE) | __GFP_THISNODE,
 			HPAGE_PMD_ORDER);
 		if (!thp)
 			return NULL;
 		prep_transhuge_page(thp);
 		return thp;
-	} else
+	} else {
+		struct page *newpage = migrate_target_cache_get(node, 0);
+
+		if (newpage)
+			return newpage;
 		return __alloc_pages_node(node, GFP_HIGHUSER_MOVABLE |
 						    __GFP_THISNODE, 0);
+	}
 }
 
 /*
@@ -1053,11 +1186,13 @@ static int migrate_to_node(struct mm_struct *mm, int source, int dest,
 	 */
 	VM_BUG_ON(!(flags & (MPOL_MF_MOVE | MPOL_MF_MOVE_ALL)));
 	queue_pages_range(mm, mm->mmap->vm_start, mm->task_size, &nmask,
-			flags | MPOL_MF_DISCONTIG_OK, &pagelist);
+			(flags & ~MPOL_MF_MOVE_ACCEL) | MPOL_MF_DISCONTIG_OK,
+			&pagelist);
 
 	if (!list_empty(&pagelist)) {
-		err = migrate_pages(&pagelist, alloc_new_node_page, NULL, dest,
-					MIGRATE_SYNC, MR_SYSCALL);
+		err = migrate_pages_flags(mm, &pagelist, alloc_new_node_page,
+				NULL, dest, flags & MPOL_MF_MOVE_ACCEL,
+				MR_SYSCALL);
 		if (err)
 			putback_movable_pages(&pagelist);
 	}
@@ -1065,6 +1200,76 @@ static int migrate_to_node(struct mm_struct *mm, int source, int dest,
 	return err;
 }
 
+/*
+ * do_migrate_pages() for a task under a weighted interleave policy: the
+ * pages on the @from nodes are dealt out over the @to nodes in proportion
+ * to their interleave weights, the pages dealt to the node they are on
+ * staying there.
+ */
+static int do_migrate_pages_weighted(struct mm_struct *mm,
+		const nodemask_t *from, const nodemask_t *to, int flags)
+{
+	nodemask_t nmask = *from;
+	struct list_head *lists;
+	struct page *page, *next;
+	LIST_HEAD(pagelist);
+	LIST_HEAD(stay);
+	int nid = NUMA_NO_NODE;
+	unsigned int left = 0;
+	int busy = 0;
+	int err;
+
+	err = migrate_prep();
+	if (err)
+		return err;
+
+	lists = kmalloc_array(nr_node_ids, sizeof(*lists), GFP_KERNEL);
+	if (!lists)
+		return -ENOMEM;
+	for (nid = 0; nid < nr_node_ids; nid++)
+		INIT_LIST_HEAD(&lists[nid]);
+
+	down_read(&mm->mmap_sem);
+	queue_pages_range(mm, mm->mmap->vm_start, mm->task_size, &nmask,
+			(flags & ~MPOL_MF_MOVE_ACCEL) | MPOL_MF_DISCONTIG_OK,
+			&pagelist);
+
+	nid = NUMA_NO_NODE;
+	list_for_each_entry_safe(page, next, &pagelist, lru) {
+		if (!left) {
+			nid = next_node_in(nid, *to);
+			left = iw_weight(nid);
+		}
+		left--;
+		if (page_to_nid(page) == nid)
+			list_move_tail(&page->lru, &stay);
+		else
+			list_move_tail(&page->lru, &lists[nid]);
+	}
+	putback_movable_pages(&stay);
+
+	for_each_node_mask(nid, *to) {
+		if (list_empty(&lists[nid]))
+			continue;
+		err = migrate_pages_flags(mm, &lists[nid], alloc_new_node_page,
+				NULL, nid, flags & MPOL_MF_MOVE_ACCEL,
+				MR_SYSCALL);
+		if (err)
+			putback_movable_pages(&lists[nid]);
+		if (err < 0)
+			break;
+		busy += err;
+	}
+	/* what an error left unmigrated */
+	for_each_node_mask(nid, *to)
+		putback_movable_pages(&lists[nid]);
+	up_read(&mm->mmap_sem);
+
+	kfree(lists);
+
+	return err < 0 ? err : busy;
+}
+
 /*
  * Move pages between the two nodesets so as to preserve the physical
  * layout as much as possible.
@@ -1223,6 +1428,12 @@ int do_migrate_pages(struct mm_struct *mm, const nodemask_t *from,
 	return -ENOSYS;
 }
 
+static int do_migrate_pages_weighted(struct mm_struct *mm,
+		const nodemask_t *from, const nodemask_t *to, int flags)
+{
+	return -ENOSYS;
+}
+
 static struct page *new_page(struct page *page, unsigned long start)
 {
 	return NULL;
@@ -1238,10 +1449,12 @@ static long do_mbind(unsigned long start, unsigned long len,
 	unsigned long end;
 	int err;
 	int ret;
+	int mflags = flags & MPOL_MF_MOVE_ACCEL;
 	LIST_HEAD(pagelist);
 
-	if (flags & ~(unsigned long)MPOL_MF_VALID)
+	if (flags & ~(unsigned long)(MPOL_MF_VALID | MPOL_MF_MOVE_ACCEL))
 		return -EINVAL;
+	flags &= ~MPOL_MF_MOVE_ACCEL;
 	if ((flags & MPOL_MF_MOVE_ALL) && !capable(CAP_SYS_NICE))
 		return -EPERM;
 
@@ -1314,13 +1527,18 @@ static long do_mbind(unsigned long start, unsigned long len,
 
 		if (!list_empty(&pagelist)) {
 			WARN_ON_ONCE(flags & MPOL_MF_LAZY);
-			nr_failed = migrate_pages(&pagelist, new_page, NULL,
-				start, MIGRATE_SYNC, MR_MEMPOLICY_MBIND);
+			if (!(mflags & ~MPOL_MF_COPY_POLICY))
+				mflags |= mpol_migrate_flags(new);
+			nr_failed = migrate_pages_flags(mm, &pagelist, new_page,
+				NULL, start, mflags, MR_MEMPOLICY_MBIND);
 			if (nr_failed)
 				putback_movable_pages(&pagelist);
 		}
 
-		if ((ret > 0) || (nr_failed && (flags & MPOL_MF_STRICT)))
+		/* the policy is set, only MPOL_MF_STRICT cares for the pages */
+		if (nr_failed < 0 && (flags & MPOL_MF_STRICT))
+			err = nr_failed;
+		else if ((ret > 0) || (nr_failed && (flags & MPOL_MF_STRICT)))
 			err = -EIO;
 	} else {
 up_out:
@@ -1432,6 +1650,13 @@ static long kernel_mbind(unsigned long start, unsigned long len,
 	if ((mode_flags & MPOL_F_STATIC_NODES) &&
 	    (mode_flags & MPOL_F_RELATIVE_NODES))
 		return -EINVAL;
+	/*
+	 * The fallback order is looked up from the task policy only, the
+	 * flags pick the tier of MPOL_PREFERRED_TIER
+	 */
+	if ((mode_flags & (MPOL_F_TIER_FAST | MPOL_F_TIER_SLOW)) &&
+	    mode != MPOL_PREFERRED_TIER)
+		return -EINVAL;
 	err = get_nodes(&nodes, nmask, maxnode);
 	if (err)
 		return err;
@@ -1459,9 +1684,13 @@ static long kernel_set_mempolicy(int mode, const unsigned long __user *nmask,
 		return -EINVAL;
 	if ((flags & MPOL_F_STATIC_NODES) && (flags & MPOL_F_RELATIVE_NODES))
 		return -EINVAL;
+	if ((flags & MPOL_F_TIER_FAST) && (flags & MPOL_F_TIER_SLOW))
+		return -EINVAL;
 	err = get_nodes(&nodes, nmask, maxnode);
 	if (err)
 		return err;
+	if (flags & (MPOL_F_TIER_FAST | MPOL_F_TIER_SLOW))
+		tier_fallback_enable();
 	return do_set_mempolicy(mode, flags, &nodes);
 }
 
@@ -1478,6 +1707,8 @@ static int kernel_migrate_pages(pid_t pid, unsigned long maxnode,
 	struct mm_struct *mm = NULL;
 	struct task_struct *task;
 	nodemask_t task_nodes;
+	bool weighted;
+	int flags;
 	int err;
 	nodemask_t *old;
 	nodemask_t *new;
@@ -1536,6 +1767,12 @@ static int kernel_migrate_pages(pid_t pid, unsigned long maxnode,
 	if (err)
 		goto out_put;
 
+	task_lock(task);
+	weighted = task->mempolicy &&
+		task->mempolicy->mode == MPOL_INTERLEAVE &&
+		(task->mempolicy->flags & MPOL_F_WEIGHTED);
+	task_unlock(task);
+
 	mm = get_task_mm(task);
 	put_task_struct(task);
 
@@ -1544,8 +1781,13 @@ static int kernel_migrate_pages(pid_t pid, unsigned long maxnode,
 		goto out;
 	}
 
-	err = do_migrate_pages(mm, old, new,
-		capable(CAP_SYS_NICE) ? MPOL_MF_MOVE_ALL : MPOL_MF_MOVE);
+	/* the copy mode is the default of the task policy of the caller */
+	flags = (capable(CAP_SYS_NICE) ? MPOL_MF_MOVE_ALL : MPOL_MF_MOVE) |
+		mpol_migrate_flags(current->mempolicy);
+	if (weighted)
+		err = do_migrate_pages_weighted(mm, old, new, flags);
+	else
+		err = do_migrate_pages(mm, old, new, flags);
 
 	mmput(mm);
 out:
@@ -1825,6 +2067,8 @@ static int policy_node(gfp_t gfp, struct mempolicy *policy,
 {
 	if (policy->mode == MPOL_PREFERRED && !(policy->flags & MPOL_F_LOCAL))
 		nd = policy->v.preferred_node;
+	else if (policy->flags & MPOL_F_PREFERRED_TIER)
+		nd = mpol_local_node(policy);
 	else {
 		/*
 		 * __GFP_THISNODE shouldn't even be used with the bind policy
@@ -1843,9 +2087,18 @@ static unsigned interleave_nodes(struct mempolicy *policy)
 	unsigned next;
 	struct task_struct *me = current;
 
+	if ((policy->flags & MPOL_F_WEIGHTED) && me->il_weight &&
+	    node_isset(me->il_prev, policy->v.nodes)) {
+		me->il_weight--;
+		return me->il_prev;
+	}
+
 	next = next_node_in(me->il_prev, policy->v.nodes);
-	if (next < MAX_NUMNODES)
+	if (next < MAX_NUMNODES) {
 		me->il_prev = next;
+		if (policy->flags & MPOL_F_WEIGHTED)
+			me->il_weight = iw_weight(next) - 1;
+	}
 	return next;
 }
 
@@ -1862,8 +2115,10 @@ unsigned int mempolicy_slab_node(void)
 		return node;
 
 	policy = current->mempolicy;
-	if (!policy || policy->flags & MPOL_F_LOCAL)
+	if (!policy)
 		return node;
+	if (policy->flags & MPOL_F_LOCAL)
+		return mpol_local_node(policy);
 
 	switch (policy->mode) {
 	case MPOL_PREFERRED:
@@ -1900,6 +2155,29 @@ unsigned int mempolicy_slab_node(void)
  * node in pol->v.nodes (starting from n=0), wrapping around if n exceeds the
  * number of present nodes.
  */
+static unsigned weighted_offset_il_node(struct mempolicy *pol,
+		unsigned long n)
+{
+	unsigned int total = 0, weight;
+	int nid;
+
+	for_each_node_mask(nid, pol->v.nodes)
+		total += iw_weight(nid);
+	if (!total)
+		return numa_node_id();
+
+	n %= total;
+	for_each_node_mask(nid, pol->v.nodes) {
+		weight = iw_weight(nid);
+		if (n < weight)
+			return nid;
+		n -= weight;
+	}
+
+	/* the weights changed under us */
+	return first_node(pol->v.nodes);
+}
+
 static unsigned offset_il_node(struct mempolicy *pol, unsigned long n)
 {
 	unsigned nnodes = nodes_weight(pol->v.nodes);
@@ -1907,6 +2185,8 @@ static unsigned offset_il_node(struct mempolicy *pol, unsigned long n)
 	int i;
 	int nid;
 
+	if (pol->flags & MPOL_F_WEIGHTED)
+		return weighted_offset_il_node(pol, n);
 	if (!nnodes)
 		return numa_node_id();
 	target = (unsigned int)n % nnodes;
@@ -2002,7 +2282,7 @@ bool init_nodemask_of_mempolicy(nodemask_t *mask)
 	switch (mempolicy->mode) {
 	case MPOL_PREFERRED:
 		if (mempolicy->flags & MPOL_F_LOCAL)
-			nid = numa_node_id();
+			nid = mpol_local_node(mempolicy);
 		else
 			nid = mempolicy->v.preferred_node;
 		init_nodemask_of_node(mask, nid);
@@ -2023,6 +2303,45 @@ bool init_nodemask_of_mempolicy(nodemask_t *mask)
 }
 #endif
 
+/*
+ * The node a THP for @addr of @vma is allocated from first, NUMA_NO_NODE
+ * if a bind policy of @vma does not allow that node.
+ */
+int thp_node(struct vm_area_struct *vma, unsigned long addr, gfp_t gfp)
+{
+	struct mempolicy *pol = get_vma_policy(vma, addr);
+	int nid;
+
+	if (pol->mode == MPOL_INTERLEAVE) {
+		nid = interleave_nid(pol, vma, addr, PMD_SHIFT);
+	} else {
+		nid = policy_node(gfp, pol, numa_node_id());
+		if (pol->mode == MPOL_BIND && !node_isset(nid, pol->v.nodes))
+			nid = NUMA_NO_NODE;
+	}
+	mpol_cond_put(pol);
+
+	return nid;
+}
+
+/*
+ * Whether the policy of @vma lets the page at @addr of @vma live on @nid:
+ * the interleave node of @addr, or one of the nodes of a bind policy.
+ */
+bool mpol_node_allowed(struct vm_area_struct *vma, unsigned long addr, int nid)
+{
+	struct mempolicy *pol = get_vma_policy(vma, addr);
+	bool allowed = true;
+
+	if (pol->mode == MPOL_INTERLEAVE)
+		allowed = interleave_nid(pol, vma, addr, PAGE_SHIFT) == nid;
+	else if (pol->mode == MPOL_BIND)
+		allowed = node_isset(nid, pol->v.nodes);
+	mpol_cond_put(pol);
+
+	return allowed;
+}
+
 /*
  * mempolicy_nodemask_intersects
  *
@@ -2109,6 +2428,30 @@ static struct page *alloc_page_interleave(gfp_t gfp, unsigned order,
  *	all allocations for pages that will be mapped into user space. Returns
  *	NULL when no page can be allocated.
  */
+/*
+ * @nid, or the node of the next tier when the allocation of 2^@order pages
+ * by the current task would put its memcg over its max_at_node on @nid.
+ * @nmask, if any, still has to allow the node.
+ */
+static int memcg_spill_node(int nid, int order, nodemask_t *nmask)
+{
+	struct mem_cgroup *memcg;
+	int target;
+
+	if (mem_cgroup_disabled() || nid == NUMA_NO_NODE)
+		return nid;
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_task(current);
+	target = memcg ? mem_cgroup_spill_node(memcg, nid, 1UL << order) : nid;
+	rcu_read_unlock();
+
+	if (nmask && !node_isset(target, *nmask))
+		return nid;
+
+	return target;
+}
+
 struct page *
 alloc_pages_vma(gfp_t gfp, int order, struct vm_area_struct *vma,
 		unsigned long addr, int node, bool hugepage)
@@ -2180,8 +2523,11 @@ alloc_pages_vma(gfp_t gfp, int order, struct vm_area_struct *vma,
 		 */
 		if (pol->mode == MPOL_PREFERRED && !(pol->flags & MPOL_F_LOCAL))
 			hpage_node = pol->v.preferred_node;
+		else if (pol->flags & MPOL_F_PREFERRED_TIER)
+			hpage_node = mpol_local_node(pol);
 
 		nmask = policy_nodemask(gfp, pol);
+		hpage_node = memcg_spill_node(hpage_node, order, nmask);
 		if (!nmask || node_isset(hpage_node, *nmask)) {
 			mpol_cond_put(pol);
 			/*
@@ -2206,7 +2552,8 @@ alloc_pages_vma(gfp_t gfp, int order, struct vm_area_struct *vma,
 	}
 
 	nmask = policy_nodemask(gfp, pol);
-	preferred_nid = policy_node(gfp, pol, node);
+	preferred_nid = memcg_spill_node(policy_node(gfp, pol, node), order,
+			nmask);
 	page = __alloc_pages_nodemask(gfp, order, preferred_nid, nmask);
 	mpol_cond_put(pol);
 out:
@@ -2461,7 +2808,7 @@ int mpol_misplaced(struct page *page, struct vm_area_struct *vma, unsigned long
 
 	case MPOL_PREFERRED:
 		if (pol->flags & MPOL_F_LOCAL)
-			polnid = numa_node_id();
+			polnid = mpol_local_node(pol);
 		else
 			polnid = pol->v.preferred_node;
 		break;
@@ -2834,6 +3181,7 @@ static const char * const policy_modes[] =
 	[MPOL_BIND]       = "bind",
 	[MPOL_INTERLEAVE] = "interleave",
 	[MPOL_LOCAL]      = "local",
+	[MPOL_PREFERRED_TIER] = "preferred_tier",
 };
 
 
@@ -2902,6 +3250,10 @@ int mpol_parse_str(char *str, struct mempolicy **mpol)
 			goto out;
 		mode = MPOL_PREFERRED;
 		break;
+	case MPOL_PREFERRED_TIER:
+		if (nodelist)
+			goto out;
+		break;
 	case MPOL_DEFAULT:
 		/*
 		 * Insist on a empty nodelist
@@ -2927,6 +3279,12 @@ int mpol_parse_str(char *str, struct mempolicy **mpol)
 			mode_flags |= MPOL_F_STATIC_NODES;
 		else if (!strcmp(flags, "relative"))
 			mode_flags |= MPOL_F_RELATIVE_NODES;
+		else if (!strcmp(flags, "weighted") && mode == MPOL_INTERLEAVE)
+			mode_flags |= MPOL_F_WEIGHTED;
+		else if (!strcmp(flags, "fast") && mode == MPOL_PREFERRED_TIER)
+			mode_flags |= MPOL_F_TIER_FAST;
+		else if (!strcmp(flags, "slow") && mode == MPOL_PREFERRED_TIER)
+			mode_flags |= MPOL_F_TIER_SLOW;
 		else
 			goto out;
 	}
@@ -2992,7 +3350,9 @@ void mpol_to_str(char *buffer, int maxlen, struct mempolicy *pol)
 	case MPOL_DEFAULT:
 		break;
 	case MPOL_PREFERRED:
-		if (flags & MPOL_F_LOCAL)
+		if (flags & MPOL_F_PREFERRED_TIER)
+			mode = MPOL_PREFERRED_TIER;
+		else if (flags & MPOL_F_LOCAL)
 			mode = MPOL_LOCAL;
 		else
 			node_set(pol->v.preferred_node, nodes);
@@ -3010,18 +3370,88 @@ void mpol_to_str(char *buffer, int maxlen, struct mempolicy *pol)
 	p += snprintf(p, maxlen, "%s", policy_modes[mode]);
 
 	if (flags & MPOL_MODE_FLAGS) {
+		const char *sep = "";
+
 		p += snprintf(p, buffer + maxlen - p, "=");
 
 		/*
-		 * Currently, the only defined flags are mutually exclusive
+		 * static and relative are mutually exclusive, and so are
+		 * fast and slow
 		 */
-		if (flags & MPOL_F_STATIC_NODES)
+		if (flags & MPOL_F_STATIC_NODES) {
 			p += snprintf(p, buffer + maxlen - p, "static");
-		else if (flags & MPOL_F_RELATIVE_NODES)
+			sep = ",";
+		} else if (flags & MPOL_F_RELATIVE_NODES) {
 			p += snprintf(p, buffer + maxlen - p, "relative");
+			sep = ",";
+		}
+		if (flags & MPOL_F_WEIGHTED) {
+			p += snprintf(p, buffer + maxlen - p, "%sweighted", sep);
+			sep = ",";
+		}
+		if (flags & MPOL_F_TIER_FAST)
+			p += snprintf(p, buffer + maxlen - p, "%sfast", sep);
+		else if (flags & MPOL_F_TIER_SLOW)
+			p += snprintf(p, buffer + maxlen - p, "%sslow", sep);
 	}
 
 	if (!nodes_empty(nodes))
 		p += scnprintf(p, buffer + maxlen - p, ":%*pbl",
 			       nodemask_pr_args(&nodes));
 }
+
+/*
+ * /sys/kernel/mm/weighted_interleave/nodes: one "node weight default" line
+ * per memory node, the weight a node has under MPOL_F_WEIGHTED and the one
+ * derived from its bandwidth. Writing "node weight" sets the weight of a
+ * node, 0 going back to the default.
+ */
+static ssize_t nodes_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	ssize_t len = 0;
+	int nid;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len, "node weight default\n");
+
+	for_each_node_state(nid, N_MEMORY)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %u %u\n", nid,
+				iw_weight(nid), iw_default_weight(nid));
+
+	return len;
+}
+
+static ssize_t nodes_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	unsigned int weight;
+	int nid;
+
+	if (sscanf(buf, "%d %u", &nid, &weight) != 2)
+		return -EINVAL;
+	if (nid < 0 || nid >= MAX_NUMNODES || weight > U8_MAX)
+		return -EINVAL;
+
+	WRITE_ONCE(iw_weights[nid], weight);
+
+	return count;
+}
+static struct kobj_attribute nodes_attr = __ATTR_RW(nodes);
+
+static struct attribute *weighted_interleave_attrs[] = {
+	&nodes_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group weighted_interleave_attr_group = {
+	.attrs = weighted_interleave_attrs,
+};
+
+static int __init weighted_interleave_init(void)
+{
+	mm_sysfs_add_group("weighted_interleave",
+			   &weighted_interleave_attr_group);
+
+	return 0;
+}
+subsys_initcall(weighted_interleave_init);
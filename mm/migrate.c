@@ -49,6 +49,15 @@
 #include <linux/sched/mm.h>
 #include <linux/ptrace.h>
 #include <linux/oom.h>
+#include <linux/kthread.h>
+#include <linux/mempool.h>
+#include <linux/prefetch.h>
+#include <linux/sort.h>
+#include <linux/exchange.h>
+#include <linux/memory_tier.h>
+#include <linux/migrate_history.h>
+#include <linux/migrate_latency.h>
+#include <linux/migrate_stat.h>
 
 #include <asm/tlbflush.h>
 
@@ -60,13 +69,6 @@
 int accel_page_copy = 1;
 // controls if RPDAA is enabled
 int sysctl_enable_page_migration_optimization_avoid_remote_pmem_write = 0;
-// for PMEM memory only NUMA node x, CLOSEST_CPU_NODE_FOR_PMEM[x] stores 
-// id of CPU which is on the same socket x
-// Otherwise it stores -1
-int CLOSEST_CPU_NODE_FOR_PMEM[MAX_NUMNODES];
-// suggest if CLOSEST_CPU_NODE_FOR_PMEM needs to be updated
-int CLOSEST_CPU_NODE_FOR_PMEM_INITIALIZED=0;
-EXPORT_SYMBOL(CLOSEST_CPU_NODE_FOR_PMEM_INITIALIZED);
 
 struct page_migration_work_item {
 	struct list_head list;
@@ -74,6 +76,8 @@ struct page_migration_work_item {
 	struct page *new_page;
 	struct anon_vma *anon_vma;
 	int page_was_mapped;
+	/* the new page is the clean shadow of the old, see migrate_shadow_hit() */
+	bool shadow_hit;
 };
 
 /*
@@ -102,6 +106,52 @@ int migrate_prep_local(void)
 	return 0;
 }
 
+// Minimum interval between two migrate_prep_memcg() drains of a CPU
+int sysctl_migrate_prep_interval_ms = 10;
+
+static int migrate_prep_task_cpu(struct task_struct *task, void *arg)
+{
+	cpumask_set_cpu(task_cpu(task), arg);
+
+	return 0;
+}
+
+/*
+ * migrate_prep() for the pages of @memcg: only the CPUs its tasks last ran
+ * on are drained, and not if they were drained shortly before. Pages left
+ * in the pagevecs of other CPUs fail to isolate like busy pages.
+ */
+int migrate_prep_memcg(struct mem_cgroup *memcg)
+{
+	cpumask_var_t cpus;
+
+	if (mem_cgroup_disabled() || !memcg || mem_cgroup_is_root(memcg) ||
+	    !zalloc_cpumask_var(&cpus, GFP_KERNEL))
+		return migrate_prep();
+
+	mem_cgroup_scan_tasks(memcg, migrate_prep_task_cpu, cpus);
+
+	lru_add_drain();
+	lru_add_drain_mask(cpus, msecs_to_jiffies(
+			READ_ONCE(sysctl_migrate_prep_interval_ms)));
+
+	free_cpumask_var(cpus);
+
+	return 0;
+}
+
+/* migrate_prep_memcg() for the memcg of @mm */
+int migrate_prep_mm(struct mm_struct *mm)
+{
+	struct mem_cgroup *memcg = get_mem_cgroup_from_mm(mm);
+	int err;
+
+	err = migrate_prep_memcg(memcg);
+	mem_cgroup_put(memcg);
+
+	return err;
+}
+
 int isolate_movable_page(struct page *page, isolate_mode_t mode)
 {
 	struct address_space *mapping;
@@ -189,7 +239,9 @@ void putback_movable_pages(struct list_head *l)
 {
 	struct page *page;
 	struct page *page2;
+	struct pagevec pvec;
 
+	pagevec_init(&pvec);
 	list_for_each_entry_safe(page, page2, l, lru) {
 		if (unlikely(PageHuge(page))) {
 			putback_active_hugepage(page);
@@ -213,9 +265,44 @@ void putback_movable_pages(struct list_head *l)
 		} else {
 			mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
 					page_is_file_cache(page), -hpage_nr_pages(page));
-			putback_lru_page(page);
+			/*
+			 * As putback_lru_page(), but the lru_lock is taken
+			 * once per pagevec and the isolation reference is the
+			 * one the pagevec drops.
+			 */
+			if (!pagevec_add(&pvec, page))
+				__pagevec_lru_add(&pvec);
 		}
 	}
+
+	if (pagevec_count(&pvec))
+		__pagevec_lru_add(&pvec);
+}
+
+/* Was @new, a migration target of @old, left unwritten as all zero? */
+static bool migrate_page_zero_tagged(struct page *new, struct page *old)
+{
+	return new != old && PageAnon(new) && !PageSwapCache(new) &&
+		page_private(new) == (unsigned long)old;
+}
+
+/* Map the zero page instead of the all zero page under migration */
+static bool migrate_map_zero_page(struct vm_area_struct *vma,
+		struct page_vma_mapped_walk *pvmw)
+{
+	pte_t pte;
+
+	if ((vma->vm_flags & VM_LOCKED) || mm_forbids_zeropage(vma->vm_mm))
+		return false;
+
+	pte = pte_mkspecial(pfn_pte(my_zero_pfn(pvmw->address),
+				    vma->vm_page_prot));
+	set_pte_at(vma->vm_mm, pvmw->address, pvmw->pte, pte);
+	/* the migration entry still counted the page */
+	dec_mm_counter(vma->vm_mm, MM_ANONPAGES);
+	update_mmu_cache(vma, pvmw->address, pvmw->pte);
+
+	return true;
 }
 
 /*
@@ -251,6 +338,14 @@ static bool remove_migration_pte(struct page *page, struct vm_area_struct *vma,
 		}
 #endif
 
+		if (migrate_page_zero_tagged(new, old)) {
+			if (migrate_map_zero_page(vma, &pvmw))
+				continue;
+			/* mapped after all, it needs its zeroes */
+			clear_highpage(new);
+			set_page_private(new, 0);
+		}
+
 		get_page(new);
 		pte = pte_mkold(mk_pte(new, READ_ONCE(vma->vm_page_prot)));
 		if (pte_swp_soft_dirty(*pvmw.pte))
@@ -317,6 +412,19 @@ void remove_migration_ptes(struct page *old, struct page *new, bool locked)
 		rmap_walk_locked(new, &rwc);
 	else
 		rmap_walk(new, &rwc);
+
+	/*
+	 * Nothing maps the all zero page left unwritten, a clean lazyfree
+	 * page is freed by reclaim without being swapped out.
+	 */
+	if (migrate_page_zero_tagged(new, old)) {
+		set_page_private(new, 0);
+		if (!page_mapped(new)) {
+			ClearPageDirty(new);
+			ClearPageSwapBacked(new);
+			count_vm_event(PGMIGRATE_ZERO_PAGE);
+		}
+	}
 }
 
 /*
@@ -330,6 +438,8 @@ void __migration_entry_wait(struct mm_struct *mm, pte_t *ptep,
 	pte_t pte;
 	swp_entry_t entry;
 	struct page *page;
+	bool huge;
+	u64 start;
 
 	spin_lock(ptl);
 	pte = *ptep;
@@ -350,7 +460,10 @@ void __migration_entry_wait(struct mm_struct *mm, pte_t *ptep,
 	if (!get_page_unless_zero(page))
 		goto out;
 	pte_unmap_unlock(ptep, ptl);
+	huge = PageCompound(page);
+	start = ktime_get_ns();
 	put_and_wait_on_page_locked(page);
+	count_migrate_stall(mm, huge, ktime_get_ns() - start);
 	return;
 out:
 	pte_unmap_unlock(ptep, ptl);
@@ -388,6 +501,7 @@ void pmd_migration_entry_wait(struct mm_struct *mm, pmd_t *pmd)
 	struct page *page;
 	unsigned long enter_jiffies = jiffies;
 	struct task_struct *tsk;
+	u64 start;
 
 	ptl = pmd_lock(mm, pmd);
 	if (!is_pmd_migration_entry(*pmd))
@@ -396,7 +510,9 @@ void pmd_migration_entry_wait(struct mm_struct *mm, pmd_t *pmd)
 	if (!get_page_unless_zero(page))
 		goto unlock;
 	spin_unlock(ptl);
+	start = ktime_get_ns();
 	put_and_wait_on_page_locked(page);
+	count_migrate_stall(mm, true, ktime_get_ns() - start);
 
 	enter_jiffies = jiffies - enter_jiffies;
 	rcu_read_lock();
@@ -591,6 +707,22 @@ int migrate_huge_page_move_mapping(struct address_space *mapping,
  * arithmetic will work across the entire page.  We need something more
  * specialized.
  */
+/*
+ * Plain CPU copy of a (possibly gigantic) page. With RPDAA it runs on the
+ * socket local to the PMEM side, like the multi-threaded copies do.
+ */
+static void copy_highpages_rpdaa(struct page *dst, struct page *src,
+				int nr_pages)
+{
+	int nid = copy_page_socket_local(dst, src, nr_pages, copy_highpages);
+
+	if (nid < 0) {
+		copy_highpages(dst, src, nr_pages);
+		nid = numa_node_id();
+	}
+	count_pmem_write(nid, page_to_nid(dst), PAGE_SIZE * nr_pages);
+}
+
 static void __copy_gigantic_page(struct page *dst, struct page *src,
 				int nr_pages, enum migrate_mode mode)
 {
@@ -599,6 +731,11 @@ static void __copy_gigantic_page(struct page *dst, struct page *src,
 	struct page *src_base = src;
 	int rc = -EFAULT;
 
+	if (!(mode & MIGRATE_DMA)) {
+		copy_highpages_rpdaa(dst, src, nr_pages);
+		return;
+	}
+
 	for (i = 0; i < nr_pages; ) {
 		cond_resched();
 
@@ -617,7 +754,8 @@ static void __copy_gigantic_page(struct page *dst, struct page *src,
 noinline static void copy_huge_page(struct page *dst, struct page *src,
 				enum migrate_mode mode)
 {
-	int i;
+	struct copy_decision decision;
+	bool gigantic = false;
 	int nr_pages;
 	int rc = -EFAULT;
 
@@ -625,11 +763,7 @@ noinline static void copy_huge_page(struct page *dst, struct page *src,
 		/* hugetlbfs page */
 		struct hstate *h = page_hstate(src);
 		nr_pages = pages_per_huge_page(h);
-
-		if (unlikely(nr_pages > MAX_ORDER_NR_PAGES)) {
-			__copy_gigantic_page(dst, src, nr_pages, mode);
-			return;
-		}
+		gigantic = nr_pages > MAX_ORDER_NR_PAGES;
 	} else {
 		/* thp page */
 		BUG_ON(!PageTransHuge(src));
@@ -637,30 +771,53 @@ noinline static void copy_huge_page(struct page *dst, struct page *src,
 	}
 
 	/* Try to accelerate page migration if it is not specified in mode  */
-	// In case of non-concurrent native 2MB page migration RPDAA is used 
-	// only when we use multithreaded page copy.
-	// Note that the actual number of threads does not have to be more than one.
-	// RPDAA works irrespective of actual number of threads but we just need to set 
-	// MIGRATE_MT bit in mode.
-	if (accel_page_copy || sysctl_enable_page_migration_optimization_avoid_remote_pmem_write==1)
+	// With RPDAA, native 2MB page migration prefers the multithreaded copy,
+	// whose workers run on the PMEM-local socket whatever their number.
+	// The single-threaded fallback below is socket-local as well.
+	if (accel_page_copy || page_copy_use_rpdaa())
 		mode |= MIGRATE_MT;
 
-	if (mode & MIGRATE_MT)
+	// With copy_engine_auto the calibrated engine for this node pair wins
+	// over the mode the caller asked for, unless the task has its own
+	// copy policy.
+	if (copy_decision_lookup(page_to_nid(src), page_to_nid(dst), true,
+				&decision)) {
+		mode &= ~(MIGRATE_MT | MIGRATE_DMA | MIGRATE_HYBRID);
+		if (decision.engine == COPY_ENGINE_MT)
+			mode |= MIGRATE_MT;
+		else if (decision.engine == COPY_ENGINE_DMA)
+			mode |= MIGRATE_DMA;
+	}
+
+	/*
+	 * A gigantic page is contiguous in the direct map, so the MT engine
+	 * copies it as a single range spread over all its workers. Without
+	 * it, or with highmem, it is copied one base page at a time.
+	 */
+	if (unlikely(gigantic)) {
+		if ((mode & (MIGRATE_MT | MIGRATE_HYBRID)) &&
+		    !IS_ENABLED(CONFIG_HIGHMEM))
+			rc = copy_page_multithread(dst, src, nr_pages);
+		if (rc)
+			__copy_gigantic_page(dst, src, nr_pages, mode);
+		return;
+	}
+
+	if (mode & MIGRATE_HYBRID)
+		rc = copy_page_hybrid(dst, src, nr_pages);
+	else if (mode & MIGRATE_MT)
 		rc = copy_page_multithread(dst, src, nr_pages);
 	else if (mode & MIGRATE_DMA)
 		rc = copy_page_dma(dst, src, nr_pages);
 
 	if (rc)
-		for (i = 0; i < nr_pages; i++) {
-			cond_resched();
-			copy_highpage(dst + i, src + i);
-		}
+		copy_highpages_rpdaa(dst, src, nr_pages);
 }
 
 /*
- * Copy the page to its new location
+ * Copy the page to its new location, all but its memcg charge
  */
-void migrate_page_states(struct page *newpage, struct page *page)
+static void __migrate_page_states(struct page *newpage, struct page *page)
 {
 	int cpupid;
 
@@ -697,12 +854,26 @@ void migrate_page_states(struct page *newpage, struct page *page)
 	 */
 	cpupid = page_cpupid_xchg_last(page, -1);
 	page_cpupid_xchg_last(newpage, cpupid);
+	page_migrate_history_record(newpage, page);
+
+	/* what became of the page tells the history of its region */
+	if (PageAnon(page) && page_to_nid(page) != page_to_nid(newpage)) {
+		bool from_slow = node_is_slow_tier(page_to_nid(page));
+
+		if (from_slow != node_is_slow_tier(page_to_nid(newpage))) {
+			if (from_slow)
+				tier_site_promoted(page);
+			else
+				tier_site_demoted(page);
+		}
+	}
 
 	ksm_migrate_page(newpage, page);
 	/*
 	 * Please do not reorder this without considering how mm/ksm.c's
 	 * get_ksm_page() depends upon ksm_migrate_page() and PageSwapCache().
 	 */
+	migrate_shadow_drop(page);
 	if (PageSwapCache(page))
 		ClearPageSwapCache(page);
 	ClearPagePrivate(page);
@@ -716,11 +887,78 @@ void migrate_page_states(struct page *newpage, struct page *page)
 		end_page_writeback(newpage);
 
 	copy_page_owner(page, newpage);
+}
 
+void migrate_page_states(struct page *newpage, struct page *page)
+{
+	__migrate_page_states(newpage, page);
 	mem_cgroup_migrate(page, newpage);
 }
 EXPORT_SYMBOL(migrate_page_states);
 
+/*
+ * migrate_page_states() for a page of a batch, its charge gathered in @mg
+ * with those of the other pages for mem_cgroup_migrate_flush()
+ */
+static void migrate_page_states_gather(struct page *newpage,
+		struct page *page, struct mem_cgroup_migrate_gather *mg)
+{
+	__migrate_page_states(newpage, page);
+	mem_cgroup_migrate_gather(page, newpage, mg);
+}
+
+// Skip the copy of same-filled anon pages, mapping the zero ones to the
+// zero page
+int sysctl_migrate_same_filled = 0;
+
+/*
+ * Much of the cold anonymous memory demoted is all zero or filled with a
+ * single value, never written since it was allocated. The source of a base
+ * anon page is scanned before it is copied, the scan stopping at the first
+ * word that differs from the first one, which is early for pages holding
+ * data, and the copy engines then copy the page out of the cache.
+ *
+ * A page filled with a non-zero value is filled from that value instead.
+ * An all zero page is not written at all: the new page is tagged with the
+ * old one, remove_migration_pte() maps the zero page in its place and it
+ * is left, unmapped, to reclaim. A mapping that cannot take the zero page,
+ * an mlocked one, gets the new page cleared after all.
+ */
+static bool migrate_page_same_filled(struct page *newpage, struct page *page)
+{
+	unsigned long *src, value;
+	unsigned int i;
+
+	if (!READ_ONCE(sysctl_migrate_same_filled) || !PageAnon(page) ||
+	    PageKsm(page) || PageSwapCache(page) || PageCompound(page) ||
+	    PageMlocked(page))
+		return false;
+
+	set_page_private(newpage, 0);
+
+	src = kmap_atomic(page);
+	value = src[0];
+	for (i = 1; i < PAGE_SIZE / sizeof(*src); i++)
+		if (src[i] != value)
+			break;
+	kunmap_atomic(src);
+
+	if (i < PAGE_SIZE / sizeof(*src))
+		return false;
+
+	if (!value) {
+		set_page_private(newpage, (unsigned long)page);
+		return true;
+	}
+
+	src = kmap_atomic(newpage);
+	memset_l(src, value, PAGE_SIZE / sizeof(*src));
+	kunmap_atomic(src);
+	count_vm_event(PGMIGRATE_SAME_FILLED);
+
+	return true;
+}
+
 void migrate_page_copy(struct page *newpage, struct page *page,
 		enum migrate_mode mode)
 {
@@ -728,14 +966,15 @@ void migrate_page_copy(struct page *newpage, struct page *page,
 
 	if (PageHuge(page) || PageTransHuge(page))
 		copy_huge_page(newpage, page, mode);
-	else {
+	else if (!migrate_shadow_hit(newpage, page) &&
+		 !migrate_page_same_filled(newpage, page)) {
 		if (mode & MIGRATE_DMA)
 			rc = copy_page_dma(newpage, page, 1);
 		else if (mode & MIGRATE_MT)
 			rc = copy_page_multithread(newpage, page, 1);
 
 		if (rc)
-			copy_highpage(newpage, page);
+			copy_highpages_rpdaa(newpage, page, 1);
 	}
 
 	migrate_page_states(newpage, page);
@@ -1093,13 +1332,71 @@ static int move_to_new_page(struct page *newpage, struct page *page,
 	return rc;
 }
 
+// Copy anonymous THPs before unmapping them for migration
+int sysctl_migrate_thp_precopy = 0;
+
+enum thp_precopy {
+	THP_PRECOPY_NONE,
+	THP_PRECOPY_CLEAN,
+	THP_PRECOPY_DIRTY,	/* a mapping became writable during the copy */
+};
+
+/*
+ * Unmapping a THP for migration stalls every access to it for the whole
+ * copy. With vm.migrate_thp_precopy, an anonymous THP is write protected
+ * and copied while it is still mapped, so reads go on during the copy and
+ * the page is only unmapped to be remapped to its copy. Write faults wait
+ * on the page lock held by the migration. Should a mapping have become
+ * writable or dirty anyway, the subpages that changed are copied again
+ * once the page is unmapped, see migrate_thp_recopy().
+ */
+static enum thp_precopy migrate_thp_precopy(struct page *newpage,
+		struct page *page, enum migrate_mode mode)
+{
+	if (!READ_ONCE(sysctl_migrate_thp_precopy) || !PageTransHuge(page) ||
+	    !PageAnon(page) || PageKsm(page) || PageSwapCache(page) ||
+	    (mode & MIGRATE_MODE_MASK) == MIGRATE_ASYNC)
+		return THP_PRECOPY_NONE;
+
+	/* page_wrprotect() drops the dirty bits of the mappings */
+	SetPageDirty(page);
+	page_wrprotect(page);
+
+	copy_huge_page(newpage, page, mode);
+
+	return page_mapped_writable(page) ? THP_PRECOPY_DIRTY :
+		THP_PRECOPY_CLEAN;
+}
+
+/* Copy again the subpages of @page that changed since the precopy */
+static void migrate_thp_recopy(struct page *newpage, struct page *page)
+{
+	int i, nr_pages = hpage_nr_pages(page);
+
+	for (i = 0; i < nr_pages; i++) {
+		void *src = kmap_atomic(page + i);
+		void *dst = kmap_atomic(newpage + i);
+		bool changed = memcmp(src, dst, PAGE_SIZE);
+
+		kunmap_atomic(dst);
+		kunmap_atomic(src);
+
+		if (changed)
+			copy_highpage(newpage + i, page + i);
+		cond_resched();
+	}
+}
+
 static int __unmap_and_move(struct page *page, struct page *newpage,
 				int force, enum migrate_mode mode)
 {
+	enum thp_precopy precopy = THP_PRECOPY_NONE;
 	int rc = -EAGAIN;
 	int page_was_mapped = 0;
 	struct anon_vma *anon_vma = NULL;
 	bool is_lru = !__PageMovable(page);
+	enum migrate_latency_engine engine = migrate_latency_engine(mode);
+	u64 start = migrate_latency_start(), clock = start;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
@@ -1133,6 +1430,7 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 		current->move_pages_breakdown.last_timestamp;
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
+	migrate_latency_phase(engine, MIGRATE_PHASE_LOCK, &clock);
 
 	if (PageWriteback(page)) {
 		/*
@@ -1205,6 +1503,7 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 		/* Establish migration ptes */
 		VM_BUG_ON_PAGE(PageAnon(page) && !PageKsm(page) && !anon_vma,
 				page);
+		precopy = migrate_thp_precopy(newpage, page, mode);
 		try_to_unmap(page,
 			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
 		page_was_mapped = 1;
@@ -1216,9 +1515,15 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 		current->move_pages_breakdown.last_timestamp;
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
+	migrate_latency_phase(engine, MIGRATE_PHASE_UNMAP, &clock);
 
-	if (!page_mapped(page))
-		rc = move_to_new_page(newpage, page, mode);
+	if (!page_mapped(page)) {
+		rc = move_to_new_page(newpage, page, precopy ?
+				mode | MIGRATE_SYNC_NO_COPY : mode);
+		if (rc == MIGRATEPAGE_SUCCESS && precopy == THP_PRECOPY_DIRTY)
+			migrate_thp_recopy(newpage, page);
+	}
+	migrate_latency_phase(engine, MIGRATE_PHASE_COPY, &clock);
 
 	if (page_was_mapped)
 		remove_migration_ptes(page,
@@ -1230,6 +1535,14 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 		current->move_pages_breakdown.last_timestamp;
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
+	migrate_latency_phase(engine, MIGRATE_PHASE_REMAP, &clock);
+
+	if (rc == MIGRATEPAGE_SUCCESS) {
+		migrate_latency_done(engine, MIGRATE_PHASE_PAGE,
+				page_to_nid(page), page_to_nid(newpage), start);
+		count_migrate_pair(newpage, page_to_nid(page),
+				page_to_nid(newpage), engine);
+	}
 
 out_unlock_both:
 	unlock_page(newpage);
@@ -1269,6 +1582,19 @@ static int __unmap_and_move(struct page *page, struct page *newpage,
 #define ICE_noinline
 #endif
 
+/* Allocate the target of @page, which may use the promotion headroom */
+static struct page *migrate_target_alloc(new_page_t get_new_page,
+		struct page *page, unsigned long private)
+{
+	unsigned int headroom = memalloc_headroom_save();
+	struct page *newpage;
+
+	newpage = get_new_page(page, private);
+	memalloc_headroom_restore(headroom);
+
+	return newpage;
+}
+
 /*
  * Obtain the lock on page, remove all ptes and migrate the page
  * to the newly allocated page in newpage.
@@ -1280,7 +1606,10 @@ static ICE_noinline int unmap_and_move(new_page_t get_new_page,
 				   enum migrate_reason reason)
 {
 	int rc = MIGRATEPAGE_SUCCESS;
-	struct page *newpage = NULL;
+	struct page *newpage = NULL, *shadow = NULL;
+	bool keep_shadow = false;
+	u64 rate_wait = 0;
+	int dst_nid;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
@@ -1330,13 +1659,30 @@ static ICE_noinline int unmap_and_move(new_page_t get_new_page,
 		goto out;
 	}
 
-	newpage = get_new_page(page, private);
+	newpage = migrate_target_alloc(get_new_page, page, private);
 	if (!newpage)
 		return -ENOMEM;
 
+	dst_nid = page_to_nid(newpage);
+	shadow = migrate_shadow_take(page, dst_nid);
+	if (shadow) {
+		if (put_new_page)
+			put_new_page(newpage, private);
+		else
+			put_page(newpage);
+		newpage = shadow;
+	}
+
+	/* newpage is handed to its owner by __unmap_and_move() */
+	keep_shadow = migrate_shadow_candidate(newpage, page, reason);
+	if (keep_shadow)
+		get_page(newpage);
+
 	rc = __unmap_and_move(page, newpage, force, mode);
-	if (rc == MIGRATEPAGE_SUCCESS)
+	if (rc == MIGRATEPAGE_SUCCESS) {
 		set_page_owner_migrate_reason(newpage, reason);
+		rate_wait = migrate_rate_charge(page, dst_nid, reason, mode);
+	}
 
 out:
 	if (rc != -EAGAIN) {
@@ -1357,6 +1703,12 @@ static ICE_noinline int unmap_and_move(new_page_t get_new_page,
 					page_is_file_cache(page), -hpage_nr_pages(page));
 	}
 
+	if (keep_shadow) {
+		if (rc == MIGRATEPAGE_SUCCESS)
+			migrate_shadow_keep(newpage, page);
+		put_page(newpage);
+	}
+
 	/*
 	 * If migration is successful, releases reference grabbed during
 	 * isolation. Otherwise, restore the page to right list unless
@@ -1405,6 +1757,9 @@ static ICE_noinline int unmap_and_move(new_page_t get_new_page,
 #endif
 
 put_new:
+		/* not a shadow of the page any more */
+		if (shadow)
+			set_page_private(newpage, 0);
 		if (put_new_page)
 			put_new_page(newpage, private);
 		else
@@ -1419,6 +1774,9 @@ static ICE_noinline int unmap_and_move(new_page_t get_new_page,
 
 	}
 
+	/* with both pages released, nothing waits on us while sleeping */
+	migrate_rate_throttle(rate_wait, mode);
+
 	return rc;
 }
 
@@ -1462,7 +1820,7 @@ static int unmap_and_move_huge_page(new_page_t get_new_page,
 		return -ENOSYS;
 	}
 
-	new_hpage = get_new_page(hpage, private);
+	new_hpage = migrate_target_alloc(get_new_page, hpage, private);
 	if (!new_hpage)
 		return -ENOMEM;
 
@@ -1509,6 +1867,9 @@ static int unmap_and_move_huge_page(new_page_t get_new_page,
 
 	if (rc == MIGRATEPAGE_SUCCESS) {
 		move_hugetlb_state(hpage, new_hpage, reason);
+		count_migrate_pair(new_hpage, page_to_nid(hpage),
+				page_to_nid(new_hpage),
+				migrate_latency_engine(mode));
 		put_new_page = NULL;
 	}
 
@@ -1531,10 +1892,34 @@ static int unmap_and_move_huge_page(new_page_t get_new_page,
 	return rc;
 }
 
+/*
+ * Whether the concurrent path can move the mapping of @page itself:
+ * anonymous pages, and page cache, shmem or swapcache pages with neither
+ * fs-private data nor a ->migratepage other than migrate_page(), so that
+ * migrate_page_move_mapping() is all it takes. Stable under the page
+ * lock.
+ */
+static bool concur_migratable_mapping(struct page *page)
+{
+	struct address_space *mapping = page_mapping(page);
+
+	if (!mapping)
+		return true;
+	if (page_has_private(page))
+		return false;
+
+	return !mapping->a_ops->migratepage ||
+		mapping->a_ops->migratepage == migrate_page;
+}
+
+/*
+ * With @defer_unmap the page is locked and left mapped, *@page_was_mapped
+ * telling the caller to unmap it with concur_unmap().
+ */
 static int __unmap_page_concur(struct page *page, struct page *newpage,
 				struct anon_vma **anon_vma,
 				int *page_was_mapped,
-				int force, enum migrate_mode mode)
+				int force, bool defer_unmap, enum migrate_mode mode)
 {
 	int rc = -EAGAIN;
 	bool is_lru = !__PageMovable(page);
@@ -1568,25 +1953,15 @@ static int __unmap_page_concur(struct page *page, struct page *newpage,
 		lock_page(page);
 	}
 
-	/* We are working on page_mapping(page) == NULL */
-	VM_BUG_ON_PAGE(PageWriteback(page), page);
-#if 0
-	if (PageWriteback(page)) {
-		/*
-		 * Only in the case of a full synchronous migration is it
-		 * necessary to wait for PageWriteback. In the async case,
-		 * the retry loop is too short and in the sync-light case,
-		 * the overhead of stalling is too much
-		 */
-		if ((mode & MIGRATE_MODE_MASK) != MIGRATE_SYNC) {
-			rc = -EBUSY;
-			goto out_unlock;
-		}
-		if (!force)
-			goto out_unlock;
-		wait_on_page_writeback(page);
+	/*
+	 * Pages under writeback, and pages whose mapping needs more than
+	 * migrate_page() to move them, are left to migrate_pages(), which
+	 * waits for the writeback and calls ->migratepage.
+	 */
+	if (PageWriteback(page) || !concur_migratable_mapping(page)) {
+		rc = -ENODEV;
+		goto out_unlock;
 	}
-#endif
 
 	/*
 	 * By try_to_unmap(), page->mapcount goes down to 0 here. In this case,
@@ -1652,8 +2027,14 @@ static int __unmap_page_concur(struct page *page, struct page *newpage,
 		/* Establish migration ptes */
 		VM_BUG_ON_PAGE(PageAnon(page) && !PageKsm(page) && !*anon_vma,
 				page);
-		try_to_unmap(page,
-			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS);
+		/*
+		 * The TLB flush is deferred and done once for the whole batch
+		 * by __migrate_pages_concur() before the pages are copied.
+		 */
+		if (!defer_unmap)
+			try_to_unmap(page,
+				TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS|
+				TTU_BATCH_FLUSH);
 		*page_was_mapped = 1;
 	}
 
@@ -1680,10 +2061,11 @@ static int __unmap_page_concur(struct page *page, struct page *newpage,
 static int unmap_pages_and_get_new_concur(new_page_t get_new_page,
 				free_page_t put_new_page, unsigned long private,
 				struct page_migration_work_item *item,
-				int force,
+				int force, bool defer_unmap,
 				enum migrate_mode mode, enum migrate_reason reason)
 {
 	int rc = MIGRATEPAGE_SUCCESS;
+	struct page *shadow;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
@@ -1691,10 +2073,20 @@ static int unmap_pages_and_get_new_concur(new_page_t get_new_page,
 	if (!thp_migration_supported() && PageTransHuge(item->old_page))
 		return -ENOMEM;
 
-	item->new_page = get_new_page(item->old_page, private);
+	item->new_page = migrate_target_alloc(get_new_page, item->old_page,
+					      private);
 	if (!item->new_page)
 		return -ENOMEM;
 
+	shadow = migrate_shadow_take(item->old_page, page_to_nid(item->new_page));
+	if (shadow) {
+		if (put_new_page)
+			put_new_page(item->new_page, private);
+		else
+			put_page(item->new_page);
+		item->new_page = shadow;
+	}
+
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	timestamp = rdtsc();
 	current->move_pages_breakdown.get_new_page_cycles += timestamp -
@@ -1730,12 +2122,13 @@ static int unmap_pages_and_get_new_concur(new_page_t get_new_page,
 
 	rc = __unmap_page_concur(item->old_page, item->new_page, &item->anon_vma,
 							&item->page_was_mapped,
-							force, mode);
+							force, defer_unmap, mode);
 	if (rc == MIGRATEPAGE_SUCCESS)
 		return rc;
 
 out:
-	if (rc != -EAGAIN) {
+	/* -ENODEV pages stay on the list for migrate_pages() */
+	if (rc != -EAGAIN && rc != -ENODEV) {
 		list_del(&item->old_page->lru);
 
 		if (likely(!__PageMovable(item->old_page)))
@@ -1757,7 +2150,7 @@ static int unmap_pages_and_get_new_concur(new_page_t get_new_page,
 		current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 	} else {
-		if (rc != -EAGAIN) {
+		if (rc != -EAGAIN && rc != -ENODEV) {
 			if (likely(!__PageMovable(item->old_page))) {
 				putback_lru_page(item->old_page);
 				goto put_new;
@@ -1801,6 +2194,52 @@ static int unmap_pages_and_get_new_concur(new_page_t get_new_page,
 	return rc;
 }
 
+/* items whose struct pages the walks over a batch prefetch ahead of them */
+#define CONCUR_PREFETCH_AHEAD	4
+
+/*
+ * Cursor running CONCUR_PREFETCH_AHEAD items ahead of a walk over a list
+ * of work items, prefetching the struct pages of the items it passes. The
+ * items of a chunk sit in one page, the misses of the walks are on the
+ * struct pages they point to, spread over the memmap. Only the item under
+ * the walk may be moved off the list, the cursor is always past it.
+ */
+struct concur_prefetch {
+	struct list_head *head;
+	struct list_head *ahead;
+};
+
+static void concur_prefetch_advance(struct concur_prefetch *cp)
+{
+	struct page_migration_work_item *item;
+
+	if (cp->ahead == cp->head)
+		return;
+
+	item = list_entry(cp->ahead, struct page_migration_work_item, list);
+	if (item->old_page)
+		prefetchw(item->old_page);
+	if (item->new_page)
+		prefetchw(item->new_page);
+	cp->ahead = cp->ahead->next;
+}
+
+static void concur_prefetch_start(struct concur_prefetch *cp,
+		struct list_head *head)
+{
+	int i;
+
+	cp->head = head;
+	cp->ahead = head->next;
+	for (i = 0; i < CONCUR_PREFETCH_AHEAD; i++)
+		concur_prefetch_advance(cp);
+}
+
+/*
+ * Move the mappings of the pages in @unmapped_list_ptr to their new pages.
+ * The pages that still have extra references are remapped and moved back
+ * to @wip_list_ptr to be retried; returns how many of them there are.
+ */
 static int move_mapping_concurr(struct list_head *unmapped_list_ptr,
 					   struct list_head *wip_list_ptr,
 					   free_page_t put_new_page, unsigned long private,
@@ -1808,18 +2247,27 @@ static int move_mapping_concurr(struct list_head *unmapped_list_ptr,
 {
 	struct page_migration_work_item *iterator, *iterator2;
 	struct address_space *mapping;
+	struct concur_prefetch cp;
+	int nr_busy = 0;
 
+	concur_prefetch_start(&cp, unmapped_list_ptr);
 	list_for_each_entry_safe(iterator, iterator2, unmapped_list_ptr, list) {
+		concur_prefetch_advance(&cp);
 		VM_BUG_ON_PAGE(!PageLocked(iterator->old_page), iterator->old_page);
 		VM_BUG_ON_PAGE(!PageLocked(iterator->new_page), iterator->new_page);
 
 		mapping = page_mapping(iterator->old_page);
 
-		VM_BUG_ON(mapping);
-
 		VM_BUG_ON(PageWriteback(iterator->old_page));
 
-		if (page_count(iterator->old_page) != 1) {
+		/*
+		 * Anonymous pages only get their index and mapping moved;
+		 * page cache, shmem and swapcache pages also have their
+		 * cache slots pointed at the new page, which stays locked
+		 * until it is copied.
+		 */
+		if (migrate_page_move_mapping(mapping, iterator->new_page,
+					iterator->old_page, 0) != MIGRATEPAGE_SUCCESS) {
 			list_move(&iterator->list, wip_list_ptr);
 			if (iterator->page_was_mapped)
 				remove_migration_ptes(iterator->old_page,
@@ -1834,56 +2282,97 @@ static int move_mapping_concurr(struct list_head *unmapped_list_ptr,
 			else
 				put_page(iterator->new_page);
 			iterator->new_page = NULL;
+			nr_busy++;
 			continue;
 		}
-
-		iterator->new_page->index = iterator->old_page->index;
-		iterator->new_page->mapping = iterator->old_page->mapping;
-		if (PageSwapBacked(iterator->old_page))
-			SetPageSwapBacked(iterator->new_page);
 	}
 
-	return 0;
+	return nr_busy;
 }
 
-static int copy_to_new_pages_concur(struct list_head *unmapped_list_ptr,
+/*
+ * Pages per batch of the migrate_pages_concur() pipeline, 0 runs all the
+ * pages as one batch. Batches are unmapped, copied and remapped in turn,
+ * with up to concur_pipeline_depth batches being copied at the same time:
+ * a batch is remapped while the next ones are being copied and the one
+ * after them is unmapped.
+ */
+int concur_copy_batch_size = 32;
+int concur_pipeline_depth = 2;
+
+/* passes over a chunk before busy pages are left to migrate_pages() */
+#define CONCUR_MIGRATE_PASSES	10
+
+/* A part of the unmapped pages of migrate_pages_concur() being copied */
+struct concur_copy_batch {
+	struct list_head list;
+	int num_pages;
+	struct page **src_page_list;
+	struct page **dst_page_list;
+	struct copy_page_handle *handle;
+	/* copy callbacks of a driver, with the cookie of its submission */
+	const struct migrate_copy_ops *ops;
+	void *cookie;
+	/* start of the unmap and of the phase under way, 0 if not timed */
+	u64 start;
+	u64 clock;
+	/* nodes of the first page of the batch, and pages left for a retry */
+	int src_nid;
+	int dst_nid;
+	int nr_busy;
+	/* exchange pairs unmapped with the batch, see exchange_concur_unmap() */
+	struct list_head exchange;
+};
+
+static void copy_to_new_pages_concur_submit(struct concur_copy_batch *batch,
 				enum migrate_mode mode)
 {
 	struct page_migration_work_item *iterator;
 	int num_pages = 0, idx = 0;
-	struct page **src_page_list = NULL, **dst_page_list = NULL;
-	unsigned long size = 0;
-	int rc = -EFAULT;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
 
-	if (list_empty(unmapped_list_ptr))
-		return 0;
+	batch->num_pages = 0;
+	batch->src_page_list = NULL;
+	batch->dst_page_list = NULL;
+	batch->handle = ERR_PTR(-EFAULT);
+	batch->ops = current->migrate_copy_ops;
+	batch->cookie = ERR_PTR(-EFAULT);
 
-	list_for_each_entry(iterator, unmapped_list_ptr, list) {
-		++num_pages;
-		size += PAGE_SIZE * hpage_nr_pages(iterator->old_page);
-	}
+	if (list_empty(&batch->list))
+		return;
 
-	src_page_list = kzalloc(sizeof(struct page *)*num_pages, GFP_KERNEL);
-	if (!src_page_list) {
+	/* a clean page going back to its shadow is not copied at all */
+	list_for_each_entry(iterator, &batch->list, list)
+		if (!migrate_shadow_hit(iterator->new_page, iterator->old_page))
+			++num_pages;
+		else
+			iterator->shadow_hit = true;
+	if (!num_pages)
+		return;
+
+	batch->src_page_list = kzalloc(sizeof(struct page *)*num_pages, GFP_KERNEL);
+	if (!batch->src_page_list) {
 		BUG();
-		return -ENOMEM;
+		return;
 	}
-	dst_page_list = kzalloc(sizeof(struct page *)*num_pages, GFP_KERNEL);
-	if (!dst_page_list) {
+	batch->dst_page_list = kzalloc(sizeof(struct page *)*num_pages, GFP_KERNEL);
+	if (!batch->dst_page_list) {
 		BUG();
-		return -ENOMEM;
+		return;
 	}
 
-	list_for_each_entry(iterator, unmapped_list_ptr, list) {
-		src_page_list[idx] = iterator->old_page;
-		dst_page_list[idx] = iterator->new_page;
+	list_for_each_entry(iterator, &batch->list, list) {
+		if (iterator->shadow_hit)
+			continue;
+		batch->src_page_list[idx] = iterator->old_page;
+		batch->dst_page_list[idx] = iterator->new_page;
 		++idx;
 	}
 
 	BUG_ON(idx != num_pages);
+	batch->num_pages = num_pages;
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	timestamp = rdtsc();
@@ -1892,51 +2381,265 @@ static int copy_to_new_pages_concur(struct list_head *unmapped_list_ptr,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	if (mode & MIGRATE_DMA)
-		rc = copy_page_lists_dma_always(dst_page_list, src_page_list,
-							num_pages);
-	else if (mode & MIGRATE_MT)
-		rc = copy_page_lists_mt(dst_page_list, src_page_list,
-							num_pages);
-
-	if (rc) {
-		list_for_each_entry(iterator, unmapped_list_ptr, list) {
-			if (PageHuge(iterator->old_page) ||
-				PageTransHuge(iterator->old_page))
-				copy_huge_page(iterator->new_page, iterator->old_page, 0);
-			else
-				copy_highpage(iterator->new_page, iterator->old_page);
-		}
-	}
+	if (batch->ops)
+		batch->cookie = batch->ops->submit(batch->dst_page_list,
+				batch->src_page_list, num_pages, batch->ops->priv);
+	else if (mode & (MIGRATE_DMA | MIGRATE_MT))
+		batch->handle = copy_page_lists_submit(batch->dst_page_list,
+				batch->src_page_list, num_pages, mode);
+}
 
-	list_for_each_entry(iterator, unmapped_list_ptr, list) {
-		migrate_page_states(iterator->new_page, iterator->old_page);
-	}
+/* Copy the page of @item with the CPU */
+static void concur_copy_page(struct page_migration_work_item *item)
+{
+	if (PageHuge(item->old_page) || PageTransHuge(item->old_page))
+		copy_huge_page(item->new_page, item->old_page, 0);
+	else if (!item->shadow_hit &&
+		 !migrate_shadow_hit(item->new_page, item->old_page))
+		copy_highpages_rpdaa(item->new_page, item->old_page, 1);
+}
 
+static void copy_to_new_pages_concur_finish(struct concur_copy_batch *batch)
+{
+	struct mem_cgroup_migrate_gather mg = {};
+	struct page_migration_work_item *iterator;
+	int rc;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
-	timestamp = rdtsc();
-	current->move_pages_breakdown.copy_page_cycles += timestamp -
-		current->move_pages_breakdown.last_timestamp;
+	u64 timestamp;
+#endif
+
+	if (list_empty(&batch->list))
+		return;
+
+	if (!batch->num_pages)
+		rc = 0;
+	else if (batch->ops)
+		rc = IS_ERR(batch->cookie) ? PTR_ERR(batch->cookie) :
+			batch->ops->wait(batch->cookie, batch->ops->priv);
+	else if (IS_ERR(batch->handle))
+		rc = PTR_ERR(batch->handle);
+	else
+		rc = copy_page_lists_wait(batch->handle);
+
+	if (rc) {
+		list_for_each_entry(iterator, &batch->list, list)
+			concur_copy_page(iterator);
+	}
+
+	list_for_each_entry(iterator, &batch->list, list) {
+		migrate_page_states_gather(iterator->new_page,
+				iterator->old_page, &mg);
+	}
+	mem_cgroup_migrate_flush(&mg);
+
+#ifdef CONFIG_PAGE_MIGRATION_PROFILE
+	timestamp = rdtsc();
+	current->move_pages_breakdown.copy_page_cycles += timestamp -
+		current->move_pages_breakdown.last_timestamp;
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	kfree(src_page_list);
-	kfree(dst_page_list);
+	kfree(batch->src_page_list);
+	kfree(batch->dst_page_list);
+}
+
+/* pages walked per hold of an rmap lock, for the mmap writers waiting */
+#define CONCUR_RMAP_LOCK_BATCH	256
 
-	return 0;
+static void concur_rmap_one(struct page_migration_work_item *item,
+				bool unmap, bool locked)
+{
+	if (unmap)
+		try_to_unmap(item->old_page,
+			TTU_MIGRATION|TTU_IGNORE_MLOCK|TTU_IGNORE_ACCESS|
+			TTU_BATCH_FLUSH|(locked ? TTU_RMAP_LOCKED : 0));
+	else
+		remove_migration_ptes(item->old_page, item->new_page, locked);
+}
+
+struct concur_rmap_item {
+	struct page_migration_work_item *item;
+	/* the anon_vma root or the mapping the rmap walk locks, or NULL */
+	void *lock;
+	bool anon;
+};
+
+/*
+ * Fill @ri for the rmap walk of @item: the anon_vma root of an anonymous
+ * page, pinned by the migration, or the mapping of a file page. A KSM page
+ * is walked through its stable node, which locks each anon_vma itself.
+ */
+static void concur_rmap_item_init(struct concur_rmap_item *ri,
+		struct page_migration_work_item *item, bool unmap)
+{
+	struct page *page = unmap ? item->old_page : item->new_page;
+
+	ri->item = item;
+	ri->anon = PageAnon(page);
+	if (PageKsm(page))
+		ri->lock = NULL;
+	else if (ri->anon)
+		ri->lock = item->anon_vma ? item->anon_vma->root : NULL;
+	else
+		ri->lock = page_mapping(page);
+}
+
+static int concur_rmap_item_cmp(const void *a, const void *b)
+{
+	const struct concur_rmap_item *ra = a, *rb = b;
+
+	if (ra->lock == rb->lock)
+		return 0;
+	return ra->lock < rb->lock ? -1 : 1;
+}
+
+/*
+ * Walk the rmaps of the @nr @items, sorted by the lock of their walk, with
+ * one hold of the lock for each run of pages sharing it instead of one per
+ * page.
+ */
+static void concur_rmap_items(struct concur_rmap_item *items, int nr,
+		bool unmap)
+{
+	int i, j, k;
+
+	for (i = 0; i < nr; i = j) {
+		for (j = i + 1; j < nr && j - i < CONCUR_RMAP_LOCK_BATCH &&
+		     items[i].lock && items[j].lock == items[i].lock; j++)
+			;
+
+		if (j - i == 1) {
+			concur_rmap_one(items[i].item, unmap, false);
+			continue;
+		}
+
+		if (items[i].anon)
+			anon_vma_lock_read(items[i].lock);
+		else
+			i_mmap_lock_read(items[i].lock);
+		for (k = i; k < j; k++)
+			concur_rmap_one(items[k].item, unmap, true);
+		if (items[i].anon)
+			anon_vma_unlock_read(items[i].lock);
+		else
+			i_mmap_unlock_read(items[i].lock);
+	}
 }
 
-static int remove_migration_ptes_concurr(struct list_head *unmapped_list_ptr)
+struct concur_rmap_args {
+	struct concur_rmap_item *items;
+	bool unmap;
+};
+
+static void concur_rmap_range(void *arg, int start, int end)
+{
+	struct concur_rmap_args *args = arg;
+
+	concur_rmap_items(args->items + start, end - start, args->unmap);
+
+	/* the TLB flushes this worker deferred */
+	if (args->unmap)
+		try_to_unmap_flush();
+}
+
+/*
+ * Unmap, or remap to their new pages, the mapped pages of @list, which are
+ * all locked. Pages of the same process mostly share their anon_vma, so
+ * the pages are sorted by the lock of their rmap walk and each lock is
+ * taken once for all of its pages. With @parallel the walks are spread
+ * over the copy workers of this node: for pages with many mappers they
+ * cost more than the copy.
+ */
+static void concur_rmap_walk(struct list_head *list, bool unmap,
+		bool parallel)
+{
+	struct page_migration_work_item *iterator;
+	struct concur_rmap_item *items;
+	struct concur_rmap_args args;
+	int nr = 0;
+
+	list_for_each_entry(iterator, list, list)
+		if (iterator->page_was_mapped)
+			nr++;
+	if (!nr)
+		return;
+
+	items = kmalloc_array(nr, sizeof(*items), GFP_NOWAIT | __GFP_NOWARN);
+	if (!items) {
+		list_for_each_entry(iterator, list, list)
+			if (iterator->page_was_mapped)
+				concur_rmap_one(iterator, unmap, false);
+		return;
+	}
+
+	nr = 0;
+	list_for_each_entry(iterator, list, list)
+		if (iterator->page_was_mapped)
+			concur_rmap_item_init(&items[nr++], iterator, unmap);
+	sort(items, nr, sizeof(*items), concur_rmap_item_cmp, NULL);
+
+	if (parallel) {
+		args.items = items;
+		args.unmap = unmap;
+		copy_page_run_ranges(numa_node_id(), nr, concur_rmap_range,
+				     &args);
+	} else {
+		concur_rmap_items(items, nr, unmap);
+	}
+	kfree(items);
+}
+
+/*
+ * Unmap the mapped pages of @list, which are all locked, inside one mmu
+ * notifier range per mm so that the secondary MMUs of a KVM guest flush
+ * once for the batch instead of once per page.
+ */
+static void concur_unmap(struct list_head *list, bool parallel_rmap)
+{
+	struct page_migration_work_item *iterator;
+	struct mmu_notify_batch nb;
+
+	mmu_notify_batch_init(&nb);
+	list_for_each_entry(iterator, list, list)
+		if (iterator->page_was_mapped)
+			mmu_notify_batch_add(&nb, iterator->old_page);
+	mmu_notify_batch_start(&nb);
+	concur_rmap_walk(list, true, parallel_rmap);
+	mmu_notify_batch_end(&nb);
+}
+
+/* Drop the references of old pages of a migration, mostly their last */
+static void release_migrated_pages(struct pagevec *pvec)
+{
+	release_pages(pvec->pages, pagevec_count(pvec));
+	pagevec_reinit(pvec);
+}
+
+/*
+ * Remap the pages of @unmapped_list_ptr to their new pages and release
+ * both. The old pages are freed a pagevec at a time, through
+ * free_unref_page_list(), unless kept as shadows, and the new pages are
+ * put on the LRU a pagevec at a time, with one lru_lock hold per node of
+ * the pagevec.
+ */
+static int remove_migration_ptes_concurr(struct list_head *unmapped_list_ptr,
+				bool parallel_rmap, enum migrate_reason reason)
 {
 	struct page_migration_work_item *iterator, *iterator2;
+	struct pagevec old_pvec, new_pvec;
+	struct concur_prefetch cp;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
 
-	list_for_each_entry_safe(iterator, iterator2, unmapped_list_ptr, list) {
-		if (iterator->page_was_mapped)
-			remove_migration_ptes(iterator->old_page, iterator->new_page, false);
+	pagevec_init(&old_pvec);
+	pagevec_init(&new_pvec);
 
+	concur_rmap_walk(unmapped_list_ptr, false, parallel_rmap);
+
+	concur_prefetch_start(&cp, unmapped_list_ptr);
+	list_for_each_entry_safe(iterator, iterator2, unmapped_list_ptr, list) {
+		concur_prefetch_advance(&cp);
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 		timestamp = rdtsc();
@@ -1957,7 +2660,13 @@ static int remove_migration_ptes_concurr(struct list_head *unmapped_list_ptr)
 				page_is_file_cache(iterator->old_page),
 				-hpage_nr_pages(iterator->old_page));
 
-		put_page(iterator->old_page);
+		if (migrate_shadow_candidate(iterator->new_page,
+					     iterator->old_page, reason))
+			migrate_shadow_keep(iterator->new_page,
+					    iterator->old_page);
+
+		if (!pagevec_add(&old_pvec, iterator->old_page))
+			release_migrated_pages(&old_pvec);
 		iterator->old_page = NULL;
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
@@ -1969,8 +2678,8 @@ static int remove_migration_ptes_concurr(struct list_head *unmapped_list_ptr)
 
 		if (unlikely(__PageMovable(iterator->new_page)))
 			put_page(iterator->new_page);
-		else
-			putback_lru_page(iterator->new_page);
+		else if (!pagevec_add(&new_pvec, iterator->new_page))
+			__pagevec_lru_add(&new_pvec);
 		iterator->new_page = NULL;
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
@@ -1981,59 +2690,490 @@ static int remove_migration_ptes_concurr(struct list_head *unmapped_list_ptr)
 #endif
 	}
 
+	if (pagevec_count(&old_pvec))
+		release_migrated_pages(&old_pvec);
+	if (pagevec_count(&new_pvec))
+		__pagevec_lru_add(&new_pvec);
+
 	return 0;
 }
 
-int migrate_pages_concur(struct list_head *from, new_page_t get_new_page,
-		free_page_t put_new_page, unsigned long private,
-		enum migrate_mode mode, int reason)
+/* State of the migration of one chunk of migrate_pages_concur() */
+struct migrate_concur_ctx {
+	new_page_t *get_new_page;
+	free_page_t *put_new_page;
+	unsigned long private;
+	enum migrate_mode mode;
+	int reason;
+	/* run the rmap walks on the copy workers, see concur_rmap_walk() */
+	bool parallel_rmap;
+	/* target node whose new pages are allocated in bulk, or NUMA_NO_NODE */
+	int bulk_nid;
+
+	/* pages for the next pass, and pages left to migrate_pages() */
+	struct list_head wip_list;
+	struct list_head serialized_list;
+	struct list_head failed_list;
+
+	int nr_succeeded;
+	int nr_failed;
+	int retry;
+	/* no pass after this one, busy pages are not deferred any more */
+	bool last_pass;
+	/* migrate_rate_charge() debt of the batches copied so far */
+	u64 rate_wait;
+
+	/*
+	 * Exchange pairs unmapped, copied and remapped with the first batch,
+	 * see migrate_exchange_pages_concur(), and the pairs of them left to
+	 * exchange_pages().
+	 */
+	struct list_head *exchange_list;
+	struct list_head exchange_serialized;
+	bool exchange_pending;
+};
+
+/*
+ * Pages the pipeline would only find unmigratable after unmapping them and
+ * shooting down their TLB entries, checked before their new page is even
+ * allocated. Pages under writeback go to migrate_pages() straight away,
+ * which waits for it, pinned pages are deferred to the next pass and
+ * given up on in the last one. Returns the error the item then takes, 0
+ * for a page worth unmapping.
+ */
+static int concur_precheck(struct migrate_concur_ctx *ctx, struct page *page)
+{
+	if (PageWriteback(page)) {
+		count_vm_event(PGMIGRATE_EARLY_WRITEBACK);
+		return -ENODEV;
+	}
+
+	if (isolated_page_pinned(page)) {
+		count_vm_event(PGMIGRATE_EARLY_PINNED);
+		return ctx->last_pass ? -EBUSY : -EAGAIN;
+	}
+
+	return 0;
+}
+
+/* Put back the isolated page of an item given up on before its unmap */
+static void concur_putback_early(struct page_migration_work_item *item)
+{
+	struct page *page = item->old_page;
+
+	list_del(&page->lru);
+	mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
+			page_is_file_cache(page), -hpage_nr_pages(page));
+	putback_lru_page(page);
+}
+
+/*
+ * Unmap and get new pages for up to @batch_size items of @todo, all of them
+ * if 0, and move those that succeed to @unmapped. Returns -ENOMEM if no new
+ * page could be allocated; the rest of @todo is not looked at then.
+ */
+static int unmap_batch_concur(struct migrate_concur_ctx *ctx,
+				struct list_head *todo, struct list_head *unmapped,
+				int batch_size, int force)
 {
-	int retry = 1;
-	int nr_failed = 0;
-	int nr_succeeded = 0;
-	int pass = 0;
-	struct page *page;
-	int swapwrite = current->flags & PF_SWAPWRITE;
-	int rc;
-	int total_num_pages = 0, idx;
-	struct page_migration_work_item *item_list;
 	struct page_migration_work_item *iterator, *iterator2;
-	int item_list_order = 0;
+	struct concur_prefetch cp;
+	int n = 0;
+	int rc, ret = 0;
+
+	if (ctx->bulk_nid != NUMA_NO_NODE) {
+		int nr_base = 0, nr_thp = 0;
+
+		list_for_each_entry(iterator, todo, list) {
+			if (batch_size && n++ == batch_size)
+				break;
+			if (PageHuge(iterator->old_page))
+				continue;
+			if (PageTransHuge(iterator->old_page))
+				nr_thp++;
+			else
+				nr_base++;
+		}
+		migrate_target_cache_fill(ctx->bulk_nid, nr_base, nr_thp);
+		n = 0;
+	}
+
+	concur_prefetch_start(&cp, todo);
+	list_for_each_entry_safe(iterator, iterator2, todo, list) {
+		if (batch_size && n++ == batch_size)
+			break;
+
+		concur_prefetch_advance(&cp);
+		cond_resched();
+
+		if (iterator->new_page) {
+			pr_info("%s: iterator already has a new page?\n", __func__);
+			VM_BUG_ON_PAGE(1, iterator->old_page);
+		}
+
+		/*
+		 * hugetlbfs pages are left to migrate_pages(), and so are
+		 * the page cache pages concur_migratable_mapping() rejects
+		 */
+		if (PageHuge(iterator->old_page))
+			rc = -ENODEV;
+		else
+			rc = concur_precheck(ctx, iterator->old_page);
+
+		if (rc == -EBUSY)
+			concur_putback_early(iterator);
+		else if (!rc)
+			rc = unmap_pages_and_get_new_concur(ctx->get_new_page,
+					ctx->put_new_page, ctx->private, iterator,
+					force, true, ctx->mode, ctx->reason);
+
+		switch(rc) {
+		case -ENODEV:
+			list_move(&iterator->list, &ctx->serialized_list);
+			break;
+		case -ENOMEM:
+			if (PageTransHuge(iterator->old_page))
+				list_move(&iterator->list, &ctx->serialized_list);
+			else
+				ret = -ENOMEM;
+			break;
+		case -EAGAIN:
+			list_move_tail(&iterator->list, &ctx->wip_list);
+			ctx->retry++;
+			break;
+		case MIGRATEPAGE_SUCCESS:
+			if (iterator->old_page) {
+				list_move_tail(&iterator->list, unmapped);
+				ctx->nr_succeeded++;
+			} else { /* pages are freed under us */
+				list_del(&iterator->list);
+			}
+			break;
+		default:
+			/*
+			 * Permanent failure (-EBUSY, -ENOSYS, etc.):
+			 * unlike -EAGAIN case, the failed page is
+			 * removed from migration page list and not
+			 * retried in the next outer loop.
+			 */
+			list_move(&iterator->list, &ctx->failed_list);
+			ctx->nr_failed++;
+			break;
+		}
+		if (ret)
+			break;
+	}
+
+	concur_unmap(unmapped, ctx->parallel_rmap);
+
+	return ret;
+}
+
+/* Charge the migrated pages of @list to the migration rate limits */
+static void concur_rate_charge(struct migrate_concur_ctx *ctx,
+				struct list_head *list)
+{
+	struct page_migration_work_item *iterator;
+	struct concur_prefetch cp;
+
+	concur_prefetch_start(&cp, list);
+	list_for_each_entry(iterator, list, list) {
+		concur_prefetch_advance(&cp);
+		ctx->rate_wait = max(ctx->rate_wait,
+				migrate_rate_charge(iterator->old_page,
+					page_to_nid(iterator->new_page),
+					ctx->reason, ctx->mode));
+	}
+}
+
+/* Count the migrated pages of @list by node pair */
+static void concur_count_pairs(struct list_head *list)
+{
+	struct page_migration_work_item *iterator;
+
+	list_for_each_entry(iterator, list, list)
+		count_migrate_pair(iterator->new_page,
+				page_to_nid(iterator->old_page),
+				page_to_nid(iterator->new_page),
+				MIGRATE_ENGINE_CONCUR);
+}
+
+/*
+ * Copy and remap right away the pages of @b that a task waits on, after a
+ * fault on their migration entries or for their lock, so that it does not
+ * sleep until the whole batch is done. Called before the copy of @b is
+ * submitted and, when the copy is left to this thread, before it is done;
+ * the pages handled are taken off @b.
+ */
+static void concur_copy_waited(struct migrate_concur_ctx *ctx,
+				struct concur_copy_batch *b)
+{
+	struct mem_cgroup_migrate_gather mg = {};
+	struct page_migration_work_item *iterator, *next;
+	LIST_HEAD(waited);
+	int nr = 0;
+
+	list_for_each_entry_safe(iterator, next, &b->list, list) {
+		if (!PageWaiters(iterator->old_page))
+			continue;
+
+		concur_copy_page(iterator);
+		migrate_page_states_gather(iterator->new_page,
+				iterator->old_page, &mg);
+		list_move_tail(&iterator->list, &waited);
+		nr++;
+	}
+
+	if (!nr)
+		return;
+	mem_cgroup_migrate_flush(&mg);
+
+	concur_rate_charge(ctx, &waited);
+	concur_count_pairs(&waited);
+	remove_migration_ptes_concurr(&waited, false, ctx->reason);
+	count_vm_events(PGMIGRATE_CONCUR_WAITED, nr);
+}
+
+/*
+ * Run one pass of the pipeline over @todo: unmap a batch, move its
+ * mappings and start copying it, and once @depth batches are being copied
+ * wait for the oldest one and remap it before unmapping the next batch.
+ * When the migration rate limits are exceeded, the batches in flight are
+ * drained and the task sleeps before unmapping more pages, so that no
+ * page stays unmapped while it does.
+ */
+static void migrate_concur_pipeline(struct migrate_concur_ctx *ctx,
+				struct list_head *todo, int force, bool *nomem)
+{
+	struct concur_copy_batch batch[CONCUR_PIPELINE_MAX_DEPTH];
+	int batch_size = READ_ONCE(concur_copy_batch_size);
+	int depth = clamp(READ_ONCE(concur_pipeline_depth), 1,
+			CONCUR_PIPELINE_MAX_DEPTH);
+	int head = 0, nr_inflight = 0;
+	struct page_migration_work_item *first;
+	struct concur_copy_batch *b;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
 #endif
 
-	LIST_HEAD(wip_list);
-	LIST_HEAD(unmapped_list);
-	LIST_HEAD(serialized_list);
-	LIST_HEAD(failed_list);
+	for (;;) {
+		if (!list_empty(todo) && !*nomem && nr_inflight < depth &&
+		    (!ctx->rate_wait || !nr_inflight)) {
+			migrate_rate_throttle(ctx->rate_wait, ctx->mode);
+			ctx->rate_wait = 0;
+
+			b = &batch[(head + nr_inflight) % depth];
+			INIT_LIST_HEAD(&b->list);
+			b->start = migrate_latency_start();
+			if (!b->start && trace_mm_migrate_batch_end_enabled())
+				b->start = ktime_get_ns();
+			b->clock = b->start;
+
+			if (unmap_batch_concur(ctx, todo, &b->list, batch_size,
+						force) == -ENOMEM)
+				*nomem = true;
+
+			INIT_LIST_HEAD(&b->exchange);
+			if (ctx->exchange_pending) {
+				exchange_concur_unmap(ctx->exchange_list,
+						&b->exchange,
+						&ctx->exchange_serialized,
+						ctx->mode);
+				ctx->exchange_pending = false;
+			}
 
-	if (!swapwrite)
-		current->flags |= PF_SWAPWRITE;
+			/*
+			 * One shootdown for every page of the batch, stale TLB
+			 * entries must be gone before the pages are copied.
+			 */
+			try_to_unmap_flush();
 
-	list_for_each_entry(page, from, lru)
-		++total_num_pages;
+#ifdef CONFIG_PAGE_MIGRATION_PROFILE
+			timestamp = rdtsc();
+			current->move_pages_breakdown.unmap_page_cycles += timestamp -
+				current->move_pages_breakdown.last_timestamp;
+			current->move_pages_breakdown.last_timestamp = timestamp;
+#endif
+			migrate_latency_phase(MIGRATE_ENGINE_CONCUR,
+					MIGRATE_PHASE_UNMAP, &b->clock);
+
+			/* move page->mapping to new page, only -EAGAIN could happen */
+			b->nr_busy = move_mapping_concurr(&b->list,
+					&ctx->wip_list, ctx->put_new_page,
+					ctx->private, ctx->mode);
+			ctx->nr_succeeded -= b->nr_busy;
+			ctx->retry += b->nr_busy;
+			exchange_concur_move_mapping(&b->exchange, ctx->mode);
+
+			/* a batch goes from one node to another, bar misplaced pages */
+			b->src_nid = b->dst_nid = NUMA_NO_NODE;
+			first = list_first_entry_or_null(&b->list,
+					struct page_migration_work_item, list);
+			if (first) {
+				b->src_nid = page_to_nid(first->old_page);
+				b->dst_nid = page_to_nid(first->new_page);
+			}
+
+			/* the pages faulted on since the unmap go first */
+			concur_copy_waited(ctx, b);
+			copy_to_new_pages_concur_submit(b, ctx->mode);
+			/* the exchanges are copied while the migrations are */
+			exchange_concur_copy(&b->exchange, ctx->mode);
+			trace_mm_migrate_batch_start(MIGRATE_ENGINE_CONCUR,
+					b->src_nid, b->dst_nid, b->num_pages,
+					ctx->mode);
+			nr_inflight++;
+			continue;
+		}
+
+		if (!nr_inflight)
+			break;
+
+		/* remove migration pte, unlock old and new pages, put anon_vma,
+		 * put old and new pages */
+		b = &batch[head];
+		/* the pages of a copy left to this thread faulted on meanwhile */
+		if (!b->ops && IS_ERR(b->handle))
+			concur_copy_waited(ctx, b);
+		/* copies overlap, the copy phase runs from the submission */
+		copy_to_new_pages_concur_finish(b);
+		migrate_latency_phase(MIGRATE_ENGINE_CONCUR, MIGRATE_PHASE_COPY,
+				&b->clock);
+		concur_rate_charge(ctx, &b->list);
+		concur_count_pairs(&b->list);
+		remove_migration_ptes_concurr(&b->list, ctx->parallel_rmap,
+				ctx->reason);
+		if (!list_empty(&b->exchange)) {
+			ctx->rate_wait = max(ctx->rate_wait, exchange_concur_remap(
+					&b->exchange, ctx->reason, ctx->mode));
+			list_splice_tail(&b->exchange, ctx->exchange_list);
+		}
+		migrate_latency_phase(MIGRATE_ENGINE_CONCUR, MIGRATE_PHASE_REMAP,
+				&b->clock);
+		if (b->num_pages) {
+			migrate_latency_done(MIGRATE_ENGINE_CONCUR,
+					MIGRATE_PHASE_BATCH, b->src_nid,
+					b->dst_nid, b->start);
+			if (b->start)
+				trace_mm_migrate_batch_end(MIGRATE_ENGINE_CONCUR,
+						b->src_nid, b->dst_nid,
+						b->num_pages, b->nr_busy,
+						ktime_get_ns() - b->start);
+		}
+		head = (head + 1) % depth;
+		nr_inflight--;
+	}
+
+	/* left over by an allocation failure */
+	list_splice_tail_init(todo, &ctx->wip_list);
+}
+
+/*
+ * The work items of migrate_pages_concur() come in chunks of one page from
+ * a mempool rather than in one high-order allocation per call: the path
+ * is used by compaction when memory is fragmented, exactly when such
+ * allocations fail. Longer page lists are migrated one chunk at a time.
+ */
+#define CONCUR_ITEMS_PER_CHUNK \
+	(PAGE_SIZE / sizeof(struct page_migration_work_item))
+
+#define CONCUR_ITEM_POOL_MIN	4
 
-	item_list_order = get_order(total_num_pages *
-		sizeof(struct page_migration_work_item));
+static mempool_t *concur_item_pool;
 
-	if (item_list_order > MAX_ORDER) {
-		item_list = alloc_pages_exact(total_num_pages *
-			sizeof(struct page_migration_work_item), GFP_ATOMIC);
-		memset(item_list, 0, total_num_pages *
+static int __init concur_item_pool_init(void)
+{
+	concur_item_pool = mempool_create_kmalloc_pool(CONCUR_ITEM_POOL_MIN,
+			CONCUR_ITEMS_PER_CHUNK *
 			sizeof(struct page_migration_work_item));
-	} else {
-		item_list = (struct page_migration_work_item *)__get_free_pages(GFP_ATOMIC,
-						item_list_order);
-		memset(item_list, 0, PAGE_SIZE<<item_list_order);
+
+	return concur_item_pool ? 0 : -ENOMEM;
+}
+core_initcall(concur_item_pool_init);
+
+/* Without reclaim, callers fall back to migrate_pages() on failure */
+static struct page_migration_work_item *concur_item_alloc(void)
+{
+	if (!concur_item_pool)
+		return NULL;
+
+	return mempool_alloc(concur_item_pool, GFP_NOWAIT | __GFP_NOWARN);
+}
+
+static void concur_item_free(struct page_migration_work_item *item_list)
+{
+	if (item_list)
+		mempool_free(item_list, concur_item_pool);
+}
+
+/* Move the first @nr_pages pages of @from to @to */
+static void concur_take_pages(struct list_head *from, struct list_head *to,
+				int nr_pages)
+{
+	struct list_head *pos;
+	int n = 0;
+
+	list_for_each(pos, from) {
+		if (++n == nr_pages)
+			break;
 	}
 
+	if (pos == from)
+		list_splice_init(from, to);
+	else
+		list_cut_position(to, from, pos);
+}
+
+/*
+ * Migrate the at most CONCUR_ITEMS_PER_CHUNK pages of @from with the work
+ * items of @item_list. The pages that are not migrated are left on @from.
+ * The pairs of @exchange_list, if any, are exchanged along the first batch
+ * and left on it like exchange_pages_concur() leaves them. Returns the
+ * number of pages that failed and adds the migrated ones to @nr_succeeded.
+ */
+static int migrate_pages_concur_chunk(struct list_head *from,
+		struct page_migration_work_item *item_list,
+		new_page_t get_new_page, free_page_t put_new_page,
+		unsigned long private, struct list_head *exchange_list,
+		enum migrate_mode mode, int reason, int *nr_succeeded_ptr)
+{
+	struct migrate_concur_ctx ctx = {
+		.get_new_page = get_new_page,
+		.put_new_page = put_new_page,
+		.private = private,
+		.mode = mode,
+		.reason = reason,
+		.parallel_rmap = mode & MIGRATE_MT,
+		.bulk_nid = NUMA_NO_NODE,
+		.retry = 1,
+		.exchange_list = exchange_list,
+		.exchange_pending = exchange_list && !list_empty(exchange_list),
+	};
+	bool nomem = false;
+	struct page *page;
+	int pass = 0;
+	int idx;
+#ifdef CONFIG_PAGE_MIGRATION_PROFILE
+	u64 timestamp;
+#endif
+
+	LIST_HEAD(todo_list);
+	INIT_LIST_HEAD(&ctx.wip_list);
+	INIT_LIST_HEAD(&ctx.serialized_list);
+	INIT_LIST_HEAD(&ctx.failed_list);
+	INIT_LIST_HEAD(&ctx.exchange_serialized);
+
+	/* alloc_new_node_page() allocates from the bulk filled target cache */
+	if (get_new_page == alloc_new_node_page)
+		ctx.bulk_nid = private;
+
 	idx = 0;
 	list_for_each_entry(page, from, lru) {
+		VM_BUG_ON(idx >= CONCUR_ITEMS_PER_CHUNK);
+		memset(&item_list[idx], 0, sizeof(item_list[idx]));
 		item_list[idx].old_page = page;
-		item_list[idx].new_page = NULL;
 		INIT_LIST_HEAD(&item_list[idx].list);
-		list_add_tail(&item_list[idx].list, &wip_list);
+		list_add_tail(&item_list[idx].list, &ctx.wip_list);
 		idx += 1;
 	}
 
@@ -2044,86 +3184,73 @@ int migrate_pages_concur(struct list_head *from, new_page_t get_new_page,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	for(pass = 0; pass < 1 && retry; pass++) {
-		retry = 0;
+	/*
+	 * Like migrate_pages(), retry transiently busy pages: locked, under
+	 * writeback or with extra references. Each pass re-runs the whole
+	 * pipeline on what is left of the batch, from the third one on
+	 * waiting for page locks.
+	 */
+	for(pass = 0; pass < CONCUR_MIGRATE_PASSES && ctx.retry && !nomem; pass++) {
+		ctx.retry = 0;
+		ctx.last_pass = pass == CONCUR_MIGRATE_PASSES - 1;
+		list_splice_init(&ctx.wip_list, &todo_list);
+		migrate_concur_pipeline(&ctx, &todo_list, pass > 2, &nomem);
+	}
+	*nr_succeeded_ptr += ctx.nr_succeeded;
 
-		/* unmap and get new page for page_mapping(page) == NULL */
-		list_for_each_entry_safe(iterator, iterator2, &wip_list, list) {
-			cond_resched();
+	if (ctx.bulk_nid != NUMA_NO_NODE)
+		migrate_target_cache_trim(ctx.bulk_nid);
 
-			if (iterator->new_page) {
-				pr_info("%s: iterator already has a new page?\n", __func__);
-				VM_BUG_ON_PAGE(1, iterator->old_page);
-			}
+	migrate_rate_throttle(ctx.rate_wait, mode);
 
-			/* We do not migrate huge pages, file-backed, or swapcached pages */
-			if (PageHuge(iterator->old_page)) {
-				rc = -ENODEV;
-			}
-			else if ((page_mapping(iterator->old_page) != NULL)) {
-				rc = -ENODEV;
-			}
-			else
-				rc = unmap_pages_and_get_new_concur(get_new_page, put_new_page,
-						private, iterator, pass > 2, mode,
-						reason);
+	if (exchange_list) {
+		exchange_pages(&ctx.exchange_serialized, mode, reason);
+		try_to_unmap_flush();
+		list_splice(&ctx.exchange_serialized, exchange_list);
+	}
 
-			switch(rc) {
-			case -ENODEV:
-				list_move(&iterator->list, &serialized_list);
-				break;
-			case -ENOMEM:
-				if (PageTransHuge(page))
-					list_move(&iterator->list, &serialized_list);
-				else
-					goto out;
-				break;
-			case -EAGAIN:
-				retry++;
-				break;
-			case MIGRATEPAGE_SUCCESS:
-				if (iterator->old_page) {
-					list_move(&iterator->list, &unmapped_list);
-					nr_succeeded++;
-				} else { /* pages are freed under us */
-					list_del(&iterator->list);
-				}
-				break;
-			default:
-				/*
-				 * Permanent failure (-EBUSY, -ENOSYS, etc.):
-				 * unlike -EAGAIN case, the failed page is
-				 * removed from migration page list and not
-				 * retried in the next outer loop.
-				 */
-				list_move(&iterator->list, &failed_list);
-				nr_failed++;
-				break;
-			}
-		}
-out:
-		if (list_empty(&unmapped_list))
-			continue;
+	return ctx.nr_failed + ctx.retry;
+}
 
+static int __migrate_pages_concur(struct list_head *from, new_page_t get_new_page,
+		free_page_t put_new_page, unsigned long private,
+		struct list_head *exchange_list, enum migrate_mode mode,
+		int reason)
+{
+	int nr_failed = 0;
+	int nr_succeeded = 0;
+	int swapwrite = current->flags & PF_SWAPWRITE;
+	int rc;
+	struct page_migration_work_item *item_list;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
-		timestamp = rdtsc();
-		current->move_pages_breakdown.unmap_page_cycles += timestamp -
-			current->move_pages_breakdown.last_timestamp;
-		current->move_pages_breakdown.last_timestamp = timestamp;
+	u64 timestamp;
 #endif
 
-		/* move page->mapping to new page, only -EAGAIN could happen  */
-		move_mapping_concurr(&unmapped_list, &wip_list, put_new_page, private, mode);
-
-		/* copy pages in unmapped_list */
-		copy_to_new_pages_concur(&unmapped_list, mode);
+	LIST_HEAD(chunk);
+	LIST_HEAD(leftover);
 
-		/* remove migration pte, if old_page is NULL?, unlock old and new
-		 * pages, put anon_vma, put old and new pages */
-		remove_migration_ptes_concurr(&unmapped_list);
+	if (!swapwrite)
+		current->flags |= PF_SWAPWRITE;
 
+	item_list = concur_item_alloc();
+	while (item_list && !list_empty(from)) {
+		concur_take_pages(from, &chunk, CONCUR_ITEMS_PER_CHUNK);
+		/* the exchanges go with the first batch of the first chunk */
+		nr_failed += migrate_pages_concur_chunk(&chunk, item_list,
+				get_new_page, put_new_page, private,
+				exchange_list, mode, reason, &nr_succeeded);
+		exchange_list = NULL;
+		list_splice_tail_init(&chunk, &leftover);
+		cond_resched();
 	}
-	nr_failed += retry;
+	concur_item_free(item_list);
+
+	/* nothing to migrate, or no work items to migrate with */
+	if (exchange_list && !list_empty(exchange_list))
+		exchange_pages_concur(exchange_list, mode, reason);
+
+	/* what the chunks did not migrate goes through migrate_pages() */
+	list_splice(&leftover, from);
 	rc = nr_failed;
 
 	if (!list_empty(from))
@@ -2136,13 +3263,6 @@ int migrate_pages_concur(struct list_head *from, new_page_t get_new_page,
 		count_vm_events(PGMIGRATE_FAIL, nr_failed);
 	trace_mm_migrate_pages(nr_succeeded, nr_failed, mode, reason);
 
-	if (item_list_order >= MAX_ORDER) {
-		free_pages_exact(item_list, total_num_pages *
-			sizeof(struct page_migration_work_item));
-	} else {
-		free_pages((unsigned long)item_list, item_list_order);
-	}
-
 	if (!swapwrite)
 		current->flags &= ~PF_SWAPWRITE;
 
@@ -2156,6 +3276,268 @@ int migrate_pages_concur(struct list_head *from, new_page_t get_new_page,
 	return rc;
 }
 
+// Run migrate_pages_concur()/exchange_pages_concur() calls of at least
+// this many pages on a kthread bound to the socket nearest the PMEM node,
+// 0 disables the offload
+int concur_offload_min_pages = 0;
+
+/* Per node kthread workers running offloaded concurrent migrations */
+static struct kthread_worker *concur_offload_workers[MAX_NUMNODES];
+static DEFINE_MUTEX(concur_offload_mutex);
+
+struct concur_offload_req {
+	struct kthread_work work;
+	int (*fn)(void *arg);
+	void *arg;
+	/* copy policy of the task that offloaded the migration */
+	struct page_copy_policy policy;
+	int rc;
+};
+
+static struct kthread_worker *concur_offload_worker(int nid)
+{
+	struct kthread_worker *worker;
+
+	worker = smp_load_acquire(&concur_offload_workers[nid]);
+	if (worker)
+		return worker;
+
+	mutex_lock(&concur_offload_mutex);
+	worker = concur_offload_workers[nid];
+	if (!worker) {
+		worker = kthread_create_worker(0, "kmigrate_concur/%d", nid);
+		if (IS_ERR(worker)) {
+			worker = NULL;
+			goto unlock;
+		}
+		set_cpus_allowed_ptr(worker->task, cpumask_of_node(nid));
+		smp_store_release(&concur_offload_workers[nid], worker);
+	}
+unlock:
+	mutex_unlock(&concur_offload_mutex);
+
+	return worker;
+}
+
+static void concur_offload_fn(struct kthread_work *work)
+{
+	struct concur_offload_req *req =
+		container_of(work, struct concur_offload_req, work);
+
+	current->page_copy_policy = req->policy;
+	req->rc = req->fn(req->arg);
+	current->page_copy_policy = PAGE_COPY_POLICY_DEFAULT;
+}
+
+/*
+ * Run @fn(@arg) on the kthread worker of node @nid and wait for it, so
+ * that the unmap, remap and copy steps of a concurrent migration touch
+ * the PMEM memmap and page tables from the local socket. Returns false,
+ * and the caller runs @fn itself, if the offload is disabled, the batch
+ * of @nr_pages is too small, this CPU already is on @nid or the caller
+ * reclaims memory and must keep its own context.
+ */
+bool migrate_concur_offload(int nid, int nr_pages,
+		int (*fn)(void *arg), void *arg, int *rc)
+{
+	int min_pages = READ_ONCE(concur_offload_min_pages);
+	struct concur_offload_req req;
+	struct kthread_worker *worker;
+
+	if (!min_pages || nr_pages < min_pages)
+		return false;
+	if (nid == numa_node_id() || !node_state(nid, N_CPU))
+		return false;
+	if (current->flags & PF_MEMALLOC)
+		return false;
+
+	worker = concur_offload_worker(nid);
+	if (!worker)
+		return false;
+
+	kthread_init_work(&req.work, concur_offload_fn);
+	req.fn = fn;
+	req.arg = arg;
+	req.policy = current->page_copy_policy;
+	kthread_queue_work(worker, &req.work);
+	kthread_flush_work(&req.work);
+
+	*rc = req.rc;
+	return true;
+}
+
+struct migrate_concur_args {
+	struct list_head *from;
+	new_page_t *get_new_page;
+	free_page_t *put_new_page;
+	unsigned long private;
+	struct list_head *exchange_list;
+	enum migrate_mode mode;
+	int reason;
+};
+
+static int migrate_pages_concur_fn(void *arg)
+{
+	struct migrate_concur_args *args = arg;
+
+	return __migrate_pages_concur(args->from, args->get_new_page,
+			args->put_new_page, args->private, args->exchange_list,
+			args->mode, args->reason);
+}
+
+int migrate_pages_concur(struct list_head *from, new_page_t get_new_page,
+		free_page_t put_new_page, unsigned long private,
+		enum migrate_mode mode, int reason)
+{
+	return migrate_exchange_pages_concur(from, get_new_page, put_new_page,
+			private, NULL, mode, reason);
+}
+
+/*
+ * migrate_pages_concur() of the pages of @from, and exchange of the pairs
+ * of @exchange_list in the same pipeline: the pairs are unmapped with the
+ * first batch of migrations, under the same TLB shootdown, copied while
+ * the batch is and remapped with it, instead of going through a pipeline
+ * of their own. The pairs are left on @exchange_list, as by
+ * exchange_pages_concur(). Returns the result for the migrations.
+ */
+int migrate_exchange_pages_concur(struct list_head *from,
+		new_page_t get_new_page, free_page_t put_new_page,
+		unsigned long private, struct list_head *exchange_list,
+		enum migrate_mode mode, int reason)
+{
+	struct migrate_concur_args args = {
+		.from = from,
+		.get_new_page = get_new_page,
+		.put_new_page = put_new_page,
+		.private = private,
+		.exchange_list = exchange_list,
+		.mode = mode,
+		.reason = reason,
+	};
+	int to_nid = NUMA_NO_NODE;
+	struct page *page;
+	int nr_pages = 0;
+	int rc;
+
+	list_for_each_entry(page, from, lru)
+		nr_pages++;
+
+	/* only alloc_new_node_page() tells where the pages go */
+	if (get_new_page == alloc_new_node_page)
+		to_nid = private;
+
+	page = list_first_entry_or_null(from, struct page, lru);
+	if (page && migrate_concur_offload(
+				copy_page_rpdaa_node(page_to_nid(page), to_nid),
+				nr_pages, migrate_pages_concur_fn, &args, &rc))
+		return rc;
+
+	return __migrate_pages_concur(from, get_new_page, put_new_page,
+			private, exchange_list, mode, reason);
+}
+
+/*
+ * migrate_pages() of the pages of @mm on @from with the copy mode of the
+ * MPOL_MF_MOVE_MT, MPOL_MF_MOVE_DMA and MPOL_MF_MOVE_CONCUR bits and the
+ * MPOL_MF_COPY_* policy of @flags, for the syscalls that take them.
+ */
+int migrate_pages_flags(struct mm_struct *mm, struct list_head *from,
+		new_page_t get_new_page, free_page_t put_new_page,
+		unsigned long private, int flags, int reason)
+{
+	bool migrate_mt = flags & MPOL_MF_MOVE_MT;
+	bool migrate_dma = flags & MPOL_MF_MOVE_DMA;
+	enum migrate_mode mode = MIGRATE_SYNC |
+		(migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD) |
+		(migrate_dma ? MIGRATE_DMA : MIGRATE_SINGLETHREAD) |
+		(migrate_mt && migrate_dma ? MIGRATE_HYBRID : MIGRATE_SINGLETHREAD);
+	struct page_copy_policy copy_policy;
+	struct migrate_cputime cputime;
+	int err;
+
+	err = page_copy_policy_enter(mm, flags, &copy_policy);
+	if (err)
+		return err;
+	migrate_cputime_begin(&cputime, current);
+
+	if (flags & MPOL_MF_MOVE_CONCUR)
+		err = migrate_pages_concur(from, get_new_page, put_new_page,
+				private, mode | MIGRATE_CONCUR, reason);
+	else
+		err = migrate_pages(from, get_new_page, put_new_page, private,
+				mode, reason);
+
+	migrate_cputime_end(&cputime);
+	page_copy_policy_exit(&copy_policy);
+
+	return err;
+}
+
+/**
+ * migrate_pages_batch - migrate a list of pages with the concurrent pipeline
+ * @from: pages isolated from the LRU, those not migrated are left on it
+ * @get_new_page: allocates the target pages, as for migrate_pages()
+ * @put_new_page: frees the unused target pages, or NULL
+ * @private: passed on to @get_new_page and @put_new_page
+ * @engine: copies the pages, see enum migrate_copy_engine
+ * @ops: copy callbacks with MIGRATE_COPY_DRIVER, NULL otherwise
+ * @reason: reason of the migration
+ *
+ * The pages are unmapped, copied and remapped in batches like those of
+ * move_pages(MPOL_MF_MOVE_CONCUR). With MIGRATE_COPY_DRIVER the ->submit()
+ * callback is handed the target and source pages of each batch and
+ * ->wait() is called once the next batch has been submitted. If either
+ * fails the batch is copied by the CPU. The pages that stay busy are
+ * migrated one at a time by the CPU.
+ *
+ * Returns the number of pages not migrated, or an error code. The caller
+ * puts the pages left on @from back with putback_movable_pages().
+ */
+int migrate_pages_batch(struct list_head *from, new_page_t get_new_page,
+		free_page_t put_new_page, unsigned long private,
+		enum migrate_copy_engine engine,
+		const struct migrate_copy_ops *ops, int reason)
+{
+	enum migrate_mode mode = MIGRATE_SYNC | MIGRATE_CONCUR;
+	const struct migrate_copy_ops *old_ops;
+	int err;
+
+	switch (engine) {
+	case MIGRATE_COPY_CPU:
+		break;
+	case MIGRATE_COPY_MT:
+		mode |= MIGRATE_MT;
+		break;
+	case MIGRATE_COPY_DMA:
+		mode |= MIGRATE_DMA;
+		break;
+	case MIGRATE_COPY_HYBRID:
+		mode |= MIGRATE_MT | MIGRATE_DMA | MIGRATE_HYBRID;
+		break;
+	case MIGRATE_COPY_DRIVER:
+		if (!ops || !ops->submit || !ops->wait)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (engine != MIGRATE_COPY_DRIVER)
+		return migrate_pages_concur(from, get_new_page, put_new_page,
+				private, mode, reason);
+
+	/* the callbacks are the caller's, the pipeline is not offloaded */
+	old_ops = current->migrate_copy_ops;
+	current->migrate_copy_ops = ops;
+	err = __migrate_pages_concur(from, get_new_page, put_new_page,
+			private, NULL, mode, reason);
+	current->migrate_copy_ops = old_ops;
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(migrate_pages_batch);
+
 /*
  * migrate_pages - migrate the pages specified in a list, to the free pages
  *		   supplied as the target for the page migration
@@ -2177,6 +3559,80 @@ int migrate_pages_concur(struct list_head *from, new_page_t get_new_page,
  *
  * Returns the number of pages that were not migrated, or an error code.
  */
+/*
+ * With vm.migrate_exchange_fallback set, the pages that migrate_pages()
+ * cannot allocate a target page for on the node of alloc_new_node_page()
+ * are exchanged with cold pages of that node. Returns the node, or
+ * NUMA_NO_NODE if the fallback does not apply.
+ */
+static int migrate_exchange_fallback_nid(new_page_t get_new_page,
+		unsigned long private, int reason)
+{
+	if (!READ_ONCE(sysctl_migrate_exchange_fallback) ||
+	    get_new_page != alloc_new_node_page)
+		return NUMA_NO_NODE;
+	if (reason != MR_SYSCALL && reason != MR_MEMPOLICY_MBIND &&
+	    reason != MR_NUMA_MISPLACED)
+		return NUMA_NO_NODE;
+
+	return private;
+}
+
+/* new_page_t handing over the target page of migrate_thp_exchange() once */
+static struct page *migrate_thp_exchange_target(struct page *page,
+		unsigned long private)
+{
+	struct page **target = (struct page **)private;
+	struct page *newpage = *target;
+
+	*target = NULL;
+	return newpage;
+}
+
+/*
+ * Exchange fallback of a THP with no cold THP on @nid to be exchanged
+ * with: migrate it into a block that exchange_thp_target() emptied of cold
+ * base pages, instead of splitting it.
+ */
+static int migrate_thp_exchange(struct page *page, int nid, int force,
+		enum migrate_mode mode, enum migrate_reason reason)
+{
+	struct page *target = exchange_thp_target(page, nid, mode);
+	int rc;
+
+	if (!target)
+		return -ENOMEM;
+	if (IS_ERR(target))
+		return PTR_ERR(target);
+
+	rc = unmap_and_move(migrate_thp_exchange_target, NULL,
+			(unsigned long)&target, page, force, mode, reason);
+	/* the page was freed under us and the target not used */
+	if (target)
+		put_page(target);
+
+	return rc;
+}
+
+// Compact the target node before splitting a THP that cannot be migrated
+int sysctl_thp_migration_compact = 0;
+
+atomic_long_t thp_migration_splits[MR_TYPES];
+
+/*
+ * Node to compact for a THP that cannot be allocated on the node of
+ * alloc_new_node_page(), NUMA_NO_NODE if it should be split right away.
+ */
+static int migrate_thp_compact_nid(new_page_t get_new_page,
+		unsigned long private)
+{
+	if (!READ_ONCE(sysctl_thp_migration_compact) ||
+	    get_new_page != alloc_new_node_page || !thp_migration_supported())
+		return NUMA_NO_NODE;
+
+	return private;
+}
+
 int migrate_pages(struct list_head *from, new_page_t get_new_page,
 		free_page_t put_new_page, unsigned long private,
 		enum migrate_mode mode, int reason)
@@ -2188,6 +3644,15 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 	struct page *page;
 	struct page *page2;
 	int swapwrite = current->flags & PF_SWAPWRITE;
+	int exchange_nid = migrate_exchange_fallback_nid(get_new_page, private,
+			reason);
+	/* once the target node is full, the other pages go straight there */
+	bool target_full = false;
+	int nr_exchange = 0;
+	LIST_HEAD(exchange_list);
+	bool thp_exchange = true;
+	int compact_nid = migrate_thp_compact_nid(get_new_page, private);
+	struct page *compacted = NULL;
 	int rc;
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	u64 timestamp;
@@ -2203,7 +3668,10 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 retry:
 			cond_resched();
 
-			if (PageHuge(page))
+			if (target_full && exchange_fallback_page(page) &&
+			    page != compacted)
+				rc = -ENOMEM;
+			else if (PageHuge(page))
 				rc = unmap_and_move_huge_page(get_new_page,
 						put_new_page, private, page,
 						pass > 2, mode, reason);
@@ -2214,6 +3682,49 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 
 			switch(rc) {
 			case -ENOMEM:
+				/*
+				 * Before a THP is split, or exchanged, the
+				 * target node is compacted once for it. After
+				 * a compaction that did not help, the next THPs
+				 * are not held up by more.
+				 */
+				if (compact_nid != NUMA_NO_NODE && page != compacted &&
+				    PageTransHuge(page) && !PageHuge(page)) {
+					compacted = page;
+					if (compact_node_order(compact_nid,
+							HPAGE_PMD_ORDER))
+						goto retry;
+					compact_nid = NUMA_NO_NODE;
+				}
+				if (exchange_nid != NUMA_NO_NODE &&
+				    !exchange_fallback_queue(page, exchange_nid,
+						&exchange_list)) {
+					target_full = true;
+					nr_exchange++;
+					break;
+				}
+				if (exchange_nid != NUMA_NO_NODE && thp_exchange &&
+				    PageTransHuge(page) && !PageHuge(page)) {
+					rc = migrate_thp_exchange(page, exchange_nid,
+							pass > 2, mode, reason);
+					if (rc == MIGRATEPAGE_SUCCESS) {
+						nr_succeeded++;
+						break;
+					}
+					/* a permanent failure put the page back */
+					if (rc != -ENOMEM && rc != -EAGAIN) {
+						nr_failed++;
+						break;
+					}
+					/* retried whole on the next pass */
+					if (rc == -EAGAIN) {
+						retry++;
+						break;
+					}
+					/* no block to be had, split the next THPs */
+					if (rc == -ENOMEM)
+						thp_exchange = false;
+				}
 				/*
 				 * THP migration might be unsupported or the
 				 * allocation could've failed so we should
@@ -2229,6 +3740,8 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 					lock_page(page);
 					rc = split_huge_page_to_list(page, from);
 					unlock_page(page);
+					if (!rc)
+						count_thp_migration_split(reason);
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 					timestamp = rdtsc();
@@ -2265,6 +3778,15 @@ int migrate_pages(struct list_head *from, new_page_t get_new_page,
 	nr_failed += retry;
 	rc = nr_failed;
 out:
+	if (nr_exchange) {
+		int nr_exchange_failed = exchange_fallback_flush(&exchange_list,
+				mode, reason);
+
+		nr_failed += nr_exchange_failed;
+		nr_succeeded += nr_exchange - nr_exchange_failed;
+		if (rc >= 0)
+			rc = nr_failed;
+	}
 	if (nr_succeeded)
 		count_vm_events(PGMIGRATE_SUCCESS, nr_succeeded);
 	if (nr_failed)
@@ -2297,79 +3819,6 @@ static int store_status(int __user *status, int start, int value, int nr)
 	return 0;
 }
 
-// IS_PMEM_NODE[x] stores is NUMA node x is PMEM memory only NUMA node
-char IS_PMEM_NODE[MAX_NUMNODES];
-EXPORT_SYMBOL(IS_PMEM_NODE);
-
-void init_closest_cpu_node_for_pmem_list_kernel(void);
-/**
- * @brief Initializes CLOSEST_CPU_NODE_FOR_PMEM array.
- * CLOSEST_CPU_NODE_FOR_PMEM[x] contains id of a cpu which 
- * is on the same socket as a NUMA node x if node x is 
- * PMEM NUMA node. Otherwise it stores -1.
- */
-void init_closest_cpu_node_for_pmem_list_kernel(){
-	if(CLOSEST_CPU_NODE_FOR_PMEM_INITIALIZED)
-		return;
-		
-	int i, j, cpu, nid, cmin;
-	char *is_cpu_node = (char*) kmalloc(MAX_NUMNODES, GFP_KERNEL);
-
-	if(!is_cpu_node){
-		printk("Unable to initialize CLOSEST_CPU_NODE_FOR_PMEM: kernel memory allocation failed!\n");
-		return;
-	}
-
-	int *node_to_cpu = (int*) kmalloc(MAX_NUMNODES*sizeof(int), GFP_KERNEL);
-	if(!node_to_cpu){
-		printk("Unable to initialize CLOSEST_CPU_NODE_FOR_PMEM: kernel memory allocation failed!\n");
-		kfree(is_cpu_node);
-		return;
-	}
-
-	memset(is_cpu_node, 0, MAX_NUMNODES);
-	memset(node_to_cpu, -1, MAX_NUMNODES*sizeof(int));
-	
-	for_each_present_cpu(cpu) {
-		nid = cpu_to_node(cpu);
-		if (nid>=0 && nid<MAX_NUMNODES){
-			is_cpu_node[nid] = 1;
-			node_to_cpu[nid] = cpu;
-		}
-	}
-
-	// find for all pmem nodes the closest cpu node
-	for(i=0; i<MAX_NUMNODES; i++){
-		if(!IS_PMEM_NODE[i]){
-			CLOSEST_CPU_NODE_FOR_PMEM[i] = -1;
-			continue;
-		}
-		/**
-		 * Initialize cmin to 256 which is more than highest
-		 * possible distance between any two numa nodes.
-		 */
-		cmin = 256;
-		for(j=0; j<MAX_NUMNODES; j++){
-			if(is_cpu_node[j] && cmin>node_distance(i, j)){
-				cmin = node_distance(i, j);
-				CLOSEST_CPU_NODE_FOR_PMEM[i] = node_to_cpu[j];
-			}
-		}
-	}
-
-	CLOSEST_CPU_NODE_FOR_PMEM_INITIALIZED = 1;
-	kfree(node_to_cpu);
-	kfree(is_cpu_node);
-}
-
-// returns id of closest cpu to the given NUMA node
-int get_nearest_cpu_node(int node){
-	init_closest_cpu_node_for_pmem_list_kernel();
-	if(CLOSEST_CPU_NODE_FOR_PMEM_INITIALIZED==0 || node < 0 || node >= MAX_NUMNODES)
-		return -1;
-	return CLOSEST_CPU_NODE_FOR_PMEM[node];
-}
-
 static int do_move_pages_to_node(struct mm_struct *mm,
 		struct list_head *pagelist, int node,
 		bool migrate_mt, bool migrate_dma, bool migrate_concur)
@@ -2382,13 +3831,15 @@ static int do_move_pages_to_node(struct mm_struct *mm,
 	if (migrate_concur) {
 		err = migrate_pages_concur(pagelist, alloc_new_node_page, NULL, node,
 				MIGRATE_SYNC | (migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD) |
-				(migrate_dma ? MIGRATE_DMA : MIGRATE_SINGLETHREAD),
+				(migrate_dma ? MIGRATE_DMA : MIGRATE_SINGLETHREAD) |
+				(migrate_mt && migrate_dma ? MIGRATE_HYBRID : MIGRATE_SINGLETHREAD),
 				MR_SYSCALL);
 
 	} else {
 		err = migrate_pages(pagelist, alloc_new_node_page, NULL, node,
 				MIGRATE_SYNC | (migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD) |
-				(migrate_dma ? MIGRATE_DMA : MIGRATE_SINGLETHREAD),
+				(migrate_dma ? MIGRATE_DMA : MIGRATE_SINGLETHREAD) |
+				(migrate_mt && migrate_dma ? MIGRATE_HYBRID : MIGRATE_SINGLETHREAD),
 				MR_SYSCALL);
 	}
 	if (err)
@@ -2470,6 +3921,60 @@ static int add_page_for_migration(struct mm_struct *mm, unsigned long addr,
 	return err;
 }
 
+/**
+ * migrate_range_batch - migrate the pages of a range of @mm to a node
+ * @mm: address space of the range
+ * @start: start of the range
+ * @end: end of the range
+ * @nid: target node
+ * @engine: copies the pages, as for migrate_pages_batch()
+ * @ops: copy callbacks with MIGRATE_COPY_DRIVER, NULL otherwise
+ *
+ * The pages of the range mapped by @mm alone and not on @nid yet are
+ * isolated and migrated with migrate_pages_batch(). Returns the number of
+ * pages not migrated, or an error code.
+ */
+int migrate_range_batch(struct mm_struct *mm, unsigned long start,
+		unsigned long end, int nid, enum migrate_copy_engine engine,
+		const struct migrate_copy_ops *ops)
+{
+	unsigned long addr;
+	struct page *page;
+	LIST_HEAD(pagelist);
+	int err;
+
+	if (nid < 0 || nid >= MAX_NUMNODES || !node_state(nid, N_MEMORY))
+		return -EINVAL;
+
+	migrate_prep();
+
+	for (addr = start & PAGE_MASK; addr < end; addr += PAGE_SIZE) {
+		if (fatal_signal_pending(current))
+			break;
+
+		err = add_page_for_migration(mm, addr, nid, &pagelist, false);
+		if (err != 1)
+			continue;
+
+		/* skip the tail pages of a THP just isolated */
+		page = list_last_entry(&pagelist, struct page, lru);
+		if (PageTransHuge(page))
+			addr = ALIGN(addr + 1, HPAGE_PMD_SIZE) - PAGE_SIZE;
+		cond_resched();
+	}
+
+	if (list_empty(&pagelist))
+		return 0;
+
+	err = migrate_pages_batch(&pagelist, alloc_new_node_page, NULL, nid,
+			engine, ops, MR_SYSCALL);
+	if (!list_empty(&pagelist))
+		putback_movable_pages(&pagelist);
+
+	return err;
+}
+EXPORT_SYMBOL_GPL(migrate_range_batch);
+
 /*
  * Migrate an array of page address onto an array of nodes and fill
  * the corresponding array of status.
@@ -2478,7 +3983,7 @@ static int do_pages_move(struct mm_struct *mm, nodemask_t task_nodes,
 			 unsigned long nr_pages,
 			 const void __user * __user *pages,
 			 const int __user *nodes,
-			 int __user *status, int flags)
+			 int __user *status, int flags, bool drain_all)
 {
 	int current_node = NUMA_NO_NODE;
 	LIST_HEAD(pagelist);
@@ -2488,7 +3993,10 @@ static int do_pages_move(struct mm_struct *mm, nodemask_t task_nodes,
 	u64 timestamp;
 #endif
 
-	migrate_prep();
+	if (drain_all)
+		migrate_prep();
+	else
+		migrate_prep_local();
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
 	timestamp = rdtsc();
@@ -2740,6 +4248,243 @@ static int do_pages_stat(struct mm_struct *mm, unsigned long nr_pages,
 	return nr_pages ? -EFAULT : 0;
 }
 
+/*
+ * With MPOL_MF_MOVE_GROUPED, do_pages_move_grouped() reads this many
+ * entries at a time and migrates those of each target node as one batch,
+ * however the target nodes are interleaved in the nodes array.
+ */
+#define DO_PAGES_MOVE_GROUP_CHUNK_NR 1024
+
+/*
+ * Isolate the pages of @nr entries into one list per target node,
+ * recording the entries queued in @queued. Stops at the first invalid
+ * target node, returning the error and the number of entries handled in
+ * @nr_done.
+ */
+static int do_pages_move_group(struct mm_struct *mm, nodemask_t task_nodes,
+		unsigned long nr, const void __user **chunk_pages,
+		const int *chunk_nodes, int *chunk_status, unsigned long *queued,
+		struct list_head *node_lists, nodemask_t *used, int flags,
+		unsigned long *nr_done)
+{
+	unsigned long i;
+	int node, err;
+
+	for (i = 0; i < nr; i++) {
+		node = chunk_nodes[i];
+
+		err = -ENODEV;
+		if (node < 0 || node >= MAX_NUMNODES)
+			break;
+		if (!node_state(node, N_MEMORY))
+			break;
+
+		err = -EACCES;
+		if (!node_isset(node, task_nodes))
+			break;
+
+		err = add_page_for_migration(mm,
+				(unsigned long)untagged_addr(chunk_pages[i]),
+				node, &node_lists[node],
+				flags & MPOL_MF_MOVE_ALL);
+		if (err > 0) {
+			__set_bit(i, queued);
+			node_set(node, *used);
+		}
+		/* 0 when the page is already on the target node */
+		chunk_status[i] = err ? err : node;
+	}
+
+	*nr_done = i;
+
+	return i < nr ? err : 0;
+}
+
+/*
+ * Migrate the pages of each list of @node_lists to its node. Returns the
+ * number of pages that were not migrated, or an error. The status of the
+ * queued entries of a node with failures is looked up again.
+ */
+static int do_pages_move_flush(struct mm_struct *mm, unsigned long nr,
+		const void __user **chunk_pages, const int *chunk_nodes,
+		int *chunk_status, unsigned long *queued,
+		struct list_head *node_lists, nodemask_t *used, int flags)
+{
+	nodemask_t failed = NODE_MASK_NONE;
+	int nr_failed = 0, err = 0;
+	unsigned long i;
+	int node;
+
+	for_each_node_mask(node, *used) {
+		int ret;
+
+		if (err) {
+			putback_movable_pages(&node_lists[node]);
+			continue;
+		}
+
+		ret = do_move_pages_to_node(mm, &node_lists[node], node,
+				flags & MPOL_MF_MOVE_MT, flags & MPOL_MF_MOVE_DMA,
+				flags & MPOL_MF_MOVE_CONCUR);
+		if (ret < 0)
+			err = ret;
+		else if (ret > 0) {
+			nr_failed += ret;
+			node_set(node, failed);
+		}
+	}
+	nodes_clear(*used);
+
+	if (err)
+		return err;
+
+	for_each_set_bit(i, queued, nr)
+		if (node_isset(chunk_nodes[i], failed))
+			do_pages_stat_array(mm, 1, &chunk_pages[i],
+					&chunk_status[i]);
+
+	return nr_failed;
+}
+
+/*
+ * Like do_pages_move(), but the entries are grouped by target node before
+ * they are migrated.
+ */
+static int do_pages_move_grouped(struct mm_struct *mm, nodemask_t task_nodes,
+			 unsigned long nr_pages,
+			 const void __user * __user *pages,
+			 const int __user *nodes,
+			 int __user *status, int flags, bool drain_all)
+{
+	DECLARE_BITMAP(queued, DO_PAGES_MOVE_GROUP_CHUNK_NR);
+	const void __user **chunk_pages;
+	struct list_head *node_lists;
+	nodemask_t used = NODE_MASK_NONE;
+	int *chunk_nodes, *chunk_status;
+	int nr_failed = 0, err = 0, ret;
+	unsigned long chunk_nr, nr_done;
+	int node;
+
+	chunk_pages = kvmalloc_array(DO_PAGES_MOVE_GROUP_CHUNK_NR,
+			sizeof(*chunk_pages), GFP_KERNEL);
+	chunk_nodes = kvmalloc_array(DO_PAGES_MOVE_GROUP_CHUNK_NR,
+			sizeof(*chunk_nodes), GFP_KERNEL);
+	chunk_status = kvmalloc_array(DO_PAGES_MOVE_GROUP_CHUNK_NR,
+			sizeof(*chunk_status), GFP_KERNEL);
+	node_lists = kmalloc_array(nr_node_ids, sizeof(*node_lists),
+			GFP_KERNEL);
+	if (!chunk_pages || !chunk_nodes || !chunk_status || !node_lists) {
+		err = -ENOMEM;
+		goto out;
+	}
+	for (node = 0; node < nr_node_ids; node++)
+		INIT_LIST_HEAD(&node_lists[node]);
+
+	if (drain_all)
+		migrate_prep();
+	else
+		migrate_prep_local();
+
+	while (nr_pages) {
+		chunk_nr = min_t(unsigned long, nr_pages,
+				DO_PAGES_MOVE_GROUP_CHUNK_NR);
+
+		err = -EFAULT;
+		if (copy_from_user(chunk_pages, pages,
+				   chunk_nr * sizeof(*chunk_pages)) ||
+		    copy_from_user(chunk_nodes, nodes,
+				   chunk_nr * sizeof(*chunk_nodes)))
+			break;
+
+		bitmap_zero(queued, chunk_nr);
+		err = do_pages_move_group(mm, task_nodes, chunk_nr,
+				chunk_pages, chunk_nodes, chunk_status, queued,
+				node_lists, &used, flags, &nr_done);
+
+		/* the entries before an invalid one are still migrated */
+		ret = do_pages_move_flush(mm, nr_done, chunk_pages,
+				chunk_nodes, chunk_status, queued, node_lists,
+				&used, flags);
+		if (ret < 0) {
+			err = ret;
+			break;
+		}
+		nr_failed += ret;
+
+		if (copy_to_user(status, chunk_status,
+				 nr_done * sizeof(*chunk_status)))
+			err = -EFAULT;
+		if (err)
+			break;
+
+		pages += chunk_nr;
+		nodes += chunk_nr;
+		status += chunk_nr;
+		nr_pages -= chunk_nr;
+	}
+
+out:
+	kfree(node_lists);
+	kvfree(chunk_status);
+	kvfree(chunk_nodes);
+	kvfree(chunk_pages);
+
+	return err ? err : nr_failed;
+}
+
+static int move_pages_check_flags(int flags)
+{
+	if (flags & ~(MPOL_MF_MOVE|MPOL_MF_MOVE_ALL|
+				  MPOL_MF_MOVE_DMA|MPOL_MF_MOVE_MT|
+				  MPOL_MF_MOVE_CONCUR|MPOL_MF_MOVE_GROUPED|
+				  MPOL_MF_COPY_POLICY))
+		return -EINVAL;
+
+	if ((flags & MPOL_MF_MOVE_ALL) && !capable(CAP_SYS_NICE))
+		return -EPERM;
+
+	return 0;
+}
+
+/*
+ * The body of move_pages() once the rights on @mm are checked, shared with
+ * the io_uring move_pages op. @drain_all drains the LRU pagevecs of every
+ * CPU before isolating, the op only drains the local ones, so that a batch
+ * of small requests does not pay for lru_add_drain_all() each time.
+ */
+int move_pages_mm(struct mm_struct *mm, nodemask_t task_nodes,
+		  unsigned long nr_pages,
+		  const void __user * __user *pages,
+		  const int __user *nodes,
+		  int __user *status, int flags, bool drain_all)
+{
+	struct page_copy_policy copy_policy;
+	struct migrate_cputime cputime;
+	int err;
+
+	err = move_pages_check_flags(flags);
+	if (err)
+		return err;
+
+	err = page_copy_policy_enter(mm, flags, &copy_policy);
+	if (err)
+		return err;
+	migrate_cputime_begin(&cputime, current);
+
+	if (nodes && (flags & MPOL_MF_MOVE_GROUPED))
+		err = do_pages_move_grouped(mm, task_nodes, nr_pages,
+				pages, nodes, status, flags, drain_all);
+	else if (nodes)
+		err = do_pages_move(mm, task_nodes, nr_pages, pages,
+				    nodes, status, flags, drain_all);
+	else
+		err = do_pages_stat(mm, nr_pages, pages, status);
+	migrate_cputime_end(&cputime);
+	page_copy_policy_exit(&copy_policy);
+
+	return err;
+}
+
 /*
  * Move a list of pages in the address space of the currently executing
  * process.
@@ -2760,14 +4505,9 @@ static int kernel_move_pages(pid_t pid, unsigned long nr_pages,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	/* Check flags */
-	if (flags & ~(MPOL_MF_MOVE|MPOL_MF_MOVE_ALL|
-				  MPOL_MF_MOVE_DMA|MPOL_MF_MOVE_MT|
-				  MPOL_MF_MOVE_CONCUR))
-		return -EINVAL;
-
-	if ((flags & MPOL_MF_MOVE_ALL) && !capable(CAP_SYS_NICE))
-		return -EPERM;
+	err = move_pages_check_flags(flags);
+	if (err)
+		return err;
 
 	/* Find the mm_struct */
 	rcu_read_lock();
@@ -2807,12 +4547,8 @@ static int kernel_move_pages(pid_t pid, unsigned long nr_pages,
 	current->move_pages_breakdown.last_timestamp = timestamp;
 #endif
 
-	if (nodes)
-		err = do_pages_move(mm, task_nodes, nr_pages, pages,
-				    nodes, status, flags);
-	else
-		err = do_pages_stat(mm, nr_pages, pages, status);
-
+	err = move_pages_mm(mm, task_nodes, nr_pages, pages, nodes, status,
+			    flags, true);
 	mmput(mm);
 
 #ifdef CONFIG_PAGE_MIGRATION_PROFILE
@@ -2887,7 +4623,7 @@ static bool migrate_balanced_pgdat(struct pglist_data *pgdat,
 		if (!zone_watermark_ok(zone, 0,
 				       high_wmark_pages(zone) +
 				       nr_migrate_pages,
-				       ZONE_MOVABLE, 0))
+				       ZONE_MOVABLE, ALLOC_HEADROOM))
 			continue;
 		return true;
 	}
@@ -2953,6 +4689,354 @@ bool pmd_trans_migrating(pmd_t pmd)
 	return PageLocked(page);
 }
 
+/*
+ * Batched promotion: with vm.numa_promote_batch_pages set, the pages NUMA
+ * hinting faults find misplaced on a slow tier node are not migrated one
+ * by one in the fault, but queued to the kmigrated thread of their fast
+ * tier target node, which migrates them in batches of that many base
+ * pages with the copy mode of vm.numa_promote_flags: MPOL_MF_MOVE_MT,
+ * MPOL_MF_MOVE_DMA, MPOL_MF_MOVE_CONCUR and the MPOL_MF_COPY_* policy
+ * bits. A batch that does not fill up is migrated
+ * vm.numa_promote_delay_ms after its first page was queued, so that the
+ * faults on the neighbours of a page, which tend to follow within a scan
+ * window, join its batch rather than start the next one. A queued page
+ * skips the watermark check of migrate_balanced_pgdat(): if the target
+ * node is full, the exchange fallback of migrate_pages() swaps it with a
+ * cold page of the node.
+ */
+
+// Base pages per batch of NUMA fault promotions, 0 to migrate in the fault
+int sysctl_numa_promote_batch_pages = 0;
+// MPOL_MF_* copy mode of the NUMA fault promotion batches
+int sysctl_numa_promote_flags = MPOL_MF_MOVE_MT | MPOL_MF_MOVE_CONCUR;
+// Longest a queued promotion waits for its batch to fill up, in ms
+int sysctl_numa_promote_delay_ms = 100;
+
+#define NUMA_PROMOTE_FLAGS	(MPOL_MF_MOVE_MT | MPOL_MF_MOVE_DMA | \
+				 MPOL_MF_MOVE_CONCUR | MPOL_MF_COPY_POLICY)
+
+struct numa_promote_queue {
+	spinlock_t lock;
+	struct list_head pages;
+	unsigned long nr_pages;
+	struct kthread_delayed_work work;
+};
+
+static struct numa_promote_queue numa_promote_queues[MAX_NUMNODES];
+
+static void numa_promote_work_fn(struct kthread_work *work)
+{
+	struct numa_promote_queue *queue = container_of(work,
+			struct numa_promote_queue, work.work);
+	int nid = queue - numa_promote_queues;
+	int flags = READ_ONCE(sysctl_numa_promote_flags) & NUMA_PROMOTE_FLAGS;
+	bool migrate_mt = flags & MPOL_MF_MOVE_MT;
+	bool migrate_dma = flags & MPOL_MF_MOVE_DMA;
+	enum migrate_mode mode = MIGRATE_SYNC |
+		(migrate_mt ? MIGRATE_MT : MIGRATE_SINGLETHREAD) |
+		(migrate_dma ? MIGRATE_DMA : MIGRATE_SINGLETHREAD) |
+		(migrate_mt && migrate_dma ? MIGRATE_HYBRID : MIGRATE_SINGLETHREAD);
+	struct page_copy_policy copy_policy;
+	unsigned long nr_pages, nr_failed = 0;
+	struct page *page, *next;
+	bool policy;
+	LIST_HEAD(pages);
+	LIST_HEAD(deferred);
+
+	spin_lock(&queue->lock);
+	list_splice_init(&queue->pages, &pages);
+	nr_pages = queue->nr_pages;
+	queue->nr_pages = 0;
+	spin_unlock(&queue->lock);
+
+	/* queued before their memcg quiesced its migrations */
+	list_for_each_entry_safe(page, next, &pages, lru)
+		if (mem_cgroup_migrate_quiesced(page)) {
+			nr_pages -= hpage_nr_pages(page);
+			list_move(&page->lru, &deferred);
+		}
+	if (!list_empty(&deferred))
+		putback_movable_pages(&deferred);
+
+	if (list_empty(&pages))
+		return;
+
+	/* the pages of a batch belong to any number of address spaces */
+	policy = !page_copy_policy_enter(NULL, flags, &copy_policy);
+
+	/* the concurrent path leaves what it cannot move to migrate_pages() */
+	if (flags & MPOL_MF_MOVE_CONCUR)
+		migrate_pages_concur(&pages, alloc_new_node_page, NULL, nid,
+				mode | MIGRATE_CONCUR, MR_NUMA_MISPLACED);
+	else
+		migrate_pages(&pages, alloc_new_node_page, NULL, nid, mode,
+				MR_NUMA_MISPLACED);
+
+	if (policy)
+		page_copy_policy_exit(&copy_policy);
+
+	list_for_each_entry(page, &pages, lru)
+		nr_failed += hpage_nr_pages(page);
+	if (!list_empty(&pages))
+		putback_movable_pages(&pages);
+
+	count_vm_numa_events(NUMA_PAGE_MIGRATE, nr_pages - nr_failed);
+}
+
+/*
+ * Promotion prefetch: the hot pages of a slow tier node come in runs, yet
+ * NUMA balancing finds them one hinting fault at a time. With
+ * vm.numa_promote_prefetch_pages set, a base page queued for batched
+ * promotion takes along into the same batch the pages mapped after it in
+ * its vma, up to the end of its page table, that sit alone on its node
+ * and whose mempolicy lets them go where the page goes: like readahead,
+ * for tiering. The window is that many base pages, or with
+ * vm.numa_promote_prefetch_adaptive set adapts per vma: migration maps
+ * the moved pages old, so the young ptes of the range pulled in last that
+ * map pages of the node they went to are its hits, and the next window
+ * doubles if at least half of the pages pulled in were hit and halves
+ * otherwise. The prefetched pages are counted in
+ * the numa_promote_prefetch vm event, the hits in
+ * numa_promote_prefetch_hit.
+ */
+
+// Base pages at most a batched promotion pulls in after its page, 0 for none
+int sysctl_numa_promote_prefetch_pages = 0;
+// Adapt the prefetch window of each vma to the hits of its last window
+int sysctl_numa_promote_prefetch_adaptive = 1;
+
+struct numa_promote_prefetch {
+	struct list_head pages;
+	unsigned long nr_pages;	/* base pages isolated */
+	unsigned long nr_young;	/* young ptes of pages on @nid seen */
+	int nid;		/* node the pages are taken from, or went to */
+	int target;		/* node the pages go to */
+	bool take;		/* isolate the pages, or count the young */
+};
+
+static void numa_promote_prefetch_take(struct vm_area_struct *vma,
+		unsigned long addr, pte_t *pte, struct numa_promote_prefetch *pp)
+{
+	struct page *page = vm_normal_page(vma, addr, *pte);
+
+	if (!page || PageCompound(page) || page_to_nid(page) != pp->nid ||
+	    page_mapcount(page) != 1)
+		return;
+	if (page_is_file_cache(page) && PageDirty(page))
+		return;
+	if (!mpol_node_allowed(vma, addr, pp->target))
+		return;
+	if (page_migrate_suppress(page) || isolate_lru_page(page))
+		return;
+
+	/* an access from now on is a hit, see numa_promote_prefetch() */
+	ptep_test_and_clear_young(vma, addr, pte);
+	mod_node_page_state(page_pgdat(page),
+			NR_ISOLATED_ANON + page_is_file_cache(page), 1);
+	list_add_tail(&page->lru, &pp->pages);
+	pp->nr_pages++;
+}
+
+static int numa_promote_prefetch_pte_range(pmd_t *pmd, unsigned long addr,
+		unsigned long end, struct mm_walk *walk)
+{
+	struct numa_promote_prefetch *pp = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *orig_pte, *pte;
+	struct page *page;
+	spinlock_t *ptl;
+
+	/* a huge page got mapped meanwhile, it promotes on its own */
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr < end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+		if (pp->take) {
+			numa_promote_prefetch_take(vma, addr, pte, pp);
+			continue;
+		}
+		/* the pages left behind keep young bits of their own */
+		if (!pte_young(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (page && page_to_nid(page) == pp->nid)
+			pp->nr_young++;
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+
+	return 0;
+}
+
+static const struct mm_walk_ops numa_promote_prefetch_walk_ops = {
+	.pmd_entry	= numa_promote_prefetch_pte_range,
+};
+
+/*
+ * The window of the next prefetch in @vma, @max base pages at most: grown
+ * or shrunk by the hits of the last prefetch in it if it adapts.
+ */
+static unsigned long numa_promote_prefetch_window(struct vm_area_struct *vma,
+		unsigned long max)
+{
+	struct numa_promote_prefetch pp = {
+		.nid = READ_ONCE(vma->promote_prefetch_nid),
+		.take = false,
+	};
+	unsigned long start = READ_ONCE(vma->promote_prefetch_start);
+	unsigned long end = READ_ONCE(vma->promote_prefetch_end);
+	unsigned long window = READ_ONCE(vma->promote_prefetch_window);
+	unsigned long nr = READ_ONCE(vma->promote_prefetch_nr);
+
+	if (!READ_ONCE(sysctl_numa_promote_prefetch_adaptive))
+		return max;
+
+	/* start from a quarter of the largest window */
+	if (!window)
+		window = max / 4;
+	if (nr && start < end && start >= vma->vm_start &&
+	    end <= vma->vm_end) {
+		walk_page_range(vma->vm_mm, start, end,
+				&numa_promote_prefetch_walk_ops, &pp);
+		/* pages already on the node may be young too */
+		pp.nr_young = min(pp.nr_young, nr);
+		count_vm_numa_events(NUMA_PROMOTE_PREFETCH_HIT, pp.nr_young);
+		if (pp.nr_young * 2 >= nr)
+			window *= 2;
+		else
+			window /= 2;
+	}
+
+	return clamp(window, 1UL, max);
+}
+
+/*
+ * Isolate into @pages the pages to promote to @node along with @page,
+ * which is mapped in @vma, up to @room base pages. Returns how many it
+ * isolated.
+ */
+static unsigned long numa_promote_prefetch(struct page *page,
+		struct vm_area_struct *vma, int node, long room,
+		struct list_head *pages)
+{
+	unsigned long max = READ_ONCE(sysctl_numa_promote_prefetch_pages);
+	struct numa_promote_prefetch pp = {
+		.pages = LIST_HEAD_INIT(pp.pages),
+		.nid = page_to_nid(page),
+		.target = node,
+		.take = true,
+	};
+	unsigned long addr, start, end, window;
+
+	if (!max || room <= 0 || PageTransHuge(page))
+		return 0;
+	addr = page_address_in_vma(page, vma);
+	if (addr == -EFAULT)
+		return 0;
+
+	window = numa_promote_prefetch_window(vma, max);
+	WRITE_ONCE(vma->promote_prefetch_window, window);
+	window = min_t(unsigned long, window, room);
+
+	start = addr + PAGE_SIZE;
+	end = pmd_addr_end(addr, vma->vm_end);
+	if (start < end && end - start > window << PAGE_SHIFT)
+		end = start + (window << PAGE_SHIFT);
+
+	if (start < end)
+		walk_page_range(vma->vm_mm, start, end,
+				&numa_promote_prefetch_walk_ops, &pp);
+	WRITE_ONCE(vma->promote_prefetch_start, start);
+	WRITE_ONCE(vma->promote_prefetch_end, end);
+	WRITE_ONCE(vma->promote_prefetch_nr, pp.nr_pages);
+	WRITE_ONCE(vma->promote_prefetch_nid, node);
+
+	if (!pp.nr_pages)
+		return 0;
+	list_splice_tail(&pp.pages, pages);
+	count_vm_numa_events(NUMA_PROMOTE_PREFETCH, pp.nr_pages);
+
+	return pp.nr_pages;
+}
+
+/* Is the NUMA fault promotion of @page to @node batched? */
+static bool numa_promote_batched(struct page *page, int node)
+{
+	return READ_ONCE(sysctl_numa_promote_batch_pages) > 0 &&
+		node_is_slow_tier(page_to_nid(page)) &&
+		!node_is_slow_tier(node);
+}
+
+/*
+ * Isolate @page and queue it for promotion to @node, along with the pages
+ * prefetched after it in @vma if @vma is given. Returns 1 if the page was
+ * queued, the caller's reference is left to the caller.
+ */
+static int numa_promote_queue(struct page *page, struct vm_area_struct *vma,
+		int node)
+{
+	struct numa_promote_queue *queue = &numa_promote_queues[node];
+	int batch = READ_ONCE(sysctl_numa_promote_batch_pages);
+	struct kthread_worker *worker;
+	unsigned long nr_pages, delay;
+	long room;
+	LIST_HEAD(pages);
+
+	/* kmigrated is behind, let the next fault retry */
+	if (READ_ONCE(queue->nr_pages) >= 2 * batch)
+		return 0;
+
+	worker = kmigrated_worker(node);
+	if (!worker)
+		return 0;
+
+	if (isolate_lru_page(page))
+		return 0;
+
+	mod_node_page_state(page_pgdat(page),
+			NR_ISOLATED_ANON + page_is_file_cache(page),
+			hpage_nr_pages(page));
+	list_add_tail(&page->lru, &pages);
+	nr_pages = hpage_nr_pages(page);
+	if (vma) {
+		room = 2L * batch - (long)READ_ONCE(queue->nr_pages) - nr_pages;
+		nr_pages += numa_promote_prefetch(page, vma, node, room,
+						  &pages);
+	}
+
+	spin_lock(&queue->lock);
+	list_splice_tail(&pages, &queue->pages);
+	queue->nr_pages += nr_pages;
+	nr_pages = queue->nr_pages;
+	spin_unlock(&queue->lock);
+
+	delay = msecs_to_jiffies(READ_ONCE(sysctl_numa_promote_delay_ms));
+	if (nr_pages >= batch)
+		kthread_mod_delayed_work(worker, &queue->work, 0);
+	else
+		kthread_queue_delayed_work(worker, &queue->work, delay);
+
+	return 1;
+}
+
+static int __init numa_promote_init(void)
+{
+	struct numa_promote_queue *queue;
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		queue = &numa_promote_queues[nid];
+		spin_lock_init(&queue->lock);
+		INIT_LIST_HEAD(&queue->pages);
+		kthread_init_delayed_work(&queue->work, numa_promote_work_fn);
+	}
+
+	return 0;
+}
+core_initcall(numa_promote_init);
+
 /*
  * Attempt to migrate a misplaced page to the specified destination
  * node. Caller is expected to have an elevated reference count on
@@ -2981,6 +5065,18 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 	if (page_is_file_cache(page) && PageDirty(page))
 		goto out;
 
+	if (page_migrate_suppress(page) || mem_cgroup_migrate_quiesced(page))
+		goto out;
+	if (node_is_slow_tier(node) && !node_is_slow_tier(page_to_nid(page)) &&
+	    mem_cgroup_demotion_protected(page, true))
+		goto out;
+
+	if (numa_promote_batched(page, node)) {
+		isolated = numa_promote_queue(page, vma, node);
+		put_page(page);
+		return isolated;
+	}
+
 	isolated = numamigrate_isolate_page(pgdat, page);
 	if (!isolated)
 		goto out;
@@ -3009,6 +5105,23 @@ int migrate_misplaced_page(struct page *page, struct vm_area_struct *vma,
 #endif /* CONFIG_NUMA_BALANCING */
 
 #if defined(CONFIG_NUMA_BALANCING) && defined(CONFIG_TRANSPARENT_HUGEPAGE)
+/* Give back the access rights the NUMA hinting fault on @pmd took away */
+static void migrate_misplaced_pmd_restore(struct mm_struct *mm,
+		struct vm_area_struct *vma, pmd_t *pmd, pmd_t entry,
+		unsigned long address)
+{
+	unsigned long start = address & HPAGE_PMD_MASK;
+	spinlock_t *ptl;
+
+	ptl = pmd_lock(mm, pmd);
+	if (pmd_same(*pmd, entry)) {
+		entry = pmd_modify(entry, vma->vm_page_prot);
+		set_pmd_at(mm, start, pmd, entry);
+		update_mmu_cache_pmd(vma, address, &entry);
+	}
+	spin_unlock(ptl);
+}
+
 /*
  * Migrates a THP to a given target node. page must be locked and is unlocked
  * before returning.
@@ -3026,6 +5139,23 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 	int page_lru = page_is_file_cache(page);
 	unsigned long start = address & HPAGE_PMD_MASK;
 
+	if (page_migrate_suppress(page) || mem_cgroup_migrate_quiesced(page) ||
+	    !thp_node_target_allowed(node))
+		goto out_fail;
+	if (node_is_slow_tier(node) && !node_is_slow_tier(page_to_nid(page)) &&
+	    mem_cgroup_demotion_protected(page, true))
+		goto out_fail;
+
+	/* the THP moves with the batch, the task need not wait for it */
+	if (numa_promote_batched(page, node)) {
+		if (!numa_promote_queue(page, NULL, node))
+			goto out_fail;
+		migrate_misplaced_pmd_restore(mm, vma, pmd, entry, address);
+		unlock_page(page);
+		put_page(page);
+		return 1;
+	}
+
 	new_page = alloc_pages_node(node,
 		(GFP_TRANSHUGE_LIGHT | __GFP_THISNODE),
 		HPAGE_PMD_ORDER);
@@ -3127,13 +5257,7 @@ int migrate_misplaced_transhuge_page(struct mm_struct *mm,
 
 out_fail:
 	count_vm_events(PGMIGRATE_FAIL, HPAGE_PMD_NR);
-	ptl = pmd_lock(mm, pmd);
-	if (pmd_same(*pmd, entry)) {
-		entry = pmd_modify(entry, vma->vm_page_prot);
-		set_pmd_at(mm, start, pmd, entry);
-		update_mmu_cache_pmd(vma, address, &entry);
-	}
-	spin_unlock(ptl);
+	migrate_misplaced_pmd_restore(mm, vma, pmd, entry, address);
 
 out_unlock:
 	unlock_page(page);
@@ -0,0 +1,381 @@
+/*
+ * Closed loop migration bandwidth limits.
+ *
+ * A static vm.migrate_rate_limit is too slow on an idle machine and too
+ * fast at peak. With vm.migrate_bandwidth_headroom set to a percentage of
+ * the bandwidth of a node, the migrations charged by migrate_rate_charge()
+ * and the demotions of reclaim are also charged to a token bucket of their
+ * source and of their destination node, whose rate follows what the other
+ * users of the node leave: every MIGRATE_BANDWIDTH_PERIOD_MS the traffic
+ * of each node is read from its memory controller counters, and the rate
+ * of its bucket is halved when less than the headroom was left, raised by
+ * a sixteenth of the bandwidth of the node otherwise, and never set above
+ * what the foreground traffic leaves below the headroom nor under a
+ * sixty-fourth of the bandwidth, so that the migrations never stall. The
+ * MIGRATE_ASYNC promotions of kmigrated and demotions of kswapd sleep off
+ * their debt like the blocking migrations, see migrate_rate_throttle().
+ *
+ * The kernel does not know which uncore PMU events count the traffic of a
+ * node, so they are given in /sys/kernel/mm/migrate_bandwidth/nodes: each
+ * "node event type config [bytes]" write adds a counter, of the perf type
+ * and config of e.g. the CAS count event of an IMC of the socket, each
+ * count standing for @bytes bytes, 64 by default. The counters of a node
+ * add up. The bandwidth of a node is the one "node peak bytes" sets, else
+ * the one of the memory tier of the node, else the highest traffic seen.
+ * The traffic of the migrations themselves is counted as they are charged
+ * and taken out of the traffic measured. Nodes without counters are not
+ * limited.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/nodemask.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/perf_event.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/memory_tier.h>
+#include <linux/migrate.h>
+#include <linux/migrate_rate.h>
+
+#include "internal.h"
+
+// Percent of the bandwidth of a node migrations leave to its other users, 0 for no feedback
+int sysctl_migrate_bandwidth_headroom = 0;
+
+#define MIGRATE_BANDWIDTH_PERIOD_MS	100
+/* counters per node, one per memory controller channel */
+#define MIGRATE_BANDWIDTH_EVENTS	8
+/* the rate goes up by peak >> INC_SHIFT and stays above peak >> MIN_SHIFT */
+#define MIGRATE_BANDWIDTH_INC_SHIFT	4
+#define MIGRATE_BANDWIDTH_MIN_SHIFT	6
+
+struct migrate_bandwidth_node {
+	struct perf_event *events[MIGRATE_BANDWIDTH_EVENTS];
+	unsigned int bytes_per_count[MIGRATE_BANDWIDTH_EVENTS];
+	int nr_events;
+	u64 last_bytes;
+	atomic64_t migrated;	/* bytes migrated from and to the node */
+	u64 last_migrated;
+	u64 peak;		/* bytes/s, 0 for the memory tier's */
+	u64 max_seen;
+	/* bytes/s over the last period, and the rate migrations get */
+	u64 used;
+	u64 migration;
+	u64 rate;
+	struct migrate_rate_bucket bucket;
+};
+
+static struct migrate_bandwidth_node migrate_bandwidth_nodes[MAX_NUMNODES];
+/* serializes the counter updates with the sampling */
+static DEFINE_MUTEX(migrate_bandwidth_mutex);
+static u64 migrate_bandwidth_last_ns;
+
+static void migrate_bandwidth_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(migrate_bandwidth_work, migrate_bandwidth_work_fn);
+
+/* Bytes/s the traffic of @node is measured against */
+static u64 migrate_bandwidth_peak(struct migrate_bandwidth_node *node, int nid)
+{
+	u64 peak = READ_ONCE(node->peak);
+
+	if (!peak)
+		peak = (u64)memory_tier_bandwidth(nid) << 20;
+	if (!peak)
+		peak = node->max_seen;
+
+	return peak;
+}
+
+#ifdef CONFIG_PERF_EVENTS
+static u64 migrate_bandwidth_read_event(struct perf_event *event,
+		unsigned int bytes_per_count)
+{
+	u64 enabled, running;
+
+	return perf_event_read_value(event, &enabled, &running) *
+		bytes_per_count;
+}
+#else
+static u64 migrate_bandwidth_read_event(struct perf_event *event,
+		unsigned int bytes_per_count)
+{
+	return 0;
+}
+#endif
+
+/* Bytes counted by the counters of @node since they were added */
+static u64 migrate_bandwidth_read(struct migrate_bandwidth_node *node)
+{
+	u64 bytes = 0;
+	int i;
+
+	for (i = 0; i < node->nr_events; i++)
+		bytes += migrate_bandwidth_read_event(node->events[i],
+				node->bytes_per_count[i]);
+
+	return bytes;
+}
+
+/* Set the migration rate of @node from its traffic over @elapsed ns */
+static void migrate_bandwidth_update(struct migrate_bandwidth_node *node,
+		int nid, u64 elapsed)
+{
+	int headroom = READ_ONCE(sysctl_migrate_bandwidth_headroom);
+	u64 bytes, migrated, used, migration, peak, target, avail, rate;
+	/* in microseconds, a period of bytes times NSEC_PER_SEC overflows */
+	u64 elapsed_us = max_t(u64, div_u64(elapsed, NSEC_PER_USEC), 1);
+
+	bytes = migrate_bandwidth_read(node);
+	migrated = atomic64_read(&node->migrated);
+	used = div64_u64((bytes - node->last_bytes) * USEC_PER_SEC, elapsed_us);
+	migration = div64_u64((migrated - node->last_migrated) * USEC_PER_SEC,
+			      elapsed_us);
+	node->last_bytes = bytes;
+	node->last_migrated = migrated;
+	node->max_seen = max(node->max_seen, used);
+	WRITE_ONCE(node->used, used);
+	WRITE_ONCE(node->migration, migration);
+
+	peak = migrate_bandwidth_peak(node, nid);
+	if (!headroom || !peak) {
+		WRITE_ONCE(node->rate, 0);
+		return;
+	}
+
+	target = div_u64(peak * (100 - headroom), 100);
+	/* what the other users of the node leave below the headroom */
+	avail = target - min(target, used - min(used, migration));
+
+	rate = node->rate ? node->rate : avail;
+	if (used > target)
+		rate >>= 1;
+	else
+		rate += peak >> MIGRATE_BANDWIDTH_INC_SHIFT;
+	rate = clamp(rate, peak >> MIGRATE_BANDWIDTH_MIN_SHIFT,
+		     max(avail, peak >> MIGRATE_BANDWIDTH_MIN_SHIFT));
+	WRITE_ONCE(node->rate, rate);
+}
+
+static void migrate_bandwidth_work_fn(struct work_struct *work)
+{
+	struct migrate_bandwidth_node *node;
+	u64 now = ktime_get_ns();
+	u64 elapsed = now - migrate_bandwidth_last_ns;
+	bool active = false;
+	int nid;
+
+	mutex_lock(&migrate_bandwidth_mutex);
+	for_each_node_state(nid, N_MEMORY) {
+		node = &migrate_bandwidth_nodes[nid];
+		if (!node->nr_events)
+			continue;
+		migrate_bandwidth_update(node, nid, max_t(u64, elapsed, 1));
+		active = true;
+	}
+	migrate_bandwidth_last_ns = now;
+	mutex_unlock(&migrate_bandwidth_mutex);
+
+	if (active)
+		schedule_delayed_work(&migrate_bandwidth_work,
+			msecs_to_jiffies(MIGRATE_BANDWIDTH_PERIOD_MS));
+}
+
+/*
+ * Charge @bytes migrated from @src_nid to @dst_nid to the buckets of both
+ * nodes. Returns how many nanoseconds it takes to repay the debt.
+ */
+u64 migrate_bandwidth_charge(int src_nid, int dst_nid, u64 bytes)
+{
+	struct migrate_bandwidth_node *src = &migrate_bandwidth_nodes[src_nid];
+	struct migrate_bandwidth_node *dst = &migrate_bandwidth_nodes[dst_nid];
+	u64 wait;
+
+	atomic64_add(bytes, &src->migrated);
+	atomic64_add(bytes, &dst->migrated);
+
+	if (!READ_ONCE(sysctl_migrate_bandwidth_headroom))
+		return 0;
+
+	wait = migrate_rate_bucket_charge(&src->bucket, READ_ONCE(src->rate),
+			bytes);
+	return max(wait, migrate_rate_bucket_charge(&dst->bucket,
+			READ_ONCE(dst->rate), bytes));
+}
+
+#ifdef CONFIG_PERF_EVENTS
+static int migrate_bandwidth_add_event(int nid, u32 type, u64 config,
+		unsigned int bytes_per_count)
+{
+	struct migrate_bandwidth_node *node = &migrate_bandwidth_nodes[nid];
+	struct perf_event_attr attr = {
+		.type		= type,
+		.size		= sizeof(attr),
+		.config		= config,
+		.pinned		= 1,
+	};
+	struct perf_event *event;
+	int cpu, err = 0;
+
+	/*
+	 * Uncore events count for the whole socket of the CPU, the nearest
+	 * one for a CPU-less PMEM node.
+	 */
+	cpu = cpumask_first_and(cpumask_of_node(nid), cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = get_nearest_cpu_node(nid);
+	if (cpu < 0 || cpu >= nr_cpu_ids)
+		return -ENODEV;
+
+	mutex_lock(&migrate_bandwidth_mutex);
+	if (node->nr_events == MIGRATE_BANDWIDTH_EVENTS) {
+		err = -ENOSPC;
+		goto unlock;
+	}
+
+	event = perf_event_create_kernel_counter(&attr, cpu, NULL, NULL, NULL);
+	if (IS_ERR(event)) {
+		err = PTR_ERR(event);
+		goto unlock;
+	}
+
+	/* the traffic counted so far is not the next period's */
+	node->last_bytes += migrate_bandwidth_read_event(event,
+			bytes_per_count);
+	node->events[node->nr_events] = event;
+	node->bytes_per_count[node->nr_events++] = bytes_per_count;
+	if (!migrate_bandwidth_last_ns)
+		migrate_bandwidth_last_ns = ktime_get_ns();
+unlock:
+	mutex_unlock(&migrate_bandwidth_mutex);
+
+	if (!err)
+		schedule_delayed_work(&migrate_bandwidth_work,
+			msecs_to_jiffies(MIGRATE_BANDWIDTH_PERIOD_MS));
+
+	return err;
+}
+
+static void migrate_bandwidth_clear(int nid)
+{
+	struct migrate_bandwidth_node *node = &migrate_bandwidth_nodes[nid];
+	int i;
+
+	mutex_lock(&migrate_bandwidth_mutex);
+	for (i = 0; i < node->nr_events; i++)
+		perf_event_release_kernel(node->events[i]);
+	node->nr_events = 0;
+	node->last_bytes = 0;
+	node->max_seen = 0;
+	WRITE_ONCE(node->used, 0);
+	WRITE_ONCE(node->rate, 0);
+	mutex_unlock(&migrate_bandwidth_mutex);
+}
+#else
+static int migrate_bandwidth_add_event(int nid, u32 type, u64 config,
+		unsigned int bytes_per_count)
+{
+	return -EOPNOTSUPP;
+}
+
+static void migrate_bandwidth_clear(int nid)
+{
+}
+#endif
+
+/*
+ * /sys/kernel/mm/migrate_bandwidth/nodes: one "node events peak used
+ * migration rate throttled" line per memory node, in bytes per second, a
+ * rate of 0 for no limit. Writing "node event type config [bytes]" adds a
+ * counter to a node, "node peak bytes" sets its bandwidth, 0 for the
+ * default, and "node clear" removes its counters.
+ */
+static ssize_t nodes_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct migrate_bandwidth_node *node;
+	ssize_t len = 0;
+	int nid;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			"node events peak used migration rate throttled\n");
+
+	for_each_node_state(nid, N_MEMORY) {
+		node = &migrate_bandwidth_nodes[nid];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"%d %d %llu %llu %llu %llu %lu\n", nid,
+				READ_ONCE(node->nr_events),
+				migrate_bandwidth_peak(node, nid),
+				READ_ONCE(node->used),
+				READ_ONCE(node->migration),
+				READ_ONCE(node->rate),
+				READ_ONCE(node->bucket.nr_throttled));
+	}
+
+	return len;
+}
+
+static ssize_t nodes_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	unsigned int bytes_per_count = 64;
+	char cmd[8];
+	u64 config;
+	u32 type;
+	int nid, n, err;
+
+	if (sscanf(buf, "%d %7s", &nid, cmd) != 2)
+		return -EINVAL;
+	if (nid < 0 || nid >= MAX_NUMNODES || !node_state(nid, N_MEMORY))
+		return -EINVAL;
+
+	if (!strcmp(cmd, "event")) {
+		n = sscanf(buf, "%*d %*s %u %llx %u", &type, &config,
+			   &bytes_per_count);
+		if (n < 2 || !bytes_per_count)
+			return -EINVAL;
+		err = migrate_bandwidth_add_event(nid, type, config,
+				bytes_per_count);
+		if (err)
+			return err;
+	} else if (!strcmp(cmd, "peak")) {
+		if (sscanf(buf, "%*d %*s %llu", &config) != 1)
+			return -EINVAL;
+		WRITE_ONCE(migrate_bandwidth_nodes[nid].peak, config);
+	} else if (!strcmp(cmd, "clear")) {
+		migrate_bandwidth_clear(nid);
+	} else {
+		return -EINVAL;
+	}
+
+	return count;
+}
+static struct kobj_attribute nodes_attr = __ATTR_RW(nodes);
+
+static struct attribute *migrate_bandwidth_attrs[] = {
+	&nodes_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group migrate_bandwidth_attr_group = {
+	.attrs = migrate_bandwidth_attrs,
+};
+
+static int __init migrate_bandwidth_init(void)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		atomic64_set(&migrate_bandwidth_nodes[nid].migrated, 0);
+		migrate_rate_bucket_init(&migrate_bandwidth_nodes[nid].bucket);
+	}
+
+	mm_sysfs_add_group("migrate_bandwidth", &migrate_bandwidth_attr_group);
+
+	return 0;
+}
+subsys_initcall(migrate_bandwidth_init);
@@ -0,0 +1,585 @@
+/*
+ * Page migration benchmark.
+ *
+ * /sys/kernel/debug/migrate_benchmark times one copy engine in one
+ * configuration per MIGRATE_BENCHMARK ioctl, so that the copy and
+ * exchange paths can be measured without the Nimble user space suite or
+ * a CONFIG_PAGE_MIGRATION_PROFILE kernel. The caller sweeps the matrix of
+ * engines, thread counts, NT and RPDAA modes, page orders and batch sizes
+ * one ioctl at a time.
+ *
+ * The copy and exchange engines run over nr_pages pages of the given
+ * order allocated on src_nid and dst_nid, nr_runs times. The concurrent
+ * migration runs over the pages of the caller mapped at [addr, addr +
+ * size), moving them to dst_nid and back to src_nid on every other run.
+ * The replay engine re-executes the migration and exchange batches of a
+ * vm.migrate_record trace at [addr, addr + size) merged by time, each on
+ * fresh pages of the recorded order on the recorded nodes, or on src_nid
+ * and dst_nid for nodes this machine does not have. The batches run back
+ * to back, the gaps between them in the trace are not reproduced.
+ *
+ * Reported are the bytes moved, the total time and throughput, and the
+ * percentiles of the per-page latency: of each page for the single page
+ * engines, of the average page of each run for the list engines and of
+ * each batch for the replay.
+ *
+ * See tools/testing/selftests/vm/migrate_benchmark.c
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/sort.h>
+#include <linux/highmem.h>
+#include <linux/huge_mm.h>
+#include <linux/swap.h>
+#include <linux/mm_inline.h>
+#include <linux/sched/signal.h>
+#include <linux/migrate.h>
+#include <linux/debugfs.h>
+#include <linux/migrate_record.h>
+
+#include "internal.h"
+
+#define MIGRATE_BENCHMARK	_IOWR('m', 1, struct migrate_benchmark)
+
+enum {
+	MIGRATE_BENCH_COPY_MT,		/* copy_page_multithread() */
+	MIGRATE_BENCH_COPY_LISTS_MT,	/* copy_page_lists_mt() */
+	MIGRATE_BENCH_COPY_DMA,		/* copy_page_dma() */
+	MIGRATE_BENCH_EXCHANGE_LISTS_MT,	/* exchange_page_lists_mthread() */
+	MIGRATE_BENCH_MIGRATE_CONCUR,	/* migrate_pages_concur() */
+	MIGRATE_BENCH_REPLAY,		/* struct migrate_record trace */
+	NR_MIGRATE_BENCH_ENGINES,
+};
+
+/* flags of the concurrent migration, DMA also of the replay */
+#define MIGRATE_BENCH_MT	0x1
+#define MIGRATE_BENCH_DMA	0x2
+
+struct migrate_benchmark {
+	__u32 engine;
+	__u32 src_nid;
+	__u32 dst_nid;
+	__u32 order;
+	__u32 nr_pages;		/* pages of @order per run, the batch size */
+	__u32 nr_runs;
+	__s32 nr_threads;	/* copy threads, -1 for vm.limit_mt_num */
+	__s32 nt;		/* non-temporal copies: 0, 1, -1 for the sysctl */
+	__s32 rpdaa;		/* copies on the PMEM socket: 0, 1, -1 for the sysctl */
+	__u32 flags;
+	__u64 addr;		/* MIGRATE_CONCUR: pages, REPLAY: records of the caller */
+	__u64 size;
+	/* results */
+	__u64 bytes;
+	__u64 delta_nsec;
+	__u64 mbps;
+	__u64 lat_p50_nsec;
+	__u64 lat_p90_nsec;
+	__u64 lat_p99_nsec;
+	__u64 lat_max_nsec;
+	__u64 expansion[8];	/* For future use */
+};
+
+/* latency samples of one ioctl */
+#define MIGRATE_BENCH_MAX_SAMPLES	(1 << 20)
+
+struct migrate_bench_samples {
+	u64 *ns;
+	unsigned int nr;
+	unsigned int max;
+};
+
+static void migrate_bench_sample(struct migrate_bench_samples *samples,
+		u64 ns)
+{
+	if (samples->nr < samples->max)
+		samples->ns[samples->nr++] = ns;
+}
+
+static int migrate_bench_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void migrate_bench_report(struct migrate_benchmark *mb,
+		struct migrate_bench_samples *samples)
+{
+	unsigned int nr = samples->nr;
+
+	mb->mbps = mb->delta_nsec ?
+		div64_u64(mb->bytes * NSEC_PER_USEC, mb->delta_nsec) : 0;
+	if (!nr)
+		return;
+
+	sort(samples->ns, nr, sizeof(u64), migrate_bench_cmp, NULL);
+	mb->lat_p50_nsec = samples->ns[nr * 50 / 100];
+	mb->lat_p90_nsec = samples->ns[nr * 90 / 100];
+	mb->lat_p99_nsec = samples->ns[nr * 99 / 100];
+	mb->lat_max_nsec = samples->ns[nr - 1];
+}
+
+static void migrate_bench_free(struct page **pages, int nr, int order)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (pages[i])
+			__free_pages(pages[i], order);
+}
+
+static int migrate_bench_alloc(struct page **pages, int nr, int nid,
+		int order)
+{
+	gfp_t gfp = GFP_HIGHUSER_MOVABLE | __GFP_THISNODE | __GFP_NOWARN |
+		__GFP_NORETRY | (order ? __GFP_COMP : 0);
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		pages[i] = alloc_pages_node(nid, gfp, order);
+		if (!pages[i]) {
+			migrate_bench_free(pages, i, order);
+			return -ENOMEM;
+		}
+		if (order)
+			prep_transhuge_page(pages[i]);
+	}
+
+	return 0;
+}
+
+static int migrate_bench_run(struct migrate_benchmark *mb,
+		struct page **to, struct page **from,
+		struct migrate_bench_samples *samples)
+{
+	int nr_base = 1 << mb->order;
+	u64 start, ns;
+	int i, err;
+
+	switch (mb->engine) {
+	case MIGRATE_BENCH_COPY_MT:
+	case MIGRATE_BENCH_COPY_DMA:
+		for (i = 0; i < mb->nr_pages; i++) {
+			start = ktime_get_ns();
+			if (mb->engine == MIGRATE_BENCH_COPY_MT)
+				err = copy_page_multithread(to[i], from[i],
+						nr_base);
+			else
+				err = copy_page_dma(to[i], from[i], nr_base);
+			if (err)
+				return err;
+			ns = ktime_get_ns() - start;
+			mb->delta_nsec += ns;
+			migrate_bench_sample(samples, ns);
+		}
+		return 0;
+	case MIGRATE_BENCH_COPY_LISTS_MT:
+	case MIGRATE_BENCH_EXCHANGE_LISTS_MT:
+		start = ktime_get_ns();
+		if (mb->engine == MIGRATE_BENCH_COPY_LISTS_MT)
+			err = copy_page_lists_mt(to, from, mb->nr_pages);
+		else
+			err = exchange_page_lists_mthread(to, from,
+					mb->nr_pages);
+		if (err)
+			return err;
+		ns = ktime_get_ns() - start;
+		mb->delta_nsec += ns;
+		migrate_bench_sample(samples, div_u64(ns, mb->nr_pages));
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static int migrate_bench_pages(struct migrate_benchmark *mb,
+		struct migrate_bench_samples *samples)
+{
+	struct page **from, **to;
+	int run, err;
+
+	if (!mb->nr_pages)
+		return -EINVAL;
+	/* base pages or THP */
+	if (mb->order && (!IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE) ||
+			  mb->order != HPAGE_PMD_ORDER))
+		return -EINVAL;
+
+	from = kvcalloc(mb->nr_pages, sizeof(*from), GFP_KERNEL);
+	to = kvcalloc(mb->nr_pages, sizeof(*to), GFP_KERNEL);
+	err = -ENOMEM;
+	if (!from || !to)
+		goto out;
+
+	err = migrate_bench_alloc(from, mb->nr_pages, mb->src_nid, mb->order);
+	if (err)
+		goto out;
+	err = migrate_bench_alloc(to, mb->nr_pages, mb->dst_nid, mb->order);
+	if (err)
+		goto out_from;
+
+	for (run = 0; run < mb->nr_runs; run++) {
+		err = migrate_bench_run(mb, to, from, samples);
+		if (err)
+			break;
+		mb->bytes += ((u64)mb->nr_pages << mb->order) * PAGE_SIZE;
+		/* an exchange moves both pages */
+		if (mb->engine == MIGRATE_BENCH_EXCHANGE_LISTS_MT)
+			mb->bytes += ((u64)mb->nr_pages << mb->order) * PAGE_SIZE;
+		cond_resched();
+		if (fatal_signal_pending(current)) {
+			err = -EINTR;
+			break;
+		}
+	}
+
+	migrate_bench_free(to, mb->nr_pages, mb->order);
+out_from:
+	migrate_bench_free(from, mb->nr_pages, mb->order);
+out:
+	kvfree(to);
+	kvfree(from);
+	return err;
+}
+
+/* Isolate the pages of the caller in [@addr, @addr + @size) */
+static int migrate_bench_isolate(unsigned long addr, unsigned long size,
+		struct list_head *pagelist)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned long end = addr + size;
+	struct page *page, *head;
+	int nr = 0;
+
+	down_read(&mm->mmap_sem);
+	for (; addr < end; addr += PAGE_SIZE) {
+		vma = find_vma(mm, addr);
+		if (!vma || addr < vma->vm_start || !vma_migratable(vma))
+			continue;
+
+		page = follow_page(vma, addr, FOLL_GET | FOLL_DUMP);
+		if (IS_ERR_OR_NULL(page))
+			continue;
+
+		head = compound_head(page);
+		if (!PageHuge(head) && !isolate_lru_page(head)) {
+			list_add_tail(&head->lru, pagelist);
+			mod_node_page_state(page_pgdat(head),
+				NR_ISOLATED_ANON + page_is_file_cache(head),
+				hpage_nr_pages(head));
+			nr += hpage_nr_pages(head);
+		}
+		put_page(page);
+	}
+	up_read(&mm->mmap_sem);
+
+	return nr;
+}
+
+static int migrate_bench_concur(struct migrate_benchmark *mb,
+		struct migrate_bench_samples *samples)
+{
+	enum migrate_mode mode = MIGRATE_SYNC | MIGRATE_CONCUR;
+	LIST_HEAD(pagelist);
+	struct page *page;
+	int run, nr, nid, err = 0;
+	u64 start, ns;
+
+	if (!mb->size || mb->addr + mb->size < mb->addr)
+		return -EINVAL;
+
+	if (mb->flags & MIGRATE_BENCH_MT)
+		mode |= MIGRATE_MT;
+	if (mb->flags & MIGRATE_BENCH_DMA)
+		mode |= MIGRATE_DMA;
+	if ((mb->flags & MIGRATE_BENCH_MT) && (mb->flags & MIGRATE_BENCH_DMA))
+		mode |= MIGRATE_HYBRID;
+
+	for (run = 0; run < mb->nr_runs; run++) {
+		nid = run & 1 ? mb->src_nid : mb->dst_nid;
+
+		migrate_prep();
+		nr = migrate_bench_isolate(untagged_addr(mb->addr), mb->size,
+				&pagelist);
+		if (!nr)
+			return -ENOENT;
+
+		start = ktime_get_ns();
+		err = migrate_pages_concur(&pagelist, alloc_new_node_page,
+				NULL, nid, mode, MR_SYSCALL);
+		ns = ktime_get_ns() - start;
+		if (err) {
+			/* pages that failed to migrate are only not counted */
+			list_for_each_entry(page, &pagelist, lru)
+				nr -= hpage_nr_pages(page);
+			putback_movable_pages(&pagelist);
+			if (err < 0)
+				return err;
+			err = 0;
+		}
+		if (nr <= 0)
+			continue;
+
+		mb->delta_nsec += ns;
+		mb->bytes += (u64)nr * PAGE_SIZE;
+		migrate_bench_sample(samples, div_u64(ns, nr));
+		cond_resched();
+		if (fatal_signal_pending(current))
+			return -EINTR;
+	}
+
+	return err;
+}
+
+/* records replayed in one copy, larger batches are split */
+#define MIGRATE_BENCH_REPLAY_BATCH	512
+/* records read from the caller at a time */
+#define MIGRATE_BENCH_REPLAY_CHUNK	64
+
+struct migrate_bench_replay {
+	struct page **from, **to;
+	int nr;
+	u32 batch;
+	u8 type;
+	u8 order;
+};
+
+static void migrate_bench_replay_free(struct migrate_bench_replay *rp)
+{
+	migrate_bench_free(rp->to, rp->nr, rp->order);
+	migrate_bench_free(rp->from, rp->nr, rp->order);
+	rp->nr = 0;
+}
+
+/* Copy or exchange the pages of the pending batch and free them */
+static int migrate_bench_replay_flush(struct migrate_benchmark *mb,
+		struct migrate_bench_replay *rp,
+		struct migrate_bench_samples *samples)
+{
+	u64 start, ns, bytes;
+	int err;
+
+	if (!rp->nr)
+		return 0;
+
+	start = ktime_get_ns();
+	if (rp->type == MIGRATE_RECORD_EXCHANGE)
+		err = exchange_page_lists_mthread(rp->to, rp->from, rp->nr);
+	else if (mb->flags & MIGRATE_BENCH_DMA)
+		err = copy_page_lists_dma_always(rp->to, rp->from, rp->nr);
+	else
+		err = copy_page_lists_mt(rp->to, rp->from, rp->nr);
+	ns = ktime_get_ns() - start;
+
+	if (!err) {
+		bytes = ((u64)rp->nr << rp->order) * PAGE_SIZE;
+		/* an exchange moves both pages */
+		if (rp->type == MIGRATE_RECORD_EXCHANGE)
+			bytes *= 2;
+		mb->bytes += bytes;
+		mb->delta_nsec += ns;
+		migrate_bench_sample(samples, div_u64(ns, rp->nr));
+	}
+
+	migrate_bench_replay_free(rp);
+	return err;
+}
+
+/* @nid of the trace if this machine has it, else @fallback */
+static int migrate_bench_replay_nid(int nid, int fallback)
+{
+	return nid < nr_node_ids && node_state(nid, N_MEMORY) ? nid : fallback;
+}
+
+static int migrate_bench_replay_record(struct migrate_benchmark *mb,
+		struct migrate_bench_replay *rp, const struct migrate_record *rec,
+		struct migrate_bench_samples *samples)
+{
+	int src_nid, dst_nid, err;
+
+	if (rec->type == MIGRATE_RECORD_BATCH)
+		return rec->batch == rp->batch ?
+			migrate_bench_replay_flush(mb, rp, samples) : 0;
+	/* candidates only tell what the policy looked at */
+	if (rec->type != MIGRATE_RECORD_MIGRATE &&
+	    rec->type != MIGRATE_RECORD_EXCHANGE)
+		return 0;
+	if (rec->order && (!IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE) ||
+			   rec->order != HPAGE_PMD_ORDER))
+		return 0;
+
+	if (rp->nr && (rec->batch != rp->batch || rec->type != rp->type ||
+		       rec->order != rp->order ||
+		       rp->nr == MIGRATE_BENCH_REPLAY_BATCH)) {
+		err = migrate_bench_replay_flush(mb, rp, samples);
+		if (err)
+			return err;
+	}
+
+	rp->batch = rec->batch;
+	rp->type = rec->type;
+	rp->order = rec->order;
+
+	src_nid = migrate_bench_replay_nid(rec->src_nid, mb->src_nid);
+	dst_nid = migrate_bench_replay_nid(rec->dst_nid, mb->dst_nid);
+	err = migrate_bench_alloc(&rp->from[rp->nr], 1, src_nid, rec->order);
+	if (err)
+		return err;
+	err = migrate_bench_alloc(&rp->to[rp->nr], 1, dst_nid, rec->order);
+	if (err) {
+		migrate_bench_free(&rp->from[rp->nr], 1, rec->order);
+		return err;
+	}
+	rp->nr++;
+
+	return 0;
+}
+
+static int migrate_bench_replay(struct migrate_benchmark *mb,
+		struct migrate_bench_samples *samples)
+{
+	struct migrate_record __user *urecs = u64_to_user_ptr(mb->addr);
+	unsigned long nr_recs = mb->size / sizeof(struct migrate_record);
+	struct migrate_bench_replay rp = {};
+	struct migrate_record *recs;
+	unsigned long i, j, n;
+	int run, err = -ENOMEM;
+
+	if (!nr_recs)
+		return -EINVAL;
+
+	recs = kmalloc_array(MIGRATE_BENCH_REPLAY_CHUNK, sizeof(*recs),
+			GFP_KERNEL);
+	rp.from = kcalloc(MIGRATE_BENCH_REPLAY_BATCH, sizeof(*rp.from),
+			GFP_KERNEL);
+	rp.to = kcalloc(MIGRATE_BENCH_REPLAY_BATCH, sizeof(*rp.to),
+			GFP_KERNEL);
+	if (!recs || !rp.from || !rp.to)
+		goto out;
+
+	err = 0;
+	for (run = 0; run < mb->nr_runs; run++) {
+		for (i = 0; i < nr_recs; i += n) {
+			n = min_t(unsigned long, nr_recs - i,
+					MIGRATE_BENCH_REPLAY_CHUNK);
+			if (copy_from_user(recs, urecs + i, n * sizeof(*recs))) {
+				err = -EFAULT;
+				goto out;
+			}
+
+			for (j = 0; j < n; j++) {
+				err = migrate_bench_replay_record(mb, &rp,
+						&recs[j], samples);
+				if (err)
+					goto out;
+			}
+
+			cond_resched();
+			if (fatal_signal_pending(current)) {
+				err = -EINTR;
+				goto out;
+			}
+		}
+
+		/* a trace cut short in the middle of a batch */
+		err = migrate_bench_replay_flush(mb, &rp, samples);
+		if (err)
+			goto out;
+	}
+out:
+	if (rp.from && rp.to)
+		migrate_bench_replay_free(&rp);
+	kfree(rp.to);
+	kfree(rp.from);
+	kfree(recs);
+	return err;
+}
+
+static int __migrate_benchmark_ioctl(struct migrate_benchmark *mb)
+{
+	struct page_copy_policy saved = current->page_copy_policy;
+	struct migrate_bench_samples samples = {};
+	int err;
+
+	if (mb->engine >= NR_MIGRATE_BENCH_ENGINES || !mb->nr_runs ||
+	    mb->src_nid >= nr_node_ids || !node_state(mb->src_nid, N_MEMORY) ||
+	    mb->dst_nid >= nr_node_ids || !node_state(mb->dst_nid, N_MEMORY))
+		return -EINVAL;
+
+	if (mb->engine == MIGRATE_BENCH_REPLAY)
+		samples.max = min_t(u64, (u64)mb->nr_runs *
+				max_t(u64, mb->size / sizeof(struct migrate_record), 1),
+				MIGRATE_BENCH_MAX_SAMPLES);
+	else
+		samples.max = min_t(u64, (u64)mb->nr_runs *
+				(mb->engine == MIGRATE_BENCH_COPY_MT ||
+				 mb->engine == MIGRATE_BENCH_COPY_DMA ?
+				 max(mb->nr_pages, 1U) : 1),
+				MIGRATE_BENCH_MAX_SAMPLES);
+	samples.ns = kvmalloc_array(samples.max, sizeof(u64), GFP_KERNEL);
+	if (!samples.ns)
+		return -ENOMEM;
+
+	mb->bytes = mb->delta_nsec = 0;
+	current->page_copy_policy.nt = mb->nt < 0 ? -1 : !!mb->nt;
+	current->page_copy_policy.rpdaa = mb->rpdaa < 0 ? -1 : !!mb->rpdaa;
+	current->page_copy_policy.nr_threads = mb->nr_threads > 0 ?
+		min_t(int, mb->nr_threads, MAX_NR_COPY_THREADS) : -1;
+
+	if (mb->engine == MIGRATE_BENCH_MIGRATE_CONCUR)
+		err = migrate_bench_concur(mb, &samples);
+	else if (mb->engine == MIGRATE_BENCH_REPLAY)
+		err = migrate_bench_replay(mb, &samples);
+	else
+		err = migrate_bench_pages(mb, &samples);
+
+	current->page_copy_policy = saved;
+
+	if (!err)
+		migrate_bench_report(mb, &samples);
+	kvfree(samples.ns);
+
+	return err;
+}
+
+static long migrate_benchmark_ioctl(struct file *filep, unsigned int cmd,
+		unsigned long arg)
+{
+	struct migrate_benchmark mb;
+	int ret;
+
+	if (cmd != MIGRATE_BENCHMARK)
+		return -EINVAL;
+
+	if (copy_from_user(&mb, (void __user *)arg, sizeof(mb)))
+		return -EFAULT;
+
+	ret = __migrate_benchmark_ioctl(&mb);
+	if (ret)
+		return ret;
+
+	if (copy_to_user((void __user *)arg, &mb, sizeof(mb)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static const struct file_operations migrate_benchmark_fops = {
+	.open = nonseekable_open,
+	.unlocked_ioctl = migrate_benchmark_ioctl,
+};
+
+static int migrate_benchmark_init(void)
+{
+	debugfs_create_file_unsafe("migrate_benchmark", 0600, NULL, NULL,
+				   &migrate_benchmark_fops);
+
+	return 0;
+}
+
+late_initcall(migrate_benchmark_init);
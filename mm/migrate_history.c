@@ -0,0 +1,116 @@
+/*
+ * Page migration ping-pong suppression.
+ *
+ * Nothing keeps a page promoted by mm_manage() or NUMA balancing from
+ * being demoted again by the next reclaim or mm_manage() cycle, and a few
+ * pages bouncing between the tiers can make most of the migration
+ * traffic. The time of the last migration of a page to another node is
+ * kept in its page_ext, and with vm.migrate_hysteresis_ms set a page
+ * that moved less than that long ago stays where it is: mm_manage()
+ * leaves it on the LRU, reclaim keeps it on its node instead of demoting
+ * it and NUMA balancing does not promote it. The suppressed migrations
+ * are counted in the pgmigrate_pingpong vm event.
+ *
+ * A demoted page also keeps the shadow entry workingset_demotion() made
+ * for it until its next hinting fault, see workingset_demotion_refault(),
+ * or until it moves again or is freed.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/jiffies.h>
+#include <linux/page_ext.h>
+#include <linux/vmstat.h>
+#include <linux/migrate_history.h>
+
+// Time a page that moved to another node stays there, 0 to disable
+int sysctl_migrate_hysteresis_ms = 0;
+
+struct page_migrate_history {
+	unsigned long migrated;	/* jiffies of the last migration, 0 for none */
+	void *demotion;		/* shadow entry of the last demotion */
+};
+
+static bool need_page_migrate_history(void)
+{
+	return true;
+}
+
+struct page_ext_operations page_migrate_history_ops = {
+	.size = sizeof(struct page_migrate_history),
+	.need = need_page_migrate_history,
+};
+
+static struct page_migrate_history *get_page_migrate_history(struct page *page)
+{
+	struct page_ext *page_ext = lookup_page_ext(compound_head(page));
+
+	if (unlikely(!page_ext))
+		return NULL;
+
+	return (void *)page_ext + page_migrate_history_ops.offset;
+}
+
+/*
+ * @page moved to @newpage, or two pages swapped contents when called for
+ * an exchange. Moves within a node, as compaction's, do not count.
+ */
+void page_migrate_history_record(struct page *newpage, struct page *page)
+{
+	struct page_migrate_history *history;
+
+	/* the demotion shadow was for the old contents of @page */
+	page_migrate_history_take_demotion(page);
+
+	if (page_to_nid(newpage) == page_to_nid(page))
+		return;
+
+	history = get_page_migrate_history(newpage);
+	if (history)
+		WRITE_ONCE(history->migrated, jiffies ?: 1);
+}
+
+/*
+ * Whether moving @page now would undo a migration of less than
+ * vm.migrate_hysteresis_ms ago. Counts the migrations it suppresses.
+ */
+bool page_migrate_suppress(struct page *page)
+{
+	unsigned int hysteresis = READ_ONCE(sysctl_migrate_hysteresis_ms);
+	struct page_migrate_history *history;
+	unsigned long migrated;
+
+	if (!hysteresis)
+		return false;
+
+	history = get_page_migrate_history(page);
+	if (!history)
+		return false;
+
+	migrated = READ_ONCE(history->migrated);
+	if (!migrated ||
+	    !time_before(jiffies, migrated + msecs_to_jiffies(hysteresis)))
+		return false;
+
+	count_vm_events(PGMIGRATE_PINGPONG, hpage_nr_pages(page));
+	return true;
+}
+
+void page_migrate_history_set_demotion(struct page *page, void *shadow)
+{
+	struct page_migrate_history *history = get_page_migrate_history(page);
+
+	if (history)
+		WRITE_ONCE(history->demotion, shadow);
+}
+
+/* The demotion shadow entry of @page, NULL if none, cleared once read */
+void *page_migrate_history_take_demotion(struct page *page)
+{
+	struct page_migrate_history *history = get_page_migrate_history(page);
+
+	if (!history || !READ_ONCE(history->demotion))
+		return NULL;
+
+	return xchg(&history->demotion, NULL);
+}
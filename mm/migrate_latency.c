@@ -0,0 +1,194 @@
+/*
+ * Page migration latency histograms.
+ *
+ * CONFIG_PAGE_MIGRATION_PROFILE adds up the cycles of each migration step
+ * per task, which is neither cheap enough to build into a production
+ * kernel nor tells anything about the tail. With vm.migrate_latency_hist
+ * set, the migration paths instead count the duration of each of their
+ * phases in per-CPU log2 histograms, one per phase and copy engine, and
+ * the duration of each whole page or batch in one histogram per node
+ * pair. The histograms sit behind a static key and cost nothing while
+ * off.
+ *
+ * They are read, summed over the CPUs, from
+ * /sys/kernel/debug/migrate_latency/phases and .../pairs, one line per
+ * histogram with one count per bucket. Bucket i counts durations from
+ * 2^(i + MIGRATE_LATENCY_MIN_SHIFT) ns up to twice that, the first and
+ * the last bucket also everything shorter and longer.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/nodemask.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/sysctl.h>
+#include <linux/migrate_latency.h>
+
+DEFINE_STATIC_KEY_FALSE(migrate_latency_key);
+// Count the duration of each migration phase in histograms
+int sysctl_migrate_latency_hist = 0;
+
+/* 256ns to 2s */
+#define MIGRATE_LATENCY_MIN_SHIFT	8
+#define MIGRATE_LATENCY_BUCKETS		24
+
+struct migrate_latency_hist {
+	unsigned long count[MIGRATE_LATENCY_BUCKETS];
+};
+
+static const char * const migrate_engine_names[NR_MIGRATE_ENGINES] = {
+	"single", "mt", "dma", "hybrid", "concur", "exchange",
+};
+
+static const char * const migrate_phase_names[NR_MIGRATE_PHASES] = {
+	"lock", "unmap", "copy", "remap", "page", "batch",
+};
+
+/* [engine][phase] and nr_node_ids * nr_node_ids pairs, per CPU */
+static struct migrate_latency_hist __percpu *migrate_phase_hists;
+static struct migrate_latency_hist __percpu *migrate_pair_hists;
+static DEFINE_MUTEX(migrate_latency_mutex);
+
+static int migrate_latency_bucket(u64 ns)
+{
+	int bucket = ns ? ilog2(ns) - MIGRATE_LATENCY_MIN_SHIFT : 0;
+
+	return clamp(bucket, 0, MIGRATE_LATENCY_BUCKETS - 1);
+}
+
+void __migrate_latency_record(enum migrate_latency_engine engine,
+		enum migrate_latency_phase phase, int src_nid, int dst_nid,
+		u64 ns)
+{
+	int bucket = migrate_latency_bucket(ns);
+
+	/* the key is only enabled once the histograms are allocated */
+	this_cpu_inc(migrate_phase_hists[engine * NR_MIGRATE_PHASES + phase]
+			.count[bucket]);
+
+	if (src_nid != NUMA_NO_NODE && dst_nid != NUMA_NO_NODE)
+		this_cpu_inc(migrate_pair_hists[src_nid * nr_node_ids + dst_nid]
+				.count[bucket]);
+}
+
+static int migrate_latency_alloc(void)
+{
+	struct migrate_latency_hist __percpu *phases, *pairs;
+
+	if (migrate_phase_hists)
+		return 0;
+
+	phases = __alloc_percpu(sizeof(*phases) * NR_MIGRATE_ENGINES *
+			NR_MIGRATE_PHASES, __alignof__(*phases));
+	pairs = __alloc_percpu(sizeof(*pairs) * nr_node_ids * nr_node_ids,
+			__alignof__(*pairs));
+	if (!phases || !pairs) {
+		free_percpu(phases);
+		free_percpu(pairs);
+		return -ENOMEM;
+	}
+
+	migrate_phase_hists = phases;
+	migrate_pair_hists = pairs;
+	return 0;
+}
+
+/* The histograms are allocated on first use and kept, like the counts */
+int migrate_latency_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int err;
+
+	mutex_lock(&migrate_latency_mutex);
+	err = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (err || !write)
+		goto out;
+
+	if (sysctl_migrate_latency_hist) {
+		err = migrate_latency_alloc();
+		if (err) {
+			sysctl_migrate_latency_hist = 0;
+			goto out;
+		}
+		static_branch_enable(&migrate_latency_key);
+	} else {
+		static_branch_disable(&migrate_latency_key);
+	}
+out:
+	mutex_unlock(&migrate_latency_mutex);
+	return err;
+}
+
+static void migrate_latency_show_hist(struct seq_file *m,
+		struct migrate_latency_hist __percpu *hist)
+{
+	unsigned long count;
+	int bucket, cpu;
+
+	for (bucket = 0; bucket < MIGRATE_LATENCY_BUCKETS; bucket++) {
+		count = 0;
+		for_each_possible_cpu(cpu)
+			count += per_cpu_ptr(hist, cpu)->count[bucket];
+		seq_printf(m, " %lu", count);
+	}
+	seq_putc(m, '\n');
+}
+
+static int migrate_latency_phases_show(struct seq_file *m, void *v)
+{
+	int engine, phase;
+
+	mutex_lock(&migrate_latency_mutex);
+	if (!migrate_phase_hists)
+		goto out;
+
+	for (engine = 0; engine < NR_MIGRATE_ENGINES; engine++)
+		for (phase = 0; phase < NR_MIGRATE_PHASES; phase++) {
+			seq_printf(m, "%s %s", migrate_engine_names[engine],
+					migrate_phase_names[phase]);
+			migrate_latency_show_hist(m, migrate_phase_hists +
+					engine * NR_MIGRATE_PHASES + phase);
+		}
+out:
+	mutex_unlock(&migrate_latency_mutex);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(migrate_latency_phases);
+
+static int migrate_latency_pairs_show(struct seq_file *m, void *v)
+{
+	int src_nid, dst_nid;
+
+	mutex_lock(&migrate_latency_mutex);
+	if (!migrate_pair_hists)
+		goto out;
+
+	for_each_node_state(src_nid, N_MEMORY)
+		for_each_node_state(dst_nid, N_MEMORY) {
+			if (src_nid == dst_nid)
+				continue;
+			seq_printf(m, "%d %d", src_nid, dst_nid);
+			migrate_latency_show_hist(m, migrate_pair_hists +
+					src_nid * nr_node_ids + dst_nid);
+		}
+out:
+	mutex_unlock(&migrate_latency_mutex);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(migrate_latency_pairs);
+
+static int __init migrate_latency_init(void)
+{
+	struct dentry *dir = debugfs_create_dir("migrate_latency", NULL);
+
+	debugfs_create_file("phases", 0444, dir, NULL,
+			&migrate_latency_phases_fops);
+	debugfs_create_file("pairs", 0444, dir, NULL,
+			&migrate_latency_pairs_fops);
+
+	return 0;
+}
+late_initcall(migrate_latency_init);
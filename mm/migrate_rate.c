@@ -0,0 +1,283 @@
+/*
+ * Migration bandwidth limits.
+ *
+ * A large promotion or demotion saturates the write bandwidth of the
+ * slower node and the tail latency of every other user of the node jumps.
+ * Migrations on behalf of user space, whether from move_pages(),
+ * mm_manage(), mbind() or NUMA balancing, are therefore charged to a
+ * token bucket of their (source node, destination node) pair and to one
+ * of their memcg and of each of its ancestors with a limit. When a bucket
+ * is in debt the migrating task sleeps until it is repaid. Migrations that
+ * must not block, MIGRATE_ASYNC ones, charge the buckets without sleeping
+ * and leave the debt to the next blocking migration. Kernel threads such
+ * as kmigrated and kswapd hold up no allocation of their own and sleep off
+ * the debt of their MIGRATE_ASYNC migrations too, see
+ * migrate_rate_may_sleep().
+ *
+ * The limit of a pair is set in /sys/kernel/mm/migrate_rate/pairs and
+ * defaults to vm.migrate_rate_limit, the limit of a memcg in its
+ * memory.migrate_rate file, all in bytes per second with 0 for no limit.
+ * How often each bucket throttled is reported next to its limit, the
+ * total in the pgmigrate_throttle vm event. The buckets of the nodes
+ * themselves, whose rates follow the measured traffic of the nodes, are
+ * in mm/migrate_bandwidth.c.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/huge_mm.h>
+#include <linux/nodemask.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/memcontrol.h>
+#include <linux/migrate.h>
+#include <linux/migrate_rate.h>
+#include <linux/memory_tier.h>
+
+#include "internal.h"
+
+// Migration bytes per second of a node pair without a limit of its own
+unsigned long sysctl_migrate_rate_limit = 0;
+
+/* a bucket fills up to 100ms worth of its limit */
+#define MIGRATE_RATE_BURST_US	(100 * USEC_PER_MSEC)
+/* longest sleep of one throttled migration */
+#define MIGRATE_RATE_MAX_WAIT_NS	NSEC_PER_SEC
+
+struct migrate_rate_pair {
+	u64 limit;			/* 0 for sysctl_migrate_rate_limit */
+	struct migrate_rate_bucket bucket;
+};
+
+/* nr_node_ids * nr_node_ids pairs */
+static struct migrate_rate_pair *migrate_rate_pairs;
+
+static struct migrate_rate_pair *migrate_rate_pair(int src_nid, int dst_nid)
+{
+	return &migrate_rate_pairs[src_nid * nr_node_ids + dst_nid];
+}
+
+void migrate_rate_bucket_init(struct migrate_rate_bucket *bucket)
+{
+	spin_lock_init(&bucket->lock);
+	bucket->tokens = 0;
+	bucket->last_ns = 0;
+	bucket->nr_throttled = 0;
+}
+
+/*
+ * Take @bytes out of @bucket, refilled at @limit bytes per second up to
+ * now. Returns how many nanoseconds it takes to repay the debt, 0 if the
+ * bucket is not in debt.
+ */
+u64 migrate_rate_bucket_charge(struct migrate_rate_bucket *bucket,
+		u64 limit, u64 bytes)
+{
+	u64 elapsed_us, debt, now, wait = 0;
+	s64 burst;
+
+	if (!limit)
+		return 0;
+	/* a burst beyond S64_MAX bytes is no limit at all */
+	if (limit > div_u64(S64_MAX, MIGRATE_RATE_BURST_US))
+		return 0;
+	burst = div_u64(limit * MIGRATE_RATE_BURST_US, USEC_PER_SEC);
+
+	spin_lock(&bucket->lock);
+	/* sampled under the lock, the refills of the bucket are in order */
+	now = ktime_get_ns();
+	elapsed_us = now > bucket->last_ns ?
+		div_u64(now - bucket->last_ns, NSEC_PER_USEC) : 0;
+	if (elapsed_us >= MIGRATE_RATE_BURST_US) {
+		bucket->tokens = max(bucket->tokens, burst);
+		bucket->last_ns = now;
+	} else {
+		bucket->tokens = min_t(s64, bucket->tokens +
+				div_u64(elapsed_us * limit, USEC_PER_SEC), burst);
+		/* keep the fraction of a microsecond for the next refill */
+		bucket->last_ns += elapsed_us * NSEC_PER_USEC;
+	}
+
+	bucket->tokens -= bytes;
+	if (bucket->tokens < 0) {
+		debt = -bucket->tokens;
+		if (debt > div_u64(U64_MAX, USEC_PER_SEC * NSEC_PER_USEC))
+			wait = U64_MAX;
+		else
+			wait = div64_u64(debt * USEC_PER_SEC, limit) *
+				NSEC_PER_USEC;
+		bucket->nr_throttled++;
+	}
+	spin_unlock(&bucket->lock);
+
+	return wait;
+}
+
+/*
+ * Bytes per second the migrations from @src_nid to @dst_nid are limited to,
+ * 0 for no limit.
+ */
+u64 migrate_rate_limit(int src_nid, int dst_nid)
+{
+	u64 limit = 0;
+
+	if (smp_load_acquire(&migrate_rate_pairs))
+		limit = READ_ONCE(migrate_rate_pair(src_nid, dst_nid)->limit);
+
+	return limit ? limit : READ_ONCE(sysctl_migrate_rate_limit);
+}
+
+static bool migrate_rate_limited(enum migrate_reason reason)
+{
+	return reason == MR_SYSCALL || reason == MR_MEMPOLICY_MBIND ||
+		reason == MR_NUMA_MISPLACED;
+}
+
+/* The node buckets also take the demotions of reclaim */
+static bool migrate_bandwidth_limited(enum migrate_reason reason)
+{
+	return migrate_rate_limited(reason) || reason == MR_DEMOTION;
+}
+
+/* Whether a migration of @mode by current sleeps off its debt */
+static bool migrate_rate_may_sleep(enum migrate_mode mode)
+{
+	return (mode & MIGRATE_MODE_MASK) != MIGRATE_ASYNC ||
+		(current->flags & PF_KTHREAD);
+}
+
+/*
+ * Charge the migration of @page to @dst_nid to the buckets of its node
+ * pair and of its memcg. Returns how long the migrating task should sleep,
+ * to be passed to migrate_rate_throttle().
+ */
+u64 migrate_rate_charge(struct page *page, int dst_nid,
+		enum migrate_reason reason, enum migrate_mode mode)
+{
+	int src_nid = page_to_nid(page);
+	u64 bytes = (u64)hpage_nr_pages(page) << PAGE_SHIFT;
+	struct migrate_rate_pair *pair;
+	u64 now, limit, wait;
+
+	if (src_nid == dst_nid)
+		return 0;
+
+	/*
+	 * An emulated slow node is as slow for every migration that waits
+	 * for it. One that does not would only push back the others.
+	 */
+	wait = 0;
+	if (migrate_rate_may_sleep(mode)) {
+		now = ktime_get_ns();
+		wait = max(memory_tier_emu_charge(src_nid, bytes, now),
+			   memory_tier_emu_charge(dst_nid, bytes, now));
+	}
+	if (migrate_bandwidth_limited(reason))
+		wait = max(wait, migrate_bandwidth_charge(src_nid, dst_nid,
+				bytes));
+	if (!migrate_rate_limited(reason))
+		return min_t(u64, wait, MIGRATE_RATE_MAX_WAIT_NS);
+
+	if (smp_load_acquire(&migrate_rate_pairs)) {
+		pair = migrate_rate_pair(src_nid, dst_nid);
+		limit = READ_ONCE(pair->limit);
+		if (!limit)
+			limit = READ_ONCE(sysctl_migrate_rate_limit);
+		wait = max(wait, migrate_rate_bucket_charge(&pair->bucket,
+				limit, bytes));
+	}
+
+	wait = max(wait, mem_cgroup_migrate_rate_charge(page, bytes));
+
+	return min_t(u64, wait, MIGRATE_RATE_MAX_WAIT_NS);
+}
+
+/* Sleep off @wait nanoseconds of migrate_rate_charge() debt */
+void migrate_rate_throttle(u64 wait, enum migrate_mode mode)
+{
+	if (!wait || !migrate_rate_may_sleep(mode))
+		return;
+
+	count_vm_event(PGMIGRATE_THROTTLE);
+	schedule_timeout_killable(max_t(unsigned long,
+				nsecs_to_jiffies(wait), 1));
+}
+
+/*
+ * /sys/kernel/mm/migrate_rate/pairs: one "src dst limit throttled" line
+ * per pair of memory nodes, a limit of 0 following vm.migrate_rate_limit.
+ * Writing "src dst limit" sets the limit of a pair.
+ */
+static ssize_t pairs_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct migrate_rate_pair *pair;
+	int src_nid, dst_nid;
+	ssize_t len = 0;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			"src dst limit throttled\n");
+
+	for_each_node_state(src_nid, N_MEMORY)
+		for_each_node_state(dst_nid, N_MEMORY) {
+			if (src_nid == dst_nid)
+				continue;
+			pair = migrate_rate_pair(src_nid, dst_nid);
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					"%d %d %llu %lu\n", src_nid, dst_nid,
+					READ_ONCE(pair->limit),
+					READ_ONCE(pair->bucket.nr_throttled));
+		}
+
+	return len;
+}
+
+static ssize_t pairs_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	int src_nid, dst_nid;
+	u64 limit;
+
+	if (sscanf(buf, "%d %d %llu", &src_nid, &dst_nid, &limit) != 3)
+		return -EINVAL;
+	if (src_nid < 0 || src_nid >= nr_node_ids ||
+	    dst_nid < 0 || dst_nid >= nr_node_ids)
+		return -EINVAL;
+
+	WRITE_ONCE(migrate_rate_pair(src_nid, dst_nid)->limit, limit);
+
+	return count;
+}
+static struct kobj_attribute pairs_attr = __ATTR_RW(pairs);
+
+static struct attribute *migrate_rate_attrs[] = {
+	&pairs_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group migrate_rate_attr_group = {
+	.attrs = migrate_rate_attrs,
+};
+
+static int __init migrate_rate_init(void)
+{
+	struct migrate_rate_pair *pairs;
+	int i;
+
+	pairs = kvcalloc(nr_node_ids * nr_node_ids, sizeof(*pairs), GFP_KERNEL);
+	if (!pairs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_node_ids * nr_node_ids; i++)
+		migrate_rate_bucket_init(&pairs[i].bucket);
+	smp_store_release(&migrate_rate_pairs, pairs);
+
+	mm_sysfs_add_group("migrate_rate", &migrate_rate_attr_group);
+
+	return 0;
+}
+subsys_initcall(migrate_rate_init);
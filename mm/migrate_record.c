@@ -0,0 +1,217 @@
+/*
+ * Migration trace for offline policy evaluation.
+ *
+ * Tiering policies are tuned against what a daemon actually did in
+ * production. With vm.migrate_record set, mm_manage() writes a struct
+ * migrate_record for every page it isolates as a candidate, every page it
+ * migrates and every pair of pages it exchanges, and one at the end of
+ * each migration or exchange batch with its size, failures and duration.
+ * The records go to the per-CPU relay files
+ * /sys/kernel/debug/migrate_record/cpuN, which user space drains while
+ * recording. The replay engine of /sys/kernel/debug/migrate_benchmark
+ * re-executes the recorded batches with other copy engines and settings.
+ *
+ * A task that moves to another CPU in the middle of a batch continues it
+ * in the file of the new CPU, so readers merge the files by time_ns. When
+ * a reader falls behind, records are dropped and counted in
+ * /sys/kernel/debug/migrate_record/dropped. Writing 1 again after 0 starts
+ * a new trace.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/mm_inline.h>
+#include <linux/list.h>
+#include <linux/relay.h>
+#include <linux/rcupdate.h>
+#include <linux/debugfs.h>
+#include <linux/sysctl.h>
+#include <linux/migrate_record.h>
+
+DEFINE_STATIC_KEY_FALSE(migrate_record_key);
+// Record the isolations, migrations and exchanges of mm_manage()
+int sysctl_migrate_record = 0;
+
+/* 4MB of records per CPU */
+#define MIGRATE_RECORD_SUBBUF_SIZE	(256 * 1024)
+#define MIGRATE_RECORD_SUBBUFS		16
+
+static struct rchan __rcu *migrate_record_chan;
+static struct dentry *migrate_record_dir;
+static DEFINE_MUTEX(migrate_record_mutex);
+static atomic_t migrate_record_batch_id;
+static atomic_t migrate_record_dropped;
+
+u32 migrate_record_next_batch(void)
+{
+	u32 batch;
+
+	/* 0 is no batch */
+	do {
+		batch = atomic_inc_return(&migrate_record_batch_id);
+	} while (!batch);
+
+	return batch;
+}
+
+static void migrate_record_write(struct migrate_record *rec)
+{
+	struct rchan *chan;
+
+	rcu_read_lock();
+	chan = rcu_dereference(migrate_record_chan);
+	if (chan)
+		relay_write(chan, rec, sizeof(*rec));
+	rcu_read_unlock();
+}
+
+void __migrate_record_page(enum migrate_record_type type, struct page *page,
+		int dst_nid, u32 batch)
+{
+	struct migrate_record rec = {
+		.time_ns	= ktime_get_ns(),
+		.pfn		= page_to_pfn(page),
+		.batch		= batch,
+		.nr_pages	= hpage_nr_pages(page),
+		.src_nid	= page_to_nid(page),
+		.dst_nid	= dst_nid,
+		.type		= type,
+		.order		= compound_order(page),
+		.flags		= (PageActive(page) ? MIGRATE_RECORD_ACTIVE : 0) |
+				  (PageAnon(page) ? MIGRATE_RECORD_ANON : 0),
+	};
+
+	migrate_record_write(&rec);
+}
+
+void __migrate_record_list(enum migrate_record_type type,
+		struct list_head *pages, int dst_nid, u32 batch)
+{
+	struct page *page;
+
+	list_for_each_entry(page, pages, lru)
+		__migrate_record_page(type, page, dst_nid, batch);
+}
+
+void __migrate_record_batch(u32 batch, int src_nid, int dst_nid,
+		unsigned int nr_pages, unsigned int nr_failed, u64 start)
+{
+	u64 now = ktime_get_ns();
+	struct migrate_record rec = {
+		.time_ns	= now,
+		.batch		= batch,
+		.nr_pages	= nr_pages,
+		.nr_failed	= nr_failed,
+		.duration_ns	= min_t(u64, now - start, U32_MAX),
+		.src_nid	= src_nid,
+		.dst_nid	= dst_nid,
+		.type		= MIGRATE_RECORD_BATCH,
+	};
+
+	migrate_record_write(&rec);
+}
+
+/* Drop the records instead of overwriting those not read yet */
+static int migrate_record_subbuf_start(struct rchan_buf *buf, void *subbuf,
+		void *prev_subbuf, size_t prev_padding)
+{
+	if (relay_buf_full(buf)) {
+		atomic_inc(&migrate_record_dropped);
+		return 0;
+	}
+
+	return 1;
+}
+
+static struct dentry *migrate_record_create_buf_file(const char *filename,
+		struct dentry *parent, umode_t mode, struct rchan_buf *buf,
+		int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf,
+			&relay_file_operations);
+}
+
+static int migrate_record_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+
+static struct rchan_callbacks migrate_record_callbacks = {
+	.subbuf_start		= migrate_record_subbuf_start,
+	.create_buf_file	= migrate_record_create_buf_file,
+	.remove_buf_file	= migrate_record_remove_buf_file,
+};
+
+static int migrate_record_start_trace(void)
+{
+	struct rchan *chan;
+
+	if (rcu_access_pointer(migrate_record_chan))
+		return 0;
+
+	chan = relay_open("cpu", migrate_record_dir,
+			MIGRATE_RECORD_SUBBUF_SIZE, MIGRATE_RECORD_SUBBUFS,
+			&migrate_record_callbacks, NULL);
+	if (!chan)
+		return -ENOMEM;
+
+	atomic_set(&migrate_record_dropped, 0);
+	rcu_assign_pointer(migrate_record_chan, chan);
+	static_branch_enable(&migrate_record_key);
+	return 0;
+}
+
+static void migrate_record_stop_trace(void)
+{
+	struct rchan *chan = rcu_dereference_protected(migrate_record_chan,
+			lockdep_is_held(&migrate_record_mutex));
+
+	if (!chan)
+		return;
+
+	static_branch_disable(&migrate_record_key);
+	RCU_INIT_POINTER(migrate_record_chan, NULL);
+	synchronize_rcu();
+	/* open files keep their buffers until they are closed */
+	relay_close(chan);
+}
+
+int migrate_record_sysctl_handler(struct ctl_table *table, int write,
+		void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	int err;
+
+	mutex_lock(&migrate_record_mutex);
+	err = proc_dointvec_minmax(table, write, buffer, lenp, ppos);
+	if (err || !write)
+		goto out;
+
+	if (!sysctl_migrate_record) {
+		migrate_record_stop_trace();
+		goto out;
+	}
+
+	err = -ENODEV;
+	if (migrate_record_dir)
+		err = migrate_record_start_trace();
+	if (err)
+		sysctl_migrate_record = 0;
+out:
+	mutex_unlock(&migrate_record_mutex);
+	return err;
+}
+
+static int __init migrate_record_init(void)
+{
+	struct dentry *dir = debugfs_create_dir("migrate_record", NULL);
+
+	if (IS_ERR_OR_NULL(dir))
+		return 0;
+
+	debugfs_create_atomic_t("dropped", 0444, dir, &migrate_record_dropped);
+	migrate_record_dir = dir;
+	return 0;
+}
+late_initcall(migrate_record_init);
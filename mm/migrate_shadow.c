@@ -0,0 +1,334 @@
+/*
+ * Clean shadows of promoted pages.
+ *
+ * A page demoted, promoted for a burst of accesses and then demoted again
+ * unchanged is copied across the socket both ways. With vm.migrate_shadow
+ * set, the promotion of an anon base page keeps its slow tier frame as a
+ * shadow instead of freeing it, and clears the dirty bit of the new page.
+ * A later migration of the page back to the node of the shadow takes the
+ * shadow as its target and skips the copy if the page is still clean: the
+ * dirty bits of its ptes move to the page when it is unmapped for the
+ * migration, like they do for reclaim.
+ *
+ * The private field of the page points to its shadow, tagged with
+ * MIGRATE_SHADOW_TAG, and the private field of the shadow back to the page.
+ * The shadow goes away as soon as the page is freed, added to the swap
+ * cache or migrated anywhere else, and the shadows of a node are freed
+ * oldest first by a shrinker when the node is short of memory. They stay
+ * charged to their memcg while they exist.
+ *
+ * The migrations of unmap_and_move() and of migrate_pages_concur(), which
+ * reclaim demotes with, keep and take shadows, not those of the batched
+ * path.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/nodemask.h>
+#include <linux/pagemap.h>
+#include <linux/memory.h>
+#include <linux/ksm.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/shrinker.h>
+#include <linux/migrate.h>
+#include <linux/memory_tier.h>
+
+#include "internal.h"
+
+// Keep the slow tier frame of promoted anon pages for their next demotion
+int sysctl_migrate_shadow = 0;
+
+struct migrate_shadow_node {
+	spinlock_t lock;
+	struct list_head shadows;	/* newest first */
+	unsigned long nr_shadows;
+	unsigned long nr_hits;
+};
+
+static struct migrate_shadow_node migrate_shadow_nodes[MAX_NUMNODES];
+
+static struct page *page_migrate_shadow(struct page *page)
+{
+	return (struct page *)(page_private(page) & ~MIGRATE_SHADOW_TAG);
+}
+
+/*
+ * Whether @shadow is the linked shadow of @page. Called under the lock of
+ * the node of @shadow, which the link is only changed under.
+ */
+static bool migrate_shadow_linked(struct page *shadow, struct page *page)
+{
+	return page_private(page) == ((unsigned long)shadow | MIGRATE_SHADOW_TAG) &&
+		page_private(shadow) == (unsigned long)page;
+}
+
+/* Unlink @shadow from its node and from its page, under the node lock */
+static void migrate_shadow_unlink(struct migrate_shadow_node *node,
+		struct page *shadow)
+{
+	struct page *page = (struct page *)page_private(shadow);
+
+	if (page_private(page) == ((unsigned long)shadow | MIGRATE_SHADOW_TAG))
+		set_page_private(page, 0);
+	set_page_private(shadow, 0);
+	list_del(&shadow->lru);
+	node->nr_shadows--;
+}
+
+/* Whether a migration of @page to @newpage may keep @page as a shadow */
+bool migrate_shadow_candidate(struct page *newpage, struct page *page,
+		enum migrate_reason reason)
+{
+	if (!READ_ONCE(sysctl_migrate_shadow))
+		return false;
+	if (reason == MR_MEMORY_FAILURE || reason == MR_MEMORY_HOTPLUG ||
+	    reason == MR_CONTIG_RANGE)
+		return false;
+	if (!PageAnon(page) || PageCompound(page) || PageKsm(page))
+		return false;
+
+	return node_is_slow_tier(page_to_nid(page)) &&
+		!node_is_slow_tier(page_to_nid(newpage));
+}
+
+/*
+ * Keep @page, just migrated to @newpage, as the shadow of @newpage. The
+ * caller holds a reference on @newpage and @page is no longer on a list.
+ */
+void migrate_shadow_keep(struct page *newpage, struct page *page)
+{
+	struct migrate_shadow_node *node = &migrate_shadow_nodes[page_to_nid(page)];
+	unsigned long flags;
+
+	/* the lock of the page serializes with add_to_swap() and migrations */
+	if (!trylock_page(newpage))
+		return;
+
+	if (!PageAnon(newpage) || PageSwapCache(newpage) ||
+	    !PageSwapBacked(newpage) || PageKsm(newpage) ||
+	    !page_mapped(newpage) || page_private(newpage))
+		goto unlock;
+
+	get_page(page);
+	ClearPageDirty(newpage);
+
+	spin_lock_irqsave(&node->lock, flags);
+	set_page_private(page, (unsigned long)newpage);
+	set_page_private(newpage, (unsigned long)page | MIGRATE_SHADOW_TAG);
+	list_add(&page->lru, &node->shadows);
+	node->nr_shadows++;
+	spin_unlock_irqrestore(&node->lock, flags);
+
+	count_vm_event(PGMIGRATE_SHADOW_KEEP);
+unlock:
+	unlock_page(newpage);
+}
+
+/*
+ * The shadow of @page on @nid, to migrate @page to in place of a newly
+ * allocated page, NULL if it has none there. The shadow is handed out like
+ * a free page, its private field marking it as the shadow of @page for
+ * migrate_shadow_hit().
+ */
+struct page *migrate_shadow_take(struct page *page, int nid)
+{
+	struct migrate_shadow_node *node = &migrate_shadow_nodes[nid];
+	struct page *shadow;
+	unsigned long flags;
+
+	if (!page_has_migrate_shadow(page) || PageKsm(page))
+		return NULL;
+
+	shadow = page_migrate_shadow(page);
+	if (page_to_nid(shadow) != nid)
+		return NULL;
+
+	spin_lock_irqsave(&node->lock, flags);
+	if (!migrate_shadow_linked(shadow, page) || page_count(shadow) != 1) {
+		spin_unlock_irqrestore(&node->lock, flags);
+		return NULL;
+	}
+	migrate_shadow_unlink(node, shadow);
+	spin_unlock_irqrestore(&node->lock, flags);
+
+	shadow->mapping = NULL;
+	shadow->flags &= ~PAGE_FLAGS_CHECK_AT_PREP;
+	set_page_private(shadow, (unsigned long)page | MIGRATE_SHADOW_TAG);
+
+	return shadow;
+}
+
+/*
+ * Called by the copy of @page to @newpage: whether @newpage is the shadow
+ * of @page and @page has not been written since the shadow was kept, so
+ * that there is nothing to copy.
+ */
+bool migrate_shadow_hit(struct page *newpage, struct page *page)
+{
+	if (likely(page_private(newpage) !=
+		   ((unsigned long)page | MIGRATE_SHADOW_TAG)))
+		return false;
+
+	set_page_private(newpage, 0);
+	if (PageDirty(page))
+		return false;
+
+	migrate_shadow_nodes[page_to_nid(newpage)].nr_hits++;
+	count_vm_event(PGMIGRATE_SHADOW_HIT);
+
+	return true;
+}
+
+/*
+ * Free the shadow of @page, which is locked or being freed. Its private
+ * field is cleared even if the tag turns out to be stale.
+ */
+void __migrate_shadow_drop(struct page *page)
+{
+	struct page *shadow = page_migrate_shadow(page);
+	struct migrate_shadow_node *node = &migrate_shadow_nodes[page_to_nid(shadow)];
+	unsigned long flags;
+	bool linked;
+
+	spin_lock_irqsave(&node->lock, flags);
+	linked = migrate_shadow_linked(shadow, page);
+	if (linked)
+		migrate_shadow_unlink(node, shadow);
+	else
+		set_page_private(page, 0);
+	spin_unlock_irqrestore(&node->lock, flags);
+
+	if (linked)
+		put_page(shadow);
+}
+
+/* Free up to @nr of the oldest shadows of @nid */
+static unsigned long migrate_shadow_shrink(int nid, unsigned long nr)
+{
+	struct migrate_shadow_node *node = &migrate_shadow_nodes[nid];
+	struct page *shadow, *next;
+	unsigned long flags, freed = 0;
+	LIST_HEAD(shadows);
+
+	spin_lock_irqsave(&node->lock, flags);
+	while (freed < nr && !list_empty(&node->shadows)) {
+		shadow = list_last_entry(&node->shadows, struct page, lru);
+		migrate_shadow_unlink(node, shadow);
+		list_add(&shadow->lru, &shadows);
+		freed++;
+	}
+	spin_unlock_irqrestore(&node->lock, flags);
+
+	list_for_each_entry_safe(shadow, next, &shadows, lru) {
+		list_del(&shadow->lru);
+		put_page(shadow);
+	}
+
+	return freed;
+}
+
+static unsigned long migrate_shadow_count(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	return READ_ONCE(migrate_shadow_nodes[sc->nid].nr_shadows);
+}
+
+static unsigned long migrate_shadow_scan(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	unsigned long freed = migrate_shadow_shrink(sc->nid, sc->nr_to_scan);
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+static struct shrinker migrate_shadow_shrinker = {
+	.count_objects = migrate_shadow_count,
+	.scan_objects = migrate_shadow_scan,
+	.seeks = DEFAULT_SEEKS,
+	.flags = SHRINKER_NUMA_AWARE,
+};
+
+/* shadows are not movable, free them before their memory goes offline */
+static int migrate_shadow_memory_callback(struct notifier_block *self,
+		unsigned long action, void *arg)
+{
+	struct memory_notify *mn = arg;
+
+	if (action == MEM_GOING_OFFLINE)
+		migrate_shadow_shrink(pfn_to_nid(mn->start_pfn), ULONG_MAX);
+
+	return NOTIFY_OK;
+}
+
+/*
+ * /sys/kernel/mm/migrate_shadow/nodes: one "node shadows hits" line per
+ * memory node. Writing a node number frees the shadows of the node.
+ */
+static ssize_t nodes_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct migrate_shadow_node *node;
+	ssize_t len = 0;
+	int nid;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len, "node shadows hits\n");
+
+	for_each_node_state(nid, N_MEMORY) {
+		node = &migrate_shadow_nodes[nid];
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %lu %lu\n",
+				nid, READ_ONCE(node->nr_shadows),
+				READ_ONCE(node->nr_hits));
+	}
+
+	return len;
+}
+
+static ssize_t nodes_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	int nid;
+
+	if (kstrtoint(buf, 0, &nid))
+		return -EINVAL;
+	if (nid < 0 || nid >= MAX_NUMNODES || !node_state(nid, N_MEMORY))
+		return -EINVAL;
+
+	migrate_shadow_shrink(nid, ULONG_MAX);
+
+	return count;
+}
+static struct kobj_attribute nodes_attr = __ATTR_RW(nodes);
+
+static struct attribute *migrate_shadow_attrs[] = {
+	&nodes_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group migrate_shadow_attr_group = {
+	.attrs = migrate_shadow_attrs,
+};
+
+static int __init migrate_shadow_init(void)
+{
+	int nid, err;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		spin_lock_init(&migrate_shadow_nodes[nid].lock);
+		INIT_LIST_HEAD(&migrate_shadow_nodes[nid].shadows);
+	}
+
+	err = register_shrinker(&migrate_shadow_shrinker);
+	if (err)
+		return err;
+
+	hotplug_memory_notifier(migrate_shadow_memory_callback, 0);
+
+	mm_sysfs_add_group("migrate_shadow", &migrate_shadow_attr_group);
+
+	return 0;
+}
+subsys_initcall(migrate_shadow_init);
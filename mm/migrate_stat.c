@@ -0,0 +1,315 @@
+/*
+ * Per node pair migration counters.
+ *
+ * The migration counters of a task only tell fast to slow tier from slow
+ * to fast and go away with the task. For capacity planning every page
+ * that is migrated or exchanged is also counted, in per-CPU counters, by
+ * its (source node, destination node) pair, its copy engine and its
+ * size, and by pair and size in its memcg. An exchange counts both of
+ * its pages, each in its own direction.
+ *
+ * The system-wide counts, summed over the CPUs and engines on read, are
+ * the pgmigrate_pair_<src>_<dst>_{base,huge,bytes} lines of /proc/vmstat,
+ * followed by one pgmigrate_pair_<src>_<dst>_<engine>_<size> line per
+ * engine that moved pages of that size. The counts of a memcg and its
+ * descendants follow the same scheme in its memory.stat without the
+ * engines, and only for the pairs it moved pages between.
+ *
+ * RPDAA is meant to keep PMEM from being written from a remote socket, so
+ * the copy engines also count the bytes they write to each PMEM node by
+ * the node of the CPUs or the DMA engine that wrote them. They are the
+ * pgmigrate_pmem_write_<writer>_<pmem>_bytes lines, and the
+ * pgmigrate_pmem_write_{local,remote}_bytes totals, a write being local
+ * when the writer is the CPU node nearest to the PMEM node.
+ *
+ * Faults that hit a page under migration, or under exchange, which also
+ * unmaps its pages with migration entries, wait until it is remapped.
+ * That time is what the application sees of a migration, so it is
+ * counted in nanoseconds with a log2 histogram of the waits, system-wide
+ * in the pgmigrate_stall_* lines of /proc/vmstat and for the memcg of
+ * the faulting mm and its descendants in its memory.migrate_stall.
+ *
+ * The copy workers, and kmigrated when it migrates for a task, run in the
+ * root cgroup. The CPU time they spend on a migration is charged to the
+ * cgroup of the task it is done for, as system time in its cpu.stat and
+ * as migrate_cpu_usec in the memory.stat of its memcg. The time DMA
+ * engines spend copying and their completion interrupts are not.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/nodemask.h>
+#include <linux/seq_file.h>
+#include <linux/cgroup.h>
+#include <linux/sched/cputime.h>
+#include <linux/memcontrol.h>
+#include <linux/migrate.h>
+#include <linux/migrate_stat.h>
+
+#include "internal.h"
+
+static const char * const migrate_stat_engine_names[NR_MIGRATE_ENGINES] = {
+	"single", "mt", "dma", "hybrid", "concur", "exchange",
+};
+
+static const char * const migrate_stat_size_names[NR_MIGRATE_STAT_SIZES] = {
+	"base", "huge",
+};
+
+/* [src_nid][dst_nid][engine] with nr_node_ids nodes, per CPU */
+static struct migrate_pair_stat __percpu *migrate_pair_stats;
+/* bytes written to PMEM, [writer_nid][dst_nid], per CPU */
+static u64 __percpu *pmem_write_stats;
+static DEFINE_PER_CPU(struct migrate_stall_stat, migrate_stall_stats);
+
+static int migrate_pair_index(int src_nid, int dst_nid)
+{
+	return src_nid * nr_node_ids + dst_nid;
+}
+
+/*
+ * Count @page, now on @dst_nid, as moved from @src_nid by @engine. @page
+ * is the one whose memcg the move is charged to.
+ */
+void count_migrate_pair(struct page *page, int src_nid, int dst_nid,
+		enum migrate_latency_engine engine)
+{
+	int nr_pages = hpage_nr_pages(page);
+	int size = nr_pages > 1 ? MIGRATE_STAT_HUGE : MIGRATE_STAT_BASE;
+	struct migrate_pair_stat __percpu *stat;
+
+	if (src_nid == dst_nid || !migrate_pair_stats)
+		return;
+
+	stat = migrate_pair_stats +
+		migrate_pair_index(src_nid, dst_nid) * NR_MIGRATE_ENGINES +
+		engine;
+	this_cpu_inc(stat->nr[size]);
+	this_cpu_add(stat->nr_base_pages, nr_pages);
+
+	mem_cgroup_count_migrate_pair(page, migrate_pair_index(src_nid,
+				dst_nid), size, nr_pages);
+}
+
+/*
+ * Count @bytes written to @dst_nid by a copy run on the CPUs or the DMA
+ * engine of @writer_nid. Only writes to PMEM nodes are counted.
+ */
+void count_pmem_write(int writer_nid, int dst_nid, u64 bytes)
+{
+	if (!pmem_write_stats || pmem_nearest_node(dst_nid) == NUMA_NO_NODE)
+		return;
+
+	this_cpu_add(pmem_write_stats[migrate_pair_index(writer_nid, dst_nid)],
+			bytes);
+}
+
+/* Count a wait of @nsec by a fault of @mm on a page under migration */
+void count_migrate_stall(struct mm_struct *mm, bool huge, u64 nsec)
+{
+	int size = huge ? MIGRATE_STAT_HUGE : MIGRATE_STAT_BASE;
+	int bucket = min_t(int, fls64(div_u64(nsec, NSEC_PER_USEC)),
+			   MIGRATE_STALL_BUCKETS - 1);
+
+	this_cpu_add(migrate_stall_stats.nsec[size], nsec);
+	this_cpu_inc(migrate_stall_stats.nr[size]);
+	this_cpu_inc(migrate_stall_stats.hist[bucket]);
+
+	mem_cgroup_count_migrate_stall(mm, size, bucket, nsec);
+}
+
+/**
+ * migrate_cputime_begin - start accounting the CPU time of a migration
+ * @mc: accounting state
+ * @task: task the migration is done for, the current one or the one
+ *        kmigrated works for
+ *
+ * The time the current task runs is only counted when it is not @task,
+ * which the scheduler already charges for it.
+ */
+void migrate_cputime_begin(struct migrate_cputime *mc,
+		struct task_struct *task)
+{
+	mc->task = task;
+	mc->exec_ns = task != current ? task_sched_runtime(current) : 0;
+	mc->worker_ns = current->page_migration_stats.worker_ns;
+}
+
+/* Charge the CPU time since migrate_cputime_begin() to the cgroup of the task */
+void migrate_cputime_end(struct migrate_cputime *mc)
+{
+	struct task_struct *task = mc->task;
+	u64 nsec = current->page_migration_stats.worker_ns - mc->worker_ns;
+#ifdef CONFIG_CGROUPS
+	struct cgroup *cgrp;
+	unsigned long flags;
+#endif
+
+	if (task != current)
+		nsec += task_sched_runtime(current) - mc->exec_ns;
+	if (!nsec)
+		return;
+
+#ifdef CONFIG_CGROUPS
+	local_irq_save(flags);
+	rcu_read_lock();
+	cgrp = task_dfl_cgroup(task);
+	if (cgroup_parent(cgrp)) {
+		__cgroup_account_cputime(cgrp, nsec);
+		__cgroup_account_cputime_field(cgrp, CPUTIME_SYSTEM, nsec);
+	}
+	rcu_read_unlock();
+	local_irq_restore(flags);
+#endif
+
+	mem_cgroup_count_migrate_cputime(task, nsec);
+}
+
+void migrate_stall_stat_add(struct migrate_stall_stat *sum,
+		struct migrate_stall_stat __percpu *stat)
+{
+	struct migrate_stall_stat *cpu_stat;
+	int cpu, i;
+
+	for_each_possible_cpu(cpu) {
+		cpu_stat = per_cpu_ptr(stat, cpu);
+		for (i = 0; i < NR_MIGRATE_STAT_SIZES; i++) {
+			sum->nsec[i] += cpu_stat->nsec[i];
+			sum->nr[i] += cpu_stat->nr[i];
+		}
+		for (i = 0; i < MIGRATE_STALL_BUCKETS; i++)
+			sum->hist[i] += cpu_stat->hist[i];
+	}
+}
+
+/* The stall lines of /proc/vmstat and memory.migrate_stall */
+void migrate_stall_stat_show(struct seq_file *m, const char *prefix,
+		const struct migrate_stall_stat *stat)
+{
+	int i;
+
+	for (i = 0; i < NR_MIGRATE_STAT_SIZES; i++) {
+		seq_printf(m, "%sstall_%s_nsec %llu\n", prefix,
+				migrate_stat_size_names[i], stat->nsec[i]);
+		seq_printf(m, "%sstall_%s %lu\n", prefix,
+				migrate_stat_size_names[i], stat->nr[i]);
+	}
+	for (i = 0; i < MIGRATE_STALL_BUCKETS - 1; i++)
+		seq_printf(m, "%sstall_lt_%luus %lu\n", prefix, 1UL << i,
+				stat->hist[i]);
+	seq_printf(m, "%sstall_ge_%luus %lu\n", prefix, 1UL << (i - 1),
+			stat->hist[i]);
+}
+
+/* Add the per-CPU counts of @stat to @sum */
+void migrate_pair_stat_add(struct migrate_pair_stat *sum,
+		struct migrate_pair_stat __percpu *stat)
+{
+	struct migrate_pair_stat *cpu_stat;
+	int cpu, size;
+
+	for_each_possible_cpu(cpu) {
+		cpu_stat = per_cpu_ptr(stat, cpu);
+		for (size = 0; size < NR_MIGRATE_STAT_SIZES; size++)
+			sum->nr[size] += cpu_stat->nr[size];
+		sum->nr_base_pages += cpu_stat->nr_base_pages;
+	}
+}
+
+static void migrate_stat_show_pair(struct seq_file *m, int src_nid,
+		int dst_nid)
+{
+	struct migrate_pair_stat engines[NR_MIGRATE_ENGINES] = {};
+	struct migrate_pair_stat sum = {};
+	int engine, size;
+
+	for (engine = 0; engine < NR_MIGRATE_ENGINES; engine++) {
+		migrate_pair_stat_add(&engines[engine], migrate_pair_stats +
+				migrate_pair_index(src_nid, dst_nid) *
+				NR_MIGRATE_ENGINES + engine);
+		for (size = 0; size < NR_MIGRATE_STAT_SIZES; size++)
+			sum.nr[size] += engines[engine].nr[size];
+		sum.nr_base_pages += engines[engine].nr_base_pages;
+	}
+
+	for (size = 0; size < NR_MIGRATE_STAT_SIZES; size++)
+		seq_printf(m, "pgmigrate_pair_%d_%d_%s %lu\n", src_nid, dst_nid,
+				migrate_stat_size_names[size], sum.nr[size]);
+	seq_printf(m, "pgmigrate_pair_%d_%d_bytes %llu\n", src_nid, dst_nid,
+			(u64)sum.nr_base_pages << PAGE_SHIFT);
+
+	for (engine = 0; engine < NR_MIGRATE_ENGINES; engine++)
+		for (size = 0; size < NR_MIGRATE_STAT_SIZES; size++)
+			if (engines[engine].nr[size])
+				seq_printf(m, "pgmigrate_pair_%d_%d_%s_%s %lu\n",
+						src_nid, dst_nid,
+						migrate_stat_engine_names[engine],
+						migrate_stat_size_names[size],
+						engines[engine].nr[size]);
+}
+
+static void migrate_stat_show_pmem_writes(struct seq_file *m)
+{
+	u64 bytes, local = 0, remote = 0;
+	int writer_nid, dst_nid, cpu;
+
+	for_each_node_state(dst_nid, N_MEMORY) {
+		if (pmem_nearest_node(dst_nid) == NUMA_NO_NODE)
+			continue;
+
+		for_each_online_node(writer_nid) {
+			bytes = 0;
+			for_each_possible_cpu(cpu)
+				bytes += *per_cpu_ptr(pmem_write_stats +
+						migrate_pair_index(writer_nid,
+							dst_nid), cpu);
+			if (!bytes)
+				continue;
+
+			seq_printf(m, "pgmigrate_pmem_write_%d_%d_bytes %llu\n",
+					writer_nid, dst_nid, bytes);
+			if (writer_nid == pmem_nearest_node(dst_nid))
+				local += bytes;
+			else
+				remote += bytes;
+		}
+	}
+
+	seq_printf(m, "pgmigrate_pmem_write_local_bytes %llu\n", local);
+	seq_printf(m, "pgmigrate_pmem_write_remote_bytes %llu\n", remote);
+}
+
+/* The lines /proc/vmstat ends with */
+void migrate_stat_show_vmstat(struct seq_file *m)
+{
+	struct migrate_stall_stat stall = {};
+	int src_nid, dst_nid;
+
+	migrate_stall_stat_add(&stall, &migrate_stall_stats);
+	migrate_stall_stat_show(m, "pgmigrate_", &stall);
+
+	if (!migrate_pair_stats)
+		return;
+
+	for_each_node_state(src_nid, N_MEMORY)
+		for_each_node_state(dst_nid, N_MEMORY)
+			if (src_nid != dst_nid)
+				migrate_stat_show_pair(m, src_nid, dst_nid);
+
+	if (pmem_write_stats)
+		migrate_stat_show_pmem_writes(m);
+}
+
+static int __init migrate_stat_init(void)
+{
+	migrate_pair_stats = __alloc_percpu(sizeof(*migrate_pair_stats) *
+			nr_node_ids * nr_node_ids * NR_MIGRATE_ENGINES,
+			__alignof__(*migrate_pair_stats));
+	pmem_write_stats = __alloc_percpu(sizeof(*pmem_write_stats) *
+			nr_node_ids * nr_node_ids, __alignof__(*pmem_write_stats));
+
+	return migrate_pair_stats && pmem_write_stats ? 0 : -ENOMEM;
+}
+subsys_initcall(migrate_stat_init);
@@ -0,0 +1,242 @@
+/*
+ * Bulk allocation of migration target pages.
+ *
+ * Migrations to a node allocate their new pages one by one through
+ * new_page_t, each allocation going through the page allocator on its
+ * own. The concurrent migration path knows how many pages of each size a
+ * batch needs before it unmaps it, so for migrations to a node it
+ * allocates them in bulk into a per-node cache that alloc_new_node_page()
+ * takes from, through alloc_pages_bulk_node(): one zonelist walk and zone
+ * lock round trip per batch rather than per page.
+ *
+ * vm.migrate_target_cache_pages base pages worth of target pages are kept
+ * cached per node after a batch, so that a tiering daemon promoting or
+ * demoting pages continuously does not allocate on every batch. The cache
+ * is given back to the allocator under memory pressure.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/huge_mm.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/nodemask.h>
+#include <linux/shrinker.h>
+#include <linux/migrate.h>
+#include <linux/sched/mm.h>
+
+#include "internal.h"
+
+// Base pages worth of migration target pages kept cached per node
+int sysctl_migrate_target_cache_pages = 0;
+
+/* HPAGE_PMD_ORDER, which cannot be used without THP */
+#define MIGRATE_TARGET_THP_ORDER	(PMD_SHIFT - PAGE_SHIFT)
+#define MIGRATE_TARGET_THP_NR		(1L << MIGRATE_TARGET_THP_ORDER)
+
+enum {
+	MIGRATE_TARGET_BASE,
+	MIGRATE_TARGET_THP,
+	NR_MIGRATE_TARGET_SIZES,
+};
+
+struct migrate_target_cache {
+	spinlock_t lock;
+	struct list_head pages[NR_MIGRATE_TARGET_SIZES];
+	int nr_pages[NR_MIGRATE_TARGET_SIZES];
+};
+
+static struct migrate_target_cache migrate_target_caches[MAX_NUMNODES];
+
+static int migrate_target_size(int order)
+{
+	return order ? MIGRATE_TARGET_THP : MIGRATE_TARGET_BASE;
+}
+
+static int __migrate_target_alloc_bulk(struct list_head *pages, int order,
+		int nr, unsigned long private)
+{
+	gfp_t gfp_mask = GFP_HIGHUSER_MOVABLE | __GFP_THISNODE | __GFP_NOWARN;
+	int nid = private;
+	struct page *page;
+	int allocated = 0;
+	int got;
+	LIST_HEAD(new_pages);
+
+	if (order) {
+		if (!IS_ENABLED(CONFIG_TRANSPARENT_HUGEPAGE) ||
+		    order != MIGRATE_TARGET_THP_ORDER ||
+		    !thp_node_target_allowed(nid))
+			return 0;
+		gfp_mask = thp_node_defrag_gfpmask(nid, GFP_TRANSHUGE) |
+			__GFP_THISNODE | __GFP_NOWARN;
+	}
+
+	/* each round falls back to one allocation that may reclaim */
+	while (allocated < nr) {
+		got = alloc_pages_bulk_node(nid, gfp_mask, order,
+				nr - allocated, &new_pages);
+		if (!got)
+			break;
+		allocated += got;
+	}
+
+	if (order)
+		list_for_each_entry(page, &new_pages, lru)
+			prep_transhuge_page(page);
+	list_splice(&new_pages, pages);
+
+	return allocated;
+}
+
+/*
+ * Allocate @nr pages of @order on node @private into @pages, the bulk
+ * counterpart of alloc_new_node_page(). Only base pages and PMD sized THP
+ * are supported. The pages are migration targets and may use the promotion
+ * headroom. Returns how many pages were allocated.
+ */
+int migrate_target_alloc_bulk(struct list_head *pages, int order, int nr,
+		unsigned long private)
+{
+	unsigned int headroom = memalloc_headroom_save();
+	int allocated;
+
+	allocated = __migrate_target_alloc_bulk(pages, order, nr, private);
+	memalloc_headroom_restore(headroom);
+
+	return allocated;
+}
+
+/* A cached target page of @order on @nid, NULL if there is none */
+struct page *migrate_target_cache_get(int nid, int order)
+{
+	struct migrate_target_cache *cache = &migrate_target_caches[nid];
+	int size = migrate_target_size(order);
+	struct page *page = NULL;
+
+	if (!READ_ONCE(cache->nr_pages[size]))
+		return NULL;
+
+	spin_lock(&cache->lock);
+	if (!list_empty(&cache->pages[size])) {
+		page = list_first_entry(&cache->pages[size], struct page, lru);
+		list_del(&page->lru);
+		cache->nr_pages[size]--;
+	}
+	spin_unlock(&cache->lock);
+
+	return page;
+}
+
+/*
+ * Make sure the cache of @nid holds at least @nr_base base pages and
+ * @nr_thp THP, allocating what is missing in bulk.
+ */
+void migrate_target_cache_fill(int nid, int nr_base, int nr_thp)
+{
+	struct migrate_target_cache *cache = &migrate_target_caches[nid];
+	int want[NR_MIGRATE_TARGET_SIZES] = { nr_base, nr_thp };
+	int size, nr;
+	LIST_HEAD(pages);
+
+	for (size = 0; size < NR_MIGRATE_TARGET_SIZES; size++) {
+		nr = want[size] - READ_ONCE(cache->nr_pages[size]);
+		if (nr <= 0)
+			continue;
+
+		nr = migrate_target_alloc_bulk(&pages,
+				size == MIGRATE_TARGET_THP ?
+					MIGRATE_TARGET_THP_ORDER : 0,
+				nr, nid);
+		if (!nr)
+			continue;
+
+		spin_lock(&cache->lock);
+		list_splice_init(&pages, &cache->pages[size]);
+		cache->nr_pages[size] += nr;
+		spin_unlock(&cache->lock);
+	}
+}
+
+/* Free cached pages of @nid beyond @max base pages worth */
+static unsigned long migrate_target_cache_shrink(int nid, long max)
+{
+	struct migrate_target_cache *cache = &migrate_target_caches[nid];
+	unsigned long freed = 0;
+	struct page *page, *next;
+	int size;
+	LIST_HEAD(pages);
+
+	spin_lock(&cache->lock);
+	for (size = NR_MIGRATE_TARGET_SIZES - 1; size >= 0; size--) {
+		long nr_base = size == MIGRATE_TARGET_THP ?
+			MIGRATE_TARGET_THP_NR : 1;
+
+		while (cache->nr_pages[size] &&
+		       cache->nr_pages[MIGRATE_TARGET_BASE] +
+		       cache->nr_pages[MIGRATE_TARGET_THP] *
+		       MIGRATE_TARGET_THP_NR > max) {
+			page = list_first_entry(&cache->pages[size],
+					struct page, lru);
+			list_move(&page->lru, &pages);
+			cache->nr_pages[size]--;
+			freed += nr_base;
+		}
+	}
+	spin_unlock(&cache->lock);
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del(&page->lru);
+		put_page(page);
+	}
+
+	return freed;
+}
+
+/* Give back what the cache of @nid holds beyond the sysctl */
+void migrate_target_cache_trim(int nid)
+{
+	migrate_target_cache_shrink(nid,
+			READ_ONCE(sysctl_migrate_target_cache_pages));
+}
+
+static unsigned long migrate_target_count(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	struct migrate_target_cache *cache = &migrate_target_caches[sc->nid];
+
+	return READ_ONCE(cache->nr_pages[MIGRATE_TARGET_BASE]) +
+		READ_ONCE(cache->nr_pages[MIGRATE_TARGET_THP]) *
+		MIGRATE_TARGET_THP_NR;
+}
+
+static unsigned long migrate_target_scan(struct shrinker *shrink,
+		struct shrink_control *sc)
+{
+	unsigned long freed = migrate_target_cache_shrink(sc->nid, 0);
+
+	return freed ? freed : SHRINK_STOP;
+}
+
+static struct shrinker migrate_target_shrinker = {
+	.count_objects = migrate_target_count,
+	.scan_objects = migrate_target_scan,
+	.seeks = DEFAULT_SEEKS,
+	.flags = SHRINKER_NUMA_AWARE,
+};
+
+static int __init migrate_target_init(void)
+{
+	int nid, size;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		spin_lock_init(&migrate_target_caches[nid].lock);
+		for (size = 0; size < NR_MIGRATE_TARGET_SIZES; size++)
+			INIT_LIST_HEAD(&migrate_target_caches[nid].pages[size]);
+	}
+
+	return register_shrinker(&migrate_target_shrinker);
+}
+core_initcall(migrate_target_init);
@@ -17,6 +17,9 @@
 #include <linux/swapops.h>
 #include <linux/shmem_fs.h>
 #include <linux/hugetlb.h>
+#include <linux/mempolicy.h>
+#include <linux/ptrace.h>
+#include <linux/sched/mm.h>
 
 #include <linux/uaccess.h>
 #include <asm/pgtable.h>
@@ -302,3 +305,214 @@ SYSCALL_DEFINE3(mincore, unsigned long, start, size_t, len,
 	free_page((unsigned long) tmp);
 	return retval;
 }
+
+/*
+ * page_residency(): on which node each page of a range is, for a placement
+ * agent that would otherwise look up every address with move_pages().
+ */
+struct residency_walk {
+	u32 *vec;
+	unsigned long start;	/* address of vec[0] */
+	int shift;		/* PAGE_SHIFT, or PMD_SHIFT per block */
+	int flags;
+};
+
+static u32 residency_entry(struct residency_walk *rw, struct page *page,
+		bool young, bool dirty)
+{
+	u32 val = page_to_nid(page) & PAGE_RESIDENCY_NODE_MASK;
+
+	if (rw->flags & PAGE_RESIDENCY_BITS) {
+		if (young)
+			val |= PAGE_RESIDENCY_ACCESSED;
+		if (dirty)
+			val |= PAGE_RESIDENCY_DIRTY;
+	}
+
+	return val;
+}
+
+/* Fold @val into the entries of [addr, end) */
+static void residency_fill(struct residency_walk *rw, unsigned long addr,
+		unsigned long end, u32 val)
+{
+	unsigned long i = (addr - rw->start) >> rw->shift;
+	unsigned long n = (end - rw->start + (1UL << rw->shift) - 1) >>
+		rw->shift;
+	u32 old;
+
+	for (; i < n; i++) {
+		old = rw->vec[i];
+		if ((old & PAGE_RESIDENCY_NODE_MASK) == PAGE_RESIDENCY_NONE) {
+			rw->vec[i] = val;
+			continue;
+		}
+		if ((old ^ val) & PAGE_RESIDENCY_NODE_MASK)
+			old |= PAGE_RESIDENCY_MIXED;
+		rw->vec[i] = old | (val & (PAGE_RESIDENCY_ACCESSED |
+					   PAGE_RESIDENCY_DIRTY));
+	}
+}
+
+static int residency_pte_range(pmd_t *pmd, unsigned long addr,
+		unsigned long end, struct mm_walk *walk)
+{
+	struct residency_walk *rw = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	pte_t *orig_pte, *pte;
+	struct page *page;
+	spinlock_t *ptl;
+
+	ptl = pmd_trans_huge_lock(pmd, vma);
+	if (ptl) {
+		if (pmd_present(*pmd))
+			residency_fill(rw, addr, end,
+				       residency_entry(rw, pmd_page(*pmd),
+						       pmd_young(*pmd),
+						       pmd_dirty(*pmd)) |
+				       PAGE_RESIDENCY_HUGE);
+		spin_unlock(ptl);
+		return 0;
+	}
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr < end; pte++, addr += PAGE_SIZE) {
+		if (!pte_present(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (page)
+			residency_fill(rw, addr, addr + PAGE_SIZE,
+				       residency_entry(rw, page, pte_young(*pte),
+						       pte_dirty(*pte)));
+	}
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+
+	return 0;
+}
+
+static int residency_hugetlb(pte_t *ptep, unsigned long hmask,
+		unsigned long addr, unsigned long end, struct mm_walk *walk)
+{
+#ifdef CONFIG_HUGETLB_PAGE
+	struct residency_walk *rw = walk->private;
+	pte_t pte = huge_ptep_get(ptep);
+
+	if (pte_present(pte))
+		residency_fill(rw, addr, end,
+			       residency_entry(rw, pte_page(pte),
+					       pte_young(pte), pte_dirty(pte)) |
+			       PAGE_RESIDENCY_HUGE);
+#endif
+	return 0;
+}
+
+static const struct mm_walk_ops residency_walk_ops = {
+	.pmd_entry		= residency_pte_range,
+	.hugetlb_entry		= residency_hugetlb,
+};
+
+/*
+ * The page_residency(2) system call.
+ *
+ * page_residency() returns the node of the pages mapped in [start, start +
+ * len) of the process @pid, 0 for the current one, in a vector of __u32,
+ * see PAGE_RESIDENCY_* for the format. Unmapped addresses and pages not
+ * present are reported as PAGE_RESIDENCY_NONE. With PAGE_RESIDENCY_PMD,
+ * @start must be PMD_SIZE aligned and @vec has an entry per PMD_SIZE.
+ *
+ * return values:
+ *  zero    - success
+ *  -EFAULT - vec points to an illegal address
+ *  -EINVAL - start is not aligned, or flags are not valid
+ *  -ESRCH  - there is no process @pid
+ *  -EPERM  - the caller may not inspect the process @pid
+ */
+SYSCALL_DEFINE5(page_residency, pid_t, pid, unsigned long, start,
+		size_t, len, __u32 __user *, vec, int, flags)
+{
+	struct residency_walk rw = { .flags = flags };
+	unsigned long entries, nr, end, i;
+	struct task_struct *task;
+	struct mm_struct *mm;
+	long retval;
+
+	start = untagged_addr(start);
+
+	if (flags & ~(PAGE_RESIDENCY_PMD | PAGE_RESIDENCY_BITS))
+		return -EINVAL;
+	rw.shift = flags & PAGE_RESIDENCY_PMD ? PMD_SHIFT : PAGE_SHIFT;
+	if (start & ((1UL << rw.shift) - 1))
+		return -EINVAL;
+	if (start + len < start)
+		return -EINVAL;
+
+	entries = (len >> rw.shift) + ((len & ((1UL << rw.shift) - 1)) != 0);
+	if (!access_ok(vec, entries * sizeof(*vec)))
+		return -EFAULT;
+
+	rcu_read_lock();
+	task = pid ? find_task_by_vpid(pid) : current;
+	if (!task) {
+		rcu_read_unlock();
+		return -ESRCH;
+	}
+	get_task_struct(task);
+	rcu_read_unlock();
+
+	if (!ptrace_may_access(task, PTRACE_MODE_READ_REALCREDS)) {
+		put_task_struct(task);
+		return -EPERM;
+	}
+	mm = get_task_mm(task);
+	put_task_struct(task);
+	if (!mm)
+		return -EINVAL;
+
+	rw.vec = (void *) __get_free_page(GFP_USER);
+	if (!rw.vec) {
+		mmput(mm);
+		return -EAGAIN;
+	}
+
+	retval = 0;
+	while (entries) {
+		/* a page of entries per mmap_sem hold */
+		nr = min_t(unsigned long, entries, PAGE_SIZE / sizeof(*vec));
+		for (i = 0; i < nr; i++)
+			rw.vec[i] = PAGE_RESIDENCY_NONE;
+
+		rw.start = start;
+		end = min_t(unsigned long, start + (nr << rw.shift),
+			    PAGE_ALIGN(start + len));
+		if (end > start) {
+			down_read(&mm->mmap_sem);
+			retval = walk_page_range(mm, start, end,
+						 &residency_walk_ops, &rw);
+			up_read(&mm->mmap_sem);
+			if (retval < 0)
+				break;
+		}
+
+		if (copy_to_user(vec, rw.vec, nr * sizeof(*vec))) {
+			retval = -EFAULT;
+			break;
+		}
+		entries -= nr;
+		vec += nr;
+		len -= min_t(unsigned long, len, nr << rw.shift);
+		start += nr << rw.shift;
+
+		if (fatal_signal_pending(current)) {
+			retval = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+	free_page((unsigned long) rw.vec);
+	mmput(mm);
+
+	return retval;
+}
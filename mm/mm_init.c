@@ -25,6 +25,9 @@ int __meminitdata mminit_loglevel;
 /* The zonelists are simply reported, validation is manual. */
 void __init mminit_verify_zonelist(void)
 {
+	static const char * const listnames[] = {
+		"general", "thisnode", "fastfirst", "slowfirst",
+	};
 	int nid;
 
 	if (mminit_loglevel < MMINIT_VERIFY)
@@ -37,7 +40,7 @@ void __init mminit_verify_zonelist(void)
 		struct zonelist *zonelist;
 		int i, listid, zoneid;
 
-		BUG_ON(MAX_ZONELISTS > 2);
+		BUILD_BUG_ON(MAX_ZONELISTS > ARRAY_SIZE(listnames));
 		for (i = 0; i < MAX_ZONELISTS * MAX_NR_ZONES; i++) {
 
 			/* Identify the zone and nodelist */
@@ -50,7 +53,7 @@ void __init mminit_verify_zonelist(void)
 
 			/* Print information about the zonelist */
 			printk(KERN_DEBUG "mminit::zonelist %s %d:%s = ",
-				listid > 0 ? "thisnode" : "general", nid,
+				listnames[listid], nid,
 				zone->name);
 
 			/* Iterate the zonelist */
@@ -191,3 +194,27 @@ static int __init mm_sysfs_init(void)
 	return 0;
 }
 postcore_initcall(mm_sysfs_init);
+
+/*
+ * Create the directory @name under /sys/kernel/mm with the attributes of
+ * @grp in it, for the initcalls of the mm features that export knobs or
+ * statistics there. Failures are logged here, callers that can live
+ * without their sysfs files may ignore the error.
+ */
+int __init mm_sysfs_add_group(const char *name,
+		const struct attribute_group *grp)
+{
+	struct kobject *kobj;
+	int err = -ENOMEM;
+
+	kobj = kobject_create_and_add(name, mm_kobj);
+	if (kobj) {
+		err = sysfs_create_group(kobj, grp);
+		if (err)
+			kobject_put(kobj);
+	}
+	if (err)
+		pr_err("mm: failed to register sysfs group %s\n", name);
+
+	return err;
+}
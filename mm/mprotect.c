@@ -28,6 +28,7 @@
 #include <linux/ksm.h>
 #include <linux/uaccess.h>
 #include <linux/mm_inline.h>
+#include <linux/sched/numa_balancing.h>
 #include <asm/pgtable.h>
 #include <asm/cacheflush.h>
 #include <asm/mmu_context.h>
@@ -107,6 +108,13 @@ static unsigned long change_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 				 */
 				if (target_node == page_to_nid(page))
 					continue;
+
+				/* Fast tier pages are scanned on fewer passes */
+				if (numa_scan_skip_node(vma->vm_mm,
+							page_to_nid(page)))
+					continue;
+
+				numa_scan_mark_page(page);
 			}
 
 			oldpte = ptep_modify_prot_start(vma, addr, pte);
@@ -42,6 +42,8 @@
 #include <linux/vmalloc.h>
 #include <linux/vmstat.h>
 #include <linux/mempolicy.h>
+#include <linux/memory_tier.h>
+#include <linux/migrate_history.h>
 #include <linux/memremap.h>
 #include <linux/stop_machine.h>
 #include <linux/random.h>
@@ -330,6 +332,10 @@ int watermark_boost_factor __read_mostly;
 int watermark_boost_factor __read_mostly = 15000;
 #endif
 int watermark_scale_factor = 10;
+// Free memory above the high watermark kswapd keeps by demotion, 1/10000 of a zone
+int demote_watermark_scale_factor;
+// Free memory of a fast tier zone kept for migration targets, 1/10000 of a zone
+int promote_headroom_factor;
 
 static unsigned long nr_kernel_pages __initdata;
 static unsigned long nr_all_pages __initdata;
@@ -1149,6 +1155,10 @@ static __always_inline bool free_pages_prepare(struct page *page,
 			(page + i)->flags &= ~PAGE_FLAGS_CHECK_AT_PREP;
 		}
 	}
+	migrate_shadow_drop(page);
+	/* only demoted pages carry a demotion shadow entry */
+	if (node_is_slow_tier(page_to_nid(page)))
+		page_migrate_history_take_demotion(page);
 	if (PageMappingFlags(page))
 		page->mapping = NULL;
 	if (memcg_kmem_enabled() && PageKmemcg(page))
@@ -3144,7 +3154,8 @@ int __isolate_free_page(struct page *page, unsigned int order)
 		 * exists.
 		 */
 		watermark = zone->_watermark[WMARK_MIN] + (1UL << order);
-		if (!zone_watermark_ok(zone, 0, watermark, 0, ALLOC_CMA))
+		if (!zone_watermark_ok(zone, 0, watermark, 0,
+				       ALLOC_CMA | ALLOC_HEADROOM))
 			return 0;
 
 		__mod_zone_freepage_state(zone, -(1UL << order), mt);
@@ -3247,6 +3258,23 @@ static struct page *rmqueue_pcplist(struct zone *preferred_zone,
 	return page;
 }
 
+/* Wake kswapd for the boost or the demotion watermark of @zone */
+static inline void rmqueue_wake_kswapd(struct zone *zone)
+{
+	/* Separate test+clear to avoid unnecessary atomics */
+	if (test_bit(ZONE_BOOSTED_WATERMARK, &zone->flags)) {
+		clear_bit(ZONE_BOOSTED_WATERMARK, &zone->flags);
+		wakeup_kswapd(zone, 0, 0, zone_idx(zone));
+	}
+
+	/* kswapd demotes until the zone is back above the watermark */
+	if (unlikely(demote_wmark_pages(zone)) &&
+	    zone_page_state(zone, NR_FREE_PAGES) < demote_wmark_pages(zone) &&
+	    !test_bit(ZONE_DEMOTE_WATERMARK, &zone->flags) &&
+	    !test_and_set_bit(ZONE_DEMOTE_WATERMARK, &zone->flags))
+		wakeup_kswapd(zone, 0, 0, zone_idx(zone));
+}
+
 /*
  * Allocate a page from the given zone. Use pcplists for order-0 allocations.
  */
@@ -3293,11 +3321,7 @@ struct page *rmqueue(struct zone *preferred_zone,
 	local_irq_restore(flags);
 
 out:
-	/* Separate test+clear to avoid unnecessary atomics */
-	if (test_bit(ZONE_BOOSTED_WATERMARK, &zone->flags)) {
-		clear_bit(ZONE_BOOSTED_WATERMARK, &zone->flags);
-		wakeup_kswapd(zone, 0, 0, zone_idx(zone));
-	}
+	rmqueue_wake_kswapd(zone);
 
 	VM_BUG_ON_PAGE(page && bad_range(zone, page), page);
 	return page;
@@ -3398,6 +3422,9 @@ bool __zone_watermark_ok(struct zone *z, unsigned int order, unsigned long mark,
 	/* free_pages may go negative - that's OK */
 	free_pages -= (1 << order) - 1;
 
+	if (alloc_flags & ALLOC_HEADROOM)
+		min -= min_t(long, min, z->promote_headroom);
+
 	if (alloc_flags & ALLOC_HIGH)
 		min -= min / 2;
 
@@ -4203,6 +4230,9 @@ gfp_to_alloc_flags(gfp_t gfp_mask)
 	if (gfp_mask & __GFP_KSWAPD_RECLAIM)
 		alloc_flags |= ALLOC_KSWAPD;
 
+	if (current->memalloc_headroom && !in_interrupt())
+		alloc_flags |= ALLOC_HEADROOM;
+
 #ifdef CONFIG_CMA
 	if (gfpflags_to_migratetype(gfp_mask) == MIGRATE_MOVABLE)
 		alloc_flags |= ALLOC_CMA;
@@ -4646,13 +4676,39 @@ __alloc_pages_slowpath(gfp_t gfp_mask, unsigned int order,
 	return page;
 }
 
+/*
+ * Zonelist of the allocations of the current task from @nid, tier-ordered
+ * if its mempolicy or memcg asks for it.
+ */
+static inline struct zonelist *tier_fallback_zonelist(int nid, gfp_t flags)
+{
+#ifdef CONFIG_NUMA
+	if (static_branch_unlikely(&tier_fallback_used) &&
+	    !(flags & __GFP_THISNODE) && !in_interrupt() &&
+	    memory_tiers_present()) {
+		switch (current_tier_fallback()) {
+		case TIER_FALLBACK_FAST:
+			return NODE_DATA(nid)->node_zonelists +
+				ZONELIST_FAST_FIRST;
+		case TIER_FALLBACK_SLOW:
+			return NODE_DATA(nid)->node_zonelists +
+				ZONELIST_SLOW_FIRST;
+		default:
+			break;
+		}
+	}
+#endif
+
+	return node_zonelist(nid, flags);
+}
+
 static inline bool prepare_alloc_pages(gfp_t gfp_mask, unsigned int order,
 		int preferred_nid, nodemask_t *nodemask,
 		struct alloc_context *ac, gfp_t *alloc_mask,
 		unsigned int *alloc_flags)
 {
 	ac->high_zoneidx = gfp_zone(gfp_mask);
-	ac->zonelist = node_zonelist(preferred_nid, gfp_mask);
+	ac->zonelist = tier_fallback_zonelist(preferred_nid, gfp_mask);
 	ac->nodemask = nodemask;
 	ac->migratetype = gfpflags_to_migratetype(gfp_mask);
 
@@ -4675,6 +4731,9 @@ static inline bool prepare_alloc_pages(gfp_t gfp_mask, unsigned int order,
 	if (IS_ENABLED(CONFIG_CMA) && ac->migratetype == MIGRATE_MOVABLE)
 		*alloc_flags |= ALLOC_CMA;
 
+	if (current->memalloc_headroom && !in_interrupt())
+		*alloc_flags |= ALLOC_HEADROOM;
+
 	return true;
 }
 
@@ -4763,6 +4822,157 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order, int preferred_nid,
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+/*
+ * Take up to @count pages of @order off the free lists of @zone onto @list
+ * under one hold of the zone lock. The caller disables interrupts.
+ */
+static int rmqueue_bulk_pages(struct zone *zone, unsigned int order,
+			int count, struct list_head *list,
+			int migratetype, unsigned int alloc_flags)
+{
+	struct page *page;
+	int i, alloced = 0;
+
+	spin_lock(&zone->lock);
+	for (i = 0; i < count; i++) {
+		page = __rmqueue(zone, order, migratetype, alloc_flags);
+		if (unlikely(!page))
+			break;
+		__mod_zone_freepage_state(zone, -(1 << order),
+					  get_pcppage_migratetype(page));
+		/* a bad page is leaked, as in rmqueue() */
+		if (unlikely(check_new_pages(page, order)))
+			continue;
+		list_add_tail(&page->lru, list);
+		alloced++;
+	}
+	spin_unlock(&zone->lock);
+
+	return alloced;
+}
+
+/**
+ * alloc_pages_bulk_node - allocate pages of one order on one node in bulk
+ * @nid: the node to allocate on
+ * @gfp_mask: GFP flags, __GFP_THISNODE is implied
+ * @order: the order of the pages
+ * @nr_pages: how many pages to allocate
+ * @list: where to add the pages
+ *
+ * Walks the zones of @nid once and takes as many pages as each zone holds
+ * above its watermark, order-0 pages from the per-cpu list first and the
+ * rest under one hold of the zone lock, instead of paying the zonelist
+ * walk, the watermark check and the locking for every page. Only when the
+ * fast path finds nothing does it fall back to one regular allocation,
+ * which may reclaim as @gfp_mask allows. Not for __GFP_ACCOUNT pages.
+ *
+ * Return: how many pages were added to @list.
+ */
+int alloc_pages_bulk_node(int nid, gfp_t gfp_mask, unsigned int order,
+			  int nr_pages, struct list_head *list)
+{
+	unsigned int alloc_flags = ALLOC_WMARK_LOW;
+	struct alloc_context ac = { };
+	struct per_cpu_pages *pcp;
+	struct list_head *pcp_list;
+	struct page *page, *next;
+	struct zoneref *z;
+	struct zone *zone;
+	unsigned long flags;
+	gfp_t alloc_mask;
+	int allocated = 0;
+	int classzone_idx;
+	long nr, mark;
+	int got, i;
+	LIST_HEAD(pages);
+
+	if (nr_pages <= 0 || WARN_ON_ONCE(order >= MAX_ORDER) ||
+	    WARN_ON_ONCE(gfp_mask & __GFP_ACCOUNT))
+		return 0;
+
+	gfp_mask = (gfp_mask & gfp_allowed_mask) | __GFP_THISNODE;
+	alloc_mask = gfp_mask;
+	if (!prepare_alloc_pages(gfp_mask, order, nid, NULL, &ac, &alloc_mask,
+				 &alloc_flags))
+		return 0;
+
+	finalise_ac(gfp_mask, &ac);
+	/* no fragmenting fallbacks, as on the first get_page_from_freelist() */
+	alloc_flags |= alloc_flags_nofragment(ac.preferred_zoneref->zone,
+					      gfp_mask);
+	classzone_idx = zonelist_zone_idx(ac.preferred_zoneref);
+
+	z = ac.preferred_zoneref;
+	for_next_zone_zonelist_nodemask(zone, z, ac.zonelist, ac.high_zoneidx,
+					ac.nodemask) {
+		if (cpusets_enabled() &&
+		    (alloc_flags & ALLOC_CPUSET) &&
+		    !__cpuset_zone_allowed(zone, gfp_mask))
+			continue;
+
+		mark = wmark_pages(zone, alloc_flags & ALLOC_WMARK_MASK);
+		if (!zone_watermark_fast(zone, order, mark,
+				classzone_idx, alloc_flags))
+			continue;
+
+		/*
+		 * No deeper into the zone than __zone_watermark_ok() lets
+		 * one allocation go, lowmem reserve included.
+		 */
+		if (alloc_flags & ALLOC_HEADROOM)
+			mark -= min_t(long, mark, zone->promote_headroom);
+		mark += zone->lowmem_reserve[classzone_idx];
+		nr = (zone_page_state(zone, NR_FREE_PAGES) - mark) >> order;
+		nr = clamp_t(long, nr, 1, nr_pages - allocated);
+
+		got = 0;
+		local_irq_save(flags);
+		if (!order) {
+			pcp = &this_cpu_ptr(zone->pageset)->pcp;
+			pcp_list = &pcp->lists[ac.migratetype];
+			while (got < nr && !list_empty(pcp_list)) {
+				page = list_first_entry(pcp_list, struct page,
+							lru);
+				list_del(&page->lru);
+				pcp->count--;
+				if (unlikely(check_new_pcp(page)))
+					continue;
+				list_add_tail(&page->lru, &pages);
+				got++;
+			}
+		}
+		if (got < nr)
+			got += rmqueue_bulk_pages(zone, order, nr - got, &pages,
+						  ac.migratetype, alloc_flags);
+		__count_zid_vm_events(PGALLOC, zone_idx(zone), got << order);
+		for (i = 0; i < got; i++)
+			zone_statistics(ac.preferred_zoneref->zone, zone);
+		local_irq_restore(flags);
+
+		rmqueue_wake_kswapd(zone);
+
+		allocated += got;
+		if (allocated == nr_pages)
+			break;
+	}
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		prep_new_page(page, order, gfp_mask, alloc_flags);
+		trace_mm_page_alloc(page, order, alloc_mask, ac.migratetype);
+		list_move_tail(&page->lru, list);
+	}
+
+	if (!allocated) {
+		page = __alloc_pages_node(nid, gfp_mask, order);
+		if (page) {
+			list_add_tail(&page->lru, list);
+			allocated = 1;
+		}
+	}
+
+	return allocated;
+}
+
 /*
  * Common helper functions. Never use with __GFP_HIGHMEM because the returned
  * address cannot represent highmem pages. Use alloc_pages and then kmap if
@@ -5598,6 +5808,47 @@ static void build_thisnode_zonelists(pg_data_t *pgdat)
 	zonerefs->zone_idx = 0;
 }
 
+static struct zoneref *build_zonerefs_tier(struct zoneref *zonerefs,
+		int *node_order, unsigned nr_nodes, bool slow)
+{
+	int i;
+
+	for (i = 0; i < nr_nodes; i++) {
+		if (node_is_slow_tier(node_order[i]) != slow)
+			continue;
+
+		zonerefs += build_zonerefs_node(NODE_DATA(node_order[i]),
+						zonerefs);
+	}
+
+	return zonerefs;
+}
+
+/*
+ * Build the tier-ordered zonelists: the nodes of the fallback zonelist,
+ * in the same order, but the fast tier nodes ahead of the slow tier ones,
+ * or the other way round. find_next_best_node() prefers nodes without
+ * CPUs, so by distance a DRAM node can fall back to its local PMEM node
+ * before the remote DRAM one.
+ */
+static void build_tier_zonelists(pg_data_t *pgdat, int *node_order,
+		unsigned nr_nodes)
+{
+	struct zoneref *zonerefs;
+
+	zonerefs = pgdat->node_zonelists[ZONELIST_FAST_FIRST]._zonerefs;
+	zonerefs = build_zonerefs_tier(zonerefs, node_order, nr_nodes, false);
+	zonerefs = build_zonerefs_tier(zonerefs, node_order, nr_nodes, true);
+	zonerefs->zone = NULL;
+	zonerefs->zone_idx = 0;
+
+	zonerefs = pgdat->node_zonelists[ZONELIST_SLOW_FIRST]._zonerefs;
+	zonerefs = build_zonerefs_tier(zonerefs, node_order, nr_nodes, true);
+	zonerefs = build_zonerefs_tier(zonerefs, node_order, nr_nodes, false);
+	zonerefs->zone = NULL;
+	zonerefs->zone_idx = 0;
+}
+
 /*
  * Build zonelists ordered by zone and nodes within zones.
  * This results in conserving DMA zone[s] until all Normal memory is
@@ -5636,6 +5887,7 @@ static void build_zonelists(pg_data_t *pgdat)
 
 	build_zonelists_in_node_order(pgdat, node_order, nr_nodes);
 	build_thisnode_zonelists(pgdat);
+	build_tier_zonelists(pgdat, node_order, nr_nodes);
 }
 
 #ifdef CONFIG_HAVE_MEMORYLESS_NODES
@@ -7767,6 +8019,7 @@ static void __setup_per_zone_wmarks(void)
 	}
 
 	for_each_zone(zone) {
+		unsigned long headroom;
 		u64 tmp;
 
 		spin_lock_irqsave(&zone->lock, flags);
@@ -7804,8 +8057,25 @@ static void __setup_per_zone_wmarks(void)
 			    mult_frac(zone_managed_pages(zone),
 				      watermark_scale_factor, 10000));
 
+		/*
+		 * The promotion headroom of a fast tier zone sits below the
+		 * min watermark of the allocations that may not use it, and
+		 * kswapd refills it along with the rest of the watermarks.
+		 */
+		headroom = 0;
+		if (promote_headroom_factor && memory_tiers_present() &&
+		    !node_is_slow_tier(zone_to_nid(zone)))
+			headroom = mult_frac(zone_managed_pages(zone),
+					     promote_headroom_factor, 10000);
+		zone->promote_headroom = headroom;
+		zone->_watermark[WMARK_MIN] += headroom;
+
 		zone->_watermark[WMARK_LOW]  = min_wmark_pages(zone) + tmp;
 		zone->_watermark[WMARK_HIGH] = min_wmark_pages(zone) + tmp * 2;
+		zone->_watermark[WMARK_DEMOTE] = demote_watermark_scale_factor ?
+			zone->_watermark[WMARK_HIGH] +
+			mult_frac(zone_managed_pages(zone),
+				  demote_watermark_scale_factor, 10000) : 0;
 		zone->watermark_boost = 0;
 
 		spin_unlock_irqrestore(&zone->lock, flags);
@@ -8321,6 +8591,34 @@ static unsigned long pfn_max_align_up(unsigned long pfn)
 				pageblock_nr_pages));
 }
 
+// Copy mode of alloc_contig_range(): 0 serial, 1 concurrent
+// multi-threaded, 2 concurrent MT+DMA
+int sysctl_contig_range_migrate = 1;
+
+/*
+ * Target pages of the pages moved out of a contiguous range of @private,
+ * the zone of the range. When the node of the range is short of free
+ * memory they go to its slow tier, if it has one, rather than pushing the
+ * node further below its watermarks.
+ */
+static struct page *alloc_contig_migrate_target(struct page *page,
+		unsigned long private)
+{
+	struct zone *zone = (struct zone *)private;
+	int nid = zone_to_nid(zone);
+	int target;
+
+	if (!zone_watermark_ok(zone, 0, high_wmark_pages(zone),
+			       zone_idx(zone), 0) &&
+	    !mem_cgroup_demotion_protected(page, true)) {
+		target = node_demotion_target(nid);
+		if (target != NUMA_NO_NODE)
+			nid = target;
+	}
+
+	return new_page_nodemask(page, nid, &node_states[N_MEMORY]);
+}
+
 /* [start, end) must belong to a single zone. */
 static int __alloc_contig_migrate_range(struct compact_control *cc,
 					unsigned long start, unsigned long end)
@@ -8330,6 +8628,13 @@ static int __alloc_contig_migrate_range(struct compact_control *cc,
 	unsigned long pfn = start;
 	unsigned int tries = 0;
 	int ret = 0;
+	int mode = READ_ONCE(sysctl_contig_range_migrate);
+	int flags = 0;
+
+	if (mode)
+		flags |= MPOL_MF_MOVE_MT | MPOL_MF_MOVE_CONCUR;
+	if (mode > 1)
+		flags |= MPOL_MF_MOVE_DMA;
 
 	migrate_prep();
 
@@ -8356,8 +8661,9 @@ static int __alloc_contig_migrate_range(struct compact_control *cc,
 							&cc->migratepages);
 		cc->nr_migratepages -= nr_reclaimed;
 
-		ret = migrate_pages(&cc->migratepages, alloc_migrate_target,
-				    NULL, 0, cc->mode, MR_CONTIG_RANGE);
+		ret = migrate_pages_flags(NULL, &cc->migratepages,
+				alloc_contig_migrate_target, NULL,
+				(unsigned long)cc->zone, flags, MR_CONTIG_RANGE);
 	}
 	if (ret < 0) {
 		putback_movable_pages(&cc->migratepages);
@@ -0,0 +1,184 @@
+/*
+ * Page cache on the slow tier.
+ *
+ * __page_cache_alloc() puts the page cache of every file on the local node,
+ * so a backup or a scan streaming through files fills DRAM with pages read
+ * once. The page cache of a file can be placed on the nearest slow tier
+ * node instead, with the Linux specific fadvise() advices:
+ *
+ *	POSIX_FADV_SLOW_TIER		all the page cache of the file
+ *	POSIX_FADV_SLOW_TIER_READAHEAD	the pages the readahead allocates
+ *	POSIX_FADV_ANY_TIER		back to the local node
+ *
+ * The advice applies to the inode, not to the open file. Setting
+ * vm.page_cache_readahead_slow_tier places the readahead pages of all files
+ * on the slow tier. The allocation falls back to the local node rather than
+ * reclaiming on the slow tier node, and the pages the readahead allocates
+ * include the page a sync readahead was started for.
+ *
+ * With vm.page_cache_promote set, a page cache page on a slow tier node
+ * that mark_page_accessed() activates, its second access while inactive,
+ * is queued for promotion to the nearest fast tier node. The queue of a
+ * node holds references, not isolated pages, as mark_page_accessed() may
+ * run with interrupts off, and is drained by a work item that isolates
+ * and migrates the pages. Pages accessed when the queue is full are left
+ * where they are.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/cpuset.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/migrate.h>
+#include <linux/mm_inline.h>
+#include <linux/memory_tier.h>
+
+#include "internal.h"
+
+// Place the readahead pages of all files on the slow tier
+int sysctl_page_cache_readahead_slow_tier = 0;
+// Promote the slow tier page cache pages mark_page_accessed() activates
+int sysctl_page_cache_promote = 0;
+
+/*
+ * Node for a new page cache page of @mapping, the nearest slow tier node
+ * when the file or @readahead asks for it, NUMA_NO_NODE for the default
+ * placement.
+ */
+int page_cache_tier_node(struct address_space *mapping, bool readahead)
+{
+	int nid;
+
+	if (!memory_tiers_present())
+		return NUMA_NO_NODE;
+
+	if (!test_bit(AS_SLOW_TIER, &mapping->flags) &&
+	    !(readahead && (test_bit(AS_SLOW_TIER_READAHEAD, &mapping->flags) ||
+			    READ_ONCE(sysctl_page_cache_readahead_slow_tier))))
+		return NUMA_NO_NODE;
+
+	nid = numa_mem_id();
+	if (!node_is_slow_tier(nid))
+		nid = node_demotion_target(nid);
+	if (nid == NUMA_NO_NODE || !cpuset_node_allowed(nid, GFP_KERNEL))
+		return NUMA_NO_NODE;
+
+	return nid;
+}
+
+#ifdef CONFIG_MIGRATION
+/* pages queued for promotion per fast tier node */
+#define PAGE_CACHE_PROMOTE_BATCH	64
+
+struct page_cache_promote_queue {
+	spinlock_t lock;
+	int nr;
+	struct page *pages[PAGE_CACHE_PROMOTE_BATCH];
+	struct work_struct work;
+};
+
+static struct page_cache_promote_queue page_cache_promote_queues[MAX_NUMNODES];
+
+static void page_cache_promote_work_fn(struct work_struct *work)
+{
+	struct page_cache_promote_queue *queue = container_of(work,
+			struct page_cache_promote_queue, work);
+	int nid = queue - page_cache_promote_queues;
+	struct page *pages[PAGE_CACHE_PROMOTE_BATCH];
+	unsigned long nr_isolated = 0, nr_failed = 0;
+	struct page *page;
+	LIST_HEAD(list);
+	int i, nr;
+
+	spin_lock_irq(&queue->lock);
+	nr = queue->nr;
+	memcpy(pages, queue->pages, nr * sizeof(pages[0]));
+	queue->nr = 0;
+	spin_unlock_irq(&queue->lock);
+
+	for (i = 0; i < nr; i++) {
+		page = pages[i];
+		/* truncated, or promoted by someone else since */
+		if (page->mapping && node_is_slow_tier(page_to_nid(page)) &&
+		    !isolate_lru_page(page)) {
+			mod_node_page_state(page_pgdat(page),
+					NR_ISOLATED_ANON + page_is_file_cache(page),
+					hpage_nr_pages(page));
+			list_add_tail(&page->lru, &list);
+			nr_isolated += hpage_nr_pages(page);
+		}
+		put_page(page);
+	}
+
+	if (list_empty(&list))
+		return;
+
+	migrate_pages(&list, alloc_new_node_page, NULL, nid, MIGRATE_ASYNC,
+			MR_NUMA_MISPLACED);
+
+	list_for_each_entry(page, &list, lru)
+		nr_failed += hpage_nr_pages(page);
+	if (!list_empty(&list))
+		putback_movable_pages(&list);
+
+	count_vm_events(PGMIGRATE_PAGE_CACHE_PROMOTE, nr_isolated - nr_failed);
+}
+
+/*
+ * Called by mark_page_accessed() when it activates the page cache page
+ * @page: queue it for promotion if it is on the slow tier.
+ */
+void page_cache_tier_accessed(struct page *page)
+{
+	struct page_cache_promote_queue *queue;
+	unsigned long flags;
+	int nid, target;
+	bool first;
+
+	if (!READ_ONCE(sysctl_page_cache_promote))
+		return;
+
+	nid = page_to_nid(page);
+	if (!node_is_slow_tier(nid) || !page_mapping(page) ||
+	    PageUnevictable(page))
+		return;
+
+	target = node_promotion_target(nid);
+	if (target == NUMA_NO_NODE)
+		return;
+
+	queue = &page_cache_promote_queues[target];
+	if (READ_ONCE(queue->nr) >= PAGE_CACHE_PROMOTE_BATCH)
+		return;
+
+	spin_lock_irqsave(&queue->lock, flags);
+	if (queue->nr >= PAGE_CACHE_PROMOTE_BATCH) {
+		spin_unlock_irqrestore(&queue->lock, flags);
+		return;
+	}
+	get_page(page);
+	queue->pages[queue->nr++] = page;
+	first = queue->nr == 1;
+	spin_unlock_irqrestore(&queue->lock, flags);
+
+	if (first)
+		queue_work_node(target, system_unbound_wq, &queue->work);
+}
+
+static int __init page_cache_tier_init(void)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		spin_lock_init(&page_cache_promote_queues[nid].lock);
+		INIT_WORK(&page_cache_promote_queues[nid].work,
+			  page_cache_promote_work_fn);
+	}
+
+	return 0;
+}
+core_initcall(page_cache_tier_init);
+#endif /* CONFIG_MIGRATION */
@@ -8,6 +8,8 @@
 #include <linux/kmemleak.h>
 #include <linux/page_owner.h>
 #include <linux/page_idle.h>
+#include <linux/access_scan.h>
+#include <linux/migrate_history.h>
 
 /*
  * struct page extension
@@ -65,6 +67,12 @@ static struct page_ext_operations *page_ext_ops[] = {
 #if defined(CONFIG_IDLE_PAGE_TRACKING) && !defined(CONFIG_64BIT)
 	&page_idle_ops,
 #endif
+#ifdef CONFIG_PAGE_ACCESS_SCAN
+	&page_access_ops,
+#endif
+#ifdef CONFIG_PAGE_MIGRATE_HISTORY
+	&page_migrate_history_ops,
+#endif
 };
 
 unsigned long page_ext_size = sizeof(struct page_ext);
@@ -0,0 +1,283 @@
+/*
+ * Page tables on the fast tier.
+ *
+ * The page tables, VMAs and anon_vmas of a task are allocated under its
+ * mempolicy like its data, so a task bound to a PMEM node walks its page
+ * tables in PMEM and every page fault, remove_migration_ptes() and
+ * rmap_walk() touches slow memory. With vm.pgtable_fast_tier set they are
+ * allocated on the home node of the task instead, the NUMA balancing
+ * preferred node or else the local one, or the nearest fast tier node when
+ * that is a slow tier node.
+ *
+ * When the home node of a task changes, the next NUMA balancing scan of
+ * its mm moves the PTE tables that are elsewhere to the new home node.
+ * The PMD and upper level tables, one per GB and more, stay where they
+ * are, and so do the PTE tables shared between VMAs.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/jiffies.h>
+#include <linux/mmu_notifier.h>
+#include <linux/pagewalk.h>
+#include <linux/rmap.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/memory_tier.h>
+#include <asm/pgalloc.h>
+#include <asm/tlb.h>
+
+#include "internal.h"
+
+// Allocate page tables and mm metadata on the fast tier home node
+int sysctl_pgtable_fast_tier = 0;
+
+/* Node for the page tables of the current task, NUMA_NO_NODE for any */
+int pgtable_tier_node(void)
+{
+	int nid = numa_mem_id();
+
+	if (!READ_ONCE(sysctl_pgtable_fast_tier) || !memory_tiers_present())
+		return NUMA_NO_NODE;
+
+#ifdef CONFIG_NUMA_BALANCING
+	if (current->numa_preferred_nid != NUMA_NO_NODE)
+		nid = current->numa_preferred_nid;
+#endif
+	if (node_is_slow_tier(nid))
+		nid = node_promotion_target(nid);
+
+	return nid;
+}
+
+#ifdef CONFIG_NUMA_BALANCING
+/* how often the page tables of an mm may follow its home node */
+#define PGTABLE_TIER_MOVE_INTERVAL	(10 * HZ)
+/* PTE tables moved per TLB flush */
+#define PGTABLE_TIER_BATCH		16
+/* address range moved per hold of the rmap locks */
+#define PGTABLE_TIER_CHUNK		(PGTABLE_TIER_BATCH * PMD_SIZE)
+
+struct pgtable_tier_walk {
+	struct mmu_gather tlb;
+	int nid;
+	int nr;
+	/* tables on @nid allocated before the rmap locks are taken */
+	int nr_spare;
+	pgtable_t spare[PGTABLE_TIER_BATCH];
+	struct {
+		pmd_t *pmd;
+		unsigned long addr;
+		pgtable_t old;
+	} moved[PGTABLE_TIER_BATCH];
+};
+
+/*
+ * Flush the TLB entries of the PTE tables moved, carry over the dirty and
+ * accessed bits the hardware set in the old tables since they were copied
+ * and free the old tables.
+ */
+static void pgtable_tier_flush(struct vm_area_struct *vma,
+		struct pgtable_tier_walk *pw)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct mmu_gather *tlb = &pw->tlb;
+	unsigned long start, end;
+	pte_t *old_pte, *pte;
+	spinlock_t *ptl;
+	int i, j;
+
+	if (!pw->nr)
+		return;
+
+	start = pw->moved[0].addr;
+	end = pw->moved[pw->nr - 1].addr + PMD_SIZE;
+	flush_tlb_range(vma, start, end);
+	mmu_notifier_invalidate_range(mm, start, end);
+
+	for (i = 0; i < pw->nr; i++) {
+		old_pte = kmap_atomic(pw->moved[i].old);
+		pte = pte_offset_map_lock(mm, pw->moved[i].pmd,
+					  pw->moved[i].addr, &ptl);
+		for (j = 0; j < PTRS_PER_PTE; j++) {
+			pte_t entry = pte[j];
+
+			if (!pte_present(old_pte[j]) || !pte_present(entry))
+				continue;
+			if (pte_dirty(old_pte[j]))
+				entry = pte_mkdirty(entry);
+			if (pte_young(old_pte[j]))
+				entry = pte_mkyoung(entry);
+			if (!pte_same(entry, pte[j]))
+				set_pte_at(mm, pw->moved[i].addr + j * PAGE_SIZE,
+					   pte + j, entry);
+		}
+		pte_unmap_unlock(pte, ptl);
+		kunmap_atomic(old_pte);
+
+		pte_free_tlb(tlb, pw->moved[i].old, pw->moved[i].addr);
+	}
+
+	count_vm_events(PGTABLE_MIGRATE, pw->nr);
+	pw->nr = 0;
+}
+
+static int pgtable_tier_pmd_entry(pmd_t *pmd, unsigned long addr,
+		unsigned long next, struct mm_walk *walk)
+{
+	struct pgtable_tier_walk *pw = walk->private;
+	struct vm_area_struct *vma = walk->vma;
+	struct mm_struct *mm = walk->mm;
+	spinlock_t *pml, *ptl;
+	pgtable_t old, new;
+
+	walk->action = ACTION_CONTINUE;
+
+	/* a PTE table shared with another VMA is left alone */
+	addr &= PMD_MASK;
+	if (addr < vma->vm_start || addr + PMD_SIZE > vma->vm_end)
+		return 0;
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
+	if (page_to_nid(pmd_pgtable(*pmd)) == pw->nid)
+		return 0;
+
+	if (!pw->nr_spare)
+		return 0;
+	new = pw->spare[--pw->nr_spare];
+
+	pml = pmd_lock(mm, pmd);
+	ptl = pte_lockptr(mm, pmd);
+	if (ptl != pml)
+		spin_lock_nested(ptl, SINGLE_DEPTH_NESTING);
+	old = pmd_pgtable(*pmd);
+	copy_highpage(new, old);
+	/* the copy is visible before the table, as in __pte_alloc() */
+	smp_wmb();
+	pmd_populate(mm, pmd, new);
+	if (ptl != pml)
+		spin_unlock(ptl);
+	spin_unlock(pml);
+
+	pw->moved[pw->nr].pmd = pmd;
+	pw->moved[pw->nr].addr = addr;
+	pw->moved[pw->nr].old = old;
+	if (++pw->nr == PGTABLE_TIER_BATCH)
+		pgtable_tier_flush(vma, pw);
+
+	return 0;
+}
+
+static const struct mm_walk_ops pgtable_tier_walk_ops = {
+	.pmd_entry	= pgtable_tier_pmd_entry,
+};
+
+/*
+ * Allocate the tables a chunk may need before the rmap locks are taken:
+ * reclaim under them would walk the rmap of our own pages and block on
+ * the locks we hold. Those left unused are kept for the next chunk.
+ */
+static void pgtable_tier_refill(struct pgtable_tier_walk *pw)
+{
+	pgtable_t new;
+
+	while (pw->nr_spare < PGTABLE_TIER_BATCH) {
+		new = alloc_pages_node(pw->nid, GFP_PGTABLE_USER |
+				       __GFP_THISNODE | __GFP_NOWARN, 0);
+		if (!new)
+			return;
+		if (!pgtable_pte_page_ctor(new)) {
+			__free_page(new);
+			return;
+		}
+		pw->spare[pw->nr_spare++] = new;
+	}
+}
+
+/*
+ * Move the PTE tables of @vma to @pw->nid, PGTABLE_TIER_CHUNK at a time.
+ * The rmap locks keep the rmap walkers, which do not take mmap_sem, off
+ * the tables being moved, and the secondary MMUs are told about each
+ * chunk as about any other change of the page tables.
+ */
+static void pgtable_tier_move_vma(struct vm_area_struct *vma,
+		struct pgtable_tier_walk *pw)
+{
+	struct address_space *mapping = vma->vm_file ?
+		vma->vm_file->f_mapping : NULL;
+	struct mmu_notifier_range range;
+	unsigned long start, end;
+
+	if (is_vm_hugetlb_page(vma) || (vma->vm_flags & (VM_PFNMAP | VM_IO)))
+		return;
+
+	for (start = vma->vm_start; start < vma->vm_end; start = end) {
+		end = min(ALIGN(start + 1, PGTABLE_TIER_CHUNK), vma->vm_end);
+
+		pgtable_tier_refill(pw);
+		mmu_notifier_range_init(&range, MMU_NOTIFY_CLEAR, 0, vma,
+					vma->vm_mm, start, end);
+		mmu_notifier_invalidate_range_start(&range);
+		if (mapping)
+			i_mmap_lock_write(mapping);
+		if (vma->anon_vma)
+			anon_vma_lock_write(vma->anon_vma);
+
+		tlb_gather_mmu(&pw->tlb, vma->vm_mm, start, end);
+		walk_page_range(vma->vm_mm, start, end,
+				&pgtable_tier_walk_ops, pw);
+		pgtable_tier_flush(vma, pw);
+		tlb_finish_mmu(&pw->tlb, start, end);
+
+		if (vma->anon_vma)
+			anon_vma_unlock_write(vma->anon_vma);
+		if (mapping)
+			i_mmap_unlock_write(mapping);
+		mmu_notifier_invalidate_range_end(&range);
+
+		cond_resched();
+	}
+}
+
+/*
+ * Called from the NUMA balancing scan of @mm: when the home node of the
+ * current task has changed, move the PTE tables of @mm to it.
+ */
+void pgtable_tier_update(struct mm_struct *mm)
+{
+	int nid = pgtable_tier_node();
+	int old = READ_ONCE(mm->pgtable_nid);
+	struct pgtable_tier_walk *pw;
+	struct vm_area_struct *vma;
+
+	if (nid == NUMA_NO_NODE || nid == old)
+		return;
+	/* the first home node seen is where the tables were allocated */
+	if (old != NUMA_NO_NODE &&
+	    time_before(jiffies, READ_ONCE(mm->pgtable_next_move)))
+		return;
+	if (cmpxchg(&mm->pgtable_nid, old, nid) != old || old == NUMA_NO_NODE)
+		return;
+
+	pw = kmalloc(sizeof(*pw), GFP_KERNEL);
+	if (!pw || !down_write_trylock(&mm->mmap_sem)) {
+		/* try again on the next scan */
+		kfree(pw);
+		WRITE_ONCE(mm->pgtable_nid, old);
+		return;
+	}
+
+	pw->nid = nid;
+	pw->nr = 0;
+	pw->nr_spare = 0;
+	for (vma = mm->mmap; vma; vma = vma->vm_next)
+		pgtable_tier_move_vma(vma, pw);
+	WRITE_ONCE(mm->pgtable_next_move, jiffies + PGTABLE_TIER_MOVE_INTERVAL);
+
+	up_write(&mm->mmap_sem);
+	while (pw->nr_spare)
+		pte_free(mm, pw->spare[--pw->nr_spare]);
+	kfree(pw);
+}
+#endif /* CONFIG_NUMA_BALANCING */
@@ -0,0 +1,589 @@
+/*
+ * PMEM topology used by RPDAA.
+ *
+ * For every PMEM (slow memory tier) NUMA node the CPU node nearest to it,
+ * and the online CPUs of that node, are precomputed into a single object.
+ * The object is rebuilt whenever the memory tier of a node changes, memory
+ * of a node comes or goes, or a CPU goes online or offline, and published
+ * with RCU, so that the copy paths only do one RCU protected pointer load.
+ *
+ * The object also holds the helper node of every (source, destination)
+ * pair: the CPU node whose copy moves the data fastest, given how fast
+ * each CPU node reads and writes each memory node. The bandwidths start
+ * as estimates from the SLIT, are measured after boot and when memory
+ * comes online, and can be set from /sys/kernel/mm/pmem_topology/bandwidth
+ * by platform tools that know better.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/memory.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/cpuhotplug.h>
+#include <linux/nodemask.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/migrate.h>
+#include <linux/memory_tier.h>
+#include <linux/workqueue.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/ktime.h>
+#include <linux/gfp.h>
+
+#include "internal.h"
+
+struct pmem_node_topology {
+	/* CPU node nearest to this PMEM node, NUMA_NO_NODE if not PMEM */
+	int cpu_node;
+	/* online CPUs of cpu_node, NULL if not PMEM */
+	struct cpumask *cpus;
+};
+
+struct pmem_topology {
+	struct rcu_head rcu;
+	/* helper of each [src * nr_node_ids + dst], NUMA_NO_NODE if none */
+	int *helper;
+	/*
+	 * nr_node_ids entries, followed by the helper table and the cpumasks
+	 * of the PMEM nodes
+	 */
+	struct pmem_node_topology node[];
+};
+
+static struct pmem_topology __rcu *pmem_topology;
+/* serializes rebuilds and bandwidth updates */
+static DEFINE_MUTEX(pmem_topology_mutex);
+
+/* MB/s of the CPUs of a node reading and writing the memory of a node */
+struct pmem_bandwidth {
+	u32 read;
+	u32 write;
+	/* set through sysfs, not overwritten by measurements */
+	bool fixed;
+};
+
+/* [cpu node * nr_node_ids + memory node], 0 if unknown */
+static struct pmem_bandwidth *pmem_bandwidth;
+
+/* bandwidth of a local access in the SLIT based estimates */
+#define PMEM_BW_ESTIMATE_LOCAL	10000
+
+static struct pmem_bandwidth *pmem_bw(int cpu_nid, int mem_nid)
+{
+	return &pmem_bandwidth[cpu_nid * nr_node_ids + mem_nid];
+}
+
+/* Nanoseconds for the CPUs of @helper to copy 1MB from @src to @dst */
+static u64 pmem_helper_cost(int helper, int src, int dst)
+{
+	struct pmem_bandwidth *r = pmem_bw(helper, src);
+	struct pmem_bandwidth *w = pmem_bw(helper, dst);
+
+	if (!r->read || !w->write)
+		return U64_MAX;
+
+	return div_u64(NSEC_PER_SEC, r->read) + div_u64(NSEC_PER_SEC, w->write);
+}
+
+/* Whether @nid has online CPUs other than @dying_cpu */
+static bool pmem_topology_node_usable(int nid, int dying_cpu)
+{
+	int cpu;
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), cpu_online_mask)
+		if (cpu != dying_cpu)
+			return true;
+
+	return false;
+}
+
+/*
+ * The helper of a copy from @src to @dst: the CPU node with online CPUs
+ * that minimizes the read time of @src plus the write time of @dst. Ties
+ * go to the RPDAA default, the socket of the PMEM side with the
+ * destination first, or for DRAM pairs the destination node.
+ */
+static int pmem_topology_helper(struct pmem_topology *topo, int src, int dst,
+		int dying_cpu)
+{
+	int best = topo->node[dst].cpu_node;
+	u64 best_cost, cost;
+	int nid;
+
+	if (best == NUMA_NO_NODE)
+		best = topo->node[src].cpu_node;
+	if (best == NUMA_NO_NODE && pmem_topology_node_usable(dst, dying_cpu))
+		best = dst;
+	if (best == NUMA_NO_NODE && pmem_topology_node_usable(src, dying_cpu))
+		best = src;
+	best_cost = best == NUMA_NO_NODE ? U64_MAX :
+		pmem_helper_cost(best, src, dst);
+
+	for_each_node_state(nid, N_CPU) {
+		if (!pmem_topology_node_usable(nid, dying_cpu))
+			continue;
+
+		cost = pmem_helper_cost(nid, src, dst);
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = nid;
+		}
+	}
+
+	return best;
+}
+
+static void pmem_topology_free_rcu(struct rcu_head *rcu)
+{
+	kvfree(container_of(rcu, struct pmem_topology, rcu));
+}
+
+/*
+ * Build and publish a new topology. @dying_cpu is a CPU on its way
+ * offline that must not be used anymore, or -1.
+ */
+static void pmem_topology_rebuild(int dying_cpu)
+{
+	struct pmem_topology *topo, *old;
+	nodemask_t pmem_nodes = NODE_MASK_NONE;
+	struct cpumask *masks;
+	int nid, cpu_nid, cpu, src, dst;
+	size_t size, helper_size;
+
+	mutex_lock(&pmem_topology_mutex);
+
+	/* tiers can change under us, size and fill from the same snapshot */
+	for (nid = 0; nid < nr_node_ids; nid++)
+		if (node_is_slow_tier(nid))
+			node_set(nid, pmem_nodes);
+
+	size = sizeof(*topo) + nr_node_ids * sizeof(topo->node[0]);
+	helper_size = ALIGN(nr_node_ids * nr_node_ids * sizeof(int),
+			sizeof(long));
+	topo = kvzalloc(size + helper_size +
+			nodes_weight(pmem_nodes) * cpumask_size(), GFP_KERNEL);
+	if (!topo) {
+		pr_err("pmem topology: rebuild failed, keeping the old one\n");
+		goto unlock;
+	}
+	topo->helper = (void *)topo + size;
+	masks = (void *)topo->helper + helper_size;
+
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		struct pmem_node_topology *pnt = &topo->node[nid];
+		/* more than the highest possible distance between two nodes */
+		int cmin = 256;
+
+		pnt->cpu_node = NUMA_NO_NODE;
+		if (!node_isset(nid, pmem_nodes))
+			continue;
+
+		pnt->cpus = masks;
+		masks = (void *)masks + cpumask_size();
+
+		for_each_node_state(cpu_nid, N_CPU) {
+			if (node_distance(nid, cpu_nid) < cmin &&
+			    pmem_topology_node_usable(cpu_nid, dying_cpu)) {
+				cmin = node_distance(nid, cpu_nid);
+				pnt->cpu_node = cpu_nid;
+			}
+		}
+		if (pnt->cpu_node == NUMA_NO_NODE)
+			continue;
+
+		cpumask_and(pnt->cpus, cpumask_of_node(pnt->cpu_node),
+				cpu_online_mask);
+		if (dying_cpu >= 0)
+			cpumask_clear_cpu(dying_cpu, pnt->cpus);
+
+		cpu = cpumask_first(pnt->cpus);
+		pr_debug("pmem topology: node %d -> node %d (cpu %d)\n",
+				nid, pnt->cpu_node, cpu);
+	}
+
+	for (src = 0; src < nr_node_ids; src++) {
+		for (dst = 0; dst < nr_node_ids; dst++) {
+			int helper = NUMA_NO_NODE;
+
+			if (pmem_bandwidth)
+				helper = pmem_topology_helper(topo, src, dst,
+						dying_cpu);
+			topo->helper[src * nr_node_ids + dst] = helper;
+		}
+	}
+
+	old = rcu_dereference_protected(pmem_topology,
+			lockdep_is_held(&pmem_topology_mutex));
+	rcu_assign_pointer(pmem_topology, topo);
+	if (old)
+		call_rcu(&old->rcu, pmem_topology_free_rcu);
+unlock:
+	mutex_unlock(&pmem_topology_mutex);
+}
+
+/* CPU node that should copy pages from @src to @dst, NUMA_NO_NODE if unknown */
+int pmem_helper_node(int src, int dst)
+{
+	struct pmem_topology *topo;
+	int helper = NUMA_NO_NODE;
+
+	if (src < 0 || src >= nr_node_ids || dst < 0 || dst >= nr_node_ids)
+		return NUMA_NO_NODE;
+
+	rcu_read_lock();
+	topo = rcu_dereference(pmem_topology);
+	if (topo)
+		helper = topo->helper[src * nr_node_ids + dst];
+	rcu_read_unlock();
+
+	return helper;
+}
+
+/* Rebuild after the memory tier of a node changed */
+void pmem_topology_update(void)
+{
+	pmem_topology_rebuild(-1);
+}
+
+/* CPU node nearest to PMEM node @nid, NUMA_NO_NODE if @nid is not PMEM */
+int pmem_nearest_node(int nid)
+{
+	struct pmem_topology *topo;
+	int cpu_node = NUMA_NO_NODE;
+
+	if (nid < 0 || nid >= nr_node_ids)
+		return NUMA_NO_NODE;
+
+	rcu_read_lock();
+	topo = rcu_dereference(pmem_topology);
+	if (topo)
+		cpu_node = topo->node[nid].cpu_node;
+	rcu_read_unlock();
+
+	return cpu_node;
+}
+
+/*
+ * Online CPUs of the node nearest to PMEM node @nid, NULL if @nid is not
+ * PMEM. Must be called under rcu_read_lock(), the mask is only valid
+ * until rcu_read_unlock().
+ */
+const struct cpumask *pmem_nearest_cpus(int nid)
+{
+	struct pmem_topology *topo;
+
+	if (nid < 0 || nid >= nr_node_ids)
+		return NULL;
+
+	topo = rcu_dereference(pmem_topology);
+	if (!topo || topo->node[nid].cpu_node == NUMA_NO_NODE)
+		return NULL;
+
+	return topo->node[nid].cpus;
+}
+
+// returns id of closest cpu to the given NUMA node
+int get_nearest_cpu_node(int node)
+{
+	const struct cpumask *cpus;
+	int cpu = -1;
+
+	rcu_read_lock();
+	cpus = pmem_nearest_cpus(node);
+	if (cpus)
+		cpu = cpumask_first(cpus);
+	rcu_read_unlock();
+
+	return cpu;
+}
+
+/* ======================== bandwidth matrix ======================== */
+
+/* memory touched per measurement, larger than the last level caches */
+#define PMEM_BW_BLOCK_ORDER	(MAX_ORDER - 1)
+#define PMEM_BW_NR_BLOCKS	8
+
+struct pmem_bw_measure {
+	int mem_nid;
+	struct pmem_bandwidth bw;
+};
+
+static u32 pmem_bw_mbps(unsigned long bytes, u64 ns)
+{
+	u64 mbps = div64_u64((u64)bytes * NSEC_PER_USEC, max_t(u64, ns, 1));
+
+	return min_t(u64, mbps, U32_MAX);
+}
+
+/* Runs on a CPU of the measured CPU node */
+static long pmem_bw_measure_fn(void *arg)
+{
+	struct pmem_bw_measure *m = arg;
+	struct page *blocks[PMEM_BW_NR_BLOCKS];
+	unsigned long block_size = PAGE_SIZE << PMEM_BW_BLOCK_ORDER;
+	unsigned long bytes = 0, i, j;
+	u64 sum = 0, start, ns;
+	int nr = 0;
+
+	for (i = 0; i < PMEM_BW_NR_BLOCKS; i++) {
+		/* PMEM is usually onlined movable */
+		blocks[nr] = alloc_pages_node(m->mem_nid, GFP_HIGHUSER_MOVABLE |
+				__GFP_THISNODE | __GFP_NOWARN | __GFP_NORETRY,
+				PMEM_BW_BLOCK_ORDER);
+		if (blocks[nr])
+			nr++;
+	}
+	if (!nr)
+		return -ENOMEM;
+	bytes = nr * block_size;
+
+	start = ktime_get_ns();
+	for (i = 0; i < nr; i++)
+		memset(page_address(blocks[i]), 0x5a, block_size);
+	ns = ktime_get_ns() - start;
+	m->bw.write = pmem_bw_mbps(bytes, ns);
+
+	start = ktime_get_ns();
+	for (i = 0; i < nr; i++) {
+		u64 *p = page_address(blocks[i]);
+
+		for (j = 0; j < block_size / sizeof(u64); j++)
+			sum += READ_ONCE(p[j]);
+	}
+	ns = ktime_get_ns() - start;
+	m->bw.read = pmem_bw_mbps(bytes, ns);
+
+	for (i = 0; i < nr; i++)
+		__free_pages(blocks[i], PMEM_BW_BLOCK_ORDER);
+
+	/* keep the read loop */
+	return sum == 1;
+}
+
+/* Measure every CPU node against memory node @mem_nid, all if NUMA_NO_NODE */
+static void pmem_bw_measure(int mem_nid)
+{
+	struct pmem_bw_measure m;
+	int cpu_nid, nid, cpu;
+
+	for_each_node_state(nid, N_MEMORY) {
+		if (mem_nid != NUMA_NO_NODE && nid != mem_nid)
+			continue;
+
+		for_each_node_state(cpu_nid, N_CPU) {
+			cpus_read_lock();
+			cpu = cpumask_any_and(cpumask_of_node(cpu_nid),
+					cpu_online_mask);
+			if (cpu >= nr_cpu_ids) {
+				cpus_read_unlock();
+				continue;
+			}
+
+			m.mem_nid = nid;
+			if (work_on_cpu(cpu, pmem_bw_measure_fn, &m) < 0) {
+				cpus_read_unlock();
+				continue;
+			}
+			cpus_read_unlock();
+
+			mutex_lock(&pmem_topology_mutex);
+			if (!pmem_bw(cpu_nid, nid)->fixed)
+				*pmem_bw(cpu_nid, nid) = m.bw;
+			mutex_unlock(&pmem_topology_mutex);
+
+			cond_resched();
+		}
+	}
+
+	pmem_topology_rebuild(-1);
+}
+
+static void pmem_bw_measure_all_fn(struct work_struct *work)
+{
+	pmem_bw_measure(NUMA_NO_NODE);
+}
+static DECLARE_WORK(pmem_bw_measure_all_work, pmem_bw_measure_all_fn);
+
+/* memory nodes whose bandwidth must be measured again */
+static nodemask_t pmem_bw_pending_nodes;
+static DEFINE_SPINLOCK(pmem_bw_pending_lock);
+
+static void pmem_bw_measure_pending_fn(struct work_struct *work)
+{
+	int nid;
+
+	for (;;) {
+		spin_lock(&pmem_bw_pending_lock);
+		nid = first_node(pmem_bw_pending_nodes);
+		if (nid < MAX_NUMNODES)
+			node_clear(nid, pmem_bw_pending_nodes);
+		spin_unlock(&pmem_bw_pending_lock);
+
+		if (nid >= MAX_NUMNODES)
+			break;
+		pmem_bw_measure(nid);
+	}
+}
+static DECLARE_WORK(pmem_bw_measure_pending_work, pmem_bw_measure_pending_fn);
+
+/* SLIT based estimates, used until the bandwidths are measured or set */
+static void __init pmem_bw_estimate(void)
+{
+	int cpu_nid, mem_nid;
+
+	for (cpu_nid = 0; cpu_nid < nr_node_ids; cpu_nid++)
+		for (mem_nid = 0; mem_nid < nr_node_ids; mem_nid++) {
+			u32 bw = PMEM_BW_ESTIMATE_LOCAL * LOCAL_DISTANCE /
+				max(node_distance(cpu_nid, mem_nid), 1);
+
+			pmem_bw(cpu_nid, mem_nid)->read = bw;
+			pmem_bw(cpu_nid, mem_nid)->write = bw;
+		}
+}
+
+/*
+ * /sys/kernel/mm/pmem_topology/bandwidth: one "cpu_node mem_node read
+ * write" line per pair of online nodes, in MB/s. Writing such a line
+ * overrides the bandwidths of that pair.
+ */
+static ssize_t bandwidth_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	int cpu_nid, mem_nid;
+	ssize_t len = 0;
+
+	mutex_lock(&pmem_topology_mutex);
+	for_each_node_state(cpu_nid, N_CPU)
+		for_each_node_state(mem_nid, N_MEMORY)
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					"%d %d %u %u\n", cpu_nid, mem_nid,
+					pmem_bw(cpu_nid, mem_nid)->read,
+					pmem_bw(cpu_nid, mem_nid)->write);
+	mutex_unlock(&pmem_topology_mutex);
+
+	return len;
+}
+
+static ssize_t bandwidth_store(struct kobject *kobj,
+		struct kobj_attribute *attr, const char *buf, size_t count)
+{
+	int cpu_nid, mem_nid;
+	u32 read, write;
+
+	if (sscanf(buf, "%d %d %u %u", &cpu_nid, &mem_nid, &read, &write) != 4)
+		return -EINVAL;
+	if (cpu_nid < 0 || cpu_nid >= nr_node_ids ||
+	    mem_nid < 0 || mem_nid >= nr_node_ids)
+		return -EINVAL;
+
+	mutex_lock(&pmem_topology_mutex);
+	pmem_bw(cpu_nid, mem_nid)->read = read;
+	pmem_bw(cpu_nid, mem_nid)->write = write;
+	pmem_bw(cpu_nid, mem_nid)->fixed = true;
+	mutex_unlock(&pmem_topology_mutex);
+
+	pmem_topology_rebuild(-1);
+
+	return count;
+}
+static struct kobj_attribute bandwidth_attr = __ATTR_RW(bandwidth);
+
+/* /sys/kernel/mm/pmem_topology/helpers: "src dst helper" per node pair */
+static ssize_t helpers_show(struct kobject *kobj,
+		struct kobj_attribute *attr, char *buf)
+{
+	int src, dst;
+	ssize_t len = 0;
+
+	for_each_node_state(src, N_MEMORY)
+		for_each_node_state(dst, N_MEMORY)
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					"%d %d %d\n", src, dst,
+					pmem_helper_node(src, dst));
+
+	return len;
+}
+static struct kobj_attribute helpers_attr = __ATTR_RO(helpers);
+
+static struct attribute *pmem_topology_attrs[] = {
+	&bandwidth_attr.attr,
+	&helpers_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group pmem_topology_attr_group = {
+	.attrs = pmem_topology_attrs,
+};
+
+static int pmem_topology_memory_callback(struct notifier_block *self,
+		unsigned long action, void *arg)
+{
+	struct memory_notify *mn = arg;
+
+	if ((action == MEM_ONLINE || action == MEM_OFFLINE) &&
+	    mn->status_change_nid >= 0)
+		pmem_topology_rebuild(-1);
+
+	/* no bandwidth matrix to measure into if its allocation failed */
+	if (action == MEM_ONLINE && mn->status_change_nid >= 0 &&
+	    pmem_bandwidth) {
+		spin_lock(&pmem_bw_pending_lock);
+		node_set(mn->status_change_nid, pmem_bw_pending_nodes);
+		spin_unlock(&pmem_bw_pending_lock);
+		queue_work(system_unbound_wq, &pmem_bw_measure_pending_work);
+	}
+
+	return NOTIFY_OK;
+}
+
+static int pmem_topology_cpu_online(unsigned int cpu)
+{
+	pmem_topology_rebuild(-1);
+	return 0;
+}
+
+static int pmem_topology_cpu_offline(unsigned int cpu)
+{
+	pmem_topology_rebuild(cpu);
+	return 0;
+}
+
+static int __init pmem_topology_init(void)
+{
+	int ret;
+
+	pmem_bandwidth = kvcalloc(nr_node_ids * nr_node_ids,
+			sizeof(*pmem_bandwidth), GFP_KERNEL);
+	if (pmem_bandwidth)
+		pmem_bw_estimate();
+
+	pmem_topology_rebuild(-1);
+
+	hotplug_memory_notifier(pmem_topology_memory_callback, 0);
+
+	ret = cpuhp_setup_state_nocalls(CPUHP_AP_ONLINE_DYN,
+			"mm/pmem_topology:online", pmem_topology_cpu_online,
+			pmem_topology_cpu_offline);
+	if (ret < 0)
+		pr_err("pmem topology: CPU hotplug callbacks not registered\n");
+
+	return 0;
+}
+subsys_initcall(pmem_topology_init);
+
+static int __init pmem_topology_late_init(void)
+{
+	if (!pmem_bandwidth)
+		return 0;
+
+	mm_sysfs_add_group("pmem_topology", &pmem_topology_attr_group);
+
+	queue_work(system_unbound_wq, &pmem_bw_measure_all_work);
+
+	return 0;
+}
+late_initcall(pmem_topology_late_init);
@@ -0,0 +1,208 @@
+/*
+ * PMEM writer concurrency limits.
+ *
+ * The write bandwidth of Optane DIMMs peaks with a handful of writers and
+ * collapses well below that peak when many threads write to the same
+ * DIMMs at once. Each mm_manage(), move_pages() or demotion sizes its copy
+ * on its own, so a few of them running together easily end up with
+ * several times the writers the node does best with. The copy engines
+ * therefore take their writers out of a budget per slow tier node: a
+ * multi-threaded copy or exchange one slot per worker thread, a DMA copy
+ * one per channel and the pmem block driver one per write bio.
+ *
+ * A copy asks for as many slots as it would like to use and gets what is
+ * free, at least one, waiting for a slot to be freed when there is none.
+ * Copies that must not block, the asynchronous starts of the migration
+ * pipeline, get one slot even when the node is over its budget. Their
+ * slots are only given back once the copy is waited for, so a waiter that
+ * holds such slots itself would never see them freed: nobody waits longer
+ * than PMEM_WRITERS_MAX_WAIT, then goes over the budget by one slot.
+ *
+ * The budget of a node is set in /sys/kernel/mm/pmem_writers/nodes and
+ * defaults to vm.pmem_writer_limit, 0 for no limit. Fast tier nodes are
+ * never limited, their writers are only counted.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/nodemask.h>
+#include <linux/jiffies.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/export.h>
+#include <linux/memory_tier.h>
+#include <linux/pmem_writers.h>
+
+#include "internal.h"
+
+// Concurrent writers of a slow tier node without a limit of its own
+int sysctl_pmem_writer_limit = 0;
+
+struct pmem_writers {
+	spinlock_t lock;
+	int active;
+	int limit;		/* 0 for sysctl_pmem_writer_limit */
+	unsigned long nr_waits;
+	wait_queue_head_t wait;
+};
+
+static struct pmem_writers pmem_writers[MAX_NUMNODES];
+
+/* longest wait for a slot */
+#define PMEM_WRITERS_MAX_WAIT	(HZ / 10)
+
+static int pmem_writers_limit(int nid)
+{
+	int limit;
+
+	if (!node_is_slow_tier(nid))
+		return 0;
+
+	limit = READ_ONCE(pmem_writers[nid].limit);
+
+	return limit ? limit : READ_ONCE(sysctl_pmem_writer_limit);
+}
+
+/* Slots free on @pw under @limit */
+static int pmem_writers_free(struct pmem_writers *pw, int limit)
+{
+	return !limit ? INT_MAX : limit - READ_ONCE(pw->active);
+}
+
+/*
+ * Take up to @nr writer slots of @nid, waiting up to PMEM_WRITERS_MAX_WAIT
+ * for one to be freed if there is none and @wait is set. Returns the
+ * number of slots taken, from 1 to @nr, to be given back with
+ * pmem_writers_put(), or 0 for no slot at all if @nr is not positive.
+ */
+int pmem_writers_get(int nid, int nr, bool wait)
+{
+	unsigned long deadline = jiffies + PMEM_WRITERS_MAX_WAIT;
+	struct pmem_writers *pw;
+	bool waited = false;
+	long timeout;
+	int got;
+
+	if (WARN_ON_ONCE(nr <= 0))
+		return 0;
+	if (nid < 0 || nid >= MAX_NUMNODES)
+		return nr;
+
+	pw = &pmem_writers[nid];
+
+	spin_lock(&pw->lock);
+	for (;;) {
+		got = min(nr, pmem_writers_free(pw, pmem_writers_limit(nid)));
+		timeout = (long)(deadline - jiffies);
+		if (got > 0 || !wait || timeout <= 0) {
+			got = max(got, 1);
+			break;
+		}
+
+		if (!waited)
+			pw->nr_waits++;
+		waited = true;
+		spin_unlock(&pw->lock);
+		wait_event_timeout(pw->wait, pmem_writers_free(pw,
+					pmem_writers_limit(nid)) > 0, timeout);
+		spin_lock(&pw->lock);
+	}
+	pw->active += got;
+	spin_unlock(&pw->lock);
+
+	return got;
+}
+EXPORT_SYMBOL_GPL(pmem_writers_get);
+
+/* Give back @nr slots taken from @nid by pmem_writers_get() */
+void pmem_writers_put(int nid, int nr)
+{
+	struct pmem_writers *pw;
+
+	if (nid < 0 || nid >= MAX_NUMNODES || nr <= 0)
+		return;
+
+	pw = &pmem_writers[nid];
+
+	spin_lock(&pw->lock);
+	pw->active -= nr;
+	spin_unlock(&pw->lock);
+
+	if (wq_has_sleeper(&pw->wait))
+		wake_up(&pw->wait);
+}
+EXPORT_SYMBOL_GPL(pmem_writers_put);
+
+/*
+ * /sys/kernel/mm/pmem_writers/nodes: one "node limit active waits" line
+ * per memory node, a limit of 0 following vm.pmem_writer_limit. Writing
+ * "node limit" sets the limit of a node.
+ */
+static ssize_t nodes_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct pmem_writers *pw;
+	ssize_t len = 0;
+	int nid;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			"node limit active waits\n");
+
+	for_each_node_state(nid, N_MEMORY) {
+		pw = &pmem_writers[nid];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"%d %d %d %lu\n", nid,
+				READ_ONCE(pw->limit),
+				READ_ONCE(pw->active),
+				READ_ONCE(pw->nr_waits));
+	}
+
+	return len;
+}
+
+static ssize_t nodes_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	int nid, limit;
+
+	if (sscanf(buf, "%d %d", &nid, &limit) != 2)
+		return -EINVAL;
+	if (nid < 0 || nid >= MAX_NUMNODES || !node_state(nid, N_MEMORY) ||
+	    limit < 0)
+		return -EINVAL;
+
+	WRITE_ONCE(pmem_writers[nid].limit, limit);
+	/* a higher limit lets the waiters in */
+	wake_up(&pmem_writers[nid].wait);
+
+	return count;
+}
+static struct kobj_attribute nodes_attr = __ATTR_RW(nodes);
+
+static struct attribute *pmem_writers_attrs[] = {
+	&nodes_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group pmem_writers_attr_group = {
+	.attrs = pmem_writers_attrs,
+};
+
+static int __init pmem_writers_init(void)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		spin_lock_init(&pmem_writers[nid].lock);
+		init_waitqueue_head(&pmem_writers[nid].wait);
+	}
+
+	mm_sysfs_add_group("pmem_writers", &pmem_writers_attr_group);
+
+	return 0;
+}
+subsys_initcall(pmem_writers_init);
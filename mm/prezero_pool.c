@@ -0,0 +1,282 @@
+/*
+ * Pre-zeroed THP pools.
+ *
+ * A THP fault zeroes 2MB before it returns, and a demotion allocates a
+ * 2MB target page before it copies, both on the critical path. On a PMEM
+ * node the zeroing is also a burst of writes from whatever CPU faulted.
+ * Each node can keep a pool of THPs zeroed ahead of time, which the THP
+ * fault path and alloc_new_node_page() take from first.
+ *
+ * The pool of a node is refilled by a SCHED_IDLE kthread running on the
+ * CPUs of the node, or of the socket nearest to it for CPU-less PMEM
+ * nodes, which zeroes the pages with streaming stores. It only takes free
+ * huge pages, it never reclaims or compacts for them.
+ *
+ * The size of each pool is set in /sys/kernel/mm/prezero_pool/nodes, in
+ * THPs, 0 (the default) for no pool.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/huge_mm.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/nodemask.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/migrate.h>
+#include <linux/cpuset.h>
+#include <linux/mempolicy.h>
+#include <uapi/linux/sched/types.h>
+
+#include "internal.h"
+
+struct prezero_pool {
+	spinlock_t lock;
+	struct list_head pages;
+	int nr_pages;
+	int target;
+	unsigned long nr_hits;
+	unsigned long nr_misses;
+	struct task_struct *task;
+	wait_queue_head_t wait;
+};
+
+static struct prezero_pool prezero_pools[MAX_NUMNODES];
+/* serializes the pool size changes and the kthread creation */
+static DEFINE_MUTEX(prezero_pool_mutex);
+
+static bool prezero_pool_short(struct prezero_pool *pool)
+{
+	return READ_ONCE(pool->nr_pages) < READ_ONCE(pool->target);
+}
+
+/*
+ * Whether current may have a page of @nid: the pool is taken from before
+ * the page allocator, which checks the cpuset and the mempolicy itself.
+ */
+static bool prezero_pool_allowed(int nid)
+{
+#ifdef CONFIG_NUMA
+	nodemask_t mask = nodemask_of_node(nid);
+
+	if (!mempolicy_nodemask_intersects(current, &mask))
+		return false;
+#endif
+	return cpuset_node_allowed(nid, GFP_TRANSHUGE);
+}
+
+/* A zeroed THP of @nid, NULL if the pool of @nid is empty */
+struct page *prezero_pool_get(int nid)
+{
+	struct prezero_pool *pool;
+	struct page *page = NULL;
+
+	if (nid < 0 || nid >= MAX_NUMNODES)
+		return NULL;
+
+	pool = &prezero_pools[nid];
+	if (!READ_ONCE(pool->target) || !prezero_pool_allowed(nid))
+		return NULL;
+
+	spin_lock(&pool->lock);
+	if (!list_empty(&pool->pages)) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_del(&page->lru);
+		pool->nr_pages--;
+		pool->nr_hits++;
+	} else {
+		pool->nr_misses++;
+	}
+	spin_unlock(&pool->lock);
+
+	if (prezero_pool_short(pool))
+		wake_up(&pool->wait);
+
+	return page;
+}
+
+/* The node whose CPUs zero the pages of @nid */
+static int prezero_pool_cpu_node(int nid)
+{
+	if (node_state(nid, N_CPU))
+		return nid;
+#ifdef CONFIG_MIGRATION
+	return pmem_nearest_node(nid);
+#else
+	return NUMA_NO_NODE;
+#endif
+}
+
+/* THPs allocated per refill round */
+#define PREZERO_POOL_BATCH	16
+
+static int prezero_pool_fn(void *data)
+{
+	struct prezero_pool *pool = data;
+	int nid = pool - prezero_pools;
+	struct sched_param param = { .sched_priority = 0 };
+	struct page *page, *next;
+	LIST_HEAD(pages);
+	int nr;
+
+	sched_setscheduler_nocheck(current, SCHED_IDLE, &param);
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		wait_event_freezable(pool->wait,
+				prezero_pool_short(pool) || kthread_should_stop());
+
+		while (prezero_pool_short(pool) && !kthread_should_stop()) {
+			nr = min(READ_ONCE(pool->target) -
+				 READ_ONCE(pool->nr_pages), PREZERO_POOL_BATCH);
+			if (!alloc_pages_bulk_node(nid, GFP_TRANSHUGE_LIGHT,
+					HPAGE_PMD_ORDER, nr, &pages)) {
+				/* retry once memory has been freed */
+				schedule_timeout_interruptible(HZ);
+				continue;
+			}
+
+			list_for_each_entry_safe(page, next, &pages, lru) {
+				list_del(&page->lru);
+				prep_transhuge_page(page);
+				clear_pages_nt(page, HPAGE_PMD_NR);
+
+				spin_lock(&pool->lock);
+				list_add(&page->lru, &pool->pages);
+				pool->nr_pages++;
+				spin_unlock(&pool->lock);
+
+				cond_resched();
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Free what @pool holds beyond its target */
+static void prezero_pool_trim(struct prezero_pool *pool)
+{
+	struct page *page, *next;
+	LIST_HEAD(pages);
+
+	spin_lock(&pool->lock);
+	while (pool->nr_pages > pool->target) {
+		page = list_first_entry(&pool->pages, struct page, lru);
+		list_move(&page->lru, &pages);
+		pool->nr_pages--;
+	}
+	spin_unlock(&pool->lock);
+
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del(&page->lru);
+		put_page(page);
+	}
+}
+
+static int prezero_pool_resize(int nid, int target)
+{
+	struct prezero_pool *pool = &prezero_pools[nid];
+	struct task_struct *task;
+	int cpu_nid;
+
+	mutex_lock(&prezero_pool_mutex);
+	if (target && !pool->task) {
+		task = kthread_create_on_node(prezero_pool_fn, pool, nid,
+				"kprezerod/%d", nid);
+		if (IS_ERR(task)) {
+			mutex_unlock(&prezero_pool_mutex);
+			return PTR_ERR(task);
+		}
+		cpu_nid = prezero_pool_cpu_node(nid);
+		if (cpu_nid != NUMA_NO_NODE)
+			set_cpus_allowed_ptr(task, cpumask_of_node(cpu_nid));
+		pool->task = task;
+		wake_up_process(task);
+	}
+
+	WRITE_ONCE(pool->target, target);
+	prezero_pool_trim(pool);
+	wake_up(&pool->wait);
+	mutex_unlock(&prezero_pool_mutex);
+
+	return 0;
+}
+
+/*
+ * /sys/kernel/mm/prezero_pool/nodes: one "node target pages hits misses"
+ * line per memory node, the sizes in THPs. Writing "node target" sets the
+ * size of the pool of a node.
+ */
+static ssize_t nodes_show(struct kobject *kobj, struct kobj_attribute *attr,
+		char *buf)
+{
+	struct prezero_pool *pool;
+	ssize_t len = 0;
+	int nid;
+
+	len += scnprintf(buf + len, PAGE_SIZE - len,
+			"node target pages hits misses\n");
+
+	for_each_node_state(nid, N_MEMORY) {
+		pool = &prezero_pools[nid];
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				"%d %d %d %lu %lu\n", nid,
+				READ_ONCE(pool->target),
+				READ_ONCE(pool->nr_pages),
+				READ_ONCE(pool->nr_hits),
+				READ_ONCE(pool->nr_misses));
+	}
+
+	return len;
+}
+
+static ssize_t nodes_store(struct kobject *kobj, struct kobj_attribute *attr,
+		const char *buf, size_t count)
+{
+	int nid, target, err;
+
+	if (sscanf(buf, "%d %d", &nid, &target) != 2)
+		return -EINVAL;
+	if (nid < 0 || nid >= MAX_NUMNODES || !node_state(nid, N_MEMORY) ||
+	    target < 0)
+		return -EINVAL;
+
+	err = prezero_pool_resize(nid, target);
+
+	return err ? err : count;
+}
+static struct kobj_attribute nodes_attr = __ATTR_RW(nodes);
+
+static struct attribute *prezero_pool_attrs[] = {
+	&nodes_attr.attr,
+	NULL,
+};
+
+static const struct attribute_group prezero_pool_attr_group = {
+	.attrs = prezero_pool_attrs,
+};
+
+static int __init prezero_pool_init(void)
+{
+	int nid;
+
+	for (nid = 0; nid < MAX_NUMNODES; nid++) {
+		spin_lock_init(&prezero_pools[nid].lock);
+		INIT_LIST_HEAD(&prezero_pools[nid].pages);
+		init_waitqueue_head(&prezero_pools[nid].wait);
+	}
+
+	mm_sysfs_add_group("prezero_pool", &prezero_pool_attr_group);
+
+	return 0;
+}
+subsys_initcall(prezero_pool_init);
@@ -193,7 +193,7 @@ unsigned int __do_page_cache_readahead(struct address_space *mapping,
 			continue;
 		}
 
-		page = __page_cache_alloc(gfp_mask);
+		page = __page_cache_alloc_tier(mapping, gfp_mask, true);
 		if (!page)
 			break;
 		page->index = page_offset;
@@ -80,7 +80,8 @@ static inline struct anon_vma *anon_vma_alloc(void)
 {
 	struct anon_vma *anon_vma;
 
-	anon_vma = kmem_cache_alloc(anon_vma_cachep, GFP_KERNEL);
+	anon_vma = kmem_cache_alloc_node(anon_vma_cachep, GFP_KERNEL,
+					 pgtable_tier_node());
 	if (anon_vma) {
 		atomic_set(&anon_vma->refcount, 1);
 		anon_vma->degree = 1;	/* Reference for first vma */
@@ -127,7 +128,8 @@ static inline void anon_vma_free(struct anon_vma *anon_vma)
 
 static inline struct anon_vma_chain *anon_vma_chain_alloc(gfp_t gfp)
 {
-	return kmem_cache_alloc(anon_vma_chain_cachep, gfp);
+	return kmem_cache_alloc_node(anon_vma_chain_cachep, gfp,
+				     pgtable_tier_node());
 }
 
 static void anon_vma_chain_free(struct anon_vma_chain *anon_vma_chain)
@@ -940,7 +942,8 @@ static bool page_mkclean_one(struct page *page, struct vm_area_struct *vma,
 			set_pte_at(vma->vm_mm, address, pte, entry);
 			ret = 1;
 		} else {
-#ifdef CONFIG_TRANSPARENT_HUGE_PAGECACHE
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+			/* file THPs, and anonymous ones from page_wrprotect() */
 			pmd_t *pmd = pvmw.pmd;
 			pmd_t entry;
 
@@ -1008,6 +1011,77 @@ int page_mkclean(struct page *page)
 }
 EXPORT_SYMBOL_GPL(page_mkclean);
 
+/*
+ * Like page_mkclean(), but for private and anonymous mappings as well.
+ * The dirty bits are dropped, so the caller must have marked the page
+ * dirty first.
+ */
+int page_wrprotect(struct page *page)
+{
+	int cleaned = 0;
+	struct rmap_walk_control rwc = {
+		.arg = (void *)&cleaned,
+		.rmap_one = page_mkclean_one,
+	};
+
+	BUG_ON(!PageLocked(page));
+
+	if (!page_mapped(page))
+		return 0;
+
+	rmap_walk(page, &rwc);
+
+	return cleaned;
+}
+
+static bool page_mapped_writable_one(struct page *page,
+		struct vm_area_struct *vma, unsigned long address, void *arg)
+{
+	struct page_vma_mapped_walk pvmw = {
+		.page = page,
+		.vma = vma,
+		.address = address,
+	};
+	bool *writable = arg;
+
+	while (page_vma_mapped_walk(&pvmw)) {
+		if (pvmw.pte)
+			*writable = pte_write(*pvmw.pte) || pte_dirty(*pvmw.pte);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		else
+			*writable = pmd_write(*pvmw.pmd) || pmd_dirty(*pvmw.pmd);
+#endif
+		if (*writable) {
+			page_vma_mapped_walk_done(&pvmw);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Whether a mapping of the locked @page is writable or dirty, for example
+ * since page_wrprotect().
+ */
+bool page_mapped_writable(struct page *page)
+{
+	bool writable = false;
+	struct rmap_walk_control rwc = {
+		.arg = (void *)&writable,
+		.rmap_one = page_mapped_writable_one,
+	};
+
+	BUG_ON(!PageLocked(page));
+
+	if (!page_mapped(page))
+		return false;
+
+	rmap_walk(page, &rwc);
+
+	return writable;
+}
+
 /**
  * page_move_anon_rmap - move a page to our anon_vma
  * @page:	the page to move to our anon_vma
@@ -1759,6 +1833,92 @@ bool try_to_unmap(struct page *page, enum ttu_flags flags)
 	return !page_mapcount(page) ? true : false;
 }
 
+// Open one mmu notifier range per mm around the unmapping of a concurrent
+// migration or exchange batch
+int sysctl_migrate_notify_batch = 1;
+
+#ifdef CONFIG_MMU_NOTIFIER
+/* mappings closer than this share a range */
+#define MMU_NOTIFY_BATCH_GAP	PMD_SIZE
+
+static bool mmu_notify_batch_one(struct page *page, struct vm_area_struct *vma,
+		unsigned long address, void *arg)
+{
+	struct mmu_notify_batch *nb = arg;
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long end = min(address + page_size(page), vma->vm_end);
+	struct mmu_notifier_range *range;
+	int i;
+
+	if (!mm_has_notifiers(mm))
+		return true;
+
+	for (i = 0; i < nb->nr; i++) {
+		range = &nb->ranges[i];
+		if (range->mm == mm &&
+		    address <= range->end + MMU_NOTIFY_BATCH_GAP &&
+		    end + MMU_NOTIFY_BATCH_GAP >= range->start) {
+			range->start = min(range->start, address);
+			range->end = max(range->end, end);
+			return true;
+		}
+	}
+
+	/* the rest is left to the ranges try_to_unmap_one() opens */
+	if (nb->nr == MMU_NOTIFY_BATCH_RANGES || !mmget_not_zero(mm))
+		return true;
+
+	mmu_notifier_range_init(&nb->ranges[nb->nr++], MMU_NOTIFY_CLEAR, 0,
+				NULL, mm, address, end);
+	return true;
+}
+
+/*
+ * Add the mappings of the locked @page to the ranges of @nb. Once all the
+ * pages of a batch are added, the ranges are opened with
+ * mmu_notify_batch_start() before the pages are unmapped and closed with
+ * mmu_notify_batch_end() after. A secondary MMU such as KVM then zaps and
+ * flushes once per range instead of once per page, the ranges
+ * try_to_unmap_one() opens inside finding nothing left to zap.
+ */
+void mmu_notify_batch_add(struct mmu_notify_batch *nb, struct page *page)
+{
+	struct rmap_walk_control rwc = {
+		.rmap_one = mmu_notify_batch_one,
+		.arg = nb,
+		.anon_lock = page_lock_anon_vma_read,
+	};
+
+	VM_BUG_ON_PAGE(!PageLocked(page), page);
+
+	/* once all the ranges are taken the walks are not worth it */
+	if (!READ_ONCE(sysctl_migrate_notify_batch) ||
+	    nb->nr == MMU_NOTIFY_BATCH_RANGES || !page_mapped(page))
+		return;
+
+	rmap_walk(page, &rwc);
+}
+
+void mmu_notify_batch_start(struct mmu_notify_batch *nb)
+{
+	int i;
+
+	for (i = 0; i < nb->nr; i++)
+		mmu_notifier_invalidate_range_start(&nb->ranges[i]);
+}
+
+void mmu_notify_batch_end(struct mmu_notify_batch *nb)
+{
+	int i;
+
+	for (i = 0; i < nb->nr; i++) {
+		mmu_notifier_invalidate_range_end(&nb->ranges[i]);
+		mmput_async(nb->ranges[i].mm);
+	}
+	nb->nr = 0;
+}
+#endif /* CONFIG_MMU_NOTIFIER */
+
 static int page_not_mapped(struct page *page)
 {
 	return !page_mapped(page);
@@ -34,6 +34,7 @@
 #include <linux/prefetch.h>
 #include <linux/memcontrol.h>
 #include <linux/random.h>
+#include <linux/memory_tier.h>
 
 #include <trace/events/kmem.h>
 
@@ -1502,19 +1503,81 @@ static void *setup_object(struct kmem_cache *s, struct page *page,
 	return object;
 }
 
+#ifdef CONFIG_NUMA
+/*
+ * Reclaimable caches on the slow tier.
+ *
+ * The dentry and inode caches of a file server grow to take a large share
+ * of DRAM. With vm.slab_reclaimable_slow_tier set to 1, the new slabs of
+ * the SLAB_RECLAIM_ACCOUNT caches marked in /sys/kernel/slab/xx/slow_tier
+ * are allocated on the slow tier node of the local socket, and with 2 the
+ * new slabs of all of them. The allocation falls back to the local node
+ * rather than reclaiming on the slow tier node. A slow tier node with only
+ * ZONE_MOVABLE memory, not in N_NORMAL_MEMORY, cannot hold slabs and is
+ * left alone.
+ *
+ * list_lru keeps the objects on the lists of the node of their slab, so
+ * the reclaim of the DRAM nodes no longer shrinks them. The reclaim of a
+ * slow tier node shrinks the caches before it evicts pages from the node,
+ * see shrink_node_memcgs().
+ */
+// Place reclaimable slab caches on the slow tier: 1 marked ones, 2 all
+int sysctl_slab_reclaimable_slow_tier = 0;
+
+/* Node for the new slabs of @s, NUMA_NO_NODE for the default placement */
+static int slab_tier_node(struct kmem_cache *s)
+{
+	int mode = READ_ONCE(sysctl_slab_reclaimable_slow_tier);
+	int nid;
+
+	if (!mode || !(s->flags & SLAB_RECLAIM_ACCOUNT) ||
+	    (mode == 1 && !READ_ONCE(s->slow_tier)) || !memory_tiers_present())
+		return NUMA_NO_NODE;
+
+	nid = numa_mem_id();
+	if (!node_is_slow_tier(nid))
+		nid = node_demotion_target(nid);
+	if (nid == NUMA_NO_NODE || !node_state(nid, N_NORMAL_MEMORY))
+		return NUMA_NO_NODE;
+
+	return nid;
+}
+
+/* Whether the reclaim of @nid shrinks the slab caches before the LRUs */
+bool slab_tier_shrink_first(int nid)
+{
+	return READ_ONCE(sysctl_slab_reclaimable_slow_tier) &&
+		node_is_slow_tier(nid);
+}
+#else
+static inline int slab_tier_node(struct kmem_cache *s)
+{
+	return NUMA_NO_NODE;
+}
+#endif
+
 /*
  * Slab allocation and freeing
  */
 static inline struct page *alloc_slab_page(struct kmem_cache *s,
 		gfp_t flags, int node, struct kmem_cache_order_objects oo)
 {
-	struct page *page;
+	struct page *page = NULL;
 	unsigned int order = oo_order(oo);
+	int tier_nid = NUMA_NO_NODE;
 
 	if (node == NUMA_NO_NODE)
-		page = alloc_pages(flags, order);
-	else
-		page = __alloc_pages_node(node, flags, order);
+		tier_nid = slab_tier_node(s);
+	if (tier_nid != NUMA_NO_NODE)
+		page = __alloc_pages_node(tier_nid, (flags | __GFP_THISNODE |
+				__GFP_NOWARN) & ~__GFP_DIRECT_RECLAIM, order);
+
+	if (!page) {
+		if (node == NUMA_NO_NODE)
+			page = alloc_pages(flags, order);
+		else
+			page = __alloc_pages_node(node, flags, order);
+	}
 
 	if (page && charge_slab_page(page, flags, order, s)) {
 		__free_pages(page, order);
@@ -1971,9 +2034,12 @@ static void *get_partial(struct kmem_cache *s, gfp_t flags, int node,
 	void *object;
 	int searchnode = node;
 
-	if (node == NUMA_NO_NODE)
-		searchnode = numa_mem_id();
-	else if (!node_present_pages(node))
+	if (node == NUMA_NO_NODE) {
+		/* the partial slabs of a cache on the slow tier are there */
+		searchnode = slab_tier_node(s);
+		if (searchnode == NUMA_NO_NODE)
+			searchnode = numa_mem_id();
+	} else if (!node_present_pages(node))
 		searchnode = node_to_mem_node(node);
 
 	object = get_partial_node(s, get_node(s, searchnode), c, flags);
@@ -5338,6 +5404,29 @@ static ssize_t remote_node_defrag_ratio_store(struct kmem_cache *s,
 	return length;
 }
 SLAB_ATTR(remote_node_defrag_ratio);
+
+static ssize_t slow_tier_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%d\n", s->slow_tier);
+}
+
+static ssize_t slow_tier_store(struct kmem_cache *s,
+				const char *buf, size_t length)
+{
+	bool slow_tier;
+	int err;
+
+	err = kstrtobool(buf, &slow_tier);
+	if (err)
+		return err;
+	if (!(s->flags & SLAB_RECLAIM_ACCOUNT))
+		return -EINVAL;
+
+	WRITE_ONCE(s->slow_tier, slow_tier);
+
+	return length;
+}
+SLAB_ATTR(slow_tier);
 #endif
 
 #ifdef CONFIG_SLUB_STATS
@@ -5457,6 +5546,7 @@ static struct attribute *slab_attrs[] = {
 #endif
 #ifdef CONFIG_NUMA
 	&remote_node_defrag_ratio_attr.attr,
+	&slow_tier_attr.attr,
 #endif
 #ifdef CONFIG_SLUB_STATS
 	&alloc_fastpath_attr.attr,
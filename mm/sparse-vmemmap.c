@@ -17,6 +17,12 @@
  *
  * The architecture is expected to provide a vmemmap_populate() function
  * to instantiate the mapping.
+ *
+ * With vm.vmemmap_fast_tier set, the memmap of memory hot-added to a slow
+ * tier node, such as PMEM onlined by dax kmem, is allocated on the nearest
+ * fast tier node instead: the page_to_nid(), PageLRU() and LRU list
+ * accesses of migration and reclaim scanning then hit DRAM, at the cost
+ * of 64 bytes of DRAM per 4K of PMEM.
  */
 #include <linux/mm.h>
 #include <linux/mmzone.h>
@@ -27,6 +33,7 @@
 #include <linux/spinlock.h>
 #include <linux/vmalloc.h>
 #include <linux/sched.h>
+#include <linux/memory_tier.h>
 #include <asm/dma.h>
 #include <asm/pgalloc.h>
 #include <asm/pgtable.h>
@@ -245,6 +252,26 @@ int __meminit vmemmap_populate_basepages(unsigned long start,
 	return 0;
 }
 
+// Allocate the memmap of hot-added slow tier memory on the fast tier
+int sysctl_vmemmap_fast_tier = 0;
+
+/* Node the memmap of memory being added to @nid is allocated on */
+static int __meminit vmemmap_tier_node(int nid, struct vmem_altmap *altmap)
+{
+	int target;
+
+	/*
+	 * An altmap puts the memmap in the added memory itself on purpose,
+	 * and the boot time memmap comes from the per-node sparse buffer.
+	 */
+	if (altmap || !slab_is_available() ||
+	    !READ_ONCE(sysctl_vmemmap_fast_tier) || !node_is_slow_tier(nid))
+		return nid;
+
+	target = node_promotion_target(nid);
+	return target == NUMA_NO_NODE ? nid : target;
+}
+
 struct page * __meminit __populate_section_memmap(unsigned long pfn,
 		unsigned long nr_pages, int nid, struct vmem_altmap *altmap)
 {
@@ -263,7 +290,8 @@ struct page * __meminit __populate_section_memmap(unsigned long pfn,
 	start = (unsigned long) pfn_to_page(pfn);
 	end = start + nr_pages * sizeof(struct page);
 
-	if (vmemmap_populate(start, end, nid, altmap))
+	if (vmemmap_populate(start, end, vmemmap_tier_node(nid, altmap),
+			     altmap))
 		return NULL;
 
 	return pfn_to_page(pfn);
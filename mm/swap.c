@@ -394,8 +394,10 @@ void mark_page_accessed(struct page *page)
 		else
 			__lru_cache_activate_page(page);
 		ClearPageReferenced(page);
-		if (page_is_file_cache(page))
+		if (page_is_file_cache(page)) {
 			workingset_activation(page);
+			page_cache_tier_accessed(page);
+		}
 	}
 	if (page_is_idle(page))
 		clear_page_idle(page);
@@ -698,12 +700,57 @@ void lru_add_drain(void)
 #ifdef CONFIG_SMP
 
 static DEFINE_PER_CPU(struct work_struct, lru_add_drain_work);
+/* jiffies of the last drain queued on the cpu */
+static DEFINE_PER_CPU(unsigned long, lru_add_drain_stamp);
+static DEFINE_MUTEX(lru_add_drain_lock);
 
 static void lru_add_drain_per_cpu(struct work_struct *dummy)
 {
 	lru_add_drain();
 }
 
+static bool cpu_needs_lru_add_drain(int cpu)
+{
+	return pagevec_count(&per_cpu(lru_add_pvec, cpu)) ||
+		pagevec_count(&per_cpu(lru_rotate_pvecs, cpu)) ||
+		pagevec_count(&per_cpu(lru_deactivate_file_pvecs, cpu)) ||
+		pagevec_count(&per_cpu(lru_deactivate_pvecs, cpu)) ||
+		pagevec_count(&per_cpu(lru_lazyfree_pvecs, cpu)) ||
+		need_activate_page_drain(cpu);
+}
+
+/*
+ * Drain the online cpus of @mask that have pages in their pagevecs, unless
+ * they were drained less than @interval jiffies ago. Called with
+ * lru_add_drain_lock held.
+ */
+static void __lru_add_drain_mask(const struct cpumask *mask,
+		unsigned long interval)
+{
+	static struct cpumask has_work;
+	int cpu;
+
+	cpumask_clear(&has_work);
+
+	for_each_cpu_and(cpu, mask, cpu_online_mask) {
+		struct work_struct *work = &per_cpu(lru_add_drain_work, cpu);
+
+		if (interval && time_before(jiffies,
+				per_cpu(lru_add_drain_stamp, cpu) + interval))
+			continue;
+
+		if (cpu_needs_lru_add_drain(cpu)) {
+			INIT_WORK(work, lru_add_drain_per_cpu);
+			queue_work_on(cpu, mm_percpu_wq, work);
+			cpumask_set_cpu(cpu, &has_work);
+			per_cpu(lru_add_drain_stamp, cpu) = jiffies;
+		}
+	}
+
+	for_each_cpu(cpu, &has_work)
+		flush_work(&per_cpu(lru_add_drain_work, cpu));
+}
+
 /*
  * Doesn't need any cpu hotplug locking because we do rely on per-cpu
  * kworkers being shut down before our page_alloc_cpu_dead callback is
@@ -714,9 +761,7 @@ static void lru_add_drain_per_cpu(struct work_struct *dummy)
 void lru_add_drain_all(void)
 {
 	static seqcount_t seqcount = SEQCNT_ZERO(seqcount);
-	static DEFINE_MUTEX(lock);
-	static struct cpumask has_work;
-	int cpu, seq;
+	int seq;
 
 	/*
 	 * Make sure nobody triggers this path before mm_percpu_wq is fully
@@ -727,7 +772,7 @@ void lru_add_drain_all(void)
 
 	seq = raw_read_seqcount_latch(&seqcount);
 
-	mutex_lock(&lock);
+	mutex_lock(&lru_add_drain_lock);
 
 	/*
 	 * Piggyback on drain started and finished while we waited for lock:
@@ -738,34 +783,37 @@ void lru_add_drain_all(void)
 
 	raw_write_seqcount_latch(&seqcount);
 
-	cpumask_clear(&has_work);
-
-	for_each_online_cpu(cpu) {
-		struct work_struct *work = &per_cpu(lru_add_drain_work, cpu);
+	__lru_add_drain_mask(cpu_online_mask, 0);
 
-		if (pagevec_count(&per_cpu(lru_add_pvec, cpu)) ||
-		    pagevec_count(&per_cpu(lru_rotate_pvecs, cpu)) ||
-		    pagevec_count(&per_cpu(lru_deactivate_file_pvecs, cpu)) ||
-		    pagevec_count(&per_cpu(lru_deactivate_pvecs, cpu)) ||
-		    pagevec_count(&per_cpu(lru_lazyfree_pvecs, cpu)) ||
-		    need_activate_page_drain(cpu)) {
-			INIT_WORK(work, lru_add_drain_per_cpu);
-			queue_work_on(cpu, mm_percpu_wq, work);
-			cpumask_set_cpu(cpu, &has_work);
-		}
-	}
+done:
+	mutex_unlock(&lru_add_drain_lock);
+}
 
-	for_each_cpu(cpu, &has_work)
-		flush_work(&per_cpu(lru_add_drain_work, cpu));
+/*
+ * lru_add_drain_all() limited to the cpus of @mask, for callers that know
+ * which cpus can hold the pages they are after. A cpu drained less than
+ * @interval jiffies ago is skipped, so that back to back callers do not
+ * queue work on the same cpus over and over.
+ */
+void lru_add_drain_mask(const struct cpumask *mask, unsigned long interval)
+{
+	if (WARN_ON(!mm_percpu_wq))
+		return;
 
-done:
-	mutex_unlock(&lock);
+	mutex_lock(&lru_add_drain_lock);
+	__lru_add_drain_mask(mask, interval);
+	mutex_unlock(&lru_add_drain_lock);
 }
 #else
 void lru_add_drain_all(void)
 {
 	lru_add_drain();
 }
+
+void lru_add_drain_mask(const struct cpumask *mask, unsigned long interval)
+{
+	lru_add_drain();
+}
 #endif
 
 /**
@@ -21,6 +21,8 @@
 #include <linux/vmalloc.h>
 #include <linux/swap_slots.h>
 #include <linux/huge_mm.h>
+#include <linux/cpuset.h>
+#include <linux/memory_tier.h>
 
 #include <asm/pgtable.h>
 
@@ -39,6 +41,8 @@ static const struct address_space_operations swap_aops = {
 struct address_space *swapper_spaces[MAX_SWAPFILES] __read_mostly;
 static unsigned int nr_swapper_spaces[MAX_SWAPFILES] __read_mostly;
 static bool enable_vma_readahead __read_mostly = true;
+static bool enable_ra_slow_tier __read_mostly;
+static bool enable_pmem_slow_tier __read_mostly;
 
 #define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
 #define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
@@ -122,6 +126,7 @@ int add_to_swap_cache(struct page *page, swp_entry_t entry, gfp_t gfp)
 	VM_BUG_ON_PAGE(PageSwapCache(page), page);
 	VM_BUG_ON_PAGE(!PageSwapBacked(page), page);
 
+	migrate_shadow_drop(page);
 	page_ref_add(page, nr);
 	SetPageSwapCache(page);
 
@@ -356,9 +361,13 @@ struct page *lookup_swap_cache(swp_entry_t entry, struct vm_area_struct *vma,
 	return page;
 }
 
-struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr,
-			bool *new_page_allocated)
+/*
+ * Allocate the page on @nid rather than by the mempolicy of @vma unless
+ * @nid is NUMA_NO_NODE.
+ */
+static struct page *read_swap_cache_async_node(swp_entry_t entry,
+			gfp_t gfp_mask, struct vm_area_struct *vma,
+			unsigned long addr, int nid, bool *new_page_allocated)
 {
 	struct page *found_page = NULL, *new_page = NULL;
 	struct swap_info_struct *si;
@@ -395,7 +404,10 @@ struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		 * Get a new page to read into from swap.
 		 */
 		if (!new_page) {
-			new_page = alloc_page_vma(gfp_mask, vma, addr);
+			if (nid == NUMA_NO_NODE)
+				new_page = alloc_page_vma(gfp_mask, vma, addr);
+			else
+				new_page = alloc_pages_node(nid, gfp_mask, 0);
 			if (!new_page)
 				break;		/* Out of memory */
 		}
@@ -439,18 +451,83 @@ struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+struct page *__read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			bool *new_page_allocated)
+{
+	return read_swap_cache_async_node(entry, gfp_mask, vma, addr,
+					  NUMA_NO_NODE, new_page_allocated);
+}
+
+/* The slow tier node the local node demotes to, if the task may use it */
+static int swap_slow_tier_node(void)
+{
+	int nid;
+
+	if (!memory_tiers_present())
+		return NUMA_NO_NODE;
+
+	nid = node_demotion_target(numa_node_id());
+	if (nid != NUMA_NO_NODE && !node_isset(nid, cpuset_current_mems_allowed))
+		return NUMA_NO_NODE;
+
+	return nid;
+}
+
+/*
+ * Node the readahead pages of a swapin are allocated on. With
+ * ra_slow_tier set it is the slow tier node that the local node demotes
+ * to, so that speculative pages take no fast tier memory until NUMA
+ * balancing finds them hot; the faulting page goes by swapin_fault_node().
+ * NUMA_NO_NODE to follow the mempolicy.
+ */
+static int swap_ra_node(void)
+{
+	if (!READ_ONCE(enable_ra_slow_tier))
+		return NUMA_NO_NODE;
+
+	return swap_slow_tier_node();
+}
+
+/*
+ * Node the faulting page of a swapin is allocated on, NUMA_NO_NODE to
+ * follow the mempolicy. With pmem_slow_tier set, a read fault of an
+ * anonymous page from a swap device on persistent memory reads the slot
+ * into the slow tier rather than into DRAM: a page read once and evicted
+ * again never takes fast tier memory, and NUMA balancing promotes the
+ * ones that turn out hot. The copy out of the slot itself remains, the
+ * pmem block device has no pages that could be mapped in its place.
+ */
+int swapin_fault_node(struct swap_info_struct *si, struct vm_fault *vmf)
+{
+	int nid;
+
+	if (!READ_ONCE(enable_pmem_slow_tier) || !(si->flags & SWP_PMEM))
+		return NUMA_NO_NODE;
+	if ((vmf->flags & FAULT_FLAG_WRITE) || !vmf->vma ||
+	    !vma_is_anonymous(vmf->vma))
+		return NUMA_NO_NODE;
+
+	nid = swap_slow_tier_node();
+	if (nid != NUMA_NO_NODE)
+		count_vm_event(SWPIN_SLOW_TIER);
+
+	return nid;
+}
+
 /*
  * Locate a page of swap in physical memory, reserving swap cache space
  * and reading the disk if it is not already cached.
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-		struct vm_area_struct *vma, unsigned long addr, bool do_poll)
+static struct page *read_swap_cache_async_nid(swp_entry_t entry,
+		gfp_t gfp_mask, struct vm_area_struct *vma, unsigned long addr,
+		int nid, bool do_poll)
 {
 	bool page_was_allocated;
-	struct page *retpage = __read_swap_cache_async(entry, gfp_mask,
-			vma, addr, &page_was_allocated);
+	struct page *retpage = read_swap_cache_async_node(entry, gfp_mask,
+			vma, addr, nid, &page_was_allocated);
 
 	if (page_was_allocated)
 		swap_readpage(retpage, do_poll);
@@ -458,6 +535,13 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return retpage;
 }
 
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+		struct vm_area_struct *vma, unsigned long addr, bool do_poll)
+{
+	return read_swap_cache_async_nid(entry, gfp_mask, vma, addr,
+					 NUMA_NO_NODE, do_poll);
+}
+
 static unsigned int __swapin_nr_pages(unsigned long prev_offset,
 				      unsigned long offset,
 				      int hits,
@@ -549,6 +633,7 @@ struct page *swap_cluster_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	bool do_poll = true, page_allocated;
 	struct vm_area_struct *vma = vmf->vma;
 	unsigned long addr = vmf->address;
+	int ra_nid, nid = swapin_fault_node(si, vmf);
 
 	mask = swapin_nr_pages(offset) - 1;
 	if (!mask)
@@ -570,12 +655,14 @@ struct page *swap_cluster_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	if (end_offset >= si->max)
 		end_offset = si->max - 1;
 
+	ra_nid = swap_ra_node();
 	blk_start_plug(&plug);
 	for (offset = start_offset; offset <= end_offset ; offset++) {
 		/* Ok, do the async read-ahead now */
-		page = __read_swap_cache_async(
-			swp_entry(swp_type(entry), offset),
-			gfp_mask, vma, addr, &page_allocated);
+		page = read_swap_cache_async_node(
+			swp_entry(swp_type(entry), offset), gfp_mask, vma, addr,
+			offset == entry_offset ? nid : ra_nid,
+			&page_allocated);
 		if (!page)
 			continue;
 		if (page_allocated) {
@@ -591,7 +678,8 @@ struct page *swap_cluster_readahead(swp_entry_t entry, gfp_t gfp_mask,
 
 	lru_add_drain();	/* Push any new pages onto the LRU now */
 skip:
-	return read_swap_cache_async(entry, gfp_mask, vma, addr, do_poll);
+	return read_swap_cache_async_nid(entry, gfp_mask, vma, addr, nid,
+					 do_poll);
 }
 
 int init_swap_address_space(unsigned int type, unsigned long nr_pages)
@@ -730,11 +818,13 @@ static struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
 	unsigned int i;
 	bool page_allocated;
 	struct vma_swap_readahead ra_info = {0,};
+	int ra_nid, nid = swapin_fault_node(swp_swap_info(fentry), vmf);
 
 	swap_ra_info(vmf, &ra_info);
 	if (ra_info.win == 1)
 		goto skip;
 
+	ra_nid = swap_ra_node();
 	blk_start_plug(&plug);
 	for (i = 0, pte = ra_info.ptes; i < ra_info.nr_pte;
 	     i++, pte++) {
@@ -746,8 +836,10 @@ static struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
 		entry = pte_to_swp_entry(pentry);
 		if (unlikely(non_swap_entry(entry)))
 			continue;
-		page = __read_swap_cache_async(entry, gfp_mask, vma,
-					       vmf->address, &page_allocated);
+		page = read_swap_cache_async_node(entry, gfp_mask, vma,
+				vmf->address,
+				i == ra_info.offset ? nid : ra_nid,
+				&page_allocated);
 		if (!page)
 			continue;
 		if (page_allocated) {
@@ -762,8 +854,8 @@ static struct page *swap_vma_readahead(swp_entry_t fentry, gfp_t gfp_mask,
 	blk_finish_plug(&plug);
 	lru_add_drain();
 skip:
-	return read_swap_cache_async(fentry, gfp_mask, vma, vmf->address,
-				     ra_info.win == 1);
+	return read_swap_cache_async_nid(fentry, gfp_mask, vma, vmf->address,
+					 nid, ra_info.win == 1);
 }
 
 /**
@@ -809,8 +901,52 @@ static struct kobj_attribute vma_ra_enabled_attr =
 	__ATTR(vma_ra_enabled, 0644, vma_ra_enabled_show,
 	       vma_ra_enabled_store);
 
+static ssize_t ra_slow_tier_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", enable_ra_slow_tier ? "true" : "false");
+}
+static ssize_t ra_slow_tier_store(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  const char *buf, size_t count)
+{
+	if (!strncmp(buf, "true", 4) || !strncmp(buf, "1", 1))
+		WRITE_ONCE(enable_ra_slow_tier, true);
+	else if (!strncmp(buf, "false", 5) || !strncmp(buf, "0", 1))
+		WRITE_ONCE(enable_ra_slow_tier, false);
+	else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute ra_slow_tier_attr =
+	__ATTR(ra_slow_tier, 0644, ra_slow_tier_show, ra_slow_tier_store);
+
+static ssize_t pmem_slow_tier_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%s\n", enable_pmem_slow_tier ? "true" : "false");
+}
+static ssize_t pmem_slow_tier_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	if (!strncmp(buf, "true", 4) || !strncmp(buf, "1", 1))
+		WRITE_ONCE(enable_pmem_slow_tier, true);
+	else if (!strncmp(buf, "false", 5) || !strncmp(buf, "0", 1))
+		WRITE_ONCE(enable_pmem_slow_tier, false);
+	else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute pmem_slow_tier_attr =
+	__ATTR(pmem_slow_tier, 0644, pmem_slow_tier_show, pmem_slow_tier_store);
+
 static struct attribute *swap_attrs[] = {
 	&vma_ra_enabled_attr.attr,
+	&ra_slow_tier_attr.attr,
+	&pmem_slow_tier_attr.attr,
 	NULL,
 };
 
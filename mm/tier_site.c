@@ -0,0 +1,141 @@
+/*
+ * Initial tier placement of anonymous memory by the history of its region.
+ *
+ * Some regions are predictably cold, logging buffers or data only used at
+ * initialization, yet their pages are first touched on the local DRAM node
+ * and cost a demotion each later on. The regions are told apart by their
+ * anon_vma, the one a first-touch fault puts a page in and the one reclaim
+ * finds it in when it demotes it. For each of them, blurred by a hash
+ * table, the first-touch faults that placed their page on the local node
+ * are counted along with the pages that turned out cold: the ones demoted,
+ * minus the ones NUMA balancing promoted back. Both are sampled, one in
+ * TIER_SITE_SAMPLE, to keep the shared counters off most faults. The
+ * counts halve every TIER_SITE_WINDOW samples so that a region can change
+ * its mind.
+ *
+ * With vm.cold_site_ratio set, a first-touch fault in a region of which at
+ * least that percentage of the pages turned out cold allocates its page on
+ * the slow tier node the local node demotes to, from free memory only. One
+ * in TIER_SITE_CONTROL of those faults still takes the local node: the
+ * pages placed on the slow tier say nothing about the region, these keep
+ * its history going. The faults of tasks with a mempolicy of their own, or
+ * in a vma with one, are left alone: they already said where their memory
+ * goes. The pages placed on the slow tier are counted in the
+ * pgalloc_cold_site vm event.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/hash.h>
+#include <linux/random.h>
+#include <linux/rmap.h>
+#include <linux/cpuset.h>
+#include <linux/mempolicy.h>
+#include <linux/memory_tier.h>
+
+#include "internal.h"
+
+#define TIER_SITE_BITS		12
+/* one in that many faults and demotions is counted */
+#define TIER_SITE_SAMPLE	8
+/* counted faults of a region before its history counts */
+#define TIER_SITE_MIN_TOUCHED	16
+/* counted faults after which the history of a region halves */
+#define TIER_SITE_WINDOW	512
+/* one in that many faults of a cold region still takes the local node */
+#define TIER_SITE_CONTROL	16
+
+// Percentage of cold pages of a region placing its new pages on the slow tier
+int sysctl_cold_site_ratio = 0;
+
+struct tier_site {
+	atomic_t touched;	/* first-touch faults placed on the local node */
+	atomic_t cold;		/* pages demoted, less the ones promoted */
+};
+
+static struct tier_site tier_sites[1 << TIER_SITE_BITS];
+
+static struct tier_site *tier_site(struct anon_vma *anon_vma)
+{
+	return &tier_sites[hash_ptr(anon_vma, TIER_SITE_BITS)];
+}
+
+static bool tier_site_sampled(void)
+{
+	return !prandom_u32_max(TIER_SITE_SAMPLE);
+}
+
+static void tier_site_touch(struct tier_site *site)
+{
+	if (!tier_site_sampled())
+		return;
+	if (atomic_inc_return(&site->touched) < TIER_SITE_WINDOW)
+		return;
+
+	/* racing faults only blur the history a little more */
+	atomic_set(&site->touched, TIER_SITE_WINDOW / 2);
+	atomic_set(&site->cold, atomic_read(&site->cold) / 2);
+}
+
+/*
+ * Node for the page of a first-touch fault in @vma, whose anon_vma is
+ * prepared: the nearest slow tier node if the region of @vma is cold,
+ * NUMA_NO_NODE otherwise.
+ */
+int tier_site_fault_node(struct vm_area_struct *vma)
+{
+	int ratio = READ_ONCE(sysctl_cold_site_ratio);
+	struct tier_site *site;
+	int touched, nid;
+
+	if (!ratio || !memory_tiers_present())
+		return NUMA_NO_NODE;
+
+	site = tier_site(vma->anon_vma);
+	touched = atomic_read(&site->touched);
+	if (touched < TIER_SITE_MIN_TOUCHED ||
+	    atomic_read(&site->cold) * 100 < ratio * touched ||
+	    !prandom_u32_max(TIER_SITE_CONTROL))
+		goto local;
+	if (current->mempolicy || vma->vm_policy)
+		goto local;
+
+	nid = node_demotion_target(numa_node_id());
+	if (nid == NUMA_NO_NODE || !node_isset(nid, cpuset_current_mems_allowed))
+		goto local;
+
+	count_vm_event(PGALLOC_COLD_SITE);
+	return nid;
+
+local:
+	tier_site_touch(site);
+	return NUMA_NO_NODE;
+}
+
+/* The anonymous base page @page was moved to the slow tier */
+void tier_site_demoted(struct page *page)
+{
+	struct anon_vma *anon_vma;
+
+	if (!READ_ONCE(sysctl_cold_site_ratio) || PageTransHuge(page) ||
+	    !tier_site_sampled())
+		return;
+
+	anon_vma = page_anon_vma(page);
+	if (anon_vma)
+		atomic_inc(&tier_site(anon_vma)->cold);
+}
+
+/* The anonymous base page @page left the slow tier, it was not cold */
+void tier_site_promoted(struct page *page)
+{
+	struct anon_vma *anon_vma;
+
+	if (!READ_ONCE(sysctl_cold_site_ratio) || PageTransHuge(page) ||
+	    !tier_site_sampled())
+		return;
+
+	anon_vma = page_anon_vma(page);
+	if (anon_vma)
+		atomic_dec_if_positive(&tier_site(anon_vma)->cold);
+}
@@ -57,6 +57,9 @@
 
 #include <linux/swapops.h>
 #include <linux/balloon_compaction.h>
+#include <linux/migrate.h>
+#include <linux/memory_tier.h>
+#include <linux/migrate_history.h>
 
 #include "internal.h"
 
@@ -114,6 +117,12 @@ struct scan_control {
 	/* The file pages on the current node are dangerously low */
 	unsigned int file_is_tiny:1;
 
+	/* Reclaim the pages rather than demote them to a slow tier node */
+	unsigned int no_demotion:1;
+
+	/* Keep the pages that cannot be demoted rather than reclaim them */
+	unsigned int demote_only:1;
+
 	/* Allocation order */
 	s8 order;
 
@@ -1063,6 +1072,132 @@ static void page_check_dirty_writeback(struct page *page,
 		mapping->a_ops->is_dirty_writeback(page, dirty, writeback);
 }
 
+/*
+ * Demotion: with vm.reclaim_demote set, global reclaim of a fast tier
+ * node migrates the pages it would otherwise swap out or drop to the
+ * nearest slow tier node of the tier registry, see node_demotion_target().
+ * The pages that cannot be demoted, because the slow node is full too,
+ * are reclaimed as usual.
+ *
+ * Memcg reclaim demotes too, to the first slow node on which the memcg
+ * stays within its max_at_node, so that hitting memory.high or memory.max
+ * swaps out or drops slow tier pages rather than fast tier ones while the
+ * memcg has room on the slow tier. The charge of a page moves with it, so
+ * demoted pages do not count as reclaimed and reclaim goes on until the
+ * slow tier pages freed make up for it.
+ */
+// Demote the reclaimed pages of fast tier nodes to slow tier nodes
+int sysctl_reclaim_demote = 0;
+
+static int reclaim_demotion_target(struct pglist_data *pgdat,
+		struct scan_control *sc)
+{
+	int target;
+
+	if (!IS_ENABLED(CONFIG_MIGRATION) || !READ_ONCE(sysctl_reclaim_demote) ||
+	    sc->no_demotion)
+		return NUMA_NO_NODE;
+
+	target = node_demotion_target(pgdat->node_id);
+	if (target != NUMA_NO_NODE && cgroup_reclaim(sc))
+		target = mem_cgroup_budget_node(sc->target_mem_cgroup, target,
+						SWAP_CLUSTER_MAX);
+
+	return target;
+}
+
+/*
+ * A demotion batch: the target node, and the base pages of the new pages
+ * allocated and not given back, that is of the pages demoted.
+ */
+struct demote_control {
+	int nid;
+	unsigned long nr_demoted;
+};
+
+static struct page *alloc_demote_page(struct page *page, unsigned long private)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+	int node = dc->nid;
+	/* neither recurse into reclaim nor dip into the reserves */
+	gfp_t gfp_mask = (GFP_HIGHUSER_MOVABLE & ~__GFP_RECLAIM) |
+		__GFP_THISNODE | __GFP_NOWARN | __GFP_NOMEMALLOC;
+	struct page *newpage;
+
+	if (PageTransHuge(page)) {
+		newpage = alloc_pages_node(node,
+				(GFP_TRANSHUGE_LIGHT & ~__GFP_RECLAIM) |
+				__GFP_THISNODE | __GFP_NOWARN | __GFP_NOMEMALLOC,
+				HPAGE_PMD_ORDER);
+		if (newpage)
+			prep_transhuge_page(newpage);
+	} else {
+		newpage = __alloc_pages_node(node, gfp_mask, 0);
+	}
+
+	if (newpage) {
+		workingset_demotion(page, newpage);
+		dc->nr_demoted += hpage_nr_pages(newpage);
+	}
+
+	return newpage;
+}
+
+/* The migration failed, drop the demotion record of the unused page */
+static void free_demote_page(struct page *page, unsigned long private)
+{
+	struct demote_control *dc = (struct demote_control *)private;
+
+	dc->nr_demoted -= hpage_nr_pages(page);
+	page_migrate_history_take_demotion(page);
+	put_page(page);
+}
+
+/*
+ * Demote the unlocked pages of @demote_pages to @target_nid in one
+ * concurrent batch, streaming the stores to the slow node. Returns the
+ * number of base pages demoted. The pages still worth a retry are left on
+ * @demote_pages, migration put those that failed for good back on the LRU.
+ */
+static unsigned int demote_page_list(struct list_head *demote_pages,
+		int target_nid)
+{
+	struct demote_control dc = { .nid = target_nid };
+	struct page_copy_policy copy_policy;
+	struct page *page;
+	bool policy;
+
+	if (list_empty(demote_pages))
+		return 0;
+
+	/*
+	 * Migration takes the pages it is done with off NR_ISOLATED, which
+	 * the caller of shrink_page_list() does for all of them.
+	 */
+	list_for_each_entry(page, demote_pages, lru)
+		mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
+				page_is_file_cache(page), hpage_nr_pages(page));
+
+	policy = !page_copy_policy_enter(NULL, MPOL_MF_COPY_NT, &copy_policy);
+	migrate_pages_concur(demote_pages, alloc_demote_page, free_demote_page,
+			(unsigned long)&dc, MIGRATE_ASYNC | MIGRATE_CONCUR,
+			MR_DEMOTION);
+	if (policy)
+		page_copy_policy_exit(&copy_policy);
+
+	list_for_each_entry(page, demote_pages, lru)
+		mod_node_page_state(page_pgdat(page), NR_ISOLATED_ANON +
+				page_is_file_cache(page), -hpage_nr_pages(page));
+
+	/*
+	 * The pages that failed for good went back to the LRU, only the
+	 * new pages migration kept count.
+	 */
+	count_vm_events(PGDEMOTE, dc.nr_demoted);
+
+	return dc.nr_demoted;
+}
+
 /*
  * shrink_page_list() returns the number of reclaimed pages
  */
@@ -1075,12 +1210,20 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 {
 	LIST_HEAD(ret_pages);
 	LIST_HEAD(free_pages);
+	LIST_HEAD(demote_pages);
 	unsigned nr_reclaimed = 0;
+	unsigned nr_demoted;
 	unsigned pgactivate = 0;
+	int demotion_nid = reclaim_demotion_target(pgdat, sc);
+	struct mem_cgroup_demotion_batch demotion_floor = {
+		.nid = NUMA_NO_NODE,
+		.low = !sc->memcg_low_reclaim,
+	};
 
 	memset(stat, 0, sizeof(*stat));
 	cond_resched();
 
+retry:
 	while (!list_empty(page_list)) {
 		struct address_space *mapping;
 		struct page *page;
@@ -1230,6 +1373,25 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/* demoted in one batch once the list is done */
+		if (demotion_nid != NUMA_NO_NODE) {
+			/*
+			 * Keep rather than swap a page just promoted, or one
+			 * its memcg protects on this node, with the pages
+			 * already on demote_pages counted.
+			 */
+			if (page_migrate_suppress(page) ||
+			    mem_cgroup_migrate_quiesced(page) ||
+			    mem_cgroup_demotion_batch_protected(&demotion_floor,
+								page))
+				goto activate_locked;
+			list_add(&page->lru, &demote_pages);
+			unlock_page(page);
+			continue;
+		}
+		if (sc->demote_only)
+			goto keep_locked;
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -1472,6 +1634,19 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 		VM_BUG_ON_PAGE(PageLRU(page) || PageUnevictable(page), page);
 	}
 
+	nr_demoted = demote_page_list(&demote_pages, demotion_nid);
+	/* a demotion frees the node but not the charge of the memcg */
+	if (!cgroup_reclaim(sc))
+		nr_reclaimed += nr_demoted;
+	/* what could not be demoted is reclaimed after all, or kept */
+	if (sc->demote_only) {
+		list_splice_init(&demote_pages, &ret_pages);
+	} else if (!list_empty(&demote_pages)) {
+		list_splice_init(&demote_pages, page_list);
+		demotion_nid = NUMA_NO_NODE;
+		goto retry;
+	}
+
 	pgactivate = stat->nr_activate[0] + stat->nr_activate[1];
 
 	mem_cgroup_uncharge_list(&free_pages);
@@ -1491,6 +1666,7 @@ unsigned long reclaim_clean_pages_from_list(struct zone *zone,
 		.gfp_mask = GFP_KERNEL,
 		.priority = DEF_PRIORITY,
 		.may_unmap = 1,
+		.no_demotion = 1,
 	};
 	struct reclaim_stat dummy_stat;
 	unsigned long ret;
@@ -1747,6 +1923,58 @@ int isolate_lru_page(struct page *page)
 	return ret;
 }
 
+/**
+ * isolate_lru_pages_bulk - isolate_lru_page() of an array of pages
+ * @pages: the pages, each with a reference held, no tail pages
+ * @nr: number of pages
+ * @status: isolate_lru_page() of each page is stored here
+ *
+ * The lru_lock of a node is taken once for each run of pages of the node,
+ * so the caller should bound @nr and keep the pages of a node together.
+ * The pages isolated are counted in NR_ISOLATED_ANON or NR_ISOLATED_FILE.
+ */
+void isolate_lru_pages_bulk(struct page **pages, int nr, int *status)
+{
+	pg_data_t *locked = NULL;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
+		pg_data_t *pgdat = page_pgdat(page);
+		struct lruvec *lruvec;
+
+		VM_BUG_ON_PAGE(!page_count(page), page);
+		WARN_RATELIMIT(PageTail(page), "trying to isolate tail page");
+
+		status[i] = -EBUSY;
+		if (!PageLRU(page))
+			continue;
+
+		if (pgdat != locked) {
+			if (locked)
+				spin_unlock_irq(&locked->lru_lock);
+			locked = pgdat;
+			spin_lock_irq(&pgdat->lru_lock);
+		}
+
+		lruvec = mem_cgroup_page_lruvec(page, pgdat);
+		if (PageLRU(page)) {
+			int lru = page_lru(page);
+
+			get_page(page);
+			ClearPageLRU(page);
+			del_page_from_lru_list(page, lruvec, lru);
+			__mod_node_page_state(pgdat, NR_ISOLATED_ANON +
+					page_is_file_cache(page),
+					hpage_nr_pages(page));
+			status[i] = 0;
+		}
+	}
+
+	if (locked)
+		spin_unlock_irq(&locked->lru_lock);
+}
+
 /*
  * A direct reclaimer may isolate SWAP_CLUSTER_MAX pages from the LRU list and
  * then get rescheduled. When there are massive number of tasks doing page
@@ -2085,6 +2313,8 @@ unsigned long reclaim_pages(struct list_head *page_list)
 		.may_writepage = 1,
 		.may_unmap = 1,
 		.may_swap = 1,
+		/* MADV_PAGEOUT asked for the pages to be paged out */
+		.no_demotion = 1,
 	};
 
 	while (!list_empty(page_list)) {
@@ -2220,8 +2450,12 @@ static void get_scan_count(struct lruvec *lruvec, struct scan_control *sc,
 	unsigned long ap, fp;
 	enum lru_list lru;
 
-	/* If we have no swap space, do not bother scanning anon pages. */
-	if (!sc->may_swap || mem_cgroup_get_nr_swap_pages(memcg) <= 0) {
+	/*
+	 * If we have no swap space, do not bother scanning anon pages,
+	 * unless they can be demoted.
+	 */
+	if (!sc->may_swap || (mem_cgroup_get_nr_swap_pages(memcg) <= 0 &&
+			      reclaim_demotion_target(pgdat, sc) == NUMA_NO_NODE)) {
 		scan_balance = SCAN_FILE;
 		goto out;
 	}
@@ -2528,7 +2762,9 @@ static void shrink_lruvec(struct lruvec *lruvec, struct scan_control *sc)
 	 * Even if we did not try to evict anon pages at all, we want to
 	 * rebalance the anon lru active/inactive ratio.
 	 */
-	if (total_swap_pages && inactive_is_low(lruvec, LRU_INACTIVE_ANON))
+	if ((total_swap_pages ||
+	     reclaim_demotion_target(lruvec_pgdat(lruvec), sc) != NUMA_NO_NODE) &&
+	    inactive_is_low(lruvec, LRU_INACTIVE_ANON))
 		shrink_active_list(SWAP_CLUSTER_MAX, lruvec,
 				   sc, LRU_ACTIVE_ANON);
 }
@@ -2607,6 +2843,7 @@ static inline bool should_continue_reclaim(struct pglist_data *pgdat,
 static void shrink_node_memcgs(pg_data_t *pgdat, struct scan_control *sc)
 {
 	struct mem_cgroup *target_memcg = sc->target_mem_cgroup;
+	bool slab_first = slab_tier_shrink_first(pgdat->node_id);
 	struct mem_cgroup *memcg;
 
 	memcg = mem_cgroup_iter(target_memcg, NULL, NULL);
@@ -2649,10 +2886,19 @@ static void shrink_node_memcgs(pg_data_t *pgdat, struct scan_control *sc)
 		reclaimed = sc->nr_reclaimed;
 		scanned = sc->nr_scanned;
 
+		/*
+		 * The reclaimable caches placed on a slow tier node are cold,
+		 * drop them before evicting the pages of the last tier.
+		 */
+		if (!sc->demote_only && slab_first)
+			shrink_slab(sc->gfp_mask, pgdat->node_id, memcg,
+				    sc->priority);
+
 		shrink_lruvec(lruvec, sc);
 
-		shrink_slab(sc->gfp_mask, pgdat->node_id, memcg,
-			    sc->priority);
+		if (!sc->demote_only && !slab_first)
+			shrink_slab(sc->gfp_mask, pgdat->node_id, memcg,
+				    sc->priority);
 
 		/* Record the group's reclaim efficiency */
 		vmpressure(sc->gfp_mask, memcg, false,
@@ -2685,7 +2931,14 @@ static void shrink_node(pg_data_t *pgdat, struct scan_control *sc)
 	if (!sc->force_deactivate) {
 		unsigned long refaults;
 
-		if (inactive_is_low(target_lruvec, LRU_INACTIVE_ANON))
+		/*
+		 * Demoted pages coming back to the workingset mean the
+		 * active list holds staler pages than the demoted ones.
+		 */
+		refaults = lruvec_page_state(target_lruvec,
+					     WORKINGSET_DEMOTE_REFAULT);
+		if (refaults != target_lruvec->demote_refaults ||
+		    inactive_is_low(target_lruvec, LRU_INACTIVE_ANON))
 			sc->may_deactivate |= DEACTIVATE_ANON;
 		else
 			sc->may_deactivate &= ~DEACTIVATE_ANON;
@@ -2976,6 +3229,8 @@ static void snapshot_refaults(struct mem_cgroup *target_memcg, pg_data_t *pgdat)
 	target_lruvec = mem_cgroup_lruvec(target_memcg, pgdat);
 	refaults = lruvec_page_state(target_lruvec, WORKINGSET_ACTIVATE);
 	target_lruvec->refaults = refaults;
+	target_lruvec->demote_refaults = lruvec_page_state(target_lruvec,
+			WORKINGSET_DEMOTE_REFAULT);
 }
 
 /*
@@ -3351,7 +3606,8 @@ static void age_active_anon(struct pglist_data *pgdat,
 	struct mem_cgroup *memcg;
 	struct lruvec *lruvec;
 
-	if (!total_swap_pages)
+	if (!total_swap_pages &&
+	    reclaim_demotion_target(pgdat, sc) == NUMA_NO_NODE)
 		return;
 
 	lruvec = mem_cgroup_lruvec(NULL, pgdat);
@@ -3427,6 +3683,107 @@ static bool pgdat_balanced(pg_data_t *pgdat, int order, int classzone_idx)
 	return false;
 }
 
+/*
+ * Demotion watermark: with vm.demote_watermark_scale_factor set, every zone
+ * has a watermark above the high one. An allocation that leaves a zone
+ * below it wakes kswapd, which, once the node is balanced, demotes cold
+ * pages of a fast tier node to its slow tier node until a zone is back
+ * above the watermark. Allocations thus find free DRAM well before they hit
+ * the low watermark and stall in reclaim. The pass neither swaps nor drops
+ * pages and its failures do not count towards kswapd_failures.
+ */
+static bool pgdat_demote_pending(pg_data_t *pgdat, int classzone_idx)
+{
+	int i;
+
+	for (i = 0; i <= classzone_idx; i++) {
+		if (test_bit(ZONE_DEMOTE_WATERMARK, &pgdat->node_zones[i].flags))
+			return true;
+	}
+
+	return false;
+}
+
+static bool pgdat_demote_balanced(pg_data_t *pgdat, int classzone_idx)
+{
+	unsigned long mark;
+	struct zone *zone;
+	int i;
+
+	for (i = 0; i <= classzone_idx; i++) {
+		zone = pgdat->node_zones + i;
+		if (!managed_zone(zone))
+			continue;
+
+		mark = demote_wmark_pages(zone);
+		if (!mark || zone_watermark_ok_safe(zone, 0, mark, classzone_idx))
+			return true;
+	}
+
+	return false;
+}
+
+static void kswapd_demote_node(pg_data_t *pgdat, int classzone_idx)
+{
+	struct scan_control sc = {
+		.gfp_mask = GFP_KERNEL,
+		.priority = DEF_PRIORITY,
+		.reclaim_idx = classzone_idx,
+		.may_unmap = 1,
+		.may_swap = 1,
+		.demote_only = 1,
+	};
+	unsigned long nr_reclaimed;
+	struct zone *zone;
+	int i;
+
+	/* the bits stay set on nodes without a target, nothing rewakes kswapd */
+	if (!pgdat_demote_pending(pgdat, classzone_idx) ||
+	    reclaim_demotion_target(pgdat, &sc) == NUMA_NO_NODE)
+		return;
+
+	for (i = 0; i <= classzone_idx; i++)
+		clear_bit(ZONE_DEMOTE_WATERMARK, &pgdat->node_zones[i].flags);
+
+	/* as for boosted reclaim, do not scan hard for it */
+	while (sc.priority >= DEF_PRIORITY - 2 &&
+	       !pgdat_demote_balanced(pgdat, classzone_idx)) {
+		sc.nr_to_reclaim = 0;
+		for (i = 0; i <= classzone_idx; i++) {
+			zone = pgdat->node_zones + i;
+			if (!managed_zone(zone) || !demote_wmark_pages(zone))
+				continue;
+
+			sc.nr_to_reclaim += max(demote_wmark_pages(zone) -
+						high_wmark_pages(zone),
+						SWAP_CLUSTER_MAX);
+		}
+
+		nr_reclaimed = sc.nr_reclaimed;
+		sc.nr_scanned = 0;
+		shrink_node(pgdat, &sc);
+
+		if (kthread_should_stop())
+			break;
+
+		if (sc.nr_reclaimed == nr_reclaimed)
+			sc.priority--;
+	}
+
+	/*
+	 * Nothing could be demoted, the slow tier node is full too. Leave the
+	 * watermark to the next kswapd wakeup rather than have every
+	 * allocation wake kswapd again.
+	 */
+	if (!sc.nr_reclaimed) {
+		for (i = 0; i <= classzone_idx; i++) {
+			zone = pgdat->node_zones + i;
+			if (managed_zone(zone) && demote_wmark_pages(zone))
+				set_bit(ZONE_DEMOTE_WATERMARK, &zone->flags);
+		}
+	}
+}
+
 /* Clear pgdat state for congested, dirty or under writeback. */
 static void clear_pgdat_congested(pg_data_t *pgdat)
 {
@@ -3723,6 +4080,9 @@ static int balance_pgdat(pg_data_t *pgdat, int order, int classzone_idx)
 		wakeup_kcompactd(pgdat, pageblock_order, classzone_idx);
 	}
 
+	if (pgdat_balanced(pgdat, 0, classzone_idx))
+		kswapd_demote_node(pgdat, classzone_idx);
+
 	snapshot_refaults(NULL, pgdat);
 	__fs_reclaim_release();
 	psi_memstall_leave(&pflags);
@@ -3951,7 +4311,8 @@ void wakeup_kswapd(struct zone *zone, gfp_t gfp_flags, int order,
 	/* Hopeless node, leave it to direct reclaim if possible */
 	if (pgdat->kswapd_failures >= MAX_RECLAIM_RETRIES ||
 	    (pgdat_balanced(pgdat, order, classzone_idx) &&
-	     !pgdat_watermark_boosted(pgdat, classzone_idx))) {
+	     !pgdat_watermark_boosted(pgdat, classzone_idx) &&
+	     !pgdat_demote_pending(pgdat, classzone_idx))) {
 		/*
 		 * There may be plenty of free memory available, but it's too
 		 * fragmented for high-order allocations.  Wake up kcompactd
@@ -28,6 +28,7 @@
 #include <linux/mm_inline.h>
 #include <linux/page_ext.h>
 #include <linux/page_owner.h>
+#include <linux/migrate_stat.h>
 
 #include "internal.h"
 
@@ -1150,6 +1151,7 @@ const char * const vmstat_text[] = {
 	"workingset_activate",
 	"workingset_restore",
 	"workingset_nodereclaim",
+	"workingset_demote_refault",
 	"nr_anon_pages",
 	"nr_mapped",
 	"nr_file_pages",
@@ -1222,11 +1224,35 @@ const char * const vmstat_text[] = {
 	"numa_hint_faults",
 	"numa_hint_faults_local",
 	"numa_pages_migrated",
+	"numa_pages_replicated",
+	"numa_promote_prefetch",
+	"numa_promote_prefetch_hit",
+	"pgtable_migrate",
 #endif
 #ifdef CONFIG_MIGRATION
 	"pgmigrate_success",
 	"pgmigrate_fail",
+	"pgmigrate_throttle",
+	"pgdemote",
+	"pgmigrate_skip_rank",
+	"pgmigrate_pingpong",
+	"pgmigrate_zero_page",
+	"pgmigrate_same_filled",
+	"pgmigrate_shadow_keep",
+	"pgmigrate_shadow_hit",
+	"pgmigrate_split_promote",
+	"pgmigrate_promote_collapse",
+	"pgmigrate_page_cache_promote",
+	"pgmigrate_concur_waited",
 #endif
+	"pgcopy_mt_inline",
+	"pgcopy_mt_dispatched",
+	"pgexchange_split",
+	"pgexchange_swap_mappings",
+	"pgmigrate_early_pinned",
+	"pgmigrate_early_writeback",
+	"pgmigrate_quiesced",
+	"pgalloc_cold_site",
 #ifdef CONFIG_COMPACTION
 	"compact_migrate_scanned",
 	"compact_free_scanned",
@@ -1258,10 +1284,12 @@ const char * const vmstat_text[] = {
 	"thp_collapse_alloc_failed",
 	"thp_file_alloc",
 	"thp_file_mapped",
+	"thp_dax_extent_fallback",
 	"thp_split_page",
 	"thp_split_page_failed",
 	"thp_deferred_split_page",
 	"thp_split_pmd",
+	"thp_remap_pmd",
 #ifdef CONFIG_HAVE_ARCH_TRANSPARENT_HUGEPAGE_PUD
 	"thp_split_pud",
 #endif
@@ -1291,6 +1319,7 @@ const char * const vmstat_text[] = {
 #ifdef CONFIG_SWAP
 	"swap_ra",
 	"swap_ra_hit",
+	"swpin_slow_tier",
 #endif
 #endif /* CONFIG_VM_EVENT_COUNTERS || CONFIG_MEMCG */
 };
@@ -1632,6 +1661,13 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 		   "\n  start_pfn:           %lu",
 		   pgdat->kswapd_failures >= MAX_RECLAIM_RETRIES,
 		   zone->zone_start_pfn);
+#ifdef CONFIG_COMPACTION
+	seq_printf(m,
+		   "\n  compact_batch_pages: %u"
+		   "\n  compact_block_yield: %u",
+		   zone->compact_batch_pages,
+		   zone->compact_block_yield);
+#endif
 	seq_putc(m, '\n');
 }
 
@@ -1663,12 +1699,19 @@ static const struct seq_operations zoneinfo_op = {
 			 (IS_ENABLED(CONFIG_VM_EVENT_COUNTERS) ? \
 			  NR_VM_EVENT_ITEMS : 0))
 
+#ifdef CONFIG_MIGRATION
+/* the per node pair migration counters follow the items */
+#define NR_VMSTAT_LINES	(NR_VMSTAT_ITEMS + 1)
+#else
+#define NR_VMSTAT_LINES	NR_VMSTAT_ITEMS
+#endif
+
 static void *vmstat_start(struct seq_file *m, loff_t *pos)
 {
 	unsigned long *v;
 	int i;
 
-	if (*pos >= NR_VMSTAT_ITEMS)
+	if (*pos >= NR_VMSTAT_LINES)
 		return NULL;
 
 	BUILD_BUG_ON(ARRAY_SIZE(vmstat_text) < NR_VMSTAT_ITEMS);
@@ -1705,7 +1748,7 @@ static void *vmstat_start(struct seq_file *m, loff_t *pos)
 static void *vmstat_next(struct seq_file *m, void *arg, loff_t *pos)
 {
 	(*pos)++;
-	if (*pos >= NR_VMSTAT_ITEMS)
+	if (*pos >= NR_VMSTAT_LINES)
 		return NULL;
 	return (unsigned long *)m->private + *pos;
 }
@@ -1715,6 +1758,13 @@ static int vmstat_show(struct seq_file *m, void *arg)
 	unsigned long *l = arg;
 	unsigned long off = l - (unsigned long *)m->private;
 
+#ifdef CONFIG_MIGRATION
+	if (off == NR_VMSTAT_ITEMS) {
+		migrate_stat_show_vmstat(m);
+		return 0;
+	}
+#endif
+
 	seq_puts(m, vmstat_text[off]);
 	seq_put_decimal_ull(m, " ", *l);
 	seq_putc(m, '\n');
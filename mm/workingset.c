@@ -15,6 +15,7 @@
 #include <linux/dax.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/migrate_history.h>
 
 /*
  *		Double CLOCK lists
@@ -388,6 +389,93 @@ void workingset_activation(struct page *page)
 	rcu_read_unlock();
 }
 
+/*
+ *		Demotion refaults
+ *
+ * On a tiered system reclaim of a fast tier node demotes pages to a slow
+ * tier node instead of evicting them, and a page that was demoted too
+ * early never refaults: it is just accessed on the slow node. A demotion
+ * therefore ages the inactive list of the node like an eviction does, and
+ * leaves a shadow entry in the page_ext of the demoted page. The first
+ * NUMA hinting fault on the page takes the entry, and if its refault
+ * distance fits in the active lists of the node it was demoted from,
+ * the page would have stayed there with a little more room. It is then
+ * promoted without going through the hot page filters.
+ *
+ * These demotion refaults are counted in WORKINGSET_DEMOTE_REFAULT of
+ * the memcg lruvec the page was demoted from, and reclaim of that lruvec ages
+ * its active anon list while they come in, so that the stale active pages
+ * get demoted rather than more of the workingset.
+ */
+
+/**
+ * workingset_demotion - note the demotion of a page to a slow tier node
+ * @page: the page being demoted, isolated
+ * @newpage: the slow tier page it is migrated to
+ */
+void workingset_demotion(struct page *page, struct page *newpage)
+{
+	struct pglist_data *pgdat = page_pgdat(page);
+	struct mem_cgroup *memcg = page_memcg(page);
+	struct lruvec *lruvec;
+	unsigned long eviction;
+	int memcgid;
+
+	/* the isolated page pins page->mem_cgroup */
+	advance_inactive_age(memcg, pgdat);
+
+	lruvec = mem_cgroup_lruvec(memcg, pgdat);
+	/* memcg is NULL with memcg disabled, go through the lruvec */
+	memcgid = mem_cgroup_id(lruvec_memcg(lruvec));
+	eviction = atomic_long_read(&lruvec->inactive_age);
+	page_migrate_history_set_demotion(newpage,
+			pack_shadow(memcgid, pgdat, eviction, PageWorkingset(page)));
+}
+
+/**
+ * workingset_demotion_refault - evaluate the access to a demoted page
+ * @page: the page accessed on a slow tier node
+ *
+ * Returns true if @page was demoted recently enough to belong in the
+ * workingset of the node it was demoted from.
+ */
+bool workingset_demotion_refault(struct page *page)
+{
+	struct lruvec *eviction_lruvec;
+	unsigned long refault_distance;
+	struct mem_cgroup *memcg;
+	struct pglist_data *pgdat;
+	unsigned long eviction;
+	unsigned long active;
+	bool workingset, ret = false;
+	void *shadow;
+	int memcgid;
+
+	shadow = page_migrate_history_take_demotion(page);
+	if (!shadow)
+		return false;
+
+	unpack_shadow(shadow, &memcgid, &pgdat, &eviction, &workingset);
+
+	rcu_read_lock();
+	memcg = mem_cgroup_from_id(memcgid);
+	if (!mem_cgroup_disabled() && !memcg)
+		goto out;
+	eviction_lruvec = mem_cgroup_lruvec(memcg, pgdat);
+	refault_distance = (atomic_long_read(&eviction_lruvec->inactive_age) -
+			    eviction) & EVICTION_MASK;
+	active = lruvec_page_state(eviction_lruvec, NR_ACTIVE_ANON) +
+		lruvec_page_state(eviction_lruvec, NR_ACTIVE_FILE);
+
+	if (refault_distance <= active) {
+		inc_lruvec_state(eviction_lruvec, WORKINGSET_DEMOTE_REFAULT);
+		ret = true;
+	}
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
 /*
  * Shadow entries reflect the share of the working set that does not
  * fit into memory, so their number depends on the access pattern of
@@ -159,6 +159,7 @@ struct z3fold_pool {
 	struct list_head lru;
 	struct list_head stale;
 	atomic64_t pages_nr;
+	int nid;		/* node of the pages, NUMA_NO_NODE for any */
 	struct kmem_cache *c_handle;
 	const struct z3fold_ops *ops;
 	struct zpool *zpool;
@@ -1002,6 +1003,7 @@ static struct z3fold_pool *z3fold_create_pool(const char *name, gfp_t gfp,
 		goto out_c;
 	spin_lock_init(&pool->lock);
 	spin_lock_init(&pool->stale_lock);
+	pool->nid = NUMA_NO_NODE;
 	pool->unbuddied = __alloc_percpu(sizeof(struct list_head)*NCHUNKS, 2);
 	if (!pool->unbuddied)
 		goto out_pool;
@@ -1151,8 +1153,14 @@ static int z3fold_alloc(struct z3fold_pool *pool, size_t size, gfp_t gfp,
 			spin_unlock(&pool->stale_lock);
 		}
 	}
-	if (!page)
-		page = alloc_page(gfp);
+	if (!page) {
+		int nid = READ_ONCE(pool->nid);
+
+		if (nid == NUMA_NO_NODE)
+			page = alloc_page(gfp);
+		else
+			page = alloc_pages_node(nid, gfp | __GFP_THISNODE, 0);
+	}
 
 	if (!page)
 		return -ENOMEM;
@@ -1772,6 +1780,11 @@ static u64 z3fold_zpool_total_size(void *pool)
 	return z3fold_get_pool_size(pool) * PAGE_SIZE;
 }
 
+static void z3fold_zpool_set_node(void *pool, int nid)
+{
+	WRITE_ONCE(((struct z3fold_pool *)pool)->nid, nid);
+}
+
 static struct zpool_driver z3fold_zpool_driver = {
 	.type =		"z3fold",
 	.owner =	THIS_MODULE,
@@ -1783,6 +1796,7 @@ static struct zpool_driver z3fold_zpool_driver = {
 	.map =		z3fold_zpool_map,
 	.unmap =	z3fold_zpool_unmap,
 	.total_size =	z3fold_zpool_total_size,
+	.set_node =	z3fold_zpool_set_node,
 };
 
 MODULE_ALIAS("zpool-z3fold");
@@ -375,6 +375,27 @@ u64 zpool_get_total_size(struct zpool *zpool)
 	return zpool->driver->total_size(zpool->pool);
 }
 
+/**
+ * zpool_set_node() - Set the memory node of the pool pages
+ * @zpool:	The zpool to place
+ * @nid:	The node, NUMA_NO_NODE for no node
+ *
+ * This makes the pool allocate the pages it grows by from @nid only,
+ * failing the allocations when @nid is full. The pages the pool already
+ * holds stay where they are.
+ *
+ * Returns: 0 on success, -EOPNOTSUPP if the implementation cannot place
+ * its pages.
+ */
+int zpool_set_node(struct zpool *zpool, int nid)
+{
+	if (!zpool->driver->set_node)
+		return -EOPNOTSUPP;
+
+	zpool->driver->set_node(zpool->pool, nid);
+	return 0;
+}
+
 /**
  * zpool_evictable() - Test if zpool is potentially evictable
  * @zpool:	The zpool to test
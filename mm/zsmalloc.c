@@ -257,6 +257,8 @@ struct zs_pool {
 	struct kmem_cache *zspage_cachep;
 
 	atomic_long_t pages_allocated;
+	/* node of the zspage pages, NUMA_NO_NODE for any */
+	int nid;
 
 	struct zs_pool_stats stats;
 
@@ -442,6 +444,11 @@ static u64 zs_zpool_total_size(void *pool)
 	return zs_get_total_pages(pool) << PAGE_SHIFT;
 }
 
+static void zs_zpool_set_node(void *pool, int nid)
+{
+	WRITE_ONCE(((struct zs_pool *)pool)->nid, nid);
+}
+
 static struct zpool_driver zs_zpool_driver = {
 	.type =			  "zsmalloc",
 	.owner =		  THIS_MODULE,
@@ -453,6 +460,7 @@ static struct zpool_driver zs_zpool_driver = {
 	.map =			  zs_zpool_map,
 	.unmap =		  zs_zpool_unmap,
 	.total_size =		  zs_zpool_total_size,
+	.set_node =		  zs_zpool_set_node,
 };
 
 MODULE_ALIAS("zpool-zsmalloc");
@@ -1057,6 +1065,16 @@ static void create_page_chain(struct size_class *class, struct zspage *zspage,
 	}
 }
 
+static struct page *zs_alloc_page(struct zs_pool *pool, gfp_t gfp)
+{
+	int nid = READ_ONCE(pool->nid);
+
+	if (nid == NUMA_NO_NODE)
+		return alloc_page(gfp);
+
+	return alloc_pages_node(nid, gfp | __GFP_THISNODE, 0);
+}
+
 /*
  * Allocate a zspage for the given size class
  */
@@ -1078,7 +1096,7 @@ static struct zspage *alloc_zspage(struct zs_pool *pool,
 	for (i = 0; i < class->pages_per_zspage; i++) {
 		struct page *page;
 
-		page = alloc_page(gfp);
+		page = zs_alloc_page(pool, gfp);
 		if (!page) {
 			while (--i >= 0) {
 				dec_zone_page_state(pages[i], NR_ZSPAGES);
@@ -2409,6 +2427,7 @@ struct zs_pool *zs_create_pool(const char *name)
 		return NULL;
 
 	init_deferred_free(pool);
+	pool->nid = NUMA_NO_NODE;
 
 	pool->name = kstrdup(name, GFP_KERNEL);
 	if (!pool->name)
@@ -111,6 +111,19 @@ static struct kernel_param_ops zswap_zpool_param_ops = {
 };
 module_param_cb(zpool, &zswap_zpool_param_ops, &zswap_zpool_type, 0644);
 
+/*
+ * Memory node of the compressed pool pages, e.g. a PMEM node, NUMA_NO_NODE
+ * (the default) for the node of the allocating task. The pages are only
+ * taken from that node and stored to with streaming stores.
+ */
+static int zswap_node = NUMA_NO_NODE;
+static int zswap_node_param_set(const char *, const struct kernel_param *);
+static struct kernel_param_ops zswap_node_param_ops = {
+	.set =		zswap_node_param_set,
+	.get =		param_get_int,
+};
+module_param_cb(node, &zswap_node_param_ops, &zswap_node, 0644);
+
 /* The maximum percentage of memory that the compressed pool can occupy */
 static unsigned int zswap_max_pool_percent = 20;
 module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
@@ -562,6 +575,11 @@ static struct zswap_pool *zswap_pool_create(char *type, char *compressor)
 	}
 	pr_debug("using %s zpool\n", zpool_get_type(pool->zpool));
 
+	if (zswap_node != NUMA_NO_NODE &&
+	    zpool_set_node(pool->zpool, zswap_node))
+		pr_warn("%s zpool cannot be placed on node %d\n", type,
+			zswap_node);
+
 	strlcpy(pool->tfm_name, compressor, sizeof(pool->tfm_name));
 	pool->tfm = alloc_percpu(struct crypto_comp *);
 	if (!pool->tfm) {
@@ -801,6 +819,29 @@ static int zswap_zpool_param_set(const char *val,
 	return __zswap_param_set(val, kp, NULL, zswap_compressor);
 }
 
+static int zswap_node_param_set(const char *val,
+				const struct kernel_param *kp)
+{
+	struct zswap_pool *pool;
+	int nid, ret;
+
+	ret = kstrtoint(val, 0, &nid);
+	if (ret)
+		return ret;
+	if (nid != NUMA_NO_NODE &&
+	    (nid < 0 || nid >= MAX_NUMNODES || !node_state(nid, N_MEMORY)))
+		return -EINVAL;
+
+	spin_lock(&zswap_pools_lock);
+	zswap_node = nid;
+	/* the pages already stored stay where they are */
+	list_for_each_entry(pool, &zswap_pools, list)
+		zpool_set_node(pool->zpool, nid);
+	spin_unlock(&zswap_pools_lock);
+
+	return 0;
+}
+
 static int zswap_enabled_param_set(const char *val,
 				   const struct kernel_param *kp)
 {
@@ -1101,7 +1142,14 @@ static int zswap_frontswap_store(unsigned type, pgoff_t offset,
 	}
 	buf = zpool_map_handle(entry->pool->zpool, handle, ZPOOL_MM_RW);
 	memcpy(buf, &zhdr, hlen);
-	memcpy(buf + hlen, dst, dlen);
+	if (READ_ONCE(zswap_node) != NUMA_NO_NODE) {
+		/* nothing reads the object until it is loaded */
+		memcpy_flushcache(buf + hlen, dst, dlen);
+		/* streaming stores are weakly ordered */
+		wmb();
+	} else {
+		memcpy(buf + hlen, dst, dlen);
+	}
 	zpool_unmap_handle(entry->pool->zpool, handle);
 	put_cpu_var(zswap_dstmem);
 
@@ -0,0 +1,262 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <linux/types.h>
+#include <linux/migrate_record.h>
+
+#define MB (1UL << 20)
+#define PAGE_SIZE sysconf(_SC_PAGESIZE)
+#define THP_ORDER 9
+
+#define MIGRATE_BENCHMARK	_IOWR('m', 1, struct migrate_benchmark)
+
+/* Copied from mm/migrate_benchmark.c */
+enum {
+	MIGRATE_BENCH_COPY_MT,
+	MIGRATE_BENCH_COPY_LISTS_MT,
+	MIGRATE_BENCH_COPY_DMA,
+	MIGRATE_BENCH_EXCHANGE_LISTS_MT,
+	MIGRATE_BENCH_MIGRATE_CONCUR,
+	MIGRATE_BENCH_REPLAY,
+	NR_MIGRATE_BENCH_ENGINES,
+};
+
+#define MIGRATE_BENCH_MT	0x1
+#define MIGRATE_BENCH_DMA	0x2
+
+struct migrate_benchmark {
+	__u32 engine;
+	__u32 src_nid;
+	__u32 dst_nid;
+	__u32 order;
+	__u32 nr_pages;
+	__u32 nr_runs;
+	__s32 nr_threads;
+	__s32 nt;
+	__s32 rpdaa;
+	__u32 flags;
+	__u64 addr;
+	__u64 size;
+	__u64 bytes;
+	__u64 delta_nsec;
+	__u64 mbps;
+	__u64 lat_p50_nsec;
+	__u64 lat_p90_nsec;
+	__u64 lat_p99_nsec;
+	__u64 lat_max_nsec;
+	__u64 expansion[8];	/* For future use */
+};
+
+static const char * const engine_names[NR_MIGRATE_BENCH_ENGINES] = {
+	"copy_mt", "copy_lists_mt", "copy_dma", "exchange_lists_mt",
+	"migrate_concur", "replay",
+};
+
+static int run(int fd, struct migrate_benchmark *mb)
+{
+	if (ioctl(fd, MIGRATE_BENCHMARK, mb)) {
+		fprintf(stderr, "%s threads=%d nt=%d rpdaa=%d order=%u batch=%u: ",
+			engine_names[mb->engine], mb->nr_threads, mb->nt,
+			mb->rpdaa, mb->order, mb->nr_pages);
+		perror("ioctl");
+		return 1;
+	}
+
+	printf("%-17s %2u->%-2u threads=%-2d nt=%-2d rpdaa=%-2d order=%u batch=%-4u "
+	       "%8.2f GB/s p50=%llu p90=%llu p99=%llu max=%llu ns/page\n",
+	       engine_names[mb->engine], mb->src_nid, mb->dst_nid,
+	       mb->nr_threads, mb->nt, mb->rpdaa, mb->order, mb->nr_pages,
+	       mb->delta_nsec ? (double)mb->bytes / mb->delta_nsec : 0.0,
+	       mb->lat_p50_nsec, mb->lat_p90_nsec, mb->lat_p99_nsec,
+	       mb->lat_max_nsec);
+	return 0;
+}
+
+static int record_cmp(const void *a, const void *b)
+{
+	const struct migrate_record *x = a, *y = b;
+
+	return x->time_ns < y->time_ns ? -1 : x->time_ns > y->time_ns;
+}
+
+/*
+ * Load a trace, the per-CPU files of /sys/kernel/debug/migrate_record/
+ * concatenated, and merge its records by time.
+ */
+static int load_trace(const char *path, struct migrate_benchmark *mb)
+{
+	struct migrate_record *recs;
+	struct stat st;
+	size_t nr, rd = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		perror(path);
+		return -1;
+	}
+	if (fstat(fd, &st)) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+
+	nr = st.st_size / sizeof(*recs);
+	recs = malloc(nr * sizeof(*recs) + 1);
+	if (!recs) {
+		perror("malloc");
+		close(fd);
+		return -1;
+	}
+
+	while (rd < nr * sizeof(*recs)) {
+		ret = read(fd, (char *)recs + rd, nr * sizeof(*recs) - rd);
+		if (ret <= 0) {
+			perror("read");
+			close(fd);
+			return -1;
+		}
+		rd += ret;
+	}
+	close(fd);
+
+	qsort(recs, nr, sizeof(*recs), record_cmp);
+	mb->addr = (unsigned long)recs;
+	mb->size = nr * sizeof(*recs);
+	mb->nr_pages = nr;
+	return 0;
+}
+
+/* Every thread count, NT and RPDAA mode, page order and batch size */
+static int sweep(int fd, struct migrate_benchmark *mb)
+{
+	static const int threads[] = { 1, 2, 4, 8, 16 };
+	static const int batches[] = { 1, 16, 64, 256 };
+	int t, nt, rpdaa, order, b, ret = 0;
+
+	for (order = 0; order <= THP_ORDER; order += THP_ORDER)
+		for (b = 0; b < sizeof(batches) / sizeof(batches[0]); b++)
+			for (t = 0; t < sizeof(threads) / sizeof(threads[0]); t++)
+				for (nt = 0; nt < 2; nt++)
+					for (rpdaa = 0; rpdaa < 2; rpdaa++) {
+						mb->order = order;
+						mb->nr_pages = batches[b];
+						mb->nr_threads = threads[t];
+						mb->nt = nt;
+						mb->rpdaa = rpdaa;
+						ret |= run(fd, mb);
+					}
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct migrate_benchmark mb;
+	unsigned long size = 128 * MB;
+	int fd, opt, all = 0;
+	char *trace = NULL;
+	char *p;
+
+	memset(&mb, 0, sizeof(mb));
+	mb.engine = MIGRATE_BENCH_COPY_LISTS_MT;
+	mb.dst_nid = 1;
+	mb.nr_pages = 64;
+	mb.nr_runs = 16;
+	mb.nr_threads = -1;
+	mb.nt = -1;
+	mb.rpdaa = -1;
+
+	while ((opt = getopt(argc, argv, "e:s:d:n:r:t:N:R:m:f:HMDa")) != -1) {
+		switch (opt) {
+		case 'e':
+			mb.engine = atoi(optarg);
+			break;
+		case 's':
+			mb.src_nid = atoi(optarg);
+			break;
+		case 'd':
+			mb.dst_nid = atoi(optarg);
+			break;
+		case 'n':
+			mb.nr_pages = atoi(optarg);
+			break;
+		case 'r':
+			mb.nr_runs = atoi(optarg);
+			break;
+		case 't':
+			mb.nr_threads = atoi(optarg);
+			break;
+		case 'N':
+			mb.nt = atoi(optarg);
+			break;
+		case 'R':
+			mb.rpdaa = atoi(optarg);
+			break;
+		case 'm':
+			size = atoi(optarg) * MB;
+			break;
+		case 'f':
+			trace = optarg;
+			mb.engine = MIGRATE_BENCH_REPLAY;
+			break;
+		case 'H':
+			mb.order = THP_ORDER;
+			break;
+		case 'M':
+			mb.flags |= MIGRATE_BENCH_MT;
+			break;
+		case 'D':
+			mb.flags |= MIGRATE_BENCH_DMA;
+			break;
+		case 'a':
+			all = 1;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (mb.engine >= NR_MIGRATE_BENCH_ENGINES) {
+		fprintf(stderr, "engine: 0 copy_mt, 1 copy_lists_mt, 2 copy_dma, "
+			"3 exchange_lists_mt, 4 migrate_concur, 5 replay\n");
+		return -1;
+	}
+
+	if (mb.engine == MIGRATE_BENCH_REPLAY && (!trace || load_trace(trace, &mb))) {
+		fprintf(stderr, "replay: -f trace file\n");
+		return -1;
+	}
+
+	fd = open("/sys/kernel/debug/migrate_benchmark", O_RDWR);
+	if (fd == -1) {
+		perror("open");
+		exit(1);
+	}
+
+	if (mb.engine == MIGRATE_BENCH_MIGRATE_CONCUR) {
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		if (p == MAP_FAILED) {
+			perror("mmap");
+			exit(1);
+		}
+		madvise(p, size, mb.order ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+		memset(p, 0x5a, size);
+		mb.addr = (unsigned long)p;
+		mb.size = size;
+		mb.nr_pages = size / PAGE_SIZE;
+		return run(fd, &mb);
+	}
+
+	return all ? sweep(fd, &mb) : run(fd, &mb);
+}
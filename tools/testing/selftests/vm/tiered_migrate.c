@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Regression test and benchmark of the tiered memory migration paths:
+ * move_pages() with the MPOL_MF_MOVE_MT, MPOL_MF_MOVE_CONCUR and
+ * MPOL_MF_COPY_* flags, exchange_pages() and mm_manage(). Every run moves
+ * a buffer between two memory nodes, checks with move_pages() that the
+ * pages landed where they should, checks that their contents survived
+ * and prints the throughput.
+ *
+ * The source and destination nodes default to 0 and 1, which may be a
+ * DRAM and a PMEM node or two emulated nodes (numa=fake=2). The test is
+ * skipped on machines with a single memory node.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "../kselftest.h"
+
+#ifndef __NR_exchange_pages
+#define __NR_exchange_pages	439
+#endif
+#ifndef __NR_mm_manage
+#define __NR_mm_manage		440
+#endif
+
+/* Copied from include/uapi/linux/mempolicy.h */
+#define MPOL_BIND		2
+#define MPOL_MF_MOVE		(1 << 1)
+#define MPOL_MF_MOVE_MT		(1 << 6)
+#define MPOL_MF_MOVE_CONCUR	(1 << 7)
+#define MPOL_MF_EXCHANGE	(1 << 8)
+#define MPOL_MF_COPY_NT		(1 << 10)
+#define MPOL_MF_COPY_NO_NT	(1 << 11)
+#define MPOL_MF_COPY_RPDAA	(1 << 12)
+#define MPOL_MF_COPY_NO_RPDAA	(1 << 13)
+#define MPOL_MF_COPY_THREADS(n)	((n) << 16)
+
+#define MB (1UL << 20)
+
+struct config {
+	const char *name;
+	int flags;
+};
+
+static const struct config move_configs[] = {
+	{ "single",		0 },
+	{ "mt",			MPOL_MF_MOVE_MT },
+	{ "mt,4 threads",	MPOL_MF_MOVE_MT | MPOL_MF_COPY_THREADS(4) },
+	{ "mt,nt",		MPOL_MF_MOVE_MT | MPOL_MF_COPY_NT },
+	{ "mt,no nt",		MPOL_MF_MOVE_MT | MPOL_MF_COPY_NO_NT },
+	{ "mt,rpdaa",		MPOL_MF_MOVE_MT | MPOL_MF_COPY_RPDAA },
+	{ "mt,no rpdaa",	MPOL_MF_MOVE_MT | MPOL_MF_COPY_NO_RPDAA },
+	{ "concur",		MPOL_MF_MOVE_CONCUR },
+	{ "concur,mt",		MPOL_MF_MOVE_CONCUR | MPOL_MF_MOVE_MT },
+	{ "concur,mt,nt,rpdaa",	MPOL_MF_MOVE_CONCUR | MPOL_MF_MOVE_MT |
+				MPOL_MF_COPY_NT | MPOL_MF_COPY_RPDAA },
+};
+
+static const struct config exchange_configs[] = {
+	{ "single",		0 },
+	{ "mt",			MPOL_MF_MOVE_MT },
+	{ "concur",		MPOL_MF_MOVE_CONCUR },
+	{ "concur,mt",		MPOL_MF_MOVE_CONCUR | MPOL_MF_MOVE_MT },
+	{ "concur,mt,nt",	MPOL_MF_MOVE_CONCUR | MPOL_MF_MOVE_MT |
+				MPOL_MF_COPY_NT },
+};
+
+static const struct config manage_configs[] = {
+	{ "mt",			MPOL_MF_MOVE | MPOL_MF_MOVE_MT },
+	{ "concur,mt",		MPOL_MF_MOVE | MPOL_MF_MOVE_CONCUR |
+				MPOL_MF_MOVE_MT },
+	{ "exchange,mt",	MPOL_MF_MOVE | MPOL_MF_EXCHANGE |
+				MPOL_MF_MOVE_MT },
+};
+
+#define NR_CONFIGS(c)	(sizeof(c) / sizeof((c)[0]))
+
+static unsigned long page_size;
+static unsigned long nr_pages;
+static int src_nid, dst_nid;
+static int nr_runs = 3;
+static int failed;
+
+static void **pages_a, **pages_b;
+static int *nodes, *status;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long move_pages(void **pages, const int *nodes, int *status, int flags)
+{
+	return syscall(__NR_move_pages, 0, nr_pages, pages, nodes, status,
+		       flags);
+}
+
+static long exchange_pages(void **from, void **to, int *status, int flags)
+{
+	return syscall(__NR_exchange_pages, 0, nr_pages, from, to, status,
+		       flags);
+}
+
+static long mm_manage(unsigned long nr, int old_nid, int new_nid, int flags)
+{
+	unsigned long old_nodes = 1UL << old_nid;
+	unsigned long new_nodes = 1UL << new_nid;
+
+	return syscall(__NR_mm_manage, 0, nr, sizeof(old_nodes) * 8 + 1,
+		       &old_nodes, &new_nodes, flags);
+}
+
+static long mbind(void *addr, unsigned long len, int nid)
+{
+	unsigned long mask = 1UL << nid;
+
+	return syscall(__NR_mbind, addr, len, MPOL_BIND, &mask,
+		       sizeof(mask) * 8 + 1, MPOL_MF_MOVE);
+}
+
+/* A word per cache line that tells which page of which buffer it is in */
+static void fill(void **pages, unsigned long tag)
+{
+	unsigned long i, off;
+
+	for (i = 0; i < nr_pages; i++)
+		for (off = 0; off < page_size; off += 64)
+			*(unsigned long *)((char *)pages[i] + off) =
+				tag ^ (i << 20) ^ off;
+}
+
+static int check_data(void **pages, unsigned long tag)
+{
+	unsigned long i, off;
+
+	for (i = 0; i < nr_pages; i++)
+		for (off = 0; off < page_size; off += 64)
+			if (*(unsigned long *)((char *)pages[i] + off) !=
+			    (tag ^ (i << 20) ^ off)) {
+				printf("  page %lu offset %lu corrupted\n", i, off);
+				return -1;
+			}
+
+	return 0;
+}
+
+/* Number of pages that are not on @nid */
+static unsigned long count_misplaced(void **pages, int nid)
+{
+	unsigned long i, misplaced = 0;
+
+	if (move_pages(pages, NULL, status, 0)) {
+		perror("move_pages query");
+		return nr_pages;
+	}
+
+	for (i = 0; i < nr_pages; i++)
+		if (status[i] != nid)
+			misplaced++;
+
+	return misplaced;
+}
+
+static void report(const char *syscall, const char *name, int run,
+		   double secs, unsigned long bytes, unsigned long misplaced,
+		   int corrupted)
+{
+	printf("%-14s %-20s run %d: %8.2f GB/s misplaced %lu%s\n",
+	       syscall, name, run, bytes / secs / 1e9, misplaced,
+	       corrupted ? " CORRUPTED" : "");
+
+	if (misplaced || corrupted)
+		failed = 1;
+}
+
+static void move_with(int nid, void **pages, int flags)
+{
+	unsigned long i;
+
+	for (i = 0; i < nr_pages; i++)
+		nodes[i] = nid;
+
+	if (move_pages(pages, nodes, status, MPOL_MF_MOVE | flags) < 0)
+		perror("move_pages");
+}
+
+static void test_move_pages(const struct config *c)
+{
+	unsigned long tag = (unsigned long)c;
+	int run, nid;
+	double t;
+
+	move_with(src_nid, pages_a, 0);
+	fill(pages_a, tag);
+
+	for (run = 0; run < nr_runs; run++) {
+		nid = run & 1 ? src_nid : dst_nid;
+
+		t = now();
+		move_with(nid, pages_a, c->flags);
+		t = now() - t;
+
+		report("move_pages", c->name, run, t, nr_pages * page_size,
+		       count_misplaced(pages_a, nid), check_data(pages_a, tag));
+	}
+}
+
+static void test_exchange_pages(const struct config *c)
+{
+	unsigned long tag = (unsigned long)c;
+	unsigned long misplaced;
+	int run, a_nid;
+	double t;
+
+	move_with(src_nid, pages_a, 0);
+	move_with(dst_nid, pages_b, 0);
+	fill(pages_a, tag);
+	fill(pages_b, ~tag);
+
+	for (run = 0; run < nr_runs; run++) {
+		t = now();
+		if (exchange_pages(pages_a, pages_b, status, c->flags) < 0) {
+			if (errno == ENOSYS) {
+				printf("exchange_pages: not supported, skipped\n");
+				return;
+			}
+			perror("exchange_pages");
+		}
+		t = now() - t;
+
+		/* the contents stay at their addresses, the nodes swap */
+		a_nid = run & 1 ? src_nid : dst_nid;
+		misplaced = count_misplaced(pages_a, a_nid) +
+			count_misplaced(pages_b, a_nid == src_nid ?
+					dst_nid : src_nid);
+		report("exchange_pages", c->name, run, t,
+		       2 * nr_pages * page_size, misplaced,
+		       check_data(pages_a, tag) || check_data(pages_b, ~tag));
+	}
+}
+
+static void test_mm_manage(const struct config *c)
+{
+	unsigned long tag = (unsigned long)c;
+	unsigned long moved;
+	double t;
+	long err;
+
+	move_with(src_nid, pages_a, 0);
+	fill(pages_a, tag);
+
+	t = now();
+	err = mm_manage(nr_pages, src_nid, dst_nid, c->flags);
+	t = now() - t;
+	if (err < 0) {
+		if (errno == ENOSYS) {
+			printf("mm_manage: not supported, skipped\n");
+			return;
+		}
+		perror("mm_manage");
+		failed = 1;
+	}
+
+	/*
+	 * mm_manage() picks the pages it promotes by their hotness, it does
+	 * not have to move all of them: only the data is checked.
+	 */
+	moved = nr_pages - count_misplaced(pages_a, dst_nid);
+	printf("%-14s %-20s run 0: %8.2f GB/s moved %lu/%lu%s\n",
+	       "mm_manage", c->name, moved * page_size / t / 1e9, moved,
+	       nr_pages, check_data(pages_a, tag) ? " CORRUPTED" : "");
+	if (check_data(pages_a, tag))
+		failed = 1;
+}
+
+static int node_online(int nid)
+{
+	char path[64];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", nid);
+	return !access(path, F_OK);
+}
+
+static void **map_pages(void)
+{
+	unsigned long size = nr_pages * page_size, i;
+	void **pages;
+	char *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	/* base pages, THP would be moved 512 entries at a time */
+	madvise(p, size, MADV_NOHUGEPAGE);
+	if (mbind(p, size, src_nid))
+		perror("mbind");
+	memset(p, 0, size);
+
+	pages = malloc(nr_pages * sizeof(*pages));
+	if (!pages) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i = 0; i < nr_pages; i++)
+		pages[i] = p + i * page_size;
+
+	return pages;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size = 64 * MB;
+	int opt, i;
+
+	src_nid = 0;
+	dst_nid = 1;
+
+	while ((opt = getopt(argc, argv, "s:d:m:r:")) != -1) {
+		switch (opt) {
+		case 's':
+			src_nid = atoi(optarg);
+			break;
+		case 'd':
+			dst_nid = atoi(optarg);
+			break;
+		case 'm':
+			size = atoi(optarg) * MB;
+			break;
+		case 'r':
+			nr_runs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s src node] [-d dst node] "
+				"[-m MB] [-r runs]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (src_nid == dst_nid || !node_online(src_nid) ||
+	    !node_online(dst_nid)) {
+		printf("nodes %d and %d are not two memory nodes, skipped\n",
+		       src_nid, dst_nid);
+		return KSFT_SKIP;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	nr_pages = size / page_size;
+
+	pages_a = map_pages();
+	pages_b = map_pages();
+	nodes = malloc(nr_pages * sizeof(*nodes));
+	status = malloc(nr_pages * sizeof(*status));
+	if (!nodes || !status) {
+		perror("malloc");
+		return 1;
+	}
+
+	printf("%lu MB between nodes %d and %d\n", size / MB, src_nid, dst_nid);
+
+	for (i = 0; i < NR_CONFIGS(move_configs); i++)
+		test_move_pages(&move_configs[i]);
+	for (i = 0; i < NR_CONFIGS(exchange_configs); i++)
+		test_exchange_pages(&exchange_configs[i]);
+	for (i = 0; i < NR_CONFIGS(manage_configs); i++)
+		test_mm_manage(&manage_configs[i]);
+
+	return failed ? 1 : 0;
+}
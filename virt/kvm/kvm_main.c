@@ -731,6 +731,8 @@ static struct kvm *kvm_create_vm(unsigned long type)
 	r = kvm_init_mmu_notifier(kvm);
 	if (r)
 		goto out_err_no_mmu_notifier;
+	/* the page placement scanner samples guest memory at its own rate */
+	set_bit(MMF_KVM_GUEST, &kvm->mm->flags);
 
 	r = kvm_arch_post_init_vm(kvm);
 	if (r)